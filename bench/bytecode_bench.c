@@ -0,0 +1,106 @@
+/**
+ * Compares the bytecode interpreter against the machine code loaded with --run,
+ * build and run with "make bench". Getting to the first instruction and running
+ * main are timed separately, the best of a few runs counts. Both have to return
+ * the same value so a wrong translation shows up here too.
+ */
+#include "compiler.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RUNS 3
+
+static const char *kernels[] = {"matmul", "sieve", "fib", "hash", "sort", "sum", "copy"};
+
+static double now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static int stdout_saved = -1;
+
+/**
+ * The kernels print their results, that isn't what is measured
+ */
+static void quiet(bool on)
+{
+    fflush(stdout);
+    if (on)
+    {
+        stdout_saved = dup(STDOUT_FILENO);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        close(null);
+        return;
+    }
+
+    dup2(stdout_saved, STDOUT_FILENO);
+    close(stdout_saved);
+}
+
+int main()
+{
+    char source[256];
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++)
+    {
+        snprintf(source, sizeof(source), "./bench/kernels/%s.c", kernels[i]);
+        double load[2] = {0, 0};
+        double run[2] = {0, 0};
+        int results[2] = {0, 0};
+        for (int r = 0; r < RUNS; r++)
+        {
+            double start = now();
+            struct bytecode_program *program = compile_to_bytecode(source, COMPILE_PROCESS_FLAGS_O2);
+            struct bytecode_function *entry = program ? bytecode_find(program, "main") : NULL;
+            double elapsed = now() - start;
+            if (!entry)
+            {
+                printf("%s failed to translate\n", source);
+                return 1;
+            }
+            load[0] = r == 0 || elapsed < load[0] ? elapsed : load[0];
+
+            quiet(true);
+            start = now();
+            results[0] = bytecode_call(program, entry, NULL, 0);
+            elapsed = now() - start;
+            quiet(false);
+            run[0] = r == 0 || elapsed < run[0] ? elapsed : run[0];
+            bytecode_free(program);
+
+            start = now();
+            struct jit *jit = compile_to_memory(source, COMPILE_PROCESS_FLAGS_O2);
+            int (*native)() = jit ? (int (*)())jit_symbol(jit, "main") : NULL;
+            elapsed = now() - start;
+            if (!native)
+            {
+                printf("%s failed to load\n", source);
+                return 1;
+            }
+            load[1] = r == 0 || elapsed < load[1] ? elapsed : load[1];
+
+            quiet(true);
+            start = now();
+            results[1] = native();
+            elapsed = now() - start;
+            quiet(false);
+            run[1] = r == 0 || elapsed < run[1] ? elapsed : run[1];
+            jit_free(jit);
+        }
+
+        if (results[0] != results[1])
+        {
+            printf("%s returned %d in bytecode and %d in machine code\n", kernels[i], results[0], results[1]);
+            return 1;
+        }
+
+        printf("%-8s bytecode start %6.0f us  run %8.2f ms   machine code start %6.0f us  run %8.2f ms   %.1fx slower\n", kernels[i], load[0] * 1e6,
+               run[0] * 1e3, load[1] * 1e6, run[1] * 1e3, run[0] / run[1]);
+    }
+    return 0;
+}
@@ -0,0 +1,115 @@
+/**
+ * Times incremental builds of a generated project after changes of different
+ * sizes, build and run with "make bench". Every unit includes a header shared by
+ * all of them and one of ten group headers, so changing a group header should
+ * cost a tenth of a full build and changing nothing close to nothing.
+ */
+#include "compiler.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define UNITS 100
+#define GROUPS 10
+#define DIRECTORY "/tmp/zeze_incremental_bench"
+#define STATE DIRECTORY "/state"
+
+static char *inputs[UNITS];
+
+static double now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static void write_file(const char *path, const char *text)
+{
+    FILE *out = fopen(path, "w");
+    fputs(text, out);
+    fclose(out);
+}
+
+static void write_group(int group, int value)
+{
+    char path[256];
+    char text[512];
+    snprintf(path, sizeof(path), DIRECTORY "/group%i.h", group);
+    snprintf(text, sizeof(text), "#pragma once\n#include \"common.h\"\n#define GROUP_VALUE %i\nstruct group%i { int a; long b; };\n", value, group);
+    write_file(path, text);
+}
+
+static void write_unit(int unit, int value)
+{
+    char text[1024];
+    snprintf(text, sizeof(text),
+             "#include \"group%i.h\"\n"
+             "int unit%i(int n) { int s = 0; for (int i = 0; i < n; i++) { if (i %% 3) { s += i * GROUP_VALUE; } else { s -= COMMON; } } return s + %i; }\n"
+             "int unit%i_b(int *p, int n) { int s = 0; while (n > 0) { s += p[n - 1] * %i; n--; } return s; }\n",
+             unit % GROUPS, unit, value, unit, value);
+    write_file(inputs[unit], text);
+}
+
+static double build(const char *what)
+{
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    freopen("/dev/null", "w", stdout);
+    double start = now();
+    int failed = incremental_build(STATE, inputs, UNITS, COMPILE_PROCESS_FLAGS_O2, false);
+    double elapsed = now() - start;
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    if (failed)
+    {
+        printf("%s: %i units failed\n", what, failed);
+        exit(1);
+    }
+
+    printf("%-24s %8.2f ms\n", what, elapsed * 1e3);
+    return elapsed;
+}
+
+int main()
+{
+    mkdir(DIRECTORY, 0755);
+    unlink(STATE);
+    write_file(DIRECTORY "/common.h", "#pragma once\n#define COMMON 5\nint printf(const char *format, ...);\n");
+    for (int group = 0; group < GROUPS; group++)
+    {
+        write_group(group, group);
+    }
+    for (int unit = 0; unit < UNITS; unit++)
+    {
+        char path[256];
+        snprintf(path, sizeof(path), DIRECTORY "/unit%i.c", unit);
+        inputs[unit] = strdup(path);
+        write_unit(unit, unit);
+    }
+
+    double full = build("full build");
+    build("nothing changed");
+
+    // a new mtime without new contents costs a hash, not a compile
+    for (int unit = 0; unit < UNITS; unit++)
+    {
+        utimensat(AT_FDCWD, inputs[unit], NULL, 0);
+    }
+    build("every source touched");
+
+    write_unit(42, 4242);
+    double one = build("one source changed");
+
+    write_group(3, 333);
+    double group = build("one group header changed");
+
+    write_file(DIRECTORY "/common.h", "#pragma once\n#define COMMON 6\nint printf(const char *format, ...);\n");
+    build("common header changed");
+
+    printf("one source %.1f%% and one group header %.1f%% of a full build\n", one / full * 100, group / full * 100);
+    return 0;
+}
@@ -0,0 +1,125 @@
+/**
+ * Compares the time it takes to get from a source file to a program that can
+ * run, build and run with "make bench". The assembly text and the object file
+ * still need gcc to link them, --run only loads the machine code into memory.
+ * The best of a few runs counts, the loaded main is called once so a broken
+ * relocation shows up here too.
+ */
+#include "compiler.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RUNS 5
+
+static const char *kernels[] = {"matmul", "sieve", "fib", "hash", "sort", "sum", "copy"};
+
+static double now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static void compile(const char *source, const char *output, int flags)
+{
+    if (compile_file(source, output, flags) != COMPILER_FILE_COMPILED_OK)
+    {
+        printf("%s failed to compile\n", source);
+        exit(1);
+    }
+}
+
+static void run_command(const char *command)
+{
+    if (system(command))
+    {
+        printf("%s failed\n", command);
+        exit(1);
+    }
+}
+
+static struct jit *load(const char *source)
+{
+    struct jit *jit = compile_to_memory(source, COMPILE_PROCESS_FLAGS_O2);
+    if (!jit || !jit_symbol(jit, "main"))
+    {
+        printf("%s failed to load\n", source);
+        exit(1);
+    }
+    return jit;
+}
+
+/**
+ * Calls the loaded main with its output thrown away
+ */
+static int run_loaded(struct jit *jit)
+{
+    int (*entry)() = (int (*)())jit_symbol(jit, "main");
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    close(null);
+    int res = entry();
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    return res;
+}
+
+int main()
+{
+    char source[256];
+    char assembly[256];
+    char object[256];
+    char command[1024];
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++)
+    {
+        snprintf(source, sizeof(source), "./bench/kernels/%s.c", kernels[i]);
+        snprintf(assembly, sizeof(assembly), "/tmp/zeze_bench_%s.s", kernels[i]);
+        snprintf(object, sizeof(object), "/tmp/zeze_bench_%s.o", kernels[i]);
+
+        double text = 0;
+        double linked = 0;
+        double memory = 0;
+        for (int run = 0; run < RUNS; run++)
+        {
+            double start = now();
+            compile(source, assembly, COMPILE_PROCESS_FLAGS_O2);
+            snprintf(command, sizeof(command), "gcc -o /tmp/zeze_bench_%s %s", kernels[i], assembly);
+            run_command(command);
+            double elapsed = now() - start;
+            text = run == 0 || elapsed < text ? elapsed : text;
+
+            start = now();
+            compile(source, object, COMPILE_PROCESS_FLAGS_O2 | COMPILE_PROCESS_FLAG_OBJECT);
+            snprintf(command, sizeof(command), "gcc -o /tmp/zeze_bench_%s %s", kernels[i], object);
+            run_command(command);
+            elapsed = now() - start;
+            linked = run == 0 || elapsed < linked ? elapsed : linked;
+
+            start = now();
+            struct jit *jit = load(source);
+            elapsed = now() - start;
+            memory = run == 0 || elapsed < memory ? elapsed : memory;
+            jit_free(jit);
+        }
+
+        snprintf(command, sizeof(command), "/tmp/zeze_bench_%s > /dev/null", kernels[i]);
+        int expected = system(command);
+        struct jit *jit = load(source);
+        int res = run_loaded(jit);
+        jit_free(jit);
+        if (!WIFEXITED(expected) || WEXITSTATUS(expected) != (res & 0xff))
+        {
+            printf("%s returned %d in memory\n", kernels[i], res);
+            exit(1);
+        }
+
+        printf("%-8s text+gcc %8.2f ms   object+gcc %8.2f ms   in memory %6.2f ms   %.0fx\n", kernels[i], text * 1e3, linked * 1e3, memory * 1e3, linked / memory);
+    }
+    return 0;
+}
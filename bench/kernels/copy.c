@@ -0,0 +1,48 @@
+int printf(const char *fmt, ...);
+int putchar(int c);
+
+char source[65536];
+char destination[65536];
+long words[8192];
+long copies[8192];
+
+void copy_bytes(char *to, char *from, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        to[i] = from[i];
+    }
+}
+
+void copy_words(long *to, long *from, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        to[i] = from[i];
+    }
+}
+
+int main()
+{
+    for (int i = 0; i < 65536; i++)
+    {
+        source[i] = i * 7;
+    }
+    for (int i = 0; i < 8192; i++)
+    {
+        words[i] = i * 31;
+    }
+
+    long check = 0;
+    for (int round = 0; round < 2000; round++)
+    {
+        source[round] = round;
+        words[round] = round;
+        copy_bytes(destination, source, 65536 - round);
+        copy_words(copies, words, 8192 - round);
+        check += destination[round * 3] + copies[round * 2];
+    }
+    printf("%ld", check);
+    putchar(10);
+    return 0;
+}
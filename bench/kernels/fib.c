@@ -0,0 +1,18 @@
+int printf(const char *fmt, ...);
+int putchar(int c);
+
+int fib(int n)
+{
+    if (n < 2)
+    {
+        return n;
+    }
+    return fib(n - 1) + fib(n - 2);
+}
+
+int main()
+{
+    printf("%d", fib(34));
+    putchar(10);
+    return 0;
+}
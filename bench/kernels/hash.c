@@ -0,0 +1,38 @@
+int printf(const char *fmt, ...);
+int putchar(int c);
+
+unsigned char data[65536];
+
+unsigned int mix(unsigned char *bytes, int length, unsigned int seed)
+{
+    unsigned int h1 = seed;
+    unsigned int h2 = seed ^ 2166136261;
+    unsigned int h3 = seed * 31;
+    unsigned int h4 = seed + 17;
+    for (int i = 0; i < length; i++)
+    {
+        unsigned int byte = bytes[i];
+        h1 = (h1 ^ byte) * 16777619;
+        h2 = (h2 + byte) * 2654435761;
+        h3 = (h3 << 5) + h3 + byte;
+        h4 = h4 ^ ((h4 << 7) | (h4 >> 25)) ^ byte;
+    }
+    return h1 ^ (h2 >> 3) ^ (h3 << 2) ^ h4;
+}
+
+int main()
+{
+    for (int i = 0; i < 65536; i++)
+    {
+        data[i] = i * 7 + (i >> 3);
+    }
+
+    unsigned int h = 0;
+    for (int round = 0; round < 1000; round++)
+    {
+        h = mix(data, 65536, h);
+    }
+    printf("%u", h);
+    putchar(10);
+    return 0;
+}
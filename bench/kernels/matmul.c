@@ -0,0 +1,43 @@
+int printf(const char *fmt, ...);
+int putchar(int c);
+
+int a[4096];
+int b[4096];
+int c[4096];
+
+void multiply(int *x, int *y, int *z, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            int sum = 0;
+            for (int k = 0; k < n; k++)
+            {
+                sum += x[i * n + k] * y[k * n + j];
+            }
+            z[i * n + j] = sum;
+        }
+    }
+}
+
+int main()
+{
+    int n = 64;
+    for (int i = 0; i < n * n; i++)
+    {
+        a[i] = i % 17;
+        b[i] = i % 13;
+    }
+
+    int check = 0;
+    for (int round = 0; round < 100; round++)
+    {
+        a[round] = round;
+        multiply(a, b, c, n);
+        check += c[round * 7];
+    }
+    printf("%d", check);
+    putchar(10);
+    return 0;
+}
@@ -0,0 +1,40 @@
+int printf(const char *fmt, ...);
+int putchar(int c);
+
+char composite[1000000];
+
+int sieve(int n)
+{
+    int count = 0;
+    for (int i = 0; i < n; i++)
+    {
+        composite[i] = 0;
+    }
+
+    for (int i = 2; i < n; i++)
+    {
+        if (composite[i])
+        {
+            continue;
+        }
+
+        count++;
+        for (int j = i + i; j < n; j += i)
+        {
+            composite[j] = 1;
+        }
+    }
+    return count;
+}
+
+int main()
+{
+    int total = 0;
+    for (int round = 0; round < 40; round++)
+    {
+        total += sieve(1000000 - round);
+    }
+    printf("%d", total);
+    putchar(10);
+    return 0;
+}
@@ -0,0 +1,39 @@
+int printf(const char *fmt, ...);
+int putchar(int c);
+
+int values[20000];
+
+void insertion_sort(int *items, int count)
+{
+    for (int i = 1; i < count; i++)
+    {
+        int key = items[i];
+        int j = i - 1;
+        while (j >= 0 && items[j] > key)
+        {
+            items[j + 1] = items[j];
+            j--;
+        }
+        items[j + 1] = key;
+    }
+}
+
+int main()
+{
+    unsigned int state = 12345;
+    for (int i = 0; i < 20000; i++)
+    {
+        state = state * 1103515245 + 12345;
+        values[i] = (state >> 8) % 100000;
+    }
+
+    insertion_sort(values, 20000);
+    int check = 0;
+    for (int i = 0; i < 20000; i += 100)
+    {
+        check += values[i];
+    }
+    printf("%d", check);
+    putchar(10);
+    return 0;
+}
@@ -0,0 +1,47 @@
+int printf(const char *fmt, ...);
+int putchar(int c);
+
+int values[100000];
+
+long sum(int *x, int n)
+{
+    long total = 0;
+    for (int i = 0; i < n; i++)
+    {
+        total += x[i];
+    }
+    return total;
+}
+
+// four rows at a time, the inner loop runs a constant number of times
+long sum_rows(int *x, int n)
+{
+    long total = 0;
+    for (int i = 0; i < n; i += 4)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            total += x[i + j] * (j + 1);
+        }
+    }
+    return total;
+}
+
+int main()
+{
+    int n = 100000;
+    for (int i = 0; i < n; i++)
+    {
+        values[i] = i % 1000 - 500;
+    }
+
+    long check = 0;
+    for (int round = 0; round < 1000; round++)
+    {
+        values[round] = round;
+        check += sum(values, n) + sum_rows(values, n);
+    }
+    printf("%ld", check);
+    putchar(10);
+    return 0;
+}
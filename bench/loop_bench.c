@@ -0,0 +1,92 @@
+/**
+ * Compares code optimized with and without the loop passes, build and run with
+ * "make bench". Each kernel is compiled both ways, assembled with gcc and run,
+ * the best of a few runs counts.
+ */
+#include "compiler.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RUNS 3
+
+#define LOOP_FLAGS (COMPILE_PROCESS_FLAG_LICM | COMPILE_PROCESS_FLAG_STRENGTH_REDUCTION | COMPILE_PROCESS_FLAG_UNROLL)
+
+static const char *kernels[] = {"sum", "copy", "matmul", "sieve"};
+
+static double now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+/**
+ * Counts the instructions of an assembly file
+ */
+static int count_instructions(const char *filename)
+{
+    char line[512];
+    FILE *file = fopen(filename, "r");
+    int instructions = 0;
+    while (fgets(line, sizeof(line), file))
+    {
+        if (line[0] == '\t' && line[1] != '.')
+        {
+            instructions++;
+        }
+    }
+    fclose(file);
+    return instructions;
+}
+
+static double run(const char *kernel, int flags, const char *mode)
+{
+    char source[256];
+    char assembly[256];
+    char binary[256];
+    char command[1024];
+    snprintf(source, sizeof(source), "./bench/kernels/%s.c", kernel);
+    snprintf(assembly, sizeof(assembly), "/tmp/zeze_loop_bench_%s_%s.s", kernel, mode);
+    snprintf(binary, sizeof(binary), "/tmp/zeze_loop_bench_%s_%s", kernel, mode);
+    if (compile_file(source, assembly, flags) != COMPILER_FILE_COMPILED_OK)
+    {
+        printf("%s failed to compile\n", source);
+        exit(1);
+    }
+
+    snprintf(command, sizeof(command), "gcc -o %s %s", binary, assembly);
+    if (system(command))
+    {
+        printf("%s failed to assemble\n", assembly);
+        exit(1);
+    }
+
+    double best = 0;
+    snprintf(command, sizeof(command), "%s > /dev/null", binary);
+    for (int i = 0; i < RUNS; i++)
+    {
+        double start = now();
+        if (system(command))
+        {
+            printf("%s failed\n", binary);
+            exit(1);
+        }
+        double elapsed = now() - start;
+        best = i == 0 || elapsed < best ? elapsed : best;
+    }
+
+    printf("%-8s %-8s %6i instructions %8.1f ms\n", kernel, mode, count_instructions(assembly), best * 1e3);
+    return best;
+}
+
+int main()
+{
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++)
+    {
+        double scalar = run(kernels[i], COMPILE_PROCESS_FLAGS_O2 & ~LOOP_FLAGS, "scalar");
+        double loops = run(kernels[i], COMPILE_PROCESS_FLAGS_O2, "loops");
+        printf("%-8s speedup %.2fx\n", kernels[i], scalar / loops);
+    }
+    return 0;
+}
@@ -0,0 +1,77 @@
+/**
+ * Compares writing assembly text and running the assembler on it against
+ * writing the object file directly, build and run with "make bench". Each
+ * kernel is compiled both ways, the best of a few runs counts. The object file
+ * is linked and run so a broken encoding shows up here too.
+ */
+#include "compiler.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RUNS 5
+
+static const char *kernels[] = {"matmul", "sieve", "fib", "hash", "sort", "sum", "copy"};
+
+static double now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static void compile(const char *source, const char *output, int flags)
+{
+    if (compile_file(source, output, flags) != COMPILER_FILE_COMPILED_OK)
+    {
+        printf("%s failed to compile\n", source);
+        exit(1);
+    }
+}
+
+static void run_command(const char *command)
+{
+    if (system(command))
+    {
+        printf("%s failed\n", command);
+        exit(1);
+    }
+}
+
+int main()
+{
+    char source[256];
+    char assembly[256];
+    char object[256];
+    char assembled[256];
+    char command[1024];
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++)
+    {
+        snprintf(source, sizeof(source), "./bench/kernels/%s.c", kernels[i]);
+        snprintf(assembly, sizeof(assembly), "/tmp/zeze_bench_%s.s", kernels[i]);
+        snprintf(assembled, sizeof(assembled), "/tmp/zeze_bench_%s_as.o", kernels[i]);
+        snprintf(object, sizeof(object), "/tmp/zeze_bench_%s.o", kernels[i]);
+
+        double text = 0;
+        double direct = 0;
+        for (int run = 0; run < RUNS; run++)
+        {
+            double start = now();
+            compile(source, assembly, COMPILE_PROCESS_FLAGS_O2);
+            snprintf(command, sizeof(command), "as -o %s %s", assembled, assembly);
+            run_command(command);
+            double elapsed = now() - start;
+            text = run == 0 || elapsed < text ? elapsed : text;
+
+            start = now();
+            compile(source, object, COMPILE_PROCESS_FLAGS_O2 | COMPILE_PROCESS_FLAG_OBJECT);
+            elapsed = now() - start;
+            direct = run == 0 || elapsed < direct ? elapsed : direct;
+        }
+
+        snprintf(command, sizeof(command), "gcc -o /tmp/zeze_bench_%s %s && /tmp/zeze_bench_%s > /dev/null", kernels[i], object, kernels[i]);
+        run_command(command);
+        printf("%-8s text+as %8.2f ms   object %8.2f ms   %.2fx\n", kernels[i], text * 1e3, direct * 1e3, text / direct);
+    }
+    return 0;
+}
@@ -0,0 +1,160 @@
+/**
+ * Parses one large generated file sequentially and with --parallel-parse, build and
+ * run with "make bench". The parse runs in a child process after the file is
+ * preprocessed there and the best of a few runs counts. Both modes have to write the
+ * same assembly, the bench fails when they don't. With one processor the bodies still
+ * go through a worker and its pool, only there is just the one.
+ */
+#include "compiler.h"
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RUNS 5
+#define FUNCTIONS 5000
+#define INPUT "/tmp/zeze_parse_bench.c"
+#define SEQUENTIAL_OUTPUT "/tmp/zeze_parse_bench_sequential.s"
+#define PARALLEL_OUTPUT "/tmp/zeze_parse_bench_parallel.s"
+
+static double now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+/**
+ * Function bodies with the constructs the body parser has to agree on: typedefs of
+ * their own and of the file, strings that are joined, else if chains and nesting
+ */
+static void write_input()
+{
+    FILE *out = fopen(INPUT, "w");
+    fprintf(out, "typedef long word;\nstruct pair { word a; word b; };\nint printf(const char *format, ...);\n");
+    for (int i = 0; i < FUNCTIONS; i++)
+    {
+        fprintf(out,
+                "word f%i(word a, struct pair *p)\n{\n    typedef int local%i;\n    local%i s = %i;\n"
+                "    const char *name = \"f\" \"%i\" \"\\n\";\n"
+                "    for (word i = 0; i < a; i++)\n    {\n"
+                "        if (i %% 4 == 0) { s += p->a * (i + (a - %i)); }\n"
+                "        else if (i %% 4 == 1) { s -= p->b ? a : i; }\n"
+                "        else if (i %% 4 == 2) { s ^= name[i %% 3]; }\n"
+                "        else { s = s << 1 | (s < 0); }\n    }\n"
+                "    return s;\n}\n",
+                i, i, i, i, i, i);
+    }
+    fprintf(out, "int main()\n{\n    struct pair p = {3, 4};\n    printf(\"%%ld\\n\", f%i(10, &p));\n    return 0;\n}\n", FUNCTIONS - 1);
+    fclose(out);
+}
+
+/**
+ * Preprocesses the input and sends how long parsing it took down the pipe
+ */
+static void parse_only(int flags, int pipe)
+{
+    struct compile_process *process = compile_process_create(INPUT, SEQUENTIAL_OUTPUT, flags);
+    struct lex_process *lex_process = lex_process_create(process, &compiler_lex_functions, NULL);
+    process->token_vec_original = lex_process_tokens(lex_process);
+    process->preprocessor = preprocessor_create(process);
+    if (preprocessor_run(process, lex_process, NULL) != PREPROCESS_ALL_OK)
+    {
+        _exit(1);
+    }
+
+    double start = now();
+    if (parse(process) != PARSE_ALL_OK)
+    {
+        _exit(1);
+    }
+    double elapsed = now() - start;
+    write(pipe, &elapsed, sizeof(elapsed));
+}
+
+/**
+ * Best parse time of RUNS runs, every run in a child process
+ */
+static double best(int flags)
+{
+    double best = 0;
+    for (int run = 0; run < RUNS; run++)
+    {
+        int fds[2];
+        pipe(fds);
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            parse_only(flags, fds[1]);
+            _exit(0);
+        }
+
+        double elapsed = 0;
+        int status;
+        close(fds[1]);
+        bool read_time = read(fds[0], &elapsed, sizeof(elapsed)) == sizeof(elapsed);
+        close(fds[0]);
+        waitpid(pid, &status, 0);
+        if (!read_time || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            printf("parse failed\n");
+            exit(1);
+        }
+        best = run == 0 || elapsed < best ? elapsed : best;
+    }
+    return best;
+}
+
+/**
+ * Compiles the input in a child process
+ */
+static void compile(const char *output, int flags)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        _exit(compile_file(INPUT, output, flags) == COMPILER_FILE_COMPILED_OK ? 0 : 1);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        printf("compile failed\n");
+        exit(1);
+    }
+}
+
+static bool same_file(const char *a, const char *b)
+{
+    FILE *first = fopen(a, "r");
+    FILE *second = fopen(b, "r");
+    int c;
+    bool same = true;
+    while (same && (c = fgetc(first)) != EOF)
+    {
+        same = fgetc(second) == c;
+    }
+    same = same && fgetc(second) == EOF;
+    fclose(first);
+    fclose(second);
+    return same;
+}
+
+int main()
+{
+    write_input();
+    compile(SEQUENTIAL_OUTPUT, COMPILE_PROCESS_FLAGS_O2);
+    compile(PARALLEL_OUTPUT, COMPILE_PROCESS_FLAGS_O2 | COMPILE_PROCESS_FLAG_PARALLEL_PARSE);
+    if (!same_file(SEQUENTIAL_OUTPUT, PARALLEL_OUTPUT))
+    {
+        printf("the parallel parse wrote different assembly than the sequential one\n");
+        return 1;
+    }
+
+    double sequential = best(0);
+    double parallel = best(COMPILE_PROCESS_FLAG_PARALLEL_PARSE);
+    printf("%i functions on %li processors  sequential parse %8.2f ms  parallel parse %8.2f ms  %.2fx\n", FUNCTIONS,
+           sysconf(_SC_NPROCESSORS_ONLN), sequential * 1e3, parallel * 1e3, sequential / parallel);
+    return 0;
+}
@@ -0,0 +1,108 @@
+/**
+ * Compiles one large generated file with the lexer on the compiling thread and
+ * with --pipeline-lexer, build and run with "make bench". Every compile runs in a
+ * child process so the memory a compile never frees doesn't slow down the next one,
+ * the best of a few runs counts. Lexing the file on its own shows how much time
+ * there is to hide and lexing through the ring what the ring costs. With one
+ * processor the compile doesn't start the lexer thread and both compiles are the same.
+ */
+#include "compiler.h"
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RUNS 5
+#define FUNCTIONS 5000
+#define INPUT "/tmp/zeze_pipeline_bench.c"
+#define OUTPUT "/tmp/zeze_pipeline_bench.s"
+
+static double now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static void write_input()
+{
+    FILE *out = fopen(INPUT, "w");
+    fprintf(out, "#define SQ(x) ((x) * (x))\n#define ADD(a, b) ((a) + (b))\n");
+    for (int i = 0; i < FUNCTIONS; i++)
+    {
+        fprintf(out,
+                "/* function %i\n   of %i */\n"
+                "int f%i(int a, int b)\n{\n    int s = 0; // running total\n"
+                "    for (int i = 0; i < a; i++)\n    {\n"
+                "        if (i %% 3 == %i) { s += SQ(i) + ADD(b, %i); } else { s -= b * %i; }\n    }\n"
+                "#if %i\n    s += 0x%x;\n#else\n    s ^= '\\n';\n#endif\n    return s;\n}\n",
+                i, FUNCTIONS, i, i % 3, i, i, i % 2, i);
+    }
+    fclose(out);
+}
+
+/**
+ * Runs the function in a child process, returns the best time of RUNS runs
+ */
+static double best(void (*function)(int), int flags)
+{
+    double best = 0;
+    for (int run = 0; run < RUNS; run++)
+    {
+        double start = now();
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            function(flags);
+            _exit(0);
+        }
+
+        int status;
+        waitpid(pid, &status, 0);
+        double elapsed = now() - start;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            printf("run failed\n");
+            exit(1);
+        }
+        best = run == 0 || elapsed < best ? elapsed : best;
+    }
+    return best;
+}
+
+static void compile(int flags)
+{
+    if (compile_file(INPUT, OUTPUT, flags) != COMPILER_FILE_COMPILED_OK)
+    {
+        _exit(1);
+    }
+}
+
+static void lex_only(int flags)
+{
+    struct compile_process *process = compile_process_create(INPUT, OUTPUT, flags);
+    lex(lex_process_create(process, &compiler_lex_functions, NULL));
+}
+
+static void lex_through_ring(int flags)
+{
+    struct compile_process *process = compile_process_create(INPUT, OUTPUT, flags);
+    // nothing reads the directives, every branch is lexed
+    struct lex_pipeline *pipeline = lex_pipeline_create(process, false);
+    while (lex_pipeline_next(pipeline))
+    {
+    }
+    lex_pipeline_free(pipeline);
+}
+
+int main()
+{
+    write_input();
+    double lexing = best(lex_only, 0);
+    double ring = best(lex_through_ring, 0);
+    double serial = best(compile, COMPILE_PROCESS_FLAGS_O2);
+    double pipelined = best(compile, COMPILE_PROCESS_FLAGS_O2 | COMPILE_PROCESS_FLAG_PIPELINE_LEXER);
+    printf("%i functions on %li processors  lexing alone %8.2f ms  through the ring %8.2f ms  compile %8.2f ms  pipelined %8.2f ms  %.2fx\n", FUNCTIONS,
+           sysconf(_SC_NPROCESSORS_ONLN), lexing * 1e3, ring * 1e3, serial * 1e3, pipelined * 1e3, serial / pipelined);
+    return 0;
+}
@@ -0,0 +1,99 @@
+/**
+ * Compares code from the linear scan allocator against keeping every value in
+ * its stack slot, build and run with "make bench". Each kernel is compiled both
+ * ways, assembled with gcc and run, the best of a few runs counts.
+ */
+#include "compiler.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RUNS 3
+
+static const char *kernels[] = {"matmul", "sieve", "fib", "hash", "sort"};
+
+static double now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+/**
+ * Counts the instructions of an assembly file and how many of them touch a stack slot
+ */
+static void count_instructions(const char *filename, int *instructions, int *stack_accesses)
+{
+    char line[512];
+    FILE *file = fopen(filename, "r");
+    *instructions = 0;
+    *stack_accesses = 0;
+    while (fgets(line, sizeof(line), file))
+    {
+        if (line[0] != '\t' || line[1] == '.')
+        {
+            continue;
+        }
+
+        (*instructions)++;
+        if (strstr(line, "(%rbp)") && !strstr(line, "lea"))
+        {
+            (*stack_accesses)++;
+        }
+    }
+    fclose(file);
+}
+
+static double run(const char *kernel, int flags, const char *mode)
+{
+    char source[256];
+    char assembly[256];
+    char binary[256];
+    char command[1024];
+    snprintf(source, sizeof(source), "./bench/kernels/%s.c", kernel);
+    snprintf(assembly, sizeof(assembly), "/tmp/zeze_bench_%s_%s.s", kernel, mode);
+    snprintf(binary, sizeof(binary), "/tmp/zeze_bench_%s_%s", kernel, mode);
+    if (compile_file(source, assembly, flags) != COMPILER_FILE_COMPILED_OK)
+    {
+        printf("%s failed to compile\n", source);
+        exit(1);
+    }
+
+    snprintf(command, sizeof(command), "gcc -o %s %s", binary, assembly);
+    if (system(command))
+    {
+        printf("%s failed to assemble\n", assembly);
+        exit(1);
+    }
+
+    double best = 0;
+    snprintf(command, sizeof(command), "%s > /dev/null", binary);
+    for (int i = 0; i < RUNS; i++)
+    {
+        double start = now();
+        if (system(command))
+        {
+            printf("%s failed\n", binary);
+            exit(1);
+        }
+        double elapsed = now() - start;
+        best = i == 0 || elapsed < best ? elapsed : best;
+    }
+
+    int instructions;
+    int stack_accesses;
+    count_instructions(assembly, &instructions, &stack_accesses);
+    printf("%-8s %-10s %6i instructions %6i stack accesses %8.1f ms\n", kernel, mode, instructions, stack_accesses, best * 1e3);
+    return best;
+}
+
+int main()
+{
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++)
+    {
+        double spilled = run(kernels[i], COMPILE_PROCESS_FLAG_SPILL_ALL, "spill-all");
+        double allocated = run(kernels[i], 0, "linear");
+        printf("%-8s speedup %.2fx\n", kernels[i], spilled / allocated);
+    }
+    return 0;
+}
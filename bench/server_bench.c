@@ -0,0 +1,149 @@
+/**
+ * Compares compiling a small project with a new ./main for every unit against
+ * sending the same command lines to the compile server through ./client, build
+ * and run with "make bench". The units all include one large header, which is
+ * what the server's caches are for. The first pass through the server fills its
+ * caches, the best of a few passes after that counts. The assembly written both
+ * ways has to be the same, also where the header's branches differ between units.
+ */
+#include "compiler.h"
+#include <signal.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RUNS 3
+#define UNITS 20
+#define HEADER_DECLARATIONS 3000
+#define DIRECTORY "/tmp/zeze_server_bench"
+#define SOCKET DIRECTORY "/server.sock"
+
+extern char **environ;
+
+static double now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static void write_project()
+{
+    mkdir(DIRECTORY, 0755);
+    FILE *header = fopen(DIRECTORY "/big.h", "w");
+    fprintf(header, "#ifndef BIG_H\n#define BIG_H\nint printf(const char *format, ...);\n");
+    for (int i = 0; i < HEADER_DECLARATIONS; i++)
+    {
+        fprintf(header, "#define BIG_%i (%i + 7)\nstruct s%i { int a; int b; long c; };\nint f%i(int a, int b);\n", i, i, i, i);
+    }
+    // a branch that is never taken may hold text the lexer can't read, which
+    // branch of UNIT_ODD is taken changes from one unit to the next
+    fprintf(header, "#if 0\nthe units don't use this\n#endif\n#if UNIT_ODD\nint parity() { return 1; }\n#else\nint parity() { return 0; }\n#endif\n");
+    fprintf(header, "#endif\n");
+    fclose(header);
+
+    char path[256];
+    for (int unit = 0; unit < UNITS; unit++)
+    {
+        snprintf(path, sizeof(path), DIRECTORY "/unit%i.c", unit);
+        FILE *source = fopen(path, "w");
+        fprintf(source, "#define UNIT_ODD %i\n#include \"big.h\"\nint g%i(int x) { int s = 0; for (int i = 0; i < x; i++) { s += i * BIG_%i; } return s; }\n", unit % 2, unit, unit * 7);
+        fclose(source);
+    }
+}
+
+static pid_t spawn(char **argv)
+{
+    pid_t pid;
+    if (posix_spawn(&pid, argv[0], NULL, NULL, argv, environ) != 0)
+    {
+        printf("%s failed to start\n", argv[0]);
+        exit(1);
+    }
+    return pid;
+}
+
+/**
+ * Compiles every unit with the program given, one after another like make -j1
+ */
+static double compile_all(char *program, const char *suffix)
+{
+    char source[256];
+    char output[256];
+    double start = now();
+    for (int unit = 0; unit < UNITS; unit++)
+    {
+        snprintf(source, sizeof(source), DIRECTORY "/unit%i.c", unit);
+        snprintf(output, sizeof(output), DIRECTORY "/unit%i.%s", unit, suffix);
+        char *argv[] = {program, "-O2", source, "-o", output, NULL};
+        int status;
+        waitpid(spawn(argv), &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            printf("%s failed on %s\n", program, source);
+            exit(1);
+        }
+    }
+    return now() - start;
+}
+
+static bool same_file(const char *a, const char *b)
+{
+    char command[1024];
+    snprintf(command, sizeof(command), "cmp -s %s %s", a, b);
+    return system(command) == 0;
+}
+
+int main()
+{
+    write_project();
+    setenv("ZEZE_SERVER", SOCKET, 1);
+    // the compilers print a line for each unit
+    freopen("/dev/null", "w", stdout);
+    FILE *report = fdopen(dup(STDERR_FILENO), "w");
+
+    double cold = 0;
+    for (int run = 0; run < RUNS; run++)
+    {
+        double elapsed = compile_all("./main", "s");
+        cold = run == 0 || elapsed < cold ? elapsed : cold;
+    }
+
+    char *server_argv[] = {"./main", "--workers", "1", "--server", SOCKET, NULL};
+    pid_t server = spawn(server_argv);
+    struct stat info;
+    while (stat(SOCKET, &info) != 0)
+    {
+        usleep(1000);
+    }
+
+    double first = compile_all("./client", "served.s");
+    double warm = 0;
+    for (int run = 0; run < RUNS; run++)
+    {
+        double elapsed = compile_all("./client", "served.s");
+        warm = run == 0 || elapsed < warm ? elapsed : warm;
+    }
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+
+    char a[256];
+    char b[256];
+    for (int unit = 0; unit < UNITS; unit++)
+    {
+        snprintf(a, sizeof(a), DIRECTORY "/unit%i.s", unit);
+        snprintf(b, sizeof(b), DIRECTORY "/unit%i.served.s", unit);
+        if (!same_file(a, b))
+        {
+            fprintf(report, "unit%i.c compiled differently by the server\n", unit);
+            return 1;
+        }
+    }
+
+    fprintf(report, "%i units  ./main each %8.2f ms   server first pass %8.2f ms   server warm %8.2f ms   %.1fx\n", UNITS, cold * 1e3, first * 1e3, warm * 1e3, cold / warm);
+    return 0;
+}
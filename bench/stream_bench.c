@@ -0,0 +1,79 @@
+/**
+ * Compiles generated files of growing size as a whole and with --stream, build and
+ * run with "make bench". Every compile runs in a child process and reports the
+ * most memory it had, the whole file compile should grow with the file and the
+ * streaming one stay where it is. The assembly written both ways holds the same
+ * lines, only the globals that were never initialized move to the end.
+ */
+#include "compiler.h"
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define INPUT "/tmp/zeze_stream_bench.c"
+#define OUTPUT "/tmp/zeze_stream_bench.s"
+
+static double now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static void write_input(int functions)
+{
+    FILE *out = fopen(INPUT, "w");
+    fprintf(out, "#define SQ(x) ((x) * (x))\n#define ADD(a, b) ((a) + (b))\n");
+    for (int i = 0; i < functions; i++)
+    {
+        fprintf(out,
+                "/* function %i */\nint g%i;\nstruct s%i { int a; long b; };\n"
+                "int f%i(int a, int b)\n{\n    int s = 0; // running total\n"
+                "    for (int i = 0; i < a; i++)\n    {\n"
+                "        if (i %% 3 == %i) { s += SQ(i) + ADD(b, %i); } else { s -= b * %i; }\n    }\n"
+                "    g%i = s;\n    return s;\n}\n",
+                i, i, i, i, i % 3, i, i, i);
+    }
+    fclose(out);
+}
+
+/**
+ * Compiles the input in a child process, returns the time and sets the peak memory in MB
+ */
+static double compile(int flags, long *megabytes)
+{
+    double start = now();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        _exit(compile_file(INPUT, OUTPUT, flags) == COMPILER_FILE_COMPILED_OK ? 0 : 1);
+    }
+
+    int status;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    double elapsed = now() - start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        printf("compile failed\n");
+        exit(1);
+    }
+    *megabytes = usage.ru_maxrss / 1024;
+    return elapsed;
+}
+
+int main()
+{
+    for (int functions = 2500; functions <= 20000; functions *= 2)
+    {
+        write_input(functions);
+        long whole_memory;
+        long stream_memory;
+        double whole = compile(COMPILE_PROCESS_FLAGS_O2, &whole_memory);
+        double stream = compile(COMPILE_PROCESS_FLAGS_O2 | COMPILE_PROCESS_FLAG_STREAM, &stream_memory);
+        printf("%6i functions  whole file %8.2f ms %6li MB   streaming %8.2f ms %6li MB\n", functions, whole * 1e3, whole_memory, stream * 1e3, stream_memory);
+    }
+    return 0;
+}
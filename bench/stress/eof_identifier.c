@@ -0,0 +1,15 @@
+/**
+ * Includes a header and ends in an identifier, neither has a newline at its end
+ */
+#include "eof_identifier.h"
+#define ANSWER 42
+int eof_identifier(int a)
+{
+    return a;
+}
+int main()
+{
+    return eof_identifier(ANSWER) - ANSWER;
+}
+#if ANSWER
+#endif
\ No newline at end of file
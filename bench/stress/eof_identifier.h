@@ -0,0 +1,8 @@
+/**
+ * Ends in an identifier with no newline after it, the lexer reads up to the end of
+ * the file
+ */
+#ifndef EOF_IDENTIFIER_H
+#define EOF_IDENTIFIER_H
+int eof_identifier(int a);
+#endif
\ No newline at end of file
@@ -0,0 +1,23 @@
+/**
+ * Comments stand for a space in front of a directive and between its '#' and its
+ * name, in a skipped branch as much as in a taken one
+ */
+#if 0
+int x = ;
+/* before */ #endif
+
+#if 0
+# /* between */ if 1
+int y = ;
+#else
+int z = ;
+/* over
+   two lines */ # /* between */ endif
+#else
+int w = 1;
+#endif
+
+int main()
+{
+    return w - 1;
+}
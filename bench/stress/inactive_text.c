@@ -0,0 +1,20 @@
+/**
+ * Branches that are never taken hold text that isn't C, they are skipped without
+ * being lexed however the file is read
+ */
+#if 0
+It's prose, and the quote doesn't end.
+#endif
+
+#ifdef NOT_DEFINED
+char c = 'ab;
+#elif 1
+int x = 3;
+#else
+don't
+#endif
+
+int main()
+{
+    return x - 3;
+}
@@ -0,0 +1,22 @@
+/**
+ * ## is one token, so # ## # pastes two '#', pastes chain, and the arguments that
+ * expand keep the whitespace that followed their invocation when they are stringified
+ */
+int strcmp(const char *a, const char *b);
+
+#define hash_hash # ## #
+#define mkstr(a) # a
+#define in_between(a) mkstr(a)
+#define join(c, d) in_between(c hash_hash d)
+
+#define str(s) # s
+#define xstr(s) str(s)
+#define r(x, y) x ## y
+#define q(x) x
+#define t(x, y, z) x ## y ## z
+
+int main()
+{
+    return strcmp(join(x, y), "x ## y") || strcmp(xstr(r(x, y) r(, 1) r(2, ) q()), "xy 1 2") ||
+           strcmp(xstr(t(1, 2, 3) t(, 4, ) t(, , 5)), "123 4 5");
+}
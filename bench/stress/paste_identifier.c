@@ -0,0 +1,12 @@
+/**
+ * Identifiers made with ##, the pasted text is lexed again up to its end
+ */
+#define CAT(a, b) a##b
+#define r(name, n) name##n
+
+int main()
+{
+    int myvar = 1;
+    int ab1 = 2;
+    return CAT(my, var) + r(ab, 1) - 3;
+}
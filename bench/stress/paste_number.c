@@ -0,0 +1,16 @@
+/**
+ * Numbers and char literals are stringified and pasted the way they were written
+ */
+int strcmp(const char *a, const char *b);
+
+#define HEX(n) 0x##n
+#define str(x) #x
+
+int main()
+{
+    if (HEX(10) != 16)
+    {
+        return 1;
+    }
+    return strcmp(str(0x10), "0x10") || strcmp(str('a'), "'a'") || strcmp(str(007), "007") || strcmp(str('\n'), "'\\n'");
+}
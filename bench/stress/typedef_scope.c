@@ -0,0 +1,39 @@
+/**
+ * A typedef declared in a block ends with the block, and a variable or parameter
+ * named like a typedef hides it until the end of its own block
+ */
+typedef int T;
+
+int twice(int T)
+{
+    return T * 2;
+}
+
+int main()
+{
+    {
+        typedef long T;
+        if (sizeof(T) != 8)
+        {
+            return 1;
+        }
+    }
+    T x = 0;
+    if (sizeof(x) != 4)
+    {
+        return 2;
+    }
+
+    int total = 0;
+    {
+        int T = 2;
+        T * 3;
+        total = T * 3;
+    }
+    for (int T = 1; T < 3; T++)
+    {
+        total += T * 1;
+    }
+    T y = twice(total);
+    return y != 18;
+}
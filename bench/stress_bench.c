@@ -0,0 +1,323 @@
+/**
+ * Compiles inputs that are deep or long beyond what anyone writes, build and run with
+ * "make bench". Every compile runs in a child process with a limit on its processor
+ * time and on its memory. The files of bench/stress and the generated chains have to
+ * compile and their programs return 0, the generated nesting and the unterminated
+ * comments and literals have to be rejected with an error. A crash, a signal, going
+ * over a limit or taking longer than the case allows fails the bench.
+ */
+#include "compiler.h"
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STRESS_CPU_SECONDS 30
+#define STRESS_MEMORY (2048L * 1024 * 1024)
+#define STRESS_TERMS 200000
+#define STRESS_BRANCHES 100000
+#define STRESS_TEXT (16 * 1024 * 1024)
+// wall clock bounds, the lexer cases only read their text once
+#define STRESS_SECONDS 10.0
+#define STRESS_TEXT_SECONDS 5.0
+#define INPUT "/tmp/zeze_stress_bench.c"
+#define OUTPUT "/tmp/zeze_stress_bench.s"
+#define BINARY "/tmp/zeze_stress_bench"
+
+enum
+{
+    STRESS_COMPILES,
+    STRESS_REJECTED
+};
+
+struct stress_case
+{
+    const char *name;
+    void (*write)(FILE *out);
+    int expect;
+    double seconds;
+};
+
+static const char *files[] = {"eof_identifier", "paste_identifier", "inactive_text", "inactive_comments", "paste_number", "paste_hash", "typedef_scope"};
+
+static double now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static void write_text(FILE *out, const char *text)
+{
+    size_t length = strlen(text);
+    for (size_t i = 0; i < STRESS_TEXT / length; i++)
+    {
+        fputs(text, out);
+    }
+}
+
+static void write_terms(FILE *out, const char *term, const char *op)
+{
+    for (int i = 0; i < STRESS_TERMS; i++)
+    {
+        fprintf(out, "%s%s", i ? op : "", term);
+    }
+}
+
+static void write_binary(FILE *out)
+{
+    fprintf(out, "int main()\n{\n    int a = 1;\n    return ");
+    write_terms(out, "a", " + ");
+    fprintf(out, " != %i;\n}\n", STRESS_TERMS);
+}
+
+static void write_logical(FILE *out)
+{
+    fprintf(out, "int main()\n{\n    int a = 1;\n    return !(");
+    write_terms(out, "a", " && ");
+    fprintf(out, ");\n}\n");
+}
+
+static void write_comma(FILE *out)
+{
+    fprintf(out, "int main()\n{\n    int a = 1;\n    return (");
+    write_terms(out, "a", ", ");
+    fprintf(out, ") - 1;\n}\n");
+}
+
+static void write_else_if(FILE *out)
+{
+    fprintf(out, "int main()\n{\n    int a = %i;\n", STRESS_BRANCHES / 2);
+    for (int i = 0; i < STRESS_BRANCHES; i++)
+    {
+        fprintf(out, "    %sif (a == %i)\n        return %i;\n", i ? "else " : "", i, i - STRESS_BRANCHES / 2);
+    }
+    fprintf(out, "    else\n        return 1;\n}\n");
+}
+
+static void write_case(FILE *out)
+{
+    fprintf(out, "int main()\n{\n    switch (%i)\n    {\n    case ", STRESS_TERMS);
+    write_terms(out, "1", " + ");
+    fprintf(out, ":\n        return 0;\n    }\n    return 1;\n}\n");
+}
+
+static void write_initializer(FILE *out)
+{
+    fprintf(out, "int total = ");
+    write_terms(out, "1", " + ");
+    fprintf(out, ";\n\nint main()\n{\n    return total != %i;\n}\n", STRESS_TERMS);
+}
+
+static void write_ternary(FILE *out)
+{
+    fprintf(out, "int main()\n{\n    int a = 0;\n    return ");
+    write_terms(out, "a ? 1 :", " ");
+    fprintf(out, " 0;\n}\n");
+}
+
+static void write_assignment(FILE *out)
+{
+    fprintf(out, "int main()\n{\n    int a;\n    ");
+    write_terms(out, "a =", " ");
+    fprintf(out, " 0;\n    return a;\n}\n");
+}
+
+static void write_parentheses(FILE *out)
+{
+    fprintf(out, "int main()\n{\n    return ");
+    write_terms(out, "(", "");
+    fprintf(out, "0");
+    write_terms(out, ")", "");
+    fprintf(out, ";\n}\n");
+}
+
+static void write_negation(FILE *out)
+{
+    fprintf(out, "int main()\n{\n    return ");
+    write_terms(out, "-", " ");
+    fprintf(out, " 0;\n}\n");
+}
+
+static void write_calls(FILE *out)
+{
+    fprintf(out, "int f(int a)\n{\n    return a;\n}\n\nint main()\n{\n    return ");
+    write_terms(out, "f(", "");
+    fprintf(out, "0");
+    write_terms(out, ")", "");
+    fprintf(out, ";\n}\n");
+}
+
+static void write_blocks(FILE *out)
+{
+    fprintf(out, "int main()\n{\n    ");
+    write_terms(out, "{", "");
+    write_terms(out, "}", "");
+    fprintf(out, "\n    return 0;\n}\n");
+}
+
+static void write_spaces(FILE *out)
+{
+    fprintf(out, "int main()\n{\n    return");
+    write_text(out, " ");
+    fprintf(out, "0;\n}\n");
+}
+
+static void write_blank_lines(FILE *out)
+{
+    fprintf(out, "int main()\n{\n    return");
+    write_text(out, " \t\n");
+    fprintf(out, "0;\n}\n");
+}
+
+static void write_open_comment(FILE *out)
+{
+    fprintf(out, "int main()\n{\n    return 0;\n}\n/*");
+    write_text(out, "*");
+}
+
+static void write_open_string(FILE *out)
+{
+    fprintf(out, "int main()\n{\n    return 0;\n}\nchar *s = \"");
+    write_text(out, "a");
+}
+
+static void write_open_char(FILE *out)
+{
+    fprintf(out, "int main()\n{\n    return 0;\n}\nint c = '");
+    write_text(out, "a");
+}
+
+static void write_identifier(FILE *out)
+{
+    fprintf(out, "int main()\n{\n    int ");
+    write_text(out, "a");
+    fprintf(out, " = 0;\n    return ");
+    write_text(out, "a");
+    fprintf(out, ";\n}\n");
+}
+
+static void write_number(FILE *out)
+{
+    fprintf(out, "int main()\n{\n    return ");
+    write_text(out, "0");
+    fprintf(out, ";\n}\n");
+}
+
+static void write_string(FILE *out)
+{
+    fprintf(out, "char *s = \"");
+    write_text(out, "a");
+    fprintf(out, "\";\n\nint main()\n{\n    return s[%i] != 'a' || s[%i];\n}\n", STRESS_TEXT - 1, STRESS_TEXT);
+}
+
+static const struct stress_case cases[] = {
+    {"binary", write_binary, STRESS_COMPILES, STRESS_SECONDS},
+    {"logical", write_logical, STRESS_COMPILES, STRESS_SECONDS},
+    {"comma", write_comma, STRESS_COMPILES, STRESS_SECONDS},
+    {"else if", write_else_if, STRESS_COMPILES, STRESS_SECONDS},
+    {"case", write_case, STRESS_COMPILES, STRESS_SECONDS},
+    {"initializer", write_initializer, STRESS_COMPILES, STRESS_SECONDS},
+    {"ternary", write_ternary, STRESS_REJECTED, STRESS_SECONDS},
+    {"assignment", write_assignment, STRESS_REJECTED, STRESS_SECONDS},
+    {"parentheses", write_parentheses, STRESS_REJECTED, STRESS_SECONDS},
+    {"negation", write_negation, STRESS_REJECTED, STRESS_SECONDS},
+    {"calls", write_calls, STRESS_REJECTED, STRESS_SECONDS},
+    {"blocks", write_blocks, STRESS_REJECTED, STRESS_SECONDS},
+    {"spaces", write_spaces, STRESS_COMPILES, STRESS_TEXT_SECONDS},
+    {"blank lines", write_blank_lines, STRESS_COMPILES, STRESS_TEXT_SECONDS},
+    {"open comment", write_open_comment, STRESS_REJECTED, STRESS_TEXT_SECONDS},
+    {"open string", write_open_string, STRESS_REJECTED, STRESS_TEXT_SECONDS},
+    {"open char", write_open_char, STRESS_REJECTED, STRESS_TEXT_SECONDS},
+    {"identifier", write_identifier, STRESS_COMPILES, STRESS_TEXT_SECONDS},
+    {"number", write_number, STRESS_COMPILES, STRESS_TEXT_SECONDS},
+    {"string", write_string, STRESS_COMPILES, STRESS_TEXT_SECONDS},
+};
+
+/**
+ * Compiles the source in a child process held to the limits, false when it
+ * crashed, went over one of them or took longer than the seconds given
+ */
+static bool compile(const char *name, const char *source, const char *mode, int flags, int expect, double seconds)
+{
+    double start = now();
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        struct rlimit cpu = {STRESS_CPU_SECONDS, STRESS_CPU_SECONDS};
+        struct rlimit memory = {STRESS_MEMORY, STRESS_MEMORY};
+        setrlimit(RLIMIT_CPU, &cpu);
+        setrlimit(RLIMIT_AS, &memory);
+        // the errors of the rejected inputs are expected
+        freopen("/dev/null", "w", stderr);
+        freopen("/dev/null", "w", stdout);
+        _exit(compile_file(source, OUTPUT, flags) == COMPILER_FILE_COMPILED_OK ? 0 : 1);
+    }
+
+    int status;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    double elapsed = now() - start;
+    const char *outcome = "compiled";
+    bool passed = WIFEXITED(status) && (WEXITSTATUS(status) == 0) == (expect == STRESS_COMPILES);
+    if (WIFSIGNALED(status))
+    {
+        outcome = WTERMSIG(status) == SIGXCPU || WTERMSIG(status) == SIGKILL ? "over the time limit" : "crashed or out of memory";
+    }
+    else if (WEXITSTATUS(status) != 0)
+    {
+        outcome = "rejected";
+    }
+
+    if (passed && elapsed > seconds)
+    {
+        outcome = "over the time bound";
+        passed = false;
+    }
+
+    if (passed && expect == STRESS_COMPILES)
+    {
+        char command[512];
+        snprintf(command, sizeof(command), "gcc -o %s %s && %s", BINARY, OUTPUT, BINARY);
+        if (system(command))
+        {
+            outcome = "compiled to a program that failed";
+            passed = false;
+        }
+    }
+
+    printf("%-16s %-16s %-34s %8.2f s %6li MB\n", name, mode, outcome, elapsed, usage.ru_maxrss / 1024);
+    return passed;
+}
+
+int main()
+{
+    bool passed = true;
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+    {
+        char source[256];
+        snprintf(source, sizeof(source), "./bench/stress/%s.c", files[i]);
+        passed &= compile(files[i], source, "", 0, STRESS_COMPILES, STRESS_SECONDS);
+        passed &= compile(files[i], source, "--pipeline-lexer", COMPILE_PROCESS_FLAG_PIPELINE_LEXER, STRESS_COMPILES, STRESS_SECONDS);
+    }
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        FILE *out = fopen(INPUT, "w");
+        cases[i].write(out);
+        fclose(out);
+        passed &= compile(cases[i].name, INPUT, "", 0, cases[i].expect, cases[i].seconds);
+        passed &= compile(cases[i].name, INPUT, "-O2", COMPILE_PROCESS_FLAGS_O2, cases[i].expect, cases[i].seconds);
+    }
+
+    if (!passed)
+    {
+        printf("an input crashed, went over a limit, took too long or did not end the way it should\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,244 @@
+/**
+ * Micro benchmarks for the symbol table, build and run with "make bench".
+ * The chained variant is the usual one hashmap per scope design, it's here
+ * to compare lookups under deep nesting against.
+ */
+#include "compiler.h"
+#include "helpers/intern.h"
+#include "helpers/hashmap.h"
+#include "helpers/vector.h"
+#include <stdlib.h>
+#include <time.h>
+
+#define GLOBALS 200000
+#define DEPTH 10000
+#define NAMES_PER_SCOPE 4
+#define LOOKUPS 2000000
+
+static double now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static void report(const char *what, double seconds, long operations)
+{
+    printf("%-44s %8.1f ns/op\n", what, seconds * 1e9 / operations);
+}
+
+static const char *make_name(struct intern_table *names, const char *prefix, int i)
+{
+    char buffer[32];
+    int length = snprintf(buffer, sizeof(buffer), "%s%d", prefix, i);
+    return intern_table_add(names, buffer, length);
+}
+
+static void bench_intern(struct intern_table *names, const char **globals)
+{
+    // formatted up front so only interning is timed
+    char(*spellings)[16] = malloc(sizeof(*spellings) * GLOBALS);
+    int *lengths = malloc(sizeof(int) * GLOBALS);
+    for (int i = 0; i < GLOBALS; i++)
+    {
+        lengths[i] = snprintf(spellings[i], sizeof(spellings[i]), "global_%d", i);
+    }
+
+    double start = now();
+    for (int i = 0; i < GLOBALS; i++)
+    {
+        globals[i] = intern_table_add(names, spellings[i], lengths[i]);
+    }
+    report("intern, 200k new names", now() - start, GLOBALS);
+
+    start = now();
+    for (int i = 0; i < GLOBALS; i++)
+    {
+        intern_table_add(names, spellings[i], lengths[i]);
+    }
+    report("intern, 200k existing names", now() - start, GLOBALS);
+    free(spellings);
+    free(lengths);
+}
+
+static void bench_globals(struct intern_table *names, const char **globals)
+{
+    struct symbol_table *table = symbol_table_create();
+    double start = now();
+    for (int i = 0; i < GLOBALS; i++)
+    {
+        symbol_table_declare(table, globals[i], i + 1);
+    }
+    report("declare, file scope, 200k names", now() - start, GLOBALS);
+
+    unsigned int seed = 1;
+    long found = 0;
+    start = now();
+    for (int i = 0; i < LOOKUPS; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        found += symbol_table_lookup(table, globals[(seed >> 8) % GLOBALS]) != NODE_NONE;
+    }
+    report("lookup, file scope, 200k names", now() - start, LOOKUPS);
+    if (found != LOOKUPS)
+    {
+        printf("lookup failed\n");
+    }
+    symbol_table_free(table);
+}
+
+/**
+ * Every scope declares two names of its own and shadows two names every scope uses
+ */
+static void bench_nested(const char **globals, const char **locals, const char **shadowed)
+{
+    struct symbol_table *table = symbol_table_create();
+    for (int i = 0; i < GLOBALS; i++)
+    {
+        symbol_table_declare(table, globals[i], i + 1);
+    }
+
+    double start = now();
+    for (int depth = 0; depth < DEPTH; depth++)
+    {
+        symbol_table_enter_scope(table);
+        symbol_table_declare(table, locals[depth * 2], depth + 1);
+        symbol_table_declare(table, locals[depth * 2 + 1], depth + 1);
+        symbol_table_declare(table, shadowed[0], depth + 1);
+        symbol_table_declare(table, shadowed[1], depth + 1);
+    }
+    double entered = now();
+
+    unsigned int seed = 1;
+    long found = 0;
+    for (int i = 0; i < LOOKUPS; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        unsigned int pick = seed >> 8;
+        switch (pick % 3)
+        {
+        case 0:
+            found += symbol_table_lookup(table, shadowed[pick & 1]) != NODE_NONE;
+            break;
+        case 1:
+            found += symbol_table_lookup(table, locals[pick % (DEPTH * 2)]) != NODE_NONE;
+            break;
+        default:
+            found += symbol_table_lookup(table, globals[pick % GLOBALS]) != NODE_NONE;
+            break;
+        }
+    }
+    double looked_up = now();
+
+    for (int depth = 0; depth < DEPTH; depth++)
+    {
+        symbol_table_leave_scope(table);
+    }
+    double left = now();
+
+    report("enter scope + 4 declarations, depth 10000", entered - start, DEPTH);
+    report("lookup at depth 10000", looked_up - entered, LOOKUPS);
+    report("leave scope with 4 declarations", left - looked_up, DEPTH);
+    if (found != LOOKUPS || symbol_table_lookup(table, shadowed[0]) != NODE_NONE)
+    {
+        printf("nested lookup failed\n");
+    }
+    symbol_table_free(table);
+}
+
+static void *chained_lookup(struct vector *scopes, const char *name)
+{
+    for (int i = vector_count(scopes) - 1; i >= 0; i--)
+    {
+        void *value = NULL;
+        if (hashmap_find(*(struct hashmap **)vector_at(scopes, i), name, &value))
+        {
+            return value;
+        }
+    }
+    return NULL;
+}
+
+static void bench_chained(const char **globals, const char **locals, const char **shadowed)
+{
+    struct vector *scopes = vector_create(sizeof(struct hashmap *));
+    struct hashmap *file_scope = hashmap_create();
+    for (int i = 0; i < GLOBALS; i++)
+    {
+        hashmap_set(file_scope, globals[i], (void *)(long)(i + 1));
+    }
+    vector_push(scopes, &file_scope);
+
+    double start = now();
+    for (int depth = 0; depth < DEPTH; depth++)
+    {
+        struct hashmap *scope = hashmap_create();
+        hashmap_set(scope, locals[depth * 2], (void *)(long)(depth + 1));
+        hashmap_set(scope, locals[depth * 2 + 1], (void *)(long)(depth + 1));
+        hashmap_set(scope, shadowed[0], (void *)(long)(depth + 1));
+        hashmap_set(scope, shadowed[1], (void *)(long)(depth + 1));
+        vector_push(scopes, &scope);
+    }
+    double entered = now();
+
+    // far fewer lookups, each one walks up to 10000 scopes
+    int lookups = LOOKUPS / 1000;
+    unsigned int seed = 1;
+    long found = 0;
+    for (int i = 0; i < lookups; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        unsigned int pick = seed >> 8;
+        switch (pick % 3)
+        {
+        case 0:
+            found += chained_lookup(scopes, shadowed[pick & 1]) != NULL;
+            break;
+        case 1:
+            found += chained_lookup(scopes, locals[pick % (DEPTH * 2)]) != NULL;
+            break;
+        default:
+            found += chained_lookup(scopes, globals[pick % GLOBALS]) != NULL;
+            break;
+        }
+    }
+    double looked_up = now();
+
+    while (vector_count(scopes) > 0)
+    {
+        hashmap_free(*(struct hashmap **)vector_back(scopes));
+        vector_pop(scopes);
+    }
+    double left = now();
+
+    report("chained: enter scope + 4 declarations", entered - start, DEPTH);
+    report("chained: lookup at depth 10000", looked_up - entered, lookups);
+    report("chained: leave scope", left - looked_up, DEPTH);
+    if (found != lookups)
+    {
+        printf("chained lookup failed\n");
+    }
+    vector_free(scopes);
+}
+
+int main()
+{
+    struct intern_table *names = intern_table_create();
+    const char **globals = malloc(sizeof(const char *) * GLOBALS);
+    const char **locals = malloc(sizeof(const char *) * DEPTH * 2);
+    bench_intern(names, globals);
+    for (int i = 0; i < DEPTH * 2; i++)
+    {
+        locals[i] = make_name(names, "local_", i);
+    }
+    const char *shadowed[] = {intern_table_add(names, "i", 1), intern_table_add(names, "tmp", 3)};
+
+    bench_globals(names, globals);
+    bench_nested(globals, locals, shadowed);
+    bench_chained(globals, locals, shadowed);
+
+    free(globals);
+    free(locals);
+    intern_table_free(names);
+    return 0;
+}
@@ -0,0 +1,1394 @@
+#include "compiler.h"
+#include "helpers/vector.h"
+#include "helpers/hashmap.h"
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/**
+ * A register machine that runs the optimized IR without generating machine code.
+ * Every SSA value gets a register of the frame and phis become moves on the edges
+ * that lead to them. The interpreter is direct threaded, each instruction holds
+ * the address of its handler and every handler jumps straight to the next one.
+ * Values narrower than 64 bits are kept sign extended from their width, the form
+ * the optimizer folds constants in, so comparisons never need to know the width
+ */
+
+// reserved up front, pages are only used once deep calls reach them
+#define BYTECODE_STACK_SIZE (256ull << 20)
+// words in front of the registers: where to go back to, the caller's registers and the register the result goes to
+#define BYTECODE_FRAME_HEADER 3
+// native functions always get this many arguments, the ones they don't take are ignored
+#define BYTECODE_NATIVE_ARGUMENTS 16
+// register indexes of a call's arguments are packed into the instructions that follow it
+#define BYTECODE_ARGUMENTS_PER_SLOT (sizeof(struct bytecode_instruction) / sizeof(uint32_t))
+
+enum
+{
+    BYTECODE_CONST,
+    BYTECODE_MOVE,
+    BYTECODE_ALLOCA,
+    BYTECODE_ADD32,
+    BYTECODE_ADD64,
+    BYTECODE_SUB32,
+    BYTECODE_SUB64,
+    BYTECODE_MUL32,
+    BYTECODE_MUL64,
+    BYTECODE_SDIV32,
+    BYTECODE_SDIV64,
+    BYTECODE_UDIV32,
+    BYTECODE_UDIV64,
+    BYTECODE_SREM32,
+    BYTECODE_SREM64,
+    BYTECODE_UREM32,
+    BYTECODE_UREM64,
+    BYTECODE_AND,
+    BYTECODE_OR,
+    BYTECODE_XOR,
+    BYTECODE_SHL32,
+    BYTECODE_SHL64,
+    BYTECODE_SHR32,
+    BYTECODE_SHR64,
+    BYTECODE_SAR32,
+    BYTECODE_SAR64,
+    BYTECODE_NEG32,
+    BYTECODE_NEG64,
+    BYTECODE_NOT,
+    BYTECODE_EQ,
+    BYTECODE_NE,
+    BYTECODE_SLT,
+    BYTECODE_SLE,
+    BYTECODE_SGT,
+    BYTECODE_SGE,
+    BYTECODE_ULT,
+    BYTECODE_ULE,
+    BYTECODE_UGT,
+    BYTECODE_UGE,
+    // a comparison fused with the branch that uses it
+    BYTECODE_BRANCH_EQ,
+    BYTECODE_BRANCH_NE,
+    BYTECODE_BRANCH_SLT,
+    BYTECODE_BRANCH_SLE,
+    BYTECODE_BRANCH_SGT,
+    BYTECODE_BRANCH_SGE,
+    BYTECODE_BRANCH_ULT,
+    BYTECODE_BRANCH_ULE,
+    BYTECODE_BRANCH_UGT,
+    BYTECODE_BRANCH_UGE,
+    BYTECODE_ZEXT8,
+    BYTECODE_ZEXT16,
+    BYTECODE_ZEXT32,
+    BYTECODE_TRUNC8,
+    BYTECODE_TRUNC16,
+    BYTECODE_TRUNC32,
+    BYTECODE_LOAD8,
+    BYTECODE_LOAD16,
+    BYTECODE_LOAD32,
+    BYTECODE_LOAD64,
+    BYTECODE_STORE8,
+    BYTECODE_STORE16,
+    BYTECODE_STORE32,
+    BYTECODE_STORE64,
+    // destination, source, c bytes
+    BYTECODE_MEMCPY,
+    // address, c bytes
+    BYTECODE_ZERO,
+    // a is the index of the callee, b the number of arguments
+    BYTECODE_CALL,
+    // a is the index of the native function
+    BYTECODE_CALL_NATIVE,
+    // a holds the address of the callee
+    BYTECODE_CALL_INDIRECT,
+    // goes dst instructions further
+    BYTECODE_JUMP,
+    // goes dst instructions further when a is not zero and c otherwise
+    BYTECODE_BRANCH,
+    BYTECODE_RETURN,
+    BYTECODE_TOTAL
+};
+
+// operations of 32 bit and narrower values, narrower results are truncated afterwards
+static const int bytecode_operations32[IR_TOTAL] = {
+    [IR_ADD] = BYTECODE_ADD32,
+    [IR_SUB] = BYTECODE_SUB32,
+    [IR_MUL] = BYTECODE_MUL32,
+    [IR_SDIV] = BYTECODE_SDIV32,
+    [IR_UDIV] = BYTECODE_UDIV32,
+    [IR_SREM] = BYTECODE_SREM32,
+    [IR_UREM] = BYTECODE_UREM32,
+    [IR_AND] = BYTECODE_AND,
+    [IR_OR] = BYTECODE_OR,
+    [IR_XOR] = BYTECODE_XOR,
+    [IR_SHL] = BYTECODE_SHL32,
+    [IR_SHR] = BYTECODE_SHR32,
+    [IR_SAR] = BYTECODE_SAR32,
+    [IR_NEG] = BYTECODE_NEG32,
+    [IR_NOT] = BYTECODE_NOT};
+
+static const int bytecode_operations64[IR_TOTAL] = {
+    [IR_ADD] = BYTECODE_ADD64,
+    [IR_SUB] = BYTECODE_SUB64,
+    [IR_MUL] = BYTECODE_MUL64,
+    [IR_SDIV] = BYTECODE_SDIV64,
+    [IR_UDIV] = BYTECODE_UDIV64,
+    [IR_SREM] = BYTECODE_SREM64,
+    [IR_UREM] = BYTECODE_UREM64,
+    [IR_AND] = BYTECODE_AND,
+    [IR_OR] = BYTECODE_OR,
+    [IR_XOR] = BYTECODE_XOR,
+    [IR_SHL] = BYTECODE_SHL64,
+    [IR_SHR] = BYTECODE_SHR64,
+    [IR_SAR] = BYTECODE_SAR64,
+    [IR_NEG] = BYTECODE_NEG64,
+    [IR_NOT] = BYTECODE_NOT};
+
+// comparisons of sign extended values order the same at every width
+static const int bytecode_comparisons[IR_TOTAL] = {
+    [IR_EQ] = BYTECODE_EQ,
+    [IR_NE] = BYTECODE_NE,
+    [IR_SLT] = BYTECODE_SLT,
+    [IR_SLE] = BYTECODE_SLE,
+    [IR_SGT] = BYTECODE_SGT,
+    [IR_SGE] = BYTECODE_SGE,
+    [IR_ULT] = BYTECODE_ULT,
+    [IR_ULE] = BYTECODE_ULE,
+    [IR_UGT] = BYTECODE_UGT,
+    [IR_UGE] = BYTECODE_UGE};
+
+static const int bytecode_branches[IR_TOTAL] = {
+    [IR_EQ] = BYTECODE_BRANCH_EQ,
+    [IR_NE] = BYTECODE_BRANCH_NE,
+    [IR_SLT] = BYTECODE_BRANCH_SLT,
+    [IR_SLE] = BYTECODE_BRANCH_SLE,
+    [IR_SGT] = BYTECODE_BRANCH_SGT,
+    [IR_SGE] = BYTECODE_BRANCH_SGE,
+    [IR_ULT] = BYTECODE_BRANCH_ULT,
+    [IR_ULE] = BYTECODE_BRANCH_ULE,
+    [IR_UGT] = BYTECODE_BRANCH_UGT,
+    [IR_UGE] = BYTECODE_BRANCH_UGE};
+
+static const int bytecode_zero_extensions[] = {[1] = BYTECODE_ZEXT8, [2] = BYTECODE_ZEXT16, [4] = BYTECODE_ZEXT32};
+static const int bytecode_truncations[] = {[1] = BYTECODE_TRUNC8, [2] = BYTECODE_TRUNC16, [4] = BYTECODE_TRUNC32};
+static const int bytecode_loads[] = {[1] = BYTECODE_LOAD8, [2] = BYTECODE_LOAD16, [4] = BYTECODE_LOAD32, [8] = BYTECODE_LOAD64};
+static const int bytecode_stores[] = {[1] = BYTECODE_STORE8, [2] = BYTECODE_STORE16, [4] = BYTECODE_STORE32, [8] = BYTECODE_STORE64};
+
+// labels of the interpreter by opcode, filled in by the first call to bytecode_execute
+static const void **bytecode_handlers;
+
+/**
+ * A branch of the function whose target is only known once every block has been
+ * translated. Edges that need moves go through a stub emitted after the blocks
+ */
+struct bytecode_fixup
+{
+    uint32_t instruction;
+    // the target goes to c instead of dst
+    bool is_false;
+    // IR_NONE unless the target is a stub for the moves of the edge from pred to block
+    uint32_t pred;
+    uint32_t block;
+};
+
+struct bytecode_builder
+{
+    struct bytecode_program *program;
+    // name of every function and global of the module to its address
+    struct hashmap *symbols;
+    // name of a native function to its index + 1
+    struct hashmap *natives;
+
+    struct ir_function *function;
+    // register of every value, 0 for the values that have none
+    uint32_t *registers;
+    uint32_t register_count;
+    uint32_t *phi_counts;
+    // phis of an edge that read phis of the same block are copied through these
+    uint32_t temporaries;
+    // two registers narrow operations widen their operands in
+    uint32_t scratch;
+    // first instruction of each block
+    uint32_t *starts;
+    // where the stack allocations start, counted from the registers
+    long long frame_base;
+    long long frame_bytes;
+
+    struct bytecode_instruction *code;
+    uint32_t code_count;
+    uint32_t code_capacity;
+    // struct bytecode_fixup
+    struct vector *fixups;
+    bool ok;
+};
+
+static long long bytecode_execute(struct bytecode_program *program, struct bytecode_function *function, long long *arguments, int count);
+
+static uint32_t bytecode_register(struct bytecode_builder *builder, uint32_t value)
+{
+    return value == IR_NONE ? 0 : builder->registers[value];
+}
+
+static int bytecode_size(struct bytecode_builder *builder, uint32_t value)
+{
+    return ir_type_size(builder->function->instructions[value].type);
+}
+
+static uint32_t bytecode_emit(struct bytecode_builder *builder, int op)
+{
+    if (builder->code_count == builder->code_capacity)
+    {
+        builder->code_capacity = builder->code_capacity ? builder->code_capacity * 2 : 64;
+        builder->code = realloc(builder->code, sizeof(struct bytecode_instruction) * builder->code_capacity);
+    }
+
+    struct bytecode_instruction *instruction = &builder->code[builder->code_count];
+    memset(instruction, 0, sizeof(struct bytecode_instruction));
+    instruction->handler = bytecode_handlers[op];
+    return builder->code_count++;
+}
+
+static void bytecode_emit_unary(struct bytecode_builder *builder, int op, uint32_t dst, uint32_t a)
+{
+    uint32_t index = bytecode_emit(builder, op);
+    builder->code[index].dst = dst;
+    builder->code[index].a = a;
+}
+
+static void bytecode_emit_binary(struct bytecode_builder *builder, int op, uint32_t dst, uint32_t a, uint32_t b)
+{
+    uint32_t index = bytecode_emit(builder, op);
+    builder->code[index].dst = dst;
+    builder->code[index].a = a;
+    builder->code[index].b = b;
+}
+
+static void bytecode_emit_move(struct bytecode_builder *builder, uint32_t dst, uint32_t a)
+{
+    if (dst != a)
+    {
+        bytecode_emit_unary(builder, BYTECODE_MOVE, dst, a);
+    }
+}
+
+static void bytecode_add_fixup(struct bytecode_builder *builder, uint32_t instruction, bool is_false, uint32_t pred, uint32_t block)
+{
+    struct bytecode_fixup fixup = {.instruction = instruction, .is_false = is_false, .pred = pred, .block = block};
+    vector_push(builder->fixups, &fixup);
+}
+
+/**
+ * Constants, addresses of globals and stack allocations don't change while the
+ * function runs, they are all computed once on entry instead of in their blocks
+ */
+static bool bytecode_is_invariant(int op)
+{
+    return op == IR_CONST || op == IR_GLOBAL || op == IR_ALLOCA;
+}
+
+/**
+ * Address of a function or global of the program or of the C library, NULL if there is none
+ */
+static void *bytecode_address(struct bytecode_builder *builder, const char *symbol)
+{
+    void *address = hashmap_get(builder->symbols, symbol);
+    if (!address && !(address = dlsym(RTLD_DEFAULT, symbol)))
+    {
+        fprintf(stderr, "Undefined symbol %s\n", symbol);
+        builder->ok = false;
+    }
+    return address;
+}
+
+static int bytecode_native(struct bytecode_builder *builder, const char *symbol)
+{
+    struct bytecode_program *program = builder->program;
+    int index = (int)(uintptr_t)hashmap_get(builder->natives, symbol);
+    if (index)
+    {
+        return index - 1;
+    }
+
+    if (program->native_count == program->native_capacity)
+    {
+        program->native_capacity = program->native_capacity ? program->native_capacity * 2 : 16;
+        program->natives = realloc(program->natives, sizeof(void *) * program->native_capacity);
+    }
+    program->natives[program->native_count] = bytecode_address(builder, symbol);
+    hashmap_set(builder->natives, symbol, (void *)(uintptr_t)(program->native_count + 1));
+    return program->native_count++;
+}
+
+static bool bytecode_uses(struct ir_function *function, uint32_t index, uint32_t value)
+{
+    for (uint32_t i = 0; i < function->instructions[index].operand_count; i++)
+    {
+        if (ir_operand(function, index, i) == value)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * A value computed only to become a phi on the jump at the end of its block can be
+ * computed straight into the phi's register, which saves the move on the edge. The
+ * old value of the phi must not be needed after that: not later in the block and
+ * not by the other phis of the edge
+ */
+static bool bytecode_can_coalesce(struct ir_function *function, uint32_t phi, uint32_t position)
+{
+    struct ir_instruction *instruction = &function->instructions[phi];
+    uint32_t value = ir_operand(function, phi, position);
+    struct ir_instruction *definition = &function->instructions[value];
+    uint32_t pred = function->preds[function->blocks[instruction->block].preds + position];
+    struct ir_block *block = &function->blocks[pred];
+    if (value == IR_NONE || definition->block != pred || definition->op == IR_PHI || definition->op == IR_PARAM || bytecode_is_invariant(definition->op) ||
+        function->instructions[block->last].op != IR_JUMP || definition->first_use == IR_NONE || function->uses[definition->first_use].next != IR_NONE)
+    {
+        return false;
+    }
+
+    for (uint32_t index = definition->next; index != IR_NONE; index = function->instructions[index].next)
+    {
+        if (bytecode_uses(function, index, phi))
+        {
+            return false;
+        }
+    }
+
+    for (uint32_t index = function->blocks[instruction->block].first; index != IR_NONE; index = function->instructions[index].next)
+    {
+        if (function->instructions[index].op == IR_PHI && ir_operand(function, index, position) == phi)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Gives every value a register. The parameters come first so the caller knows
+ * where to put the arguments, the temporaries and scratch registers come last
+ */
+static void bytecode_assign_registers(struct bytecode_builder *builder, struct bytecode_function *target)
+{
+    struct ir_function *function = builder->function;
+    builder->registers = calloc(function->instruction_count, sizeof(uint32_t));
+    builder->phi_counts = calloc(function->block_count, sizeof(uint32_t));
+    target->parameter_count = 0;
+    for (uint32_t block = 1; block < function->block_count; block++)
+    {
+        if (function->blocks[block].flags & IR_BLOCK_FLAG_DEAD)
+        {
+            continue;
+        }
+
+        for (uint32_t index = function->blocks[block].first; index != IR_NONE; index = function->instructions[index].next)
+        {
+            struct ir_instruction *instruction = &function->instructions[index];
+            if (instruction->op == IR_PARAM)
+            {
+                builder->registers[index] = 1 + instruction->constant;
+                target->parameter_count = instruction->constant + 1 > target->parameter_count ? instruction->constant + 1 : target->parameter_count;
+            }
+            builder->phi_counts[block] += instruction->op == IR_PHI;
+        }
+    }
+
+    uint32_t next = 1 + target->parameter_count;
+    uint32_t most_phis = 0;
+    for (uint32_t block = 1; block < function->block_count; block++)
+    {
+        if (function->blocks[block].flags & IR_BLOCK_FLAG_DEAD)
+        {
+            continue;
+        }
+
+        most_phis = builder->phi_counts[block] > most_phis ? builder->phi_counts[block] : most_phis;
+        for (uint32_t index = function->blocks[block].first; index != IR_NONE; index = function->instructions[index].next)
+        {
+            struct ir_instruction *instruction = &function->instructions[index];
+            if (instruction->op != IR_PARAM && instruction->op != IR_NOP && instruction->type != IR_TYPE_VOID)
+            {
+                builder->registers[index] = next++;
+            }
+        }
+    }
+
+    builder->temporaries = next;
+    builder->scratch = next + most_phis;
+    builder->register_count = builder->scratch + 2;
+
+    for (uint32_t block = 1; block < function->block_count; block++)
+    {
+        struct ir_block *target = &function->blocks[block];
+        for (uint32_t index = target->first; index != IR_NONE && !(target->flags & IR_BLOCK_FLAG_DEAD); index = function->instructions[index].next)
+        {
+            for (uint32_t position = 0; function->instructions[index].op == IR_PHI && position < target->pred_count; position++)
+            {
+                if (bytecode_can_coalesce(function, index, position))
+                {
+                    builder->registers[ir_operand(function, index, position)] = builder->registers[index];
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Copies the values the phis of block take when it is entered from pred
+ */
+static void bytecode_edge_moves(struct bytecode_builder *builder, uint32_t pred, uint32_t block)
+{
+    struct ir_function *function = builder->function;
+    struct ir_block *target = &function->blocks[block];
+    uint32_t position = 0;
+    while (position < target->pred_count && function->preds[target->preds + position] != pred)
+    {
+        position++;
+    }
+
+    // a phi that reads another phi of the block needs its value from before the edge
+    bool through_temporaries = false;
+    for (uint32_t index = target->first; index != IR_NONE; index = function->instructions[index].next)
+    {
+        if (function->instructions[index].op == IR_PHI)
+        {
+            struct ir_instruction *source = &function->instructions[ir_operand(function, index, position)];
+            through_temporaries |= source->op == IR_PHI && source->block == block;
+        }
+    }
+
+    uint32_t phi = 0;
+    for (uint32_t index = target->first; index != IR_NONE; index = function->instructions[index].next)
+    {
+        if (function->instructions[index].op == IR_PHI)
+        {
+            uint32_t source = bytecode_register(builder, ir_operand(function, index, position));
+            bytecode_emit_move(builder, through_temporaries ? builder->temporaries + phi++ : builder->registers[index], source);
+        }
+    }
+
+    phi = 0;
+    for (uint32_t index = target->first; index != IR_NONE && through_temporaries; index = function->instructions[index].next)
+    {
+        if (function->instructions[index].op == IR_PHI)
+        {
+            bytecode_emit_move(builder, builder->registers[index], builder->temporaries + phi++);
+        }
+    }
+}
+
+/**
+ * A comparison whose only user is the branch right after it is done by the branch
+ */
+static bool bytecode_is_fused(struct ir_function *function, uint32_t index)
+{
+    struct ir_instruction *instruction = &function->instructions[index];
+    if (!bytecode_comparisons[instruction->op])
+    {
+        return false;
+    }
+
+    if (instruction->first_use == IR_NONE || function->uses[instruction->first_use].next != IR_NONE)
+    {
+        return false;
+    }
+
+    uint32_t user = function->uses[instruction->first_use].user;
+    return user == instruction->next && function->instructions[user].op == IR_BRANCH;
+}
+
+static void bytecode_arithmetic(struct bytecode_builder *builder, uint32_t index)
+{
+    struct ir_function *function = builder->function;
+    int op = function->instructions[index].op;
+    int size = bytecode_size(builder, index);
+    uint32_t dst = builder->registers[index];
+    uint32_t left = bytecode_register(builder, ir_operand(function, index, 0));
+    uint32_t right = function->instructions[index].operand_count > 1 ? bytecode_register(builder, ir_operand(function, index, 1)) : 0;
+    if (size == 8)
+    {
+        bytecode_emit_binary(builder, bytecode_operations64[op], dst, left, right);
+        return;
+    }
+
+    // narrow values are done in 32 bits like the code generator does, the ones
+    // that look at the upper bits as unsigned are widened first
+    if (size < 4 && (op == IR_SHR || op == IR_UDIV || op == IR_UREM))
+    {
+        bytecode_emit_unary(builder, bytecode_zero_extensions[size], builder->scratch, left);
+        left = builder->scratch;
+        if (op != IR_SHR)
+        {
+            bytecode_emit_unary(builder, bytecode_zero_extensions[size], builder->scratch + 1, right);
+            right = builder->scratch + 1;
+        }
+    }
+
+    bytecode_emit_binary(builder, bytecode_operations32[op], dst, left, right);
+    if (size < 4)
+    {
+        bytecode_emit_unary(builder, bytecode_truncations[size], dst, dst);
+    }
+}
+
+static void bytecode_convert(struct bytecode_builder *builder, uint32_t index)
+{
+    struct ir_function *function = builder->function;
+    int op = function->instructions[index].op;
+    uint32_t operand = ir_operand(function, index, 0);
+    uint32_t dst = builder->registers[index];
+    uint32_t source = bytecode_register(builder, operand);
+    if (op == IR_SEXT)
+    {
+        // already sign extended
+        bytecode_emit_move(builder, dst, source);
+    }
+    else if (op == IR_ZEXT)
+    {
+        bytecode_emit_unary(builder, bytecode_zero_extensions[bytecode_size(builder, operand)], dst, source);
+    }
+    else
+    {
+        bytecode_emit_unary(builder, bytecode_truncations[bytecode_size(builder, index)], dst, source);
+    }
+}
+
+static void bytecode_call_instruction(struct bytecode_builder *builder, uint32_t index)
+{
+    struct ir_function *function = builder->function;
+    struct ir_instruction *instruction = &function->instructions[index];
+    uint32_t argument_count = instruction->operand_count - 1;
+    struct ir_instruction *callee = &function->instructions[ir_operand(function, index, 0)];
+
+    struct bytecode_program *program = builder->program;
+    struct bytecode_function *target = NULL;
+    if (callee->op == IR_GLOBAL && !callee->constant)
+    {
+        target = hashmap_get(builder->symbols, callee->symbol);
+        target = target >= program->functions && target < program->functions + program->function_count ? target : NULL;
+    }
+
+    uint32_t call;
+    if (target)
+    {
+        call = bytecode_emit(builder, BYTECODE_CALL);
+        builder->code[call].a = target - program->functions;
+    }
+    else if (callee->op == IR_GLOBAL && !callee->constant)
+    {
+        int native = bytecode_native(builder, callee->symbol);
+        call = bytecode_emit(builder, BYTECODE_CALL_NATIVE);
+        builder->code[call].a = native;
+    }
+    else
+    {
+        call = bytecode_emit(builder, BYTECODE_CALL_INDIRECT);
+        builder->code[call].a = bytecode_register(builder, ir_operand(function, index, 0));
+    }
+
+    // only calls that stay in the bytecode take any number of arguments
+    if (!target && argument_count > BYTECODE_NATIVE_ARGUMENTS)
+    {
+        fprintf(stderr, "Cannot call %s with more than %i arguments in bytecode\n", function->name, BYTECODE_NATIVE_ARGUMENTS);
+        builder->ok = false;
+    }
+
+    builder->code[call].dst = builder->registers[index];
+    builder->code[call].b = argument_count;
+    uint32_t slots = (argument_count + BYTECODE_ARGUMENTS_PER_SLOT - 1) / BYTECODE_ARGUMENTS_PER_SLOT;
+    for (uint32_t i = 0; i < slots; i++)
+    {
+        bytecode_emit(builder, BYTECODE_CONST);
+    }
+
+    uint32_t *arguments = (uint32_t *)&builder->code[call + 1];
+    memset(arguments, 0, slots * sizeof(struct bytecode_instruction));
+    for (uint32_t i = 0; i < argument_count; i++)
+    {
+        arguments[i] = bytecode_register(builder, ir_operand(function, index, i + 1));
+    }
+
+    // native code leaves the upper bits of narrow results undefined
+    int size = ir_type_size(instruction->type);
+    if (!target && size && size < 8)
+    {
+        bytecode_emit_unary(builder, bytecode_truncations[size], builder->registers[index], builder->registers[index]);
+    }
+}
+
+static void bytecode_branch(struct bytecode_builder *builder, uint32_t block, uint32_t index, uint32_t previous)
+{
+    struct ir_function *function = builder->function;
+    uint32_t branch;
+    if (previous != IR_NONE && bytecode_is_fused(function, previous))
+    {
+        branch = bytecode_emit(builder, bytecode_branches[function->instructions[previous].op]);
+        builder->code[branch].a = bytecode_register(builder, ir_operand(function, previous, 0));
+        builder->code[branch].b = bytecode_register(builder, ir_operand(function, previous, 1));
+    }
+    else
+    {
+        branch = bytecode_emit(builder, BYTECODE_BRANCH);
+        builder->code[branch].a = bytecode_register(builder, ir_operand(function, index, 0));
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        uint32_t succ = function->blocks[block].successors[i];
+        bytecode_add_fixup(builder, branch, i == 1, builder->phi_counts[succ] ? block : IR_NONE, succ);
+    }
+}
+
+/**
+ * Whether the block is nothing but phis and a branch, the comparison of a fused branch included
+ */
+static bool bytecode_only_branches(struct ir_function *function, uint32_t block)
+{
+    uint32_t last = function->blocks[block].last;
+    if (function->instructions[last].op != IR_BRANCH)
+    {
+        return false;
+    }
+
+    for (uint32_t index = function->blocks[block].first; index != last; index = function->instructions[index].next)
+    {
+        int op = function->instructions[index].op;
+        if (op != IR_PHI && op != IR_NOP && !(index == function->instructions[last].prev && bytecode_is_fused(function, index)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void bytecode_invariant(struct bytecode_builder *builder, uint32_t index)
+{
+    struct ir_instruction *instruction = &builder->function->instructions[index];
+    uint32_t instruction_index = bytecode_emit(builder, instruction->op == IR_ALLOCA ? BYTECODE_ALLOCA : BYTECODE_CONST);
+    struct bytecode_instruction *emitted = &builder->code[instruction_index];
+    emitted->dst = builder->registers[index];
+    switch (instruction->op)
+    {
+    case IR_CONST:
+        emitted->constant = instruction->constant;
+        break;
+
+    case IR_GLOBAL:
+        emitted->constant = (long long)(uintptr_t)bytecode_address(builder, instruction->symbol) + instruction->constant;
+        break;
+
+    case IR_ALLOCA:
+    {
+        // the frame is 16 byte aligned, so are the stack allocations after the registers
+        long long align = instruction->aux > 16 ? 16 : instruction->aux < 1 ? 1 : instruction->aux;
+        builder->frame_bytes = (builder->frame_bytes + align - 1) / align * align;
+        emitted->constant = builder->frame_base + builder->frame_bytes;
+        builder->frame_bytes += instruction->constant;
+        break;
+    }
+    }
+}
+
+static void bytecode_instruction(struct bytecode_builder *builder, uint32_t block, uint32_t index, uint32_t next_block)
+{
+    struct ir_function *function = builder->function;
+    struct ir_instruction *instruction = &function->instructions[index];
+    uint32_t dst = builder->registers[index];
+    switch (instruction->op)
+    {
+    case IR_NOP:
+    case IR_PARAM:
+    case IR_PHI:
+    case IR_CONST:
+    case IR_GLOBAL:
+    case IR_ALLOCA:
+        return;
+
+    case IR_LOAD:
+        bytecode_emit_unary(builder, bytecode_loads[bytecode_size(builder, index)], dst, bytecode_register(builder, ir_operand(function, index, 0)));
+        return;
+
+    case IR_STORE:
+    {
+        uint32_t value = ir_operand(function, index, 1);
+        uint32_t store = bytecode_emit(builder, bytecode_stores[bytecode_size(builder, value)]);
+        builder->code[store].a = bytecode_register(builder, ir_operand(function, index, 0));
+        builder->code[store].b = bytecode_register(builder, value);
+        return;
+    }
+
+    case IR_MEMCPY:
+    case IR_ZERO:
+    {
+        uint32_t copy = bytecode_emit(builder, instruction->op == IR_MEMCPY ? BYTECODE_MEMCPY : BYTECODE_ZERO);
+        builder->code[copy].a = bytecode_register(builder, ir_operand(function, index, 0));
+        builder->code[copy].b = instruction->op == IR_MEMCPY ? bytecode_register(builder, ir_operand(function, index, 1)) : 0;
+        builder->code[copy].c = instruction->constant;
+        return;
+    }
+
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_SDIV:
+    case IR_UDIV:
+    case IR_SREM:
+    case IR_UREM:
+    case IR_AND:
+    case IR_OR:
+    case IR_XOR:
+    case IR_SHL:
+    case IR_SHR:
+    case IR_SAR:
+    case IR_NEG:
+    case IR_NOT:
+        bytecode_arithmetic(builder, index);
+        return;
+
+    case IR_EQ:
+    case IR_NE:
+    case IR_SLT:
+    case IR_SLE:
+    case IR_SGT:
+    case IR_SGE:
+    case IR_ULT:
+    case IR_ULE:
+    case IR_UGT:
+    case IR_UGE:
+        if (!bytecode_is_fused(function, index))
+        {
+            bytecode_emit_binary(builder, bytecode_comparisons[instruction->op], dst, bytecode_register(builder, ir_operand(function, index, 0)),
+                                 bytecode_register(builder, ir_operand(function, index, 1)));
+        }
+        return;
+
+    case IR_SEXT:
+    case IR_ZEXT:
+    case IR_TRUNC:
+        bytecode_convert(builder, index);
+        return;
+
+    case IR_CALL:
+        bytecode_call_instruction(builder, index);
+        return;
+
+    case IR_JUMP:
+    {
+        uint32_t succ = function->blocks[block].successors[0];
+        if (builder->phi_counts[succ])
+        {
+            bytecode_edge_moves(builder, block, succ);
+        }
+        if (succ == next_block)
+        {
+            return;
+        }
+
+        // a jump back to a loop header that only branches does the branch itself
+        uint32_t last = function->blocks[succ].last;
+        if (bytecode_only_branches(function, succ))
+        {
+            bytecode_branch(builder, succ, last, function->instructions[last].prev);
+            return;
+        }
+        bytecode_add_fixup(builder, bytecode_emit(builder, BYTECODE_JUMP), false, IR_NONE, succ);
+        return;
+    }
+
+    case IR_BRANCH:
+        bytecode_branch(builder, block, index, instruction->prev);
+        return;
+
+    case IR_RETURN:
+        bytecode_emit_unary(builder, BYTECODE_RETURN, 0, instruction->operand_count ? bytecode_register(builder, ir_operand(function, index, 0)) : 0);
+        return;
+    }
+
+    fprintf(stderr, "Cannot translate IR instruction %i of %s to bytecode\n", instruction->op, function->name);
+    builder->ok = false;
+}
+
+/**
+ * Points the branches at their blocks, emitting the stubs of edges with moves on the way
+ */
+static void bytecode_resolve_fixups(struct bytecode_builder *builder)
+{
+    for (int i = 0; i < vector_count(builder->fixups); i++)
+    {
+        struct bytecode_fixup fixup = *(struct bytecode_fixup *)vector_at(builder->fixups, i);
+        uint32_t target = builder->starts[fixup.block];
+        if (fixup.pred != IR_NONE)
+        {
+            target = builder->code_count;
+            bytecode_edge_moves(builder, fixup.pred, fixup.block);
+            bytecode_add_fixup(builder, bytecode_emit(builder, BYTECODE_JUMP), false, IR_NONE, fixup.block);
+        }
+
+        // relative to the branch, the interpreter never needs to know which function it is in
+        uint32_t offset = target - fixup.instruction;
+        if (fixup.is_false)
+        {
+            builder->code[fixup.instruction].c = offset;
+        }
+        else
+        {
+            builder->code[fixup.instruction].dst = offset;
+        }
+    }
+}
+
+static void bytecode_function(struct bytecode_builder *builder, struct ir_function *function, struct bytecode_function *target)
+{
+    builder->function = function;
+    builder->code = NULL;
+    builder->code_count = 0;
+    builder->code_capacity = 0;
+    builder->frame_bytes = 0;
+    builder->fixups = vector_create(sizeof(struct bytecode_fixup));
+    builder->starts = calloc(function->block_count, sizeof(uint32_t));
+    ir_compute_predecessors(function);
+    bytecode_assign_registers(builder, target);
+
+    // the registers start 16 byte aligned after the header, the stack allocations follow them
+    uint32_t register_words = (BYTECODE_FRAME_HEADER + builder->register_count + 1) / 2 * 2;
+    builder->frame_base = (register_words - BYTECODE_FRAME_HEADER) * 8;
+
+    for (uint32_t block = 1; block < function->block_count; block++)
+    {
+        if (function->blocks[block].flags & IR_BLOCK_FLAG_DEAD)
+        {
+            continue;
+        }
+
+        for (uint32_t index = function->blocks[block].first; index != IR_NONE; index = function->instructions[index].next)
+        {
+            if (bytecode_is_invariant(function->instructions[index].op))
+            {
+                bytecode_invariant(builder, index);
+            }
+        }
+    }
+
+    for (uint32_t block = 1; block < function->block_count; block++)
+    {
+        if (function->blocks[block].flags & IR_BLOCK_FLAG_DEAD)
+        {
+            continue;
+        }
+
+        uint32_t next_block = block + 1;
+        while (next_block < function->block_count && function->blocks[next_block].flags & IR_BLOCK_FLAG_DEAD)
+        {
+            next_block++;
+        }
+
+        builder->starts[block] = builder->code_count;
+        for (uint32_t index = function->blocks[block].first; index != IR_NONE; index = function->instructions[index].next)
+        {
+            bytecode_instruction(builder, block, index, next_block);
+        }
+    }
+    bytecode_resolve_fixups(builder);
+
+    target->name = function->name;
+    target->code = builder->code;
+    target->code_count = builder->code_count;
+    target->frame_words = register_words + (builder->frame_bytes + 15) / 16 * 2;
+
+    vector_free(builder->fixups);
+    free(builder->starts);
+    free(builder->registers);
+    free(builder->phi_counts);
+}
+
+/**
+ * Lays out the globals and translates every function, NULL if the program uses a
+ * symbol that neither it nor the C library defines
+ */
+struct bytecode_program *bytecode_create(struct ir_module *module)
+{
+    if (!bytecode_handlers)
+    {
+        bytecode_execute(NULL, NULL, NULL, 0);
+    }
+
+    struct bytecode_program *program = calloc(1, sizeof(struct bytecode_program));
+    struct bytecode_builder builder = {.program = program, .symbols = hashmap_create(), .natives = hashmap_create(), .ok = true};
+    program->indexes = hashmap_create();
+    program->function_count = vector_count(module->functions);
+    program->functions = calloc(program->function_count + 1, sizeof(struct bytecode_function));
+    for (int i = 0; i < program->function_count; i++)
+    {
+        struct ir_function *function = *(struct ir_function **)vector_at(module->functions, i);
+        hashmap_set(builder.symbols, function->name, &program->functions[i]);
+        hashmap_set(program->indexes, function->name, &program->functions[i]);
+    }
+
+    program->global_count = vector_count(module->globals);
+    program->globals = calloc(program->global_count + 1, sizeof(void *));
+    for (int i = 0; i < program->global_count; i++)
+    {
+        struct ir_global *global = *(struct ir_global **)vector_at(module->globals, i);
+        program->globals[i] = calloc(1, global->size ? global->size : 1);
+        if (global->data)
+        {
+            memcpy(program->globals[i], global->data, global->size);
+        }
+        hashmap_set(builder.symbols, global->name, program->globals[i]);
+    }
+
+    for (int i = 0; i < program->global_count; i++)
+    {
+        struct ir_global *global = *(struct ir_global **)vector_at(module->globals, i);
+        for (int r = 0; global->relocations && r < vector_count(global->relocations); r++)
+        {
+            struct ir_relocation *relocation = vector_at(global->relocations, r);
+            uintptr_t address = (uintptr_t)bytecode_address(&builder, relocation->symbol) + relocation->addend;
+            memcpy((char *)program->globals[i] + relocation->offset, &address, sizeof(address));
+        }
+    }
+
+    for (int i = 0; i < program->function_count; i++)
+    {
+        bytecode_function(&builder, *(struct ir_function **)vector_at(module->functions, i), &program->functions[i]);
+    }
+
+    program->stack = mmap(NULL, BYTECODE_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    program->stack_end = program->stack + BYTECODE_STACK_SIZE / sizeof(long long);
+    hashmap_free(builder.symbols);
+    hashmap_free(builder.natives);
+    if (!builder.ok || program->stack == MAP_FAILED)
+    {
+        if (program->stack == MAP_FAILED)
+        {
+            program->stack = NULL;
+        }
+        bytecode_free(program);
+        return NULL;
+    }
+    return program;
+}
+
+struct bytecode_function *bytecode_find(struct bytecode_program *program, const char *name)
+{
+    return hashmap_get(program->indexes, name);
+}
+
+long long bytecode_call(struct bytecode_program *program, struct bytecode_function *function, long long *arguments, int count)
+{
+    return bytecode_execute(program, function, arguments, count);
+}
+
+void bytecode_free(struct bytecode_program *program)
+{
+    for (int i = 0; i < program->function_count; i++)
+    {
+        free(program->functions[i].code);
+    }
+    for (int i = 0; i < program->global_count; i++)
+    {
+        free(program->globals[i]);
+    }
+    if (program->stack)
+    {
+        munmap(program->stack, BYTECODE_STACK_SIZE);
+    }
+    hashmap_free(program->indexes);
+    free(program->functions);
+    free(program->globals);
+    free(program->natives);
+    free(program);
+}
+
+#define BYTECODE_NEXT() goto *(++ip)->handler
+#define BYTECODE_R(field) r[ip->field]
+
+/**
+ * Runs the function on the program's stack. A frame is the header, the registers
+ * and the stack allocations; calls between functions of the program push frames
+ * instead of recursing here. Called without a program it only publishes the
+ * addresses of its handlers
+ */
+static long long bytecode_execute(struct bytecode_program *program, struct bytecode_function *function, long long *arguments, int count)
+{
+    static const void *handlers[BYTECODE_TOTAL] = {
+        [BYTECODE_CONST] = &&bytecode_const,
+        [BYTECODE_MOVE] = &&bytecode_move,
+        [BYTECODE_ALLOCA] = &&bytecode_alloca,
+        [BYTECODE_ADD32] = &&bytecode_add32,
+        [BYTECODE_ADD64] = &&bytecode_add64,
+        [BYTECODE_SUB32] = &&bytecode_sub32,
+        [BYTECODE_SUB64] = &&bytecode_sub64,
+        [BYTECODE_MUL32] = &&bytecode_mul32,
+        [BYTECODE_MUL64] = &&bytecode_mul64,
+        [BYTECODE_SDIV32] = &&bytecode_sdiv32,
+        [BYTECODE_SDIV64] = &&bytecode_sdiv64,
+        [BYTECODE_UDIV32] = &&bytecode_udiv32,
+        [BYTECODE_UDIV64] = &&bytecode_udiv64,
+        [BYTECODE_SREM32] = &&bytecode_srem32,
+        [BYTECODE_SREM64] = &&bytecode_srem64,
+        [BYTECODE_UREM32] = &&bytecode_urem32,
+        [BYTECODE_UREM64] = &&bytecode_urem64,
+        [BYTECODE_AND] = &&bytecode_and,
+        [BYTECODE_OR] = &&bytecode_or,
+        [BYTECODE_XOR] = &&bytecode_xor,
+        [BYTECODE_SHL32] = &&bytecode_shl32,
+        [BYTECODE_SHL64] = &&bytecode_shl64,
+        [BYTECODE_SHR32] = &&bytecode_shr32,
+        [BYTECODE_SHR64] = &&bytecode_shr64,
+        [BYTECODE_SAR32] = &&bytecode_sar32,
+        [BYTECODE_SAR64] = &&bytecode_sar64,
+        [BYTECODE_NEG32] = &&bytecode_neg32,
+        [BYTECODE_NEG64] = &&bytecode_neg64,
+        [BYTECODE_NOT] = &&bytecode_not,
+        [BYTECODE_EQ] = &&bytecode_eq,
+        [BYTECODE_NE] = &&bytecode_ne,
+        [BYTECODE_SLT] = &&bytecode_slt,
+        [BYTECODE_SLE] = &&bytecode_sle,
+        [BYTECODE_SGT] = &&bytecode_sgt,
+        [BYTECODE_SGE] = &&bytecode_sge,
+        [BYTECODE_ULT] = &&bytecode_ult,
+        [BYTECODE_ULE] = &&bytecode_ule,
+        [BYTECODE_UGT] = &&bytecode_ugt,
+        [BYTECODE_UGE] = &&bytecode_uge,
+        [BYTECODE_BRANCH_EQ] = &&bytecode_branch_eq,
+        [BYTECODE_BRANCH_NE] = &&bytecode_branch_ne,
+        [BYTECODE_BRANCH_SLT] = &&bytecode_branch_slt,
+        [BYTECODE_BRANCH_SLE] = &&bytecode_branch_sle,
+        [BYTECODE_BRANCH_SGT] = &&bytecode_branch_sgt,
+        [BYTECODE_BRANCH_SGE] = &&bytecode_branch_sge,
+        [BYTECODE_BRANCH_ULT] = &&bytecode_branch_ult,
+        [BYTECODE_BRANCH_ULE] = &&bytecode_branch_ule,
+        [BYTECODE_BRANCH_UGT] = &&bytecode_branch_ugt,
+        [BYTECODE_BRANCH_UGE] = &&bytecode_branch_uge,
+        [BYTECODE_ZEXT8] = &&bytecode_zext8,
+        [BYTECODE_ZEXT16] = &&bytecode_zext16,
+        [BYTECODE_ZEXT32] = &&bytecode_zext32,
+        [BYTECODE_TRUNC8] = &&bytecode_trunc8,
+        [BYTECODE_TRUNC16] = &&bytecode_trunc16,
+        [BYTECODE_TRUNC32] = &&bytecode_trunc32,
+        [BYTECODE_LOAD8] = &&bytecode_load8,
+        [BYTECODE_LOAD16] = &&bytecode_load16,
+        [BYTECODE_LOAD32] = &&bytecode_load32,
+        [BYTECODE_LOAD64] = &&bytecode_load64,
+        [BYTECODE_STORE8] = &&bytecode_store8,
+        [BYTECODE_STORE16] = &&bytecode_store16,
+        [BYTECODE_STORE32] = &&bytecode_store32,
+        [BYTECODE_STORE64] = &&bytecode_store64,
+        [BYTECODE_MEMCPY] = &&bytecode_memcpy,
+        [BYTECODE_ZERO] = &&bytecode_zero,
+        [BYTECODE_CALL] = &&bytecode_call_direct,
+        [BYTECODE_CALL_NATIVE] = &&bytecode_call_native,
+        [BYTECODE_CALL_INDIRECT] = &&bytecode_call_indirect,
+        [BYTECODE_JUMP] = &&bytecode_jump,
+        [BYTECODE_BRANCH] = &&bytecode_branch,
+        [BYTECODE_RETURN] = &&bytecode_return};
+
+    if (!program)
+    {
+        bytecode_handlers = handlers;
+        return 0;
+    }
+
+    long long *r = program->stack + BYTECODE_FRAME_HEADER;
+    long long *top = program->stack + function->frame_words;
+    r[-3] = 0;
+    for (int i = 0; i < count && (uint32_t)i < function->parameter_count; i++)
+    {
+        r[1 + i] = arguments[i];
+    }
+
+    struct bytecode_function *callee;
+    void *native;
+    struct bytecode_instruction *ip = function->code;
+    goto *ip->handler;
+
+bytecode_const:
+    BYTECODE_R(dst) = ip->constant;
+    BYTECODE_NEXT();
+bytecode_move:
+    BYTECODE_R(dst) = BYTECODE_R(a);
+    BYTECODE_NEXT();
+bytecode_alloca:
+    BYTECODE_R(dst) = (long long)(uintptr_t)((char *)r + ip->constant);
+    BYTECODE_NEXT();
+
+bytecode_add32:
+    BYTECODE_R(dst) = (int32_t)((uint32_t)BYTECODE_R(a) + (uint32_t)BYTECODE_R(b));
+    BYTECODE_NEXT();
+bytecode_add64:
+    BYTECODE_R(dst) = (unsigned long long)BYTECODE_R(a) + BYTECODE_R(b);
+    BYTECODE_NEXT();
+bytecode_sub32:
+    BYTECODE_R(dst) = (int32_t)((uint32_t)BYTECODE_R(a) - (uint32_t)BYTECODE_R(b));
+    BYTECODE_NEXT();
+bytecode_sub64:
+    BYTECODE_R(dst) = (unsigned long long)BYTECODE_R(a) - BYTECODE_R(b);
+    BYTECODE_NEXT();
+bytecode_mul32:
+    BYTECODE_R(dst) = (int32_t)((uint32_t)BYTECODE_R(a) * (uint32_t)BYTECODE_R(b));
+    BYTECODE_NEXT();
+bytecode_mul64:
+    BYTECODE_R(dst) = (unsigned long long)BYTECODE_R(a) * BYTECODE_R(b);
+    BYTECODE_NEXT();
+
+    // division by zero traps like the machine code does
+bytecode_sdiv32:
+    BYTECODE_R(dst) = (int32_t)BYTECODE_R(a) / (int32_t)BYTECODE_R(b);
+    BYTECODE_NEXT();
+bytecode_sdiv64:
+    BYTECODE_R(dst) = BYTECODE_R(a) / BYTECODE_R(b);
+    BYTECODE_NEXT();
+bytecode_udiv32:
+    BYTECODE_R(dst) = (int32_t)((uint32_t)BYTECODE_R(a) / (uint32_t)BYTECODE_R(b));
+    BYTECODE_NEXT();
+bytecode_udiv64:
+    BYTECODE_R(dst) = (unsigned long long)BYTECODE_R(a) / (unsigned long long)BYTECODE_R(b);
+    BYTECODE_NEXT();
+bytecode_srem32:
+    BYTECODE_R(dst) = (int32_t)BYTECODE_R(a) % (int32_t)BYTECODE_R(b);
+    BYTECODE_NEXT();
+bytecode_srem64:
+    BYTECODE_R(dst) = BYTECODE_R(a) % BYTECODE_R(b);
+    BYTECODE_NEXT();
+bytecode_urem32:
+    BYTECODE_R(dst) = (int32_t)((uint32_t)BYTECODE_R(a) % (uint32_t)BYTECODE_R(b));
+    BYTECODE_NEXT();
+bytecode_urem64:
+    BYTECODE_R(dst) = (unsigned long long)BYTECODE_R(a) % (unsigned long long)BYTECODE_R(b);
+    BYTECODE_NEXT();
+
+bytecode_and:
+    BYTECODE_R(dst) = BYTECODE_R(a) & BYTECODE_R(b);
+    BYTECODE_NEXT();
+bytecode_or:
+    BYTECODE_R(dst) = BYTECODE_R(a) | BYTECODE_R(b);
+    BYTECODE_NEXT();
+bytecode_xor:
+    BYTECODE_R(dst) = BYTECODE_R(a) ^ BYTECODE_R(b);
+    BYTECODE_NEXT();
+
+    // shift counts wrap at the width of the operation like they do on x86
+bytecode_shl32:
+    BYTECODE_R(dst) = (int32_t)((uint32_t)BYTECODE_R(a) << (BYTECODE_R(b) & 31));
+    BYTECODE_NEXT();
+bytecode_shl64:
+    BYTECODE_R(dst) = (unsigned long long)BYTECODE_R(a) << (BYTECODE_R(b) & 63);
+    BYTECODE_NEXT();
+bytecode_shr32:
+    BYTECODE_R(dst) = (int32_t)((uint32_t)BYTECODE_R(a) >> (BYTECODE_R(b) & 31));
+    BYTECODE_NEXT();
+bytecode_shr64:
+    BYTECODE_R(dst) = (unsigned long long)BYTECODE_R(a) >> (BYTECODE_R(b) & 63);
+    BYTECODE_NEXT();
+bytecode_sar32:
+    BYTECODE_R(dst) = (int32_t)BYTECODE_R(a) >> (BYTECODE_R(b) & 31);
+    BYTECODE_NEXT();
+bytecode_sar64:
+    BYTECODE_R(dst) = BYTECODE_R(a) >> (BYTECODE_R(b) & 63);
+    BYTECODE_NEXT();
+
+bytecode_neg32:
+    BYTECODE_R(dst) = (int32_t)-(uint32_t)BYTECODE_R(a);
+    BYTECODE_NEXT();
+bytecode_neg64:
+    BYTECODE_R(dst) = -(unsigned long long)BYTECODE_R(a);
+    BYTECODE_NEXT();
+bytecode_not:
+    BYTECODE_R(dst) = ~BYTECODE_R(a);
+    BYTECODE_NEXT();
+
+bytecode_eq:
+    BYTECODE_R(dst) = BYTECODE_R(a) == BYTECODE_R(b);
+    BYTECODE_NEXT();
+bytecode_ne:
+    BYTECODE_R(dst) = BYTECODE_R(a) != BYTECODE_R(b);
+    BYTECODE_NEXT();
+bytecode_slt:
+    BYTECODE_R(dst) = BYTECODE_R(a) < BYTECODE_R(b);
+    BYTECODE_NEXT();
+bytecode_sle:
+    BYTECODE_R(dst) = BYTECODE_R(a) <= BYTECODE_R(b);
+    BYTECODE_NEXT();
+bytecode_sgt:
+    BYTECODE_R(dst) = BYTECODE_R(a) > BYTECODE_R(b);
+    BYTECODE_NEXT();
+bytecode_sge:
+    BYTECODE_R(dst) = BYTECODE_R(a) >= BYTECODE_R(b);
+    BYTECODE_NEXT();
+bytecode_ult:
+    BYTECODE_R(dst) = (unsigned long long)BYTECODE_R(a) < (unsigned long long)BYTECODE_R(b);
+    BYTECODE_NEXT();
+bytecode_ule:
+    BYTECODE_R(dst) = (unsigned long long)BYTECODE_R(a) <= (unsigned long long)BYTECODE_R(b);
+    BYTECODE_NEXT();
+bytecode_ugt:
+    BYTECODE_R(dst) = (unsigned long long)BYTECODE_R(a) > (unsigned long long)BYTECODE_R(b);
+    BYTECODE_NEXT();
+bytecode_uge:
+    BYTECODE_R(dst) = (unsigned long long)BYTECODE_R(a) >= (unsigned long long)BYTECODE_R(b);
+    BYTECODE_NEXT();
+
+bytecode_branch_eq:
+    ip += (int32_t)(BYTECODE_R(a) == BYTECODE_R(b) ? ip->dst : ip->c);
+    goto *ip->handler;
+bytecode_branch_ne:
+    ip += (int32_t)(BYTECODE_R(a) != BYTECODE_R(b) ? ip->dst : ip->c);
+    goto *ip->handler;
+bytecode_branch_slt:
+    ip += (int32_t)(BYTECODE_R(a) < BYTECODE_R(b) ? ip->dst : ip->c);
+    goto *ip->handler;
+bytecode_branch_sle:
+    ip += (int32_t)(BYTECODE_R(a) <= BYTECODE_R(b) ? ip->dst : ip->c);
+    goto *ip->handler;
+bytecode_branch_sgt:
+    ip += (int32_t)(BYTECODE_R(a) > BYTECODE_R(b) ? ip->dst : ip->c);
+    goto *ip->handler;
+bytecode_branch_sge:
+    ip += (int32_t)(BYTECODE_R(a) >= BYTECODE_R(b) ? ip->dst : ip->c);
+    goto *ip->handler;
+bytecode_branch_ult:
+    ip += (int32_t)((unsigned long long)BYTECODE_R(a) < (unsigned long long)BYTECODE_R(b) ? ip->dst : ip->c);
+    goto *ip->handler;
+bytecode_branch_ule:
+    ip += (int32_t)((unsigned long long)BYTECODE_R(a) <= (unsigned long long)BYTECODE_R(b) ? ip->dst : ip->c);
+    goto *ip->handler;
+bytecode_branch_ugt:
+    ip += (int32_t)((unsigned long long)BYTECODE_R(a) > (unsigned long long)BYTECODE_R(b) ? ip->dst : ip->c);
+    goto *ip->handler;
+bytecode_branch_uge:
+    ip += (int32_t)((unsigned long long)BYTECODE_R(a) >= (unsigned long long)BYTECODE_R(b) ? ip->dst : ip->c);
+    goto *ip->handler;
+
+bytecode_zext8:
+    BYTECODE_R(dst) = (uint8_t)BYTECODE_R(a);
+    BYTECODE_NEXT();
+bytecode_zext16:
+    BYTECODE_R(dst) = (uint16_t)BYTECODE_R(a);
+    BYTECODE_NEXT();
+bytecode_zext32:
+    BYTECODE_R(dst) = (uint32_t)BYTECODE_R(a);
+    BYTECODE_NEXT();
+bytecode_trunc8:
+    BYTECODE_R(dst) = (int8_t)BYTECODE_R(a);
+    BYTECODE_NEXT();
+bytecode_trunc16:
+    BYTECODE_R(dst) = (int16_t)BYTECODE_R(a);
+    BYTECODE_NEXT();
+bytecode_trunc32:
+    BYTECODE_R(dst) = (int32_t)BYTECODE_R(a);
+    BYTECODE_NEXT();
+
+bytecode_load8:
+    BYTECODE_R(dst) = *(int8_t *)(uintptr_t)BYTECODE_R(a);
+    BYTECODE_NEXT();
+bytecode_load16:
+    BYTECODE_R(dst) = *(int16_t *)(uintptr_t)BYTECODE_R(a);
+    BYTECODE_NEXT();
+bytecode_load32:
+    BYTECODE_R(dst) = *(int32_t *)(uintptr_t)BYTECODE_R(a);
+    BYTECODE_NEXT();
+bytecode_load64:
+    BYTECODE_R(dst) = *(long long *)(uintptr_t)BYTECODE_R(a);
+    BYTECODE_NEXT();
+bytecode_store8:
+    *(int8_t *)(uintptr_t)BYTECODE_R(a) = BYTECODE_R(b);
+    BYTECODE_NEXT();
+bytecode_store16:
+    *(int16_t *)(uintptr_t)BYTECODE_R(a) = BYTECODE_R(b);
+    BYTECODE_NEXT();
+bytecode_store32:
+    *(int32_t *)(uintptr_t)BYTECODE_R(a) = BYTECODE_R(b);
+    BYTECODE_NEXT();
+bytecode_store64:
+    *(long long *)(uintptr_t)BYTECODE_R(a) = BYTECODE_R(b);
+    BYTECODE_NEXT();
+bytecode_memcpy:
+    memcpy((void *)(uintptr_t)BYTECODE_R(a), (void *)(uintptr_t)BYTECODE_R(b), ip->c);
+    BYTECODE_NEXT();
+bytecode_zero:
+    memset((void *)(uintptr_t)BYTECODE_R(a), 0, ip->c);
+    BYTECODE_NEXT();
+
+bytecode_jump:
+    ip += (int32_t)ip->dst;
+    goto *ip->handler;
+bytecode_branch:
+    ip += (int32_t)(BYTECODE_R(a) ? ip->dst : ip->c);
+    goto *ip->handler;
+
+bytecode_call_direct:
+    callee = &program->functions[ip->a];
+    goto bytecode_enter;
+bytecode_call_indirect:
+    callee = (struct bytecode_function *)(uintptr_t)BYTECODE_R(a);
+    if (callee >= program->functions && callee < program->functions + program->function_count)
+    {
+        goto bytecode_enter;
+    }
+    native = callee;
+    goto bytecode_native;
+bytecode_call_native:
+    native = program->natives[ip->a];
+    goto bytecode_native;
+
+bytecode_enter:
+{
+    if (top + callee->frame_words > program->stack_end)
+    {
+        fprintf(stderr, "Bytecode stack overflow in %s\n", callee->name);
+        abort();
+    }
+
+    long long *registers = top + BYTECODE_FRAME_HEADER;
+    uint32_t *argument_registers = (uint32_t *)(ip + 1);
+    for (uint32_t i = 0; i < ip->b && i < callee->parameter_count; i++)
+    {
+        registers[1 + i] = r[argument_registers[i]];
+    }
+    registers[-3] = (long long)(uintptr_t)(ip + 1 + (ip->b + BYTECODE_ARGUMENTS_PER_SLOT - 1) / BYTECODE_ARGUMENTS_PER_SLOT);
+    registers[-2] = (long long)(uintptr_t)r;
+    registers[-1] = ip->dst;
+    top += callee->frame_words;
+    r = registers;
+    ip = callee->code;
+    goto *ip->handler;
+}
+
+bytecode_native:
+{
+    long long values[BYTECODE_NATIVE_ARGUMENTS] = {0};
+    uint32_t *argument_registers = (uint32_t *)(ip + 1);
+    for (uint32_t i = 0; i < ip->b; i++)
+    {
+        values[i] = r[argument_registers[i]];
+    }
+
+    // passed the way a variadic function takes them, which suits every native callee
+    long long (*entry)(long long, ...) = native;
+    BYTECODE_R(dst) = entry(values[0], values[1], values[2], values[3], values[4], values[5], values[6], values[7], values[8], values[9], values[10],
+                            values[11], values[12], values[13], values[14], values[15]);
+    ip += 1 + (ip->b + BYTECODE_ARGUMENTS_PER_SLOT - 1) / BYTECODE_ARGUMENTS_PER_SLOT;
+    goto *ip->handler;
+}
+
+bytecode_return:
+{
+    long long value = BYTECODE_R(a);
+    struct bytecode_instruction *back = (struct bytecode_instruction *)(uintptr_t)r[-3];
+    if (!back)
+    {
+        return value;
+    }
+
+    top = r - BYTECODE_FRAME_HEADER;
+    uint32_t dst = r[-1];
+    r = (long long *)(uintptr_t)r[-2];
+    r[dst] = value;
+    ip = back;
+    goto *ip->handler;
+}
+}
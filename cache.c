@@ -0,0 +1,167 @@
+#include "compiler.h"
+#include "helpers/vector.h"
+#include "helpers/hashmap.h"
+#include "helpers/intern.h"
+#include <stdlib.h>
+#include <sys/stat.h>
+
+/**
+ * Keeps the work of one compile for the next when a process compiles many files:
+ * the interned identifiers, the tokens of every header and where includes were
+ * found. A header is only replayed while its file is unchanged, an include
+ * lookup only while every path it tried still exists or is still missing.
+ */
+struct compiler_cache *compiler_cache;
+
+struct compiler_cache_header
+{
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec mtime;
+    // struct token, the whole file as the lexer produced it
+    struct vector *tokens;
+};
+
+struct compiler_cache_candidate
+{
+    const char *path;
+    bool exists;
+};
+
+struct compiler_cache_include
+{
+    // absolute path, NULL when the include was not found
+    const char *path;
+    // struct compiler_cache_candidate in the order they were tried
+    struct vector *candidates;
+};
+
+void compiler_cache_enable()
+{
+    if (compiler_cache)
+    {
+        return;
+    }
+
+    compiler_cache = calloc(1, sizeof(struct compiler_cache));
+    compiler_cache->identifiers = intern_table_create();
+    compiler_cache->headers = hashmap_create();
+    compiler_cache->includes = hashmap_create();
+}
+
+/**
+ * Tokens of the header at the absolute path, NULL when it isn't cached or the
+ * file changed since
+ */
+struct vector *compiler_cache_header(const char *path)
+{
+    struct compiler_cache_header *header = compiler_cache ? hashmap_get(compiler_cache->headers, path) : NULL;
+    struct stat info;
+    if (!header || stat(path, &info) != 0)
+    {
+        return NULL;
+    }
+
+    if (info.st_dev != header->device || info.st_ino != header->inode || info.st_size != header->size ||
+        info.st_mtim.tv_sec != header->mtime.tv_sec || info.st_mtim.tv_nsec != header->mtime.tv_nsec)
+    {
+        return NULL;
+    }
+    return header->tokens;
+}
+
+/**
+ * Keeps a copy of the tokens of a header that was just lexed
+ */
+void compiler_cache_set_header(const char *path, struct vector *tokens)
+{
+    struct stat info;
+    if (!compiler_cache || stat(path, &info) != 0)
+    {
+        return;
+    }
+
+    struct compiler_cache_header *header = hashmap_get(compiler_cache->headers, path);
+    if (header)
+    {
+        vector_free(header->tokens);
+    }
+    else
+    {
+        header = calloc(1, sizeof(struct compiler_cache_header));
+        hashmap_set(compiler_cache->headers, path, header);
+    }
+
+    header->device = info.st_dev;
+    header->inode = info.st_ino;
+    header->size = info.st_size;
+    header->mtime = info.st_mtim;
+    header->tokens = vector_clone(tokens);
+}
+
+/**
+ * Finds a previous lookup of the include key, path_out receives the absolute
+ * path or NULL if the include didn't exist. False when the lookup must be done again
+ */
+bool compiler_cache_include(const char *key, const char **path_out)
+{
+    struct compiler_cache_include *include = compiler_cache ? hashmap_get(compiler_cache->includes, key) : NULL;
+    if (!include)
+    {
+        return false;
+    }
+
+    struct stat info;
+    vector_set_peek_pointer(include->candidates, 0);
+    struct compiler_cache_candidate *candidate = vector_peek(include->candidates);
+    while (candidate)
+    {
+        if ((stat(candidate->path, &info) == 0) != candidate->exists)
+        {
+            return false;
+        }
+        candidate = vector_peek(include->candidates);
+    }
+
+    *path_out = include->path;
+    return true;
+}
+
+/**
+ * Remembers how an include was resolved, candidates are the char* paths tried in
+ * order and the last one is the file found unless path is NULL. The cache takes
+ * the strings over, not the vector
+ */
+void compiler_cache_set_include(const char *key, const char *path, struct vector *candidates)
+{
+    if (!compiler_cache)
+    {
+        return;
+    }
+
+    struct compiler_cache_include *include = hashmap_get(compiler_cache->includes, key);
+    if (include)
+    {
+        for (int i = 0; i < vector_count(include->candidates); i++)
+        {
+            free((char *)((struct compiler_cache_candidate *)vector_at(include->candidates, i))->path);
+        }
+        vector_clear(include->candidates);
+    }
+    else
+    {
+        include = calloc(1, sizeof(struct compiler_cache_include));
+        include->candidates = vector_create(sizeof(struct compiler_cache_candidate));
+        hashmap_set(compiler_cache->includes, key, include);
+    }
+
+    include->path = path;
+    for (int i = 0; i < vector_count(candidates); i++)
+    {
+        struct compiler_cache_candidate candidate = {
+            .path = *(const char **)vector_at(candidates, i),
+            .exists = path && i == vector_count(candidates) - 1};
+        vector_push(include->candidates, &candidate);
+    }
+}
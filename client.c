@@ -0,0 +1,36 @@
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "compiler.h"
+
+/**
+ * Thin client of the compile server, it takes the same arguments as main. The
+ * command line goes to the server listening on $ZEZE_SERVER or the default socket,
+ * when there is no server or it won't take the command line the main next to
+ * this program runs it instead
+ */
+int main(int argc, char **argv)
+{
+    int res = server_forward(server_default_socket(), argc, argv);
+    if (res != SERVER_NOT_SERVED)
+    {
+        return res;
+    }
+
+    char path[PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - sizeof("main"));
+    if (length <= 0)
+    {
+        perror("/proc/self/exe");
+        return 1;
+    }
+    path[length] = 0x00;
+
+    char *slash = strrchr(path, '/');
+    strcpy(slash ? slash + 1 : path, "main");
+    argv[0] = path;
+    execv(path, argv);
+    perror(path);
+    return 1;
+}
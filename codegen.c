@@ -0,0 +1,1617 @@
+#include "compiler.h"
+#include "helpers/vector.h"
+#include "helpers/hashmap.h"
+#include <elf.h>
+#include <stdarg.h>
+#include <stdlib.h>
+
+/**
+ * Turns the IR into x86-64 assembly for the GNU assembler following the System V
+ * ABI. Values live where the register allocator put them, rax, r10 and r11 are
+ * never handed out and serve as scratch registers here. With
+ * COMPILE_PROCESS_FLAG_OBJECT the same instructions are encoded by x86.c and
+ * the output is an object file instead
+ */
+
+static const char *codegen_names64[] = {"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"};
+static const char *codegen_names32[] = {"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi", "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"};
+static const char *codegen_names16[] = {"ax", "cx", "dx", "bx", "sp", "bp", "si", "di", "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w"};
+static const char *codegen_names8[] = {"al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil", "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"};
+
+static const int codegen_arguments[] = {X86_RDI, X86_RSI, X86_RDX, X86_RCX, X86_R8, X86_R9};
+static const int codegen_callee_saved[] = {X86_RBX, X86_R12, X86_R13, X86_R14, X86_R15};
+
+// condition codes of the comparisons and the ones that test the opposite
+static const char *codegen_conditions[IR_TOTAL] = {
+    [IR_EQ] = "e",
+    [IR_NE] = "ne",
+    [IR_SLT] = "l",
+    [IR_SLE] = "le",
+    [IR_SGT] = "g",
+    [IR_SGE] = "ge",
+    [IR_ULT] = "b",
+    [IR_ULE] = "be",
+    [IR_UGT] = "a",
+    [IR_UGE] = "ae"};
+
+static const char *codegen_inverse_conditions[IR_TOTAL] = {
+    [IR_EQ] = "ne",
+    [IR_NE] = "e",
+    [IR_SLT] = "ge",
+    [IR_SLE] = "g",
+    [IR_SGT] = "le",
+    [IR_SGE] = "l",
+    [IR_ULT] = "ae",
+    [IR_ULE] = "a",
+    [IR_UGT] = "be",
+    [IR_UGE] = "b"};
+
+enum
+{
+    CODEGEN_LOCATION_NONE,
+    CODEGEN_LOCATION_REGISTER,
+    // rbp relative stack slot
+    CODEGEN_LOCATION_STACK,
+    CODEGEN_LOCATION_IMMEDIATE,
+    // rbp relative address of a stack allocation
+    CODEGEN_LOCATION_FRAME,
+    // address of a symbol plus offset
+    CODEGEN_LOCATION_SYMBOL
+};
+
+struct codegen_location
+{
+    int kind;
+    int reg;
+    long long offset;
+    const char *symbol;
+};
+
+struct codegen_move
+{
+    struct codegen_location to;
+    struct codegen_location from;
+};
+
+// a split part that takes over from the previous part in front of an instruction
+struct codegen_split
+{
+    uint32_t position;
+    uint32_t value;
+};
+
+// moves of a branch edge that has to get its own block
+struct codegen_stub
+{
+    uint32_t pred;
+    uint32_t succ;
+};
+
+struct codegen
+{
+    struct compile_process *process;
+    FILE *out;
+    // names of the functions and globals of the modules generated so far
+    struct hashmap *defined;
+    int function_index;
+
+    struct ir_function *function;
+    struct regalloc *regalloc;
+    // rbp offset of each stack allocation, by instruction
+    long long *frame;
+    // stack slots start below this many bytes
+    long long slot_base;
+    int saved_count;
+    // a stack allocation may be in use by a callee
+    bool has_allocations;
+
+    // struct codegen_split, ordered by position
+    struct vector *splits;
+    uint32_t split_cursor;
+    // values that live in more than one place
+    struct vector *split_values;
+    // struct codegen_stub
+    struct vector *stubs;
+    // struct codegen_move
+    struct vector *moves;
+    // comparison whose flags the next branch uses
+    uint32_t fused;
+    // instructions of the current function
+    struct peephole *peephole;
+    // object file being written, NULL when the output is assembly
+    struct elf_object *object;
+};
+
+/**
+ * Instructions of a function collect in the peephole list, it goes to the
+ * output file once the function is done
+ */
+static void codegen_emit(struct codegen *codegen, const char *fmt, ...)
+{
+    char line[256];
+    va_list args;
+    va_list copy;
+    va_start(args, fmt);
+    va_copy(copy, args);
+    int length = vsnprintf(line, sizeof(line), fmt, args);
+    if (length < (int)sizeof(line))
+    {
+        peephole_add(codegen->peephole, line);
+    }
+    else
+    {
+        char *long_line = malloc(length + 1);
+        vsnprintf(long_line, length + 1, fmt, copy);
+        peephole_add(codegen->peephole, long_line);
+        free(long_line);
+    }
+    va_end(copy);
+    va_end(args);
+}
+
+static const char *codegen_register(int reg, int size)
+{
+    switch (size)
+    {
+    case 1:
+        return codegen_names8[reg];
+    case 2:
+        return codegen_names16[reg];
+    case 4:
+        return codegen_names32[reg];
+    }
+    return codegen_names64[reg];
+}
+
+static char codegen_suffix(int size)
+{
+    switch (size)
+    {
+    case 1:
+        return 'b';
+    case 2:
+        return 'w';
+    case 4:
+        return 'l';
+    }
+    return 'q';
+}
+
+static bool codegen_fits_int32(long long value)
+{
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+static bool codegen_is_defined(struct codegen *codegen, const char *symbol)
+{
+    return hashmap_get(codegen->defined, symbol) != NULL;
+}
+
+static int codegen_value_size(struct codegen *codegen, uint32_t value)
+{
+    return ir_type_size(codegen->function->instructions[value].type);
+}
+
+/**
+ * Arithmetic on values narrower than 32 bits is done in 32 bits
+ */
+static int codegen_operation_size(struct codegen *codegen, uint32_t value)
+{
+    return codegen_value_size(codegen, value) == 8 ? 8 : 4;
+}
+
+static struct codegen_location codegen_location(struct codegen *codegen, uint32_t value, uint32_t position)
+{
+    struct codegen_location location = {.kind = CODEGEN_LOCATION_NONE, .reg = X86_NO_REGISTER};
+    struct ir_instruction *instruction = &codegen->function->instructions[value];
+    switch (instruction->op)
+    {
+    case IR_CONST:
+        location.kind = CODEGEN_LOCATION_IMMEDIATE;
+        location.offset = instruction->constant;
+        return location;
+
+    case IR_ALLOCA:
+        location.kind = CODEGEN_LOCATION_FRAME;
+        location.offset = codegen->frame[value];
+        return location;
+
+    case IR_GLOBAL:
+        location.kind = CODEGEN_LOCATION_SYMBOL;
+        location.symbol = instruction->symbol;
+        location.offset = instruction->constant;
+        return location;
+    }
+
+    struct live_interval *interval = regalloc_interval_at(codegen->regalloc, value, position);
+    if (!interval)
+    {
+        return location;
+    }
+
+    if (interval->reg != X86_NO_REGISTER)
+    {
+        location.kind = CODEGEN_LOCATION_REGISTER;
+        location.reg = interval->reg;
+        return location;
+    }
+
+    location.kind = CODEGEN_LOCATION_STACK;
+    location.offset = -(codegen->slot_base + 8 * (long long)codegen->regalloc->slots[value]);
+    return location;
+}
+
+static struct codegen_location codegen_register_location(int reg)
+{
+    struct codegen_location location = {.kind = CODEGEN_LOCATION_REGISTER, .reg = reg};
+    return location;
+}
+
+static bool codegen_same_location(struct codegen_location *a, struct codegen_location *b)
+{
+    if (a->kind != b->kind)
+    {
+        return false;
+    }
+
+    switch (a->kind)
+    {
+    case CODEGEN_LOCATION_REGISTER:
+        return a->reg == b->reg;
+    case CODEGEN_LOCATION_SYMBOL:
+        return a->symbol == b->symbol && a->offset == b->offset;
+    }
+    return a->offset == b->offset;
+}
+
+static void codegen_symbol_text(struct codegen_location *location, char *text, size_t size)
+{
+    if (location->offset)
+    {
+        snprintf(text, size, "%s%+lld", location->symbol, location->offset);
+        return;
+    }
+    snprintf(text, size, "%s", location->symbol);
+}
+
+/**
+ * Puts the whole 64 bits of a location into the register
+ */
+static void codegen_load(struct codegen *codegen, struct codegen_location *location, int reg)
+{
+    char symbol[256];
+    switch (location->kind)
+    {
+    case CODEGEN_LOCATION_REGISTER:
+        if (location->reg != reg)
+        {
+            codegen_emit(codegen, "movq %%%s, %%%s", codegen_names64[location->reg], codegen_names64[reg]);
+        }
+        break;
+
+    case CODEGEN_LOCATION_STACK:
+        codegen_emit(codegen, "movq %lld(%%rbp), %%%s", location->offset, codegen_names64[reg]);
+        break;
+
+    case CODEGEN_LOCATION_IMMEDIATE:
+        if (codegen_fits_int32(location->offset))
+        {
+            codegen_emit(codegen, "movq $%lld, %%%s", location->offset, codegen_names64[reg]);
+        }
+        else if (location->offset > 0 && location->offset <= UINT32_MAX)
+        {
+            codegen_emit(codegen, "movl $%lld, %%%s", location->offset, codegen_names32[reg]);
+        }
+        else
+        {
+            codegen_emit(codegen, "movabsq $%lld, %%%s", location->offset, codegen_names64[reg]);
+        }
+        break;
+
+    case CODEGEN_LOCATION_FRAME:
+        codegen_emit(codegen, "leaq %lld(%%rbp), %%%s", location->offset, codegen_names64[reg]);
+        break;
+
+    case CODEGEN_LOCATION_SYMBOL:
+        if (codegen_is_defined(codegen, location->symbol))
+        {
+            codegen_symbol_text(location, symbol, sizeof(symbol));
+            codegen_emit(codegen, "leaq %s(%%rip), %%%s", symbol, codegen_names64[reg]);
+            break;
+        }
+
+        // somewhere else, the address comes from the global offset table
+        codegen_emit(codegen, "movq %s@GOTPCREL(%%rip), %%%s", location->symbol, codegen_names64[reg]);
+        if (location->offset)
+        {
+            codegen_emit(codegen, "leaq %lld(%%%s), %%%s", location->offset, codegen_names64[reg], codegen_names64[reg]);
+        }
+        break;
+    }
+}
+
+static void codegen_move(struct codegen *codegen, struct codegen_location *to, struct codegen_location *from)
+{
+    if (to->kind == CODEGEN_LOCATION_NONE || from->kind == CODEGEN_LOCATION_NONE || codegen_same_location(to, from))
+    {
+        return;
+    }
+
+    if (to->kind == CODEGEN_LOCATION_REGISTER)
+    {
+        codegen_load(codegen, from, to->reg);
+        return;
+    }
+
+    if (from->kind == CODEGEN_LOCATION_REGISTER)
+    {
+        codegen_emit(codegen, "movq %%%s, %lld(%%rbp)", codegen_names64[from->reg], to->offset);
+        return;
+    }
+
+    if (from->kind == CODEGEN_LOCATION_IMMEDIATE && codegen_fits_int32(from->offset))
+    {
+        codegen_emit(codegen, "movq $%lld, %lld(%%rbp)", from->offset, to->offset);
+        return;
+    }
+
+    codegen_load(codegen, from, X86_R11);
+    codegen_emit(codegen, "movq %%r11, %lld(%%rbp)", to->offset);
+}
+
+static void codegen_store(struct codegen *codegen, struct codegen_location *to, int reg)
+{
+    struct codegen_location from = codegen_register_location(reg);
+    codegen_move(codegen, to, &from);
+}
+
+/**
+ * Performs the moves as if they all happened at once. A destination is only
+ * written once nothing reads it anymore, cycles go through r10
+ */
+static void codegen_parallel_move(struct codegen *codegen, struct codegen_move *moves, uint32_t count)
+{
+    bool *done = calloc(count ? count : 1, sizeof(bool));
+    uint32_t pending = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        done[i] = moves[i].to.kind == CODEGEN_LOCATION_NONE || moves[i].from.kind == CODEGEN_LOCATION_NONE ||
+                  codegen_same_location(&moves[i].to, &moves[i].from);
+        pending += !done[i];
+    }
+
+    while (pending)
+    {
+        bool progress = false;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            if (done[i])
+            {
+                continue;
+            }
+
+            bool blocked = false;
+            for (uint32_t j = 0; j < count && !blocked; j++)
+            {
+                blocked = j != i && !done[j] && codegen_same_location(&moves[j].from, &moves[i].to);
+            }
+
+            if (!blocked)
+            {
+                codegen_move(codegen, &moves[i].to, &moves[i].from);
+                done[i] = true;
+                pending--;
+                progress = true;
+            }
+        }
+
+        if (progress)
+        {
+            continue;
+        }
+
+        // every destination left is still read, take one source out of the way
+        for (uint32_t i = 0; i < count; i++)
+        {
+            if (done[i])
+            {
+                continue;
+            }
+
+            struct codegen_location source = moves[i].from;
+            struct codegen_location temporary = codegen_register_location(X86_R10);
+            codegen_move(codegen, &temporary, &source);
+            for (uint32_t j = 0; j < count; j++)
+            {
+                if (!done[j] && codegen_same_location(&moves[j].from, &source))
+                {
+                    moves[j].from = temporary;
+                }
+            }
+            break;
+        }
+    }
+    free(done);
+}
+
+static void codegen_add_move(struct codegen *codegen, struct codegen_location to, struct codegen_location from)
+{
+    struct codegen_move move = {.to = to, .from = from};
+    vector_push(codegen->moves, &move);
+}
+
+static void codegen_flush_moves(struct codegen *codegen)
+{
+    codegen_parallel_move(codegen, vector_data_ptr(codegen->moves), vector_count(codegen->moves));
+    vector_clear(codegen->moves);
+}
+
+static bool codegen_covers(struct codegen *codegen, uint32_t value, uint32_t position)
+{
+    for (struct live_interval *part = codegen->regalloc->intervals[value]; part; part = part->next)
+    {
+        for (uint32_t r = 0; r < part->range_count; r++)
+        {
+            if (part->ranges[r].from <= position && position <= part->ranges[r].to)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * Collects the moves of the edge from pred to succ, the phis of succ and the
+ * values that sit in different places at both ends
+ */
+static uint32_t codegen_edge_moves(struct codegen *codegen, uint32_t pred, uint32_t succ)
+{
+    struct ir_function *function = codegen->function;
+    struct regalloc *regalloc = codegen->regalloc;
+    struct ir_block *block = &function->blocks[succ];
+    uint32_t slot = 0;
+    while (function->preds[block->preds + slot] != pred)
+    {
+        slot++;
+    }
+
+    uint32_t start = regalloc->block_start[succ];
+    uint32_t end = regalloc->block_end[pred];
+    for (uint32_t index = block->first; index != IR_NONE && function->instructions[index].op == IR_PHI; index = function->instructions[index].next)
+    {
+        uint32_t operand = ir_operand(function, index, slot);
+        codegen_add_move(codegen, codegen_location(codegen, index, start), codegen_location(codegen, operand, end));
+    }
+
+    uint32_t *values = vector_data_ptr(codegen->split_values);
+    for (int i = 0; i < vector_count(codegen->split_values); i++)
+    {
+        struct ir_instruction *instruction = &function->instructions[values[i]];
+        if ((instruction->op == IR_PHI && instruction->block == succ) || !codegen_covers(codegen, values[i], start))
+        {
+            continue;
+        }
+        codegen_add_move(codegen, codegen_location(codegen, values[i], start), codegen_location(codegen, values[i], end));
+    }
+    return vector_count(codegen->moves);
+}
+
+static void codegen_label(struct codegen *codegen, uint32_t block)
+{
+    char name[32];
+    snprintf(name, sizeof(name), ".L%i_%u", codegen->function_index, block);
+    peephole_label(codegen->peephole, name);
+}
+
+/**
+ * Moves of split parts that begin in front of the instruction at the position
+ */
+static void codegen_split_moves(struct codegen *codegen, uint32_t position)
+{
+    struct codegen_split *splits = vector_data_ptr(codegen->splits);
+    uint32_t count = vector_count(codegen->splits);
+    while (codegen->split_cursor < count && splits[codegen->split_cursor].position < position)
+    {
+        codegen->split_cursor++;
+    }
+
+    while (codegen->split_cursor < count && splits[codegen->split_cursor].position == position)
+    {
+        uint32_t value = splits[codegen->split_cursor++].value;
+        codegen_add_move(codegen, codegen_location(codegen, value, position), codegen_location(codegen, value, position - 1));
+    }
+    codegen_flush_moves(codegen);
+}
+
+static bool codegen_has_split(struct codegen *codegen, uint32_t position)
+{
+    struct codegen_split *splits = vector_data_ptr(codegen->splits);
+    uint32_t count = vector_count(codegen->splits);
+    for (uint32_t i = codegen->split_cursor; i < count && splits[i].position <= position; i++)
+    {
+        if (splits[i].position == position)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Text of a location that an instruction can read directly, anything else
+ * first goes to the scratch register
+ */
+static void codegen_operand(struct codegen *codegen, struct codegen_location *location, int size, int scratch, char *text, size_t text_size)
+{
+    switch (location->kind)
+    {
+    case CODEGEN_LOCATION_REGISTER:
+        snprintf(text, text_size, "%%%s", codegen_register(location->reg, size));
+        return;
+
+    case CODEGEN_LOCATION_STACK:
+        snprintf(text, text_size, "%lld(%%rbp)", location->offset);
+        return;
+
+    case CODEGEN_LOCATION_IMMEDIATE:
+        if (codegen_fits_int32(location->offset))
+        {
+            snprintf(text, text_size, "$%lld", location->offset);
+            return;
+        }
+        break;
+    }
+
+    codegen_load(codegen, location, scratch);
+    snprintf(text, text_size, "%%%s", codegen_register(scratch, size));
+}
+
+/**
+ * Memory operand at the address held by the location, r11 holds the address when needed
+ */
+static void codegen_address(struct codegen *codegen, struct codegen_location *location, char *text, size_t text_size)
+{
+    char symbol[256];
+    switch (location->kind)
+    {
+    case CODEGEN_LOCATION_REGISTER:
+        snprintf(text, text_size, "(%%%s)", codegen_names64[location->reg]);
+        return;
+
+    case CODEGEN_LOCATION_FRAME:
+        snprintf(text, text_size, "%lld(%%rbp)", location->offset);
+        return;
+
+    case CODEGEN_LOCATION_SYMBOL:
+        if (codegen_is_defined(codegen, location->symbol))
+        {
+            codegen_symbol_text(location, symbol, sizeof(symbol));
+            snprintf(text, text_size, "%s(%%rip)", symbol);
+            return;
+        }
+        break;
+    }
+
+    codegen_load(codegen, location, X86_R11);
+    snprintf(text, text_size, "(%%r11)");
+}
+
+/**
+ * Register the result is computed in, the destination itself unless an operand still needs it
+ */
+static int codegen_work_register(struct codegen_location *destination, struct codegen_location *keep)
+{
+    if (destination->kind != CODEGEN_LOCATION_REGISTER || (keep && keep->kind == CODEGEN_LOCATION_REGISTER && keep->reg == destination->reg))
+    {
+        return X86_RAX;
+    }
+    return destination->reg;
+}
+
+static void codegen_arithmetic(struct codegen *codegen, uint32_t index, uint32_t position)
+{
+    static const char *mnemonics[IR_TOTAL] = {
+        [IR_ADD] = "add",
+        [IR_SUB] = "sub",
+        [IR_MUL] = "imul",
+        [IR_AND] = "and",
+        [IR_OR] = "or",
+        [IR_XOR] = "xor"};
+
+    struct ir_function *function = codegen->function;
+    struct ir_instruction *instruction = &function->instructions[index];
+    int size = codegen_operation_size(codegen, index);
+    struct codegen_location left = codegen_location(codegen, ir_operand(function, index, 0), position);
+    struct codegen_location right = codegen_location(codegen, ir_operand(function, index, 1), position);
+    struct codegen_location destination = codegen_location(codegen, index, position + 2);
+    if (instruction->op != IR_SUB && right.kind == CODEGEN_LOCATION_REGISTER && destination.kind == CODEGEN_LOCATION_REGISTER &&
+        right.reg == destination.reg)
+    {
+        struct codegen_location swap = left;
+        left = right;
+        right = swap;
+    }
+
+    int work = codegen_work_register(&destination, &right);
+    char text[288];
+    codegen_load(codegen, &left, work);
+    codegen_operand(codegen, &right, size, X86_R11, text, sizeof(text));
+    codegen_emit(codegen, "%s%c %s, %%%s", mnemonics[instruction->op], codegen_suffix(size), text, codegen_register(work, size));
+    codegen_store(codegen, &destination, work);
+}
+
+static void codegen_unary(struct codegen *codegen, uint32_t index, uint32_t position)
+{
+    struct ir_function *function = codegen->function;
+    int size = codegen_operation_size(codegen, index);
+    struct codegen_location operand = codegen_location(codegen, ir_operand(function, index, 0), position);
+    struct codegen_location destination = codegen_location(codegen, index, position + 2);
+    int work = codegen_work_register(&destination, NULL);
+    codegen_load(codegen, &operand, work);
+    codegen_emit(codegen, "%s%c %%%s", function->instructions[index].op == IR_NEG ? "neg" : "not", codegen_suffix(size), codegen_register(work, size));
+    codegen_store(codegen, &destination, work);
+}
+
+/**
+ * Widens a narrow value inside its register before an operation that looks at the upper bits
+ */
+static void codegen_widen(struct codegen *codegen, int reg, int size, bool is_signed)
+{
+    if (size == 1)
+    {
+        codegen_emit(codegen, "mov%cbl %%%s, %%%s", is_signed ? 's' : 'z', codegen_names8[reg], codegen_names32[reg]);
+    }
+    else if (size == 2)
+    {
+        codegen_emit(codegen, "mov%cwl %%%s, %%%s", is_signed ? 's' : 'z', codegen_names16[reg], codegen_names32[reg]);
+    }
+}
+
+static void codegen_shift(struct codegen *codegen, uint32_t index, uint32_t position)
+{
+    struct ir_function *function = codegen->function;
+    int op = function->instructions[index].op;
+    const char *mnemonic = op == IR_SHL ? "shl" : op == IR_SHR ? "shr" : "sar";
+    int value_size = codegen_value_size(codegen, index);
+    int size = codegen_operation_size(codegen, index);
+    struct codegen_location left = codegen_location(codegen, ir_operand(function, index, 0), position);
+    struct codegen_location count = codegen_location(codegen, ir_operand(function, index, 1), position);
+    struct codegen_location destination = codegen_location(codegen, index, position + 2);
+    if (count.kind == CODEGEN_LOCATION_IMMEDIATE)
+    {
+        int work = codegen_work_register(&destination, NULL);
+        codegen_load(codegen, &left, work);
+        if (op != IR_SHL)
+        {
+            codegen_widen(codegen, work, value_size, op == IR_SAR);
+        }
+        codegen_emit(codegen, "%s%c $%lld, %%%s", mnemonic, codegen_suffix(size), count.offset & (size * 8 - 1), codegen_register(work, size));
+        codegen_store(codegen, &destination, work);
+        return;
+    }
+
+    // the count has to be in cl, the allocator keeps rcx free across the shift
+    codegen_load(codegen, &left, X86_R10);
+    codegen_load(codegen, &count, X86_RCX);
+    if (op != IR_SHL)
+    {
+        codegen_widen(codegen, X86_R10, value_size, op == IR_SAR);
+    }
+    codegen_emit(codegen, "%s%c %%cl, %%%s", mnemonic, codegen_suffix(size), codegen_register(X86_R10, size));
+    codegen_store(codegen, &destination, X86_R10);
+}
+
+static void codegen_division(struct codegen *codegen, uint32_t index, uint32_t position)
+{
+    struct ir_function *function = codegen->function;
+    int op = function->instructions[index].op;
+    bool is_signed = op == IR_SDIV || op == IR_SREM;
+    int value_size = codegen_value_size(codegen, index);
+    int size = codegen_operation_size(codegen, index);
+    struct codegen_location left = codegen_location(codegen, ir_operand(function, index, 0), position);
+    struct codegen_location right = codegen_location(codegen, ir_operand(function, index, 1), position);
+    struct codegen_location destination = codegen_location(codegen, index, position + 2);
+
+    // rdx:rax divided by r11, the allocator keeps rdx free across the division
+    codegen_load(codegen, &right, X86_R11);
+    codegen_load(codegen, &left, X86_RAX);
+    codegen_widen(codegen, X86_RAX, value_size, is_signed);
+    codegen_widen(codegen, X86_R11, value_size, is_signed);
+    if (is_signed)
+    {
+        codegen_emit(codegen, size == 8 ? "cqto" : "cltd");
+        codegen_emit(codegen, "idiv%c %%%s", codegen_suffix(size), codegen_register(X86_R11, size));
+    }
+    else
+    {
+        codegen_emit(codegen, "xorl %%edx, %%edx");
+        codegen_emit(codegen, "div%c %%%s", codegen_suffix(size), codegen_register(X86_R11, size));
+    }
+    codegen_store(codegen, &destination, op == IR_SDIV || op == IR_UDIV ? X86_RAX : X86_RDX);
+}
+
+/**
+ * A comparison whose only user is the branch right after it leaves its result in the flags
+ */
+static bool codegen_is_fused(struct codegen *codegen, uint32_t index)
+{
+    struct ir_function *function = codegen->function;
+    struct ir_instruction *instruction = &function->instructions[index];
+    if (instruction->first_use == IR_NONE || function->uses[instruction->first_use].next != IR_NONE)
+    {
+        return false;
+    }
+
+    uint32_t user = function->uses[instruction->first_use].user;
+    return user == instruction->next && function->instructions[user].op == IR_BRANCH &&
+           !codegen_has_split(codegen, codegen->regalloc->positions[user]);
+}
+
+static void codegen_compare(struct codegen *codegen, uint32_t index, uint32_t position)
+{
+    struct ir_function *function = codegen->function;
+    uint32_t left_value = ir_operand(function, index, 0);
+    int size = codegen_value_size(codegen, left_value);
+    struct codegen_location left = codegen_location(codegen, left_value, position);
+    struct codegen_location right = codegen_location(codegen, ir_operand(function, index, 1), position);
+    int reg = left.kind == CODEGEN_LOCATION_REGISTER ? left.reg : X86_RAX;
+    char text[288];
+    codegen_load(codegen, &left, reg);
+    codegen_operand(codegen, &right, size, X86_R11, text, sizeof(text));
+    codegen_emit(codegen, "cmp%c %s, %%%s", codegen_suffix(size), text, codegen_register(reg, size));
+    if (codegen_is_fused(codegen, index))
+    {
+        codegen->fused = index;
+        return;
+    }
+
+    struct codegen_location destination = codegen_location(codegen, index, position + 2);
+    codegen_emit(codegen, "set%s %%al", codegen_conditions[function->instructions[index].op]);
+    codegen_emit(codegen, "movzbl %%al, %%eax");
+    codegen_store(codegen, &destination, X86_RAX);
+}
+
+static void codegen_convert(struct codegen *codegen, uint32_t index, uint32_t position)
+{
+    struct ir_function *function = codegen->function;
+    int op = function->instructions[index].op;
+    uint32_t operand = ir_operand(function, index, 0);
+    int from = codegen_value_size(codegen, operand);
+    int to = codegen_value_size(codegen, index);
+    struct codegen_location source = codegen_location(codegen, operand, position);
+    struct codegen_location destination = codegen_location(codegen, index, position + 2);
+    int work = codegen_work_register(&destination, NULL);
+    codegen_load(codegen, &source, work);
+    if (op == IR_SEXT)
+    {
+        if (from == 4)
+        {
+            codegen_emit(codegen, "movslq %%%s, %%%s", codegen_names32[work], codegen_names64[work]);
+        }
+        else
+        {
+            codegen_emit(codegen, "movs%c%c %%%s, %%%s", codegen_suffix(from), to == 8 ? 'q' : 'l', codegen_register(work, from),
+                         codegen_register(work, to == 8 ? 8 : 4));
+        }
+    }
+    else if (op == IR_ZEXT)
+    {
+        if (from == 4)
+        {
+            codegen_emit(codegen, "movl %%%s, %%%s", codegen_names32[work], codegen_names32[work]);
+        }
+        else
+        {
+            codegen_emit(codegen, "movz%cl %%%s, %%%s", codegen_suffix(from), codegen_register(work, from), codegen_names32[work]);
+        }
+    }
+    codegen_store(codegen, &destination, work);
+}
+
+static void codegen_load_instruction(struct codegen *codegen, uint32_t index, uint32_t position)
+{
+    static const char *mnemonics[] = {[1] = "movzbl", [2] = "movzwl", [4] = "movl", [8] = "movq"};
+    struct ir_function *function = codegen->function;
+    int size = codegen_value_size(codegen, index);
+    struct codegen_location address = codegen_location(codegen, ir_operand(function, index, 0), position);
+    struct codegen_location destination = codegen_location(codegen, index, position + 2);
+    int work = codegen_work_register(&destination, NULL);
+    char text[288];
+    codegen_address(codegen, &address, text, sizeof(text));
+    codegen_emit(codegen, "%s %s, %%%s", mnemonics[size], text, codegen_register(work, size == 8 ? 8 : 4));
+    codegen_store(codegen, &destination, work);
+}
+
+static void codegen_store_instruction(struct codegen *codegen, uint32_t index, uint32_t position)
+{
+    struct ir_function *function = codegen->function;
+    uint32_t value = ir_operand(function, index, 1);
+    int size = codegen_value_size(codegen, value);
+    struct codegen_location address = codegen_location(codegen, ir_operand(function, index, 0), position);
+    struct codegen_location source = codegen_location(codegen, value, position);
+    char value_text[288];
+    char address_text[288];
+    if (source.kind == CODEGEN_LOCATION_REGISTER || (source.kind == CODEGEN_LOCATION_IMMEDIATE && codegen_fits_int32(source.offset)))
+    {
+        codegen_operand(codegen, &source, size, X86_RAX, value_text, sizeof(value_text));
+    }
+    else
+    {
+        codegen_load(codegen, &source, X86_RAX);
+        snprintf(value_text, sizeof(value_text), "%%%s", codegen_register(X86_RAX, size));
+    }
+    codegen_address(codegen, &address, address_text, sizeof(address_text));
+    codegen_emit(codegen, "mov%c %s, %s", codegen_suffix(size), value_text, address_text);
+}
+
+/**
+ * Block copies, short ones unrolled and longer ones with rep movsb
+ */
+static void codegen_memcpy(struct codegen *codegen, uint32_t index, uint32_t position)
+{
+    struct ir_function *function = codegen->function;
+    long long size = function->instructions[index].constant;
+    struct codegen_location destination = codegen_location(codegen, ir_operand(function, index, 0), position);
+    struct codegen_location source = codegen_location(codegen, ir_operand(function, index, 1), position);
+    codegen_load(codegen, &destination, X86_R10);
+    codegen_load(codegen, &source, X86_R11);
+    if (size > 64)
+    {
+        codegen_emit(codegen, "pushq %%rsi");
+        codegen_emit(codegen, "pushq %%rdi");
+        codegen_emit(codegen, "pushq %%rcx");
+        codegen_emit(codegen, "movq %%r11, %%rsi");
+        codegen_emit(codegen, "movq %%r10, %%rdi");
+        codegen_emit(codegen, "movq $%lld, %%rcx", size);
+        codegen_emit(codegen, "rep movsb");
+        codegen_emit(codegen, "popq %%rcx");
+        codegen_emit(codegen, "popq %%rdi");
+        codegen_emit(codegen, "popq %%rsi");
+        return;
+    }
+
+    for (long long offset = 0; offset < size;)
+    {
+        int chunk = size - offset >= 8 ? 8 : size - offset >= 4 ? 4 : size - offset >= 2 ? 2 : 1;
+        const char *reg = codegen_register(X86_RAX, chunk);
+        codegen_emit(codegen, "mov%c %lld(%%r11), %%%s", codegen_suffix(chunk), offset, reg);
+        codegen_emit(codegen, "mov%c %%%s, %lld(%%r10)", codegen_suffix(chunk), reg, offset);
+        offset += chunk;
+    }
+}
+
+static void codegen_zero(struct codegen *codegen, uint32_t index, uint32_t position)
+{
+    struct ir_function *function = codegen->function;
+    long long size = function->instructions[index].constant;
+    struct codegen_location address = codegen_location(codegen, ir_operand(function, index, 0), position);
+    codegen_load(codegen, &address, X86_R11);
+    codegen_emit(codegen, "xorl %%eax, %%eax");
+    if (size > 64)
+    {
+        codegen_emit(codegen, "pushq %%rdi");
+        codegen_emit(codegen, "pushq %%rcx");
+        codegen_emit(codegen, "movq %%r11, %%rdi");
+        codegen_emit(codegen, "movq $%lld, %%rcx", size);
+        codegen_emit(codegen, "rep stosb");
+        codegen_emit(codegen, "popq %%rcx");
+        codegen_emit(codegen, "popq %%rdi");
+        return;
+    }
+
+    for (long long offset = 0; offset < size;)
+    {
+        int chunk = size - offset >= 8 ? 8 : size - offset >= 4 ? 4 : size - offset >= 2 ? 2 : 1;
+        codegen_emit(codegen, "mov%c %%%s, %lld(%%r11)", codegen_suffix(chunk), codegen_register(X86_RAX, chunk), offset);
+        offset += chunk;
+    }
+}
+
+/**
+ * Puts back the callee saved registers and the caller's frame
+ */
+static void codegen_leave(struct codegen *codegen)
+{
+    if (codegen->saved_count)
+    {
+        codegen_emit(codegen, "leaq %i(%%rbp), %%rsp", -8 * codegen->saved_count);
+    }
+    else
+    {
+        codegen_emit(codegen, "movq %%rbp, %%rsp");
+    }
+
+    uint32_t used = codegen->regalloc->used_registers;
+    for (int i = sizeof(codegen_callee_saved) / sizeof(codegen_callee_saved[0]); i-- > 0;)
+    {
+        if (used & (1u << codegen_callee_saved[i]))
+        {
+            codegen_emit(codegen, "popq %%%s", codegen_names64[codegen_callee_saved[i]]);
+        }
+    }
+    codegen_emit(codegen, "popq %%rbp");
+}
+
+static void codegen_epilogue(struct codegen *codegen)
+{
+    codegen_leave(codegen);
+    codegen_emit(codegen, "ret");
+}
+
+/**
+ * A call whose value is returned right away jumps to the callee, which then
+ * returns to our caller. The arguments have to fit in registers and there can
+ * be no stack allocations since the frame is gone before the callee runs
+ */
+static bool codegen_is_tail_call(struct codegen *codegen, uint32_t index)
+{
+    struct ir_function *function = codegen->function;
+    if (index == IR_NONE || !(codegen->process->flags & COMPILE_PROCESS_FLAG_TAIL_CALLS) || codegen->has_allocations)
+    {
+        return false;
+    }
+
+    struct ir_instruction *instruction = &function->instructions[index];
+    if (instruction->op != IR_CALL || instruction->operand_count - 1 > 6 || instruction->next == IR_NONE)
+    {
+        return false;
+    }
+
+    struct ir_instruction *ret = &function->instructions[instruction->next];
+    return ret->op == IR_RETURN && (!ret->operand_count || ir_operand(function, instruction->next, 0) == index);
+}
+
+static void codegen_call(struct codegen *codegen, uint32_t index, uint32_t position)
+{
+    struct ir_function *function = codegen->function;
+    struct ir_instruction *instruction = &function->instructions[index];
+    uint32_t argument_count = instruction->operand_count - 1;
+    uint32_t stack_count = argument_count > 6 ? argument_count - 6 : 0;
+    bool variadic = instruction->aux >= 0;
+
+    // the stack has to stay 16 byte aligned at the call
+    if (stack_count & 1)
+    {
+        codegen_emit(codegen, "subq $8, %%rsp");
+    }
+
+    char text[288];
+    for (uint32_t i = argument_count; i > 6; i--)
+    {
+        struct codegen_location argument = codegen_location(codegen, ir_operand(function, index, i), position);
+        if (argument.kind == CODEGEN_LOCATION_REGISTER || argument.kind == CODEGEN_LOCATION_STACK ||
+            (argument.kind == CODEGEN_LOCATION_IMMEDIATE && codegen_fits_int32(argument.offset)))
+        {
+            codegen_operand(codegen, &argument, 8, X86_RAX, text, sizeof(text));
+            codegen_emit(codegen, "pushq %s", text);
+            continue;
+        }
+        codegen_load(codegen, &argument, X86_RAX);
+        codegen_emit(codegen, "pushq %%rax");
+    }
+
+    struct codegen_location callee = codegen_location(codegen, ir_operand(function, index, 0), position);
+    bool direct = callee.kind == CODEGEN_LOCATION_SYMBOL && !callee.offset;
+    if (!direct)
+    {
+        codegen_load(codegen, &callee, X86_RAX);
+    }
+
+    for (uint32_t i = 1; i <= argument_count && i <= 6; i++)
+    {
+        codegen_add_move(codegen, codegen_register_location(codegen_arguments[i - 1]), codegen_location(codegen, ir_operand(function, index, i), position));
+    }
+    codegen_flush_moves(codegen);
+
+    if (variadic)
+    {
+        // al holds the number of vector registers used
+        if (!direct)
+        {
+            codegen_emit(codegen, "movq %%rax, %%r11");
+        }
+        codegen_emit(codegen, "movl $0, %%eax");
+    }
+
+    if (codegen_is_tail_call(codegen, index))
+    {
+        codegen_leave(codegen);
+        if (direct)
+        {
+            codegen_emit(codegen, codegen_is_defined(codegen, callee.symbol) ? "jmp %s" : "jmp %s@PLT", callee.symbol);
+        }
+        else
+        {
+            codegen_emit(codegen, "jmp *%%%s", variadic ? "r11" : "rax");
+        }
+        return;
+    }
+
+    if (direct)
+    {
+        codegen_emit(codegen, codegen_is_defined(codegen, callee.symbol) ? "call %s" : "call %s@PLT", callee.symbol);
+    }
+    else
+    {
+        codegen_emit(codegen, "call *%%%s", variadic ? "r11" : "rax");
+    }
+
+    if (stack_count)
+    {
+        codegen_emit(codegen, "addq $%u, %%rsp", 8 * (stack_count + (stack_count & 1)));
+    }
+
+    if (instruction->type != IR_TYPE_VOID)
+    {
+        struct codegen_location destination = codegen_location(codegen, index, position + 2);
+        codegen_store(codegen, &destination, X86_RAX);
+    }
+}
+
+/**
+ * Label the edge jumps to, the successor itself or a stub holding the edge's moves
+ */
+static void codegen_edge_target(struct codegen *codegen, uint32_t block, uint32_t succ, char *text, size_t size)
+{
+    struct ir_function *function = codegen->function;
+    if (function->blocks[succ].pred_count > 1 && codegen_edge_moves(codegen, block, succ))
+    {
+        vector_clear(codegen->moves);
+        struct codegen_stub stub = {.pred = block, .succ = succ};
+        snprintf(text, size, ".L%i_e%i", codegen->function_index, (int)vector_count(codegen->stubs));
+        vector_push(codegen->stubs, &stub);
+        return;
+    }
+    vector_clear(codegen->moves);
+    snprintf(text, size, ".L%i_%u", codegen->function_index, succ);
+}
+
+static void codegen_branch(struct codegen *codegen, uint32_t index, uint32_t position, uint32_t next)
+{
+    struct ir_function *function = codegen->function;
+    struct ir_block *block = &function->blocks[function->instructions[index].block];
+    uint32_t condition = ir_operand(function, index, 0);
+    const char *jump = "ne";
+    const char *inverse = "e";
+    if (codegen->fused == condition)
+    {
+        int op = function->instructions[condition].op;
+        jump = codegen_conditions[op];
+        inverse = codegen_inverse_conditions[op];
+        codegen->fused = IR_NONE;
+    }
+    else
+    {
+        int size = codegen_value_size(codegen, condition);
+        struct codegen_location location = codegen_location(codegen, condition, position);
+        int reg = location.kind == CODEGEN_LOCATION_REGISTER ? location.reg : X86_RAX;
+        codegen_load(codegen, &location, reg);
+        codegen_emit(codegen, "test%c %%%s, %%%s", codegen_suffix(size), codegen_register(reg, size), codegen_register(reg, size));
+    }
+
+    char taken[64];
+    char fallthrough[64];
+    uint32_t stubs = vector_count(codegen->stubs);
+    codegen_edge_target(codegen, function->instructions[index].block, block->successors[0], taken, sizeof(taken));
+    bool taken_stub = vector_count(codegen->stubs) != stubs;
+    codegen_edge_target(codegen, function->instructions[index].block, block->successors[1], fallthrough, sizeof(fallthrough));
+    bool fallthrough_stub = vector_count(codegen->stubs) != stubs + taken_stub;
+    if (!taken_stub && block->successors[0] == next)
+    {
+        codegen_emit(codegen, "j%s %s", inverse, fallthrough);
+        return;
+    }
+
+    codegen_emit(codegen, "j%s %s", jump, taken);
+    if (fallthrough_stub || block->successors[1] != next)
+    {
+        codegen_emit(codegen, "jmp %s", fallthrough);
+    }
+}
+
+static void codegen_instruction(struct codegen *codegen, uint32_t index, uint32_t next)
+{
+    struct ir_function *function = codegen->function;
+    struct ir_instruction *instruction = &function->instructions[index];
+    uint32_t position = codegen->regalloc->positions[index];
+    codegen_split_moves(codegen, position);
+
+    // nothing reads the value and computing it has no side effects
+    if (instruction->type != IR_TYPE_VOID && instruction->first_use == IR_NONE && instruction->op != IR_CALL)
+    {
+        return;
+    }
+
+    switch (instruction->op)
+    {
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_AND:
+    case IR_OR:
+    case IR_XOR:
+        codegen_arithmetic(codegen, index, position);
+        break;
+
+    case IR_NEG:
+    case IR_NOT:
+        codegen_unary(codegen, index, position);
+        break;
+
+    case IR_SHL:
+    case IR_SHR:
+    case IR_SAR:
+        codegen_shift(codegen, index, position);
+        break;
+
+    case IR_SDIV:
+    case IR_UDIV:
+    case IR_SREM:
+    case IR_UREM:
+        codegen_division(codegen, index, position);
+        break;
+
+    case IR_EQ:
+    case IR_NE:
+    case IR_SLT:
+    case IR_SLE:
+    case IR_SGT:
+    case IR_SGE:
+    case IR_ULT:
+    case IR_ULE:
+    case IR_UGT:
+    case IR_UGE:
+        codegen_compare(codegen, index, position);
+        break;
+
+    case IR_SEXT:
+    case IR_ZEXT:
+    case IR_TRUNC:
+        codegen_convert(codegen, index, position);
+        break;
+
+    case IR_LOAD:
+        codegen_load_instruction(codegen, index, position);
+        break;
+
+    case IR_STORE:
+        codegen_store_instruction(codegen, index, position);
+        break;
+
+    case IR_MEMCPY:
+        codegen_memcpy(codegen, index, position);
+        break;
+
+    case IR_ZERO:
+        codegen_zero(codegen, index, position);
+        break;
+
+    case IR_CALL:
+        codegen_call(codegen, index, position);
+        break;
+
+    case IR_JUMP:
+    {
+        uint32_t succ = function->blocks[instruction->block].successors[0];
+        codegen_edge_moves(codegen, instruction->block, succ);
+        codegen_flush_moves(codegen);
+        if (succ != next)
+        {
+            codegen_emit(codegen, "jmp .L%i_%u", codegen->function_index, succ);
+        }
+    }
+    break;
+
+    case IR_BRANCH:
+        codegen_branch(codegen, index, position, next);
+        break;
+
+    case IR_RETURN:
+        // the callee returns for us
+        if (codegen_is_tail_call(codegen, instruction->prev))
+        {
+            break;
+        }
+
+        if (instruction->operand_count)
+        {
+            struct codegen_location value = codegen_location(codegen, ir_operand(function, index, 0), position);
+            codegen_load(codegen, &value, X86_RAX);
+        }
+        codegen_epilogue(codegen);
+        break;
+    }
+}
+
+/**
+ * Stack allocations below the saved registers, then the spill slots
+ */
+static void codegen_frame(struct codegen *codegen)
+{
+    struct ir_function *function = codegen->function;
+    uint32_t used = codegen->regalloc->used_registers;
+    codegen->saved_count = 0;
+    codegen->has_allocations = false;
+    for (size_t i = 0; i < sizeof(codegen_callee_saved) / sizeof(codegen_callee_saved[0]); i++)
+    {
+        codegen->saved_count += (used >> codegen_callee_saved[i]) & 1;
+    }
+
+    long long cursor = 8 * codegen->saved_count;
+    codegen->frame = calloc(function->instruction_count, sizeof(long long));
+    for (uint32_t value = 1; value < function->instruction_count; value++)
+    {
+        struct ir_instruction *instruction = &function->instructions[value];
+        if (instruction->op != IR_ALLOCA)
+        {
+            continue;
+        }
+
+        codegen->has_allocations = true;
+        long long align = instruction->aux > 1 ? instruction->aux : 1;
+        cursor = (cursor + instruction->constant + align - 1) / align * align;
+        codegen->frame[value] = -cursor;
+    }
+    codegen->slot_base = cursor;
+    cursor += 8 * (long long)codegen->regalloc->slot_count;
+
+    // rbp is 16 byte aligned, keep rsp aligned for calls
+    cursor = (cursor + 15) / 16 * 16;
+    codegen_emit(codegen, "pushq %%rbp");
+    codegen_emit(codegen, "movq %%rsp, %%rbp");
+    for (size_t i = 0; i < sizeof(codegen_callee_saved) / sizeof(codegen_callee_saved[0]); i++)
+    {
+        if (used & (1u << codegen_callee_saved[i]))
+        {
+            codegen_emit(codegen, "pushq %%%s", codegen_names64[codegen_callee_saved[i]]);
+        }
+    }
+
+    if (cursor > 8 * codegen->saved_count)
+    {
+        codegen_emit(codegen, "subq $%lld, %%rsp", cursor - 8 * codegen->saved_count);
+    }
+}
+
+static void codegen_parameters(struct codegen *codegen)
+{
+    struct ir_function *function = codegen->function;
+    uint32_t start = codegen->regalloc->block_start[1];
+    for (uint32_t index = function->blocks[1].first; index != IR_NONE; index = function->instructions[index].next)
+    {
+        struct ir_instruction *instruction = &function->instructions[index];
+        if (instruction->op != IR_PARAM)
+        {
+            continue;
+        }
+
+        struct codegen_location from = {.kind = CODEGEN_LOCATION_STACK, .reg = X86_NO_REGISTER};
+        if (instruction->constant < 6)
+        {
+            from = codegen_register_location(codegen_arguments[instruction->constant]);
+        }
+        else
+        {
+            // above the return address and the saved rbp
+            from.offset = 16 + 8 * (instruction->constant - 6);
+        }
+        codegen_add_move(codegen, codegen_location(codegen, index, start), from);
+    }
+    codegen_flush_moves(codegen);
+}
+
+static int codegen_compare_splits(const void *a, const void *b)
+{
+    const struct codegen_split *left = a;
+    const struct codegen_split *right = b;
+    return left->position < right->position ? -1 : left->position > right->position;
+}
+
+static void codegen_collect_splits(struct codegen *codegen)
+{
+    struct ir_function *function = codegen->function;
+    struct regalloc *regalloc = codegen->regalloc;
+    for (uint32_t value = 1; value < function->instruction_count; value++)
+    {
+        struct live_interval *interval = regalloc->intervals[value];
+        if (!interval || !interval->next)
+        {
+            continue;
+        }
+
+        vector_push(codegen->split_values, &value);
+        for (struct live_interval *part = interval->next; part; part = part->next)
+        {
+            struct codegen_split split = {.position = part->ranges[0].from, .value = value};
+            vector_push(codegen->splits, &split);
+        }
+    }
+    qsort(vector_data_ptr(codegen->splits), vector_count(codegen->splits), sizeof(struct codegen_split), codegen_compare_splits);
+}
+
+static bool codegen_function(struct codegen *codegen, struct ir_function *function)
+{
+    codegen->function = function;
+    codegen->regalloc = regalloc_run(function, codegen->process->flags & COMPILE_PROCESS_FLAG_SPILL_ALL);
+    codegen->splits = vector_create(sizeof(struct codegen_split));
+    codegen->split_values = vector_create(sizeof(uint32_t));
+    codegen->stubs = vector_create(sizeof(struct codegen_stub));
+    codegen->split_cursor = 0;
+    codegen->fused = IR_NONE;
+    codegen_collect_splits(codegen);
+
+    if (!codegen->object)
+    {
+        fprintf(codegen->out, "\t.text\n");
+        if (!function->is_local)
+        {
+            fprintf(codegen->out, "\t.globl %s\n", function->name);
+        }
+        fprintf(codegen->out, "\t.type %s, @function\n", function->name);
+        fprintf(codegen->out, "%s:\n", function->name);
+    }
+    codegen_frame(codegen);
+    codegen_parameters(codegen);
+
+    struct regalloc *regalloc = codegen->regalloc;
+    for (uint32_t i = 0; i < regalloc->order_count; i++)
+    {
+        uint32_t block = regalloc->order[i];
+        uint32_t next = i + 1 < regalloc->order_count ? regalloc->order[i + 1] : IR_NONE;
+        struct ir_block *target = &function->blocks[block];
+        if (block != 1)
+        {
+            codegen_label(codegen, block);
+        }
+
+        // the only way in is a branch, the edge's moves go here
+        if (target->pred_count == 1)
+        {
+            uint32_t pred = function->preds[target->preds];
+            if (function->instructions[function->blocks[pred].last].op == IR_BRANCH)
+            {
+                codegen_edge_moves(codegen, pred, block);
+                codegen_flush_moves(codegen);
+            }
+        }
+
+        for (uint32_t index = target->first; index != IR_NONE; index = function->instructions[index].next)
+        {
+            int op = function->instructions[index].op;
+            if (op != IR_PHI && op != IR_PARAM)
+            {
+                codegen_instruction(codegen, index, next);
+            }
+        }
+    }
+
+    struct codegen_stub *stubs = vector_data_ptr(codegen->stubs);
+    for (int i = 0; i < vector_count(codegen->stubs); i++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), ".L%i_e%i", codegen->function_index, i);
+        peephole_label(codegen->peephole, name);
+        codegen_edge_moves(codegen, stubs[i].pred, stubs[i].succ);
+        codegen_flush_moves(codegen);
+        codegen_emit(codegen, "jmp .L%i_%u", codegen->function_index, stubs[i].succ);
+    }
+
+    if (codegen->process->flags & COMPILE_PROCESS_FLAG_PEEPHOLE)
+    {
+        peephole_run(codegen->peephole);
+    }
+
+    bool ok = true;
+    if (codegen->object)
+    {
+        uint64_t start = codegen->object->sections[ELF_SECTION_TEXT].size;
+        ok = x86_assemble(codegen->peephole, codegen->object);
+        uint32_t symbol = elf_symbol(codegen->object, function->name, strlen(function->name));
+        elf_define(codegen->object, symbol, ELF_SECTION_TEXT, start, codegen->object->sections[ELF_SECTION_TEXT].size - start, function->is_local, true);
+    }
+    else
+    {
+        peephole_write(codegen->peephole, codegen->out);
+        fprintf(codegen->out, "\t.size %s, .-%s\n", function->name, function->name);
+    }
+
+    vector_free(codegen->splits);
+    vector_free(codegen->split_values);
+    vector_free(codegen->stubs);
+    free(codegen->frame);
+    regalloc_free(codegen->regalloc);
+    codegen->function_index++;
+    return ok;
+}
+
+static int codegen_compare_relocations(const void *a, const void *b)
+{
+    const struct ir_relocation *left = a;
+    const struct ir_relocation *right = b;
+    return left->offset < right->offset ? -1 : left->offset > right->offset;
+}
+
+/**
+ * The data of a global goes straight into its section of the object file,
+ * pointers to symbols are left to the linker
+ */
+static void codegen_global_object(struct codegen *codegen, struct ir_global *global)
+{
+    int section = !strncmp(global->name, ".L.str", 6) ? ELF_SECTION_RODATA : global->data ? ELF_SECTION_DATA : ELF_SECTION_BSS;
+    elf_align(codegen->object, section, global->align > 0 ? global->align : 1);
+    uint64_t offset = elf_append(codegen->object, section, global->data, global->size);
+    uint32_t symbol = elf_symbol(codegen->object, global->name, strlen(global->name));
+    elf_define(codegen->object, symbol, section, offset, global->size, global->is_local, false);
+
+    struct ir_relocation *relocations = vector_data_ptr(global->relocations);
+    for (int i = 0; global->data && i < vector_count(global->relocations); i++)
+    {
+        uint32_t target = elf_symbol(codegen->object, relocations[i].symbol, strlen(relocations[i].symbol));
+        elf_relocate(codegen->object, section, offset + relocations[i].offset, target, R_X86_64_64, relocations[i].addend);
+    }
+}
+
+static void codegen_global(struct codegen *codegen, struct ir_global *global)
+{
+    if (codegen->object)
+    {
+        codegen_global_object(codegen, global);
+        return;
+    }
+
+    if (!strncmp(global->name, ".L.str", 6))
+    {
+        fprintf(codegen->out, "\t.section .rodata\n");
+    }
+    else
+    {
+        fprintf(codegen->out, global->data ? "\t.data\n" : "\t.bss\n");
+    }
+
+    if (!global->is_local)
+    {
+        fprintf(codegen->out, "\t.globl %s\n", global->name);
+    }
+    fprintf(codegen->out, "\t.balign %i\n", global->align > 0 ? global->align : 1);
+    fprintf(codegen->out, "%s:\n", global->name);
+    if (!global->data)
+    {
+        fprintf(codegen->out, "\t.zero %li\n", global->size);
+        return;
+    }
+
+    int relocation_count = vector_count(global->relocations);
+    struct ir_relocation *relocations = vector_data_ptr(global->relocations);
+    qsort(relocations, relocation_count, sizeof(struct ir_relocation), codegen_compare_relocations);
+    int r = 0;
+    long offset = 0;
+    while (offset < global->size)
+    {
+        if (r < relocation_count && relocations[r].offset == offset)
+        {
+            if (relocations[r].addend)
+            {
+                fprintf(codegen->out, "\t.quad %s%+lld\n", relocations[r].symbol, relocations[r].addend);
+            }
+            else
+            {
+                fprintf(codegen->out, "\t.quad %s\n", relocations[r].symbol);
+            }
+            offset += 8;
+            r++;
+            continue;
+        }
+
+        long end = r < relocation_count ? relocations[r].offset : global->size;
+        end = end - offset > 16 ? offset + 16 : end;
+        fprintf(codegen->out, "\t.byte ");
+        for (long i = offset; i < end; i++)
+        {
+            fprintf(codegen->out, i == offset ? "%u" : ",%u", global->data[i]);
+        }
+        fprintf(codegen->out, "\n");
+        offset = end;
+    }
+}
+
+/**
+ * A code generator that writes any number of modules to the process's output,
+ * names defined by earlier modules stay defined
+ */
+struct codegen *codegen_create(struct compile_process *process)
+{
+    struct codegen *codegen = calloc(1, sizeof(struct codegen));
+    codegen->process = process;
+    codegen->out = process->ofile;
+    codegen->defined = hashmap_create();
+    codegen->moves = vector_create(sizeof(struct codegen_move));
+    codegen->peephole = peephole_create();
+    if (process->flags & (COMPILE_PROCESS_FLAG_OBJECT | COMPILE_PROCESS_FLAG_RUN))
+    {
+        codegen->object = elf_object_create();
+    }
+    return codegen;
+}
+
+/**
+ * Generates the globals and functions of the module. A symbol defined by a later
+ * module is reached like one from another file, through the PLT or the GOT
+ */
+int codegen_module(struct codegen *codegen, struct ir_module *module)
+{
+    struct ir_function **functions = vector_data_ptr(module->functions);
+    struct ir_global **globals = vector_data_ptr(module->globals);
+    for (size_t i = 0; i < vector_count(module->functions); i++)
+    {
+        hashmap_set(codegen->defined, functions[i]->name, (void *)functions[i]->name);
+    }
+
+    for (size_t i = 0; i < vector_count(module->globals); i++)
+    {
+        hashmap_set(codegen->defined, globals[i]->name, (void *)globals[i]->name);
+    }
+
+    for (size_t i = 0; i < vector_count(module->globals); i++)
+    {
+        codegen_global(codegen, globals[i]);
+    }
+
+    for (size_t i = 0; i < vector_count(module->functions); i++)
+    {
+        if (!codegen_function(codegen, functions[i]))
+        {
+            return CODEGEN_GENERAL_ERROR;
+        }
+    }
+    return CODEGEN_ALL_OK;
+}
+
+/**
+ * Writes the object file or the end of the assembly and frees the code generator,
+ * res is what generating the modules returned
+ */
+int codegen_finish(struct codegen *codegen, int res)
+{
+    struct compile_process *process = codegen->process;
+    if (process->flags & COMPILE_PROCESS_FLAG_RUN)
+    {
+        // the caller loads the machine code, there is no file to write
+        process->object = res == CODEGEN_ALL_OK ? codegen->object : NULL;
+        if (!process->object)
+        {
+            elf_object_free(codegen->object);
+        }
+    }
+    else if (codegen->object)
+    {
+        if (res == CODEGEN_ALL_OK && !elf_write(codegen->object, codegen->out))
+        {
+            res = CODEGEN_GENERAL_ERROR;
+        }
+        elf_object_free(codegen->object);
+        fflush(codegen->out);
+    }
+    else
+    {
+        fprintf(codegen->out, "\t.section .note.GNU-stack,\"\",@progbits\n");
+        fflush(codegen->out);
+    }
+
+    if (process->flags & COMPILE_PROCESS_FLAG_PEEPHOLE_STATS)
+    {
+        peephole_report(codegen->peephole, stdout);
+    }
+
+    hashmap_free(codegen->defined);
+    vector_free(codegen->moves);
+    peephole_free(codegen->peephole);
+    free(codegen);
+    return res;
+}
+
+int codegen(struct compile_process *process)
+{
+    struct codegen *codegen = codegen_create(process);
+    return codegen_finish(codegen, codegen_module(codegen, process->ir));
+}
@@ -1,17 +1,20 @@
 #include "compiler.h"
+#include "helpers/vector.h"
 #include <stdarg.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 struct lex_precess_functions compiler_lex_functions = {
     .next_char = compile_process_next_char,
     .peek_char = compile_process_peek_char,
-    .push_char = compile_process_push_char};
+    .push_char = compile_process_push_char,
+    .source = compile_process_source};
 
 void compiler_error(struct compile_process *process, const char *msg, ...)
 {
     va_list args;
     va_start(args, msg);
-    fprintf(stderr, msg, args);
+    vfprintf(stderr, msg, args);
     va_end(args);
     fprintf(stderr, " on line %i, col %i in file %s\n", process->pos.line, process->pos.col, process->pos.filename);
     exit(-1);
@@ -21,33 +24,230 @@ void compile_warning(struct compile_process *process, const char *msg, ...)
 {
     va_list args;
     va_start(args, msg);
-    fprintf(stderr, msg, args);
+    vfprintf(stderr, msg, args);
     va_end(args);
     fprintf(stderr, " on line %i, col %i in file %s\n", process->pos.line, process->pos.col, process->pos.filename);
 }
 
-int compile_file(const char *filename, const char *out_filename, int flags)
+/**
+ * Runs every stage on one top level declaration after the other, once a declaration
+ * is written its tokens and the nodes of its body or initializer are released so the
+ * memory used follows the largest declaration and not the size of the file
+ */
+static int compile_streaming(struct compile_process *process, struct lex_process *lex_process, struct lex_pipeline *pipeline)
 {
-    struct compile_process *process = compile_process_create(filename, out_filename, flags);
-    if (!process)
+    preprocessor_start(process, lex_process, pipeline);
+    struct parser *parser = parser_create(process);
+    struct resolver *resolver = resolver_create(process);
+    struct ir_builder *builder = ir_builder_create(process);
+    struct codegen *codegen = process->flags & COMPILE_PROCESS_FLAG_DUMP_IR ? NULL : codegen_create(process);
+    int res = CODEGEN_ALL_OK;
+    bool done = false;
+    while (res == CODEGEN_ALL_OK)
     {
-        return COMPILER_FAILED_WITH_ERRORS;
+        if (!done && preprocessor_next_declaration(process))
+        {
+            process->node_tree = parser_parse(parser);
+            resolver_resolve(resolver, process->node_tree);
+            process->ir = ir_builder_build(builder, process->node_tree);
+        }
+        else
+        {
+            // variables that were never initialized go last
+            done = true;
+            process->ir = ir_builder_finish(builder);
+            if (!process->ir)
+            {
+                break;
+            }
+        }
+
+        if (optimize(process) != OPTIMIZE_ALL_OK)
+        {
+            res = CODEGEN_GENERAL_ERROR;
+        }
+        else if (codegen)
+        {
+            res = codegen_module(codegen, process->ir);
+        }
+        else
+        {
+            ir_dump(process->ir, process->ofile);
+        }
+        ir_module_free(process->ir);
+        process->ir = NULL;
+
+        uint32_t first = parser_release(parser);
+        if (first != NODE_NONE)
+        {
+            resolver_release(resolver, first);
+            ir_builder_release(builder, first);
+        }
     }
 
-    // perform lexical analysis
-    struct lex_process *lex_process = lex_process_create(process, &compiler_lex_functions, NULL);
-    if (!lex_process)
+    if (pipeline)
+    {
+        lex_pipeline_free(pipeline);
+    }
+    parser_free(parser);
+    resolver_free(resolver);
+    ir_builder_free(builder);
+    if (codegen && codegen_finish(codegen, res) != CODEGEN_ALL_OK)
     {
         return COMPILER_FAILED_WITH_ERRORS;
     }
+    return res == CODEGEN_ALL_OK ? 0 : COMPILER_FAILED_WITH_ERRORS;
+}
 
-    if (lex(lex_process) != LEXICAL_ANALYSIS_ALL_OK)
+/**
+ * Runs every stage of the compiler on the process
+ */
+static int compile(struct compile_process *process)
+{
+    // perform lexical analysis, either as the preprocessor asks for tokens or ahead
+    // of it on a thread of its own, which only pays with a processor to run it on
+    struct lex_process *lex_process = NULL;
+    struct lex_pipeline *pipeline = NULL;
+    if ((process->flags & COMPILE_PROCESS_FLAG_PIPELINE_LEXER) && sysconf(_SC_NPROCESSORS_ONLN) > 1)
+    {
+        pipeline = lex_pipeline_create(process, true);
+    }
+    else
+    {
+        lex_process = lex_process_create(process, &compiler_lex_functions, NULL);
+        if (!lex_process)
+        {
+            return COMPILER_FAILED_WITH_ERRORS;
+        }
+        process->token_vec_original = lex_process_tokens(lex_process);
+    }
+
+    // perform preprocessing, the preprocessor pulls tokens from the lexer
+    // so included files are only opened and lexed when they are needed
+    process->preprocessor = preprocessor_create(process);
+    // the interpreter needs the whole module, it is never streamed
+    if ((process->flags & COMPILE_PROCESS_FLAG_STREAM) && !(process->flags & COMPILE_PROCESS_FLAG_BYTECODE))
+    {
+        return compile_streaming(process, lex_process, pipeline);
+    }
+
+    if (preprocessor_run(process, lex_process, pipeline) != PREPROCESS_ALL_OK)
     {
         return COMPILER_FAILED_WITH_ERRORS;
     }
+    if (pipeline)
+    {
+        lex_pipeline_free(pipeline);
+    }
+
     // perform parsing
+    if (parse(process) != PARSE_ALL_OK)
+    {
+        return COMPILER_FAILED_WITH_ERRORS;
+    }
+
+    // bind identifiers to their declarations and give every expression its type
+    if (resolve(process) != RESOLVE_ALL_OK)
+    {
+        return COMPILER_FAILED_WITH_ERRORS;
+    }
+
+    // lower to SSA form IR
+    if (ir_build(process) != IR_ALL_OK)
+    {
+        return COMPILER_FAILED_WITH_ERRORS;
+    }
+
+    // run the optimization passes the flags turn on
+    if (optimize(process) != OPTIMIZE_ALL_OK)
+    {
+        return COMPILER_FAILED_WITH_ERRORS;
+    }
+
+    if (process->flags & COMPILE_PROCESS_FLAG_DUMP_IR)
+    {
+        ir_dump(process->ir, process->ofile);
+        return 0;
+    }
 
-    // preform code generation
+    // the interpreter runs the IR, there is no machine code to generate
+    if (process->flags & COMPILE_PROCESS_FLAG_BYTECODE)
+    {
+        return 0;
+    }
+
+    // perform code generation, x86-64 assembly for the GNU assembler or an object file
+    if (codegen(process) != CODEGEN_ALL_OK)
+    {
+        return COMPILER_FAILED_WITH_ERRORS;
+    }
 
     return 0;
+}
+
+int compile_file(const char *filename, const char *out_filename, int flags)
+{
+    return compile_file_with_dependencies(filename, out_filename, flags, NULL);
+}
+
+/**
+ * Compiles the file like compile_file, dependencies receives the const char*
+ * absolute path of every file the compile read, the source first
+ */
+int compile_file_with_dependencies(const char *filename, const char *out_filename, int flags, struct vector *dependencies)
+{
+    struct compile_process *process = compile_process_create(filename, out_filename, flags);
+    if (!process)
+    {
+        return COMPILER_FAILED_WITH_ERRORS;
+    }
+
+    // the compile server runs many compiles in one process, it can't leave the output to exit
+    int res = compile(process);
+    if (process->ofile)
+    {
+        fclose(process->ofile);
+    }
+
+    for (int i = 0; dependencies && i < vector_count(process->dependencies); i++)
+    {
+        vector_push(dependencies, vector_at(process->dependencies, i));
+    }
+    return res;
+}
+
+/**
+ * Compiles the file straight into executable memory of this process, NULL on errors
+ */
+struct jit *compile_to_memory(const char *filename, int flags)
+{
+    // there is no output file to dump the IR to
+    flags = (flags & ~COMPILE_PROCESS_FLAG_DUMP_IR) | COMPILE_PROCESS_FLAG_RUN;
+    struct compile_process *process = compile_process_create(filename, NULL, flags);
+    if (!process || compile(process) != COMPILER_FILE_COMPILED_OK)
+    {
+        return NULL;
+    }
+
+    struct jit *jit = jit_load(process->object);
+    if (!jit)
+    {
+        elf_object_free(process->object);
+    }
+    process->object = NULL;
+    return jit;
+}
+
+/**
+ * Compiles the file for the bytecode interpreter, NULL on errors
+ */
+struct bytecode_program *compile_to_bytecode(const char *filename, int flags)
+{
+    flags = (flags & ~COMPILE_PROCESS_FLAG_DUMP_IR) | COMPILE_PROCESS_FLAG_BYTECODE;
+    struct compile_process *process = compile_process_create(filename, NULL, flags);
+    if (!process || compile(process) != COMPILER_FILE_COMPILED_OK)
+    {
+        return NULL;
+    }
+    return bytecode_create(process->ir);
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 
 #define S_EQ(str, str2) \
@@ -10,6 +11,19 @@
 
 struct lex_process;
 struct compile_process;
+struct preprocessor;
+struct buffer;
+struct node_pool;
+struct intern_table;
+struct symbol_table;
+struct type_table;
+struct type;
+struct ir_module;
+struct hashmap;
+struct parser;
+struct resolver;
+struct ir_builder;
+struct codegen;
 
 struct pos
 {
@@ -73,13 +87,82 @@ enum
     TOKEN_TYPE_NUMBER,
     TOKEN_TYPE_STRING,
     TOKEN_TYPE_COMMENT,
-    TOKEN_TYPE_NEWLINE
+    TOKEN_TYPE_NEWLINE,
+    // the text of a branch the preprocessor skipped, kept unlexed in cached headers
+    TOKEN_TYPE_SKIPPED
+};
+
+// codes of operator and symbol tokens, parsers can switch on them instead of
+// comparing spellings
+enum
+{
+    OP_NONE,
+    OP_PLUS,
+    OP_MINUS,
+    OP_STAR,
+    OP_SLASH,
+    OP_PERCENT,
+    OP_CARET,
+    OP_AMPERSAND,
+    OP_PIPE,
+    OP_TILDE,
+    OP_NOT,
+    OP_LESS,
+    OP_GREATER,
+    OP_ASSIGN,
+    OP_LPAREN,
+    OP_LBRACKET,
+    OP_COMMA,
+    OP_DOT,
+    OP_QUESTION,
+    OP_PLUS_ASSIGN,
+    OP_MINUS_ASSIGN,
+    OP_MUL_ASSIGN,
+    OP_DIV_ASSIGN,
+    OP_MOD_ASSIGN,
+    OP_XOR_ASSIGN,
+    OP_AND_ASSIGN,
+    OP_OR_ASSIGN,
+    OP_SHIFT_LEFT,
+    OP_SHIFT_RIGHT,
+    OP_SHIFT_LEFT_ASSIGN,
+    OP_SHIFT_RIGHT_ASSIGN,
+    OP_LESS_EQUAL,
+    OP_GREATER_EQUAL,
+    OP_EQUAL,
+    OP_NOT_EQUAL,
+    OP_LOGICAL_AND,
+    OP_LOGICAL_OR,
+    OP_INCREMENT,
+    OP_DECREMENT,
+    OP_ARROW,
+    OP_ELLIPSIS,
+    // ## of a macro body, one token so that # ## # pastes two '#'
+    OP_HASH_HASH,
+    SYM_LBRACE,
+    SYM_RBRACE,
+    SYM_COLON,
+    SYM_SEMICOLON,
+    SYM_HASH,
+    SYM_BACKSLASH,
+    SYM_RPAREN,
+    SYM_RBRACKET,
+    OP_TOTAL
+};
+
+enum
+{
+    // string token read from #include <...>
+    TOKEN_FLAG_SYSTEM_INCLUDE = 0b00000001
 };
 
 struct token
 {
     int type;
     int flags;
+    // OP_* or SYM_* code of operator and symbol tokens, OP_NONE for the rest
+    int op;
+    bool whitespace;
     struct pos pos;
 
     union
@@ -92,21 +175,28 @@ struct token
         void *any;
     };
 
-    bool whitespace;
-
     const char *between_brackets;
+    // bytes in the value of a string literal, which may hold a '\0'
+    size_t length;
+    // how a number or char literal was written, for # and ##, NULL for the numbers
+    // the preprocessor makes itself. Interned
+    const char *spelling;
 };
 
 struct lex_precess;
 typedef char (*LEX_PROCESS_NEXT_CHAR)(struct lex_process *process);
 typedef char (*LEX_PROCESS_PEEK_CHAR)(struct lex_process *process);
 typedef void (*LEX_PROCESS_PUSH_CHAR)(struct lex_process *process, char c);
+// returns the in memory input whose rindex is the read position, NULL if the input
+// can only be read a character at a time
+typedef struct buffer *(*LEX_PROCESS_SOURCE)(struct lex_process *process);
 
 struct lex_precess_functions
 {
     LEX_PROCESS_NEXT_CHAR next_char;
     LEX_PROCESS_PEEK_CHAR peek_char;
     LEX_PROCESS_PUSH_CHAR push_char;
+    LEX_PROCESS_SOURCE source;
 };
 
 struct lex_process
@@ -116,12 +206,59 @@ struct lex_process
     struct compile_process *compiler;
 
     int currtent_expression_count;
-    struct buffer *parenthsess_buffer;
     struct lex_precess_functions *function;
 
     void *private;
+    // holds how the number or char literal being read is written, NULL until there is one
+    struct buffer *spelling;
+};
+
+enum
+{
+    // function bodies are parsed on worker threads
+    COMPILE_PROCESS_FLAG_PARALLEL_PARSE = 0b00000001,
+    // write the SSA form of every function to the output file
+    COMPILE_PROCESS_FLAG_DUMP_IR = 0b00000010,
+    // keep every value in its stack slot, the baseline the register allocator is measured against
+    COMPILE_PROCESS_FLAG_SPILL_ALL = 0b00000100,
+    // sparse conditional constant propagation
+    COMPILE_PROCESS_FLAG_SCCP = 0b00001000,
+    // algebraic identities, folding and strength reduction of single instructions
+    COMPILE_PROCESS_FLAG_SIMPLIFY = 0b00010000,
+    // dead instructions, jumps to jumps and unreachable blocks
+    COMPILE_PROCESS_FLAG_DCE = 0b00100000,
+    // rewrite the emitted instructions with the peephole rules
+    COMPILE_PROCESS_FLAG_PEEPHOLE = 0b01000000,
+    // print how often each peephole rule fired
+    COMPILE_PROCESS_FLAG_PEEPHOLE_STATS = 0b10000000,
+    // inline small functions and functions called once into their callers
+    COMPILE_PROCESS_FLAG_INLINE = 0b100000000,
+    // self tail calls become loops and other tail calls become jumps
+    COMPILE_PROCESS_FLAG_TAIL_CALLS = 0b1000000000,
+    // move loop invariant instructions in front of their loop
+    COMPILE_PROCESS_FLAG_LICM = 0b10000000000,
+    // addresses that grow by a fixed step each iteration become pointers of their own
+    COMPILE_PROCESS_FLAG_STRENGTH_REDUCTION = 0b100000000000,
+    // loops with a small constant trip count are unrolled completely
+    COMPILE_PROCESS_FLAG_UNROLL = 0b1000000000000,
+    // write an ELF64 relocatable object instead of assembly text
+    COMPILE_PROCESS_FLAG_OBJECT = 0b10000000000000,
+    // keep the machine code in memory for jit_load instead of writing the output file
+    COMPILE_PROCESS_FLAG_RUN = 0b100000000000000,
+    // stop once the IR is optimized, the caller translates it to bytecode
+    COMPILE_PROCESS_FLAG_BYTECODE = 0b1000000000000000,
+    // the main file is lexed on a thread of its own while the preprocessor reads it
+    COMPILE_PROCESS_FLAG_PIPELINE_LEXER = 0b10000000000000000,
+    // compile one top level declaration at a time and let its tokens and tree go once
+    // it is written, memory stays the same however long the file is
+    COMPILE_PROCESS_FLAG_STREAM = 0b100000000000000000
 };
 
+// passes that each -O level turns on
+#define COMPILE_PROCESS_FLAGS_O1 (COMPILE_PROCESS_FLAG_SCCP | COMPILE_PROCESS_FLAG_DCE | COMPILE_PROCESS_FLAG_PEEPHOLE)
+#define COMPILE_PROCESS_FLAGS_O2 (COMPILE_PROCESS_FLAGS_O1 | COMPILE_PROCESS_FLAG_SIMPLIFY | COMPILE_PROCESS_FLAG_INLINE | COMPILE_PROCESS_FLAG_TAIL_CALLS | \
+                                  COMPILE_PROCESS_FLAG_LICM | COMPILE_PROCESS_FLAG_STRENGTH_REDUCTION | COMPILE_PROCESS_FLAG_UNROLL)
+
 enum
 {
     COMPILER_FILE_COMPILED_OK,
@@ -134,19 +271,919 @@ struct compile_process
     struct pos pos;
     struct compile_process_input_file
     {
-        FILE *fp;
+        // the whole file, rindex is where the lexer is reading
+        struct buffer *buffer;
         const char *abs_path;
     } cfile;
 
+    // tokens of the main file exactly as the lexer produced them
+    struct vector *token_vec_original;
+    // preprocessed tokens of the whole translation unit, this is what the parser reads
+    struct vector *token_vec;
+    // int for every token in token_vec, the index of the matching closing bracket
+    // for ( [ { tokens and -1 for every other token
+    struct vector *token_bracket_matches;
+
+    struct preprocessor *preprocessor;
+    // const char* absolute path of every file the translation unit read, the main file first
+    struct vector *dependencies;
+
+    // one copy of every identifier and keyword of the translation unit, included
+    // files share their includer's table so names can be compared by pointer
+    struct intern_table *identifiers;
+
+    // every node of the translation unit, freed in one go with node_pool_free
+    struct node_pool *node_pool;
+    // first top level declaration, the rest follow through node->next
+    uint32_t node_tree;
+
+    // one canonical copy of every type of the translation unit
+    struct type_table *types;
+    // type of every declaration and expression by node index, set by the resolver
+    struct type **node_types;
+
+    // functions in SSA form and the data of global variables
+    struct ir_module *ir;
+
+    // machine code of the translation unit when it is run in memory
+    struct elf_object *object;
+
     FILE *ofile;
 };
 
+enum
+{
+    PREPROCESS_ALL_OK,
+    PREPROCESS_GENERAL_ERROR
+};
+
+enum
+{
+    PARSE_ALL_OK,
+    PARSE_GENERAL_ERROR
+};
+
+enum
+{
+    RESOLVE_ALL_OK,
+    RESOLVE_GENERAL_ERROR
+};
+
+enum
+{
+    IR_ALL_OK,
+    IR_GENERAL_ERROR
+};
+
+enum
+{
+    OPTIMIZE_ALL_OK,
+    OPTIMIZE_GENERAL_ERROR
+};
+
+enum
+{
+    CODEGEN_ALL_OK,
+    CODEGEN_GENERAL_ERROR
+};
+
+// nodes refer to each other with indexes into their pool, index 0 is never
+// handed out so it can mean "no node"
+#define NODE_NONE 0
+#define NODE_MAX_CHILDREN 4
+#define NODE_POOL_LOCAL_BASE 0x80000000u
+
+enum
+{
+    NODE_TYPE_NUMBER,
+    NODE_TYPE_STRING,
+    NODE_TYPE_IDENTIFIER,
+    // binary operator including assignments and the comma operator
+    NODE_TYPE_EXPRESSION,
+    NODE_TYPE_UNARY,
+    // x++ and x--
+    NODE_TYPE_POSTFIX,
+    NODE_TYPE_TERNARY,
+    NODE_TYPE_CALL,
+    NODE_TYPE_SUBSCRIPT,
+    // x.y and x->y, op tells which one
+    NODE_TYPE_MEMBER,
+    NODE_TYPE_CAST,
+    NODE_TYPE_SIZEOF,
+    NODE_TYPE_INITIALIZER_LIST,
+
+    NODE_TYPE_VARIABLE,
+    NODE_TYPE_FUNCTION,
+    NODE_TYPE_STRUCT,
+    NODE_TYPE_ENUM,
+    NODE_TYPE_ENUMERATOR,
+    NODE_TYPE_BODY,
+    NODE_TYPE_STATEMENT_RETURN,
+    NODE_TYPE_STATEMENT_IF,
+    NODE_TYPE_STATEMENT_WHILE,
+    NODE_TYPE_STATEMENT_DO_WHILE,
+    NODE_TYPE_STATEMENT_FOR,
+    NODE_TYPE_STATEMENT_BREAK,
+    NODE_TYPE_STATEMENT_CONTINUE,
+    NODE_TYPE_STATEMENT_SWITCH,
+    NODE_TYPE_STATEMENT_CASE,
+    NODE_TYPE_STATEMENT_DEFAULT,
+    NODE_TYPE_STATEMENT_GOTO,
+    NODE_TYPE_LABEL
+};
+
+enum
+{
+    // function taking a variable amount of arguments
+    NODE_FLAG_VARIADIC = 0b00000001,
+    // sizeof applied to the datatype rather than to an expression
+    NODE_FLAG_SIZEOF_DATATYPE = 0b00000010,
+    // struct node declaring a union
+    NODE_FLAG_UNION = 0b00000100,
+    // array dimension written as []
+    NODE_FLAG_UNSIZED = 0b00001000,
+    // a streamed function or variable whose body or initializer was compiled and released
+    NODE_FLAG_RELEASED = 0b00010000
+};
+
+enum
+{
+    DATA_TYPE_VOID,
+    DATA_TYPE_CHAR,
+    DATA_TYPE_SHORT,
+    DATA_TYPE_INT,
+    DATA_TYPE_LONG,
+    DATA_TYPE_FLOAT,
+    DATA_TYPE_DOUBLE,
+    DATA_TYPE_STRUCT,
+    DATA_TYPE_UNION
+};
+
+enum
+{
+    DATATYPE_FLAG_IS_SIGNED = 0b00000001,
+    DATATYPE_FLAG_IS_UNSIGNED = 0b00000010,
+    DATATYPE_FLAG_IS_CONST = 0b00000100,
+    DATATYPE_FLAG_IS_STATIC = 0b00001000,
+    DATATYPE_FLAG_IS_EXTERN = 0b00010000,
+    DATATYPE_FLAG_IS_TYPEDEF = 0b00100000,
+    DATATYPE_FLAG_IS_INLINE = 0b01000000
+};
+
+/**
+ * A type as it was written in the source, the semantic phase turns these into real types
+ */
+struct datatype
+{
+    int type;
+    int flags;
+    int pointer_depth;
+    // tag of struct and union types, NULL when anonymous
+    const char *type_str;
+    // NODE_TYPE_STRUCT node when the members were declared together with this type
+    uint32_t struct_node;
+    // list of array dimension expressions, outermost first
+    uint32_t array_sizes;
+};
+
+struct node
+{
+    int type;
+    int flags;
+    // OP_* code of operator nodes
+    int op;
+    // the next node of the list this node belongs to: statements of a body,
+    // arguments, parameters, members and top level declarations
+    uint32_t next;
+    // index into the pool's datatypes for declarations, casts and sizeof
+    uint32_t datatype;
+    // the node an identifier refers to, or the struct a member access goes
+    // into, set by the resolver
+    uint32_t declaration;
+    struct pos pos;
+
+    union
+    {
+        uint32_t children[NODE_MAX_CHILDREN];
+        struct
+        {
+            uint32_t left;
+            uint32_t right;
+        } exp;
+        struct
+        {
+            uint32_t operand;
+        } unary;
+        struct
+        {
+            uint32_t condition;
+            uint32_t true_exp;
+            uint32_t false_exp;
+        } ternary;
+        struct
+        {
+            uint32_t function;
+            uint32_t arguments;
+        } call;
+        struct
+        {
+            uint32_t initializer;
+        } var;
+        struct
+        {
+            uint32_t params;
+            uint32_t body;
+        } func;
+        struct
+        {
+            // first statement, member, enumerator or initializer
+            uint32_t first;
+        } list;
+        struct
+        {
+            uint32_t condition;
+            uint32_t body;
+            uint32_t else_body;
+        } stmt_if;
+        struct
+        {
+            // condition of loops and switches, value of return and case
+            uint32_t exp;
+            uint32_t body;
+        } stmt;
+        struct
+        {
+            uint32_t init;
+            uint32_t condition;
+            uint32_t step;
+            uint32_t body;
+        } stmt_for;
+        struct
+        {
+            // bytes of a string literal without the terminating '\0'
+            uint32_t length;
+        } string;
+    };
+
+    union
+    {
+        unsigned long long llnum;
+        // identifier, string literal, declared name, member name or label
+        const char *sval;
+    };
+};
+
+/**
+ * Contiguous storage for the nodes of a compilation, nodes and datatypes are
+ * referred to by index so the arrays can grow and be freed in one step
+ */
+struct node_pool
+{
+    // index of nodes[0] and datatypes[0], pools filled on worker threads start at
+    // NODE_POOL_LOCAL_BASE so their indexes can be told apart from the main pool's
+    uint32_t base;
+    struct node *nodes;
+    uint32_t count;
+    uint32_t capacity;
+
+    struct datatype *datatypes;
+    uint32_t datatype_count;
+    uint32_t datatype_capacity;
+};
+
+/**
+ * A list of nodes linked through node->next that remembers its tail
+ */
+struct node_list
+{
+    uint32_t head;
+    uint32_t tail;
+};
+
+/**
+ * The innermost visible declaration of a name
+ */
+struct symbol
+{
+    // interned name, NULL for a free slot
+    const char *name;
+    // NODE_NONE while the name is not visible
+    uint32_t node;
+    // depth of the scope that declared it, the file scope is 0
+    int depth;
+};
+
+/**
+ * Maps interned names to the node declaring them. There is one open addressing
+ * table for all scopes; declaring a name saves what it hides in an undo log and
+ * leaving a scope replays the log back to where the scope started
+ */
+struct symbol_table
+{
+    struct symbol *slots;
+    size_t capacity;
+    size_t count;
+    // 64 - log2(capacity)
+    int shift;
+
+    struct symbol *undo;
+    size_t undo_count;
+    size_t undo_capacity;
+
+    // undo_count when each open scope was entered
+    size_t *scopes;
+    int depth;
+    int scopes_capacity;
+};
+
+enum
+{
+    TYPE_VOID,
+    TYPE_CHAR,
+    TYPE_SHORT,
+    TYPE_INT,
+    TYPE_LONG,
+    TYPE_FLOAT,
+    TYPE_DOUBLE,
+    TYPE_POINTER,
+    TYPE_ARRAY,
+    TYPE_FUNCTION,
+    TYPE_STRUCT,
+    TYPE_UNION
+};
+
+enum
+{
+    TYPE_FLAG_UNSIGNED = 0b00000001,
+    TYPE_FLAG_VARIADIC = 0b00000010,
+    // the struct or union has been laid out
+    TYPE_FLAG_COMPLETE = 0b00000100
+};
+
+struct type_member
+{
+    // interned name
+    const char *name;
+    struct type *type;
+    long offset;
+};
+
+/**
+ * Types are hash-consed, two types are the same exactly when their pointers are equal.
+ * Qualifiers such as const are not part of a type
+ */
+struct type
+{
+    int kind;
+    int flags;
+    // pointee, array element or return type
+    struct type *base;
+    // number of array elements, -1 for arrays declared with []
+    long length;
+    struct type **params;
+    int param_count;
+    // NODE_TYPE_STRUCT node defining a struct or union, NODE_NONE when only the tag is known
+    uint32_t struct_node;
+    const char *tag;
+
+    // in bytes, structs and unions have size 0 until they are complete
+    long size;
+    int align;
+    // struct and union members, laid out once per canonical type
+    struct type_member *members;
+    int member_count;
+
+    unsigned int hash;
+};
+
+struct type_table
+{
+    struct type **entries;
+    size_t capacity;
+    size_t count;
+    // no struct type defined by a node past this one, type_table_release has nothing to do
+    uint32_t struct_node_max;
+};
+
+// instructions, operands and blocks are referred to by index, index 0 is never
+// handed out so it can mean "none"
+#define IR_NONE 0
+
+// what a value holds, pointers are IR_TYPE_I64 and signedness lives in the opcodes
+enum
+{
+    IR_TYPE_VOID,
+    IR_TYPE_I8,
+    IR_TYPE_I16,
+    IR_TYPE_I32,
+    IR_TYPE_I64
+};
+
+enum
+{
+    // an instruction that has been removed
+    IR_NOP,
+    IR_CONST,
+    IR_PARAM,
+    // address of a global variable, function or string
+    IR_GLOBAL,
+    // stack slot of constant bytes, aligned to aux
+    IR_ALLOCA,
+    IR_LOAD,
+    // address, value
+    IR_STORE,
+    // destination, source, constant bytes
+    IR_MEMCPY,
+    // address, constant bytes
+    IR_ZERO,
+    IR_ADD,
+    IR_SUB,
+    IR_MUL,
+    IR_SDIV,
+    IR_UDIV,
+    IR_SREM,
+    IR_UREM,
+    IR_AND,
+    IR_OR,
+    IR_XOR,
+    IR_SHL,
+    IR_SHR,
+    IR_SAR,
+    IR_NEG,
+    IR_NOT,
+    // comparisons produce an IR_TYPE_I32 0 or 1
+    IR_EQ,
+    IR_NE,
+    IR_SLT,
+    IR_SLE,
+    IR_SGT,
+    IR_SGE,
+    IR_ULT,
+    IR_ULE,
+    IR_UGT,
+    IR_UGE,
+    IR_SEXT,
+    IR_ZEXT,
+    IR_TRUNC,
+    // callee, arguments; aux is the number of fixed arguments of a variadic callee or -1
+    IR_CALL,
+    // one operand for each predecessor, in the order of block->preds
+    IR_PHI,
+    IR_JUMP,
+    // condition, goes to successors[0] when it is not zero
+    IR_BRANCH,
+    // optional value
+    IR_RETURN,
+    IR_TOTAL
+};
+
+/**
+ * An operand of an instruction. Every operand is also a node of the list of
+ * uses of the value it refers to
+ */
+struct ir_use
+{
+    uint32_t value;
+    uint32_t user;
+    uint32_t prev;
+    uint32_t next;
+};
+
+/**
+ * An instruction and the value it produces share one index
+ */
+struct ir_instruction
+{
+    int op;
+    int type;
+    uint32_t block;
+    // neighbours inside the block
+    uint32_t prev;
+    uint32_t next;
+    // operand_count consecutive slots of function->uses
+    uint32_t operands;
+    uint32_t operand_count;
+    // first operand that refers to this value
+    uint32_t first_use;
+    int aux;
+    // IR_CONST value, IR_PARAM position, IR_GLOBAL offset and sizes of memory operations
+    long long constant;
+    // IR_GLOBAL symbol
+    const char *symbol;
+};
+
+enum
+{
+    // aux of an IR_ADD, IR_SUB, IR_MUL or IR_SHL whose signed overflow is undefined behaviour
+    IR_FLAG_NO_SIGNED_WRAP = 0b00000001
+};
+
+enum
+{
+    IR_BLOCK_FLAG_DEAD = 0b00000001
+};
+
+struct ir_block
+{
+    int flags;
+    uint32_t first;
+    uint32_t last;
+    // set together with the terminator, IR_NONE when unused
+    uint32_t successors[2];
+    // pred_count consecutive entries of function->preds, see ir_compute_predecessors
+    uint32_t preds;
+    uint32_t pred_count;
+    // immediate dominator, IR_NONE for the entry block
+    uint32_t idom;
+};
+
+struct ir_function
+{
+    const char *name;
+    // static functions are not visible to other object files
+    bool is_local;
+    struct type *type;
+
+    struct ir_instruction *instructions;
+    uint32_t instruction_count;
+    uint32_t instruction_capacity;
+
+    struct ir_use *uses;
+    uint32_t use_count;
+    uint32_t use_capacity;
+
+    // block 1 is the entry
+    struct ir_block *blocks;
+    uint32_t block_count;
+    uint32_t block_capacity;
+
+    uint32_t *preds;
+    uint32_t pred_count;
+    uint32_t pred_capacity;
+};
+
+/**
+ * A pointer stored in the data of a global, resolved by the linker
+ */
+struct ir_relocation
+{
+    long offset;
+    const char *symbol;
+    long long addend;
+};
+
+struct ir_global
+{
+    const char *name;
+    bool is_local;
+    long size;
+    int align;
+    // NULL for globals that start zeroed
+    unsigned char *data;
+    // struct ir_relocation
+    struct vector *relocations;
+};
+
+struct ir_module
+{
+    // struct ir_function *, only functions with a body
+    struct vector *functions;
+    // struct ir_global *
+    struct vector *globals;
+    int string_count;
+    int static_count;
+};
+
+// x86-64 general purpose registers in encoding order
+enum
+{
+    X86_RAX,
+    X86_RCX,
+    X86_RDX,
+    X86_RBX,
+    X86_RSP,
+    X86_RBP,
+    X86_RSI,
+    X86_RDI,
+    X86_R8,
+    X86_R9,
+    X86_R10,
+    X86_R11,
+    X86_R12,
+    X86_R13,
+    X86_R14,
+    X86_R15,
+    X86_REGISTER_COUNT
+};
+
+#define X86_NO_REGISTER -1
+
+/**
+ * Code positions go up by 4 for each instruction in code order, an instruction
+ * at position p reads its operands at p, clobbers registers at p + 1 and
+ * defines its value at p + 2. Phis and parameters are defined at the start of
+ * their block
+ */
+struct live_range
+{
+    uint32_t from;
+    // inclusive
+    uint32_t to;
+};
+
+struct live_use
+{
+    uint32_t position;
+    // uses inside loops weigh more
+    uint32_t weight;
+};
+
+/**
+ * Where a value lives over a set of positions. Splitting an interval gives the
+ * later part its own interval which may live somewhere else
+ */
+struct live_interval
+{
+    uint32_t value;
+    // X86_* register or X86_NO_REGISTER when the part lives in the value's stack slot
+    int reg;
+    struct live_range *ranges;
+    uint32_t range_count;
+    uint32_t range_capacity;
+    struct live_use *uses;
+    uint32_t use_count;
+    uint32_t use_capacity;
+    // first range that can still cover the position being allocated
+    uint32_t cursor;
+    // part that follows after a split
+    struct live_interval *next;
+    // register the value should preferably get, or a value whose register it should share
+    int hint_reg;
+    uint32_t hint_value;
+};
+
+struct regalloc
+{
+    struct ir_function *function;
+    // blocks in code order
+    uint32_t *order;
+    uint32_t order_count;
+    // by block
+    uint32_t *block_start;
+    uint32_t *block_end;
+    uint32_t *loop_depth;
+    // by instruction
+    uint32_t *positions;
+    // first part of each value, NULL for values that are rematerialized or never used
+    struct live_interval **intervals;
+    // stack slot of each value that is spilled anywhere, numbered from 1
+    uint32_t *slots;
+    uint32_t slot_count;
+    // bit mask of the X86_* registers that hold a value somewhere
+    uint32_t used_registers;
+};
+
+/**
+ * An assembly instruction or label held back from the output file so the
+ * peephole rules can rewrite it
+ */
+struct peephole_instruction
+{
+    // labels keep their name in operands[0]
+    bool is_label;
+    char mnemonic[16];
+    char *operands[2];
+    int operand_count;
+    // neighbours in the list, removed instructions are unlinked
+    uint32_t prev;
+    uint32_t next;
+};
+
+struct peephole
+{
+    // entry 0 is never used so index 0 can mean "none"
+    struct peephole_instruction *instructions;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t first;
+    uint32_t last;
+    // times each rule fired, in the order of the rule table
+    int *fired;
+};
+
+enum
+{
+    ELF_SECTION_TEXT,
+    ELF_SECTION_DATA,
+    ELF_SECTION_BSS,
+    ELF_SECTION_RODATA,
+    ELF_SECTION_COUNT
+};
+
+struct elf_section
+{
+    // stays NULL for .bss, which only has a size
+    uint8_t *data;
+    uint64_t size;
+    uint64_t capacity;
+    uint64_t align;
+};
+
+struct elf_symbol
+{
+    const char *name;
+    // ELF_SECTION_* the symbol is defined in, -1 while it is undefined
+    int section;
+    uint64_t value;
+    uint64_t size;
+    bool is_local;
+    bool is_function;
+};
+
+struct elf_relocation
+{
+    int section;
+    uint64_t offset;
+    uint32_t symbol;
+    // R_X86_64_*
+    int type;
+    long long addend;
+};
+
+/**
+ * Sections, symbols and relocations of the object file being put together,
+ * it is written out in one go once code generation is done
+ */
+struct elf_object
+{
+    struct elf_section sections[ELF_SECTION_COUNT];
+    // struct elf_symbol
+    struct vector *symbols;
+    // symbol name to index + 1
+    struct hashmap *indexes;
+    // struct elf_relocation
+    struct vector *relocations;
+};
+
+/**
+ * An object loaded into this process and ready to be called
+ */
+struct jit
+{
+    // text and stubs, then the global offset table and rodata, then data and bss,
+    // each part starts on its own page
+    uint8_t *memory;
+    size_t size;
+    struct elf_object *object;
+    // where each symbol of the object ended up
+    uint8_t **addresses;
+};
+
+/**
+ * One instruction of the bytecode interpreter, handler is the address of the code
+ * that runs it. Registers are 8 byte slots of the frame, branch targets count
+ * from the branch
+ */
+struct bytecode_instruction
+{
+    const void *handler;
+    uint32_t dst;
+    uint32_t a;
+    union
+    {
+        struct
+        {
+            uint32_t b;
+            uint32_t c;
+        };
+        long long constant;
+    };
+};
+
+struct bytecode_function
+{
+    const char *name;
+    struct bytecode_instruction *code;
+    uint32_t code_count;
+    // arguments go to the registers right after register 0
+    uint32_t parameter_count;
+    // registers and stack allocations in 8 byte words
+    uint32_t frame_words;
+};
+
+/**
+ * A module translated for the interpreter. The address of a function is its
+ * struct bytecode_function, the globals live in memory of their own
+ */
+struct bytecode_program
+{
+    struct bytecode_function *functions;
+    int function_count;
+    // function name to struct bytecode_function *
+    struct hashmap *indexes;
+    // data of every global, freed with the program
+    void **globals;
+    int global_count;
+    // functions of the C library the program calls directly
+    void **natives;
+    int native_count;
+    int native_capacity;
+    // frames of the functions being run
+    long long *stack;
+    long long *stack_end;
+};
+
+/**
+ * What a process that compiles many files keeps from one compile to the next,
+ * NULL unless compiler_cache_enable was called. The compile server turns it on
+ */
+struct compiler_cache
+{
+    // identifiers of every file compiled so far, the cached tokens point into it
+    struct intern_table *identifiers;
+    // absolute path -> struct compiler_cache_header*
+    struct hashmap *headers;
+    // include lookup key -> struct compiler_cache_include*
+    struct hashmap *includes;
+};
+
+extern struct compiler_cache *compiler_cache;
+
+// runs one command line in the server, the same thing main does with it
+typedef int (*SERVER_COMMAND)(int argc, char **argv);
+
+enum
+{
+    // server_forward found no server that would run the command line
+    SERVER_NOT_SERVED = -1
+};
+
+/**
+ * Direct calls between the functions of a module, indexes follow module->functions
+ */
+struct inline_graph
+{
+    struct ir_module *module;
+    struct ir_function **functions;
+    int count;
+    // function name to index + 1
+    struct hashmap *indexes;
+    // callees before their callers, the functions of a cycle next to each other
+    int *order;
+    // the function can call itself, directly or through others
+    bool *recursive;
+    // the address is used for something other than a direct call
+    bool *address_taken;
+    // direct calls to each function
+    uint32_t *calls;
+    // instructions of each function once it is optimized, 0 before
+    uint32_t *sizes;
+};
+
+/**
+ * A natural loop, the header and the blocks that reach one of its back edges
+ * without going through the header
+ */
+struct loop
+{
+    uint32_t header;
+    // the only block outside the loop that goes to the header, when that block goes nowhere else
+    uint32_t preheader;
+    // source of the back edge when there is only one
+    uint32_t latch;
+    // in index order
+    uint32_t *blocks;
+    uint32_t block_count;
+    // innermost loop around this one, -1 for outermost loops
+    int parent;
+};
+
+struct loop_nest
+{
+    struct ir_function *function;
+    // inner loops come before the loops around them
+    struct loop *loops;
+    int count;
+    // innermost loop of each block, -1 outside of loops
+    int *innermost;
+    // reverse postorder of the blocks, a block comes after its dominators
+    uint32_t *order;
+    uint32_t order_count;
+};
+
 int compile_file(const char *filename, const char *out_filename, int flags);
+int compile_file_with_dependencies(const char *filename, const char *out_filename, int flags, struct vector *dependencies);
+struct jit *compile_to_memory(const char *filename, int flags);
+struct bytecode_program *compile_to_bytecode(const char *filename, int flags);
 struct compile_process *compile_process_create(const char *filename, const char *filename_out, int flags);
+struct compile_process *compile_process_create_for_include(const char *filename, struct compile_process *parent);
+struct compile_process *compile_process_create_for_tokens(const char *filename, struct compile_process *parent);
 
 char compile_process_next_char(struct lex_process *lex_process);
 char compile_process_peek_char(struct lex_process *lex_process);
 void compile_process_push_char(struct lex_process *lex_process, char c);
+struct buffer *compile_process_source(struct lex_process *lex_process);
+int compile_process_matching_bracket(struct compile_process *process, int index);
 
 void compiler_error(struct compile_process *process, const char *msg, ...);
 
@@ -160,6 +1197,171 @@ void *lex_process_private(struct lex_process *process);
 
 struct vector *lex_process_tokens(struct lex_process *process);
 int lex(struct lex_process *process);
+struct token *lex_next_token(struct lex_process *process);
+bool lex_skip_inactive_region(struct lex_process *process);
+struct vector *tokens_build_for_string(struct compile_process *compiler, const char *str);
+
+extern struct lex_precess_functions compiler_lex_functions;
+
+struct lex_pipeline;
+struct lex_pipeline *lex_pipeline_create(struct compile_process *compiler, bool follow_branches);
+struct token *lex_pipeline_next(struct lex_pipeline *pipeline);
+void lex_pipeline_branch(struct lex_pipeline *pipeline, bool skipped);
+void lex_pipeline_free(struct lex_pipeline *pipeline);
+
+struct node_pool *node_pool_create();
+struct node_pool *node_pool_create_local();
+void node_pool_free(struct node_pool *pool);
+uint32_t node_pool_extend(struct node_pool *pool, uint32_t nodes, uint32_t datatypes, uint32_t *first_datatype);
+void node_pool_move(struct node_pool *pool, uint32_t first, uint32_t first_datatype, struct node_pool *other);
+uint32_t node_create(struct node_pool *pool, int type, struct pos *pos);
+struct node *node_at(struct node_pool *pool, uint32_t index);
+uint32_t node_datatype_create(struct node_pool *pool, struct datatype *datatype);
+struct datatype *node_datatype_at(struct node_pool *pool, uint32_t index);
+void node_list_append(struct node_pool *pool, struct node_list *list, uint32_t index);
+void node_pool_truncate(struct node_pool *pool, uint32_t count, uint32_t datatype_count);
+struct parser *parser_create(struct compile_process *process);
+uint32_t parser_parse(struct parser *parser);
+uint32_t parser_release(struct parser *parser);
+void parser_free(struct parser *parser);
+int parse(struct compile_process *process);
+
+struct symbol_table *symbol_table_create();
+void symbol_table_free(struct symbol_table *table);
+void symbol_table_enter_scope(struct symbol_table *table);
+void symbol_table_leave_scope(struct symbol_table *table);
+int symbol_table_depth(struct symbol_table *table);
+uint32_t symbol_table_declare(struct symbol_table *table, const char *name, uint32_t node);
+uint32_t symbol_table_lookup(struct symbol_table *table, const char *name);
+struct resolver *resolver_create(struct compile_process *process);
+void resolver_resolve(struct resolver *resolver, uint32_t tree);
+void resolver_release(struct resolver *resolver, uint32_t first);
+void resolver_free(struct resolver *resolver);
+int resolve(struct compile_process *process);
+
+struct type_table *type_table_create();
+void type_table_free(struct type_table *table);
+void type_table_release(struct type_table *table, uint32_t first);
+struct type *type_get_basic(struct type_table *table, int kind, int flags);
+struct type *type_get_pointer(struct type_table *table, struct type *base);
+struct type *type_get_array(struct type_table *table, struct type *base, long length);
+struct type *type_get_function(struct type_table *table, struct type *return_type, struct type **params, int total, bool variadic);
+struct type *type_get_struct(struct type_table *table, int kind, uint32_t struct_node, const char *tag);
+void type_complete_struct(struct type *type, struct type_member *members, int total);
+struct type_member *type_find_member(struct type *type, const char *name);
+bool type_is_integer(struct type *type);
+bool type_is_arithmetic(struct type *type);
+bool type_is_scalar(struct type *type);
+bool type_is_unsigned(struct type *type);
+struct type *type_promote(struct type_table *table, struct type *type);
+struct type *type_common(struct type_table *table, struct type *type, struct type *other);
+struct type *type_decay(struct type_table *table, struct type *type);
+
+struct ir_module *ir_module_create();
+void ir_module_free(struct ir_module *module);
+void ir_module_remove_function(struct ir_module *module, int index);
+struct ir_function *ir_function_create(struct ir_module *module, const char *name);
+struct ir_global *ir_global_create(struct ir_module *module, const char *name, long size, int align);
+uint32_t ir_block_create(struct ir_function *function);
+struct ir_instruction *ir_at(struct ir_function *function, uint32_t index);
+uint32_t ir_append(struct ir_function *function, uint32_t block, int op, int type, uint32_t operand_count);
+uint32_t ir_insert_before(struct ir_function *function, uint32_t before, int op, int type, uint32_t operand_count);
+uint32_t ir_operand(struct ir_function *function, uint32_t index, uint32_t operand);
+void ir_set_operand(struct ir_function *function, uint32_t index, uint32_t operand, uint32_t value);
+void ir_replace_uses(struct ir_function *function, uint32_t value, uint32_t replacement);
+void ir_remove(struct ir_function *function, uint32_t index);
+void ir_move_before(struct ir_function *function, uint32_t index, uint32_t before);
+bool ir_is_terminator(int op);
+int ir_type_size(int type);
+void ir_compute_predecessors(struct ir_function *function);
+void ir_remove_unreachable_blocks(struct ir_function *function);
+void ir_remove_edge(struct ir_function *function, uint32_t from, uint32_t to);
+void ir_branch_to_jump(struct ir_function *function, uint32_t block, int successor);
+void ir_dump(struct ir_module *module, FILE *out);
+struct ir_builder *ir_builder_create(struct compile_process *process);
+struct ir_module *ir_builder_build(struct ir_builder *builder, uint32_t tree);
+struct ir_module *ir_builder_finish(struct ir_builder *builder);
+void ir_builder_release(struct ir_builder *builder, uint32_t first);
+void ir_builder_free(struct ir_builder *builder);
+int ir_build(struct compile_process *process);
+void ssa_construct(struct ir_function *function);
+void ssa_compute_dominators(struct ir_function *function);
+void ssa_loop_depths(struct ir_function *function, uint32_t *depths);
+int optimize(struct compile_process *process);
+bool optimize_fold(int op, int type, int operand_type, long long a, long long b, long long *result);
+uint32_t optimize_const(struct ir_function *function, int type, long long value);
+bool optimize_constant_of(struct ir_function *function, uint32_t value, long long *constant);
+struct inline_graph *inline_graph_create(struct ir_module *module);
+void inline_graph_free(struct inline_graph *graph);
+uint32_t inline_size(struct ir_function *function);
+void inline_calls(struct inline_graph *graph, int index);
+void inline_tail_recursion(struct ir_function *function);
+void inline_remove_unused(struct inline_graph *graph);
+struct loop_nest *loop_nest_create(struct ir_function *function);
+void loop_nest_free(struct loop_nest *nest);
+bool loop_contains(struct loop_nest *nest, int loop, uint32_t block);
+bool loop_unroll(struct ir_function *function);
+bool loop_hoist_invariants(struct ir_function *function);
+bool loop_reduce_strength(struct ir_function *function);
+struct regalloc *regalloc_run(struct ir_function *function, bool spill_all);
+void regalloc_free(struct regalloc *regalloc);
+struct live_interval *regalloc_interval_at(struct regalloc *regalloc, uint32_t value, uint32_t position);
+bool regalloc_is_rematerialized(struct ir_function *function, uint32_t value);
+struct codegen *codegen_create(struct compile_process *process);
+int codegen_module(struct codegen *codegen, struct ir_module *module);
+int codegen_finish(struct codegen *codegen, int res);
+int codegen(struct compile_process *process);
+struct peephole *peephole_create();
+void peephole_free(struct peephole *peephole);
+void peephole_add(struct peephole *peephole, const char *line);
+void peephole_label(struct peephole *peephole, const char *name);
+void peephole_run(struct peephole *peephole);
+void peephole_write(struct peephole *peephole, FILE *out);
+void peephole_report(struct peephole *peephole, FILE *out);
+void peephole_clear(struct peephole *peephole);
+bool x86_assemble(struct peephole *peephole, struct elf_object *object);
+struct elf_object *elf_object_create();
+void elf_object_free(struct elf_object *object);
+uint64_t elf_append(struct elf_object *object, int section, const void *data, uint64_t size);
+void elf_align(struct elf_object *object, int section, uint64_t align);
+uint32_t elf_symbol(struct elf_object *object, const char *name, size_t length);
+void elf_define(struct elf_object *object, uint32_t symbol, int section, uint64_t value, uint64_t size, bool is_local, bool is_function);
+void elf_relocate(struct elf_object *object, int section, uint64_t offset, uint32_t symbol, int type, long long addend);
+bool elf_write(struct elf_object *object, FILE *out);
+struct jit *jit_load(struct elf_object *object);
+void *jit_symbol(struct jit *jit, const char *name);
+void jit_free(struct jit *jit);
+struct bytecode_program *bytecode_create(struct ir_module *module);
+struct bytecode_function *bytecode_find(struct bytecode_program *program, const char *name);
+long long bytecode_call(struct bytecode_program *program, struct bytecode_function *function, long long *arguments, int count);
+void bytecode_free(struct bytecode_program *program);
+void compiler_cache_enable();
+struct vector *compiler_cache_header(const char *path);
+void compiler_cache_set_header(const char *path, struct vector *tokens);
+bool compiler_cache_include(const char *key, const char **path_out);
+void compiler_cache_set_include(const char *key, const char *path, struct vector *candidates);
+const char *server_default_socket();
+int server_run(const char *socket_path, int workers, SERVER_COMMAND command);
+int server_forward(const char *socket_path, int argc, char **argv);
+char *incremental_path_with_extension(const char *path, const char *extension);
+bool depfile_write(const char *path, const char *target, struct vector *dependencies);
+int incremental_build(const char *state_path, char **inputs, int count, int flags, bool depfiles);
+
+struct preprocessor *preprocessor_create(struct compile_process *compiler);
+void preprocessor_start(struct compile_process *compiler, struct lex_process *lex_process, struct lex_pipeline *pipeline);
+bool preprocessor_next_declaration(struct compile_process *compiler);
+int preprocessor_run(struct compile_process *compiler, struct lex_process *lex_process, struct lex_pipeline *pipeline);
+
 bool tocken_if_keyword(struct token *token, const char *value);
+bool token_is_identifier(struct token *token, const char *value);
+bool token_is_symbol(struct token *token, char c);
+bool token_is_operator(struct token *token, const char *value);
+bool token_is_op(struct token *token, int op);
+bool token_is_nl_or_comment(struct token *token);
+char token_closing_bracket(struct token *token);
+const char *token_op_spelling(int op);
+int token_symbol_op(char c);
+bool token_is_closing_bracket(struct token *token);
+void token_write_spelling(struct buffer *buffer, struct token *token);
 static struct token *token_make_string(char start_delim, char end_delim);
 #endif
\ No newline at end of file
@@ -1,7 +1,47 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <assert.h>
 #include "compiler.h"
-struct compile_process *compile_process_create(const char *filename, const char *filename_out, int flags)
+#include "helpers/buffer.h"
+#include "helpers/vector.h"
+#include "helpers/intern.h"
+#include "helpers/utf8.h"
+
+/**
+ * Sources are UTF-8, checked once up front so the lexer can trust every byte it reads.
+ * No valid byte is 0xff so a char of -1 is always the end of the input
+ */
+static void compile_process_validate(struct compile_process *process)
+{
+    struct buffer *source = process->cfile.buffer;
+    const char *data = buffer_ptr(source);
+    size_t invalid = utf8_validate(data, source->len);
+    if (invalid != source->len)
+    {
+        for (size_t i = 0; i < invalid; i++)
+        {
+            process->pos.col++;
+            if (data[i] == '\n')
+            {
+                process->pos.line++;
+                process->pos.col = 1;
+            }
+        }
+        compiler_error(process, "Invalid UTF-8 byte 0x%02x\n", (unsigned char)data[invalid]);
+    }
+
+    // the pages go again until the lexer gets to them
+    buffer_release_all(source);
+
+    // a byte order mark says nothing C needs
+    if (source->len >= 3 && memcmp(data, "\xef\xbb\xbf", 3) == 0)
+    {
+        source->rindex = 3;
+    }
+}
+
+static struct compile_process *compile_process_open(const char *filename, FILE *out_file, int flags)
 {
     FILE *file = fopen(filename, "r");
     if (!file)
@@ -9,6 +49,31 @@ struct compile_process *compile_process_create(const char *filename, const char
         return NULL;
     }
 
+    // the whole source is kept in memory so the lexer can scan it directly, streamed
+    // files are mapped instead so the part already compiled can be let go
+    struct buffer *source = flags & COMPILE_PROCESS_FLAG_STREAM ? buffer_map(file) : NULL;
+    if (!source)
+    {
+        source = buffer_create();
+        buffer_fread(source, file);
+    }
+    fclose(file);
+
+    struct compile_process *process = calloc(1, sizeof(struct compile_process));
+    process->flags = flags;
+    process->cfile.buffer = source;
+    const char *abs_path = realpath(filename, NULL);
+    process->cfile.abs_path = abs_path ? abs_path : filename;
+    process->pos.filename = process->cfile.abs_path;
+    process->pos.line = 1;
+    process->pos.col = 1;
+    process->ofile = out_file;
+    compile_process_validate(process);
+    return process;
+}
+
+struct compile_process *compile_process_create(const char *filename, const char *filename_out, int flags)
+{
     FILE *out_file = NULL;
     if (filename_out)
     {
@@ -19,10 +84,45 @@ struct compile_process *compile_process_create(const char *filename, const char
         }
     }
 
+    struct compile_process *process = compile_process_open(filename, out_file, flags);
+    if (!process)
+    {
+        return NULL;
+    }
+    // with the cache on every file shares one table, so cached tokens stay valid
+    process->identifiers = compiler_cache ? compiler_cache->identifiers : intern_table_create();
+    process->dependencies = vector_create(sizeof(const char *));
+    vector_push(process->dependencies, &process->cfile.abs_path);
+    return process;
+}
+
+/**
+ * A process that only lexes an included file, it shares the includer's identifiers
+ */
+struct compile_process *compile_process_create_for_include(const char *filename, struct compile_process *parent)
+{
+    struct compile_process *process = compile_process_open(filename, NULL, parent->flags);
+    if (!process)
+    {
+        return NULL;
+    }
+    process->identifiers = parent->identifiers;
+    return process;
+}
+
+/**
+ * A process for an included file whose tokens come from the cache, nothing is
+ * read from the file. Its position follows the tokens so errors still point at the file
+ */
+struct compile_process *compile_process_create_for_tokens(const char *filename, struct compile_process *parent)
+{
     struct compile_process *process = calloc(1, sizeof(struct compile_process));
-    process->flags = flags;
-    process->cfile.fp = file;
-    process->ofile = out_file;
+    process->flags = parent->flags;
+    process->cfile.abs_path = filename;
+    process->pos.filename = filename;
+    process->pos.line = 1;
+    process->pos.col = 1;
+    process->identifiers = parent->identifiers;
     return process;
 }
 
@@ -30,7 +130,7 @@ char compile_process_next_char(struct lex_process *lex_process)
 {
     struct compile_process *compiler = lex_process->compiler;
     compiler->pos.col++;
-    char c = getc(compiler->cfile.fp);
+    char c = buffer_read(compiler->cfile.buffer);
     if (c == '\n')
     {
         compiler->pos.line++;
@@ -42,13 +142,30 @@ char compile_process_next_char(struct lex_process *lex_process)
 char compile_process_peek_char(struct lex_process *lex_process)
 {
     struct compile_process *compiler = lex_process->compiler;
-    char c = getc(compiler->cfile.fp);
-    ungetc(c, compiler->cfile.fp);
-    return c;
+    return buffer_peek(compiler->cfile.buffer);
 }
 
 void compile_process_push_char(struct lex_process *lex_process, char c)
 {
     struct compile_process *compiler = lex_process->compiler;
-    ungetc(c, compiler->cfile.fp);
+    struct buffer *source = compiler->cfile.buffer;
+    // only characters that were just read can be pushed back
+    assert(source->rindex > 0 && source->data[source->rindex - 1] == c);
+    source->rindex--;
+    compiler->pos.col--;
+}
+
+struct buffer *compile_process_source(struct lex_process *lex_process)
+{
+    return lex_process->compiler->cfile.buffer;
+}
+
+/**
+ * Returns the index of the bracket closing the ( [ or { at the given index in
+ * token_vec, -1 if that token is not an opening bracket
+ */
+int compile_process_matching_bracket(struct compile_process *process, int index)
+{
+    int *match = vector_peek_at(process->token_bracket_matches, index);
+    return match ? *match : -1;
 }
@@ -0,0 +1,403 @@
+#include "compiler.h"
+#include "helpers/vector.h"
+#include "helpers/hashmap.h"
+#include "helpers/buffer.h"
+#include <elf.h>
+#include <stdlib.h>
+
+/**
+ * ELF64 relocatable objects for x86-64. The code generator fills the sections
+ * and names the symbols it refers to, elf_write lays the file out the way the
+ * GNU assembler does so the system linker takes it as is
+ */
+
+// sections of the file in the order of their headers, the first ELF_SECTION_COUNT
+// after the null section follow the ELF_SECTION_* numbering
+enum
+{
+    ELF_HEADER_NULL,
+    ELF_HEADER_TEXT,
+    ELF_HEADER_DATA,
+    ELF_HEADER_BSS,
+    ELF_HEADER_RODATA,
+    ELF_HEADER_RELA_TEXT,
+    ELF_HEADER_RELA_DATA,
+    ELF_HEADER_RELA_RODATA,
+    ELF_HEADER_NOTE,
+    ELF_HEADER_SYMTAB,
+    ELF_HEADER_STRTAB,
+    ELF_HEADER_SHSTRTAB,
+    ELF_HEADER_COUNT
+};
+
+static const char *elf_section_names[ELF_HEADER_COUNT] = {
+    [ELF_HEADER_NULL] = "",
+    [ELF_HEADER_TEXT] = ".text",
+    [ELF_HEADER_DATA] = ".data",
+    [ELF_HEADER_BSS] = ".bss",
+    [ELF_HEADER_RODATA] = ".rodata",
+    [ELF_HEADER_RELA_TEXT] = ".rela.text",
+    [ELF_HEADER_RELA_DATA] = ".rela.data",
+    [ELF_HEADER_RELA_RODATA] = ".rela.rodata",
+    [ELF_HEADER_NOTE] = ".note.GNU-stack",
+    [ELF_HEADER_SYMTAB] = ".symtab",
+    [ELF_HEADER_STRTAB] = ".strtab",
+    [ELF_HEADER_SHSTRTAB] = ".shstrtab"};
+
+struct elf_object *elf_object_create()
+{
+    struct elf_object *object = calloc(1, sizeof(struct elf_object));
+    for (int i = 0; i < ELF_SECTION_COUNT; i++)
+    {
+        object->sections[i].align = 1;
+    }
+    object->sections[ELF_SECTION_TEXT].align = 16;
+    object->symbols = vector_create(sizeof(struct elf_symbol));
+    object->indexes = hashmap_create();
+    object->relocations = vector_create(sizeof(struct elf_relocation));
+    return object;
+}
+
+void elf_object_free(struct elf_object *object)
+{
+    for (int i = 0; i < ELF_SECTION_COUNT; i++)
+    {
+        free(object->sections[i].data);
+    }
+
+    struct elf_symbol *symbols = vector_data_ptr(object->symbols);
+    for (int i = 0; i < vector_count(object->symbols); i++)
+    {
+        free((char *)symbols[i].name);
+    }
+    vector_free(object->symbols);
+    hashmap_free(object->indexes);
+    vector_free(object->relocations);
+    free(object);
+}
+
+/**
+ * Adds the bytes to the end of the section and returns where they start,
+ * NULL data adds zeros. Nothing is stored for .bss
+ */
+uint64_t elf_append(struct elf_object *object, int section, const void *data, uint64_t size)
+{
+    struct elf_section *target = &object->sections[section];
+    uint64_t offset = target->size;
+    target->size += size;
+    if (section == ELF_SECTION_BSS)
+    {
+        return offset;
+    }
+
+    if (target->size > target->capacity)
+    {
+        target->capacity = target->capacity ? target->capacity : 256;
+        while (target->capacity < target->size)
+        {
+            target->capacity *= 2;
+        }
+        target->data = realloc(target->data, target->capacity);
+    }
+
+    if (data)
+    {
+        memcpy(target->data + offset, data, size);
+    }
+    else
+    {
+        memset(target->data + offset, 0, size);
+    }
+    return offset;
+}
+
+void elf_align(struct elf_object *object, int section, uint64_t align)
+{
+    struct elf_section *target = &object->sections[section];
+    if (align > target->align)
+    {
+        target->align = align;
+    }
+
+    uint64_t padding = (align - target->size % align) % align;
+    elf_append(object, section, NULL, padding);
+}
+
+/**
+ * Index of the symbol with this name, a symbol nobody defines stays undefined
+ * and is resolved by the linker
+ */
+uint32_t elf_symbol(struct elf_object *object, const char *name, size_t length)
+{
+    // most names are short and already known, only new ones are copied to the heap
+    char buffer[128];
+    char *key = length < sizeof(buffer) ? buffer : malloc(length + 1);
+    memcpy(key, name, length);
+    key[length] = 0;
+
+    void *index = hashmap_get(object->indexes, key);
+    if (index)
+    {
+        if (key != buffer)
+        {
+            free(key);
+        }
+        return (uint32_t)(uintptr_t)index - 1;
+    }
+
+    if (key == buffer)
+    {
+        key = malloc(length + 1);
+        memcpy(key, buffer, length + 1);
+    }
+    struct elf_symbol symbol = {.name = key, .section = -1};
+    vector_push(object->symbols, &symbol);
+    uint32_t count = vector_count(object->symbols);
+    hashmap_set(object->indexes, key, (void *)(uintptr_t)count);
+    return count - 1;
+}
+
+void elf_define(struct elf_object *object, uint32_t symbol, int section, uint64_t value, uint64_t size, bool is_local, bool is_function)
+{
+    struct elf_symbol *target = vector_at(object->symbols, symbol);
+    target->section = section;
+    target->value = value;
+    target->size = size;
+    target->is_local = is_local;
+    target->is_function = is_function;
+}
+
+void elf_relocate(struct elf_object *object, int section, uint64_t offset, uint32_t symbol, int type, long long addend)
+{
+    struct elf_relocation relocation = {.section = section, .offset = offset, .symbol = symbol, .type = type, .addend = addend};
+    vector_push(object->relocations, &relocation);
+}
+
+static void elf_write_padding(FILE *out, uint64_t *position, uint64_t align)
+{
+    static const uint8_t zeros[16];
+    uint64_t padding = (align - *position % align) % align;
+    fwrite(zeros, 1, padding, out);
+    *position += padding;
+}
+
+static uint32_t elf_string(struct buffer *strings, const char *name)
+{
+    uint32_t offset = strings->len;
+    for (const char *c = name; *c; c++)
+    {
+        buffer_write(strings, *c);
+    }
+    buffer_write(strings, 0);
+    return offset;
+}
+
+// .L names are the assembler's local labels, they never make it into the symbol table
+static bool elf_is_hidden(struct elf_symbol *symbol)
+{
+    return symbol->section >= 0 && symbol->is_local && !strncmp(symbol->name, ".L", 2);
+}
+
+/**
+ * Writes the object file. Local symbols come first as the format wants, the
+ * symbol table is reordered and the relocations follow the new numbering.
+ * Like the assembler, pc relative references to a local symbol of the same
+ * section are filled in here and other references to local symbols go through
+ * the section symbol
+ */
+bool elf_write(struct elf_object *object, FILE *out)
+{
+    int symbol_count = vector_count(object->symbols);
+    struct elf_symbol *symbols = vector_data_ptr(object->symbols);
+    uint32_t *order = calloc(symbol_count + 1, sizeof(uint32_t));
+    // the section symbols come right after the null symbol
+    uint32_t next = 1 + ELF_SECTION_COUNT;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int i = 0; i < symbol_count; i++)
+        {
+            bool is_local = symbols[i].is_local && symbols[i].section >= 0;
+            if (is_local == (pass == 0) && !elf_is_hidden(&symbols[i]))
+            {
+                order[i] = next++;
+            }
+        }
+    }
+
+    struct buffer *strings = buffer_create();
+    buffer_write(strings, 0);
+    Elf64_Sym *table = calloc(next, sizeof(Elf64_Sym));
+    uint32_t first_global = 1 + ELF_SECTION_COUNT;
+    for (int section = 0; section < ELF_SECTION_COUNT; section++)
+    {
+        table[1 + section].st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+        table[1 + section].st_shndx = ELF_HEADER_TEXT + section;
+    }
+
+    for (int i = 0; i < symbol_count; i++)
+    {
+        if (!order[i])
+        {
+            continue;
+        }
+
+        Elf64_Sym *entry = &table[order[i]];
+        bool is_defined = symbols[i].section >= 0;
+        bool is_local = symbols[i].is_local && is_defined;
+        int type = !is_defined ? STT_NOTYPE : symbols[i].is_function ? STT_FUNC : STT_OBJECT;
+        entry->st_name = elf_string(strings, symbols[i].name);
+        entry->st_info = ELF64_ST_INFO(is_local ? STB_LOCAL : STB_GLOBAL, type);
+        entry->st_shndx = is_defined ? ELF_HEADER_TEXT + symbols[i].section : SHN_UNDEF;
+        entry->st_value = symbols[i].value;
+        entry->st_size = symbols[i].size;
+        first_global += is_local;
+    }
+
+    // relocations of each section in the order they were made
+    int relocation_count = vector_count(object->relocations);
+    struct elf_relocation *relocations = vector_data_ptr(object->relocations);
+    Elf64_Rela *rela = malloc(sizeof(Elf64_Rela) * (relocation_count + 1));
+    int rela_start[ELF_SECTION_COUNT + 1];
+    int rela_count = 0;
+    for (int section = 0; section < ELF_SECTION_COUNT; section++)
+    {
+        rela_start[section] = rela_count;
+        for (int i = 0; i < relocation_count; i++)
+        {
+            if (relocations[i].section != section)
+            {
+                continue;
+            }
+
+            struct elf_symbol *symbol = &symbols[relocations[i].symbol];
+            bool is_local = symbol->is_local && symbol->section >= 0;
+            bool is_pc_relative = relocations[i].type == R_X86_64_PC32 || relocations[i].type == R_X86_64_PLT32;
+            if (is_local && is_pc_relative && symbol->section == section)
+            {
+                int32_t displacement = symbol->value + relocations[i].addend - relocations[i].offset;
+                memcpy(object->sections[section].data + relocations[i].offset, &displacement, 4);
+                continue;
+            }
+
+            Elf64_Rela *entry = &rela[rela_count++];
+            entry->r_offset = relocations[i].offset;
+            entry->r_addend = relocations[i].addend;
+            if (is_local)
+            {
+                entry->r_info = ELF64_R_INFO(1 + symbol->section, relocations[i].type);
+                entry->r_addend += symbol->value;
+                continue;
+            }
+            entry->r_info = ELF64_R_INFO(order[relocations[i].symbol], relocations[i].type);
+        }
+    }
+    rela_start[ELF_SECTION_COUNT] = rela_count;
+
+    struct buffer *names = buffer_create();
+    Elf64_Shdr headers[ELF_HEADER_COUNT] = {0};
+    for (int i = 0; i < ELF_HEADER_COUNT; i++)
+    {
+        headers[i].sh_name = elf_string(names, elf_section_names[i]);
+        headers[i].sh_addralign = 1;
+    }
+
+    static const int section_flags[ELF_SECTION_COUNT] = {
+        [ELF_SECTION_TEXT] = SHF_ALLOC | SHF_EXECINSTR,
+        [ELF_SECTION_DATA] = SHF_ALLOC | SHF_WRITE,
+        [ELF_SECTION_BSS] = SHF_ALLOC | SHF_WRITE,
+        [ELF_SECTION_RODATA] = SHF_ALLOC};
+    for (int section = 0; section < ELF_SECTION_COUNT; section++)
+    {
+        Elf64_Shdr *header = &headers[ELF_HEADER_TEXT + section];
+        header->sh_type = section == ELF_SECTION_BSS ? SHT_NOBITS : SHT_PROGBITS;
+        header->sh_flags = section_flags[section];
+        header->sh_size = object->sections[section].size;
+        header->sh_addralign = object->sections[section].align;
+    }
+
+    // .bss has no relocations, the other three get theirs in the same order
+    static const int rela_sections[] = {ELF_SECTION_TEXT, ELF_SECTION_DATA, ELF_SECTION_RODATA};
+    for (int i = 0; i < 3; i++)
+    {
+        int section = rela_sections[i];
+        Elf64_Shdr *header = &headers[ELF_HEADER_RELA_TEXT + i];
+        header->sh_type = SHT_RELA;
+        header->sh_flags = SHF_INFO_LINK;
+        header->sh_size = sizeof(Elf64_Rela) * (rela_start[section + 1] - rela_start[section]);
+        header->sh_link = ELF_HEADER_SYMTAB;
+        header->sh_info = ELF_HEADER_TEXT + section;
+        header->sh_addralign = 8;
+        header->sh_entsize = sizeof(Elf64_Rela);
+    }
+
+    headers[ELF_HEADER_NOTE].sh_type = SHT_PROGBITS;
+    headers[ELF_HEADER_SYMTAB].sh_type = SHT_SYMTAB;
+    headers[ELF_HEADER_SYMTAB].sh_size = sizeof(Elf64_Sym) * next;
+    headers[ELF_HEADER_SYMTAB].sh_link = ELF_HEADER_STRTAB;
+    headers[ELF_HEADER_SYMTAB].sh_info = first_global;
+    headers[ELF_HEADER_SYMTAB].sh_addralign = 8;
+    headers[ELF_HEADER_SYMTAB].sh_entsize = sizeof(Elf64_Sym);
+    headers[ELF_HEADER_STRTAB].sh_type = SHT_STRTAB;
+    headers[ELF_HEADER_STRTAB].sh_size = strings->len;
+    headers[ELF_HEADER_SHSTRTAB].sh_type = SHT_STRTAB;
+    headers[ELF_HEADER_SHSTRTAB].sh_size = names->len;
+
+    // contents follow the file header in section order, the section headers come last
+    const void *contents[ELF_HEADER_COUNT] = {
+        [ELF_HEADER_TEXT] = object->sections[ELF_SECTION_TEXT].data,
+        [ELF_HEADER_DATA] = object->sections[ELF_SECTION_DATA].data,
+        [ELF_HEADER_RODATA] = object->sections[ELF_SECTION_RODATA].data,
+        [ELF_HEADER_RELA_TEXT] = rela + rela_start[ELF_SECTION_TEXT],
+        [ELF_HEADER_RELA_DATA] = rela + rela_start[ELF_SECTION_DATA],
+        [ELF_HEADER_RELA_RODATA] = rela + rela_start[ELF_SECTION_RODATA],
+        [ELF_HEADER_SYMTAB] = table,
+        [ELF_HEADER_STRTAB] = strings->data,
+        [ELF_HEADER_SHSTRTAB] = names->data};
+
+    Elf64_Ehdr file = {0};
+    memcpy(file.e_ident, ELFMAG, SELFMAG);
+    file.e_ident[EI_CLASS] = ELFCLASS64;
+    file.e_ident[EI_DATA] = ELFDATA2LSB;
+    file.e_ident[EI_VERSION] = EV_CURRENT;
+    file.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    file.e_type = ET_REL;
+    file.e_machine = EM_X86_64;
+    file.e_version = EV_CURRENT;
+    file.e_ehsize = sizeof(Elf64_Ehdr);
+    file.e_shentsize = sizeof(Elf64_Shdr);
+    file.e_shnum = ELF_HEADER_COUNT;
+    file.e_shstrndx = ELF_HEADER_SHSTRTAB;
+
+    uint64_t position = sizeof(Elf64_Ehdr);
+    for (int i = 1; i < ELF_HEADER_COUNT; i++)
+    {
+        position += (headers[i].sh_addralign - position % headers[i].sh_addralign) % headers[i].sh_addralign;
+        headers[i].sh_offset = position;
+        if (headers[i].sh_type != SHT_NOBITS)
+        {
+            position += headers[i].sh_size;
+        }
+    }
+    file.e_shoff = position + (8 - position % 8) % 8;
+
+    fwrite(&file, sizeof(file), 1, out);
+    position = sizeof(Elf64_Ehdr);
+    for (int i = 1; i < ELF_HEADER_COUNT; i++)
+    {
+        elf_write_padding(out, &position, headers[i].sh_addralign);
+        if (headers[i].sh_type != SHT_NOBITS && headers[i].sh_size)
+        {
+            fwrite(contents[i], 1, headers[i].sh_size, out);
+            position += headers[i].sh_size;
+        }
+    }
+    elf_write_padding(out, &position, 8);
+    fwrite(headers, sizeof(Elf64_Shdr), ELF_HEADER_COUNT, out);
+
+    buffer_free(strings);
+    buffer_free(names);
+    free(table);
+    free(rela);
+    free(order);
+    return !ferror(out);
+}
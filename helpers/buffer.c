@@ -2,6 +2,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 struct buffer* buffer_create()
 {
@@ -22,7 +26,9 @@ void buffer_need(struct buffer* buffer, size_t size)
 {
     if (buffer->msize <= (buffer->len+size))
     {
-        size += BUFFER_REALLOC_AMOUNT;
+        // grow by half the buffer at least so reading a large file doesn't
+        // copy it over and over
+        size += buffer->msize / 2 > BUFFER_REALLOC_AMOUNT ? buffer->msize / 2 : BUFFER_REALLOC_AMOUNT;
         buffer_extend(buffer, size);
     }
 }
@@ -32,10 +38,10 @@ void buffer_printf(struct buffer* buffer, const char* fmt, ...)
 {
     va_list args;
     va_start(args, fmt);
-    int index = buffer->len;
+    size_t index = buffer->len;
     // Temporary, this is a limitation we are guessing the size is no more than 2048
     int len = 2048;
-    buffer_extend(buffer, len);
+    buffer_need(buffer, len);
     int actual_len = vsnprintf(&buffer->data[index], len, fmt, args);
     buffer->len += actual_len;
     va_end(args);
@@ -45,10 +51,10 @@ void buffer_printf_no_terminator(struct buffer* buffer, const char* fmt, ...)
 {
     va_list args;
     va_start(args, fmt);
-    int index = buffer->len;
+    size_t index = buffer->len;
     // Temporary, this is a limitation we are guessing the size is no more than 2048
     int len = 2048;
-    buffer_extend(buffer, len);
+    buffer_need(buffer, len);
     int actual_len = vsnprintf(&buffer->data[index], len, fmt, args);
     buffer->len += actual_len-1;
     va_end(args);
@@ -62,6 +68,75 @@ void buffer_write(struct buffer* buffer, char c)
     buffer->len++;
 }
 
+void buffer_write_bytes(struct buffer* buffer, const char* bytes, size_t size)
+{
+    buffer_need(buffer, size);
+    memcpy(buffer->data + buffer->len, bytes, size);
+    buffer->len += size;
+}
+
+size_t buffer_fread(struct buffer* buffer, FILE* fp)
+{
+    size_t total = 0;
+    size_t amount = 0;
+    do
+    {
+        buffer_need(buffer, BUFFER_REALLOC_AMOUNT);
+        amount = fread(&buffer->data[buffer->len], 1, buffer->msize - buffer->len, fp);
+        buffer->len += amount;
+        total += amount;
+    } while (amount);
+    return total;
+}
+
+struct buffer* buffer_map(FILE* fp)
+{
+    struct stat info;
+    if (fstat(fileno(fp), &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0)
+    {
+        return NULL;
+    }
+
+    void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    if (data == MAP_FAILED)
+    {
+        return NULL;
+    }
+    madvise(data, info.st_size, MADV_SEQUENTIAL);
+
+    struct buffer* buf = calloc(sizeof(struct buffer), 1);
+    buf->data = data;
+    buf->len = info.st_size;
+    buf->msize = info.st_size;
+    buf->mapped = true;
+    return buf;
+}
+
+void buffer_release_read(struct buffer* buffer)
+{
+    if (!buffer->mapped)
+    {
+        return;
+    }
+
+    // whole pages only, the one being read stays
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t end = buffer->rindex / page * page;
+    if (end > buffer->released)
+    {
+        madvise(buffer->data + buffer->released, end - buffer->released, MADV_DONTNEED);
+        buffer->released = end;
+    }
+}
+
+void buffer_release_all(struct buffer* buffer)
+{
+    if (buffer->mapped)
+    {
+        madvise(buffer->data, buffer->len, MADV_DONTNEED);
+    }
+}
+
 void* buffer_ptr(struct buffer* buffer)
 {
     return buffer->data;
@@ -90,6 +165,12 @@ char buffer_peek(struct buffer* buffer)
 
 void buffer_free(struct buffer* buffer)
 {
+    if (buffer->mapped)
+    {
+        munmap(buffer->data, buffer->msize);
+        free(buffer);
+        return;
+    }
     free(buffer->data);
     free(buffer);
 }
@@ -1,17 +1,23 @@
 #ifndef BUFFER_H
 #define BUFFER_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <stdio.h>
 
 #define BUFFER_REALLOC_AMOUNT 2000
 struct buffer
 {
     char* data;
     // Read index
-    int rindex;
-    int len;
-    int msize;
+    size_t rindex;
+    size_t len;
+    size_t msize;
+    // the data is a read only mapping of a file, see buffer_map
+    bool mapped;
+    // bytes at the start of a mapped buffer whose memory was let go
+    size_t released;
 };
 
 struct buffer* buffer_create();
@@ -23,6 +29,26 @@ void buffer_extend(struct buffer* buffer, size_t size);
 void buffer_printf(struct buffer* buffer, const char* fmt, ...);
 void buffer_printf_no_terminator(struct buffer* buffer, const char* fmt, ...);
 void buffer_write(struct buffer* buffer, char c);
+void buffer_write_bytes(struct buffer* buffer, const char* bytes, size_t size);
+/**
+ * Appends everything left in the file to the buffer, returns the amount of bytes read
+ */
+size_t buffer_fread(struct buffer* buffer, FILE* fp);
+/**
+ * A read only buffer holding the whole file, the file is mapped into memory instead of
+ * read so its pages are only read as they are used and can be dropped again with
+ * buffer_release_read. Returns NULL if the file can't be mapped, like a pipe or an empty file
+ */
+struct buffer* buffer_map(FILE* fp);
+/**
+ * Lets the memory of the data before the read index go, a mapped buffer reads it
+ * from the file again should it be needed
+ */
+void buffer_release_read(struct buffer* buffer);
+/**
+ * Lets the memory of all of a mapped buffer go, after a pass over the whole file
+ */
+void buffer_release_all(struct buffer* buffer);
 void* buffer_ptr(struct buffer* buffer);
 void buffer_free(struct buffer* buffer);
 
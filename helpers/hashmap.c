@@ -0,0 +1,120 @@
+#include "hashmap.h"
+#include <stdlib.h>
+#include <string.h>
+
+unsigned int hashmap_hash(const char* key)
+{
+    // FNV-1a
+    unsigned int hash = 2166136261u;
+    while (*key)
+    {
+        hash ^= (unsigned char)*key;
+        hash *= 16777619u;
+        key++;
+    }
+    return hash;
+}
+
+struct hashmap* hashmap_create()
+{
+    struct hashmap* map = calloc(1, sizeof(struct hashmap));
+    map->capacity = HASHMAP_INITIAL_CAPACITY;
+    map->entries = calloc(map->capacity, sizeof(struct hashmap_entry));
+    return map;
+}
+
+void hashmap_free(struct hashmap* map)
+{
+    for (size_t i = 0; i < map->capacity; i++)
+    {
+        free(map->entries[i].key);
+    }
+    free(map->entries);
+    free(map);
+}
+
+static struct hashmap_entry* hashmap_slot(struct hashmap* map, const char* key, unsigned int hash)
+{
+    size_t mask = map->capacity - 1;
+    size_t index = hash & mask;
+    while (map->entries[index].key)
+    {
+        struct hashmap_entry* entry = &map->entries[index];
+        if (entry->hash == hash && strcmp(entry->key, key) == 0)
+        {
+            return entry;
+        }
+        index = (index + 1) & mask;
+    }
+
+    // the free slot where this key would go
+    return &map->entries[index];
+}
+
+static void hashmap_grow(struct hashmap* map)
+{
+    struct hashmap_entry* old_entries = map->entries;
+    size_t old_capacity = map->capacity;
+    map->capacity *= 2;
+    map->entries = calloc(map->capacity, sizeof(struct hashmap_entry));
+    for (size_t i = 0; i < old_capacity; i++)
+    {
+        if (!old_entries[i].key)
+        {
+            continue;
+        }
+        struct hashmap_entry* slot = hashmap_slot(map, old_entries[i].key, old_entries[i].hash);
+        *slot = old_entries[i];
+    }
+    free(old_entries);
+}
+
+void hashmap_set(struct hashmap* map, const char* key, void* value)
+{
+    unsigned int hash = hashmap_hash(key);
+    struct hashmap_entry* entry = hashmap_slot(map, key, hash);
+    if (entry->key)
+    {
+        entry->value = value;
+        return;
+    }
+
+    // keep the load factor under 3/4 so probe sequences stay short
+    if ((map->count + 1) * 4 > map->capacity * 3)
+    {
+        hashmap_grow(map);
+        entry = hashmap_slot(map, key, hash);
+    }
+
+    entry->key = strdup(key);
+    entry->hash = hash;
+    entry->value = value;
+    map->count++;
+}
+
+bool hashmap_find(struct hashmap* map, const char* key, void** value_out)
+{
+    struct hashmap_entry* entry = hashmap_slot(map, key, hashmap_hash(key));
+    if (!entry->key)
+    {
+        return false;
+    }
+
+    if (value_out)
+    {
+        *value_out = entry->value;
+    }
+    return true;
+}
+
+void* hashmap_get(struct hashmap* map, const char* key)
+{
+    void* value = NULL;
+    hashmap_find(map, key, &value);
+    return value;
+}
+
+size_t hashmap_count(struct hashmap* map)
+{
+    return map->count;
+}
@@ -0,0 +1,52 @@
+#ifndef HASHMAP_H
+#define HASHMAP_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Starting amount of slots, must be a power of two
+#define HASHMAP_INITIAL_CAPACITY 64
+
+struct hashmap_entry
+{
+    // NULL when the slot is free, keys are owned by the hashmap
+    char* key;
+    unsigned int hash;
+    void* value;
+};
+
+/**
+ * Open addressing hashmap with linear probing keyed by strings.
+ * Entries can be overwritten but never removed, store NULL to "forget" a value.
+ */
+struct hashmap
+{
+    struct hashmap_entry* entries;
+    size_t capacity;
+    size_t count;
+};
+
+struct hashmap* hashmap_create();
+void hashmap_free(struct hashmap* map);
+
+unsigned int hashmap_hash(const char* key);
+
+/**
+ * Sets the value for the given key, the key is copied.
+ */
+void hashmap_set(struct hashmap* map, const char* key, void* value);
+
+/**
+ * Returns the value stored for the given key or NULL if there is none
+ */
+void* hashmap_get(struct hashmap* map, const char* key);
+
+/**
+ * Returns true if the key was ever set, value_out receives the value stored
+ * even if that value is NULL. value_out may be NULL.
+ */
+bool hashmap_find(struct hashmap* map, const char* key, void** value_out);
+
+size_t hashmap_count(struct hashmap* map);
+
+#endif
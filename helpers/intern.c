@@ -0,0 +1,143 @@
+#include "intern.h"
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned int intern_hash(const char* str, size_t length)
+{
+    // FNV-1a
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+struct intern_table* intern_table_create()
+{
+    struct intern_table* table = calloc(1, sizeof(struct intern_table));
+    table->capacity = INTERN_TABLE_INITIAL_CAPACITY;
+    table->entries = calloc(table->capacity, sizeof(struct intern_entry));
+    return table;
+}
+
+void intern_table_free(struct intern_table* table)
+{
+    struct intern_block* block = table->blocks;
+    while (block)
+    {
+        struct intern_block* next = block->next;
+        free(block);
+        block = next;
+    }
+    if (table->shared)
+    {
+        pthread_mutex_destroy(&table->lock);
+    }
+    free(table->entries);
+    free(table);
+}
+
+static const char* intern_copy(struct intern_table* table, const char* str, size_t length)
+{
+    struct intern_block* block = table->blocks;
+    if (!block || block->used + length + 1 > block->size)
+    {
+        size_t size = length + 1 > INTERN_BLOCK_SIZE ? length + 1 : INTERN_BLOCK_SIZE;
+        block = malloc(sizeof(struct intern_block) + size);
+        block->used = 0;
+        block->size = size;
+        block->next = table->blocks;
+        table->blocks = block;
+    }
+
+    char* copy = &block->data[block->used];
+    memcpy(copy, str, length);
+    copy[length] = 0x00;
+    block->used += length + 1;
+    return copy;
+}
+
+static struct intern_entry* intern_slot(struct intern_table* table, const char* str, size_t length, unsigned int hash)
+{
+    size_t mask = table->capacity - 1;
+    size_t index = hash & mask;
+    while (table->entries[index].str)
+    {
+        struct intern_entry* entry = &table->entries[index];
+        if (entry->hash == hash && entry->length == length && memcmp(entry->str, str, length) == 0)
+        {
+            return entry;
+        }
+        index = (index + 1) & mask;
+    }
+    return &table->entries[index];
+}
+
+static void intern_grow(struct intern_table* table)
+{
+    struct intern_entry* old_entries = table->entries;
+    size_t old_capacity = table->capacity;
+    table->capacity *= 2;
+    table->entries = calloc(table->capacity, sizeof(struct intern_entry));
+    for (size_t i = 0; i < old_capacity; i++)
+    {
+        if (!old_entries[i].str)
+        {
+            continue;
+        }
+        *intern_slot(table, old_entries[i].str, old_entries[i].length, old_entries[i].hash) = old_entries[i];
+    }
+    free(old_entries);
+}
+
+static const char* intern_add(struct intern_table* table, const char* str, size_t length)
+{
+    unsigned int hash = intern_hash(str, length);
+    struct intern_entry* entry = intern_slot(table, str, length, hash);
+    if (entry->str)
+    {
+        return entry->str;
+    }
+
+    // keep the load factor under 3/4 so probe sequences stay short
+    if ((table->count + 1) * 4 > table->capacity * 3)
+    {
+        intern_grow(table);
+        entry = intern_slot(table, str, length, hash);
+    }
+
+    entry->str = intern_copy(table, str, length);
+    entry->hash = hash;
+    entry->length = length;
+    table->count++;
+    return entry->str;
+}
+
+const char* intern_table_add(struct intern_table* table, const char* str, size_t length)
+{
+    if (!table->shared)
+    {
+        return intern_add(table, str, length);
+    }
+
+    pthread_mutex_lock(&table->lock);
+    const char* copy = intern_add(table, str, length);
+    pthread_mutex_unlock(&table->lock);
+    return copy;
+}
+
+void intern_table_share(struct intern_table* table)
+{
+    if (!table->shared)
+    {
+        pthread_mutex_init(&table->lock, NULL);
+        table->shared = true;
+    }
+}
+
+size_t intern_table_count(struct intern_table* table)
+{
+    return table->count;
+}
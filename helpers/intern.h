@@ -0,0 +1,60 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Starting amount of slots, must be a power of two
+#define INTERN_TABLE_INITIAL_CAPACITY 1024
+// Strings are copied into blocks of this size, longer strings get a block of their own
+#define INTERN_BLOCK_SIZE 65536
+
+struct intern_entry
+{
+    // NULL when the slot is free
+    const char* str;
+    unsigned int hash;
+    unsigned int length;
+};
+
+struct intern_block
+{
+    struct intern_block* next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+/**
+ * Keeps one copy of every string added to it so equal strings can be compared by pointer.
+ * The copies live until the table is freed.
+ */
+struct intern_table
+{
+    struct intern_entry* entries;
+    size_t capacity;
+    size_t count;
+    struct intern_block* blocks;
+
+    // set by intern_table_share, adding then takes the lock
+    bool shared;
+    pthread_mutex_t lock;
+};
+
+struct intern_table* intern_table_create();
+void intern_table_free(struct intern_table* table);
+
+/**
+ * Returns the table's copy of the string, the string doesn't have to be null terminated
+ */
+const char* intern_table_add(struct intern_table* table, const char* str, size_t length);
+
+/**
+ * Lets more than one thread add to the table, strings returned stay valid either way
+ */
+void intern_table_share(struct intern_table* table);
+
+size_t intern_table_count(struct intern_table* table);
+
+#endif
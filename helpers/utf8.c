@@ -0,0 +1,158 @@
+#include "utf8.h"
+#ifdef __AVX2__
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+size_t utf8_decode(const char* str, size_t length, uint32_t* codepoint)
+{
+    const unsigned char* s = (const unsigned char*)str;
+    if (length == 0)
+    {
+        return 0;
+    }
+
+    if (s[0] < 0x80)
+    {
+        *codepoint = s[0];
+        return 1;
+    }
+
+    size_t size;
+    uint32_t value;
+    // the smallest code point that needs this many bytes, anything below is overlong
+    uint32_t min;
+    if ((s[0] & 0xE0) == 0xC0)
+    {
+        size = 2;
+        value = s[0] & 0x1F;
+        min = 0x80;
+    }
+    else if ((s[0] & 0xF0) == 0xE0)
+    {
+        size = 3;
+        value = s[0] & 0x0F;
+        min = 0x800;
+    }
+    else if ((s[0] & 0xF8) == 0xF0)
+    {
+        size = 4;
+        value = s[0] & 0x07;
+        min = 0x10000;
+    }
+    else
+    {
+        return 0;
+    }
+
+    if (length < size)
+    {
+        return 0;
+    }
+
+    for (size_t i = 1; i < size; i++)
+    {
+        if ((s[i] & 0xC0) != 0x80)
+        {
+            return 0;
+        }
+        value = value << 6 | (s[i] & 0x3F);
+    }
+
+    if (value < min || value > UTF8_MAX_CODEPOINT || (value >= 0xD800 && value <= 0xDFFF))
+    {
+        return 0;
+    }
+    *codepoint = value;
+    return size;
+}
+
+size_t utf8_encode(uint32_t codepoint, char* out)
+{
+    if (codepoint < 0x80)
+    {
+        out[0] = codepoint;
+        return 1;
+    }
+    if (codepoint < 0x800)
+    {
+        out[0] = 0xC0 | codepoint >> 6;
+        out[1] = 0x80 | (codepoint & 0x3F);
+        return 2;
+    }
+    if (codepoint < 0x10000)
+    {
+        out[0] = 0xE0 | codepoint >> 12;
+        out[1] = 0x80 | (codepoint >> 6 & 0x3F);
+        out[2] = 0x80 | (codepoint & 0x3F);
+        return 3;
+    }
+    out[0] = 0xF0 | codepoint >> 18;
+    out[1] = 0x80 | (codepoint >> 12 & 0x3F);
+    out[2] = 0x80 | (codepoint >> 6 & 0x3F);
+    out[3] = 0x80 | (codepoint & 0x3F);
+    return 4;
+}
+
+#ifdef __AVX2__
+#define UTF8_VECTOR 32
+#else
+#define UTF8_VECTOR 16
+#endif
+
+/**
+ * Skips the whole vectors of ASCII at str, a byte with its high bit set stops it
+ */
+static size_t utf8_ascii_prefix(const char* str, size_t length)
+{
+    size_t i = 0;
+#ifdef __AVX2__
+    for (; length - i >= UTF8_VECTOR; i += UTF8_VECTOR)
+    {
+        if (_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*)(str + i))))
+        {
+            break;
+        }
+    }
+#elif defined(__SSE2__)
+    for (; length - i >= UTF8_VECTOR; i += UTF8_VECTOR)
+    {
+        if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(str + i))))
+        {
+            break;
+        }
+    }
+#endif
+    return i;
+}
+
+size_t utf8_validate(const char* str, size_t length)
+{
+    size_t i = 0;
+    while (i < length)
+    {
+        i += utf8_ascii_prefix(str + i, length - i);
+
+        // the vector that was not all ASCII, or what is left after the last whole
+        // one, goes a character at a time before trying whole vectors again
+        size_t end = length - i > UTF8_VECTOR ? i + UTF8_VECTOR : length;
+        while (i < end)
+        {
+            if ((unsigned char)str[i] < 0x80)
+            {
+                i++;
+                continue;
+            }
+
+            uint32_t codepoint;
+            size_t size = utf8_decode(str + i, length - i, &codepoint);
+            if (size == 0)
+            {
+                return i;
+            }
+            i += size;
+        }
+    }
+    return length;
+}
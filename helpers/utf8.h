@@ -0,0 +1,28 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// the longest encoding of a code point
+#define UTF8_MAX_LENGTH 4
+#define UTF8_MAX_CODEPOINT 0x10FFFF
+
+/**
+ * Decodes the code point at the start of str, returns how many bytes it takes or 0 if
+ * they are not a well formed sequence: overlong, a surrogate, past U+10FFFF or cut short
+ */
+size_t utf8_decode(const char* str, size_t length, uint32_t* codepoint);
+
+/**
+ * Writes the code point to out, returns how many bytes it took
+ */
+size_t utf8_encode(uint32_t codepoint, char* out);
+
+/**
+ * Returns the offset of the first byte that is not part of well formed UTF-8, length
+ * when there is none. Blocks of plain ASCII are checked a vector at a time
+ */
+size_t utf8_validate(const char* str, size_t length);
+
+#endif
@@ -6,17 +6,18 @@
 #include <stdbool.h>
 #include <stdio.h>
 
-static bool vector_in_bounds_for_at(struct vector *vector, int index)
+// indexes are unsigned, a negative index converts to a huge one and is out of bounds too
+static bool vector_in_bounds_for_at(struct vector *vector, size_t index)
 {
-    return (index >= 0 && index < vector->rindex);
+    return index < vector->rindex;
 }
 
-static bool vector_in_bounds_for_pop(struct vector *vector, int index)
+static bool vector_in_bounds_for_pop(struct vector *vector, size_t index)
 {
-    return (index >= 0 && index < vector->mindex);
+    return index < vector->mindex;
 }
 
-static void vector_assert_bounds_for_pop(struct vector *vector, int index)
+static void vector_assert_bounds_for_pop(struct vector *vector, size_t index)
 {
     assert(vector_in_bounds_for_pop(vector, index));
 }
@@ -50,44 +51,52 @@ struct vector *vector_clone(struct vector *vector)
     struct vector *new_vec = calloc(sizeof(struct vector), 1);
     memcpy(new_vec, vector, sizeof(struct vector));
     new_vec->data = new_data_address;
+    new_vec->mindex = vector->count + VECTOR_ELEMENT_INCREMENT;
 
     // Saves are not cloned with vector_clone yet.
-    // assert(vector->saves == NULL);
+    new_vec->saves = NULL;
     return new_vec;
 }
 
 struct vector *vector_create(size_t esize)
 {
-    struct vector *vec = vector_create_no_saves(esize);
-    vec->saves = vector_create_no_saves(sizeof(struct vector));
-    return vec;
+    // the saves are only made once the vector is saved, few vectors ever are
+    return vector_create_no_saves(esize);
 }
 
 void vector_free(struct vector *vector)
 {
+    if (vector->saves)
+    {
+        vector_free(vector->saves);
+    }
     free(vector->data);
     free(vector);
 }
 
-int vector_current_index(struct vector *vector)
+size_t vector_current_index(struct vector *vector)
 {
     return vector->rindex;
 }
 
-void vector_resize_for_index(struct vector *vector, int start_index, int total_elements)
+void vector_resize_for_index(struct vector *vector, size_t start_index, size_t total_elements)
 {
-    if (start_index + total_elements < vector->mindex)
+    size_t needed = start_index + total_elements;
+    if (needed < vector->mindex)
     {
         // Nothing to resize
         return;
     }
 
-    vector->data = realloc(vector->data, ((start_index + total_elements + VECTOR_ELEMENT_INCREMENT) * vector->esize));
+    // grow by half of what is needed so pushing n elements copies them a constant
+    // number of times on average instead of reallocating every few pushes
+    size_t capacity = needed + (needed / 2 > VECTOR_ELEMENT_INCREMENT ? needed / 2 : VECTOR_ELEMENT_INCREMENT);
+    vector->data = realloc(vector->data, capacity * vector->esize);
     assert(vector->data);
-    vector->mindex = start_index + total_elements;
+    vector->mindex = capacity;
 }
 
-void vector_resize_for(struct vector *vector, int total_elements)
+void vector_resize_for(struct vector *vector, size_t total_elements)
 {
     vector_resize_for_index(vector, vector->rindex, total_elements);
 }
@@ -98,12 +107,12 @@ void vector_resize(struct vector *vector)
     vector_resize_for(vector, 0);
 }
 
-void *vector_at(struct vector *vector, int index)
+void *vector_at(struct vector *vector, size_t index)
 {
     return vector->data + (index * vector->esize);
 }
 
-void vector_set_peek_pointer(struct vector *vector, int index)
+void vector_set_peek_pointer(struct vector *vector, size_t index)
 {
     vector->pindex = index;
 }
@@ -113,7 +122,7 @@ void vector_set_peek_pointer_end(struct vector *vector)
     vector_set_peek_pointer(vector, vector->rindex - 1);
 }
 
-void *vector_peek_at(struct vector *vector, int index)
+void *vector_peek_at(struct vector *vector, size_t index)
 {
     if (!vector_in_bounds_for_at(vector, index))
     {
@@ -177,9 +186,9 @@ void *vector_peek_ptr(struct vector *vector)
     return *ptr;
 }
 
-void *vector_peek_ptr_at(struct vector *vector, int index)
+void *vector_peek_ptr_at(struct vector *vector, size_t index)
 {
-    if (index < 0 || index > vector->count)
+    if (index >= vector->count)
     {
         return NULL;
     }
@@ -211,6 +220,10 @@ void vector_save(struct vector *vector)
     // We not allowed to modify the saves so set it to NULL
     // when we push it to the save stack.
     tmp_vec.saves = NULL;
+    if (!vector->saves)
+    {
+        vector->saves = vector_create_no_saves(sizeof(struct vector));
+    }
     vector_push(vector->saves, &tmp_vec);
 }
 
@@ -269,33 +282,34 @@ void *vector_data_end(struct vector *vector)
     return vector->data + vector->rindex * vector->esize;
 }
 
-size_t vector_elements_left(struct vector *vector, int index)
+size_t vector_elements_left(struct vector *vector, size_t index)
 {
     return vector->count - index;
 }
 
-int vector_elements_until_end(struct vector *vector, int index)
+size_t vector_elements_until_end(struct vector *vector, size_t index)
 {
     return vector->count - index;
 }
 
-void vector_shift_right_in_bounds_no_increment(struct vector *vector, int index, int amount)
+void vector_shift_right_in_bounds_no_increment(struct vector *vector, size_t index, size_t amount)
 {
-    vector_resize_for_index(vector, index, amount);
-    int eindex = (index + amount);
+    // the elements from index to the end move up by amount
+    vector_resize_for_index(vector, vector->count, amount);
+    size_t eindex = (index + amount);
     size_t bytes_to_move = vector_elements_until_end(vector, index) * vector->esize;
-    memcpy(vector_at(vector, eindex), vector_at(vector, index), bytes_to_move);
+    memmove(vector_at(vector, eindex), vector_at(vector, index), bytes_to_move);
     memset(vector_at(vector, index), 0x00, amount * vector->esize);
 }
 
-void vector_shift_right_in_bounds(struct vector *vector, int index, int amount)
+void vector_shift_right_in_bounds(struct vector *vector, size_t index, size_t amount)
 {
     vector_shift_right_in_bounds_no_increment(vector, index, amount);
     vector->rindex += amount;
     vector->count += amount;
 }
 
-void vector_stretch(struct vector *vector, int index)
+void vector_stretch(struct vector *vector, size_t index)
 {
     if (index < vector->rindex)
         return;
@@ -307,10 +321,10 @@ void vector_stretch(struct vector *vector, int index)
 
 int vector_pop_value(struct vector* vector, void* val)
 {
-    int old_pp = vector->pindex;
+    size_t old_pp = vector->pindex;
     vector_set_peek_pointer(vector, 0);
     void* ptr = vector_peek_ptr(vector);
-    int index = 0;
+    size_t index = 0;
     while(ptr)
     {
         if (ptr == val)
@@ -326,14 +340,14 @@ int vector_pop_value(struct vector* vector, void* val)
     return 0;
 }
 
-int vector_pop_at_data_address(struct vector *vector, void *address)
+size_t vector_pop_at_data_address(struct vector *vector, void *address)
 {
-    int index = (address - vector->data) / vector->esize;
+    size_t index = (address - vector->data) / vector->esize;
     vector_pop_at(vector, index);
     return index;
 }
 
-void vector_shift_right(struct vector *vector, int index, int amount)
+void vector_shift_right(struct vector *vector, size_t index, size_t amount)
 {
     if (index < vector->rindex)
     {
@@ -347,13 +361,13 @@ void vector_shift_right(struct vector *vector, int index, int amount)
     vector_shift_right_in_bounds_no_increment(vector, index, amount);
 }
 
-void vector_pop_at(struct vector *vector, int index)
+void vector_pop_at(struct vector *vector, size_t index)
 {
     void *dst_pos = vector_at(vector, index);
     void *next_element_pos = dst_pos + vector->esize;
     void *end_pos = vector_data_end(vector);
     size_t total = (size_t)end_pos - (size_t)next_element_pos;
-    memcpy(dst_pos, next_element_pos, total);
+    memmove(dst_pos, next_element_pos, total);
     vector->count -= 1;
     vector->rindex -= 1;
 }
@@ -366,7 +380,7 @@ void vector_peek_pop(struct vector *vector)
     vector_pop_at(vector, vector->pindex);
 }
 
-void vector_push_multiple_at(struct vector *vector, int dst_index, void *ptr, int total)
+void vector_push_multiple_at(struct vector *vector, size_t dst_index, void *ptr, size_t total)
 {
     vector_shift_right(vector, dst_index, total);
     void *dst_ptr = vector_at(vector, dst_index);
@@ -374,7 +388,7 @@ void vector_push_multiple_at(struct vector *vector, int dst_index, void *ptr, in
     memcpy(dst_ptr, ptr, total_bytes);
 }
 
-void vector_push_at(struct vector *vector, int index, void *ptr)
+void vector_push_at(struct vector *vector, size_t index, void *ptr)
 {
     vector_shift_right(vector, index, 1);
 
@@ -382,7 +396,7 @@ void vector_push_at(struct vector *vector, int index, void *ptr)
     memcpy(data_ptr, ptr, vector->esize);
 }
 
-int vector_insert(struct vector *vector_dst, struct vector *vector_src, int dst_index)
+int vector_insert(struct vector *vector_dst, struct vector *vector_src, size_t dst_index)
 {
     if (vector_dst->esize != vector_src->esize)
     {
@@ -417,10 +431,9 @@ bool vector_empty(struct vector *vector)
 
 void vector_clear(struct vector *vector)
 {
-    while (vector_count(vector))
-    {
-        vector_pop(vector);
-    }
+    // the memory is kept for the next pushes
+    vector->rindex = 0;
+    vector->count = 0;
 }
 
 void *vector_back_or_null(struct vector *vector)
@@ -453,7 +466,7 @@ void *vector_back(struct vector *vector)
     return vector_at(vector, vector->rindex - 1);
 }
 
-int vector_count(struct vector *vector)
+size_t vector_count(struct vector *vector)
 {
     return vector->count;
 }
\ No newline at end of file
@@ -21,10 +21,11 @@ struct vector
     void* data;
     // The pointer index is the index that will be read next upon calling "vector_peek".
     // This index will then be incremented
-    int pindex;
-    int rindex;
-    int mindex;
-    int count;
+    size_t pindex;
+    size_t rindex;
+    // elements the data has room for
+    size_t mindex;
+    size_t count;
     int flags;
     size_t esize;
 
@@ -40,11 +41,11 @@ struct vector
 
 struct vector* vector_create(size_t esize);
 void vector_free(struct vector* vector);
-void* vector_at(struct vector* vector, int index);
-void* vector_peek_ptr_at(struct vector* vector, int index);
+void* vector_at(struct vector* vector, size_t index);
+void* vector_peek_ptr_at(struct vector* vector, size_t index);
 void* vector_peek_no_increment(struct vector* vector);
 void* vector_peek(struct vector* vector);
-void *vector_peek_at(struct vector *vector, int index);
+void *vector_peek_at(struct vector *vector, size_t index);
 void vector_set_flag(struct vector* vector, int flag);
 void vector_unset_flag(struct vector* vector, int flag);
 
@@ -59,10 +60,10 @@ void vector_pop_last_peek(struct vector* vector);
  * Use this function instead of vector_peek if this is a vector of pointers
  */
 void* vector_peek_ptr(struct vector* vector);
-void vector_set_peek_pointer(struct vector* vector, int index);
+void vector_set_peek_pointer(struct vector* vector, size_t index);
 void vector_set_peek_pointer_end(struct vector* vector);
 void vector_push(struct vector* vector, void* elem);
-void vector_push_at(struct vector *vector, int index, void *ptr);
+void vector_push_at(struct vector *vector, size_t index, void *ptr);
 void vector_pop(struct vector* vector);
 void vector_peek_pop(struct vector* vector);
 
@@ -83,7 +84,7 @@ const char* vector_string(struct vector* vec);
 bool vector_empty(struct vector* vector);
 void vector_clear(struct vector* vector);
 
-int vector_count(struct vector* vector);
+size_t vector_count(struct vector* vector);
 /**
  * freads from the file directly into the vector
  */
@@ -93,7 +94,7 @@ int vector_fread(struct vector* vector, int amount, FILE* fp);
  */
 void* vector_data_ptr(struct vector* vector);
 
-int vector_insert(struct vector *vector_dst, struct vector *vector_src, int dst_index);
+int vector_insert(struct vector *vector_dst, struct vector *vector_src, size_t dst_index);
 
 /**
  * Pops the element at the given data address.
@@ -101,14 +102,14 @@ int vector_insert(struct vector *vector_dst, struct vector *vector_src, int dst_
  * \param address The address that is part of the vector->data range to pop off.
  * \return Returns the index that we popped off.
  */
-int vector_pop_at_data_address(struct vector* vector, void* address);
+size_t vector_pop_at_data_address(struct vector* vector, void* address);
 
 /**
  * Pops the given value from the vector. Only the first value found is popped
  */
 int vector_pop_value(struct vector* vector, void* val);
 
-void vector_pop_at(struct vector *vector, int index);
+void vector_pop_at(struct vector *vector, size_t index);
 
 /**
  * Decrements the peek pointer so that the next peek
@@ -119,7 +120,7 @@ void vector_peek_back(struct vector* vector);
 /**
  * Returns the current index that a vector_push would push too
  */
-int vector_current_index(struct vector* vector);
+size_t vector_current_index(struct vector* vector);
 
 /**
  * Saves the state of the vector
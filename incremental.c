@@ -0,0 +1,420 @@
+#include "compiler.h"
+#include "helpers/vector.h"
+#include "helpers/hashmap.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/**
+ * Dependency files and incremental builds. The state file of a build is a small
+ * graph: every file a translation unit read with the mtime, size and content hash
+ * it was last seen with, and every translation unit with its output, its flags and
+ * the hash of each file it read when it was compiled. A unit is compiled again
+ * when its output is gone, its flags changed or one of its files hashes differently.
+ * Files are only hashed when their mtime or size moved, touching a file costs a
+ * hash and not a compile
+ */
+
+#define INCREMENTAL_STATE_HEADER "zeze-incremental 1"
+
+struct incremental_file
+{
+    const char *path;
+    long long mtime_sec;
+    long long mtime_nsec;
+    long long size;
+    uint64_t hash;
+    // looked at during this build, the fields above are current
+    bool checked;
+};
+
+struct incremental_use
+{
+    const char *path;
+    uint64_t hash;
+};
+
+struct incremental_unit
+{
+    const char *source;
+    const char *output;
+    int flags;
+    // struct incremental_use, the files read by the last compile
+    struct vector *uses;
+};
+
+struct incremental
+{
+    // path -> struct incremental_file*
+    struct hashmap *files;
+    // absolute source path -> struct incremental_unit*
+    struct hashmap *units;
+    // struct incremental_unit* in the order they were first built
+    struct vector *unit_list;
+};
+
+/**
+ * The path with its extension replaced, or the extension appended when it has none
+ */
+char *incremental_path_with_extension(const char *path, const char *extension)
+{
+    const char *slash = strrchr(path, '/');
+    const char *dot = strrchr(path, '.');
+    size_t length = dot && (!slash || dot > slash) ? (size_t)(dot - path) : strlen(path);
+    char *res = malloc(length + strlen(extension) + 1);
+    memcpy(res, path, length);
+    strcpy(res + length, extension);
+    return res;
+}
+
+static void depfile_write_path(FILE *out, const char *path)
+{
+    for (const char *c = path; *c; c++)
+    {
+        if (*c == '$')
+        {
+            fputc('$', out);
+        }
+        else if (*c == ' ' || *c == '\t' || *c == '#' || *c == '\\')
+        {
+            fputc('\\', out);
+        }
+        fputc(*c, out);
+    }
+}
+
+/**
+ * Writes a make rule that the target depends on every file in dependencies.
+ * Every header also gets an empty rule so make doesn't stop when one is deleted
+ */
+bool depfile_write(const char *path, const char *target, struct vector *dependencies)
+{
+    FILE *out = fopen(path, "w");
+    if (!out)
+    {
+        return false;
+    }
+
+    depfile_write_path(out, target);
+    fputc(':', out);
+    for (int i = 0; i < vector_count(dependencies); i++)
+    {
+        fputs(" \\\n  ", out);
+        depfile_write_path(out, *(const char **)vector_at(dependencies, i));
+    }
+    fputc('\n', out);
+
+    for (int i = 1; i < vector_count(dependencies); i++)
+    {
+        fputc('\n', out);
+        depfile_write_path(out, *(const char **)vector_at(dependencies, i));
+        fputs(":\n", out);
+    }
+    return fclose(out) == 0;
+}
+
+static uint64_t incremental_hash_file(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        return 0;
+    }
+
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    unsigned char data[65536];
+    size_t count;
+    while ((count = fread(data, 1, sizeof(data), file)) > 0)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            hash ^= data[i];
+            hash *= 1099511628211ull;
+        }
+    }
+    fclose(file);
+    return hash;
+}
+
+static struct incremental_file *incremental_file(struct incremental *incremental, const char *path)
+{
+    struct incremental_file *file = hashmap_get(incremental->files, path);
+    if (!file)
+    {
+        file = calloc(1, sizeof(struct incremental_file));
+        file->path = strdup(path);
+        file->mtime_sec = -1;
+        hashmap_set(incremental->files, path, file);
+    }
+    return file;
+}
+
+/**
+ * Hash of the file as it is now, 0 when it doesn't exist. Only files whose mtime
+ * or size moved since the last build are read
+ */
+static uint64_t incremental_current_hash(struct incremental *incremental, const char *path)
+{
+    struct incremental_file *file = incremental_file(incremental, path);
+    if (file->checked)
+    {
+        return file->hash;
+    }
+
+    struct stat info;
+    file->checked = true;
+    if (stat(path, &info) != 0)
+    {
+        file->mtime_sec = -1;
+        file->hash = 0;
+        return 0;
+    }
+
+    if (info.st_mtim.tv_sec != file->mtime_sec || info.st_mtim.tv_nsec != file->mtime_nsec || info.st_size != file->size)
+    {
+        file->mtime_sec = info.st_mtim.tv_sec;
+        file->mtime_nsec = info.st_mtim.tv_nsec;
+        file->size = info.st_size;
+        file->hash = incremental_hash_file(path);
+    }
+    return file->hash;
+}
+
+static struct incremental_unit *incremental_unit(struct incremental *incremental, const char *source)
+{
+    struct incremental_unit *unit = hashmap_get(incremental->units, source);
+    if (!unit)
+    {
+        unit = calloc(1, sizeof(struct incremental_unit));
+        unit->source = strdup(source);
+        unit->uses = vector_create(sizeof(struct incremental_use));
+        hashmap_set(incremental->units, source, unit);
+        vector_push(incremental->unit_list, &unit);
+    }
+    return unit;
+}
+
+/**
+ * Reads the state a previous build saved, a missing or unreadable file is an empty state
+ */
+static struct incremental *incremental_load(const char *state_path)
+{
+    struct incremental *incremental = calloc(1, sizeof(struct incremental));
+    incremental->files = hashmap_create();
+    incremental->units = hashmap_create();
+    incremental->unit_list = vector_create(sizeof(struct incremental_unit *));
+
+    FILE *in = fopen(state_path, "r");
+    if (!in)
+    {
+        return incremental;
+    }
+
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length = getline(&line, &capacity, in);
+    bool valid = length > 0 && strncmp(line, INCREMENTAL_STATE_HEADER "\n", length) == 0;
+    struct incremental_unit *unit = NULL;
+    while (valid && (length = getline(&line, &capacity, in)) > 0)
+    {
+        line[length - 1] = line[length - 1] == '\n' ? 0x00 : line[length - 1];
+        long long mtime_sec, mtime_nsec, size;
+        unsigned long long hash;
+        int flags;
+        int offset = 0;
+        if (sscanf(line, "file %lld %lld %lld %llx %n", &mtime_sec, &mtime_nsec, &size, &hash, &offset) == 4 && offset)
+        {
+            struct incremental_file *file = incremental_file(incremental, line + offset);
+            file->mtime_sec = mtime_sec;
+            file->mtime_nsec = mtime_nsec;
+            file->size = size;
+            file->hash = hash;
+        }
+        else if (sscanf(line, "unit %i %n", &flags, &offset) == 1 && offset)
+        {
+            unit = incremental_unit(incremental, line + offset);
+            unit->flags = flags;
+        }
+        else if (unit && sscanf(line, "output %n", &offset) == 0 && offset)
+        {
+            unit->output = strdup(line + offset);
+        }
+        else if (unit && sscanf(line, "uses %llx %n", &hash, &offset) == 1 && offset)
+        {
+            struct incremental_use use = {.path = strdup(line + offset), .hash = hash};
+            vector_push(unit->uses, &use);
+        }
+    }
+    free(line);
+    fclose(in);
+    return incremental;
+}
+
+/**
+ * Writes the state next to its final name and renames it over, a build that
+ * stops half way never leaves a broken state behind
+ */
+static bool incremental_save(struct incremental *incremental, const char *state_path)
+{
+    char temporary[PATH_MAX];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", state_path);
+    FILE *out = fopen(temporary, "w");
+    if (!out)
+    {
+        return false;
+    }
+
+    fprintf(out, INCREMENTAL_STATE_HEADER "\n");
+    struct hashmap *written = hashmap_create();
+    for (int i = 0; i < vector_count(incremental->unit_list); i++)
+    {
+        struct incremental_unit *unit = *(struct incremental_unit **)vector_at(incremental->unit_list, i);
+        for (int j = 0; j < vector_count(unit->uses); j++)
+        {
+            struct incremental_use *use = vector_at(unit->uses, j);
+            struct incremental_file *file = hashmap_get(incremental->files, use->path);
+            if (file && file->mtime_sec >= 0 && !hashmap_get(written, use->path))
+            {
+                fprintf(out, "file %lld %lld %lld %llx %s\n", file->mtime_sec, file->mtime_nsec, file->size, (unsigned long long)file->hash, file->path);
+                hashmap_set(written, use->path, file);
+            }
+        }
+    }
+    hashmap_free(written);
+
+    for (int i = 0; i < vector_count(incremental->unit_list); i++)
+    {
+        struct incremental_unit *unit = *(struct incremental_unit **)vector_at(incremental->unit_list, i);
+        if (!unit->output)
+        {
+            continue;
+        }
+
+        fprintf(out, "unit %i %s\noutput %s\n", unit->flags, unit->source, unit->output);
+        for (int j = 0; j < vector_count(unit->uses); j++)
+        {
+            struct incremental_use *use = vector_at(unit->uses, j);
+            fprintf(out, "uses %llx %s\n", (unsigned long long)use->hash, use->path);
+        }
+    }
+
+    return fclose(out) == 0 && rename(temporary, state_path) == 0;
+}
+
+/**
+ * True when the unit has to be compiled again
+ */
+static bool incremental_is_stale(struct incremental *incremental, struct incremental_unit *unit, const char *output, int flags)
+{
+    struct stat info;
+    if (!unit->output || unit->flags != flags || !S_EQ(unit->output, output) || stat(output, &info) != 0 || vector_empty(unit->uses))
+    {
+        return true;
+    }
+
+    for (int i = 0; i < vector_count(unit->uses); i++)
+    {
+        struct incremental_use *use = vector_at(unit->uses, i);
+        uint64_t hash = incremental_current_hash(incremental, use->path);
+        if (!hash || hash != use->hash)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * The dependency file of the unit's output, from the files its last compile read
+ */
+static void incremental_write_depfile(struct incremental_unit *unit)
+{
+    struct vector *dependencies = vector_create(sizeof(const char *));
+    for (int i = 0; i < vector_count(unit->uses); i++)
+    {
+        vector_push(dependencies, &((struct incremental_use *)vector_at(unit->uses, i))->path);
+    }
+
+    char *depfile = incremental_path_with_extension(unit->output, ".d");
+    if (!depfile_write(depfile, unit->output, dependencies))
+    {
+        printf("Cannot write %s\n", depfile);
+    }
+    free(depfile);
+    vector_free(dependencies);
+}
+
+/**
+ * Compiles every input whose translation unit changed since the state was saved,
+ * each input goes to the same name ending in .s, or .o for object files. Returns
+ * the number of inputs that failed to compile
+ */
+int incremental_build(const char *state_path, char **inputs, int count, int flags, bool depfiles)
+{
+    struct incremental *incremental = incremental_load(state_path);
+    const char *extension = flags & COMPILE_PROCESS_FLAG_OBJECT ? ".o" : ".s";
+    int compiled = 0;
+    int failed = 0;
+    for (int i = 0; i < count; i++)
+    {
+        char *output = incremental_path_with_extension(inputs[i], extension);
+        char *source = realpath(inputs[i], NULL);
+        struct incremental_unit *unit = source ? incremental_unit(incremental, source) : NULL;
+        if (unit && !incremental_is_stale(incremental, unit, output, flags))
+        {
+            if (depfiles)
+            {
+                incremental_write_depfile(unit);
+            }
+            free(output);
+            free(source);
+            continue;
+        }
+
+        struct vector *dependencies = vector_create(sizeof(const char *));
+        if (!unit || compile_file_with_dependencies(inputs[i], output, flags, dependencies) != COMPILER_FILE_COMPILED_OK)
+        {
+            printf("Failed to compile %s\n", inputs[i]);
+            failed++;
+        }
+        else
+        {
+            // what the files hash to now is what this output was built from
+            for (int j = 0; j < vector_count(unit->uses); j++)
+            {
+                free((char *)((struct incremental_use *)vector_at(unit->uses, j))->path);
+            }
+            vector_clear(unit->uses);
+            for (int j = 0; j < vector_count(dependencies); j++)
+            {
+                const char *path = *(const char **)vector_at(dependencies, j);
+                struct incremental_use use = {.path = strdup(path), .hash = incremental_current_hash(incremental, path)};
+                vector_push(unit->uses, &use);
+            }
+            unit->flags = flags;
+            free((char *)unit->output);
+            unit->output = output;
+            output = NULL;
+            compiled++;
+            printf("Compiled %s\n", inputs[i]);
+            if (depfiles)
+            {
+                incremental_write_depfile(unit);
+            }
+
+            // saved after every unit, a compile error exits before the build ends
+            if (!incremental_save(incremental, state_path))
+            {
+                printf("Cannot write %s\n", state_path);
+            }
+        }
+        vector_free(dependencies);
+        free(output);
+        free(source);
+    }
+
+    printf("%i of %i translation units compiled\n", compiled, count);
+    return failed;
+}
@@ -0,0 +1,657 @@
+#include "compiler.h"
+#include "helpers/vector.h"
+#include "helpers/hashmap.h"
+#include <stdlib.h>
+
+/**
+ * Inlining and tail calls. Functions are optimized callees first so a callee is
+ * copied in its final shape, and a function that can call itself is never
+ * inlined. Whether a call is inlined depends on the size of the callee and how
+ * often the call runs, which is guessed from the loops around it
+ */
+
+// callees up to this many instructions are inlined anywhere
+#define INLINE_SIZE 24
+// the limit doubles for each loop around the call, up to this many loops
+#define INLINE_LOOP_DEPTH 2
+// a static function called once is inlined up to this size and goes away afterwards
+#define INLINE_ONCE_SIZE 500
+// callers stop taking callees at this size
+#define INLINE_CALLER_SIZE 3000
+
+struct inline_tarjan
+{
+    struct inline_graph *graph;
+    int *number;
+    int *lowlink;
+    bool *on_stack;
+    int *stack;
+    int top;
+    int counter;
+    int ordered;
+};
+
+struct inline_site
+{
+    uint32_t call;
+    uint32_t depth;
+};
+
+static int inline_index(struct inline_graph *graph, const char *name)
+{
+    return (int)(uintptr_t)hashmap_get(graph->indexes, name) - 1;
+}
+
+/**
+ * The function of the module a call goes to, -1 for calls through pointers and
+ * calls to other object files
+ */
+static int inline_callee(struct inline_graph *graph, struct ir_function *function, uint32_t call)
+{
+    struct ir_instruction *callee = ir_at(function, ir_operand(function, call, 0));
+    if (callee->op != IR_GLOBAL || callee->constant)
+    {
+        return -1;
+    }
+    return inline_index(graph, callee->symbol);
+}
+
+/**
+ * Tarjan's strongly connected components, a component is complete once all
+ * of its callees are so the order comes out callees first
+ */
+static void inline_visit(struct inline_tarjan *tarjan, int index)
+{
+    struct inline_graph *graph = tarjan->graph;
+    struct ir_function *function = graph->functions[index];
+    tarjan->number[index] = tarjan->lowlink[index] = ++tarjan->counter;
+    tarjan->stack[tarjan->top++] = index;
+    tarjan->on_stack[index] = true;
+    for (uint32_t i = 1; i < function->instruction_count; i++)
+    {
+        if (function->instructions[i].op != IR_CALL)
+        {
+            continue;
+        }
+
+        int callee = inline_callee(graph, function, i);
+        if (callee < 0)
+        {
+            continue;
+        }
+
+        if (callee == index)
+        {
+            graph->recursive[index] = true;
+        }
+
+        if (!tarjan->number[callee])
+        {
+            inline_visit(tarjan, callee);
+            if (tarjan->lowlink[callee] < tarjan->lowlink[index])
+            {
+                tarjan->lowlink[index] = tarjan->lowlink[callee];
+            }
+        }
+        else if (tarjan->on_stack[callee] && tarjan->number[callee] < tarjan->lowlink[index])
+        {
+            tarjan->lowlink[index] = tarjan->number[callee];
+        }
+    }
+
+    if (tarjan->lowlink[index] != tarjan->number[index])
+    {
+        return;
+    }
+
+    int first = tarjan->top;
+    do
+    {
+        first--;
+    } while (tarjan->stack[first] != index);
+
+    bool cycle = tarjan->top - first > 1;
+    for (int i = first; i < tarjan->top; i++)
+    {
+        int member = tarjan->stack[i];
+        tarjan->on_stack[member] = false;
+        graph->recursive[member] |= cycle;
+        graph->order[tarjan->ordered++] = member;
+    }
+    tarjan->top = first;
+}
+
+/**
+ * Counts the direct calls of every function and notes the ones whose address
+ * goes anywhere else
+ */
+static void inline_count_calls(struct inline_graph *graph)
+{
+    for (int f = 0; f < graph->count; f++)
+    {
+        struct ir_function *function = graph->functions[f];
+        for (uint32_t i = 1; i < function->instruction_count; i++)
+        {
+            struct ir_instruction *instruction = &function->instructions[i];
+            int index = instruction->op == IR_GLOBAL ? inline_index(graph, instruction->symbol) : -1;
+            if (index < 0)
+            {
+                continue;
+            }
+
+            for (uint32_t slot = instruction->first_use; slot != IR_NONE; slot = function->uses[slot].next)
+            {
+                struct ir_use *use = &function->uses[slot];
+                struct ir_instruction *user = &function->instructions[use->user];
+                if (user->op == IR_CALL && slot == user->operands && !instruction->constant)
+                {
+                    graph->calls[index]++;
+                    continue;
+                }
+                graph->address_taken[index] = true;
+            }
+        }
+    }
+
+    struct ir_global **globals = vector_data_ptr(graph->module->globals);
+    for (int g = 0; g < vector_count(graph->module->globals); g++)
+    {
+        struct ir_relocation *relocations = vector_data_ptr(globals[g]->relocations);
+        for (int r = 0; r < vector_count(globals[g]->relocations); r++)
+        {
+            int index = inline_index(graph, relocations[r].symbol);
+            if (index >= 0)
+            {
+                graph->address_taken[index] = true;
+            }
+        }
+    }
+}
+
+struct inline_graph *inline_graph_create(struct ir_module *module)
+{
+    struct inline_graph *graph = calloc(1, sizeof(struct inline_graph));
+    graph->module = module;
+    graph->functions = vector_data_ptr(module->functions);
+    graph->count = vector_count(module->functions);
+    graph->indexes = hashmap_create();
+    graph->order = calloc(graph->count + 1, sizeof(int));
+    graph->recursive = calloc(graph->count + 1, sizeof(bool));
+    graph->address_taken = calloc(graph->count + 1, sizeof(bool));
+    graph->calls = calloc(graph->count + 1, sizeof(uint32_t));
+    graph->sizes = calloc(graph->count + 1, sizeof(uint32_t));
+    for (int i = 0; i < graph->count; i++)
+    {
+        hashmap_set(graph->indexes, graph->functions[i]->name, (void *)(uintptr_t)(i + 1));
+    }
+
+    struct inline_tarjan tarjan = {.graph = graph};
+    tarjan.number = calloc(graph->count + 1, sizeof(int));
+    tarjan.lowlink = calloc(graph->count + 1, sizeof(int));
+    tarjan.on_stack = calloc(graph->count + 1, sizeof(bool));
+    tarjan.stack = calloc(graph->count + 1, sizeof(int));
+    for (int i = 0; i < graph->count; i++)
+    {
+        if (!tarjan.number[i])
+        {
+            inline_visit(&tarjan, i);
+        }
+    }
+    free(tarjan.number);
+    free(tarjan.lowlink);
+    free(tarjan.on_stack);
+    free(tarjan.stack);
+
+    inline_count_calls(graph);
+    return graph;
+}
+
+void inline_graph_free(struct inline_graph *graph)
+{
+    hashmap_free(graph->indexes);
+    free(graph->order);
+    free(graph->recursive);
+    free(graph->address_taken);
+    free(graph->calls);
+    free(graph->sizes);
+    free(graph);
+}
+
+/**
+ * Instructions that turn into code, the measure the inlining limits use
+ */
+uint32_t inline_size(struct ir_function *function)
+{
+    uint32_t size = 0;
+    for (uint32_t i = 1; i < function->instruction_count; i++)
+    {
+        int op = function->instructions[i].op;
+        size += op != IR_NOP && op != IR_PARAM && op != IR_CONST && op != IR_ALLOCA;
+    }
+    return size;
+}
+
+/**
+ * The callee can stand in for the call when the arguments and the returned
+ * values have the types of its parameters and of the call
+ */
+static bool inline_fits(struct ir_function *function, uint32_t call, struct ir_function *callee)
+{
+    struct ir_instruction *instruction = ir_at(function, call);
+    struct type *type = callee->type;
+    if ((type->flags & TYPE_FLAG_VARIADIC) || instruction->operand_count - 1 != (uint32_t)type->param_count)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 1; i < callee->instruction_count; i++)
+    {
+        struct ir_instruction *own = &callee->instructions[i];
+        if (own->op == IR_PARAM && own->type != ir_at(function, ir_operand(function, call, own->constant + 1))->type)
+        {
+            return false;
+        }
+
+        if (own->op == IR_RETURN && instruction->type != IR_TYPE_VOID &&
+            (!own->operand_count || ir_at(callee, ir_operand(callee, i, 0))->type != instruction->type))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool inline_should(struct inline_graph *graph, int caller, struct inline_site *site, int callee, uint32_t caller_size)
+{
+    if (callee == caller || graph->recursive[callee] || !graph->sizes[callee])
+    {
+        return false;
+    }
+
+    uint32_t size = graph->sizes[callee];
+    uint32_t depth = site->depth < INLINE_LOOP_DEPTH ? site->depth : INLINE_LOOP_DEPTH;
+    uint32_t limit = INLINE_SIZE << depth;
+    // the only copy of the body moves into the caller, the code does not grow
+    if (graph->functions[callee]->is_local && graph->calls[callee] == 1 && !graph->address_taken[callee])
+    {
+        limit = INLINE_ONCE_SIZE;
+    }
+
+    if (size > limit || caller_size + size > INLINE_CALLER_SIZE)
+    {
+        return false;
+    }
+    return inline_fits(graph->functions[caller], site->call, graph->functions[callee]);
+}
+
+/**
+ * Replaces the call with a copy of the callee. The instructions in front of
+ * the call move to a new block that jumps to the copy, returns of the copy
+ * jump back to the call's block which keeps the instructions after the call
+ */
+static void inline_call(struct ir_function *function, uint32_t call, struct ir_function *callee)
+{
+    uint32_t block = function->instructions[call].block;
+    uint32_t head = ir_block_create(function);
+    struct ir_block *target = &function->blocks[block];
+    for (uint32_t i = 0; i < target->pred_count; i++)
+    {
+        struct ir_block *pred = &function->blocks[function->preds[target->preds + i]];
+        for (int s = 0; s < 2; s++)
+        {
+            if (pred->successors[s] == block)
+            {
+                pred->successors[s] = head;
+            }
+        }
+    }
+
+    // phis and everything else in front of the call
+    uint32_t before = function->instructions[call].prev;
+    if (before != IR_NONE)
+    {
+        function->blocks[head].first = target->first;
+        function->blocks[head].last = before;
+        function->instructions[before].next = IR_NONE;
+        function->instructions[call].prev = IR_NONE;
+        target->first = call;
+        for (uint32_t index = function->blocks[head].first; index != IR_NONE; index = function->instructions[index].next)
+        {
+            function->instructions[index].block = head;
+        }
+    }
+
+    uint32_t *blocks = calloc(callee->block_count, sizeof(uint32_t));
+    uint32_t *values = calloc(callee->instruction_count, sizeof(uint32_t));
+    for (uint32_t b = 1; b < callee->block_count; b++)
+    {
+        if (!(callee->blocks[b].flags & IR_BLOCK_FLAG_DEAD))
+        {
+            blocks[b] = ir_block_create(function);
+        }
+    }
+
+    // returned values in block order, which is the order of the return block's predecessors
+    struct vector *returns = vector_create(sizeof(uint32_t));
+    for (uint32_t b = 1; b < callee->block_count; b++)
+    {
+        if (!blocks[b])
+        {
+            continue;
+        }
+
+        for (uint32_t index = callee->blocks[b].first; index != IR_NONE; index = callee->instructions[index].next)
+        {
+            struct ir_instruction *own = &callee->instructions[index];
+            if (own->op == IR_PARAM)
+            {
+                values[index] = ir_operand(function, call, own->constant + 1);
+                continue;
+            }
+
+            if (own->op == IR_RETURN)
+            {
+                uint32_t value = own->operand_count ? ir_operand(callee, index, 0) : IR_NONE;
+                vector_push(returns, &value);
+                ir_append(function, blocks[b], IR_JUMP, IR_TYPE_VOID, 0);
+                continue;
+            }
+
+            // stack slots stay in the entry block so loops around the call reuse them
+            uint32_t copy = own->op == IR_ALLOCA ? ir_insert_before(function, function->blocks[1].last, own->op, own->type, 0)
+                                                 : ir_append(function, blocks[b], own->op, own->type, own->operand_count);
+            struct ir_instruction *instruction = &function->instructions[copy];
+            instruction->aux = own->aux;
+            instruction->constant = own->constant;
+            instruction->symbol = own->symbol;
+            values[index] = copy;
+        }
+
+        for (int s = 0; s < 2; s++)
+        {
+            uint32_t successor = callee->blocks[b].successors[s];
+            function->blocks[blocks[b]].successors[s] = successor != IR_NONE ? blocks[successor] : IR_NONE;
+        }
+        if (callee->instructions[callee->blocks[b].last].op == IR_RETURN)
+        {
+            function->blocks[blocks[b]].successors[0] = block;
+        }
+    }
+
+    for (uint32_t index = 1; index < callee->instruction_count; index++)
+    {
+        struct ir_instruction *own = &callee->instructions[index];
+        if (own->op == IR_PARAM || own->op == IR_RETURN || own->op == IR_NOP)
+        {
+            continue;
+        }
+
+        for (uint32_t o = 0; o < own->operand_count; o++)
+        {
+            ir_set_operand(function, values[index], o, values[ir_operand(callee, index, o)]);
+        }
+    }
+
+    ir_append(function, head, IR_JUMP, IR_TYPE_VOID, 0);
+    function->blocks[head].successors[0] = blocks[1];
+    ir_compute_predecessors(function);
+
+    int type = function->instructions[call].type;
+    if (type != IR_TYPE_VOID && function->instructions[call].first_use != IR_NONE)
+    {
+        uint32_t count = vector_count(returns);
+        uint32_t *returned = vector_data_ptr(returns);
+        uint32_t result;
+        if (count == 1)
+        {
+            result = values[returned[0]];
+        }
+        else if (count)
+        {
+            result = ir_insert_before(function, call, IR_PHI, type, count);
+            for (uint32_t i = 0; i < count; i++)
+            {
+                ir_set_operand(function, result, i, values[returned[i]]);
+            }
+        }
+        else
+        {
+            // the callee never returns, the rest of the block is unreachable
+            result = ir_insert_before(function, function->blocks[1].first, IR_CONST, type, 0);
+        }
+        ir_replace_uses(function, call, result);
+    }
+    ir_remove(function, call);
+
+    vector_free(returns);
+    free(blocks);
+    free(values);
+}
+
+/**
+ * Inlines the calls the heuristic picks, callees have to be optimized already
+ */
+void inline_calls(struct inline_graph *graph, int index)
+{
+    struct ir_function *function = graph->functions[index];
+    ir_compute_predecessors(function);
+    uint32_t *depths = calloc(function->block_count, sizeof(uint32_t));
+    ssa_loop_depths(function, depths);
+
+    // inlining moves instructions to new blocks, the depths are taken first
+    struct vector *sites = vector_create(sizeof(struct inline_site));
+    for (uint32_t i = 1; i < function->instruction_count; i++)
+    {
+        struct ir_instruction *instruction = &function->instructions[i];
+        if (instruction->op == IR_CALL && instruction->block != 1)
+        {
+            struct inline_site site = {.call = i, .depth = depths[instruction->block]};
+            vector_push(sites, &site);
+        }
+    }
+    free(depths);
+
+    uint32_t size = inline_size(function);
+    struct inline_site *calls = vector_data_ptr(sites);
+    bool changed = false;
+    for (int i = 0; i < vector_count(sites); i++)
+    {
+        int callee = inline_callee(graph, function, calls[i].call);
+        if (callee < 0 || !inline_should(graph, index, &calls[i], callee, size))
+        {
+            continue;
+        }
+
+        size += graph->sizes[callee];
+        inline_call(function, calls[i].call, graph->functions[callee]);
+        changed = true;
+    }
+    vector_free(sites);
+
+    if (changed)
+    {
+        ir_remove_unreachable_blocks(function);
+    }
+}
+
+/**
+ * Returns of a call to the function itself become jumps to a new block after
+ * the entry, with a phi for each parameter. Stack slots would be shared by all
+ * the calls so functions that have any are left alone
+ */
+void inline_tail_recursion(struct ir_function *function)
+{
+    struct type *type = function->type;
+    if (type->flags & TYPE_FLAG_VARIADIC || function->instructions[function->blocks[1].last].op != IR_JUMP)
+    {
+        return;
+    }
+
+    uint32_t *params = calloc(type->param_count + 1, sizeof(uint32_t));
+    for (uint32_t i = 1; i < function->instruction_count; i++)
+    {
+        struct ir_instruction *instruction = &function->instructions[i];
+        if (instruction->op == IR_ALLOCA)
+        {
+            free(params);
+            return;
+        }
+
+        if (instruction->op == IR_PARAM)
+        {
+            params[instruction->constant] = i;
+        }
+    }
+
+    struct vector *sites = vector_create(sizeof(uint32_t));
+    for (uint32_t b = 1; b < function->block_count; b++)
+    {
+        struct ir_block *block = &function->blocks[b];
+        if (block->flags & IR_BLOCK_FLAG_DEAD || function->instructions[block->last].op != IR_RETURN)
+        {
+            continue;
+        }
+
+        uint32_t ret = block->last;
+        uint32_t call = function->instructions[ret].prev;
+        if (call == IR_NONE || function->instructions[call].op != IR_CALL || function->instructions[call].aux >= 0 ||
+            function->instructions[call].operand_count - 1 != (uint32_t)type->param_count ||
+            (function->instructions[ret].operand_count && ir_operand(function, ret, 0) != call))
+        {
+            continue;
+        }
+
+        struct ir_instruction *callee = ir_at(function, ir_operand(function, call, 0));
+        if (callee->op != IR_GLOBAL || callee->constant || !S_EQ(callee->symbol, function->name))
+        {
+            continue;
+        }
+
+        bool fits = true;
+        for (int p = 0; p < type->param_count; p++)
+        {
+            fits &= !params[p] || function->instructions[params[p]].type == ir_at(function, ir_operand(function, call, p + 1))->type;
+        }
+        if (fits)
+        {
+            vector_push(sites, &b);
+        }
+    }
+
+    if (vector_empty(sites))
+    {
+        vector_free(sites);
+        free(params);
+        return;
+    }
+
+    uint32_t body = function->blocks[1].successors[0];
+    uint32_t header = ir_block_create(function);
+    ir_append(function, header, IR_JUMP, IR_TYPE_VOID, 0);
+    function->blocks[header].successors[0] = body;
+    function->blocks[1].successors[0] = header;
+
+    uint32_t *blocks = vector_data_ptr(sites);
+    for (int i = 0; i < vector_count(sites); i++)
+    {
+        ir_remove(function, function->blocks[blocks[i]].last);
+        ir_append(function, blocks[i], IR_JUMP, IR_TYPE_VOID, 0);
+        function->blocks[blocks[i]].successors[0] = header;
+    }
+    ir_compute_predecessors(function);
+
+    // the body's edge from the entry now comes from the header, the last predecessor
+    struct ir_block *next = &function->blocks[body];
+    for (uint32_t index = next->first; index != IR_NONE && function->instructions[index].op == IR_PHI; index = function->instructions[index].next)
+    {
+        uint32_t first = ir_operand(function, index, 0);
+        for (uint32_t i = 0; i + 1 < next->pred_count; i++)
+        {
+            ir_set_operand(function, index, i, ir_operand(function, index, i + 1));
+        }
+        ir_set_operand(function, index, next->pred_count - 1, first);
+    }
+
+    struct ir_block *loop = &function->blocks[header];
+    uint32_t *phis = calloc(type->param_count + 1, sizeof(uint32_t));
+    for (int p = 0; p < type->param_count; p++)
+    {
+        if (params[p])
+        {
+            phis[p] = ir_insert_before(function, loop->first, IR_PHI, function->instructions[params[p]].type, loop->pred_count);
+            ir_replace_uses(function, params[p], phis[p]);
+        }
+    }
+
+    // arguments already refer to the phis, they are the values of the current iteration
+    for (int p = 0; p < type->param_count; p++)
+    {
+        for (uint32_t i = 0; phis[p] && i < loop->pred_count; i++)
+        {
+            uint32_t pred = function->preds[loop->preds + i];
+            uint32_t value = params[p];
+            if (pred != 1)
+            {
+                value = ir_operand(function, function->instructions[function->blocks[pred].last].prev, p + 1);
+            }
+            ir_set_operand(function, phis[p], i, value);
+        }
+    }
+
+    for (int i = 0; i < vector_count(sites); i++)
+    {
+        ir_remove(function, function->instructions[function->blocks[blocks[i]].last].prev);
+    }
+
+    vector_free(sites);
+    free(params);
+    free(phis);
+}
+
+/**
+ * Drops static functions that no longer have calls or other references once
+ * their calls were inlined
+ */
+void inline_remove_unused(struct inline_graph *graph)
+{
+    bool *reached = calloc(graph->count + 1, sizeof(bool));
+    int *stack = malloc(sizeof(int) * (graph->count + 1));
+    int top = 0;
+    for (int i = 0; i < graph->count; i++)
+    {
+        if (!graph->functions[i]->is_local || graph->address_taken[i])
+        {
+            reached[i] = true;
+            stack[top++] = i;
+        }
+    }
+
+    while (top)
+    {
+        struct ir_function *function = graph->functions[stack[--top]];
+        for (uint32_t i = 1; i < function->instruction_count; i++)
+        {
+            struct ir_instruction *instruction = &function->instructions[i];
+            int index = instruction->op == IR_GLOBAL ? inline_index(graph, instruction->symbol) : -1;
+            if (index >= 0 && !reached[index])
+            {
+                reached[index] = true;
+                stack[top++] = index;
+            }
+        }
+    }
+
+    // from the back so the indexes of the functions still to look at stay the same
+    for (int i = graph->count; i-- > 0;)
+    {
+        if (!reached[i])
+        {
+            ir_module_remove_function(graph->module, i);
+        }
+    }
+    graph->functions = vector_data_ptr(graph->module->functions);
+    graph->count = vector_count(graph->module->functions);
+
+    free(reached);
+    free(stack);
+}
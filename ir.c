@@ -0,0 +1,741 @@
+#include "compiler.h"
+#include "helpers/vector.h"
+#include <stdlib.h>
+#include <assert.h>
+
+#define IR_INITIAL_CAPACITY 64
+
+static const char *ir_op_names[IR_TOTAL] = {
+    [IR_NOP] = "nop",
+    [IR_CONST] = "const",
+    [IR_PARAM] = "param",
+    [IR_GLOBAL] = "global",
+    [IR_ALLOCA] = "alloca",
+    [IR_LOAD] = "load",
+    [IR_STORE] = "store",
+    [IR_MEMCPY] = "memcpy",
+    [IR_ZERO] = "zero",
+    [IR_ADD] = "add",
+    [IR_SUB] = "sub",
+    [IR_MUL] = "mul",
+    [IR_SDIV] = "sdiv",
+    [IR_UDIV] = "udiv",
+    [IR_SREM] = "srem",
+    [IR_UREM] = "urem",
+    [IR_AND] = "and",
+    [IR_OR] = "or",
+    [IR_XOR] = "xor",
+    [IR_SHL] = "shl",
+    [IR_SHR] = "shr",
+    [IR_SAR] = "sar",
+    [IR_NEG] = "neg",
+    [IR_NOT] = "not",
+    [IR_EQ] = "eq",
+    [IR_NE] = "ne",
+    [IR_SLT] = "slt",
+    [IR_SLE] = "sle",
+    [IR_SGT] = "sgt",
+    [IR_SGE] = "sge",
+    [IR_ULT] = "ult",
+    [IR_ULE] = "ule",
+    [IR_UGT] = "ugt",
+    [IR_UGE] = "uge",
+    [IR_SEXT] = "sext",
+    [IR_ZEXT] = "zext",
+    [IR_TRUNC] = "trunc",
+    [IR_CALL] = "call",
+    [IR_PHI] = "phi",
+    [IR_JUMP] = "jump",
+    [IR_BRANCH] = "branch",
+    [IR_RETURN] = "return"};
+
+static const char *ir_type_names[] = {
+    [IR_TYPE_VOID] = "void",
+    [IR_TYPE_I8] = "i8",
+    [IR_TYPE_I16] = "i16",
+    [IR_TYPE_I32] = "i32",
+    [IR_TYPE_I64] = "i64"};
+
+struct ir_module *ir_module_create()
+{
+    struct ir_module *module = calloc(1, sizeof(struct ir_module));
+    module->functions = vector_create(sizeof(struct ir_function *));
+    module->globals = vector_create(sizeof(struct ir_global *));
+    return module;
+}
+
+static void ir_function_free(struct ir_function *function)
+{
+    free(function->instructions);
+    free(function->uses);
+    free(function->blocks);
+    free(function->preds);
+    free(function);
+}
+
+void ir_module_free(struct ir_module *module)
+{
+    struct ir_function **functions = vector_data_ptr(module->functions);
+    for (int i = 0; i < vector_count(module->functions); i++)
+    {
+        ir_function_free(functions[i]);
+    }
+
+    struct ir_global **globals = vector_data_ptr(module->globals);
+    for (int i = 0; i < vector_count(module->globals); i++)
+    {
+        free(globals[i]->data);
+        vector_free(globals[i]->relocations);
+        free(globals[i]);
+    }
+    vector_free(module->functions);
+    vector_free(module->globals);
+    free(module);
+}
+
+/**
+ * Drops a function nothing refers to anymore, later functions move down one index
+ */
+void ir_module_remove_function(struct ir_module *module, int index)
+{
+    struct ir_function **functions = vector_data_ptr(module->functions);
+    ir_function_free(functions[index]);
+    vector_pop_at(module->functions, index);
+}
+
+struct ir_function *ir_function_create(struct ir_module *module, const char *name)
+{
+    struct ir_function *function = calloc(1, sizeof(struct ir_function));
+    function->name = name;
+    // index 0 of every array is reserved for IR_NONE
+    function->instruction_capacity = IR_INITIAL_CAPACITY;
+    function->instructions = calloc(function->instruction_capacity, sizeof(struct ir_instruction));
+    function->instruction_count = 1;
+    function->use_capacity = IR_INITIAL_CAPACITY;
+    function->uses = calloc(function->use_capacity, sizeof(struct ir_use));
+    function->use_count = 1;
+    function->block_capacity = IR_INITIAL_CAPACITY / 4;
+    function->blocks = calloc(function->block_capacity, sizeof(struct ir_block));
+    function->block_count = 1;
+    vector_push(module->functions, &function);
+    return function;
+}
+
+struct ir_global *ir_global_create(struct ir_module *module, const char *name, long size, int align)
+{
+    struct ir_global *global = calloc(1, sizeof(struct ir_global));
+    global->name = name;
+    global->size = size;
+    global->align = align;
+    global->relocations = vector_create(sizeof(struct ir_relocation));
+    vector_push(module->globals, &global);
+    return global;
+}
+
+uint32_t ir_block_create(struct ir_function *function)
+{
+    if (function->block_count == function->block_capacity)
+    {
+        function->block_capacity *= 2;
+        function->blocks = realloc(function->blocks, sizeof(struct ir_block) * function->block_capacity);
+    }
+
+    uint32_t index = function->block_count++;
+    memset(&function->blocks[index], 0, sizeof(struct ir_block));
+    return index;
+}
+
+struct ir_instruction *ir_at(struct ir_function *function, uint32_t index)
+{
+    assert(index != IR_NONE && index < function->instruction_count);
+    return &function->instructions[index];
+}
+
+static uint32_t ir_create(struct ir_function *function, int op, int type, uint32_t operand_count)
+{
+    if (function->instruction_count == function->instruction_capacity)
+    {
+        function->instruction_capacity *= 2;
+        function->instructions = realloc(function->instructions, sizeof(struct ir_instruction) * function->instruction_capacity);
+    }
+
+    if (function->use_count + operand_count > function->use_capacity)
+    {
+        while (function->use_count + operand_count > function->use_capacity)
+        {
+            function->use_capacity *= 2;
+        }
+        function->uses = realloc(function->uses, sizeof(struct ir_use) * function->use_capacity);
+    }
+
+    uint32_t index = function->instruction_count++;
+    struct ir_instruction *instruction = &function->instructions[index];
+    memset(instruction, 0, sizeof(struct ir_instruction));
+    instruction->op = op;
+    instruction->type = type;
+    instruction->operands = function->use_count;
+    instruction->operand_count = operand_count;
+    memset(&function->uses[function->use_count], 0, sizeof(struct ir_use) * operand_count);
+    for (uint32_t i = 0; i < operand_count; i++)
+    {
+        function->uses[function->use_count + i].user = index;
+    }
+    function->use_count += operand_count;
+    return index;
+}
+
+uint32_t ir_append(struct ir_function *function, uint32_t block, int op, int type, uint32_t operand_count)
+{
+    uint32_t index = ir_create(function, op, type, operand_count);
+    struct ir_block *target = &function->blocks[block];
+    struct ir_instruction *instruction = &function->instructions[index];
+    instruction->block = block;
+    instruction->prev = target->last;
+    if (target->last != IR_NONE)
+    {
+        function->instructions[target->last].next = index;
+    }
+    else
+    {
+        target->first = index;
+    }
+    target->last = index;
+    return index;
+}
+
+uint32_t ir_insert_before(struct ir_function *function, uint32_t before, int op, int type, uint32_t operand_count)
+{
+    uint32_t index = ir_create(function, op, type, operand_count);
+    struct ir_instruction *next = &function->instructions[before];
+    struct ir_instruction *instruction = &function->instructions[index];
+    instruction->block = next->block;
+    instruction->next = before;
+    instruction->prev = next->prev;
+    if (next->prev != IR_NONE)
+    {
+        function->instructions[next->prev].next = index;
+    }
+    else
+    {
+        function->blocks[next->block].first = index;
+    }
+    next->prev = index;
+    return index;
+}
+
+uint32_t ir_operand(struct ir_function *function, uint32_t index, uint32_t operand)
+{
+    struct ir_instruction *instruction = ir_at(function, index);
+    assert(operand < instruction->operand_count);
+    return function->uses[instruction->operands + operand].value;
+}
+
+static void ir_unlink_use(struct ir_function *function, uint32_t slot)
+{
+    struct ir_use *use = &function->uses[slot];
+    if (use->value == IR_NONE)
+    {
+        return;
+    }
+
+    if (use->prev != IR_NONE)
+    {
+        function->uses[use->prev].next = use->next;
+    }
+    else
+    {
+        function->instructions[use->value].first_use = use->next;
+    }
+
+    if (use->next != IR_NONE)
+    {
+        function->uses[use->next].prev = use->prev;
+    }
+    use->value = IR_NONE;
+    use->prev = IR_NONE;
+    use->next = IR_NONE;
+}
+
+void ir_set_operand(struct ir_function *function, uint32_t index, uint32_t operand, uint32_t value)
+{
+    struct ir_instruction *instruction = ir_at(function, index);
+    assert(operand < instruction->operand_count);
+    uint32_t slot = instruction->operands + operand;
+    ir_unlink_use(function, slot);
+    if (value == IR_NONE)
+    {
+        return;
+    }
+
+    struct ir_use *use = &function->uses[slot];
+    struct ir_instruction *defined = ir_at(function, value);
+    use->value = value;
+    use->next = defined->first_use;
+    if (defined->first_use != IR_NONE)
+    {
+        function->uses[defined->first_use].prev = slot;
+    }
+    defined->first_use = slot;
+}
+
+void ir_replace_uses(struct ir_function *function, uint32_t value, uint32_t replacement)
+{
+    assert(value != replacement);
+    while (function->instructions[value].first_use != IR_NONE)
+    {
+        uint32_t slot = function->instructions[value].first_use;
+        struct ir_use *use = &function->uses[slot];
+        ir_set_operand(function, use->user, slot - function->instructions[use->user].operands, replacement);
+    }
+}
+
+/**
+ * Takes the instruction out of the list of its block
+ */
+static void ir_unlink(struct ir_function *function, uint32_t index)
+{
+    struct ir_instruction *instruction = &function->instructions[index];
+    struct ir_block *block = &function->blocks[instruction->block];
+    if (instruction->prev != IR_NONE)
+    {
+        function->instructions[instruction->prev].next = instruction->next;
+    }
+    else
+    {
+        block->first = instruction->next;
+    }
+
+    if (instruction->next != IR_NONE)
+    {
+        function->instructions[instruction->next].prev = instruction->prev;
+    }
+    else
+    {
+        block->last = instruction->prev;
+    }
+    instruction->prev = IR_NONE;
+    instruction->next = IR_NONE;
+}
+
+/**
+ * Unlinks the instruction from its block and drops its operands, its own uses must be gone
+ */
+void ir_remove(struct ir_function *function, uint32_t index)
+{
+    struct ir_instruction *instruction = ir_at(function, index);
+    assert(instruction->first_use == IR_NONE);
+    for (uint32_t i = 0; i < instruction->operand_count; i++)
+    {
+        ir_unlink_use(function, instruction->operands + i);
+    }
+
+    ir_unlink(function, index);
+    instruction->op = IR_NOP;
+    instruction->operand_count = 0;
+}
+
+/**
+ * Moves the instruction in front of another one, which may be in another block
+ */
+void ir_move_before(struct ir_function *function, uint32_t index, uint32_t before)
+{
+    ir_unlink(function, index);
+    struct ir_instruction *next = &function->instructions[before];
+    struct ir_instruction *instruction = &function->instructions[index];
+    instruction->block = next->block;
+    instruction->next = before;
+    instruction->prev = next->prev;
+    if (next->prev != IR_NONE)
+    {
+        function->instructions[next->prev].next = index;
+    }
+    else
+    {
+        function->blocks[next->block].first = index;
+    }
+    next->prev = index;
+}
+
+bool ir_is_terminator(int op)
+{
+    return op == IR_JUMP || op == IR_BRANCH || op == IR_RETURN;
+}
+
+int ir_type_size(int type)
+{
+    static const int sizes[] = {
+        [IR_TYPE_VOID] = 0,
+        [IR_TYPE_I8] = 1,
+        [IR_TYPE_I16] = 2,
+        [IR_TYPE_I32] = 4,
+        [IR_TYPE_I64] = 8};
+    return sizes[type];
+}
+
+/**
+ * Fills block->preds from the successors with a counting sort, predecessors
+ * end up ordered by block index
+ */
+void ir_compute_predecessors(struct ir_function *function)
+{
+    uint32_t total = 0;
+    for (uint32_t i = 1; i < function->block_count; i++)
+    {
+        function->blocks[i].pred_count = 0;
+    }
+
+    for (uint32_t i = 1; i < function->block_count; i++)
+    {
+        struct ir_block *block = &function->blocks[i];
+        if (block->flags & IR_BLOCK_FLAG_DEAD)
+        {
+            continue;
+        }
+
+        for (int s = 0; s < 2; s++)
+        {
+            if (block->successors[s] != IR_NONE)
+            {
+                function->blocks[block->successors[s]].pred_count++;
+                total++;
+            }
+        }
+    }
+
+    if (total > function->pred_capacity)
+    {
+        function->pred_capacity = total;
+        function->preds = realloc(function->preds, sizeof(uint32_t) * total);
+    }
+    function->pred_count = total;
+
+    uint32_t start = 0;
+    for (uint32_t i = 1; i < function->block_count; i++)
+    {
+        function->blocks[i].preds = start;
+        start += function->blocks[i].pred_count;
+        function->blocks[i].pred_count = 0;
+    }
+
+    for (uint32_t i = 1; i < function->block_count; i++)
+    {
+        struct ir_block *block = &function->blocks[i];
+        if (block->flags & IR_BLOCK_FLAG_DEAD)
+        {
+            continue;
+        }
+
+        for (int s = 0; s < 2; s++)
+        {
+            if (block->successors[s] != IR_NONE)
+            {
+                struct ir_block *successor = &function->blocks[block->successors[s]];
+                function->preds[successor->preds + successor->pred_count++] = i;
+            }
+        }
+    }
+}
+
+/**
+ * Drops the phi operands that belong to dead predecessors, keeping the order of the rest
+ */
+static void ir_prune_phis(struct ir_function *function, uint32_t block)
+{
+    struct ir_block *target = &function->blocks[block];
+    for (uint32_t index = target->first; index != IR_NONE && function->instructions[index].op == IR_PHI; index = function->instructions[index].next)
+    {
+        uint32_t kept = 0;
+        for (uint32_t i = 0; i < target->pred_count; i++)
+        {
+            uint32_t pred = function->preds[target->preds + i];
+            uint32_t value = ir_operand(function, index, i);
+            if (function->blocks[pred].flags & IR_BLOCK_FLAG_DEAD)
+            {
+                continue;
+            }
+            ir_set_operand(function, index, kept++, value);
+        }
+
+        for (uint32_t i = kept; i < target->pred_count; i++)
+        {
+            ir_set_operand(function, index, i, IR_NONE);
+        }
+        function->instructions[index].operand_count = kept;
+    }
+}
+
+/**
+ * Marks blocks that cannot be reached from the entry dead and removes their instructions
+ */
+void ir_remove_unreachable_blocks(struct ir_function *function)
+{
+    uint32_t count = function->block_count;
+    bool *reached = calloc(count, sizeof(bool));
+    uint32_t *stack = malloc(sizeof(uint32_t) * count);
+    uint32_t top = 0;
+    stack[top++] = 1;
+    reached[1] = true;
+    while (top)
+    {
+        struct ir_block *block = &function->blocks[stack[--top]];
+        for (int s = 0; s < 2; s++)
+        {
+            uint32_t successor = block->successors[s];
+            if (successor != IR_NONE && !reached[successor])
+            {
+                reached[successor] = true;
+                stack[top++] = successor;
+            }
+        }
+    }
+
+    ir_compute_predecessors(function);
+    bool removed = false;
+    for (uint32_t i = 1; i < count; i++)
+    {
+        struct ir_block *block = &function->blocks[i];
+        if (reached[i] || (block->flags & IR_BLOCK_FLAG_DEAD))
+        {
+            continue;
+        }
+        block->flags |= IR_BLOCK_FLAG_DEAD;
+        removed = true;
+    }
+
+    if (removed)
+    {
+        for (uint32_t i = 1; i < count; i++)
+        {
+            if (reached[i])
+            {
+                ir_prune_phis(function, i);
+            }
+        }
+
+        // values of dead blocks are only used inside dead blocks
+        for (uint32_t i = 1; i < count; i++)
+        {
+            struct ir_block *block = &function->blocks[i];
+            if (reached[i])
+            {
+                continue;
+            }
+
+            for (uint32_t index = block->first; index != IR_NONE; index = function->instructions[index].next)
+            {
+                struct ir_instruction *instruction = &function->instructions[index];
+                for (uint32_t o = 0; o < instruction->operand_count; o++)
+                {
+                    ir_set_operand(function, index, o, IR_NONE);
+                }
+            }
+
+            while (block->last != IR_NONE)
+            {
+                uint32_t last = block->last;
+                function->instructions[last].first_use = IR_NONE;
+                ir_remove(function, last);
+            }
+            block->successors[0] = IR_NONE;
+            block->successors[1] = IR_NONE;
+        }
+        ir_compute_predecessors(function);
+    }
+
+    free(reached);
+    free(stack);
+}
+
+/**
+ * Drops one edge from the block to the successor together with its predecessor
+ * entry and the phi operands that go with it, the order of the rest is kept
+ */
+void ir_remove_edge(struct ir_function *function, uint32_t from, uint32_t to)
+{
+    struct ir_block *target = &function->blocks[to];
+    uint32_t slot = 0;
+    while (function->preds[target->preds + slot] != from)
+    {
+        slot++;
+        assert(slot < target->pred_count);
+    }
+
+    for (uint32_t index = target->first; index != IR_NONE && function->instructions[index].op == IR_PHI; index = function->instructions[index].next)
+    {
+        for (uint32_t i = slot; i + 1 < target->pred_count; i++)
+        {
+            ir_set_operand(function, index, i, ir_operand(function, index, i + 1));
+        }
+        ir_set_operand(function, index, target->pred_count - 1, IR_NONE);
+        function->instructions[index].operand_count--;
+    }
+
+    for (uint32_t i = slot; i + 1 < target->pred_count; i++)
+    {
+        function->preds[target->preds + i] = function->preds[target->preds + i + 1];
+    }
+    target->pred_count--;
+}
+
+/**
+ * Turns the branch that ends the block into a jump to one of its two successors
+ */
+void ir_branch_to_jump(struct ir_function *function, uint32_t block, int successor)
+{
+    struct ir_block *target = &function->blocks[block];
+    uint32_t branch = target->last;
+    assert(function->instructions[branch].op == IR_BRANCH);
+    uint32_t kept = target->successors[successor];
+    ir_remove_edge(function, block, target->successors[1 - successor]);
+    ir_set_operand(function, branch, 0, IR_NONE);
+    function->instructions[branch].op = IR_JUMP;
+    function->instructions[branch].operand_count = 0;
+    target->successors[0] = kept;
+    target->successors[1] = IR_NONE;
+}
+
+static void ir_dump_instruction(struct ir_function *function, uint32_t index, FILE *out)
+{
+    struct ir_instruction *instruction = ir_at(function, index);
+    fprintf(out, "    ");
+    if (instruction->type != IR_TYPE_VOID)
+    {
+        fprintf(out, "%%%u = ", index);
+    }
+    fprintf(out, "%s", ir_op_names[instruction->op]);
+    bool arithmetic = instruction->op == IR_ADD || instruction->op == IR_SUB || instruction->op == IR_MUL || instruction->op == IR_SHL;
+    if (arithmetic && (instruction->aux & IR_FLAG_NO_SIGNED_WRAP))
+    {
+        fprintf(out, " nsw");
+    }
+    if (instruction->type != IR_TYPE_VOID)
+    {
+        fprintf(out, " %s", ir_type_names[instruction->type]);
+    }
+
+    switch (instruction->op)
+    {
+    case IR_CONST:
+    case IR_PARAM:
+        fprintf(out, " %lld", instruction->constant);
+        break;
+
+    case IR_GLOBAL:
+        fprintf(out, " @%s", instruction->symbol);
+        if (instruction->constant)
+        {
+            fprintf(out, "%+lld", instruction->constant);
+        }
+        break;
+
+    case IR_ALLOCA:
+        fprintf(out, " %lld, align %i", instruction->constant, instruction->aux);
+        break;
+    }
+
+    struct ir_block *block = &function->blocks[instruction->block];
+    for (uint32_t i = 0; i < instruction->operand_count; i++)
+    {
+        fprintf(out, i == 0 ? " " : ", ");
+        uint32_t value = ir_operand(function, index, i);
+        if (value == IR_NONE)
+        {
+            fprintf(out, "undef");
+        }
+        else
+        {
+            fprintf(out, "%%%u", value);
+        }
+
+        if (instruction->op == IR_PHI)
+        {
+            fprintf(out, " b%u", function->preds[block->preds + i]);
+        }
+    }
+
+    if (instruction->op == IR_MEMCPY || instruction->op == IR_ZERO)
+    {
+        fprintf(out, ", %lld", instruction->constant);
+    }
+
+    if (instruction->op == IR_JUMP)
+    {
+        fprintf(out, " b%u", block->successors[0]);
+    }
+    else if (instruction->op == IR_BRANCH)
+    {
+        fprintf(out, ", b%u, b%u", block->successors[0], block->successors[1]);
+    }
+    fprintf(out, "\n");
+}
+
+static void ir_dump_function(struct ir_function *function, FILE *out)
+{
+    fprintf(out, "function %s%s\n", function->is_local ? "static " : "", function->name);
+    for (uint32_t i = 1; i < function->block_count; i++)
+    {
+        struct ir_block *block = &function->blocks[i];
+        if (block->flags & IR_BLOCK_FLAG_DEAD)
+        {
+            continue;
+        }
+
+        fprintf(out, "b%u:", i);
+        if (block->pred_count)
+        {
+            fprintf(out, " ; preds");
+            for (uint32_t p = 0; p < block->pred_count; p++)
+            {
+                fprintf(out, " b%u", function->preds[block->preds + p]);
+            }
+        }
+        fprintf(out, "\n");
+
+        for (uint32_t index = block->first; index != IR_NONE; index = function->instructions[index].next)
+        {
+            ir_dump_instruction(function, index, out);
+        }
+    }
+    fprintf(out, "\n");
+}
+
+static void ir_dump_global(struct ir_global *global, FILE *out)
+{
+    fprintf(out, "global %s%s %li, align %i", global->is_local ? "static " : "", global->name, global->size, global->align);
+    if (global->data)
+    {
+        fprintf(out, " = [");
+        for (long i = 0; i < global->size; i++)
+        {
+            fprintf(out, i ? " %02x" : "%02x", global->data[i]);
+        }
+        fprintf(out, "]");
+    }
+
+    struct ir_relocation *relocations = vector_data_ptr(global->relocations);
+    for (int i = 0; i < vector_count(global->relocations); i++)
+    {
+        fprintf(out, " @%li = %s%+lld", relocations[i].offset, relocations[i].symbol, relocations[i].addend);
+    }
+    fprintf(out, "\n");
+}
+
+void ir_dump(struct ir_module *module, FILE *out)
+{
+    struct ir_global **globals = vector_data_ptr(module->globals);
+    for (int i = 0; i < vector_count(module->globals); i++)
+    {
+        ir_dump_global(globals[i], out);
+    }
+
+    if (vector_count(module->globals))
+    {
+        fprintf(out, "\n");
+    }
+
+    struct ir_function **functions = vector_data_ptr(module->functions);
+    for (int i = 0; i < vector_count(module->functions); i++)
+    {
+        ir_dump_function(functions[i], out);
+    }
+}
@@ -0,0 +1,1672 @@
+#include "compiler.h"
+#include "helpers/vector.h"
+#include "helpers/hashmap.h"
+#include "helpers/intern.h"
+#include <stdlib.h>
+
+// variables that were never initialized in one module of ir_builder_finish
+#define IR_BUILDER_FINISH_BATCH 256
+
+/**
+ * Lowers the typed tree to IR. Every local variable gets a stack slot that is
+ * read and written with loads and stores, ssa_construct then turns the slots
+ * whose address is never taken into SSA values
+ */
+struct ir_builder
+{
+    struct compile_process *compiler;
+    struct node_pool *pool;
+    struct type_table *types;
+    struct ir_module *module;
+
+    struct ir_function *function;
+    // block new instructions are appended to
+    uint32_t block;
+    // node being lowered, for error positions
+    uint32_t node;
+    // stack slot of local variables and block of case and default markers, by node
+    uint32_t *node_values;
+    uint32_t node_values_capacity;
+    // one past the highest node the values were sized for
+    uint32_t node_values_end;
+    // names of static local variables, by node index
+    struct hashmap *statics;
+    // string literals and static locals named so far, the names go on across modules
+    int string_count;
+    int static_count;
+
+    // when building one declaration at a time: names of the file scope variables
+    // emitted with their initializer, and the last tentative definition of every other
+    // variable by name with the names in the order they first appeared
+    struct hashmap *initialized;
+    struct hashmap *tentatives;
+    struct vector *tentative_names;
+    // tentative names ir_builder_finish got through
+    size_t finished;
+    // blocks of the labels of the current function, by name
+    struct hashmap *labels;
+    uint32_t break_block;
+    uint32_t continue_block;
+    struct type *return_type;
+    // operators of the a + b + c chains and end blocks of the else if chains
+    // being built, each chain pops back to where it started
+    struct vector *operators;
+    struct vector *if_ends;
+};
+
+static uint32_t ir_build_expression(struct ir_builder *builder, uint32_t index);
+static uint32_t ir_build_address(struct ir_builder *builder, uint32_t index);
+static void ir_build_statement(struct ir_builder *builder, uint32_t index);
+static void ir_build_global(struct ir_builder *builder, uint32_t index, const char *name, bool is_local);
+
+static struct compile_process *ir_builder_error_position(struct ir_builder *builder)
+{
+    builder->compiler->pos = node_at(builder->pool, builder->node)->pos;
+    return builder->compiler;
+}
+
+static struct type *ir_builder_type_of(struct ir_builder *builder, uint32_t index)
+{
+    return builder->compiler->node_types[index];
+}
+
+static struct type *ir_builder_long(struct ir_builder *builder)
+{
+    return type_get_basic(builder->types, TYPE_LONG, 0);
+}
+
+/**
+ * Arrays, structs and functions are used through their address
+ */
+static bool ir_builder_is_aggregate(struct type *type)
+{
+    return type->kind == TYPE_ARRAY || type->kind == TYPE_STRUCT || type->kind == TYPE_UNION || type->kind == TYPE_FUNCTION;
+}
+
+static int ir_builder_type(struct ir_builder *builder, struct type *type)
+{
+    switch (type->kind)
+    {
+    case TYPE_VOID:
+        return IR_TYPE_VOID;
+    case TYPE_CHAR:
+        return IR_TYPE_I8;
+    case TYPE_SHORT:
+        return IR_TYPE_I16;
+    case TYPE_INT:
+        return IR_TYPE_I32;
+    case TYPE_FLOAT:
+    case TYPE_DOUBLE:
+        compiler_error(ir_builder_error_position(builder), "Floating point types are not supported yet\n");
+    }
+    return IR_TYPE_I64;
+}
+
+static uint32_t ir_builder_emit(struct ir_builder *builder, int op, int type, uint32_t operand_count)
+{
+    return ir_append(builder->function, builder->block, op, type, operand_count);
+}
+
+/**
+ * Constants are kept sign extended from their width
+ */
+static uint32_t ir_builder_const(struct ir_builder *builder, int type, long long value)
+{
+    int shift = 64 - ir_type_size(type) * 8;
+    uint32_t index = ir_builder_emit(builder, IR_CONST, type, 0);
+    ir_at(builder->function, index)->constant = shift ? (long long)((unsigned long long)value << shift) >> shift : value;
+    return index;
+}
+
+static uint32_t ir_builder_unary(struct ir_builder *builder, int op, int type, uint32_t value)
+{
+    uint32_t index = ir_builder_emit(builder, op, type, 1);
+    ir_set_operand(builder->function, index, 0, value);
+    return index;
+}
+
+static uint32_t ir_builder_binary(struct ir_builder *builder, int op, int type, uint32_t left, uint32_t right)
+{
+    uint32_t index = ir_builder_emit(builder, op, type, 2);
+    ir_set_operand(builder->function, index, 0, left);
+    ir_set_operand(builder->function, index, 1, right);
+    return index;
+}
+
+static uint32_t ir_builder_load(struct ir_builder *builder, int type, uint32_t address)
+{
+    return ir_builder_unary(builder, IR_LOAD, type, address);
+}
+
+static void ir_builder_store(struct ir_builder *builder, uint32_t address, uint32_t value)
+{
+    ir_builder_binary(builder, IR_STORE, IR_TYPE_VOID, address, value);
+}
+
+static void ir_builder_memory(struct ir_builder *builder, int op, uint32_t destination, uint32_t source, long size)
+{
+    uint32_t index = ir_builder_emit(builder, op, IR_TYPE_VOID, op == IR_MEMCPY ? 2 : 1);
+    ir_set_operand(builder->function, index, 0, destination);
+    if (op == IR_MEMCPY)
+    {
+        ir_set_operand(builder->function, index, 1, source);
+    }
+    ir_at(builder->function, index)->constant = size;
+}
+
+static uint32_t ir_builder_global(struct ir_builder *builder, const char *symbol)
+{
+    uint32_t index = ir_builder_emit(builder, IR_GLOBAL, IR_TYPE_I64, 0);
+    ir_at(builder->function, index)->symbol = symbol;
+    return index;
+}
+
+/**
+ * Stack slots all live in the entry block so they exist for the whole function
+ */
+static uint32_t ir_builder_slot(struct ir_builder *builder, struct type *type)
+{
+    uint32_t index = ir_append(builder->function, 1, IR_ALLOCA, IR_TYPE_I64, 0);
+    struct ir_instruction *instruction = ir_at(builder->function, index);
+    instruction->constant = type->size;
+    instruction->aux = type->align;
+    return index;
+}
+
+static uint32_t ir_builder_load_type(struct ir_builder *builder, struct type *type, uint32_t address)
+{
+    if (ir_builder_is_aggregate(type))
+    {
+        return address;
+    }
+    return ir_builder_load(builder, ir_builder_type(builder, type), address);
+}
+
+static bool ir_builder_is_terminated(struct ir_builder *builder)
+{
+    uint32_t last = builder->function->blocks[builder->block].last;
+    return last != IR_NONE && ir_is_terminator(ir_at(builder->function, last)->op);
+}
+
+static void ir_builder_jump(struct ir_builder *builder, uint32_t target)
+{
+    if (ir_builder_is_terminated(builder))
+    {
+        return;
+    }
+    ir_builder_emit(builder, IR_JUMP, IR_TYPE_VOID, 0);
+    builder->function->blocks[builder->block].successors[0] = target;
+}
+
+static void ir_builder_branch(struct ir_builder *builder, uint32_t condition, uint32_t true_block, uint32_t false_block)
+{
+    ir_builder_unary(builder, IR_BRANCH, IR_TYPE_VOID, condition);
+    struct ir_block *block = &builder->function->blocks[builder->block];
+    block->successors[0] = true_block;
+    block->successors[1] = false_block;
+}
+
+/**
+ * Code after a jump still needs a block, it has no predecessors until something jumps to it
+ */
+static void ir_builder_start(struct ir_builder *builder, uint32_t block)
+{
+    builder->block = block;
+}
+
+static void ir_builder_start_unreachable(struct ir_builder *builder)
+{
+    ir_builder_start(builder, ir_block_create(builder->function));
+}
+
+static uint32_t ir_builder_convert(struct ir_builder *builder, uint32_t value, struct type *from, struct type *to)
+{
+    from = type_decay(builder->types, from);
+    if (to->kind == TYPE_VOID)
+    {
+        return value;
+    }
+
+    int from_type = ir_builder_type(builder, from);
+    int to_type = ir_builder_type(builder, to);
+    if (from_type == to_type)
+    {
+        return value;
+    }
+
+    if (ir_type_size(to_type) < ir_type_size(from_type))
+    {
+        return ir_builder_unary(builder, IR_TRUNC, to_type, value);
+    }
+    return ir_builder_unary(builder, type_is_unsigned(from) ? IR_ZEXT : IR_SEXT, to_type, value);
+}
+
+static uint32_t ir_builder_value_as(struct ir_builder *builder, uint32_t index, struct type *type)
+{
+    uint32_t value = ir_build_expression(builder, index);
+    return ir_builder_convert(builder, value, ir_builder_type_of(builder, index), type);
+}
+
+/**
+ * Symbol of a global, static local or function declaration
+ */
+static const char *ir_builder_symbol(struct ir_builder *builder, uint32_t declaration)
+{
+    char key[16];
+    snprintf(key, sizeof(key), "%u", declaration);
+    const char *name = hashmap_get(builder->statics, key);
+    return name ? name : node_at(builder->pool, declaration)->sval;
+}
+
+static const char *ir_builder_name(struct ir_builder *builder, const char *format, const char *name, int number)
+{
+    char buffer[256];
+    int length = snprintf(buffer, sizeof(buffer), format, name, number);
+    return intern_table_add(builder->compiler->identifiers, buffer, length);
+}
+
+/**
+ * Each string literal becomes a local global holding its bytes
+ */
+static const char *ir_builder_string(struct ir_builder *builder, uint32_t index)
+{
+    struct node *node = node_at(builder->pool, index);
+    long size = node->string.length + 1;
+    const char *name = ir_builder_name(builder, "%s%i", ".L.str.", builder->module->string_count++);
+    struct ir_global *global = ir_global_create(builder->module, name, size, 1);
+    global->is_local = true;
+    global->data = malloc(size);
+    memcpy(global->data, node->sval, size);
+    return name;
+}
+
+/**
+ * pointer + offset * scale with the offset widened to 64 bits first
+ */
+static uint32_t ir_builder_offset(struct ir_builder *builder, int op, uint32_t pointer, uint32_t offset, struct type *offset_type, long scale)
+{
+    offset = ir_builder_convert(builder, offset, offset_type, ir_builder_long(builder));
+    if (scale != 1)
+    {
+        offset = ir_builder_binary(builder, IR_MUL, IR_TYPE_I64, offset, ir_builder_const(builder, IR_TYPE_I64, scale));
+    }
+    return ir_builder_binary(builder, op, IR_TYPE_I64, pointer, offset);
+}
+
+static uint32_t ir_builder_member_address(struct ir_builder *builder, uint32_t address, long offset)
+{
+    if (offset == 0)
+    {
+        return address;
+    }
+    return ir_builder_binary(builder, IR_ADD, IR_TYPE_I64, address, ir_builder_const(builder, IR_TYPE_I64, offset));
+}
+
+// IR opcodes of the binary operators, signed and unsigned
+static const int ir_builder_signed_ops[OP_TOTAL] = {
+    [OP_PLUS] = IR_ADD,
+    [OP_MINUS] = IR_SUB,
+    [OP_STAR] = IR_MUL,
+    [OP_SLASH] = IR_SDIV,
+    [OP_PERCENT] = IR_SREM,
+    [OP_AMPERSAND] = IR_AND,
+    [OP_PIPE] = IR_OR,
+    [OP_CARET] = IR_XOR,
+    [OP_SHIFT_LEFT] = IR_SHL,
+    [OP_SHIFT_RIGHT] = IR_SAR,
+    [OP_LESS] = IR_SLT,
+    [OP_GREATER] = IR_SGT,
+    [OP_LESS_EQUAL] = IR_SLE,
+    [OP_GREATER_EQUAL] = IR_SGE,
+    [OP_EQUAL] = IR_EQ,
+    [OP_NOT_EQUAL] = IR_NE};
+
+static const int ir_builder_unsigned_ops[OP_TOTAL] = {
+    [OP_PLUS] = IR_ADD,
+    [OP_MINUS] = IR_SUB,
+    [OP_STAR] = IR_MUL,
+    [OP_SLASH] = IR_UDIV,
+    [OP_PERCENT] = IR_UREM,
+    [OP_AMPERSAND] = IR_AND,
+    [OP_PIPE] = IR_OR,
+    [OP_CARET] = IR_XOR,
+    [OP_SHIFT_LEFT] = IR_SHL,
+    [OP_SHIFT_RIGHT] = IR_SHR,
+    [OP_LESS] = IR_ULT,
+    [OP_GREATER] = IR_UGT,
+    [OP_LESS_EQUAL] = IR_ULE,
+    [OP_GREATER_EQUAL] = IR_UGE,
+    [OP_EQUAL] = IR_EQ,
+    [OP_NOT_EQUAL] = IR_NE};
+
+// compound assignments and the operator they apply
+static const int ir_builder_compound_ops[OP_TOTAL] = {
+    [OP_PLUS_ASSIGN] = OP_PLUS,
+    [OP_MINUS_ASSIGN] = OP_MINUS,
+    [OP_MUL_ASSIGN] = OP_STAR,
+    [OP_DIV_ASSIGN] = OP_SLASH,
+    [OP_MOD_ASSIGN] = OP_PERCENT,
+    [OP_XOR_ASSIGN] = OP_CARET,
+    [OP_AND_ASSIGN] = OP_AMPERSAND,
+    [OP_OR_ASSIGN] = OP_PIPE,
+    [OP_SHIFT_LEFT_ASSIGN] = OP_SHIFT_LEFT,
+    [OP_SHIFT_RIGHT_ASSIGN] = OP_SHIFT_RIGHT};
+
+static bool ir_builder_is_comparison(int op)
+{
+    return op == OP_LESS || op == OP_GREATER || op == OP_LESS_EQUAL || op == OP_GREATER_EQUAL || op == OP_EQUAL || op == OP_NOT_EQUAL;
+}
+
+/**
+ * Applies a binary operator to two values of the given types, the type of the
+ * result is returned through result_type
+ */
+static uint32_t ir_builder_operation(struct ir_builder *builder, int op, uint32_t left, struct type *left_type, uint32_t right, struct type *right_type, struct type **result_type)
+{
+    left_type = type_decay(builder->types, left_type);
+    right_type = type_decay(builder->types, right_type);
+    bool left_pointer = left_type->kind == TYPE_POINTER;
+    bool right_pointer = right_type->kind == TYPE_POINTER;
+    int ir_op = IR_ADD;
+    if ((op == OP_PLUS || op == OP_MINUS) && left_pointer && !right_pointer)
+    {
+        *result_type = left_type;
+        return ir_builder_offset(builder, op == OP_PLUS ? IR_ADD : IR_SUB, left, right, right_type, left_type->base->size);
+    }
+
+    if (op == OP_PLUS && right_pointer)
+    {
+        *result_type = right_type;
+        return ir_builder_offset(builder, IR_ADD, right, left, left_type, right_type->base->size);
+    }
+
+    if (op == OP_MINUS && left_pointer && right_pointer)
+    {
+        *result_type = ir_builder_long(builder);
+        uint32_t difference = ir_builder_binary(builder, IR_SUB, IR_TYPE_I64, left, right);
+        long size = left_type->base->size;
+        if (size == 1)
+        {
+            return difference;
+        }
+        return ir_builder_binary(builder, IR_SDIV, IR_TYPE_I64, difference, ir_builder_const(builder, IR_TYPE_I64, size));
+    }
+
+    struct type *type;
+    if (ir_builder_is_comparison(op))
+    {
+        // pointers compare as unsigned 64 bit numbers
+        type = left_pointer || right_pointer ? type_get_basic(builder->types, TYPE_LONG, TYPE_FLAG_UNSIGNED) : type_common(builder->types, left_type, right_type);
+        *result_type = type_get_basic(builder->types, TYPE_INT, 0);
+    }
+    else if (op == OP_SHIFT_LEFT || op == OP_SHIFT_RIGHT)
+    {
+        type = type_promote(builder->types, left_type);
+        *result_type = type;
+    }
+    else
+    {
+        type = type_common(builder->types, left_type, right_type);
+        *result_type = type;
+    }
+
+    left = ir_builder_convert(builder, left, left_type, type);
+    right = ir_builder_convert(builder, right, right_type, type);
+    ir_op = type_is_unsigned(type) ? ir_builder_unsigned_ops[op] : ir_builder_signed_ops[op];
+    uint32_t value = ir_builder_binary(builder, ir_op, ir_builder_type(builder, *result_type), left, right);
+    if (!type_is_unsigned(type) && (ir_op == IR_ADD || ir_op == IR_SUB || ir_op == IR_MUL))
+    {
+        ir_at(builder->function, value)->aux = IR_FLAG_NO_SIGNED_WRAP;
+    }
+    return value;
+}
+
+static uint32_t ir_build_identifier_address(struct ir_builder *builder, uint32_t index)
+{
+    uint32_t declaration = node_at(builder->pool, index)->declaration;
+    if (declaration == IR_NONE)
+    {
+        // a function that was never declared
+        return ir_builder_global(builder, node_at(builder->pool, index)->sval);
+    }
+
+    if (builder->node_values[declaration] != IR_NONE)
+    {
+        return builder->node_values[declaration];
+    }
+    return ir_builder_global(builder, ir_builder_symbol(builder, declaration));
+}
+
+static uint32_t ir_build_address(struct ir_builder *builder, uint32_t index)
+{
+    struct node *node = node_at(builder->pool, index);
+    builder->node = index;
+    switch (node->type)
+    {
+    case NODE_TYPE_IDENTIFIER:
+        return ir_build_identifier_address(builder, index);
+
+    case NODE_TYPE_STRING:
+        return ir_builder_global(builder, ir_builder_string(builder, index));
+
+    case NODE_TYPE_UNARY:
+        if (node->op == OP_STAR)
+        {
+            return ir_build_expression(builder, node->unary.operand);
+        }
+        break;
+
+    case NODE_TYPE_SUBSCRIPT:
+    {
+        uint32_t left = node->exp.left;
+        uint32_t right = node->exp.right;
+        struct type *left_type = type_decay(builder->types, ir_builder_type_of(builder, left));
+        if (left_type->kind != TYPE_POINTER)
+        {
+            // index[pointer]
+            uint32_t swap = left;
+            left = right;
+            right = swap;
+        }
+
+        struct type *type = ir_builder_type_of(builder, index);
+        uint32_t pointer = ir_build_expression(builder, left);
+        uint32_t offset = ir_build_expression(builder, right);
+        return ir_builder_offset(builder, IR_ADD, pointer, offset, ir_builder_type_of(builder, right), type->size);
+    }
+
+    case NODE_TYPE_MEMBER:
+    {
+        uint32_t operand = node->unary.operand;
+        struct type *type = ir_builder_type_of(builder, node->declaration);
+        const char *name = node->sval;
+        uint32_t address = node->op == OP_ARROW ? ir_build_expression(builder, operand) : ir_build_address(builder, operand);
+        return ir_builder_member_address(builder, address, type_find_member(type, name)->offset);
+    }
+    }
+
+    if (ir_builder_is_aggregate(ir_builder_type_of(builder, index)))
+    {
+        // struct valued expressions already produce an address
+        return ir_build_expression(builder, index);
+    }
+
+    compiler_error(ir_builder_error_position(builder), "Expression has no address\n");
+    return IR_NONE;
+}
+
+static uint32_t ir_build_increment(struct ir_builder *builder, uint32_t index, bool postfix)
+{
+    struct node *node = node_at(builder->pool, index);
+    int op = node->op == OP_INCREMENT ? IR_ADD : IR_SUB;
+    struct type *type = ir_builder_type_of(builder, node->unary.operand);
+    int ir_type = ir_builder_type(builder, type);
+    uint32_t address = ir_build_address(builder, node->unary.operand);
+    uint32_t old = ir_builder_load(builder, ir_type, address);
+    long step = type->kind == TYPE_POINTER ? type->base->size : 1;
+    uint32_t value = ir_builder_binary(builder, op, ir_type, old, ir_builder_const(builder, ir_type, step));
+    // char and short wrap in their own width, int and long may not overflow
+    if (type->kind != TYPE_POINTER && !type_is_unsigned(type) && ir_type_size(ir_type) >= 4)
+    {
+        ir_at(builder->function, value)->aux = IR_FLAG_NO_SIGNED_WRAP;
+    }
+    ir_builder_store(builder, address, value);
+    return postfix ? old : value;
+}
+
+/**
+ * A 0 or 1 int for any scalar value
+ */
+static uint32_t ir_builder_truth(struct ir_builder *builder, uint32_t index)
+{
+    uint32_t value = ir_build_expression(builder, index);
+    int type = ir_at(builder->function, value)->type;
+    return ir_builder_binary(builder, IR_NE, IR_TYPE_I32, value, ir_builder_const(builder, type, 0));
+}
+
+/**
+ * && and || store their result in a stack slot from both paths, the slot
+ * becomes a phi once the function is in SSA form. The left operand is built
+ * by the caller, the slot is set right before branching on it so it is not
+ * live across the blocks of the left operand
+ */
+static uint32_t ir_build_logical(struct ir_builder *builder, uint32_t index, uint32_t left)
+{
+    struct node *node = node_at(builder->pool, index);
+    bool is_and = node->op == OP_LOGICAL_AND;
+    uint32_t right = node->exp.right;
+    struct type *type = type_get_basic(builder->types, TYPE_INT, 0);
+    uint32_t slot = ir_builder_slot(builder, type);
+    uint32_t right_block = ir_block_create(builder->function);
+    uint32_t end_block = ir_block_create(builder->function);
+
+    // between a comparison and the branch on it the constant would keep them from fusing
+    uint32_t constant = ir_builder_const(builder, IR_TYPE_I32, is_and ? 0 : 1);
+    if (ir_at(builder->function, left)->next == constant)
+    {
+        ir_move_before(builder->function, constant, left);
+    }
+    ir_builder_store(builder, slot, constant);
+    if (is_and)
+    {
+        ir_builder_branch(builder, left, right_block, end_block);
+    }
+    else
+    {
+        ir_builder_branch(builder, left, end_block, right_block);
+    }
+
+    ir_builder_start(builder, right_block);
+    ir_builder_store(builder, slot, ir_builder_truth(builder, right));
+    ir_builder_jump(builder, end_block);
+
+    ir_builder_start(builder, end_block);
+    return ir_builder_load(builder, IR_TYPE_I32, slot);
+}
+
+static uint32_t ir_build_ternary(struct ir_builder *builder, uint32_t index)
+{
+    struct node *node = node_at(builder->pool, index);
+    uint32_t true_exp = node->ternary.true_exp;
+    uint32_t false_exp = node->ternary.false_exp;
+    struct type *type = ir_builder_type_of(builder, index);
+    bool has_value = type->kind != TYPE_VOID;
+    // aggregates pass their address through the slot
+    struct type *slot_type = ir_builder_is_aggregate(type) ? type_get_pointer(builder->types, type) : type;
+    uint32_t slot = has_value ? ir_builder_slot(builder, slot_type) : IR_NONE;
+    uint32_t true_block = ir_block_create(builder->function);
+    uint32_t false_block = ir_block_create(builder->function);
+    uint32_t end_block = ir_block_create(builder->function);
+
+    ir_builder_branch(builder, ir_build_expression(builder, node->ternary.condition), true_block, false_block);
+    uint32_t branches[2] = {true_exp, false_exp};
+    uint32_t blocks[2] = {true_block, false_block};
+    for (int i = 0; i < 2; i++)
+    {
+        ir_builder_start(builder, blocks[i]);
+        uint32_t value = ir_build_expression(builder, branches[i]);
+        if (has_value)
+        {
+            ir_builder_store(builder, slot, ir_builder_convert(builder, value, ir_builder_type_of(builder, branches[i]), slot_type));
+        }
+        ir_builder_jump(builder, end_block);
+    }
+
+    ir_builder_start(builder, end_block);
+    return has_value ? ir_builder_load(builder, ir_builder_type(builder, slot_type), slot) : IR_NONE;
+}
+
+static uint32_t ir_build_call(struct ir_builder *builder, uint32_t index)
+{
+    struct node *node = node_at(builder->pool, index);
+    uint32_t callee = node->call.function;
+    uint32_t arguments = node->call.arguments;
+    struct type *function = type_decay(builder->types, ir_builder_type_of(builder, callee))->base;
+    struct type *return_type = function->base;
+    if (ir_builder_is_aggregate(return_type))
+    {
+        compiler_error(ir_builder_error_position(builder), "Returning structs is not supported yet\n");
+    }
+
+    uint32_t callee_value = ir_build_expression(builder, callee);
+    struct vector *values = vector_create(sizeof(uint32_t));
+    int position = 0;
+    for (uint32_t argument = arguments; argument != NODE_NONE; argument = node_at(builder->pool, argument)->next)
+    {
+        struct type *type = type_decay(builder->types, ir_builder_type_of(builder, argument));
+        if (ir_builder_is_aggregate(type))
+        {
+            builder->node = argument;
+            compiler_error(ir_builder_error_position(builder), "Passing structs by value is not supported yet\n");
+        }
+
+        // arguments without a parameter get the default promotions
+        struct type *parameter = position < function->param_count ? function->params[position] : type_promote(builder->types, type);
+        uint32_t value = ir_builder_value_as(builder, argument, parameter);
+        vector_push(values, &value);
+        position++;
+    }
+
+    builder->node = index;
+    uint32_t call = ir_builder_emit(builder, IR_CALL, ir_builder_type(builder, return_type), position + 1);
+    ir_set_operand(builder->function, call, 0, callee_value);
+    uint32_t *argument_values = vector_data_ptr(values);
+    for (int i = 0; i < position; i++)
+    {
+        ir_set_operand(builder->function, call, i + 1, argument_values[i]);
+    }
+    ir_at(builder->function, call)->aux = function->flags & TYPE_FLAG_VARIADIC ? function->param_count : -1;
+    vector_free(values);
+    return call;
+}
+
+static uint32_t ir_build_assignment(struct ir_builder *builder, uint32_t index)
+{
+    struct node *node = node_at(builder->pool, index);
+    int op = node->op;
+    uint32_t left = node->exp.left;
+    uint32_t right = node->exp.right;
+    struct type *type = ir_builder_type_of(builder, left);
+    if (ir_builder_is_aggregate(type))
+    {
+        uint32_t source = ir_build_address(builder, right);
+        uint32_t destination = ir_build_address(builder, left);
+        ir_builder_memory(builder, IR_MEMCPY, destination, source, type->size);
+        return destination;
+    }
+
+    if (op == OP_ASSIGN)
+    {
+        uint32_t value = ir_builder_value_as(builder, right, type);
+        ir_builder_store(builder, ir_build_address(builder, left), value);
+        return value;
+    }
+
+    uint32_t address = ir_build_address(builder, left);
+    uint32_t old = ir_builder_load(builder, ir_builder_type(builder, type), address);
+    uint32_t operand = ir_build_expression(builder, right);
+    struct type *result_type;
+    uint32_t value = ir_builder_operation(builder, ir_builder_compound_ops[op], old, type, operand, ir_builder_type_of(builder, right), &result_type);
+    value = ir_builder_convert(builder, value, result_type, type);
+    ir_builder_store(builder, address, value);
+    return value;
+}
+
+/**
+ * Binary operators other than the assignments, ir_build_binary chains them
+ */
+static bool ir_builder_is_operator(struct ir_builder *builder, uint32_t index)
+{
+    struct node *node = node_at(builder->pool, index);
+    return node->type == NODE_TYPE_EXPRESSION && node->op != OP_ASSIGN && !ir_builder_compound_ops[node->op];
+}
+
+static uint32_t ir_build_operator(struct ir_builder *builder, uint32_t index, uint32_t left_value)
+{
+    struct node *node = node_at(builder->pool, index);
+    int op = node->op;
+    uint32_t left = node->exp.left;
+    uint32_t right = node->exp.right;
+    if (op == OP_COMMA)
+    {
+        return ir_build_expression(builder, right);
+    }
+
+    if (op == OP_LOGICAL_AND || op == OP_LOGICAL_OR)
+    {
+        return ir_build_logical(builder, index, left_value);
+    }
+
+    uint32_t right_value = ir_build_expression(builder, right);
+    struct type *result_type;
+    builder->node = index;
+    return ir_builder_operation(builder, op, left_value, ir_builder_type_of(builder, left), right_value, ir_builder_type_of(builder, right), &result_type);
+}
+
+/**
+ * a + b + c holds a + b as its left operand and such chains are as long as the
+ * source makes them. A loop goes down the left operands, the innermost operand
+ * is built and the operators are applied on the way back out
+ */
+static uint32_t ir_build_binary(struct ir_builder *builder, uint32_t index)
+{
+    size_t base = vector_count(builder->operators);
+    while (ir_builder_is_operator(builder, index))
+    {
+        vector_push(builder->operators, &index);
+        index = node_at(builder->pool, index)->exp.left;
+    }
+
+    uint32_t value = ir_build_expression(builder, index);
+    while (vector_count(builder->operators) > base)
+    {
+        uint32_t operator = *(uint32_t *)vector_back(builder->operators);
+        vector_pop(builder->operators);
+        value = ir_build_operator(builder, operator, value);
+    }
+    return value;
+}
+
+static uint32_t ir_build_unary(struct ir_builder *builder, uint32_t index)
+{
+    struct node *node = node_at(builder->pool, index);
+    uint32_t operand = node->unary.operand;
+    struct type *type = ir_builder_type_of(builder, index);
+    switch (node->op)
+    {
+    case OP_AMPERSAND:
+        return ir_build_address(builder, operand);
+
+    case OP_STAR:
+        return ir_builder_load_type(builder, type, ir_build_expression(builder, operand));
+
+    case OP_PLUS:
+        return ir_builder_value_as(builder, operand, type);
+
+    case OP_MINUS:
+        return ir_builder_unary(builder, IR_NEG, ir_builder_type(builder, type), ir_builder_value_as(builder, operand, type));
+
+    case OP_TILDE:
+        return ir_builder_unary(builder, IR_NOT, ir_builder_type(builder, type), ir_builder_value_as(builder, operand, type));
+
+    case OP_NOT:
+    {
+        uint32_t value = ir_build_expression(builder, operand);
+        int value_type = ir_at(builder->function, value)->type;
+        return ir_builder_binary(builder, IR_EQ, IR_TYPE_I32, value, ir_builder_const(builder, value_type, 0));
+    }
+
+    case OP_INCREMENT:
+    case OP_DECREMENT:
+        return ir_build_increment(builder, index, false);
+    }
+
+    compiler_error(ir_builder_error_position(builder), "Unexpected unary operator\n");
+    return IR_NONE;
+}
+
+static uint32_t ir_build_expression(struct ir_builder *builder, uint32_t index)
+{
+    struct node *node = node_at(builder->pool, index);
+    builder->node = index;
+    switch (node->type)
+    {
+    case NODE_TYPE_NUMBER:
+        return ir_builder_const(builder, ir_builder_type(builder, ir_builder_type_of(builder, index)), node->llnum);
+
+    case NODE_TYPE_STRING:
+        return ir_build_address(builder, index);
+
+    case NODE_TYPE_IDENTIFIER:
+    case NODE_TYPE_SUBSCRIPT:
+    case NODE_TYPE_MEMBER:
+        return ir_builder_load_type(builder, ir_builder_type_of(builder, index), ir_build_address(builder, index));
+
+    case NODE_TYPE_UNARY:
+        return ir_build_unary(builder, index);
+
+    case NODE_TYPE_POSTFIX:
+        return ir_build_increment(builder, index, true);
+
+    case NODE_TYPE_EXPRESSION:
+        return ir_builder_is_operator(builder, index) ? ir_build_binary(builder, index) : ir_build_assignment(builder, index);
+
+    case NODE_TYPE_TERNARY:
+        return ir_build_ternary(builder, index);
+
+    case NODE_TYPE_CALL:
+        return ir_build_call(builder, index);
+
+    case NODE_TYPE_CAST:
+    {
+        struct type *type = ir_builder_type_of(builder, index);
+        uint32_t value = ir_builder_value_as(builder, node->unary.operand, type);
+        return type->kind == TYPE_VOID ? IR_NONE : value;
+    }
+    }
+
+    compiler_error(ir_builder_error_position(builder), "Unexpected expression\n");
+    return IR_NONE;
+}
+
+/**
+ * Stores the elements of a brace or string initializer into memory that has been zeroed
+ */
+static void ir_build_initializer_elements(struct ir_builder *builder, uint32_t address, struct type *type, uint32_t index)
+{
+    struct node *node = node_at(builder->pool, index);
+    if (node->type == NODE_TYPE_STRING && type->kind == TYPE_ARRAY)
+    {
+        long size = node->string.length + 1;
+        size = size < type->size ? size : type->size;
+        ir_builder_memory(builder, IR_MEMCPY, address, ir_build_address(builder, index), size);
+        return;
+    }
+
+    if (node->type != NODE_TYPE_INITIALIZER_LIST)
+    {
+        if (ir_builder_is_aggregate(type))
+        {
+            ir_builder_memory(builder, IR_MEMCPY, address, ir_build_address(builder, index), type->size);
+            return;
+        }
+        ir_builder_store(builder, address, ir_builder_value_as(builder, index, type));
+        return;
+    }
+
+    int position = 0;
+    for (uint32_t value = node->list.first; value != NODE_NONE; value = node_at(builder->pool, value)->next)
+    {
+        struct type *element = type;
+        long offset = 0;
+        if (type->kind == TYPE_ARRAY)
+        {
+            element = type->base;
+            offset = position * element->size;
+        }
+        else if (type->kind == TYPE_STRUCT || type->kind == TYPE_UNION)
+        {
+            element = type->members[position].type;
+            offset = type->members[position].offset;
+        }
+
+        ir_build_initializer_elements(builder, ir_builder_member_address(builder, address, offset), element, value);
+        position++;
+    }
+}
+
+static void ir_build_initializer(struct ir_builder *builder, uint32_t address, struct type *type, uint32_t index)
+{
+    struct node *node = node_at(builder->pool, index);
+    if (node->type == NODE_TYPE_INITIALIZER_LIST || (node->type == NODE_TYPE_STRING && type->kind == TYPE_ARRAY))
+    {
+        // elements that are not listed start at zero
+        ir_builder_memory(builder, IR_ZERO, address, IR_NONE, type->size);
+    }
+    ir_build_initializer_elements(builder, address, type, index);
+}
+
+static void ir_build_local(struct ir_builder *builder, uint32_t index)
+{
+    struct node *node = node_at(builder->pool, index);
+    int flags = node_datatype_at(builder->pool, node->datatype)->flags;
+    if (flags & DATATYPE_FLAG_IS_EXTERN)
+    {
+        return;
+    }
+
+    if (flags & DATATYPE_FLAG_IS_STATIC)
+    {
+        char key[16];
+        snprintf(key, sizeof(key), "%u", index);
+        const char *name = ir_builder_name(builder, "%s.%i", node->sval, builder->module->static_count++);
+        hashmap_set(builder->statics, key, (void *)name);
+        ir_build_global(builder, index, name, true);
+        return;
+    }
+
+    struct type *type = ir_builder_type_of(builder, index);
+    uint32_t slot = ir_builder_slot(builder, type);
+    builder->node_values[index] = slot;
+    uint32_t initializer = node_at(builder->pool, index)->var.initializer;
+    if (initializer != NODE_NONE)
+    {
+        ir_build_initializer(builder, slot, type, initializer);
+    }
+}
+
+static void ir_build_list(struct ir_builder *builder, uint32_t index)
+{
+    while (index != NODE_NONE)
+    {
+        ir_build_statement(builder, index);
+        index = node_at(builder->pool, index)->next;
+    }
+}
+
+/**
+ * An else if chain is built by a loop, the end blocks of its ifs are started
+ * from the innermost out once the last else is built
+ */
+static void ir_build_if(struct ir_builder *builder, uint32_t index)
+{
+    size_t base = vector_count(builder->if_ends);
+    do
+    {
+        struct node *node = node_at(builder->pool, index);
+        builder->node = index;
+        uint32_t body = node->stmt_if.body;
+        uint32_t else_body = node->stmt_if.else_body;
+        uint32_t then_block = ir_block_create(builder->function);
+        uint32_t else_block = else_body != NODE_NONE ? ir_block_create(builder->function) : IR_NONE;
+        uint32_t end_block = ir_block_create(builder->function);
+
+        uint32_t condition = ir_build_expression(builder, node->stmt_if.condition);
+        ir_builder_branch(builder, condition, then_block, else_body != NODE_NONE ? else_block : end_block);
+        ir_builder_start(builder, then_block);
+        ir_build_statement(builder, body);
+        ir_builder_jump(builder, end_block);
+        if (else_body != NODE_NONE)
+        {
+            ir_builder_start(builder, else_block);
+        }
+        vector_push(builder->if_ends, &end_block);
+        index = else_body;
+    } while (index != NODE_NONE && node_at(builder->pool, index)->type == NODE_TYPE_STATEMENT_IF);
+
+    ir_build_statement(builder, index);
+    while (vector_count(builder->if_ends) > base)
+    {
+        uint32_t end_block = *(uint32_t *)vector_back(builder->if_ends);
+        vector_pop(builder->if_ends);
+        ir_builder_jump(builder, end_block);
+        ir_builder_start(builder, end_block);
+    }
+}
+
+/**
+ * Lowers a loop body with break and continue going to the given blocks
+ */
+static void ir_build_loop_body(struct ir_builder *builder, uint32_t body, uint32_t break_block, uint32_t continue_block)
+{
+    uint32_t saved_break = builder->break_block;
+    uint32_t saved_continue = builder->continue_block;
+    builder->break_block = break_block;
+    builder->continue_block = continue_block;
+    ir_build_statement(builder, body);
+    builder->break_block = saved_break;
+    builder->continue_block = saved_continue;
+}
+
+static void ir_build_while(struct ir_builder *builder, uint32_t index)
+{
+    struct node *node = node_at(builder->pool, index);
+    uint32_t condition = node->stmt.exp;
+    uint32_t body = node->stmt.body;
+    uint32_t condition_block = ir_block_create(builder->function);
+    uint32_t body_block = ir_block_create(builder->function);
+    uint32_t end_block = ir_block_create(builder->function);
+
+    ir_builder_jump(builder, condition_block);
+    ir_builder_start(builder, condition_block);
+    ir_builder_branch(builder, ir_build_expression(builder, condition), body_block, end_block);
+    ir_builder_start(builder, body_block);
+    ir_build_loop_body(builder, body, end_block, condition_block);
+    ir_builder_jump(builder, condition_block);
+    ir_builder_start(builder, end_block);
+}
+
+static void ir_build_do_while(struct ir_builder *builder, uint32_t index)
+{
+    struct node *node = node_at(builder->pool, index);
+    uint32_t condition = node->stmt.exp;
+    uint32_t body = node->stmt.body;
+    uint32_t body_block = ir_block_create(builder->function);
+    uint32_t condition_block = ir_block_create(builder->function);
+    uint32_t end_block = ir_block_create(builder->function);
+
+    ir_builder_jump(builder, body_block);
+    ir_builder_start(builder, body_block);
+    ir_build_loop_body(builder, body, end_block, condition_block);
+    ir_builder_jump(builder, condition_block);
+    ir_builder_start(builder, condition_block);
+    ir_builder_branch(builder, ir_build_expression(builder, condition), body_block, end_block);
+    ir_builder_start(builder, end_block);
+}
+
+static void ir_build_for(struct ir_builder *builder, uint32_t index)
+{
+    struct node *node = node_at(builder->pool, index);
+    uint32_t condition = node->stmt_for.condition;
+    uint32_t step = node->stmt_for.step;
+    uint32_t body = node->stmt_for.body;
+    ir_build_list(builder, node->stmt_for.init);
+
+    uint32_t condition_block = ir_block_create(builder->function);
+    uint32_t body_block = ir_block_create(builder->function);
+    uint32_t step_block = ir_block_create(builder->function);
+    uint32_t end_block = ir_block_create(builder->function);
+    ir_builder_jump(builder, condition_block);
+    ir_builder_start(builder, condition_block);
+    if (condition != NODE_NONE)
+    {
+        ir_builder_branch(builder, ir_build_expression(builder, condition), body_block, end_block);
+    }
+    else
+    {
+        ir_builder_jump(builder, body_block);
+    }
+
+    ir_builder_start(builder, body_block);
+    ir_build_loop_body(builder, body, end_block, step_block);
+    ir_builder_jump(builder, step_block);
+    ir_builder_start(builder, step_block);
+    if (step != NODE_NONE)
+    {
+        ir_build_expression(builder, step);
+    }
+    ir_builder_jump(builder, condition_block);
+    ir_builder_start(builder, end_block);
+}
+
+/**
+ * Gives every case and default of the switch a block, nested switches keep theirs
+ */
+static void ir_build_collect_cases(struct ir_builder *builder, uint32_t index, struct vector *cases)
+{
+    // else if chains go on in the loop
+    while (index != NODE_NONE)
+    {
+        struct node *node = node_at(builder->pool, index);
+        switch (node->type)
+        {
+        case NODE_TYPE_STATEMENT_CASE:
+        case NODE_TYPE_STATEMENT_DEFAULT:
+            builder->node_values[index] = ir_block_create(builder->function);
+            vector_push(cases, &index);
+            return;
+
+        case NODE_TYPE_BODY:
+            for (uint32_t statement = node->list.first; statement != NODE_NONE; statement = node_at(builder->pool, statement)->next)
+            {
+                ir_build_collect_cases(builder, statement, cases);
+            }
+            return;
+
+        case NODE_TYPE_STATEMENT_IF:
+            ir_build_collect_cases(builder, node->stmt_if.body, cases);
+            index = node_at(builder->pool, index)->stmt_if.else_body;
+            break;
+
+        case NODE_TYPE_STATEMENT_WHILE:
+        case NODE_TYPE_STATEMENT_DO_WHILE:
+            index = node->stmt.body;
+            break;
+
+        case NODE_TYPE_STATEMENT_FOR:
+            index = node->stmt_for.body;
+            break;
+
+        default:
+            return;
+        }
+    }
+}
+
+/**
+ * A switch is a chain of comparisons, one for each case
+ */
+static void ir_build_switch(struct ir_builder *builder, uint32_t index)
+{
+    struct node *node = node_at(builder->pool, index);
+    uint32_t exp = node->stmt.exp;
+    uint32_t body = node->stmt.body;
+    struct type *type = type_promote(builder->types, ir_builder_type_of(builder, exp));
+    int ir_type = ir_builder_type(builder, type);
+    uint32_t value = ir_builder_value_as(builder, exp, type);
+    uint32_t end_block = ir_block_create(builder->function);
+
+    struct vector *cases = vector_create(sizeof(uint32_t));
+    ir_build_collect_cases(builder, body, cases);
+    uint32_t default_block = end_block;
+    uint32_t *labels = vector_data_ptr(cases);
+    for (int i = 0; i < vector_count(cases); i++)
+    {
+        struct node *label = node_at(builder->pool, labels[i]);
+        if (label->type == NODE_TYPE_STATEMENT_DEFAULT)
+        {
+            default_block = builder->node_values[labels[i]];
+            continue;
+        }
+
+        long long case_value = node_at(builder->pool, label->stmt.exp)->llnum;
+        uint32_t next_block = ir_block_create(builder->function);
+        uint32_t equal = ir_builder_binary(builder, IR_EQ, IR_TYPE_I32, value, ir_builder_const(builder, ir_type, case_value));
+        ir_builder_branch(builder, equal, builder->node_values[labels[i]], next_block);
+        ir_builder_start(builder, next_block);
+    }
+    ir_builder_jump(builder, default_block);
+    vector_free(cases);
+
+    // the body is only entered through its labels
+    ir_builder_start_unreachable(builder);
+    uint32_t saved_break = builder->break_block;
+    builder->break_block = end_block;
+    ir_build_statement(builder, body);
+    builder->break_block = saved_break;
+    ir_builder_jump(builder, end_block);
+    ir_builder_start(builder, end_block);
+}
+
+static uint32_t ir_builder_label(struct ir_builder *builder, const char *name)
+{
+    uint32_t block = (uint32_t)(uintptr_t)hashmap_get(builder->labels, name);
+    if (block == IR_NONE)
+    {
+        block = ir_block_create(builder->function);
+        hashmap_set(builder->labels, name, (void *)(uintptr_t)block);
+    }
+    return block;
+}
+
+static void ir_build_return(struct ir_builder *builder, uint32_t index)
+{
+    uint32_t exp = node_at(builder->pool, index)->stmt.exp;
+    if (exp == NODE_NONE || builder->return_type->kind == TYPE_VOID)
+    {
+        if (exp != NODE_NONE)
+        {
+            ir_build_expression(builder, exp);
+        }
+        ir_builder_emit(builder, IR_RETURN, IR_TYPE_VOID, 0);
+    }
+    else
+    {
+        uint32_t value = ir_builder_value_as(builder, exp, builder->return_type);
+        ir_builder_unary(builder, IR_RETURN, IR_TYPE_VOID, value);
+    }
+    ir_builder_start_unreachable(builder);
+}
+
+static void ir_build_statement(struct ir_builder *builder, uint32_t index)
+{
+    if (index == NODE_NONE)
+    {
+        return;
+    }
+
+    struct node *node = node_at(builder->pool, index);
+    builder->node = index;
+    switch (node->type)
+    {
+    case NODE_TYPE_BODY:
+        ir_build_list(builder, node->list.first);
+        break;
+
+    case NODE_TYPE_VARIABLE:
+        ir_build_local(builder, index);
+        break;
+
+    case NODE_TYPE_FUNCTION:
+    case NODE_TYPE_STRUCT:
+    case NODE_TYPE_ENUM:
+        // declarations inside a body produce no code
+        break;
+
+    case NODE_TYPE_STATEMENT_RETURN:
+        ir_build_return(builder, index);
+        break;
+
+    case NODE_TYPE_STATEMENT_IF:
+        ir_build_if(builder, index);
+        break;
+
+    case NODE_TYPE_STATEMENT_WHILE:
+        ir_build_while(builder, index);
+        break;
+
+    case NODE_TYPE_STATEMENT_DO_WHILE:
+        ir_build_do_while(builder, index);
+        break;
+
+    case NODE_TYPE_STATEMENT_FOR:
+        ir_build_for(builder, index);
+        break;
+
+    case NODE_TYPE_STATEMENT_SWITCH:
+        ir_build_switch(builder, index);
+        break;
+
+    case NODE_TYPE_STATEMENT_BREAK:
+    case NODE_TYPE_STATEMENT_CONTINUE:
+    {
+        uint32_t target = node->type == NODE_TYPE_STATEMENT_BREAK ? builder->break_block : builder->continue_block;
+        if (target == IR_NONE)
+        {
+            compiler_error(ir_builder_error_position(builder), "%s outside of a loop\n", node->type == NODE_TYPE_STATEMENT_BREAK ? "break" : "continue");
+        }
+        ir_builder_jump(builder, target);
+        ir_builder_start_unreachable(builder);
+    }
+    break;
+
+    case NODE_TYPE_STATEMENT_CASE:
+    case NODE_TYPE_STATEMENT_DEFAULT:
+        if (builder->node_values[index] == IR_NONE)
+        {
+            compiler_error(ir_builder_error_position(builder), "Case label outside of a switch\n");
+        }
+        ir_builder_jump(builder, builder->node_values[index]);
+        ir_builder_start(builder, builder->node_values[index]);
+        break;
+
+    case NODE_TYPE_LABEL:
+    {
+        uint32_t block = ir_builder_label(builder, node->sval);
+        ir_builder_jump(builder, block);
+        ir_builder_start(builder, block);
+    }
+    break;
+
+    case NODE_TYPE_STATEMENT_GOTO:
+        ir_builder_jump(builder, ir_builder_label(builder, node->sval));
+        ir_builder_start_unreachable(builder);
+        break;
+
+    default:
+        ir_build_expression(builder, index);
+        break;
+    }
+}
+
+static void ir_build_function(struct ir_builder *builder, uint32_t index)
+{
+    struct node *node = node_at(builder->pool, index);
+    struct type *type = ir_builder_type_of(builder, index);
+    struct ir_function *function = ir_function_create(builder->module, node->sval);
+    function->is_local = node_datatype_at(builder->pool, node->datatype)->flags & DATATYPE_FLAG_IS_STATIC;
+    function->type = type;
+    builder->function = function;
+    builder->return_type = type->base;
+    builder->labels = hashmap_create();
+    builder->node = index;
+    if (ir_builder_is_aggregate(type->base))
+    {
+        compiler_error(ir_builder_error_position(builder), "Returning structs is not supported yet\n");
+    }
+
+    // block 1 holds the parameters and stack slots and falls into the body
+    uint32_t entry = ir_block_create(function);
+    uint32_t body = ir_block_create(function);
+    builder->block = entry;
+    int position = 0;
+    for (uint32_t param = node->func.params; param != NODE_NONE; param = node_at(builder->pool, param)->next)
+    {
+        struct type *param_type = ir_builder_type_of(builder, param);
+        if (ir_builder_is_aggregate(param_type))
+        {
+            builder->node = param;
+            compiler_error(ir_builder_error_position(builder), "Passing structs by value is not supported yet\n");
+        }
+
+        uint32_t slot = ir_builder_slot(builder, param_type);
+        uint32_t value = ir_builder_emit(builder, IR_PARAM, ir_builder_type(builder, param_type), 0);
+        ir_at(function, value)->constant = position++;
+        ir_builder_store(builder, slot, value);
+        builder->node_values[param] = slot;
+    }
+
+    builder->block = body;
+    ir_build_statement(builder, node_at(builder->pool, index)->func.body);
+    if (!ir_builder_is_terminated(builder))
+    {
+        // falling off the end returns 0, which is what main needs
+        if (type->base->kind == TYPE_VOID)
+        {
+            ir_builder_emit(builder, IR_RETURN, IR_TYPE_VOID, 0);
+        }
+        else
+        {
+            ir_builder_unary(builder, IR_RETURN, IR_TYPE_VOID, ir_builder_const(builder, ir_builder_type(builder, type->base), 0));
+        }
+    }
+
+    builder->node = index;
+    for (size_t i = 0; i < builder->labels->capacity; i++)
+    {
+        struct hashmap_entry *label = &builder->labels->entries[i];
+        if (label->key && function->blocks[(uint32_t)(uintptr_t)label->value].last == IR_NONE)
+        {
+            compiler_error(ir_builder_error_position(builder), "Label %s used but not defined\n", label->key);
+        }
+    }
+
+    builder->block = entry;
+    ir_builder_jump(builder, body);
+    hashmap_free(builder->labels);
+    builder->labels = NULL;
+    ssa_construct(function);
+}
+
+static void ir_builder_write(unsigned char *data, long long value, int size)
+{
+    for (int i = 0; i < size; i++)
+    {
+        data[i] = (unsigned char)(value >> (i * 8));
+    }
+}
+
+static bool ir_builder_constant_address(struct ir_builder *builder, uint32_t index, const char **symbol, long long *addend);
+
+/**
+ * Symbol and offset of an lvalue with static storage
+ */
+static bool ir_builder_static_lvalue(struct ir_builder *builder, uint32_t index, const char **symbol, long long *addend)
+{
+    struct node *node = node_at(builder->pool, index);
+    switch (node->type)
+    {
+    case NODE_TYPE_IDENTIFIER:
+    {
+        uint32_t declaration = node->declaration;
+        if (declaration == NODE_NONE || builder->node_values[declaration] != IR_NONE)
+        {
+            return false;
+        }
+        *symbol = ir_builder_symbol(builder, declaration);
+        return true;
+    }
+
+    case NODE_TYPE_STRING:
+        *symbol = ir_builder_string(builder, index);
+        return true;
+
+    case NODE_TYPE_SUBSCRIPT:
+    {
+        struct node *offset = node_at(builder->pool, node->exp.right);
+        if (offset->type != NODE_TYPE_NUMBER || !ir_builder_constant_address(builder, node->exp.left, symbol, addend))
+        {
+            return false;
+        }
+        *addend += (long long)offset->llnum * ir_builder_type_of(builder, index)->size;
+        return true;
+    }
+
+    case NODE_TYPE_MEMBER:
+    {
+        if (node->op != OP_DOT || !ir_builder_static_lvalue(builder, node->unary.operand, symbol, addend))
+        {
+            return false;
+        }
+        struct type *type = ir_builder_type_of(builder, node->declaration);
+        *addend += type_find_member(type, node->sval)->offset;
+        return true;
+    }
+
+    case NODE_TYPE_UNARY:
+        return node->op == OP_STAR && ir_builder_constant_address(builder, node->unary.operand, symbol, addend);
+    }
+    return false;
+}
+
+/**
+ * Address constants allowed in static initializers, such as &x, array + 2 or "text"
+ */
+static bool ir_builder_constant_address(struct ir_builder *builder, uint32_t index, const char **symbol, long long *addend)
+{
+    struct node *node = node_at(builder->pool, index);
+    struct type *type = ir_builder_type_of(builder, index);
+    switch (node->type)
+    {
+    case NODE_TYPE_CAST:
+        return ir_builder_constant_address(builder, node->unary.operand, symbol, addend);
+
+    case NODE_TYPE_STRING:
+        *symbol = ir_builder_string(builder, index);
+        return true;
+
+    case NODE_TYPE_IDENTIFIER:
+    case NODE_TYPE_SUBSCRIPT:
+    case NODE_TYPE_MEMBER:
+        // arrays and functions are used through their address
+        return ir_builder_is_aggregate(type) && ir_builder_static_lvalue(builder, index, symbol, addend);
+
+    case NODE_TYPE_UNARY:
+        return node->op == OP_AMPERSAND && ir_builder_static_lvalue(builder, node->unary.operand, symbol, addend);
+
+    case NODE_TYPE_EXPRESSION:
+    {
+        struct node *offset = node_at(builder->pool, node->exp.right);
+        if ((node->op != OP_PLUS && node->op != OP_MINUS) || offset->type != NODE_TYPE_NUMBER ||
+            !ir_builder_constant_address(builder, node->exp.left, symbol, addend))
+        {
+            return false;
+        }
+        long long scale = type_decay(builder->types, ir_builder_type_of(builder, node->exp.left))->base->size;
+        *addend += (node->op == OP_PLUS ? 1 : -1) * (long long)offset->llnum * scale;
+        return true;
+    }
+    }
+    return false;
+}
+
+/**
+ * Writes a static initializer into the bytes of a global
+ */
+static void ir_build_data(struct ir_builder *builder, struct ir_global *global, long offset, struct type *type, uint32_t index)
+{
+    struct node *node = node_at(builder->pool, index);
+    builder->node = index;
+    if (node->type == NODE_TYPE_STRING && type->kind == TYPE_ARRAY)
+    {
+        long size = node->string.length + 1;
+        memcpy(global->data + offset, node->sval, size < type->size ? size : type->size);
+        return;
+    }
+
+    if (node->type == NODE_TYPE_INITIALIZER_LIST)
+    {
+        int position = 0;
+        for (uint32_t value = node->list.first; value != NODE_NONE; value = node_at(builder->pool, value)->next)
+        {
+            if (type->kind == TYPE_ARRAY)
+            {
+                ir_build_data(builder, global, offset + position * type->base->size, type->base, value);
+            }
+            else if (type->kind == TYPE_STRUCT || type->kind == TYPE_UNION)
+            {
+                struct type_member *member = &type->members[position];
+                ir_build_data(builder, global, offset + member->offset, member->type, value);
+            }
+            else
+            {
+                ir_build_data(builder, global, offset, type, value);
+            }
+            position++;
+        }
+        return;
+    }
+
+    if (node->type == NODE_TYPE_NUMBER && !ir_builder_is_aggregate(type))
+    {
+        ir_builder_write(global->data + offset, node->llnum, type->size);
+        return;
+    }
+
+    struct ir_relocation relocation = {.offset = offset};
+    if (type->size == 8 && ir_builder_constant_address(builder, index, &relocation.symbol, &relocation.addend))
+    {
+        vector_push(global->relocations, &relocation);
+        return;
+    }
+    builder->node = index;
+    compiler_error(ir_builder_error_position(builder), "Initializer element is not constant\n");
+}
+
+static void ir_build_global(struct ir_builder *builder, uint32_t index, const char *name, bool is_local)
+{
+    struct type *type = ir_builder_type_of(builder, index);
+    builder->node = index;
+    if (type->kind == TYPE_ARRAY && type->length < 0)
+    {
+        // int a[]; without a size anywhere is one element
+        type = type_get_array(builder->types, type->base, 1);
+    }
+
+    struct ir_global *global = ir_global_create(builder->module, name, type->size, type->align);
+    global->is_local = is_local;
+    uint32_t initializer = node_at(builder->pool, index)->var.initializer;
+    if (initializer != NODE_NONE)
+    {
+        global->data = calloc(1, type->size ? type->size : 1);
+        ir_build_data(builder, global, 0, type, initializer);
+    }
+}
+
+struct ir_builder *ir_builder_create(struct compile_process *process)
+{
+    struct ir_builder *builder = calloc(1, sizeof(struct ir_builder));
+    builder->compiler = process;
+    builder->pool = process->node_pool;
+    builder->statics = hashmap_create();
+    builder->initialized = hashmap_create();
+    builder->tentatives = hashmap_create();
+    builder->tentative_names = vector_create(sizeof(const char *));
+    builder->operators = vector_create(sizeof(uint32_t));
+    builder->if_ends = vector_create(sizeof(uint32_t));
+    return builder;
+}
+
+static struct ir_module *ir_builder_start_module(struct ir_builder *builder)
+{
+    builder->types = builder->compiler->types;
+    builder->module = ir_module_create();
+    builder->module->string_count = builder->string_count;
+    builder->module->static_count = builder->static_count;
+
+    uint32_t end = builder->pool->base + builder->pool->count;
+    if (end > builder->node_values_capacity)
+    {
+        uint32_t capacity = builder->node_values_capacity ? builder->node_values_capacity : end;
+        while (capacity < end)
+        {
+            capacity *= 2;
+        }
+        builder->node_values = realloc(builder->node_values, sizeof(uint32_t) * capacity);
+        memset(builder->node_values + builder->node_values_capacity, 0, sizeof(uint32_t) * (capacity - builder->node_values_capacity));
+        builder->node_values_capacity = capacity;
+    }
+    builder->node_values_end = end;
+    return builder->module;
+}
+
+static struct ir_module *ir_builder_end_module(struct ir_builder *builder)
+{
+    struct ir_module *module = builder->module;
+    builder->string_count = module->string_count;
+    builder->static_count = module->static_count;
+    builder->module = NULL;
+    return module;
+}
+
+/**
+ * Lowers the top level declarations starting at tree into a module of their own.
+ * Initialized variables are emitted right away, a variable without an initializer
+ * waits for ir_builder_finish in case a later declaration defines it
+ */
+struct ir_module *ir_builder_build(struct ir_builder *builder, uint32_t tree)
+{
+    ir_builder_start_module(builder);
+    for (uint32_t index = tree; index != NODE_NONE; index = node_at(builder->pool, index)->next)
+    {
+        struct node *node = node_at(builder->pool, index);
+        if (node->type == NODE_TYPE_FUNCTION && node->func.body != NODE_NONE)
+        {
+            ir_build_function(builder, index);
+            continue;
+        }
+
+        if (node->type != NODE_TYPE_VARIABLE || (node_datatype_at(builder->pool, node->datatype)->flags & DATATYPE_FLAG_IS_EXTERN))
+        {
+            continue;
+        }
+
+        bool is_local = node_datatype_at(builder->pool, node->datatype)->flags & DATATYPE_FLAG_IS_STATIC;
+        if (node->var.initializer != NODE_NONE)
+        {
+            hashmap_set(builder->initialized, node->sval, (void *)node->sval);
+            ir_build_global(builder, index, node->sval, is_local);
+            continue;
+        }
+
+        if (!hashmap_get(builder->tentatives, node->sval))
+        {
+            vector_push(builder->tentative_names, &node->sval);
+        }
+        hashmap_set(builder->tentatives, node->sval, (void *)(uintptr_t)index);
+    }
+
+    // static locals are only named inside their function
+    if (builder->statics->count)
+    {
+        hashmap_free(builder->statics);
+        builder->statics = hashmap_create();
+    }
+    return ir_builder_end_module(builder);
+}
+
+/**
+ * The variables that were declared but never initialized, they start out zero. Each
+ * call builds a module of the next few of them, NULL once there are no more
+ */
+struct ir_module *ir_builder_finish(struct ir_builder *builder)
+{
+    if (builder->finished == vector_count(builder->tentative_names))
+    {
+        return NULL;
+    }
+
+    ir_builder_start_module(builder);
+    const char **names = vector_data_ptr(builder->tentative_names);
+    size_t end = builder->finished + IR_BUILDER_FINISH_BATCH;
+    end = end < vector_count(builder->tentative_names) ? end : vector_count(builder->tentative_names);
+    for (; builder->finished < end; builder->finished++)
+    {
+        const char *name = names[builder->finished];
+        if (hashmap_get(builder->initialized, name))
+        {
+            continue;
+        }
+
+        uint32_t index = (uint32_t)(uintptr_t)hashmap_get(builder->tentatives, name);
+        struct node *node = node_at(builder->pool, index);
+        bool is_local = node_datatype_at(builder->pool, node->datatype)->flags & DATATYPE_FLAG_IS_STATIC;
+        ir_build_global(builder, index, node->sval, is_local);
+    }
+    return ir_builder_end_module(builder);
+}
+
+/**
+ * The nodes from first on were released, their indexes start out without a value again
+ */
+void ir_builder_release(struct ir_builder *builder, uint32_t first)
+{
+    if (first < builder->node_values_end)
+    {
+        memset(builder->node_values + first, 0, sizeof(uint32_t) * (builder->node_values_end - first));
+        builder->node_values_end = first;
+    }
+}
+
+void ir_builder_free(struct ir_builder *builder)
+{
+    hashmap_free(builder->statics);
+    hashmap_free(builder->initialized);
+    hashmap_free(builder->tentatives);
+    vector_free(builder->tentative_names);
+    vector_free(builder->operators);
+    vector_free(builder->if_ends);
+    free(builder->node_values);
+    free(builder);
+}
+
+int ir_build(struct compile_process *process)
+{
+    struct ir_builder *builder = ir_builder_create(process);
+    ir_builder_start_module(builder);
+
+    // a file scope variable may be declared many times, the one with an initializer or else the last one is emitted
+    struct hashmap *definitions = hashmap_create();
+    for (uint32_t index = process->node_tree; index != NODE_NONE; index = node_at(builder->pool, index)->next)
+    {
+        struct node *node = node_at(builder->pool, index);
+        if (node->type != NODE_TYPE_VARIABLE || (node_datatype_at(builder->pool, node->datatype)->flags & DATATYPE_FLAG_IS_EXTERN))
+        {
+            continue;
+        }
+
+        if (!hashmap_get(definitions, node->sval) || node->var.initializer != NODE_NONE)
+        {
+            hashmap_set(definitions, node->sval, (void *)(uintptr_t)index);
+        }
+    }
+
+    for (uint32_t index = process->node_tree; index != NODE_NONE; index = node_at(builder->pool, index)->next)
+    {
+        struct node *node = node_at(builder->pool, index);
+        if (node->type == NODE_TYPE_FUNCTION && node->func.body != NODE_NONE)
+        {
+            ir_build_function(builder, index);
+        }
+        else if (node->type == NODE_TYPE_VARIABLE && (uint32_t)(uintptr_t)hashmap_get(definitions, node->sval) == index)
+        {
+            bool is_local = node_datatype_at(builder->pool, node->datatype)->flags & DATATYPE_FLAG_IS_STATIC;
+            ir_build_global(builder, index, node->sval, is_local);
+        }
+    }
+
+    hashmap_free(definitions);
+    process->ir = ir_builder_end_module(builder);
+    ir_builder_free(builder);
+    return IR_ALL_OK;
+}
@@ -0,0 +1,202 @@
+#define _GNU_SOURCE
+#include "compiler.h"
+#include "helpers/vector.h"
+#include "helpers/hashmap.h"
+#include <dlfcn.h>
+#include <elf.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ * Runs an object in this process. The sections are copied into fresh pages and
+ * relocated while the pages are only writable, then the code becomes executable
+ * and the constants read only, no page is ever writable and executable at once.
+ * Symbols the object doesn't define come from dlsym, calls to them go through a
+ * stub next to the code since the C library may be too far away for a 32 bit
+ * displacement
+ */
+
+// jmp *slot(%rip) and two int3 of padding
+#define JIT_STUB_SIZE 8
+
+static uint64_t jit_align(uint64_t value, uint64_t align)
+{
+    return (value + align - 1) / align * align;
+}
+
+static bool jit_is_defined(struct elf_symbol *symbol)
+{
+    return symbol->section >= 0;
+}
+
+static bool jit_store32(uint8_t *place, int64_t value)
+{
+    if (value < INT32_MIN || value > INT32_MAX)
+    {
+        return false;
+    }
+
+    int32_t narrow = value;
+    memcpy(place, &narrow, 4);
+    return true;
+}
+
+/**
+ * Fills in one relocation, stub and slot are the symbol's entries in the stub
+ * area and the global offset table
+ */
+static bool jit_relocate(struct elf_relocation *relocation, uint8_t *place, uint8_t *address, uint8_t *stub, uint8_t *slot)
+{
+    int64_t place_address = (int64_t)(uintptr_t)place;
+    switch (relocation->type)
+    {
+    case R_X86_64_64:
+    {
+        uint64_t value = (uint64_t)(uintptr_t)address + relocation->addend;
+        memcpy(place, &value, 8);
+        return true;
+    }
+
+    case R_X86_64_PC32:
+        return jit_store32(place, (int64_t)(uintptr_t)address + relocation->addend - place_address);
+
+    case R_X86_64_PLT32:
+        return jit_store32(place, (int64_t)(uintptr_t)(stub ? stub : address) + relocation->addend - place_address);
+
+    case R_X86_64_REX_GOTPCRELX:
+        return jit_store32(place, (int64_t)(uintptr_t)slot + relocation->addend - place_address);
+    }
+    return false;
+}
+
+/**
+ * Copies the object into memory of its own and relocates it, NULL if a symbol
+ * can't be found. The jit takes the object over once it is loaded
+ */
+struct jit *jit_load(struct elf_object *object)
+{
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    struct elf_symbol *symbols = vector_data_ptr(object->symbols);
+    int symbol_count = vector_count(object->symbols);
+    int *stubs = malloc(sizeof(int) * (symbol_count + 1));
+    int stub_count = 0;
+    for (int i = 0; i < symbol_count; i++)
+    {
+        stubs[i] = jit_is_defined(&symbols[i]) ? -1 : stub_count++;
+    }
+
+    // every symbol gets a slot in the global offset table, it costs little and
+    // keeps the indexes the same
+    struct elf_section *sections = object->sections;
+    uint64_t bases[ELF_SECTION_COUNT];
+    bases[ELF_SECTION_TEXT] = 0;
+    uint64_t stub_base = jit_align(sections[ELF_SECTION_TEXT].size, 8);
+    uint64_t got_base = jit_align(stub_base + (uint64_t)stub_count * JIT_STUB_SIZE, page);
+    bases[ELF_SECTION_RODATA] = jit_align(got_base + (uint64_t)symbol_count * 8, sections[ELF_SECTION_RODATA].align);
+    bases[ELF_SECTION_DATA] = jit_align(bases[ELF_SECTION_RODATA] + sections[ELF_SECTION_RODATA].size, page);
+    bases[ELF_SECTION_BSS] = jit_align(bases[ELF_SECTION_DATA] + sections[ELF_SECTION_DATA].size, sections[ELF_SECTION_BSS].align);
+    uint64_t size = jit_align(bases[ELF_SECTION_BSS] + sections[ELF_SECTION_BSS].size, page);
+
+    uint8_t *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        free(stubs);
+        return NULL;
+    }
+
+    // .bss stays as mmap zeroed it
+    for (int section = 0; section < ELF_SECTION_COUNT; section++)
+    {
+        if (section != ELF_SECTION_BSS && sections[section].size)
+        {
+            memcpy(memory + bases[section], sections[section].data, sections[section].size);
+        }
+    }
+
+    struct jit *jit = calloc(1, sizeof(struct jit));
+    jit->memory = memory;
+    jit->size = size;
+    jit->object = object;
+    jit->addresses = calloc(symbol_count + 1, sizeof(uint8_t *));
+    bool ok = true;
+    uint8_t **got = (uint8_t **)(memory + got_base);
+    for (int i = 0; i < symbol_count && ok; i++)
+    {
+        if (jit_is_defined(&symbols[i]))
+        {
+            jit->addresses[i] = memory + bases[symbols[i].section] + symbols[i].value;
+        }
+        else if (!(jit->addresses[i] = dlsym(RTLD_DEFAULT, symbols[i].name)))
+        {
+            fprintf(stderr, "Undefined symbol %s\n", symbols[i].name);
+            ok = false;
+            break;
+        }
+        got[i] = jit->addresses[i];
+
+        if (stubs[i] >= 0)
+        {
+            uint8_t *stub = memory + stub_base + (uint64_t)stubs[i] * JIT_STUB_SIZE;
+            stub[0] = 0xFF;
+            stub[1] = 0x25;
+            jit_store32(stub + 2, (int64_t)(uintptr_t)&got[i] - (int64_t)(uintptr_t)(stub + 6));
+            stub[6] = 0xCC;
+            stub[7] = 0xCC;
+        }
+    }
+
+    struct elf_relocation *relocations = vector_data_ptr(object->relocations);
+    for (int i = 0; i < vector_count(object->relocations) && ok; i++)
+    {
+        uint32_t symbol = relocations[i].symbol;
+        uint8_t *place = memory + bases[relocations[i].section] + relocations[i].offset;
+        uint8_t *stub = stubs[symbol] >= 0 ? memory + stub_base + (uint64_t)stubs[symbol] * JIT_STUB_SIZE : NULL;
+        if (!jit_relocate(&relocations[i], place, jit->addresses[symbol], stub, (uint8_t *)&got[symbol]))
+        {
+            fprintf(stderr, "Cannot relocate %s\n", symbols[symbol].name);
+            ok = false;
+        }
+    }
+    free(stubs);
+
+    if (ok)
+    {
+        ok = !mprotect(memory, got_base, PROT_READ | PROT_EXEC) &&
+             !mprotect(memory + got_base, bases[ELF_SECTION_DATA] - got_base, PROT_READ);
+    }
+
+    if (!ok)
+    {
+        jit->object = NULL;
+        jit_free(jit);
+        return NULL;
+    }
+    return jit;
+}
+
+/**
+ * Address of a symbol the object defines, NULL if there is none
+ */
+void *jit_symbol(struct jit *jit, const char *name)
+{
+    void *index = hashmap_get(jit->object->indexes, name);
+    if (!index)
+    {
+        return NULL;
+    }
+
+    struct elf_symbol *symbol = vector_at(jit->object->symbols, (int)(uintptr_t)index - 1);
+    return jit_is_defined(symbol) ? jit->addresses[(uintptr_t)index - 1] : NULL;
+}
+
+void jit_free(struct jit *jit)
+{
+    munmap(jit->memory, jit->size);
+    if (jit->object)
+    {
+        elf_object_free(jit->object);
+    }
+    free(jit->addresses);
+    free(jit);
+}
@@ -0,0 +1,329 @@
+#include "compiler.h"
+#include "helpers/buffer.h"
+#include "helpers/intern.h"
+#include "helpers/vector.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Lexes a file on a thread of its own while the preprocessor reads its tokens. The
+ * lexer thread copies every token into a single producer single consumer ring and
+ * the reader takes them out in order, neither side takes a lock. Both sides only
+ * publish how far they got once per batch so the shared counters bounce between
+ * the cores once per batch and not once per token. A full ring makes the lexer
+ * wait, an empty one the reader: a side that waits spins for a moment and then
+ * sleeps until the other side publishes, which on a busy machine hands the
+ * processor to the thread that can make progress.
+ *
+ * Only the preprocessor knows which branches of a conditional are taken, and the
+ * branches it skips are never lexed since they may hold text that isn't C. After
+ * the line of an #if, #ifdef, #ifndef, #elif or #else the lexer thread publishes
+ * what it has and waits until the reader has handled the directive and says
+ * whether to skip the branch that follows.
+ *
+ * Tokens are copied by value, what they point to is interned or allocated for the
+ * token and never moves, so a slot can be reused as soon as the reader is past it.
+ * The lexer thread has a copy of the compile process of its own: its position is
+ * where the lexer is, the reader moves the real one along with the tokens it reads.
+ * Nothing the reader gets points into the file, so the lexer thread lets go of the
+ * pages of the file it has read itself, every LEX_PIPELINE_BATCH tokens.
+ */
+
+// tokens in the ring, a power of two
+#define LEX_PIPELINE_RING_SIZE 4096
+// tokens between two updates of a shared counter
+#define LEX_PIPELINE_BATCH 256
+// checks of the other side's counter before going to sleep
+#define LEX_PIPELINE_SPINS 128
+
+enum
+{
+    LEX_PIPELINE_BRANCH_WAITING,
+    LEX_PIPELINE_BRANCH_TAKEN,
+    LEX_PIPELINE_BRANCH_SKIPPED
+};
+
+// where the lexer thread is in the line, to find the lines that start a branch
+enum
+{
+    LEX_PIPELINE_LINE_START,
+    LEX_PIPELINE_LINE_HASH,
+    LEX_PIPELINE_LINE_BRANCH,
+    LEX_PIPELINE_LINE_OTHER
+};
+
+struct lex_pipeline
+{
+    struct compile_process *compiler;
+    struct lex_process *lex_process;
+    pthread_t thread;
+    struct token *ring;
+
+    // tokens written by the lexer thread, only it stores here
+    _Alignas(64) atomic_size_t tail;
+    // set after the last tail once the file is lexed
+    atomic_bool done;
+
+    // tokens the reader is done with, only it stores here
+    _Alignas(64) atomic_size_t head;
+    // the reader's own count, the token at read - 1 is still in use
+    size_t read;
+
+    // what the reader said about the branch the lexer waits at, one of LEX_PIPELINE_BRANCH_...
+    _Alignas(64) atomic_size_t branch;
+    bool follow_branches;
+
+    // a side that ran out of spins sleeps here until the other one publishes
+    _Alignas(64) atomic_int sleepers;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+};
+
+static bool lex_pipeline_full(struct lex_pipeline *pipeline, size_t tail)
+{
+    return tail - atomic_load_explicit(&pipeline->head, memory_order_acquire) == LEX_PIPELINE_RING_SIZE;
+}
+
+static bool lex_pipeline_empty(struct lex_pipeline *pipeline, size_t read)
+{
+    return read == atomic_load_explicit(&pipeline->tail, memory_order_acquire) && !atomic_load_explicit(&pipeline->done, memory_order_acquire);
+}
+
+/**
+ * Called after the counter is stored, the sleeper counts itself before it looks
+ * at the counter for the last time so one of the two always sees the other
+ */
+static void lex_pipeline_publish(struct lex_pipeline *pipeline, atomic_size_t *counter, size_t value)
+{
+    atomic_store_explicit(counter, value, memory_order_seq_cst);
+    if (atomic_load_explicit(&pipeline->sleepers, memory_order_seq_cst))
+    {
+        pthread_mutex_lock(&pipeline->lock);
+        pthread_cond_broadcast(&pipeline->wake);
+        pthread_mutex_unlock(&pipeline->lock);
+    }
+}
+
+static bool lex_pipeline_undecided(struct lex_pipeline *pipeline, size_t position)
+{
+    return atomic_load_explicit(&pipeline->branch, memory_order_acquire) == LEX_PIPELINE_BRANCH_WAITING;
+}
+
+/**
+ * Waits while the ring is full or the reader hasn't decided on a branch for the
+ * lexer, or while the ring is empty for the reader
+ */
+static void lex_pipeline_wait(struct lex_pipeline *pipeline, bool (*blocked)(struct lex_pipeline *, size_t), size_t position)
+{
+    for (int i = 0; i < LEX_PIPELINE_SPINS; i++)
+    {
+        if (!blocked(pipeline, position))
+        {
+            return;
+        }
+    }
+
+    pthread_mutex_lock(&pipeline->lock);
+    atomic_fetch_add_explicit(&pipeline->sleepers, 1, memory_order_seq_cst);
+    while (blocked(pipeline, position))
+    {
+        pthread_cond_wait(&pipeline->wake, &pipeline->lock);
+    }
+    atomic_fetch_sub_explicit(&pipeline->sleepers, 1, memory_order_seq_cst);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+/**
+ * Moves the line state past the token, true when the token ends the line of a
+ * directive that starts a branch. Comments and spliced lines are part of the line
+ * the way the preprocessor reads it
+ */
+static bool lex_pipeline_ends_branch_line(int *line, bool *splice, struct token *token)
+{
+    bool spliced = *splice;
+    *splice = token_is_symbol(token, '\\');
+    if (token->type == TOKEN_TYPE_COMMENT)
+    {
+        return false;
+    }
+    if (token->type == TOKEN_TYPE_NEWLINE)
+    {
+        if (spliced && *line != LEX_PIPELINE_LINE_START)
+        {
+            return false;
+        }
+        bool branch = *line == LEX_PIPELINE_LINE_BRANCH;
+        *line = LEX_PIPELINE_LINE_START;
+        return branch;
+    }
+
+    if (*line == LEX_PIPELINE_LINE_START)
+    {
+        *line = token_is_symbol(token, '#') ? LEX_PIPELINE_LINE_HASH : LEX_PIPELINE_LINE_OTHER;
+    }
+    else if (*line == LEX_PIPELINE_LINE_HASH)
+    {
+        bool name = token->type == TOKEN_TYPE_IDENTIFIER || token->type == TOKEN_TYPE_KEYWORD;
+        *line = name && (S_EQ(token->sval, "if") || S_EQ(token->sval, "ifdef") || S_EQ(token->sval, "ifndef") || S_EQ(token->sval, "elif") || S_EQ(token->sval, "else"))
+                    ? LEX_PIPELINE_LINE_BRANCH
+                    : LEX_PIPELINE_LINE_OTHER;
+    }
+    return false;
+}
+
+static void *lex_pipeline_thread(void *data)
+{
+    struct lex_pipeline *pipeline = data;
+    size_t tail = 0;
+    size_t published = 0;
+    size_t head = 0;
+    int line = LEX_PIPELINE_LINE_START;
+    bool splice = false;
+    struct token *token = lex_next_token(pipeline->lex_process);
+    while (token)
+    {
+        if (tail - head == LEX_PIPELINE_RING_SIZE)
+        {
+            // the reader may be waiting for what we have not published yet
+            if (published != tail)
+            {
+                lex_pipeline_publish(pipeline, &pipeline->tail, tail);
+                published = tail;
+            }
+            lex_pipeline_wait(pipeline, lex_pipeline_full, tail);
+            head = atomic_load_explicit(&pipeline->head, memory_order_acquire);
+        }
+
+        pipeline->ring[tail & (LEX_PIPELINE_RING_SIZE - 1)] = *token;
+        tail++;
+        if (tail - published == LEX_PIPELINE_BATCH)
+        {
+            lex_pipeline_publish(pipeline, &pipeline->tail, tail);
+            published = tail;
+        }
+        if (tail % LEX_PIPELINE_BATCH == 0)
+        {
+            buffer_release_read(pipeline->compiler->cfile.buffer);
+        }
+
+        // the lexer keeps only the last token, the rest live in the ring
+        if (vector_count(pipeline->lex_process->token_vec) > 1)
+        {
+            struct token last = *token;
+            vector_clear(pipeline->lex_process->token_vec);
+            vector_push(pipeline->lex_process->token_vec, &last);
+        }
+
+        if (pipeline->follow_branches && lex_pipeline_ends_branch_line(&line, &splice, token))
+        {
+            // the reader can't decide before it has read the directive
+            if (published != tail)
+            {
+                lex_pipeline_publish(pipeline, &pipeline->tail, tail);
+                published = tail;
+            }
+            lex_pipeline_wait(pipeline, lex_pipeline_undecided, tail);
+            if (atomic_load_explicit(&pipeline->branch, memory_order_acquire) == LEX_PIPELINE_BRANCH_SKIPPED)
+            {
+                lex_skip_inactive_region(pipeline->lex_process);
+            }
+            atomic_store_explicit(&pipeline->branch, LEX_PIPELINE_BRANCH_WAITING, memory_order_relaxed);
+        }
+        token = lex_next_token(pipeline->lex_process);
+    }
+
+    atomic_store_explicit(&pipeline->tail, tail, memory_order_seq_cst);
+    // done goes out after the last tail and wakes the reader like a tail would
+    atomic_store_explicit(&pipeline->done, true, memory_order_seq_cst);
+    lex_pipeline_publish(pipeline, &pipeline->tail, tail);
+    return NULL;
+}
+
+/**
+ * Starts lexing the file of the process on a new thread. With follow_branches
+ * the reader has to call lex_pipeline_branch for every line that starts a branch
+ */
+struct lex_pipeline *lex_pipeline_create(struct compile_process *compiler, bool follow_branches)
+{
+    struct lex_pipeline *pipeline = aligned_alloc(64, sizeof(struct lex_pipeline));
+    memset(pipeline, 0, sizeof(struct lex_pipeline));
+    pipeline->compiler = malloc(sizeof(struct compile_process));
+    memcpy(pipeline->compiler, compiler, sizeof(struct compile_process));
+    pipeline->lex_process = lex_process_create(pipeline->compiler, &compiler_lex_functions, NULL);
+    pipeline->ring = malloc(LEX_PIPELINE_RING_SIZE * sizeof(struct token));
+    atomic_init(&pipeline->tail, 0);
+    atomic_init(&pipeline->head, 0);
+    atomic_init(&pipeline->done, false);
+    atomic_init(&pipeline->sleepers, 0);
+    atomic_init(&pipeline->branch, LEX_PIPELINE_BRANCH_WAITING);
+    pipeline->follow_branches = follow_branches;
+    pthread_mutex_init(&pipeline->lock, NULL);
+    pthread_cond_init(&pipeline->wake, NULL);
+
+    // both threads intern names from here on
+    intern_table_share(compiler->identifiers);
+    if (pthread_create(&pipeline->thread, NULL, lex_pipeline_thread, pipeline) != 0)
+    {
+        compiler_error(compiler, "Failed to start the lexer thread\n");
+    }
+    return pipeline;
+}
+
+/**
+ * Next token of the file, NULL at its end. The token stays valid until the next call
+ */
+struct token *lex_pipeline_next(struct lex_pipeline *pipeline)
+{
+    // every token before read is done with, the caller moved on
+    size_t read = pipeline->read;
+    size_t head = atomic_load_explicit(&pipeline->head, memory_order_relaxed);
+    if (read - head >= LEX_PIPELINE_BATCH)
+    {
+        lex_pipeline_publish(pipeline, &pipeline->head, read);
+        head = read;
+    }
+
+    if (read == atomic_load_explicit(&pipeline->tail, memory_order_acquire))
+    {
+        // a lexer waiting for room has to see everything we already read
+        if (head != read)
+        {
+            lex_pipeline_publish(pipeline, &pipeline->head, read);
+        }
+        lex_pipeline_wait(pipeline, lex_pipeline_empty, read);
+
+        // done is stored after the last tail
+        if (read == atomic_load_explicit(&pipeline->tail, memory_order_acquire))
+        {
+            return NULL;
+        }
+    }
+
+    pipeline->read = read + 1;
+    return &pipeline->ring[read & (LEX_PIPELINE_RING_SIZE - 1)];
+}
+
+/**
+ * Tells the lexer thread, which waits after the line of an #if, #ifdef, #ifndef,
+ * #elif or #else, whether the branch that follows it is skipped
+ */
+void lex_pipeline_branch(struct lex_pipeline *pipeline, bool skipped)
+{
+    lex_pipeline_publish(pipeline, &pipeline->branch, skipped ? LEX_PIPELINE_BRANCH_SKIPPED : LEX_PIPELINE_BRANCH_TAKEN);
+}
+
+/**
+ * Waits for the lexer thread and frees the pipeline
+ */
+void lex_pipeline_free(struct lex_pipeline *pipeline)
+{
+    pthread_join(pipeline->thread, NULL);
+    pthread_mutex_destroy(&pipeline->lock);
+    pthread_cond_destroy(&pipeline->wake);
+    lex_process_free(pipeline->lex_process);
+    free(pipeline->ring);
+    free(pipeline->compiler);
+    free(pipeline);
+}
@@ -1,5 +1,6 @@
 #include "compiler.h"
 #include "helpers/vector.h"
+#include "helpers/buffer.h"
 #include <stdlib.h>
 
 struct lex_process *lex_process_create(struct compile_process *compiler, struct lex_precess_functions *compiler_lex_functions, void *private)
@@ -8,6 +9,7 @@ struct lex_process *lex_process_create(struct compile_process *compiler, struct
     process->compiler = compiler;
     process->pos.line = 1;
     process->pos.col = 1;
+    process->pos.filename = compiler->cfile.abs_path;
     process->token_vec = vector_create(sizeof(struct token));
     process->private = private;
     process->function = compiler_lex_functions;
@@ -17,6 +19,10 @@ struct lex_process *lex_process_create(struct compile_process *compiler, struct
 void lex_process_free(struct lex_process *process)
 {
     vector_free(process->token_vec);
+    if (process->spelling)
+    {
+        buffer_free(process->spelling);
+    }
     free(process);
 }
 
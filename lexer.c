@@ -1,9 +1,14 @@
 #include "compiler.h"
 #include "helpers/vector.h"
 #include "helpers/buffer.h"
+#include "helpers/intern.h"
+#include "helpers/utf8.h"
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
-#include <ctype.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define LEX_GETC_IF(buffer, c, exp)     \
     for (c = peekc(); exp; c = peekc()) \
@@ -12,8 +17,14 @@
         nextc();                        \
     }
 struct token *read_next_token();
-static struct lex_process *lex_process;
-static struct token tmp_token;
+static uint32_t lex_read_universal_character();
+// per thread so a file can be lexed on a thread of its own, see lex_pipeline.c
+static _Thread_local struct lex_process *lex_process;
+static _Thread_local struct token tmp_token;
+// where the token being read starts
+static _Thread_local struct pos token_start;
+// while a number or char literal is read, the characters it is written with
+static _Thread_local struct buffer *token_spelling;
 
 static char peekc()
 {
@@ -22,7 +33,9 @@ static char peekc()
 
 static void pushc(char c)
 {
+    // only characters of the current line are pushed back
     lex_process->function->push_char(lex_process, c);
+    lex_process->pos.col--;
 }
 
 static struct pos lex_file_position()
@@ -33,6 +46,10 @@ static struct pos lex_file_position()
 static char nextc()
 {
     char c = lex_process->function->next_char(lex_process);
+    if (token_spelling && c != EOF)
+    {
+        buffer_write(token_spelling, c);
+    }
     lex_process->pos.col++;
     if (c == '\n')
     {
@@ -52,7 +69,7 @@ static char assert_next_char(char c)
 struct token *token_create(struct token *_token)
 {
     memcpy(&tmp_token, _token, sizeof(struct token));
-    tmp_token.pos = lex_file_position();
+    tmp_token.pos = token_start;
     return &tmp_token;
 }
 
@@ -68,39 +85,45 @@ static struct token *handle_whitespace()
     {
         last_token->whitespace = true;
     }
-    nextc();
+
+    // the whole run is skipped here, a token is never more than one run away
+    for (char c = peekc(); c == ' ' || c == '\t'; c = peekc())
+    {
+        nextc();
+    }
     return read_next_token();
 }
 
-const char *read_number_str()
+const char *read_number_str(struct buffer *buffer)
 {
-    struct buffer *buffer = buffer_create();
     char c = peekc();
     LEX_GETC_IF(buffer, c, (c >= '0' && c <= '9'));
     buffer_write(buffer, 0x00);
     return buffer_ptr(buffer);
 }
 
-unsigned long long read_number()
-{
-    const char *s = read_number_str();
-    return atoll(s);
-}
-
 struct token *token_make_number_for_value(unsigned long number)
 {
     return token_create(&(struct token){
         .type = TOKEN_TYPE_NUMBER, .llnum = number});
 }
 
+struct token *token_make_special_number_hexadecimal();
+
 struct token *token_make_number(struct compile_process *process, char c)
 {
-    return token_make_number_for_value(read_number());
-}
+    struct buffer *buffer = buffer_create();
+    const char *s = read_number_str(buffer);
+    // 0x123
+    if (S_EQ(s, "0") && (peekc() == 'x' || peekc() == 'X'))
+    {
+        buffer_free(buffer);
+        return token_make_special_number_hexadecimal();
+    }
 
-static bool op_treated_as_one(char op)
-{
-    return op == '(' || op == '[' || op == ',' || op == '.' || op == '*' || op == '?';
+    long long number = atoll(s);
+    buffer_free(buffer);
+    return token_make_number_for_value(number);
 }
 
 static bool is_single_operator(char op)
@@ -108,57 +131,62 @@ static bool is_single_operator(char op)
     return op == '+' || op == '-' || op == '/' || op == '*' || op == '%' || op == '^' || op == '&' || op == '|' || op == '~' || op == '!' || op == '<' || op == '>' || op == '=' || op == '(' || op == '[' || op == ',' || op == '.' || op == '?';
 }
 
-bool op_valid(const char *op)
-{
-    return S_EQ(op, "+") || S_EQ(op, "-") || S_EQ(op, "*") || S_EQ(op, "/") || S_EQ(op, "!") || S_EQ(op, "^") || S_EQ(op, "+=") || S_EQ(op, "-=") || S_EQ(op, "*=") || S_EQ(op, "/=") || S_EQ(op, ">>") || S_EQ(op, "<<") || S_EQ(op, ">=") || S_EQ(op, "<=") || S_EQ(op, ">") || S_EQ(op, "<") || S_EQ(op, "||") || S_EQ(op, "&&") || S_EQ(op, "|") || S_EQ(op, "&") || S_EQ(op, "++") || S_EQ(op, "--") || S_EQ(op, "=") || S_EQ(op, "!=") || S_EQ(op, "==") || S_EQ(op, "->") || S_EQ(op, "(") || S_EQ(op, "[") || S_EQ(op, ",") || S_EQ(op, ".") || S_EQ(op, "...") || S_EQ(op, "?") || S_EQ(op, "%");
-}
+// first state of the operator DFA for every single operator character
+static const unsigned char op_start_states[128] = {
+    ['+'] = OP_PLUS, ['-'] = OP_MINUS, ['*'] = OP_STAR, ['/'] = OP_SLASH, ['%'] = OP_PERCENT,
+    ['^'] = OP_CARET, ['&'] = OP_AMPERSAND, ['|'] = OP_PIPE, ['~'] = OP_TILDE, ['!'] = OP_NOT,
+    ['<'] = OP_LESS, ['>'] = OP_GREATER, ['='] = OP_ASSIGN, ['('] = OP_LPAREN, ['['] = OP_LBRACKET,
+    [','] = OP_COMMA, ['.'] = OP_DOT, ['?'] = OP_QUESTION};
 
-void read_op_flush_back_keep_first(struct buffer *buffer)
-{
-    // +*, push * back to the stack, only leave + in the buffer
-    const char *data = buffer_ptr(buffer);
-    int len = buffer->len;
-    for (int i = len - 1; i > 0; i--)
-    {
-        if (data[i] == 0x00)
-        {
-            continue;
-        }
-        pushc(data[i]);
-    }
-}
+// OP_DOT_DOT is the only state that is not an operator, ".." has to give back one '.'
+#define OP_DOT_DOT OP_TOTAL
+
+// state -> next character -> state, 0 ends the operator
+static const unsigned char op_transitions[OP_TOTAL + 1][128] = {
+    [OP_PLUS] = {['='] = OP_PLUS_ASSIGN, ['+'] = OP_INCREMENT},
+    [OP_MINUS] = {['='] = OP_MINUS_ASSIGN, ['-'] = OP_DECREMENT, ['>'] = OP_ARROW},
+    [OP_STAR] = {['='] = OP_MUL_ASSIGN},
+    [OP_SLASH] = {['='] = OP_DIV_ASSIGN},
+    [OP_PERCENT] = {['='] = OP_MOD_ASSIGN},
+    [OP_CARET] = {['='] = OP_XOR_ASSIGN},
+    [OP_AMPERSAND] = {['='] = OP_AND_ASSIGN, ['&'] = OP_LOGICAL_AND},
+    [OP_PIPE] = {['='] = OP_OR_ASSIGN, ['|'] = OP_LOGICAL_OR},
+    [OP_NOT] = {['='] = OP_NOT_EQUAL},
+    [OP_LESS] = {['='] = OP_LESS_EQUAL, ['<'] = OP_SHIFT_LEFT},
+    [OP_GREATER] = {['='] = OP_GREATER_EQUAL, ['>'] = OP_SHIFT_RIGHT},
+    [OP_SHIFT_LEFT] = {['='] = OP_SHIFT_LEFT_ASSIGN},
+    [OP_SHIFT_RIGHT] = {['='] = OP_SHIFT_RIGHT_ASSIGN},
+    [OP_ASSIGN] = {['='] = OP_EQUAL},
+    [OP_DOT] = {['.'] = OP_DOT_DOT},
+    [OP_DOT_DOT] = {['.'] = OP_ELLIPSIS}};
 
-const char *read_op()
+/**
+ * Reads the longest operator starting at the current character
+ */
+int read_op()
 {
-    bool single_operator = true;
-    char op = nextc();
-    struct buffer *buffer = buffer_create();
-    buffer_write(buffer, op);
-    if (!op_treated_as_one(op))
+    char c = nextc();
+    int state = is_single_operator(c) ? op_start_states[(int)c] : OP_NONE;
+    if (state == OP_NONE)
     {
-        op = peekc();
-        if (is_single_operator(op))
-        {
-            buffer_write(buffer, op);
-            nextc();
-            single_operator = false;
-        }
+        compiler_error(lex_process->compiler, "Invalid operator: %c\n", c);
     }
-    buffer_write(buffer, 0x00);
-    char *ptr = buffer_ptr(buffer);
-    if (!single_operator)
+
+    c = peekc();
+    while (c >= 0 && op_transitions[state][(int)c])
     {
-        if (!op_valid(ptr))
-        {
-            read_op_flush_back_keep_first(buffer);
-            ptr[1] = 0x00;
-        }
+        state = op_transitions[state][(int)c];
+        nextc();
+        c = peekc();
     }
-    else if (!op_valid(ptr))
+
+    if (state == OP_DOT_DOT)
     {
-        compiler_error(lex_process->compiler, "Invalid operator: %s\n", ptr);
+        // a.. is a followed by two dots
+        pushc('.');
+        state = OP_DOT;
     }
-    return ptr;
+    return state;
 }
 
 bool lex_is_in_expression()
@@ -169,21 +197,16 @@ bool lex_is_in_expression()
 static void lex_new_expression()
 {
     lex_process->currtent_expression_count++;
-    // ( () )
-    if (lex_process->currtent_expression_count == 1)
-    {
-        lex_process->parenthsess_buffer = buffer_create();
-    }
 }
 // close the expression
 static void lex_finish_expression()
 {
     // ) -> symble
-    lex_process->currtent_expression_count--;
-    // there is no ( to match )
-    if (lex_process->currtent_expression_count < 0)
+    // a file on its own may legally have a ) without a ( such as in #define RP ),
+    // brackets are matched and reported on the preprocessed tokens instead
+    if (lex_process->currtent_expression_count > 0)
     {
-        compiler_error(lex_process->compiler, "Unexpected ')'\n");
+        lex_process->currtent_expression_count--;
     }
 }
 
@@ -233,13 +256,16 @@ static struct token *token_make_operator_or_string()
     if (op == '<')
     {
         struct token *last_token = lexer_last_token();
-        if (tocken_if_keyword(last_token, "include"))
+        if (token_is_identifier(last_token, "include"))
         {
-            return token_make_string('<', '>');
+            struct token *token = token_make_string('<', '>');
+            token->flags |= TOKEN_FLAG_SYSTEM_INCLUDE;
+            return token;
         }
     }
+    int code = read_op();
     struct token *token = token_create(&(struct token){
-        .type = TOKEN_TYPE_OPERATOR, .sval = read_op()});
+        .type = TOKEN_TYPE_OPERATOR, .op = code, .sval = token_op_spelling(code)});
     if (op == '(')
     {
         lex_new_expression();
@@ -247,45 +273,34 @@ static struct token *token_make_operator_or_string()
     return token;
 }
 
+// nothing reads the text of a comment, it is skipped instead of copied
 struct token *token_make_one_line_comment()
 {
-    struct buffer *buffer = buffer_create();
-    char c = 0;
-    LEX_GETC_IF(buffer, c, c != '\n' && c != EOF);
-    // hello world
+    for (char c = peekc(); c != '\n' && c != EOF; c = peekc())
+    {
+        nextc();
+    }
     return token_create(&(struct token){
-        .type = TOKEN_TYPE_COMMENT, .sval = buffer_ptr(buffer)});
+        .type = TOKEN_TYPE_COMMENT});
 }
 
 struct token *token_make_multiline_comment()
 {
-    struct buffer *buffer = buffer_create();
-    char c = 0;
     while (1)
     {
-        LEX_GETC_IF(buffer, c, c != '*' && c != EOF);
+        char c = nextc();
         if (c == EOF)
         {
-            compiler_error(lex_process->compiler, "Unexpected EOF\n");
+            compiler_error(lex_process->compiler, "Unterminated comment\n");
         }
-        else if (c == '*')
+        else if (c == '*' && peekc() == '/')
         {
-            // skip the *
             nextc();
-            if (peekc() == '/')
-            {
-                /**
-                 *  end
-                 */
-                nextc();
-                break;
-            }
+            break;
         }
     }
-
-    // hello world
     return token_create(&(struct token){
-        .type = TOKEN_TYPE_COMMENT, .sval = buffer_ptr(buffer)});
+        .type = TOKEN_TYPE_COMMENT});
 }
 
 struct token *handle_comment()
@@ -311,23 +326,208 @@ struct token *handle_comment()
 
     return NULL;
 }
+/**
+ * Returns the first character in [ptr, end) a string literal can't just copy: its
+ * closing delimiter, a backslash or a newline
+ */
+static const char *lex_string_find_special(const char *ptr, const char *end, char end_delim)
+{
+#ifdef __SSE2__
+    const __m128i delim = _mm_set1_epi8(end_delim);
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i newline = _mm_set1_epi8('\n');
+    while (end - ptr >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)ptr);
+        __m128i match = _mm_or_si128(_mm_cmpeq_epi8(chunk, delim),
+                                     _mm_or_si128(_mm_cmpeq_epi8(chunk, backslash), _mm_cmpeq_epi8(chunk, newline)));
+        int mask = _mm_movemask_epi8(match);
+        if (mask)
+        {
+            return ptr + __builtin_ctz(mask);
+        }
+        ptr += 16;
+    }
+#endif
+    for (; ptr < end; ptr++)
+    {
+        if (*ptr == end_delim || *ptr == '\\' || *ptr == '\n')
+        {
+            return ptr;
+        }
+    }
+    return end;
+}
+
+/**
+ * Copies the characters up to the next one that needs a look straight from the file,
+ * the run has no newline so only the column moves. Other inputs go a character at a time
+ */
+static void lex_copy_string_run(struct buffer *buf, char end_delim)
+{
+    struct buffer *source = lex_process->function->source ? lex_process->function->source(lex_process) : NULL;
+    // reading the file with nextc moves the compiler's position too
+    if (source != lex_process->compiler->cfile.buffer)
+    {
+        return;
+    }
+
+    const char *start = source->data + source->rindex;
+    size_t length = lex_string_find_special(start, source->data + source->len, end_delim) - start;
+    buffer_write_bytes(buf, start, length);
+    source->rindex += length;
+    lex_process->pos.col += length;
+    lex_process->compiler->pos.col += length;
+}
+
+// a byte of a multibyte UTF-8 sequence, EOF is (char)-1 and has the high bit set too
+static bool lex_is_utf8_byte(char c)
+{
+    return c != EOF && (c & 0x80);
+}
+
+static int lex_hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if ((c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'))
+    {
+        return (c | 0x20) - 'a' + 10;
+    }
+    return -1;
+}
+
+/**
+ * Reads the escape sequence after a backslash and returns the value it stands for,
+ * a universal character name gives its code point and sets universal
+ */
+static uint32_t lex_read_escape(bool *universal)
+{
+    *universal = false;
+    char c = nextc();
+    switch (c)
+    {
+    case 'n':
+        return '\n';
+    case 't':
+        return '\t';
+    case 'r':
+        return '\r';
+    case 'a':
+        return '\a';
+    case 'b':
+        return '\b';
+    case 'f':
+        return '\f';
+    case 'v':
+        return '\v';
+    case '\\':
+    case '\'':
+    case '"':
+    case '?':
+        return c;
+
+    case 'x':
+    {
+        if (lex_hex_value(peekc()) < 0)
+        {
+            compiler_error(lex_process->compiler, "Expecting hex digits after \\x\n");
+        }
+
+        uint32_t value = 0;
+        for (int digit = lex_hex_value(peekc()); digit >= 0; digit = lex_hex_value(peekc()))
+        {
+            nextc();
+            value = value > 0xFF ? value : value << 4 | digit;
+        }
+        if (value > 0xFF)
+        {
+            compiler_error(lex_process->compiler, "Hex escape sequence out of range\n");
+        }
+        return value;
+    }
+
+    case 'u':
+    case 'U':
+        pushc(c);
+        *universal = true;
+        return lex_read_universal_character();
+    }
+
+    if (c >= '0' && c <= '7')
+    {
+        // up to three octal digits
+        uint32_t value = c - '0';
+        for (int i = 1; i < 3 && peekc() >= '0' && peekc() <= '7'; i++)
+        {
+            value = value << 3 | (nextc() - '0');
+        }
+        if (value > 0xFF)
+        {
+            compiler_error(lex_process->compiler, "Octal escape sequence out of range\n");
+        }
+        return value;
+    }
+
+    compiler_error(lex_process->compiler, "Invalid escape character: \\%c\n", c);
+    return 0;
+}
+
 static struct token *token_make_string(char start_delim, char end_delim)
 {
     struct buffer *buf = buffer_create();
+    // the name in #include "name" is no string literal, a backslash in it is a backslash
+    bool raw = start_delim == '<' || token_is_identifier(lexer_last_token(), "include");
     assert(nextc() == start_delim);
-    char c = nextc();
-    for (; c != end_delim && c != EOF; c = nextc())
+    while (true)
     {
-        if (c == '\\')
+        lex_copy_string_run(buf, end_delim);
+        char c = nextc();
+        if (c == end_delim)
         {
-            // we need to handle an escape character
+            break;
+        }
+        if (c == EOF || c == '\n')
+        {
+            compiler_error(lex_process->compiler, "Unterminated string, expecting %c\n", end_delim);
+        }
+        if (c != '\\' || raw)
+        {
+            buffer_write(buf, c);
+            continue;
+        }
+
+        if (peekc() == '\n')
+        {
+            // a line splice
+            nextc();
             continue;
         }
-        buffer_write(buf, c);
+
+        bool universal;
+        uint32_t value = lex_read_escape(&universal);
+        if (universal)
+        {
+            // stored in UTF-8 like the rest of the source
+            char bytes[UTF8_MAX_LENGTH];
+            buffer_write_bytes(buf, bytes, utf8_encode(value, bytes));
+            continue;
+        }
+        buffer_write(buf, value);
     }
+
+    // the value may hold a '\0', the length says where it ends
+    size_t length = buf->len;
     buffer_write(buf, 0x00);
+
+    // the buffer grows in big steps, the literal keeps only what it needs
+    char *text = malloc(buf->len);
+    memcpy(text, buffer_ptr(buf), buf->len);
+    buffer_free(buf);
     return token_create(&(struct token){
-        .type = TOKEN_TYPE_STRING, .sval = buffer_ptr(buf)});
+        .type = TOKEN_TYPE_STRING, .sval = text, .length = length});
 }
 
 static struct token *token_make_symbol()
@@ -337,36 +537,199 @@ static struct token *token_make_symbol()
     {
         lex_finish_expression();
     }
+    else if (c == '#' && peekc() == '#')
+    {
+        nextc();
+        return token_create(&(struct token){
+            .type = TOKEN_TYPE_OPERATOR, .op = OP_HASH_HASH, .sval = token_op_spelling(OP_HASH_HASH)});
+    }
 
     struct token *token = token_create(&(struct token){
-        .type = TOKEN_TYPE_SYMBOL, .cval = c});
+        .type = TOKEN_TYPE_SYMBOL, .op = token_symbol_op(c), .cval = c});
     return token;
 }
 
+// code points C11 allows in identifiers (annex D.1), ascending
+static const uint32_t lex_identifier_ranges[][2] = {
+    {0x00A8, 0x00A8}, {0x00AA, 0x00AA}, {0x00AD, 0x00AD}, {0x00AF, 0x00AF}, {0x00B2, 0x00B5},
+    {0x00B7, 0x00BA}, {0x00BC, 0x00BE}, {0x00C0, 0x00D6}, {0x00D8, 0x00F6}, {0x00F8, 0x00FF},
+    {0x0100, 0x167F}, {0x1681, 0x180D}, {0x180F, 0x1FFF}, {0x200B, 0x200D}, {0x202A, 0x202E},
+    {0x203F, 0x2040}, {0x2054, 0x2054}, {0x2060, 0x206F}, {0x2070, 0x218F}, {0x2460, 0x24FF},
+    {0x2776, 0x2793}, {0x2C00, 0x2DFF}, {0x2E80, 0x2FFF}, {0x3004, 0x3007}, {0x3021, 0x302F},
+    {0x3031, 0x303F}, {0x3040, 0xD7FF}, {0xF900, 0xFD3D}, {0xFD40, 0xFDCF}, {0xFDF0, 0xFE44},
+    {0xFE47, 0xFFFD}, {0x10000, 0x1FFFD}, {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD}, {0x40000, 0x4FFFD},
+    {0x50000, 0x5FFFD}, {0x60000, 0x6FFFD}, {0x70000, 0x7FFFD}, {0x80000, 0x8FFFD}, {0x90000, 0x9FFFD},
+    {0xA0000, 0xAFFFD}, {0xB0000, 0xBFFFD}, {0xC0000, 0xCFFFD}, {0xD0000, 0xDFFFD}, {0xE0000, 0xEFFFD}};
+
+// combining marks that may not start an identifier (annex D.2)
+static const uint32_t lex_identifier_not_first[][2] = {
+    {0x0300, 0x036F}, {0x1DC0, 0x1DFF}, {0x20D0, 0x20FF}, {0xFE20, 0xFE2F}};
+
+static bool lex_codepoint_in(const uint32_t ranges[][2], size_t total, uint32_t codepoint)
+{
+    size_t low = 0;
+    size_t high = total;
+    while (low < high)
+    {
+        size_t middle = (low + high) / 2;
+        if (codepoint < ranges[middle][0])
+        {
+            high = middle;
+        }
+        else if (codepoint > ranges[middle][1])
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool lex_is_identifier_codepoint(uint32_t codepoint, bool first)
+{
+    if (first && lex_codepoint_in(lex_identifier_not_first, sizeof(lex_identifier_not_first) / sizeof(*lex_identifier_not_first), codepoint))
+    {
+        return false;
+    }
+    return lex_codepoint_in(lex_identifier_ranges, sizeof(lex_identifier_ranges) / sizeof(*lex_identifier_ranges), codepoint);
+}
+
+// the ASCII characters of identifiers, not isalpha which depends on the locale
+static bool lex_is_identifier_char(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+/**
+ * Reads a universal character name, \u and four or \U and eight hex digits, the
+ * backslash is already read
+ */
+static uint32_t lex_read_universal_character()
+{
+    int digits = nextc() == 'u' ? 4 : 8;
+    uint32_t codepoint = 0;
+    for (int i = 0; i < digits; i++)
+    {
+        int value = lex_hex_value(peekc());
+        if (value < 0)
+        {
+            compiler_error(lex_process->compiler, "Expecting %i hex digits in a universal character name\n", digits);
+        }
+        nextc();
+        codepoint = codepoint << 4 | value;
+    }
+
+    // C11 6.4.3, only $, @ and ` of the basic characters may be spelled this way
+    if (codepoint > UTF8_MAX_CODEPOINT || (codepoint >= 0xD800 && codepoint <= 0xDFFF) ||
+        (codepoint < 0xA0 && codepoint != '$' && codepoint != '@' && codepoint != '`'))
+    {
+        compiler_error(lex_process->compiler, "Invalid universal character name U+%04X\n", codepoint);
+    }
+    return codepoint;
+}
+
+/**
+ * True when the next characters are a \u or \U universal character name
+ */
+static bool lex_at_universal_character()
+{
+    if (peekc() != '\\')
+    {
+        return false;
+    }
+    nextc();
+    char c = peekc();
+    pushc('\\');
+    return c == 'u' || c == 'U';
+}
+
+/**
+ * Reads the character of an identifier that is not ASCII, spelled in UTF-8 or as a
+ * universal character name, and appends it in UTF-8 so both spellings are one name
+ */
+static void lex_read_identifier_codepoint(struct buffer *buf, bool first)
+{
+    uint32_t codepoint;
+    char c = peekc();
+    if (c == '\\')
+    {
+        nextc();
+        codepoint = lex_read_universal_character();
+    }
+    else
+    {
+        // the source is valid UTF-8, the lead byte says how long the sequence is
+        char bytes[UTF8_MAX_LENGTH];
+        size_t length = (c & 0xE0) == 0xC0 ? 2 : (c & 0xF0) == 0xE0 ? 3 : 4;
+        for (size_t i = 0; i < length; i++)
+        {
+            bytes[i] = nextc();
+        }
+        if (utf8_decode(bytes, length, &codepoint) != length)
+        {
+            compiler_error(lex_process->compiler, "Invalid UTF-8 in an identifier\n");
+        }
+    }
+
+    if (!lex_is_identifier_codepoint(codepoint, first))
+    {
+        compiler_error(lex_process->compiler, "Character U+%04X is not allowed %s an identifier\n", codepoint, first ? "to start" : "in");
+    }
+
+    char bytes[UTF8_MAX_LENGTH];
+    size_t length = utf8_encode(codepoint, bytes);
+    for (size_t i = 0; i < length; i++)
+    {
+        buffer_write(buf, bytes[i]);
+    }
+}
+
 static struct token *token_make_identifier_or_keyword()
 {
     struct buffer *buf = buffer_create();
-    char c = 0;
-    LEX_GETC_IF(buf, c, (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_');
+    while (true)
+    {
+        char c = peekc();
+        if (lex_is_identifier_char(c))
+        {
+            buffer_write(buf, c);
+            nextc();
+        }
+        else if (lex_is_utf8_byte(c) || lex_at_universal_character())
+        {
+            lex_read_identifier_codepoint(buf, buf->len == 0);
+        }
+        else
+        {
+            break;
+        }
+    }
 
     // null terminator
     buffer_write(buf, 0x00);
 
+    // names are interned so later stages can compare them by pointer
+    const char *name = intern_table_add(lex_process->compiler->identifiers, buffer_ptr(buf), buf->len - 1);
+    buffer_free(buf);
+
     // check if this is a keyword
-    if (is_keyword(buffer_ptr(buf)))
+    if (is_keyword(name))
     {
         return token_create(&(struct token){
-            .type = TOKEN_TYPE_KEYWORD, .sval = buffer_ptr(buf)});
+            .type = TOKEN_TYPE_KEYWORD, .sval = name});
     }
 
     return token_create(&(struct token){
-        .type = TOKEN_TYPE_IDENTIFIER, .sval = buffer_ptr(buf)});
+        .type = TOKEN_TYPE_IDENTIFIER, .sval = name});
 }
 
 struct token *read_special_token()
 {
     char c = peekc();
-    if (isalpha(c) || c == '_')
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || lex_is_utf8_byte(c) || lex_at_universal_character())
     {
         return token_make_identifier_or_keyword();
     }
@@ -376,26 +739,17 @@ struct token *read_special_token()
 struct token *token_make_newline()
 {
     nextc();
-    return token_create(&(struct token){
-        .type = TOKEN_TYPE_NEWLINE});
-}
-
-char lex_get_escaped_char(char c)
-{
-    switch (c)
+    // blank lines after it end nothing more, unless a backslash splices this one
+    struct token *last_token = lexer_last_token();
+    if (!last_token || !token_is_symbol(last_token, '\\'))
     {
-    case 'n':
-        return '\n';
-    case 't':
-        return '\t';
-    case '\\':
-        return '\\';
-    case '\'':
-        return '\'';
-    default:
-        compiler_error(lex_process->compiler, "Invalid escape character: \\%c\n", c);
+        for (char c = peekc(); c == '\n' || c == ' ' || c == '\t'; c = peekc())
+        {
+            nextc();
+        }
     }
-    return 0;
+    return token_create(&(struct token){
+        .type = TOKEN_TYPE_NEWLINE});
 }
 
 void lexer_pop_token()
@@ -405,13 +759,11 @@ void lexer_pop_token()
 
 bool is_hex_cahr(char c)
 {
-    c = tolower(c);
-    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+    return lex_hex_value(c) >= 0;
 }
 
-const char *read_hex_number_str()
+const char *read_hex_number_str(struct buffer *buffer)
 {
-    struct buffer *buffer = buffer_create();
     char c = peekc();
     LEX_GETC_IF(buffer, c, is_hex_cahr(c));
     // wrtie our null terminator
@@ -424,40 +776,25 @@ struct token *token_make_special_number_hexadecimal()
     // skip the "x"
     nextc();
 
-    unsigned long number = 0;
-    const char *number_str = read_hex_number_str();
-    number = strtol(number_str, 0, 16);
+    struct buffer *buffer = buffer_create();
+    unsigned long number = strtol(read_hex_number_str(buffer), 0, 16);
+    buffer_free(buffer);
     return token_make_number_for_value(number);
 }
 
-struct token *token_make_special_number()
-{
-    struct token *token = NULL;
-    struct token *last_token = lexer_last_token();
-
-    // pop off 0
-    lexer_pop_token();
-
-    char c = peekc();
-    // 0x123
-    if (c == 'x')
-    {
-        token = token_make_special_number_hexadecimal();
-    }
-
-    return token;
-}
-
 struct token *token_make_quote()
 {
     assert_next_char('\'');
     char c = nextc();
-    // \n
     if (c == '\\')
     {
-        // \n -> c = n
-        c = nextc();
-        c = lex_get_escaped_char(c);
+        bool universal;
+        uint32_t value = lex_read_escape(&universal);
+        if (universal && value > 0x7F)
+        {
+            compiler_error(lex_process->compiler, "U+%04X does not fit in a char\n", value);
+        }
+        c = value;
     }
     if (nextc() != '\'')
     {
@@ -468,9 +805,32 @@ struct token *token_make_quote()
         .type = TOKEN_TYPE_NUMBER, .cval = c});
 }
 
+/**
+ * Reads a number or char literal with make and keeps how it was written on the token
+ */
+static struct token *lex_spelled_token(struct token *(*make)())
+{
+    if (!lex_process->spelling)
+    {
+        lex_process->spelling = buffer_create();
+    }
+    lex_process->spelling->len = 0;
+    token_spelling = lex_process->spelling;
+    struct token *token = make();
+    token_spelling = NULL;
+    token->spelling = intern_table_add(lex_process->compiler->identifiers, buffer_ptr(lex_process->spelling), lex_process->spelling->len);
+    return token;
+}
+
+static struct token *lex_number()
+{
+    return token_make_number(lex_process->compiler, peekc());
+}
+
 struct token *read_next_token()
 {
     struct token *token = NULL;
+    token_start = lex_file_position();
     char c = peekc();
     token = handle_comment();
     if (token)
@@ -478,10 +838,16 @@ struct token *read_next_token()
         return token;
     }
 
+    // \u00e9 starts an identifier, any other backslash is a symbol
+    if (c == '\\' && lex_at_universal_character())
+    {
+        return token_make_identifier_or_keyword();
+    }
+
     switch (c)
     {
     NUMERIC_CASES:
-        token = token_make_number(lex_process->compiler, c);
+        token = lex_spelled_token(lex_number);
         break;
     OPERATOR_CASE_EXCLUDING_DIVISION:
         token = token_make_operator_or_string();
@@ -489,14 +855,11 @@ struct token *read_next_token()
     SYMBOL_CASE:
         token = token_make_symbol();
         break;
-    case 'x':
-        token = token_make_special_number();
-        break;
     case '"':
         token = token_make_string('"', '"');
         break;
     case '\'':
-        token = token_make_quote();
+        token = lex_spelled_token(token_make_quote);
         break;
     case ' ':
     case '\t':
@@ -520,18 +883,345 @@ struct token *read_next_token()
     return token;
 }
 
-int lex(struct lex_process *process)
+/**
+ * Returns the first character in [ptr, end) that matters while skipping an inactive
+ * region: a newline, the start of a comment, string or char literal, or a line splice
+ */
+static const char *lex_skip_find_special(const char *ptr, const char *end)
 {
-    process->currtent_expression_count = 0;
-    process->parenthsess_buffer = NULL;
-    lex_process = process;
-    process->pos.filename = process->compiler->cfile.abs_path;
+#ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i slash = _mm_set1_epi8('/');
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i single_quote = _mm_set1_epi8('\'');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    while (end - ptr >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)ptr);
+        __m128i match = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, newline), _mm_cmpeq_epi8(chunk, slash)),
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, single_quote)),
+                         _mm_cmpeq_epi8(chunk, backslash)));
+        int mask = _mm_movemask_epi8(match);
+        if (mask)
+        {
+            return ptr + __builtin_ctz(mask);
+        }
+        ptr += 16;
+    }
+#endif
+    for (; ptr < end; ptr++)
+    {
+        char c = *ptr;
+        if (c == '\n' || c == '/' || c == '"' || c == '\'' || c == '\\')
+        {
+            return ptr;
+        }
+    }
+    return end;
+}
+
+static const char *lex_skip_horizontal_whitespace(const char *ptr, const char *end)
+{
+    while (ptr < end && (*ptr == ' ' || *ptr == '\t'))
+    {
+        ptr++;
+    }
+    return ptr;
+}
+
+/**
+ * Skips spaces, tabs and block comments, which stand for a space in front of a
+ * directive and between its '#' and its name. Newlines in the comments are counted
+ */
+static const char *lex_skip_blank(const char *ptr, const char *end, int *lines, const char **line_begin)
+{
+    while (true)
+    {
+        ptr = lex_skip_horizontal_whitespace(ptr, end);
+        if (end - ptr < 2 || ptr[0] != '/' || ptr[1] != '*')
+        {
+            return ptr;
+        }
+
+        ptr += 2;
+        while (ptr < end && !(ptr[0] == '*' && ptr + 1 < end && ptr[1] == '/'))
+        {
+            if (*ptr == '\n')
+            {
+                (*lines)++;
+                *line_begin = ptr + 1;
+            }
+            ptr++;
+        }
+        if (ptr == end)
+        {
+            return end;
+        }
+        ptr += 2;
+    }
+}
+
+/**
+ * Returns true if ptr points at the given directive name as a whole word
+ */
+static bool lex_skip_directive_is(const char *ptr, const char *end, const char *name)
+{
+    size_t len = strlen(name);
+    if (end - ptr < len || strncmp(ptr, name, len) != 0)
+    {
+        return false;
+    }
+
+    // #ifdef must not match #if
+    return ptr + len == end || !(lex_is_identifier_char(ptr[len]) || (ptr[len] & 0x80));
+}
 
+/**
+ * Skips the text of an inactive conditional branch without tokenizing it. Stops in
+ * front of the #elif, #else or #endif that belongs to the current conditional, nested
+ * conditionals are skipped whole. Comments, strings and char literals are stepped over
+ * so a '#' or quote inside them is never mistaken for anything else.
+ *
+ * The caller must be at the start of a line. Returns false if the input cannot be
+ * scanned directly, the caller then has to lex the region and discard it.
+ */
+bool lex_skip_inactive_region(struct lex_process *process)
+{
+    if (!process->function->source)
+    {
+        return false;
+    }
+
+    struct buffer *source = process->function->source(process);
+    if (!source)
+    {
+        return false;
+    }
+
+    const char *start = source->data + source->rindex;
+    const char *end = source->data + source->len;
+    const char *line_begin = start;
+    const char *ptr = start;
+    int lines = 0;
+    int depth = 0;
+    bool line_start = true;
+    while (ptr < end)
+    {
+        if (line_start)
+        {
+            line_start = false;
+            const char *hash = lex_skip_blank(ptr, end, &lines, &line_begin);
+            ptr = hash;
+            if (hash < end && *hash == '#')
+            {
+                const char *name = lex_skip_blank(hash + 1, end, &lines, &line_begin);
+                if (lex_skip_directive_is(name, end, "if") || lex_skip_directive_is(name, end, "ifdef") || lex_skip_directive_is(name, end, "ifndef"))
+                {
+                    depth++;
+                }
+                else if (lex_skip_directive_is(name, end, "endif"))
+                {
+                    if (depth == 0)
+                    {
+                        ptr = hash;
+                        break;
+                    }
+                    depth--;
+                }
+                else if (depth == 0 && (lex_skip_directive_is(name, end, "elif") || lex_skip_directive_is(name, end, "else")))
+                {
+                    ptr = hash;
+                    break;
+                }
+                ptr = name;
+            }
+        }
+
+        ptr = lex_skip_find_special(ptr, end);
+        if (ptr == end)
+        {
+            break;
+        }
+
+        char c = *ptr++;
+        if (c == '\n')
+        {
+            lines++;
+            line_begin = ptr;
+            line_start = true;
+        }
+        else if (c == '\\')
+        {
+            // a line splice, the next line continues this one
+            if (ptr < end && *ptr == '\n')
+            {
+                ptr++;
+                lines++;
+                line_begin = ptr;
+            }
+        }
+        else if (c == '/' && ptr < end && *ptr == '/')
+        {
+            // the line comment ends with the line, splices included
+            while (ptr < end && *ptr != '\n')
+            {
+                if (*ptr == '\\' && ptr + 1 < end && ptr[1] == '\n')
+                {
+                    ptr++;
+                    lines++;
+                    line_begin = ptr + 1;
+                }
+                ptr++;
+            }
+        }
+        else if (c == '/' && ptr < end && *ptr == '*')
+        {
+            ptr++;
+            while (ptr < end)
+            {
+                const char *star = memchr(ptr, '*', end - ptr);
+                const char *comment_end = star ? star : end;
+                for (const char *nl = memchr(ptr, '\n', comment_end - ptr); nl; nl = memchr(nl + 1, '\n', comment_end - nl - 1))
+                {
+                    lines++;
+                    line_begin = nl + 1;
+                }
+                ptr = comment_end;
+                if (!star)
+                {
+                    break;
+                }
+                ptr++;
+                if (ptr < end && *ptr == '/')
+                {
+                    ptr++;
+                    break;
+                }
+            }
+        }
+        else if (c == '"' || c == '\'')
+        {
+            // an unterminated literal ends with the line, like an apostrophe in #error
+            while (ptr < end && *ptr != c && *ptr != '\n')
+            {
+                if (*ptr == '\\' && ptr + 1 < end)
+                {
+                    if (ptr[1] == '\n')
+                    {
+                        lines++;
+                        line_begin = ptr + 2;
+                    }
+                    ptr++;
+                }
+                ptr++;
+            }
+            if (ptr < end && *ptr == c)
+            {
+                ptr++;
+            }
+        }
+    }
+
+    if (ptr > end)
+    {
+        ptr = end;
+    }
+
+    int col = (int)(ptr - line_begin) + 1;
+    source->rindex = ptr - source->data;
+    process->pos.line += lines;
+    process->pos.col = lines ? col : process->pos.col + (int)(ptr - start);
+    process->compiler->pos.line = process->pos.line;
+    process->compiler->pos.col = process->pos.col;
+    return true;
+}
+
+struct token *lex_next_token(struct lex_process *process)
+{
+    lex_process = process;
     struct token *token = read_next_token();
+    if (!token)
+    {
+        return NULL;
+    }
+
+    vector_push(process->token_vec, token);
+    token = vector_back(process->token_vec);
+
+    // consume the whitespace that follows so the token is complete
+    // by the time the caller sees it
+    char c = peekc();
+    while (c == ' ' || c == '\t')
+    {
+        token->whitespace = true;
+        nextc();
+        c = peekc();
+    }
+    return token;
+}
+
+static char lexer_string_buffer_next_char(struct lex_process *process)
+{
+    struct buffer *buf = lex_process_private(process);
+    return buffer_read(buf);
+}
+
+static char lexer_string_buffer_peek_char(struct lex_process *process)
+{
+    struct buffer *buf = lex_process_private(process);
+    return buffer_peek(buf);
+}
+
+static void lexer_string_buffer_push_char(struct lex_process *process, char c)
+{
+    struct buffer *buf = lex_process_private(process);
+    assert(buf->rindex > 0 && buf->data[buf->rindex - 1] == c);
+    buf->rindex--;
+}
+
+static struct buffer *lexer_string_buffer_source(struct lex_process *process)
+{
+    return lex_process_private(process);
+}
+
+struct lex_precess_functions lexer_string_buffer_functions = {
+    .next_char = lexer_string_buffer_next_char,
+    .peek_char = lexer_string_buffer_peek_char,
+    .push_char = lexer_string_buffer_push_char,
+    .source = lexer_string_buffer_source};
+
+/**
+ * Lexes the given string on its own, used by the preprocessor to form tokens
+ * that did not come from a file
+ */
+struct vector *tokens_build_for_string(struct compile_process *compiler, const char *str)
+{
+    struct buffer *buffer = buffer_create();
+    while (*str)
+    {
+        buffer_write(buffer, *str);
+        str++;
+    }
+
+    struct lex_process *process = lex_process_create(compiler, &lexer_string_buffer_functions, buffer);
+    if (lex(process) != LEXICAL_ANALYSIS_ALL_OK)
+    {
+        return NULL;
+    }
+
+    struct vector *tokens = lex_process_tokens(process);
+    free(process);
+    buffer_free(buffer);
+    return tokens;
+}
+
+int lex(struct lex_process *process)
+{
+    struct token *token = lex_next_token(process);
     while (token)
     {
-        vector_push(process->token_vec, token);
-        token = read_next_token();
+        token = lex_next_token(process);
     }
     return LEXICAL_ANALYSIS_ALL_OK;
 }
\ No newline at end of file
@@ -0,0 +1,1226 @@
+#include "compiler.h"
+#include "helpers/vector.h"
+#include <stdlib.h>
+#include <assert.h>
+
+/**
+ * Natural loops and the passes that work on them. Loops come from the back
+ * edges of the dominator tree, and every pass first gives each loop a
+ * preheader: a block outside the loop that only goes to the header, where the
+ * code that runs once before the loop is placed
+ */
+
+// loops with a constant trip count up to this are unrolled completely
+#define LOOP_UNROLL_TRIPS 8
+// as long as the copies add up to no more than this many instructions
+#define LOOP_UNROLL_SIZE 96
+// addresses of one loop that get a pointer of their own, each takes a register
+#define LOOP_REDUCE_LIMIT 6
+
+// what strength reduction knows about a value
+enum
+{
+    LOOP_UNKNOWN,
+    // start + iteration * step for a start and step that do not change in the loop
+    LOOP_AFFINE,
+    LOOP_NOT_AFFINE
+};
+
+struct loop_reduce
+{
+    struct ir_function *function;
+    struct loop_nest *nest;
+    int loop;
+    // values created for the loop are not looked at
+    uint32_t instruction_count;
+    unsigned char *state;
+    // the value is the mathematical result, so extending it is still affine
+    bool *exact;
+    // instructions of the loop that compute the value
+    uint32_t *cost;
+    // value in the first iteration and how much it grows by, both in the preheader
+    uint32_t *start;
+    uint32_t *step;
+    bool *stepped;
+    bool *chosen;
+    // values with an entry above, cleared for the next loop
+    struct vector *touched;
+    // new code goes in front of the preheader's jump
+    uint32_t before;
+};
+
+static int loop_compare_blocks(const void *a, const void *b)
+{
+    uint32_t left = *(const uint32_t *)a;
+    uint32_t right = *(const uint32_t *)b;
+    return left < right ? -1 : left > right;
+}
+
+static int loop_compare_sizes(const void *a, const void *b)
+{
+    const struct loop *left = a;
+    const struct loop *right = b;
+    if (left->block_count != right->block_count)
+    {
+        return left->block_count < right->block_count ? -1 : 1;
+    }
+    return loop_compare_blocks(&left->header, &right->header);
+}
+
+/**
+ * The outermost loop found around the loop so far, the loops looked at on the
+ * way point straight to it afterwards
+ */
+static int loop_outermost(int *outer, int loop)
+{
+    int root = loop;
+    while (outer[root] != root)
+    {
+        root = outer[root];
+    }
+    while (outer[loop] != root)
+    {
+        int next = outer[loop];
+        outer[loop] = root;
+        loop = next;
+    }
+    return root;
+}
+
+/**
+ * Reverse postorder of the blocks reachable from the entry
+ */
+static void loop_order_blocks(struct loop_nest *nest)
+{
+    struct ir_function *function = nest->function;
+    uint32_t count = function->block_count;
+    uint32_t *stack = malloc(sizeof(uint32_t) * count);
+    int *cursor = calloc(count, sizeof(int));
+    uint32_t *postorder = malloc(sizeof(uint32_t) * count);
+    uint32_t top = 0;
+    uint32_t done = 0;
+    stack[top++] = 1;
+    cursor[1] = 0;
+    bool *visited = calloc(count, sizeof(bool));
+    visited[1] = true;
+    while (top)
+    {
+        uint32_t block = stack[top - 1];
+        if (cursor[block] < 2)
+        {
+            uint32_t successor = function->blocks[block].successors[cursor[block]++];
+            if (successor != IR_NONE && !visited[successor])
+            {
+                visited[successor] = true;
+                stack[top++] = successor;
+            }
+            continue;
+        }
+        postorder[done++] = block;
+        top--;
+    }
+
+    nest->order = malloc(sizeof(uint32_t) * (done + 1));
+    nest->order_count = done;
+    for (uint32_t i = 0; i < done; i++)
+    {
+        nest->order[i] = postorder[done - 1 - i];
+    }
+    free(stack);
+    free(cursor);
+    free(postorder);
+    free(visited);
+}
+
+/**
+ * Finds the loops of the function, predecessors and dominators are computed first
+ */
+struct loop_nest *loop_nest_create(struct ir_function *function)
+{
+    ir_compute_predecessors(function);
+    ssa_compute_dominators(function);
+    struct loop_nest *nest = calloc(1, sizeof(struct loop_nest));
+    nest->function = function;
+    loop_order_blocks(nest);
+
+    // dominator tree numbering, a dominates b when b's interval nests in a's
+    uint32_t count = function->block_count;
+    uint32_t *first_child = calloc(count, sizeof(uint32_t));
+    uint32_t *next_sibling = calloc(count, sizeof(uint32_t));
+    uint32_t *enter = calloc(count, sizeof(uint32_t));
+    uint32_t *leave = calloc(count, sizeof(uint32_t));
+    for (uint32_t i = nest->order_count; i-- > 1;)
+    {
+        uint32_t block = nest->order[i];
+        uint32_t idom = function->blocks[block].idom;
+        next_sibling[block] = first_child[idom];
+        first_child[idom] = block;
+    }
+
+    uint32_t *stack = malloc(sizeof(uint32_t) * count);
+    uint32_t top = 0;
+    uint32_t clock = 1;
+    stack[top++] = 1;
+    while (top)
+    {
+        uint32_t block = stack[top - 1];
+        if (!enter[block])
+        {
+            enter[block] = clock++;
+            for (uint32_t child = first_child[block]; child != IR_NONE; child = next_sibling[child])
+            {
+                stack[top++] = child;
+            }
+            continue;
+        }
+        if (!leave[block])
+        {
+            leave[block] = clock++;
+        }
+        top--;
+    }
+
+    struct vector *loops = vector_create(sizeof(struct loop));
+    uint32_t *mark = calloc(count, sizeof(uint32_t));
+    for (uint32_t i = 0; i < nest->order_count; i++)
+    {
+        uint32_t header = nest->order[i];
+        struct ir_block *block = &function->blocks[header];
+        struct vector *blocks = NULL;
+        uint32_t latch = IR_NONE;
+        uint32_t back_edges = 0;
+        for (uint32_t p = 0; p < block->pred_count; p++)
+        {
+            uint32_t pred = function->preds[block->preds + p];
+            if (!enter[pred] || enter[pred] < enter[header] || leave[pred] > leave[header])
+            {
+                continue;
+            }
+
+            back_edges++;
+            latch = pred;
+            if (!blocks)
+            {
+                blocks = vector_create(sizeof(uint32_t));
+                mark[header] = header;
+                vector_push(blocks, &header);
+            }
+
+            // the blocks that reach the latch without going through the header
+            top = 0;
+            if (mark[pred] != header)
+            {
+                mark[pred] = header;
+                vector_push(blocks, &pred);
+                stack[top++] = pred;
+            }
+            while (top)
+            {
+                struct ir_block *body = &function->blocks[stack[--top]];
+                for (uint32_t q = 0; q < body->pred_count; q++)
+                {
+                    uint32_t inner = function->preds[body->preds + q];
+                    if (enter[inner] && mark[inner] != header)
+                    {
+                        mark[inner] = header;
+                        vector_push(blocks, &inner);
+                        stack[top++] = inner;
+                    }
+                }
+            }
+        }
+
+        if (!blocks)
+        {
+            continue;
+        }
+
+        struct loop loop = {.header = header, .latch = back_edges == 1 ? latch : IR_NONE, .parent = -1};
+        uint32_t outside = 0;
+        for (uint32_t p = 0; p < block->pred_count; p++)
+        {
+            uint32_t pred = function->preds[block->preds + p];
+            if (mark[pred] != header)
+            {
+                outside++;
+                loop.preheader = pred;
+            }
+        }
+        if (outside != 1 || function->blocks[loop.preheader].successors[1] != IR_NONE)
+        {
+            loop.preheader = IR_NONE;
+        }
+
+        loop.block_count = vector_count(blocks);
+        loop.blocks = malloc(sizeof(uint32_t) * loop.block_count);
+        memcpy(loop.blocks, vector_data_ptr(blocks), sizeof(uint32_t) * loop.block_count);
+        qsort(loop.blocks, loop.block_count, sizeof(uint32_t), loop_compare_blocks);
+        vector_free(blocks);
+        vector_push(loops, &loop);
+    }
+
+    nest->count = vector_count(loops);
+    nest->loops = malloc(sizeof(struct loop) * (nest->count + 1));
+    memcpy(nest->loops, vector_data_ptr(loops), sizeof(struct loop) * nest->count);
+    qsort(nest->loops, nest->count, sizeof(struct loop), loop_compare_sizes);
+    vector_free(loops);
+
+    // a loop is inside the smallest loop that contains its header
+    nest->innermost = malloc(sizeof(int) * count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        nest->innermost[i] = -1;
+    }
+    int *outer = malloc(sizeof(int) * (nest->count + 1));
+    for (int i = 0; i < nest->count; i++)
+    {
+        outer[i] = i;
+    }
+    for (int i = 0; i < nest->count; i++)
+    {
+        struct loop *loop = &nest->loops[i];
+        for (uint32_t b = 0; b < loop->block_count; b++)
+        {
+            int inner = nest->innermost[loop->blocks[b]];
+            if (inner < 0)
+            {
+                nest->innermost[loop->blocks[b]] = i;
+                continue;
+            }
+
+            inner = loop_outermost(outer, inner);
+            if (inner != i)
+            {
+                nest->loops[inner].parent = i;
+                outer[inner] = i;
+            }
+        }
+    }
+    free(outer);
+
+    free(first_child);
+    free(next_sibling);
+    free(enter);
+    free(leave);
+    free(stack);
+    free(mark);
+    return nest;
+}
+
+void loop_nest_free(struct loop_nest *nest)
+{
+    for (int i = 0; i < nest->count; i++)
+    {
+        free(nest->loops[i].blocks);
+    }
+    free(nest->loops);
+    free(nest->innermost);
+    free(nest->order);
+    free(nest);
+}
+
+/**
+ * Looks the block up in the blocks of the loop, which are in index order, rather
+ * than walking out from the block's innermost loop through every loop around it
+ */
+bool loop_contains(struct loop_nest *nest, int loop, uint32_t block)
+{
+    struct loop *found = &nest->loops[loop];
+    return bsearch(&block, found->blocks, found->block_count, sizeof(uint32_t), loop_compare_blocks) != NULL;
+}
+
+/**
+ * The edges from outside the loop move to a new block that jumps to the header.
+ * With more than one of them the new block merges their phi operands. The
+ * predecessors are changed in place, the order ir_compute_predecessors gives stays
+ */
+static void loop_insert_preheader(struct loop_nest *nest, int index)
+{
+    struct ir_function *function = nest->function;
+    uint32_t header = nest->loops[index].header;
+    struct ir_block *target = &function->blocks[header];
+    uint32_t count = target->pred_count;
+    bool *inside = malloc(sizeof(bool) * count);
+    uint32_t outside = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        inside[i] = loop_contains(nest, index, function->preds[target->preds + i]);
+        outside += !inside[i];
+    }
+
+    if (!outside)
+    {
+        free(inside);
+        return;
+    }
+
+    uint32_t block = ir_block_create(function);
+    target = &function->blocks[header];
+    for (uint32_t i = 0; i < count; i++)
+    {
+        struct ir_block *pred = &function->blocks[function->preds[target->preds + i]];
+        for (int s = 0; !inside[i] && s < 2; s++)
+        {
+            if (pred->successors[s] == header)
+            {
+                pred->successors[s] = block;
+            }
+        }
+    }
+
+    // the new block comes last in the header's predecessors, the blocks it merges keep their order
+    uint32_t *values = malloc(sizeof(uint32_t) * count);
+    for (uint32_t phi = target->first; phi != IR_NONE && function->instructions[phi].op == IR_PHI; phi = function->instructions[phi].next)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            values[i] = ir_operand(function, phi, i);
+        }
+
+        uint32_t merged = IR_NONE;
+        uint32_t kept = 0;
+        uint32_t moved = 0;
+        if (outside > 1)
+        {
+            merged = ir_append(function, block, IR_PHI, function->instructions[phi].type, outside);
+        }
+        for (uint32_t i = 0; i < count; i++)
+        {
+            if (inside[i])
+            {
+                ir_set_operand(function, phi, kept++, values[i]);
+            }
+            else if (outside > 1)
+            {
+                ir_set_operand(function, merged, moved++, values[i]);
+            }
+            else
+            {
+                merged = values[i];
+            }
+        }
+
+        ir_set_operand(function, phi, kept, merged);
+        for (uint32_t i = kept + 1; i < count; i++)
+        {
+            ir_set_operand(function, phi, i, IR_NONE);
+        }
+        function->instructions[phi].operand_count = kept + 1;
+    }
+
+    ir_append(function, block, IR_JUMP, IR_TYPE_VOID, 0);
+    function->blocks[block].successors[0] = header;
+
+    // the header keeps the predecessors inside the loop and gets the new block last,
+    // the new block takes the ones outside
+    if (function->pred_count + outside > function->pred_capacity)
+    {
+        function->pred_capacity = (function->pred_count + outside) * 2;
+        function->preds = realloc(function->preds, sizeof(uint32_t) * function->pred_capacity);
+    }
+    struct ir_block *preheader = &function->blocks[block];
+    target = &function->blocks[header];
+    preheader->preds = function->pred_count;
+    preheader->pred_count = 0;
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t pred = function->preds[target->preds + i];
+        if (inside[i])
+        {
+            function->preds[target->preds + kept++] = pred;
+        }
+        else
+        {
+            function->preds[preheader->preds + preheader->pred_count++] = pred;
+        }
+    }
+    function->preds[target->preds + kept] = block;
+    target->pred_count = kept + 1;
+    function->pred_count += outside;
+    free(inside);
+    free(values);
+}
+
+/**
+ * The loops of the function, each with a preheader where one could be made
+ */
+static struct loop_nest *loop_prepare(struct ir_function *function)
+{
+    struct loop_nest *nest = loop_nest_create(function);
+    bool inserted = false;
+    for (int i = 0; i < nest->count; i++)
+    {
+        if (nest->loops[i].preheader == IR_NONE)
+        {
+            loop_insert_preheader(nest, i);
+            inserted = true;
+        }
+    }
+
+    if (inserted)
+    {
+        loop_nest_free(nest);
+        nest = loop_nest_create(function);
+    }
+    return nest;
+}
+
+static uint32_t loop_pred_slot(struct ir_function *function, uint32_t block, uint32_t pred)
+{
+    struct ir_block *target = &function->blocks[block];
+    for (uint32_t i = 0; i < target->pred_count; i++)
+    {
+        if (function->preds[target->preds + i] == pred)
+        {
+            return i;
+        }
+    }
+    return target->pred_count;
+}
+
+static uint32_t loop_size(struct ir_function *function, struct loop *loop)
+{
+    uint32_t size = 0;
+    for (uint32_t b = 0; b < loop->block_count; b++)
+    {
+        for (uint32_t index = function->blocks[loop->blocks[b]].first; index != IR_NONE; index = function->instructions[index].next)
+        {
+            size++;
+        }
+    }
+    return size;
+}
+
+/**
+ * How often the body of a loop runs when its header counts a phi from one
+ * constant to another and it can only be left from the header
+ */
+static bool loop_trip_count(struct loop_nest *nest, int index, int *trips)
+{
+    struct ir_function *function = nest->function;
+    struct loop *loop = &nest->loops[index];
+    struct ir_block *header = &function->blocks[loop->header];
+    if (loop->preheader == IR_NONE || loop->latch == IR_NONE || header->pred_count != 2 || function->instructions[header->last].op != IR_BRANCH)
+    {
+        return false;
+    }
+
+    for (uint32_t b = 0; b < loop->block_count; b++)
+    {
+        struct ir_block *block = &function->blocks[loop->blocks[b]];
+        for (int s = 0; loop->blocks[b] != loop->header && s < 2; s++)
+        {
+            if (block->successors[s] != IR_NONE && !loop_contains(nest, index, block->successors[s]))
+            {
+                return false;
+            }
+        }
+    }
+
+    // the branch stays in the loop when the condition is not zero
+    bool taken_stays = loop_contains(nest, index, header->successors[0]);
+    if (taken_stays == loop_contains(nest, index, header->successors[1]))
+    {
+        return false;
+    }
+
+    uint32_t condition = ir_operand(function, header->last, 0);
+    struct ir_instruction *compare = &function->instructions[condition];
+    if (compare->op < IR_EQ || compare->op > IR_UGE || compare->block != loop->header)
+    {
+        return false;
+    }
+
+    long long bound;
+    uint32_t left = ir_operand(function, condition, 0);
+    uint32_t right = ir_operand(function, condition, 1);
+    bool phi_left = !optimize_constant_of(function, left, &bound);
+    uint32_t phi = phi_left ? left : right;
+    if ((phi_left && !optimize_constant_of(function, right, &bound)) || function->instructions[phi].op != IR_PHI || function->instructions[phi].block != loop->header)
+    {
+        return false;
+    }
+
+    long long value;
+    long long step;
+    uint32_t next = ir_operand(function, phi, loop_pred_slot(function, loop->header, loop->latch));
+    struct ir_instruction *increment = &function->instructions[next];
+    if (!optimize_constant_of(function, ir_operand(function, phi, loop_pred_slot(function, loop->header, loop->preheader)), &value) ||
+        (increment->op != IR_ADD && increment->op != IR_SUB))
+    {
+        return false;
+    }
+
+    bool step_right = ir_operand(function, next, 0) == phi && optimize_constant_of(function, ir_operand(function, next, 1), &step);
+    bool step_left = increment->op == IR_ADD && ir_operand(function, next, 1) == phi && optimize_constant_of(function, ir_operand(function, next, 0), &step);
+    if (!step_right && !step_left)
+    {
+        return false;
+    }
+
+    int type = function->instructions[phi].type;
+    for (int trip = 0; trip <= LOOP_UNROLL_TRIPS; trip++)
+    {
+        long long result;
+        if (!optimize_fold(compare->op, IR_TYPE_I32, type, phi_left ? value : bound, phi_left ? bound : value, &result))
+        {
+            return false;
+        }
+
+        if ((result != 0) != taken_stays)
+        {
+            *trips = trip;
+            return trip > 0;
+        }
+
+        if (!optimize_fold(increment->op, type, type, value, step, &value))
+        {
+            return false;
+        }
+    }
+    return false;
+}
+
+static uint32_t loop_mapped(uint32_t *values, uint32_t value)
+{
+    return values[value] != IR_NONE ? values[value] : value;
+}
+
+/**
+ * Lays out one copy of the body per iteration in front of the loop. The last
+ * copy goes to the header, which then always leaves so the old body becomes
+ * unreachable
+ */
+static void loop_unroll_one(struct loop_nest *nest, int index, int trips)
+{
+    struct ir_function *function = nest->function;
+    struct loop *loop = &nest->loops[index];
+    uint32_t header = loop->header;
+    uint32_t branch = function->blocks[header].last;
+    int exit = loop_contains(nest, index, function->blocks[header].successors[0]) ? 1 : 0;
+    uint32_t inside = function->blocks[header].successors[1 - exit];
+    uint32_t entry_slot = loop_pred_slot(function, header, loop->preheader);
+    uint32_t latch_slot = loop_pred_slot(function, header, loop->latch);
+
+    uint32_t count = function->instruction_count;
+    uint32_t *previous = calloc(count, sizeof(uint32_t));
+    uint32_t *current = calloc(count, sizeof(uint32_t));
+    uint32_t *blocks = calloc(function->block_count, sizeof(uint32_t));
+    // the block whose edge goes to the next copy
+    uint32_t back = loop->preheader;
+    for (int trip = 0; trip < trips; trip++)
+    {
+        for (uint32_t b = 0; b < loop->block_count; b++)
+        {
+            blocks[loop->blocks[b]] = ir_block_create(function);
+        }
+
+        for (int s = 0; s < 2; s++)
+        {
+            if (function->blocks[back].successors[s] == header)
+            {
+                function->blocks[back].successors[s] = blocks[header];
+            }
+        }
+
+        // header phis take the values of the previous iteration
+        for (uint32_t phi = function->blocks[header].first; function->instructions[phi].op == IR_PHI; phi = function->instructions[phi].next)
+        {
+            current[phi] = trip == 0 ? ir_operand(function, phi, entry_slot) : loop_mapped(previous, ir_operand(function, phi, latch_slot));
+        }
+
+        for (uint32_t b = 0; b < loop->block_count; b++)
+        {
+            uint32_t block = loop->blocks[b];
+            for (uint32_t own = function->blocks[block].first; own != IR_NONE; own = function->instructions[own].next)
+            {
+                struct ir_instruction *instruction = &function->instructions[own];
+                if (block == header && (instruction->op == IR_PHI || own == branch))
+                {
+                    continue;
+                }
+
+                uint32_t copy = ir_append(function, blocks[block], instruction->op, instruction->type, instruction->operand_count);
+                instruction = &function->instructions[own];
+                function->instructions[copy].aux = instruction->aux;
+                function->instructions[copy].constant = instruction->constant;
+                function->instructions[copy].symbol = instruction->symbol;
+                current[own] = copy;
+            }
+
+            // the copy of the header goes straight into the body
+            if (block == header)
+            {
+                ir_append(function, blocks[block], IR_JUMP, IR_TYPE_VOID, 0);
+            }
+
+            for (int s = 0; s < 2; s++)
+            {
+                uint32_t successor = block == header ? (s == 0 ? inside : IR_NONE) : function->blocks[block].successors[s];
+                // back edges stay on the header until the next copy takes them
+                function->blocks[blocks[block]].successors[s] = successor == IR_NONE || successor == header ? successor : blocks[successor];
+            }
+        }
+
+        for (uint32_t b = 0; b < loop->block_count; b++)
+        {
+            uint32_t block = loop->blocks[b];
+            for (uint32_t own = function->blocks[block].first; own != IR_NONE; own = function->instructions[own].next)
+            {
+                if (own >= count || !current[own] || (block == header && function->instructions[own].op == IR_PHI))
+                {
+                    continue;
+                }
+
+                for (uint32_t o = 0; o < function->instructions[own].operand_count; o++)
+                {
+                    ir_set_operand(function, current[own], o, loop_mapped(current, ir_operand(function, own, o)));
+                }
+            }
+        }
+
+        back = blocks[loop->latch];
+        uint32_t *swap = previous;
+        previous = current;
+        current = swap;
+    }
+
+    // the header is now entered once, after the last copy
+    uint32_t latch = loop->latch;
+    struct vector *values = vector_create(sizeof(uint32_t));
+    for (uint32_t phi = function->blocks[header].first; function->instructions[phi].op == IR_PHI; phi = function->instructions[phi].next)
+    {
+        uint32_t old = ir_operand(function, phi, latch_slot);
+        uint32_t last = loop_mapped(previous, old);
+        vector_push(values, &old);
+        vector_push(values, &last);
+    }
+    ir_compute_predecessors(function);
+
+    uint32_t *pairs = vector_data_ptr(values);
+    uint32_t pair = 0;
+    struct ir_block *target = &function->blocks[header];
+    for (uint32_t phi = target->first; function->instructions[phi].op == IR_PHI; phi = function->instructions[phi].next, pair += 2)
+    {
+        for (uint32_t i = 0; i < target->pred_count; i++)
+        {
+            ir_set_operand(function, phi, i, function->preds[target->preds + i] == latch ? pairs[pair] : pairs[pair + 1]);
+        }
+    }
+
+    ir_branch_to_jump(function, header, exit);
+    ir_remove_unreachable_blocks(function);
+
+    vector_free(values);
+    free(previous);
+    free(current);
+    free(blocks);
+}
+
+/**
+ * Unrolls innermost loops that run a small constant number of times
+ */
+bool loop_unroll(struct ir_function *function)
+{
+    bool changed = false;
+    for (;;)
+    {
+        struct loop_nest *nest = loop_prepare(function);
+        bool *outer = calloc(nest->count + 1, sizeof(bool));
+        for (int i = 0; i < nest->count; i++)
+        {
+            if (nest->loops[i].parent >= 0)
+            {
+                outer[nest->loops[i].parent] = true;
+            }
+        }
+
+        int chosen = -1;
+        int trips = 0;
+        for (int i = 0; i < nest->count && chosen < 0; i++)
+        {
+            if (!outer[i] && loop_trip_count(nest, i, &trips) && loop_size(function, &nest->loops[i]) * trips <= LOOP_UNROLL_SIZE)
+            {
+                chosen = i;
+            }
+        }
+        free(outer);
+
+        if (chosen < 0)
+        {
+            loop_nest_free(nest);
+            return changed;
+        }
+
+        loop_unroll_one(nest, chosen, trips);
+        loop_nest_free(nest);
+        changed = true;
+    }
+}
+
+/**
+ * Instructions that give the same value wherever they run and cannot trap
+ */
+static bool loop_is_hoistable(struct ir_function *function, uint32_t index)
+{
+    int op = function->instructions[index].op;
+    if (op == IR_SDIV || op == IR_UDIV || op == IR_SREM || op == IR_UREM)
+    {
+        long long divisor;
+        return optimize_constant_of(function, ir_operand(function, index, 1), &divisor) && divisor != 0 && divisor != -1;
+    }
+    return op >= IR_ADD && op <= IR_TRUNC;
+}
+
+/**
+ * Constants and addresses of globals are computed again where they are used,
+ * they count as invariant wherever they are
+ */
+static bool loop_is_invariant(struct loop_nest *nest, int loop, uint32_t value)
+{
+    int op = nest->function->instructions[value].op;
+    return op == IR_CONST || op == IR_GLOBAL || !loop_contains(nest, loop, nest->function->instructions[value].block);
+}
+
+/**
+ * Moves instructions whose operands do not change in a loop to its preheader,
+ * inner loops first so their invariants can move on out of the loops around them
+ */
+bool loop_hoist_invariants(struct ir_function *function)
+{
+    struct loop_nest *nest = loop_prepare(function);
+    bool changed = false;
+    for (int i = 0; i < nest->count; i++)
+    {
+        struct loop *loop = &nest->loops[i];
+        if (loop->preheader == IR_NONE)
+        {
+            continue;
+        }
+
+        uint32_t before = function->blocks[loop->preheader].last;
+        bool moved = true;
+        while (moved)
+        {
+            moved = false;
+            for (uint32_t b = 0; b < loop->block_count; b++)
+            {
+                // what an inner loop kept changes in it, so it changes in this loop too
+                int innermost = nest->innermost[loop->blocks[b]];
+                if (innermost != i && nest->loops[innermost].preheader != IR_NONE)
+                {
+                    continue;
+                }
+
+                uint32_t next;
+                for (uint32_t index = function->blocks[loop->blocks[b]].first; index != IR_NONE; index = next)
+                {
+                    next = function->instructions[index].next;
+                    if (!loop_is_hoistable(function, index))
+                    {
+                        continue;
+                    }
+
+                    bool invariant = true;
+                    for (uint32_t o = 0; o < function->instructions[index].operand_count; o++)
+                    {
+                        invariant &= loop_is_invariant(nest, i, ir_operand(function, index, o));
+                    }
+                    if (!invariant)
+                    {
+                        continue;
+                    }
+
+                    // constants and globals of the loop go along, they dominate their other uses from there too
+                    for (uint32_t o = 0; o < function->instructions[index].operand_count; o++)
+                    {
+                        uint32_t operand = ir_operand(function, index, o);
+                        if (loop_contains(nest, i, function->instructions[operand].block))
+                        {
+                            ir_move_before(function, operand, before);
+                        }
+                    }
+                    ir_move_before(function, index, before);
+                    moved = changed = true;
+                }
+            }
+        }
+    }
+    loop_nest_free(nest);
+    return changed;
+}
+
+static bool loop_reduce_invariant(struct loop_reduce *reduce, uint32_t value)
+{
+    return loop_is_invariant(reduce->nest, reduce->loop, value);
+}
+
+/**
+ * Whether the value is start + iteration * step. Wrapping around keeps that
+ * true in the width of the value, but an extension of a value that wrapped is
+ * not, so extensions need an operand that is exact
+ */
+static bool loop_affine(struct loop_reduce *reduce, uint32_t value)
+{
+    struct ir_function *function = reduce->function;
+    if (value == IR_NONE || value >= reduce->instruction_count)
+    {
+        return false;
+    }
+
+    if (reduce->state[value] != LOOP_UNKNOWN)
+    {
+        return reduce->state[value] == LOOP_AFFINE;
+    }
+
+    // phis can lead back here, they are not affine until shown otherwise
+    reduce->state[value] = LOOP_NOT_AFFINE;
+    vector_push(reduce->touched, &value);
+    struct ir_instruction *instruction = &function->instructions[value];
+    bool no_wrap = instruction->aux & IR_FLAG_NO_SIGNED_WRAP;
+    bool affine = false;
+    bool exact = false;
+    uint32_t cost = 1;
+    uint32_t left = instruction->operand_count > 0 ? ir_operand(function, value, 0) : IR_NONE;
+    uint32_t right = instruction->operand_count > 1 ? ir_operand(function, value, 1) : IR_NONE;
+    if (loop_reduce_invariant(reduce, value))
+    {
+        affine = exact = true;
+        cost = 0;
+    }
+    else if (instruction->op == IR_PHI)
+    {
+        // an induction variable: a header phi that goes up by the same amount each iteration
+        struct loop *loop = &reduce->nest->loops[reduce->loop];
+        if (instruction->block == loop->header && instruction->operand_count == 2 && loop->latch != IR_NONE)
+        {
+            uint32_t next = ir_operand(function, value, loop_pred_slot(function, loop->header, loop->latch));
+            struct ir_instruction *increment = &function->instructions[next];
+            affine = (increment->op == IR_ADD || increment->op == IR_SUB) && ir_operand(function, next, 0) == value && loop_reduce_invariant(reduce, ir_operand(function, next, 1));
+            affine |= increment->op == IR_ADD && ir_operand(function, next, 1) == value && loop_reduce_invariant(reduce, ir_operand(function, next, 0));
+            exact = increment->aux & IR_FLAG_NO_SIGNED_WRAP;
+            cost = 0;
+        }
+    }
+    else
+    {
+        switch (instruction->op)
+        {
+        case IR_ADD:
+        case IR_SUB:
+            affine = loop_affine(reduce, left) && loop_affine(reduce, right);
+            exact = affine && no_wrap && reduce->exact[left] && reduce->exact[right];
+            break;
+
+        case IR_MUL:
+            affine = (loop_reduce_invariant(reduce, right) && loop_affine(reduce, left)) || (loop_reduce_invariant(reduce, left) && loop_affine(reduce, right));
+            exact = affine && no_wrap && reduce->exact[left] && reduce->exact[right];
+            break;
+
+        case IR_SHL:
+            affine = loop_reduce_invariant(reduce, right) && loop_affine(reduce, left);
+            exact = affine && no_wrap && reduce->exact[left];
+            break;
+
+        case IR_SEXT:
+            affine = loop_affine(reduce, left) && reduce->exact[left];
+            exact = affine;
+            break;
+
+        case IR_TRUNC:
+            affine = loop_affine(reduce, left);
+            break;
+        }
+
+        for (uint32_t o = 0; affine && o < instruction->operand_count; o++)
+        {
+            cost += reduce->cost[ir_operand(function, value, o)];
+        }
+    }
+
+    reduce->state[value] = affine ? LOOP_AFFINE : LOOP_NOT_AFFINE;
+    reduce->exact[value] = exact;
+    reduce->cost[value] = cost;
+    return affine;
+}
+
+static uint32_t loop_emit(struct loop_reduce *reduce, int op, int type, uint32_t left, uint32_t right)
+{
+    struct ir_function *function = reduce->function;
+    uint32_t index = ir_insert_before(function, reduce->before, op, type, right != IR_NONE ? 2 : 1);
+    ir_set_operand(function, index, 0, left);
+    if (right != IR_NONE)
+    {
+        ir_set_operand(function, index, 1, right);
+    }
+    return index;
+}
+
+/**
+ * The value in the first iteration, computed in the preheader
+ */
+static uint32_t loop_start(struct loop_reduce *reduce, uint32_t value)
+{
+    struct ir_function *function = reduce->function;
+    struct loop *loop = &reduce->nest->loops[reduce->loop];
+    struct ir_instruction *instruction = &function->instructions[value];
+    if (!loop_contains(reduce->nest, reduce->loop, instruction->block))
+    {
+        return value;
+    }
+
+    if (reduce->start[value] != IR_NONE)
+    {
+        return reduce->start[value];
+    }
+
+    if (instruction->op == IR_PHI)
+    {
+        return ir_operand(function, value, loop_pred_slot(function, loop->header, loop->preheader));
+    }
+
+    // affine values have at most two operands, they go in front of the copy
+    uint32_t operands[2];
+    uint32_t count = instruction->operand_count;
+    assert(count <= 2);
+    for (uint32_t o = 0; o < count; o++)
+    {
+        operands[o] = loop_start(reduce, ir_operand(function, value, o));
+    }
+
+    instruction = &function->instructions[value];
+    uint32_t copy = ir_insert_before(function, reduce->before, instruction->op, instruction->type, count);
+    instruction = &function->instructions[value];
+    function->instructions[copy].aux = instruction->aux;
+    function->instructions[copy].constant = instruction->constant;
+    function->instructions[copy].symbol = instruction->symbol;
+    for (uint32_t o = 0; o < count; o++)
+    {
+        ir_set_operand(function, copy, o, operands[o]);
+    }
+    reduce->start[value] = copy;
+    vector_push(reduce->touched, &value);
+    return copy;
+}
+
+/**
+ * How much the value grows each iteration, computed in the preheader.
+ * IR_NONE stands for a step of zero
+ */
+static uint32_t loop_step(struct loop_reduce *reduce, uint32_t value)
+{
+    struct ir_function *function = reduce->function;
+    if (loop_reduce_invariant(reduce, value))
+    {
+        return IR_NONE;
+    }
+
+    if (reduce->stepped[value])
+    {
+        return reduce->step[value];
+    }
+
+    struct loop *loop = &reduce->nest->loops[reduce->loop];
+    int op = function->instructions[value].op;
+    int type = function->instructions[value].type;
+    uint32_t left = function->instructions[value].operand_count > 0 ? ir_operand(function, value, 0) : IR_NONE;
+    uint32_t right = function->instructions[value].operand_count > 1 ? ir_operand(function, value, 1) : IR_NONE;
+    uint32_t step = IR_NONE;
+    switch (op)
+    {
+    case IR_PHI:
+    {
+        uint32_t next = ir_operand(function, value, loop_pred_slot(function, loop->header, loop->latch));
+        uint32_t amount = loop_start(reduce, ir_operand(function, next, ir_operand(function, next, 0) == value ? 1 : 0));
+        step = function->instructions[next].op == IR_SUB ? loop_emit(reduce, IR_NEG, type, amount, IR_NONE) : amount;
+    }
+    break;
+
+    case IR_ADD:
+    case IR_SUB:
+    {
+        uint32_t a = loop_step(reduce, left);
+        uint32_t b = loop_step(reduce, right);
+        if (b == IR_NONE)
+        {
+            step = a;
+        }
+        else if (a == IR_NONE)
+        {
+            step = op == IR_ADD ? b : loop_emit(reduce, IR_NEG, type, b, IR_NONE);
+        }
+        else
+        {
+            step = loop_emit(reduce, op, type, a, b);
+        }
+    }
+    break;
+
+    case IR_MUL:
+    {
+        bool left_varies = !loop_reduce_invariant(reduce, left);
+        uint32_t a = loop_step(reduce, left_varies ? left : right);
+        step = a == IR_NONE ? IR_NONE : loop_emit(reduce, IR_MUL, type, a, loop_start(reduce, left_varies ? right : left));
+    }
+    break;
+
+    case IR_SHL:
+    {
+        uint32_t a = loop_step(reduce, left);
+        step = a == IR_NONE ? IR_NONE : loop_emit(reduce, IR_SHL, type, a, loop_start(reduce, right));
+    }
+    break;
+
+    case IR_SEXT:
+    case IR_TRUNC:
+    {
+        uint32_t a = loop_step(reduce, left);
+        step = a == IR_NONE ? IR_NONE : loop_emit(reduce, op, type, a, IR_NONE);
+    }
+    break;
+    }
+
+    reduce->stepped[value] = true;
+    reduce->step[value] = step;
+    vector_push(reduce->touched, &value);
+    return step;
+}
+
+/**
+ * Addresses of loads and stores in the loop that are affine and take more
+ * than one instruction become phis of their own that go up by the step
+ */
+static bool loop_reduce_one(struct loop_reduce *reduce)
+{
+    struct ir_function *function = reduce->function;
+    struct loop_nest *nest = reduce->nest;
+    struct loop *loop = &nest->loops[reduce->loop];
+    if (loop->preheader == IR_NONE || loop->latch == IR_NONE || function->blocks[loop->header].pred_count != 2)
+    {
+        return false;
+    }
+
+    struct vector *candidates = vector_create(sizeof(uint32_t));
+    bool *chosen = reduce->chosen;
+    for (uint32_t b = 0; b < loop->block_count && vector_count(candidates) < LOOP_REDUCE_LIMIT; b++)
+    {
+        uint32_t block = loop->blocks[b];
+        if (nest->innermost[block] != reduce->loop)
+        {
+            continue;
+        }
+
+        for (uint32_t index = function->blocks[block].first; index != IR_NONE; index = function->instructions[index].next)
+        {
+            int op = function->instructions[index].op;
+            if (op != IR_LOAD && op != IR_STORE)
+            {
+                continue;
+            }
+
+            uint32_t address = ir_operand(function, index, 0);
+            struct ir_instruction *instruction = &function->instructions[address];
+            if (chosen[address] || instruction->op == IR_PHI || instruction->type != IR_TYPE_I64 ||
+                nest->innermost[instruction->block] != reduce->loop || !loop_affine(reduce, address) || reduce->cost[address] < 2)
+            {
+                continue;
+            }
+
+            chosen[address] = true;
+            vector_push(candidates, &address);
+            if (vector_count(candidates) == LOOP_REDUCE_LIMIT)
+            {
+                break;
+            }
+        }
+    }
+
+    // starts and steps are all computed before any use changes
+    uint32_t count = vector_count(candidates);
+    uint32_t *addresses = vector_data_ptr(candidates);
+    uint32_t *starts = malloc(sizeof(uint32_t) * (count + 1));
+    uint32_t *steps = malloc(sizeof(uint32_t) * (count + 1));
+    for (uint32_t i = 0; i < count; i++)
+    {
+        starts[i] = loop_start(reduce, addresses[i]);
+        steps[i] = loop_step(reduce, addresses[i]);
+    }
+
+    bool changed = false;
+    uint32_t entry_slot = loop_pred_slot(function, loop->header, loop->preheader);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        chosen[addresses[i]] = false;
+        if (steps[i] == IR_NONE)
+        {
+            continue;
+        }
+
+        uint32_t phi = ir_insert_before(function, function->blocks[loop->header].first, IR_PHI, IR_TYPE_I64, 2);
+        uint32_t next = ir_insert_before(function, function->blocks[loop->latch].last, IR_ADD, IR_TYPE_I64, 2);
+        ir_set_operand(function, next, 0, phi);
+        ir_set_operand(function, next, 1, steps[i]);
+        ir_set_operand(function, phi, entry_slot, starts[i]);
+        ir_set_operand(function, phi, 1 - entry_slot, next);
+        ir_replace_uses(function, addresses[i], phi);
+        changed = true;
+    }
+
+    vector_free(candidates);
+    free(starts);
+    free(steps);
+    return changed;
+}
+
+/**
+ * Induction variable strength reduction: an address such as base + i * size
+ * is kept in a pointer that goes up by the step instead of being computed
+ * from the index each iteration
+ */
+bool loop_reduce_strength(struct ir_function *function)
+{
+    struct loop_nest *nest = loop_prepare(function);
+    uint32_t count = function->instruction_count;
+    // values created for earlier loops are never looked at
+    struct loop_reduce reduce = {.function = function, .nest = nest, .instruction_count = count};
+    reduce.state = calloc(count, sizeof(unsigned char));
+    reduce.exact = calloc(count, sizeof(bool));
+    reduce.cost = calloc(count, sizeof(uint32_t));
+    reduce.start = calloc(count, sizeof(uint32_t));
+    reduce.step = calloc(count, sizeof(uint32_t));
+    reduce.stepped = calloc(count, sizeof(bool));
+    reduce.chosen = calloc(count, sizeof(bool));
+    reduce.touched = vector_create(sizeof(uint32_t));
+    bool changed = false;
+    for (int i = 0; i < nest->count; i++)
+    {
+        if (nest->loops[i].preheader == IR_NONE)
+        {
+            continue;
+        }
+
+        reduce.loop = i;
+        reduce.before = function->blocks[nest->loops[i].preheader].last;
+        changed |= loop_reduce_one(&reduce);
+        uint32_t *touched = vector_data_ptr(reduce.touched);
+        for (size_t t = 0; t < vector_count(reduce.touched); t++)
+        {
+            uint32_t value = touched[t];
+            reduce.state[value] = LOOP_UNKNOWN;
+            reduce.exact[value] = reduce.stepped[value] = false;
+            reduce.cost[value] = reduce.start[value] = reduce.step[value] = 0;
+        }
+        vector_clear(reduce.touched);
+    }
+    free(reduce.state);
+    free(reduce.exact);
+    free(reduce.cost);
+    free(reduce.start);
+    free(reduce.step);
+    free(reduce.stepped);
+    free(reduce.chosen);
+    vector_free(reduce.touched);
+    loop_nest_free(nest);
+    return changed;
+}
@@ -1,7 +1,73 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 #include "helpers/vector.h"
 #include "compiler.h"
-int main()
+
+static double now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+/**
+ * Compiles the input into memory and calls its main with the remaining arguments
+ */
+static int run(const char *input, int flags, int argc, char **argv, bool stats)
+{
+    double start = now();
+    struct jit *jit = compile_to_memory(input, flags);
+    int (*entry)(int, char **) = jit ? (int (*)(int, char **))jit_symbol(jit, "main") : NULL;
+    if (!entry)
+    {
+        fprintf(stderr, jit ? "%s has no main function\n" : "Failed to compile %s\n", input);
+        return 1;
+    }
+
+    if (stats)
+    {
+        fprintf(stderr, "compile to first instruction: %.3f ms\n", (now() - start) * 1e3);
+    }
+
+    // the memory stays mapped, functions registered with atexit still run after main returns
+    return entry(argc, argv);
+}
+
+/**
+ * Compiles the input to bytecode and interprets its main with the remaining arguments
+ */
+static int interpret(const char *input, int flags, int argc, char **argv, bool stats)
+{
+    double start = now();
+    struct bytecode_program *program = compile_to_bytecode(input, flags);
+    struct bytecode_function *entry = program ? bytecode_find(program, "main") : NULL;
+    if (!entry)
+    {
+        fprintf(stderr, program ? "%s has no main function\n" : "Failed to compile %s\n", input);
+        return 1;
+    }
+
+    if (stats)
+    {
+        fprintf(stderr, "compile to first instruction: %.3f ms\n", (now() - start) * 1e3);
+    }
+
+    long long arguments[] = {argc, (long long)(uintptr_t)argv};
+    return bytecode_call(program, entry, arguments, 2);
+}
+
+static void usage()
+{
+    printf("usage: main [-O0|-O1|-O2] [--dump-ir] [--spill-all] [--peephole-stats] [--parallel-parse] [--pipeline-lexer] [--stream] [-c] [-MD] [-MF depfile] [-o output] [input]\n");
+    printf("       main [-O0|-O1|-O2] [-c] [-MD] [--state file] --incremental inputs...\n");
+    printf("       main [-O0|-O1|-O2] [--spill-all] [--run-stats] --run input [args...]\n");
+    printf("       main [-O0|-O1|-O2] [--run-stats] --interpret input [args...]\n");
+    printf("       main [--workers n] --server [socket]\n");
+}
+
+int main(int argc, char **argv)
 {
     // example of using vector
     // struct vector* vec = vector_create(sizeof(int));
@@ -20,10 +86,126 @@ int main()
 
     // printf("Hello World\n");
 
-    int res = compile_file("./test.c", "./test", 0);
+    // without arguments ./test.c is compiled to ./test
+    const char *input = "./test.c";
+    const char *output = "./test";
+    int flags = 0;
+    bool stats = false;
+    int workers = sysconf(_SC_NPROCESSORS_ONLN);
+    // -MD names the dependency file after the output, -MF names it
+    bool depfile = false;
+    const char *depfile_path = NULL;
+    const char *state_path = ".zeze-incremental";
+    for (int i = 1; i < argc; i++)
+    {
+        if (S_EQ(argv[i], "-O0"))
+        {
+            flags &= ~COMPILE_PROCESS_FLAGS_O2;
+        }
+        else if (S_EQ(argv[i], "-O1"))
+        {
+            flags = (flags & ~COMPILE_PROCESS_FLAGS_O2) | COMPILE_PROCESS_FLAGS_O1;
+        }
+        else if (S_EQ(argv[i], "-O2"))
+        {
+            flags |= COMPILE_PROCESS_FLAGS_O2;
+        }
+        else if (S_EQ(argv[i], "--dump-ir"))
+        {
+            flags |= COMPILE_PROCESS_FLAG_DUMP_IR;
+        }
+        else if (S_EQ(argv[i], "--spill-all"))
+        {
+            flags |= COMPILE_PROCESS_FLAG_SPILL_ALL;
+        }
+        else if (S_EQ(argv[i], "--peephole-stats"))
+        {
+            flags |= COMPILE_PROCESS_FLAG_PEEPHOLE_STATS;
+        }
+        else if (S_EQ(argv[i], "--parallel-parse"))
+        {
+            flags |= COMPILE_PROCESS_FLAG_PARALLEL_PARSE;
+        }
+        else if (S_EQ(argv[i], "--pipeline-lexer"))
+        {
+            flags |= COMPILE_PROCESS_FLAG_PIPELINE_LEXER;
+        }
+        else if (S_EQ(argv[i], "--stream"))
+        {
+            flags |= COMPILE_PROCESS_FLAG_STREAM;
+        }
+        else if (S_EQ(argv[i], "-c"))
+        {
+            flags |= COMPILE_PROCESS_FLAG_OBJECT;
+        }
+        else if (S_EQ(argv[i], "--run-stats"))
+        {
+            stats = true;
+        }
+        else if (S_EQ(argv[i], "--run") && i + 1 < argc)
+        {
+            // the input and everything after it belong to the program
+            return run(argv[i + 1], flags, argc - i - 1, argv + i + 1, stats);
+        }
+        else if (S_EQ(argv[i], "--interpret") && i + 1 < argc)
+        {
+            return interpret(argv[i + 1], flags, argc - i - 1, argv + i + 1, stats);
+        }
+        else if (S_EQ(argv[i], "--workers") && i + 1 < argc)
+        {
+            workers = atoi(argv[++i]);
+        }
+        else if (S_EQ(argv[i], "--server"))
+        {
+            // the workers run every command line they get through main, as if it was typed here
+            const char *socket_path = i + 1 < argc ? argv[i + 1] : server_default_socket();
+            compiler_cache_enable();
+            return server_run(socket_path, workers, main);
+        }
+        else if (S_EQ(argv[i], "-MD"))
+        {
+            depfile = true;
+        }
+        else if (S_EQ(argv[i], "-MF") && i + 1 < argc)
+        {
+            depfile = true;
+            depfile_path = argv[++i];
+        }
+        else if (S_EQ(argv[i], "--state") && i + 1 < argc)
+        {
+            state_path = argv[++i];
+        }
+        else if (S_EQ(argv[i], "--incremental") && i + 1 < argc)
+        {
+            // everything after it is a translation unit of the build
+            return incremental_build(state_path, argv + i + 1, argc - i - 1, flags, depfile) ? 1 : 0;
+        }
+        else if (S_EQ(argv[i], "-o") && i + 1 < argc)
+        {
+            output = argv[++i];
+        }
+        else if (argv[i][0] == '-')
+        {
+            usage();
+            return 1;
+        }
+        else
+        {
+            input = argv[i];
+        }
+    }
+
+    struct vector *dependencies = vector_create(sizeof(const char *));
+    int res = compile_file_with_dependencies(input, output, flags, dependencies);
     if (res == COMPILER_FILE_COMPILED_OK)
     {
         printf("Compiled successfully\n");
+        char *path = depfile && !depfile_path ? incremental_path_with_extension(output, ".d") : NULL;
+        if (depfile && !depfile_write(path ? path : depfile_path, output, dependencies))
+        {
+            printf("Cannot write %s\n", path ? path : depfile_path);
+        }
+        free(path);
     }
     else if (res == COMPILER_FAILED_WITH_ERRORS)
     {
@@ -0,0 +1,193 @@
+#include "compiler.h"
+#include <stdlib.h>
+#include <assert.h>
+
+#define NODE_POOL_INITIAL_CAPACITY 1024
+
+static struct node_pool *node_pool_create_with_base(uint32_t base)
+{
+    struct node_pool *pool = calloc(1, sizeof(struct node_pool));
+    pool->base = base;
+    pool->capacity = NODE_POOL_INITIAL_CAPACITY;
+    pool->nodes = malloc(sizeof(struct node) * pool->capacity);
+    pool->datatype_capacity = NODE_POOL_INITIAL_CAPACITY / 4;
+    pool->datatypes = malloc(sizeof(struct datatype) * pool->datatype_capacity);
+    return pool;
+}
+
+struct node_pool *node_pool_create()
+{
+    struct node_pool *pool = node_pool_create_with_base(0);
+    // index 0 is NODE_NONE for both arrays
+    memset(&pool->nodes[0], 0, sizeof(struct node));
+    memset(&pool->datatypes[0], 0, sizeof(struct datatype));
+    pool->count = 1;
+    pool->datatype_count = 1;
+    return pool;
+}
+
+/**
+ * A pool for a worker thread, its nodes may refer to nodes of the main pool
+ * and are moved into it with node_pool_merge
+ */
+struct node_pool *node_pool_create_local()
+{
+    return node_pool_create_with_base(NODE_POOL_LOCAL_BASE);
+}
+
+void node_pool_free(struct node_pool *pool)
+{
+    free(pool->nodes);
+    free(pool->datatypes);
+    free(pool);
+}
+
+/**
+ * Grows the node and datatype arrays to hold that many more of each, ahead of a
+ * batch of creations. Pointers returned by node_at before this call may no longer be valid
+ */
+static void node_pool_reserve(struct node_pool *pool, uint32_t nodes, uint32_t datatypes)
+{
+    if (pool->count + nodes > pool->capacity)
+    {
+        while (pool->count + nodes > pool->capacity)
+        {
+            pool->capacity *= 2;
+        }
+        pool->nodes = realloc(pool->nodes, sizeof(struct node) * pool->capacity);
+    }
+
+    if (pool->datatype_count + datatypes > pool->datatype_capacity)
+    {
+        while (pool->datatype_count + datatypes > pool->datatype_capacity)
+        {
+            pool->datatype_capacity *= 2;
+        }
+        pool->datatypes = realloc(pool->datatypes, sizeof(struct datatype) * pool->datatype_capacity);
+    }
+}
+
+/**
+ * Creates a node and returns its index, pointers returned by node_at before
+ * this call may no longer be valid
+ */
+uint32_t node_create(struct node_pool *pool, int type, struct pos *pos)
+{
+    node_pool_reserve(pool, 1, 0);
+    struct node *node = &pool->nodes[pool->count];
+    memset(node, 0, sizeof(struct node));
+    node->type = type;
+    node->pos = *pos;
+    return pool->base + pool->count++;
+}
+
+struct node *node_at(struct node_pool *pool, uint32_t index)
+{
+    assert(index != NODE_NONE && index >= pool->base && index - pool->base < pool->count);
+    return &pool->nodes[index - pool->base];
+}
+
+uint32_t node_datatype_create(struct node_pool *pool, struct datatype *datatype)
+{
+    node_pool_reserve(pool, 0, 1);
+    pool->datatypes[pool->datatype_count] = *datatype;
+    return pool->base + pool->datatype_count++;
+}
+
+struct datatype *node_datatype_at(struct node_pool *pool, uint32_t index)
+{
+    assert(index != NODE_NONE && index >= pool->base && index - pool->base < pool->datatype_count);
+    return &pool->datatypes[index - pool->base];
+}
+
+static uint32_t node_relocate(uint32_t index, uint32_t base, uint32_t first)
+{
+    return index >= base ? index - base + first : index;
+}
+
+/**
+ * Grows the pool by the given amount of nodes and datatypes for node_pool_move, returns
+ * the index of the first new node and sets first_datatype to the first new datatype
+ */
+uint32_t node_pool_extend(struct node_pool *pool, uint32_t nodes, uint32_t datatypes, uint32_t *first_datatype)
+{
+    node_pool_reserve(pool, nodes, datatypes);
+    uint32_t first = pool->base + pool->count;
+    *first_datatype = pool->base + pool->datatype_count;
+    pool->count += nodes;
+    pool->datatype_count += datatypes;
+    return first;
+}
+
+/**
+ * Copies every node and datatype of a local pool into a range made with node_pool_extend.
+ * Indexes into the local pool are rewritten while indexes into the pool stay as they are,
+ * the node at local index i ends up at i - other->base + first. Moves into different
+ * ranges can run at the same time
+ */
+void node_pool_move(struct node_pool *pool, uint32_t first, uint32_t first_datatype, struct node_pool *other)
+{
+    assert(other->base > pool->base + pool->count);
+    struct node *nodes = &pool->nodes[first - pool->base];
+    for (uint32_t i = 0; i < other->count; i++)
+    {
+        struct node *node = &nodes[i];
+        *node = other->nodes[i];
+        for (int j = 0; j < NODE_MAX_CHILDREN; j++)
+        {
+            node->children[j] = node_relocate(node->children[j], other->base, first);
+        }
+        node->next = node_relocate(node->next, other->base, first);
+        node->declaration = node_relocate(node->declaration, other->base, first);
+        node->datatype = node_relocate(node->datatype, other->base, first_datatype);
+    }
+
+    struct datatype *datatypes = &pool->datatypes[first_datatype - pool->base];
+    for (uint32_t i = 0; i < other->datatype_count; i++)
+    {
+        struct datatype *datatype = &datatypes[i];
+        *datatype = other->datatypes[i];
+        datatype->struct_node = node_relocate(datatype->struct_node, other->base, first);
+        datatype->array_sizes = node_relocate(datatype->array_sizes, other->base, first);
+    }
+}
+
+/**
+ * Lets go of every node from count on and every datatype from datatype_count on,
+ * their indexes are handed out again
+ */
+void node_pool_truncate(struct node_pool *pool, uint32_t count, uint32_t datatype_count)
+{
+    assert(count >= pool->base + 1 && count - pool->base <= pool->count);
+    assert(datatype_count >= pool->base + 1 && datatype_count - pool->base <= pool->datatype_count);
+    pool->count = count - pool->base;
+    pool->datatype_count = datatype_count - pool->base;
+}
+
+/**
+ * Appends the node to the list, when the node already has a chain of next
+ * nodes the whole chain is appended
+ */
+void node_list_append(struct node_pool *pool, struct node_list *list, uint32_t index)
+{
+    if (index == NODE_NONE)
+    {
+        return;
+    }
+
+    if (list->head == NODE_NONE)
+    {
+        list->head = index;
+    }
+    else
+    {
+        node_at(pool, list->tail)->next = index;
+    }
+
+    uint32_t tail = index;
+    while (node_at(pool, tail)->next != NODE_NONE)
+    {
+        tail = node_at(pool, tail)->next;
+    }
+    list->tail = tail;
+}
@@ -0,0 +1,1179 @@
+#include "compiler.h"
+#include "helpers/vector.h"
+#include <stdlib.h>
+
+/**
+ * Scalar optimizations on the SSA form. Each pass has its own compile process
+ * flag, -O levels are sets of those flags. Every pass visits an instruction a
+ * bounded number of times so they stay linear in the size of the function
+ */
+
+// lattice of sparse conditional constant propagation, values only move down
+enum
+{
+    OPTIMIZE_TOP,
+    OPTIMIZE_CONSTANT,
+    OPTIMIZE_BOTTOM
+};
+
+struct optimize_sccp
+{
+    struct ir_function *function;
+    uint32_t instruction_count;
+    int *state;
+    long long *constant;
+    bool *executable;
+    // bit s is set once the edge to successors[s] is known to be taken
+    unsigned char *edges;
+    // blocks reached over a new edge and values whose state went down
+    struct vector *blocks;
+    struct vector *values;
+};
+
+struct optimize_simplify
+{
+    struct ir_function *function;
+    uint32_t instruction_count;
+    bool *queued;
+    struct vector *worklist;
+};
+
+static int optimize_bits(int type)
+{
+    return ir_type_size(type) * 8;
+}
+
+/**
+ * Wraps the value to the width of the type and sign extends it, the form every
+ * constant is compared and folded in
+ */
+static long long optimize_normalize(int type, unsigned long long value)
+{
+    int bits = optimize_bits(type);
+    if (bits == 0 || bits == 64)
+    {
+        return (long long)value;
+    }
+    return (long long)(value << (64 - bits)) >> (64 - bits);
+}
+
+static unsigned long long optimize_unsigned(int type, long long value)
+{
+    int bits = optimize_bits(type);
+    if (bits == 0 || bits == 64)
+    {
+        return value;
+    }
+    return (unsigned long long)value & ((1ull << bits) - 1);
+}
+
+/**
+ * Evaluates the operation on constant operands of operand_type, false when the
+ * result is not defined: division by zero, overflowing division and shifts by
+ * the width of the value or more are left for the program to do
+ */
+bool optimize_fold(int op, int type, int operand_type, long long a, long long b, long long *result)
+{
+    unsigned long long ua = optimize_unsigned(operand_type, a);
+    unsigned long long ub = optimize_unsigned(operand_type, b);
+    int bits = optimize_bits(operand_type);
+    unsigned long long value = 0;
+    switch (op)
+    {
+    case IR_ADD:
+        value = (unsigned long long)a + b;
+        break;
+    case IR_SUB:
+        value = (unsigned long long)a - b;
+        break;
+    case IR_MUL:
+        value = (unsigned long long)a * b;
+        break;
+    case IR_SDIV:
+    case IR_SREM:
+        if (b == 0 || (b == -1 && a == optimize_normalize(operand_type, 1ull << (bits - 1))))
+        {
+            return false;
+        }
+        value = op == IR_SDIV ? a / b : a % b;
+        break;
+    case IR_UDIV:
+    case IR_UREM:
+        if (ub == 0)
+        {
+            return false;
+        }
+        value = op == IR_UDIV ? ua / ub : ua % ub;
+        break;
+    case IR_AND:
+        value = a & b;
+        break;
+    case IR_OR:
+        value = a | b;
+        break;
+    case IR_XOR:
+        value = a ^ b;
+        break;
+    case IR_SHL:
+    case IR_SHR:
+    case IR_SAR:
+        if (b < 0 || b >= bits)
+        {
+            return false;
+        }
+        value = op == IR_SHL ? (unsigned long long)a << b : op == IR_SHR ? ua >> b : (unsigned long long)(a >> b);
+        break;
+    case IR_NEG:
+        value = -(unsigned long long)a;
+        break;
+    case IR_NOT:
+        value = ~a;
+        break;
+    case IR_EQ:
+        value = a == b;
+        break;
+    case IR_NE:
+        value = a != b;
+        break;
+    case IR_SLT:
+        value = a < b;
+        break;
+    case IR_SLE:
+        value = a <= b;
+        break;
+    case IR_SGT:
+        value = a > b;
+        break;
+    case IR_SGE:
+        value = a >= b;
+        break;
+    case IR_ULT:
+        value = ua < ub;
+        break;
+    case IR_ULE:
+        value = ua <= ub;
+        break;
+    case IR_UGT:
+        value = ua > ub;
+        break;
+    case IR_UGE:
+        value = ua >= ub;
+        break;
+    case IR_SEXT:
+    case IR_TRUNC:
+        value = a;
+        break;
+    case IR_ZEXT:
+        value = ua;
+        break;
+    default:
+        return false;
+    }
+
+    *result = optimize_normalize(type, value);
+    return true;
+}
+
+static bool optimize_is_binary(int op)
+{
+    return (op >= IR_ADD && op <= IR_SAR) || (op >= IR_EQ && op <= IR_UGE);
+}
+
+static bool optimize_is_unary(int op)
+{
+    return op == IR_NEG || op == IR_NOT || op == IR_SEXT || op == IR_ZEXT || op == IR_TRUNC;
+}
+
+static bool optimize_is_comparison(int op)
+{
+    return op >= IR_EQ && op <= IR_UGE;
+}
+
+/**
+ * A new constant at the start of the entry block, where it dominates every use
+ */
+uint32_t optimize_const(struct ir_function *function, int type, long long value)
+{
+    uint32_t index = ir_insert_before(function, function->blocks[1].first, IR_CONST, type, 0);
+    function->instructions[index].constant = optimize_normalize(type, value);
+    return index;
+}
+
+bool optimize_constant_of(struct ir_function *function, uint32_t value, long long *constant)
+{
+    struct ir_instruction *instruction = &function->instructions[value];
+    if (instruction->op != IR_CONST)
+    {
+        return false;
+    }
+    *constant = optimize_normalize(instruction->type, instruction->constant);
+    return true;
+}
+
+static void optimize_sccp_lower(struct optimize_sccp *sccp, uint32_t value, int state, long long constant)
+{
+    int current = sccp->state[value];
+    if (current == OPTIMIZE_CONSTANT && state == OPTIMIZE_CONSTANT && sccp->constant[value] != constant)
+    {
+        state = OPTIMIZE_BOTTOM;
+    }
+
+    if (state <= current)
+    {
+        return;
+    }
+    sccp->state[value] = state;
+    sccp->constant[value] = constant;
+    vector_push(sccp->values, &value);
+}
+
+static void optimize_sccp_edge(struct optimize_sccp *sccp, uint32_t block, int successor)
+{
+    if (sccp->edges[block] & (1 << successor))
+    {
+        return;
+    }
+    sccp->edges[block] |= 1 << successor;
+    vector_push(sccp->blocks, &sccp->function->blocks[block].successors[successor]);
+}
+
+/**
+ * Meet of the operands that come in over edges known to be taken
+ */
+static void optimize_sccp_phi(struct optimize_sccp *sccp, uint32_t index)
+{
+    struct ir_function *function = sccp->function;
+    uint32_t block = function->instructions[index].block;
+    struct ir_block *target = &function->blocks[block];
+    int state = OPTIMIZE_TOP;
+    long long constant = 0;
+    for (uint32_t i = 0; i < target->pred_count; i++)
+    {
+        uint32_t pred = function->preds[target->preds + i];
+        struct ir_block *from = &function->blocks[pred];
+        bool taken = ((sccp->edges[pred] & 1) && from->successors[0] == block) || ((sccp->edges[pred] & 2) && from->successors[1] == block);
+        uint32_t value = ir_operand(function, index, i);
+        if (!taken || sccp->state[value] == OPTIMIZE_TOP)
+        {
+            continue;
+        }
+
+        if (sccp->state[value] == OPTIMIZE_BOTTOM || (state == OPTIMIZE_CONSTANT && sccp->constant[value] != constant))
+        {
+            state = OPTIMIZE_BOTTOM;
+            break;
+        }
+        state = OPTIMIZE_CONSTANT;
+        constant = sccp->constant[value];
+    }
+
+    if (state != OPTIMIZE_TOP)
+    {
+        optimize_sccp_lower(sccp, index, state, constant);
+    }
+}
+
+static void optimize_sccp_visit(struct optimize_sccp *sccp, uint32_t index)
+{
+    struct ir_function *function = sccp->function;
+    struct ir_instruction *instruction = &function->instructions[index];
+    uint32_t block = instruction->block;
+    switch (instruction->op)
+    {
+    case IR_PHI:
+        optimize_sccp_phi(sccp, index);
+        return;
+    case IR_CONST:
+        optimize_sccp_lower(sccp, index, OPTIMIZE_CONSTANT, optimize_normalize(instruction->type, instruction->constant));
+        return;
+    case IR_JUMP:
+        optimize_sccp_edge(sccp, block, 0);
+        return;
+    case IR_BRANCH:
+    {
+        uint32_t condition = ir_operand(function, index, 0);
+        if (sccp->state[condition] == OPTIMIZE_CONSTANT)
+        {
+            optimize_sccp_edge(sccp, block, sccp->constant[condition] ? 0 : 1);
+        }
+        else if (sccp->state[condition] == OPTIMIZE_BOTTOM)
+        {
+            optimize_sccp_edge(sccp, block, 0);
+            optimize_sccp_edge(sccp, block, 1);
+        }
+        return;
+    }
+    default:
+        break;
+    }
+
+    if (instruction->type == IR_TYPE_VOID)
+    {
+        return;
+    }
+
+    if (!optimize_is_binary(instruction->op) && !optimize_is_unary(instruction->op))
+    {
+        optimize_sccp_lower(sccp, index, OPTIMIZE_BOTTOM, 0);
+        return;
+    }
+
+    long long operands[2] = {0, 0};
+    bool top = false;
+    bool bottom = false;
+    bool zero = false;
+    for (uint32_t i = 0; i < instruction->operand_count; i++)
+    {
+        uint32_t value = ir_operand(function, index, i);
+        top |= sccp->state[value] == OPTIMIZE_TOP;
+        bottom |= sccp->state[value] == OPTIMIZE_BOTTOM;
+        operands[i] = sccp->constant[value];
+        zero |= sccp->state[value] == OPTIMIZE_CONSTANT && operands[i] == 0;
+    }
+
+    // a product or mask with zero is zero whatever the other operand
+    if (zero && (instruction->op == IR_MUL || instruction->op == IR_AND))
+    {
+        optimize_sccp_lower(sccp, index, OPTIMIZE_CONSTANT, 0);
+        return;
+    }
+
+    if (bottom)
+    {
+        optimize_sccp_lower(sccp, index, OPTIMIZE_BOTTOM, 0);
+        return;
+    }
+
+    if (top)
+    {
+        return;
+    }
+
+    int operand_type = function->instructions[ir_operand(function, index, 0)].type;
+    long long result;
+    if (optimize_fold(instruction->op, instruction->type, operand_type, operands[0], operands[1], &result))
+    {
+        optimize_sccp_lower(sccp, index, OPTIMIZE_CONSTANT, result);
+    }
+    else
+    {
+        optimize_sccp_lower(sccp, index, OPTIMIZE_BOTTOM, 0);
+    }
+}
+
+/**
+ * Replaces values that are constant on every path that can be taken and drops
+ * the branches that cannot (Wegman and Zadeck)
+ */
+static void optimize_sccp(struct ir_function *function)
+{
+    struct optimize_sccp sccp = {.function = function, .instruction_count = function->instruction_count};
+    sccp.state = calloc(sccp.instruction_count, sizeof(int));
+    sccp.constant = calloc(sccp.instruction_count, sizeof(long long));
+    sccp.executable = calloc(function->block_count, sizeof(bool));
+    sccp.edges = calloc(function->block_count, sizeof(unsigned char));
+    sccp.blocks = vector_create(sizeof(uint32_t));
+    sccp.values = vector_create(sizeof(uint32_t));
+
+    uint32_t entry = 1;
+    vector_push(sccp.blocks, &entry);
+    while (!vector_empty(sccp.blocks) || !vector_empty(sccp.values))
+    {
+        while (!vector_empty(sccp.blocks))
+        {
+            uint32_t block = *(uint32_t *)vector_back(sccp.blocks);
+            vector_pop(sccp.blocks);
+            // a block seen before only has new phi operands to look at
+            bool first = !sccp.executable[block];
+            sccp.executable[block] = true;
+            for (uint32_t index = function->blocks[block].first; index != IR_NONE; index = function->instructions[index].next)
+            {
+                if (!first && function->instructions[index].op != IR_PHI)
+                {
+                    break;
+                }
+                optimize_sccp_visit(&sccp, index);
+            }
+        }
+
+        while (!vector_empty(sccp.values))
+        {
+            uint32_t value = *(uint32_t *)vector_back(sccp.values);
+            vector_pop(sccp.values);
+            for (uint32_t use = function->instructions[value].first_use; use != IR_NONE; use = function->uses[use].next)
+            {
+                uint32_t user = function->uses[use].user;
+                if (sccp.executable[function->instructions[user].block])
+                {
+                    optimize_sccp_visit(&sccp, user);
+                }
+            }
+        }
+    }
+
+    // branches first, the conditions are about to be replaced by new constants
+    for (uint32_t block = 1; block < function->block_count; block++)
+    {
+        uint32_t last = function->blocks[block].last;
+        if (sccp.executable[block] && function->instructions[last].op == IR_BRANCH)
+        {
+            uint32_t condition = ir_operand(function, last, 0);
+            if (sccp.state[condition] == OPTIMIZE_CONSTANT)
+            {
+                ir_branch_to_jump(function, block, sccp.constant[condition] ? 0 : 1);
+            }
+        }
+    }
+
+    for (uint32_t index = 1; index < sccp.instruction_count; index++)
+    {
+        struct ir_instruction *instruction = &function->instructions[index];
+        if (sccp.state[index] == OPTIMIZE_CONSTANT && instruction->op != IR_CONST && instruction->op != IR_NOP)
+        {
+            uint32_t constant = optimize_const(function, instruction->type, sccp.constant[index]);
+            ir_replace_uses(function, index, constant);
+            ir_remove(function, index);
+        }
+    }
+    ir_remove_unreachable_blocks(function);
+
+    free(sccp.state);
+    free(sccp.constant);
+    free(sccp.executable);
+    free(sccp.edges);
+    vector_free(sccp.blocks);
+    vector_free(sccp.values);
+}
+
+static void optimize_simplify_queue(struct optimize_simplify *simplify, uint32_t index)
+{
+    if (index >= simplify->instruction_count || simplify->queued[index])
+    {
+        return;
+    }
+    simplify->queued[index] = true;
+    vector_push(simplify->worklist, &index);
+}
+
+static void optimize_simplify_queue_users(struct optimize_simplify *simplify, uint32_t index)
+{
+    struct ir_function *function = simplify->function;
+    for (uint32_t use = function->instructions[index].first_use; use != IR_NONE; use = function->uses[use].next)
+    {
+        optimize_simplify_queue(simplify, function->uses[use].user);
+    }
+}
+
+/**
+ * Makes the users of the instruction use the value instead and removes it
+ */
+static void optimize_simplify_replace(struct optimize_simplify *simplify, uint32_t index, uint32_t value)
+{
+    struct ir_function *function = simplify->function;
+    optimize_simplify_queue_users(simplify, index);
+    ir_replace_uses(function, index, value);
+    ir_remove(function, index);
+}
+
+static void optimize_simplify_replace_const(struct optimize_simplify *simplify, uint32_t index, long long value)
+{
+    struct ir_function *function = simplify->function;
+    uint32_t constant = optimize_const(function, function->instructions[index].type, value);
+    optimize_simplify_replace(simplify, index, constant);
+}
+
+/**
+ * Gives the instruction a new opcode and operands in place
+ */
+static void optimize_simplify_rewrite(struct optimize_simplify *simplify, uint32_t index, int op, uint32_t left, uint32_t right)
+{
+    struct ir_function *function = simplify->function;
+    function->instructions[index].op = op;
+    // the new form may overflow where the old one did not, callers put the flag back where it still holds
+    function->instructions[index].aux &= ~IR_FLAG_NO_SIGNED_WRAP;
+    ir_set_operand(function, index, 0, left);
+    if (function->instructions[index].operand_count > 1)
+    {
+        ir_set_operand(function, index, 1, right);
+    }
+    simplify->queued[index] = false;
+    optimize_simplify_queue(simplify, index);
+    optimize_simplify_queue_users(simplify, index);
+}
+
+static int optimize_log2(unsigned long long value)
+{
+    if (value == 0 || (value & (value - 1)))
+    {
+        return -1;
+    }
+
+    int log = 0;
+    while (value >>= 1)
+    {
+        log++;
+    }
+    return log;
+}
+
+// the comparison with its operands swapped and the one that gives the opposite answer
+static int optimize_swapped(int op)
+{
+    static const int swapped[] = {[IR_EQ] = IR_EQ, [IR_NE] = IR_NE, [IR_SLT] = IR_SGT, [IR_SLE] = IR_SGE, [IR_SGT] = IR_SLT, [IR_SGE] = IR_SLE, [IR_ULT] = IR_UGT, [IR_ULE] = IR_UGE, [IR_UGT] = IR_ULT, [IR_UGE] = IR_ULE};
+    return swapped[op];
+}
+
+static int optimize_inverted(int op)
+{
+    static const int inverted[] = {[IR_EQ] = IR_NE, [IR_NE] = IR_EQ, [IR_SLT] = IR_SGE, [IR_SLE] = IR_SGT, [IR_SGT] = IR_SLE, [IR_SGE] = IR_SLT, [IR_ULT] = IR_UGE, [IR_ULE] = IR_UGT, [IR_UGT] = IR_ULE, [IR_UGE] = IR_ULT};
+    return inverted[op];
+}
+
+static bool optimize_is_commutative(int op)
+{
+    return op == IR_ADD || op == IR_MUL || op == IR_AND || op == IR_OR || op == IR_XOR || optimize_is_comparison(op);
+}
+
+static void optimize_simplify_unary(struct optimize_simplify *simplify, uint32_t index)
+{
+    struct ir_function *function = simplify->function;
+    struct ir_instruction *instruction = &function->instructions[index];
+    uint32_t operand = ir_operand(function, index, 0);
+    struct ir_instruction *inner = &function->instructions[operand];
+    long long constant;
+    long long result;
+    if (optimize_constant_of(function, operand, &constant))
+    {
+        if (optimize_fold(instruction->op, instruction->type, inner->type, constant, 0, &result))
+        {
+            optimize_simplify_replace_const(simplify, index, result);
+        }
+        return;
+    }
+
+    // -(-x), ~~x and truncating a value back to the type it was extended from
+    bool cancels = (instruction->op == IR_NEG || instruction->op == IR_NOT) && inner->op == instruction->op;
+    cancels |= instruction->op == IR_TRUNC && (inner->op == IR_SEXT || inner->op == IR_ZEXT);
+    if (cancels)
+    {
+        uint32_t value = ir_operand(function, operand, 0);
+        if (function->instructions[value].type == instruction->type)
+        {
+            optimize_simplify_replace(simplify, index, value);
+        }
+    }
+}
+
+static void optimize_simplify_binary(struct optimize_simplify *simplify, uint32_t index)
+{
+    struct ir_function *function = simplify->function;
+    int op = function->instructions[index].op;
+    int type = function->instructions[index].type;
+    uint32_t left = ir_operand(function, index, 0);
+    uint32_t right = ir_operand(function, index, 1);
+    int operand_type = function->instructions[left].type;
+    long long a;
+    long long c;
+    bool left_constant = optimize_constant_of(function, left, &a);
+    bool right_constant = optimize_constant_of(function, right, &c);
+    if (left_constant && right_constant)
+    {
+        long long result;
+        if (optimize_fold(op, type, operand_type, a, c, &result))
+        {
+            optimize_simplify_replace_const(simplify, index, result);
+        }
+        return;
+    }
+
+    // constants go to the right so the rules below only look there
+    if (left_constant && optimize_is_commutative(op))
+    {
+        int flags = function->instructions[index].aux;
+        optimize_simplify_rewrite(simplify, index, optimize_swapped(op) ? optimize_swapped(op) : op, right, left);
+        function->instructions[index].aux = flags;
+        return;
+    }
+
+    bool same_type = type == operand_type;
+    if (left == right)
+    {
+        switch (op)
+        {
+        case IR_SUB:
+        case IR_XOR:
+        case IR_NE:
+        case IR_SLT:
+        case IR_SGT:
+        case IR_ULT:
+        case IR_UGT:
+            optimize_simplify_replace_const(simplify, index, 0);
+            return;
+        case IR_EQ:
+        case IR_SLE:
+        case IR_SGE:
+        case IR_ULE:
+        case IR_UGE:
+            optimize_simplify_replace_const(simplify, index, 1);
+            return;
+        case IR_AND:
+        case IR_OR:
+            optimize_simplify_replace(simplify, index, left);
+            return;
+        }
+    }
+
+    if (!right_constant)
+    {
+        return;
+    }
+
+    unsigned long long unsigned_constant = optimize_unsigned(operand_type, c);
+    int log = optimize_log2(unsigned_constant);
+    switch (op)
+    {
+    case IR_ADD:
+    {
+        long long inner;
+        struct ir_instruction *operand = &function->instructions[left];
+        if (c == 0 && same_type)
+        {
+            optimize_simplify_replace(simplify, index, left);
+        }
+        else if (operand->op == IR_ADD && optimize_constant_of(function, ir_operand(function, left, 1), &inner))
+        {
+            // (x + c1) + c2 is x + (c1 + c2)
+            uint32_t value = ir_operand(function, left, 0);
+            uint32_t sum = optimize_const(function, type, (unsigned long long)inner + c);
+            optimize_simplify_rewrite(simplify, index, IR_ADD, value, sum);
+        }
+        return;
+    }
+    case IR_SUB:
+        if (c == 0 && same_type)
+        {
+            optimize_simplify_replace(simplify, index, left);
+        }
+        else
+        {
+            optimize_simplify_rewrite(simplify, index, IR_ADD, left, optimize_const(function, type, -(unsigned long long)c));
+        }
+        return;
+    case IR_MUL:
+        if (c == 0)
+        {
+            optimize_simplify_replace_const(simplify, index, 0);
+        }
+        else if (c == 1 && same_type)
+        {
+            optimize_simplify_replace(simplify, index, left);
+        }
+        else if (log > 0)
+        {
+            // x * 2^k and x << k are the same number
+            int flags = function->instructions[index].aux;
+            optimize_simplify_rewrite(simplify, index, IR_SHL, left, optimize_const(function, type, log));
+            function->instructions[index].aux = flags;
+        }
+        return;
+    case IR_SDIV:
+        if (c == 1 && same_type)
+        {
+            optimize_simplify_replace(simplify, index, left);
+        }
+        return;
+    case IR_UDIV:
+        if (c == 1 && same_type)
+        {
+            optimize_simplify_replace(simplify, index, left);
+        }
+        else if (log > 0)
+        {
+            optimize_simplify_rewrite(simplify, index, IR_SHR, left, optimize_const(function, type, log));
+        }
+        return;
+    case IR_SREM:
+        if (c == 1 || c == -1)
+        {
+            optimize_simplify_replace_const(simplify, index, 0);
+        }
+        return;
+    case IR_UREM:
+        if (c == 1)
+        {
+            optimize_simplify_replace_const(simplify, index, 0);
+        }
+        else if (log > 0)
+        {
+            optimize_simplify_rewrite(simplify, index, IR_AND, left, optimize_const(function, type, unsigned_constant - 1));
+        }
+        return;
+    case IR_AND:
+        if (c == 0)
+        {
+            optimize_simplify_replace_const(simplify, index, 0);
+        }
+        else if (c == -1 && same_type)
+        {
+            optimize_simplify_replace(simplify, index, left);
+        }
+        return;
+    case IR_OR:
+    case IR_XOR:
+        if (c == 0 && same_type)
+        {
+            optimize_simplify_replace(simplify, index, left);
+        }
+        else if (c == -1 && op == IR_OR)
+        {
+            optimize_simplify_replace_const(simplify, index, -1);
+        }
+        return;
+    case IR_SHL:
+    case IR_SHR:
+    case IR_SAR:
+        if (c == 0 && same_type)
+        {
+            optimize_simplify_replace(simplify, index, left);
+        }
+        return;
+    case IR_EQ:
+    case IR_NE:
+    {
+        // comparing the result of a comparison with zero
+        int inner = function->instructions[left].op;
+        if (c != 0 || !optimize_is_comparison(inner))
+        {
+            return;
+        }
+
+        if (op == IR_NE)
+        {
+            optimize_simplify_replace(simplify, index, left);
+        }
+        else
+        {
+            optimize_simplify_rewrite(simplify, index, optimize_inverted(inner), ir_operand(function, left, 0), ir_operand(function, left, 1));
+        }
+        return;
+    }
+    }
+}
+
+/**
+ * A phi whose operands are all the same value or the phi itself
+ */
+static void optimize_simplify_phi(struct optimize_simplify *simplify, uint32_t index)
+{
+    struct ir_function *function = simplify->function;
+    uint32_t value = IR_NONE;
+    for (uint32_t i = 0; i < function->instructions[index].operand_count; i++)
+    {
+        uint32_t operand = ir_operand(function, index, i);
+        if (operand == index || operand == value)
+        {
+            continue;
+        }
+
+        if (value != IR_NONE)
+        {
+            return;
+        }
+        value = operand;
+    }
+
+    if (value != IR_NONE)
+    {
+        optimize_simplify_replace(simplify, index, value);
+    }
+}
+
+/**
+ * Applies algebraic identities, folds constants and turns multiplications and
+ * unsigned divisions by powers of two into shifts and masks until nothing changes
+ */
+static void optimize_simplify(struct ir_function *function)
+{
+    struct optimize_simplify simplify = {.function = function, .instruction_count = function->instruction_count};
+    simplify.queued = calloc(simplify.instruction_count, sizeof(bool));
+    simplify.worklist = vector_create(sizeof(uint32_t));
+    // queued backwards so the worklist hands out instructions in program order
+    for (uint32_t index = simplify.instruction_count - 1; index > 0; index--)
+    {
+        if (function->instructions[index].op != IR_NOP)
+        {
+            optimize_simplify_queue(&simplify, index);
+        }
+    }
+
+    while (!vector_empty(simplify.worklist))
+    {
+        uint32_t index = *(uint32_t *)vector_back(simplify.worklist);
+        vector_pop(simplify.worklist);
+        simplify.queued[index] = false;
+        int op = function->instructions[index].op;
+        if (op == IR_PHI)
+        {
+            optimize_simplify_phi(&simplify, index);
+        }
+        else if (optimize_is_binary(op))
+        {
+            optimize_simplify_binary(&simplify, index);
+        }
+        else if (optimize_is_unary(op))
+        {
+            optimize_simplify_unary(&simplify, index);
+        }
+    }
+
+    free(simplify.queued);
+    vector_free(simplify.worklist);
+}
+
+static bool optimize_has_effect(int op)
+{
+    return op == IR_STORE || op == IR_MEMCPY || op == IR_ZERO || op == IR_CALL || ir_is_terminator(op);
+}
+
+/**
+ * Removes instructions whose values are never used, marking from the ones with side effects
+ */
+static void optimize_dead_instructions(struct ir_function *function)
+{
+    bool *live = calloc(function->instruction_count, sizeof(bool));
+    struct vector *worklist = vector_create(sizeof(uint32_t));
+    for (uint32_t block = 1; block < function->block_count; block++)
+    {
+        for (uint32_t index = function->blocks[block].first; index != IR_NONE; index = function->instructions[index].next)
+        {
+            if (optimize_has_effect(function->instructions[index].op))
+            {
+                live[index] = true;
+                vector_push(worklist, &index);
+            }
+        }
+    }
+
+    while (!vector_empty(worklist))
+    {
+        uint32_t index = *(uint32_t *)vector_back(worklist);
+        vector_pop(worklist);
+        for (uint32_t i = 0; i < function->instructions[index].operand_count; i++)
+        {
+            uint32_t value = ir_operand(function, index, i);
+            if (value != IR_NONE && !live[value])
+            {
+                live[value] = true;
+                vector_push(worklist, &value);
+            }
+        }
+    }
+
+    // dead values may use each other, so every operand goes before anything is removed
+    for (uint32_t index = 1; index < function->instruction_count; index++)
+    {
+        if (!live[index] && function->instructions[index].op != IR_NOP)
+        {
+            for (uint32_t i = 0; i < function->instructions[index].operand_count; i++)
+            {
+                ir_set_operand(function, index, i, IR_NONE);
+            }
+        }
+    }
+
+    for (uint32_t index = 1; index < function->instruction_count; index++)
+    {
+        if (!live[index] && function->instructions[index].op != IR_NOP)
+        {
+            ir_remove(function, index);
+        }
+    }
+
+    free(live);
+    vector_free(worklist);
+}
+
+/**
+ * Blocks that only jump somewhere else, edges into them can go straight to the
+ * target as long as it has no phis that would need to tell the two apart
+ */
+static bool optimize_is_forwarder(struct ir_function *function, uint32_t block)
+{
+    struct ir_block *target = &function->blocks[block];
+    if (block == 1 || target->first != target->last || function->instructions[target->first].op != IR_JUMP)
+    {
+        return false;
+    }
+
+    uint32_t successor = target->successors[0];
+    return successor != block && function->instructions[function->blocks[successor].first].op != IR_PHI;
+}
+
+static uint32_t optimize_forward(struct ir_function *function, uint32_t *forward, uint32_t block)
+{
+    // the step limit stops at loops made of nothing but jumps
+    uint32_t target = block;
+    for (uint32_t steps = 0; steps < function->block_count && optimize_is_forwarder(function, target); steps++)
+    {
+        if (forward[target] != IR_NONE)
+        {
+            target = forward[target];
+            break;
+        }
+        target = function->blocks[target].successors[0];
+    }
+
+    for (uint32_t at = block; at != target && forward[at] == IR_NONE && optimize_is_forwarder(function, at);)
+    {
+        uint32_t next = function->blocks[at].successors[0];
+        forward[at] = target;
+        at = next;
+    }
+    return target;
+}
+
+/**
+ * Moves a block that jumps to a successor with no other predecessor into the
+ * front of that successor. The merged block keeps the index of the successor
+ * so the predecessor lists of the blocks after it, and the phis that follow
+ * their order, stay as they are
+ */
+static void optimize_merge(struct ir_function *function, uint32_t block)
+{
+    struct ir_block *target = &function->blocks[block];
+    uint32_t successor = target->successors[0];
+    struct ir_block *next = &function->blocks[successor];
+    while (function->instructions[next->first].op == IR_PHI)
+    {
+        uint32_t phi = next->first;
+        ir_replace_uses(function, phi, ir_operand(function, phi, 0));
+        ir_remove(function, phi);
+    }
+    ir_remove(function, target->last);
+
+    if (target->first != IR_NONE)
+    {
+        for (uint32_t index = target->first; index != IR_NONE; index = function->instructions[index].next)
+        {
+            function->instructions[index].block = successor;
+        }
+        function->instructions[target->last].next = next->first;
+        function->instructions[next->first].prev = target->last;
+        next->first = target->first;
+    }
+
+    for (uint32_t i = 0; i < target->pred_count; i++)
+    {
+        struct ir_block *pred = &function->blocks[function->preds[target->preds + i]];
+        for (int s = 0; s < 2; s++)
+        {
+            if (pred->successors[s] == block)
+            {
+                pred->successors[s] = successor;
+            }
+        }
+    }
+
+    next->preds = target->preds;
+    next->pred_count = target->pred_count;
+    target->flags |= IR_BLOCK_FLAG_DEAD;
+    target->first = IR_NONE;
+    target->last = IR_NONE;
+    target->successors[0] = IR_NONE;
+    target->pred_count = 0;
+}
+
+static bool optimize_can_merge(struct ir_function *function, uint32_t block)
+{
+    struct ir_block *target = &function->blocks[block];
+    uint32_t successor = target->successors[0];
+    return block != 1 && target->successors[1] == IR_NONE && successor != IR_NONE && successor != block && function->blocks[successor].pred_count == 1;
+}
+
+/**
+ * Merges straight line chains of blocks, successors are visited first so every
+ * instruction moves at most once
+ */
+static void optimize_merge_blocks(struct ir_function *function)
+{
+    uint32_t count = function->block_count;
+    bool *visited = calloc(count, sizeof(bool));
+    uint32_t *order = malloc(sizeof(uint32_t) * count);
+    // each entry is a block and the successor to look at next
+    uint32_t *stack = malloc(sizeof(uint32_t) * count * 2);
+    uint32_t order_count = 0;
+    uint32_t top = 0;
+    visited[1] = true;
+    stack[top++] = 1;
+    stack[top++] = 0;
+    while (top)
+    {
+        uint32_t block = stack[top - 2];
+        uint32_t s = stack[top - 1];
+        if (s == 2)
+        {
+            order[order_count++] = block;
+            top -= 2;
+            continue;
+        }
+
+        stack[top - 1]++;
+        uint32_t successor = function->blocks[block].successors[s];
+        if (successor != IR_NONE && !visited[successor])
+        {
+            visited[successor] = true;
+            stack[top++] = successor;
+            stack[top++] = 0;
+        }
+    }
+
+    for (uint32_t i = 0; i < order_count; i++)
+    {
+        if (optimize_can_merge(function, order[i]))
+        {
+            optimize_merge(function, order[i]);
+        }
+    }
+
+    free(visited);
+    free(order);
+    free(stack);
+}
+
+/**
+ * Sends edges past blocks that only jump, turns branches with one target into
+ * jumps, drops the blocks nothing reaches anymore and merges straight line code
+ */
+static void optimize_dead_blocks(struct ir_function *function)
+{
+    uint32_t *forward = calloc(function->block_count, sizeof(uint32_t));
+    for (uint32_t block = 1; block < function->block_count; block++)
+    {
+        struct ir_block *target = &function->blocks[block];
+        if (target->flags & IR_BLOCK_FLAG_DEAD)
+        {
+            continue;
+        }
+
+        for (int s = 0; s < 2; s++)
+        {
+            if (target->successors[s] != IR_NONE)
+            {
+                target->successors[s] = optimize_forward(function, forward, target->successors[s]);
+            }
+        }
+    }
+    ir_compute_predecessors(function);
+
+    for (uint32_t block = 1; block < function->block_count; block++)
+    {
+        struct ir_block *target = &function->blocks[block];
+        if (!(target->flags & IR_BLOCK_FLAG_DEAD) && target->successors[1] != IR_NONE && target->successors[0] == target->successors[1])
+        {
+            ir_branch_to_jump(function, block, 0);
+        }
+    }
+    ir_remove_unreachable_blocks(function);
+    optimize_merge_blocks(function);
+    free(forward);
+}
+
+/**
+ * The passes that work on one function at a time without looking at loops
+ */
+static void optimize_scalar(struct compile_process *process, struct ir_function *function)
+{
+    if (process->flags & COMPILE_PROCESS_FLAG_SCCP)
+    {
+        optimize_sccp(function);
+    }
+
+    if (process->flags & COMPILE_PROCESS_FLAG_SIMPLIFY)
+    {
+        optimize_simplify(function);
+    }
+
+    if (process->flags & COMPILE_PROCESS_FLAG_DCE)
+    {
+        optimize_dead_instructions(function);
+        optimize_dead_blocks(function);
+    }
+}
+
+/**
+ * Unrolled loops are folded by the scalar passes before the other loop passes
+ * look at what is left, and what those passes add is cleaned up the same way
+ */
+static void optimize_loops(struct compile_process *process, struct ir_function *function)
+{
+    if ((process->flags & COMPILE_PROCESS_FLAG_UNROLL) && loop_unroll(function))
+    {
+        optimize_scalar(process, function);
+    }
+
+    bool changed = false;
+    if (process->flags & COMPILE_PROCESS_FLAG_LICM)
+    {
+        changed |= loop_hoist_invariants(function);
+    }
+
+    if (process->flags & COMPILE_PROCESS_FLAG_STRENGTH_REDUCTION)
+    {
+        changed |= loop_reduce_strength(function);
+    }
+
+    // the moved and new instructions only need folding where their operands
+    // became constants, and the addresses strength reduction replaced are dead
+    if (changed && (process->flags & COMPILE_PROCESS_FLAG_SIMPLIFY))
+    {
+        optimize_simplify(function);
+    }
+
+    if (changed && (process->flags & COMPILE_PROCESS_FLAG_DCE))
+    {
+        optimize_dead_instructions(function);
+        optimize_dead_blocks(function);
+    }
+}
+
+int optimize(struct compile_process *process)
+{
+    int passes = COMPILE_PROCESS_FLAG_SCCP | COMPILE_PROCESS_FLAG_SIMPLIFY | COMPILE_PROCESS_FLAG_DCE | COMPILE_PROCESS_FLAG_INLINE | COMPILE_PROCESS_FLAG_TAIL_CALLS |
+                 COMPILE_PROCESS_FLAG_LICM | COMPILE_PROCESS_FLAG_STRENGTH_REDUCTION | COMPILE_PROCESS_FLAG_UNROLL;
+    if (!(process->flags & passes))
+    {
+        return OPTIMIZE_ALL_OK;
+    }
+
+    // callees first, so they are inlined after their own calls were
+    struct inline_graph *graph = inline_graph_create(process->ir);
+    for (int i = 0; i < graph->count; i++)
+    {
+        int index = graph->order[i];
+        struct ir_function *function = graph->functions[index];
+        if (process->flags & COMPILE_PROCESS_FLAG_INLINE)
+        {
+            inline_calls(graph, index);
+        }
+
+        if (process->flags & COMPILE_PROCESS_FLAG_TAIL_CALLS)
+        {
+            inline_tail_recursion(function);
+        }
+
+        optimize_scalar(process, function);
+        optimize_loops(process, function);
+
+        // the passes change the control flow graph the register allocator walks
+        ssa_compute_dominators(function);
+        graph->sizes[index] = inline_size(function);
+    }
+
+    // a streamed declaration may still be called by one that comes later
+    if ((process->flags & COMPILE_PROCESS_FLAG_INLINE) && !(process->flags & COMPILE_PROCESS_FLAG_STREAM))
+    {
+        inline_remove_unused(graph);
+    }
+    inline_graph_free(graph);
+    return OPTIMIZE_ALL_OK;
+}
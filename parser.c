@@ -0,0 +1,1681 @@
+#include "compiler.h"
+#include "helpers/vector.h"
+#include "helpers/hashmap.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// statements, expressions, initializers and struct bodies inside one another, every
+// level is a few stack frames here and in the stages after the parser
+#define PARSER_MAX_DEPTH 4096
+
+struct parser_typedef
+{
+    struct datatype datatype;
+    // token index of the name counted from the start of the translation unit,
+    // parsers running ahead of the typedef don't see it
+    long declared_at;
+};
+
+/**
+ * A function body whose parsing was left to a worker thread
+ */
+struct parser_body
+{
+    // the function node in the main pool
+    uint32_t function;
+    // token indexes of the body's opening and closing brace
+    int start;
+    int end;
+    // the body in the worker's pool until the pools are merged
+    uint32_t body;
+};
+
+/**
+ * All the state of one parse, parsers on different threads share nothing but
+ * the tokens and the file scope typedefs which are only read once the bodies are parsed
+ */
+struct parser
+{
+    struct compile_process *compiler;
+    struct node_pool *pool;
+    // the tokens being parsed, index is the next token to read and end is one past the last
+    struct token *tokens;
+    int index;
+    int end;
+    // tokens of the translation unit parsed before these, when they come one declaration at a time
+    long token_base;
+    // typedef name -> struct parser_typedef *
+    struct hashmap *typedefs;
+    // the blocks of the function body being parsed, innermost last. Each is a struct
+    // hashmap * of name -> struct parser_typedef *, or -> NULL for a variable hiding a
+    // typedef, and is NULL itself until something like that is declared in it
+    struct vector *scopes;
+    bool in_function;
+    // how deep the statement or expression being parsed is nested
+    int depth;
+    // vector of struct parser_body, when not NULL function bodies are skipped and
+    // recorded here to be parsed on worker threads
+    struct vector *bodies;
+
+    // the file scope function or variable whose body or initializer was parsed last,
+    // every node and datatype from release_node and release_datatype on belongs to it
+    uint32_t release_declaration;
+    uint32_t release_node;
+    uint32_t release_datatype;
+    // a file scope enum was defined, the resolver adds nodes for it after the body
+    bool defines_enum;
+};
+
+struct parser_worker
+{
+    struct parser parser;
+    struct parser_body *bodies;
+    int total;
+    // where the worker's pool goes in the main pool
+    struct node_pool *main_pool;
+    uint32_t first;
+    uint32_t first_datatype;
+    pthread_t thread;
+};
+
+// binding powers of the binary operators, an operator only continues an
+// expression whose minimum binding power is not higher than its own
+enum
+{
+    BP_NONE,
+    BP_COMMA,
+    BP_ASSIGNMENT,
+    BP_TERNARY,
+    BP_LOGICAL_OR,
+    BP_LOGICAL_AND,
+    BP_BITWISE_OR,
+    BP_BITWISE_XOR,
+    BP_BITWISE_AND,
+    BP_EQUALITY,
+    BP_RELATIONAL,
+    BP_SHIFT,
+    BP_ADDITIVE,
+    BP_MULTIPLICATIVE
+};
+
+static const unsigned char binding_powers[OP_TOTAL] = {
+    [OP_COMMA] = BP_COMMA,
+    [OP_ASSIGN] = BP_ASSIGNMENT,
+    [OP_PLUS_ASSIGN] = BP_ASSIGNMENT,
+    [OP_MINUS_ASSIGN] = BP_ASSIGNMENT,
+    [OP_MUL_ASSIGN] = BP_ASSIGNMENT,
+    [OP_DIV_ASSIGN] = BP_ASSIGNMENT,
+    [OP_MOD_ASSIGN] = BP_ASSIGNMENT,
+    [OP_XOR_ASSIGN] = BP_ASSIGNMENT,
+    [OP_AND_ASSIGN] = BP_ASSIGNMENT,
+    [OP_OR_ASSIGN] = BP_ASSIGNMENT,
+    [OP_SHIFT_LEFT_ASSIGN] = BP_ASSIGNMENT,
+    [OP_SHIFT_RIGHT_ASSIGN] = BP_ASSIGNMENT,
+    [OP_QUESTION] = BP_TERNARY,
+    [OP_LOGICAL_OR] = BP_LOGICAL_OR,
+    [OP_LOGICAL_AND] = BP_LOGICAL_AND,
+    [OP_PIPE] = BP_BITWISE_OR,
+    [OP_CARET] = BP_BITWISE_XOR,
+    [OP_AMPERSAND] = BP_BITWISE_AND,
+    [OP_EQUAL] = BP_EQUALITY,
+    [OP_NOT_EQUAL] = BP_EQUALITY,
+    [OP_LESS] = BP_RELATIONAL,
+    [OP_GREATER] = BP_RELATIONAL,
+    [OP_LESS_EQUAL] = BP_RELATIONAL,
+    [OP_GREATER_EQUAL] = BP_RELATIONAL,
+    [OP_SHIFT_LEFT] = BP_SHIFT,
+    [OP_SHIFT_RIGHT] = BP_SHIFT,
+    [OP_PLUS] = BP_ADDITIVE,
+    [OP_MINUS] = BP_ADDITIVE,
+    [OP_STAR] = BP_MULTIPLICATIVE,
+    [OP_SLASH] = BP_MULTIPLICATIVE,
+    [OP_PERCENT] = BP_MULTIPLICATIVE};
+
+static uint32_t parse_expression(struct parser *parser);
+static uint32_t parse_expression_bp(struct parser *parser, int min_bp);
+static uint32_t parse_unary(struct parser *parser);
+static uint32_t parse_statement(struct parser *parser);
+static uint32_t parse_body(struct parser *parser);
+static void parse_declaration(struct parser *parser, struct node_list *list, bool allow_function_body);
+
+static struct token *parser_peek(struct parser *parser, int ahead)
+{
+    int index = parser->index + ahead;
+    return index < parser->end ? &parser->tokens[index] : NULL;
+}
+
+static struct token *parser_next(struct parser *parser)
+{
+    struct token *token = parser_peek(parser, 0);
+    if (token)
+    {
+        parser->index++;
+    }
+    return token;
+}
+
+/**
+ * Points the compiler at the token the parser stopped on so errors are reported there
+ */
+static struct compile_process *parser_error_position(struct parser *parser)
+{
+    struct token *token = parser_peek(parser, 0);
+    if (!token && parser->index > 0)
+    {
+        token = &parser->tokens[parser->index - 1];
+    }
+
+    if (token)
+    {
+        parser->compiler->pos = token->pos;
+    }
+    return parser->compiler;
+}
+
+/**
+ * Called before parsing anything that can nest, the parser and the stages after
+ * it recurse once per level so the nesting is limited instead of the stack overflowing
+ */
+static void parser_enter(struct parser *parser)
+{
+    if (parser->depth == PARSER_MAX_DEPTH)
+    {
+        compiler_error(parser_error_position(parser), "Nested too deeply, more than %i levels\n", PARSER_MAX_DEPTH);
+    }
+    parser->depth++;
+}
+
+static void parser_leave(struct parser *parser)
+{
+    parser->depth--;
+}
+
+static bool parser_next_is_op(struct parser *parser, int op)
+{
+    return token_is_op(parser_peek(parser, 0), op);
+}
+
+static bool parser_next_is_keyword(struct parser *parser, const char *keyword)
+{
+    return tocken_if_keyword(parser_peek(parser, 0), keyword);
+}
+
+static bool parser_accept_op(struct parser *parser, int op)
+{
+    if (!parser_next_is_op(parser, op))
+    {
+        return false;
+    }
+    parser->index++;
+    return true;
+}
+
+static struct token *parser_expect_op(struct parser *parser, int op)
+{
+    if (!parser_next_is_op(parser, op))
+    {
+        compiler_error(parser_error_position(parser), "Expecting '%s'\n", token_op_spelling(op));
+    }
+    return parser_next(parser);
+}
+
+static struct token *parser_expect_identifier(struct parser *parser)
+{
+    struct token *token = parser_peek(parser, 0);
+    if (!token || token->type != TOKEN_TYPE_IDENTIFIER)
+    {
+        compiler_error(parser_error_position(parser), "Expecting an identifier\n");
+    }
+    return parser_next(parser);
+}
+
+static uint32_t parser_node(struct parser *parser, int type, struct token *token)
+{
+    return node_create(parser->pool, type, &token->pos);
+}
+
+static struct node *parser_node_at(struct parser *parser, uint32_t index)
+{
+    return node_at(parser->pool, index);
+}
+
+static bool parser_is_datatype_keyword(const char *str)
+{
+    return S_EQ(str, "void") ||
+           S_EQ(str, "char") ||
+           S_EQ(str, "short") ||
+           S_EQ(str, "int") ||
+           S_EQ(str, "long") ||
+           S_EQ(str, "float") ||
+           S_EQ(str, "double") ||
+           S_EQ(str, "signed") ||
+           S_EQ(str, "unsigned") ||
+           S_EQ(str, "struct") ||
+           S_EQ(str, "union") ||
+           S_EQ(str, "enum") ||
+           S_EQ(str, "const") ||
+           S_EQ(str, "volatile") ||
+           S_EQ(str, "static") ||
+           S_EQ(str, "extern") ||
+           S_EQ(str, "auto") ||
+           S_EQ(str, "register") ||
+           S_EQ(str, "inline") ||
+           S_EQ(str, "restrict") ||
+           S_EQ(str, "typedef");
+}
+
+static struct datatype *parser_get_typedef(struct parser *parser, const char *name)
+{
+    struct parser_typedef *defined = NULL;
+    bool found = false;
+    for (int i = vector_count(parser->scopes) - 1; i >= 0 && !found; i--)
+    {
+        struct hashmap *scope = *(struct hashmap **)vector_at(parser->scopes, i);
+        found = scope && hashmap_find(scope, name, (void **)&defined);
+    }
+
+    if (!found)
+    {
+        defined = hashmap_get(parser->typedefs, name);
+    }
+
+    if (!defined || defined->declared_at >= parser->token_base + parser->index)
+    {
+        return NULL;
+    }
+    return &defined->datatype;
+}
+
+static bool parser_is_datatype_start(struct parser *parser, struct token *token)
+{
+    if (!token)
+    {
+        return false;
+    }
+
+    if (token->type == TOKEN_TYPE_KEYWORD)
+    {
+        return parser_is_datatype_keyword(token->sval);
+    }
+    return token->type == TOKEN_TYPE_IDENTIFIER && parser_get_typedef(parser, token->sval);
+}
+
+static void parse_datatype_specifiers(struct parser *parser, struct datatype *datatype, struct node_list *definitions);
+
+/**
+ * struct name { members } or struct name, the definition node is appended to definitions
+ */
+static void parse_struct_specifier(struct parser *parser, struct datatype *datatype, struct node_list *definitions, bool is_union)
+{
+    struct token *keyword = parser_next(parser);
+    const char *tag = NULL;
+    struct token *token = parser_peek(parser, 0);
+    if (token && token->type == TOKEN_TYPE_IDENTIFIER)
+    {
+        tag = token->sval;
+        parser->index++;
+    }
+
+    datatype->type = is_union ? DATA_TYPE_UNION : DATA_TYPE_STRUCT;
+    datatype->type_str = tag;
+    if (!parser_accept_op(parser, SYM_LBRACE))
+    {
+        if (!tag)
+        {
+            compiler_error(parser_error_position(parser), "Expecting a name or a body after %s\n", keyword->sval);
+        }
+        return;
+    }
+
+    struct node_list members = {};
+    parser_enter(parser);
+    while (!parser_accept_op(parser, SYM_RBRACE))
+    {
+        parse_declaration(parser, &members, false);
+    }
+    parser_leave(parser);
+
+    uint32_t index = parser_node(parser, NODE_TYPE_STRUCT, keyword);
+    struct node *node = parser_node_at(parser, index);
+    node->sval = tag;
+    node->flags = is_union ? NODE_FLAG_UNION : 0;
+    node->list.first = members.head;
+    node_list_append(parser->pool, definitions, index);
+    datatype->struct_node = index;
+}
+
+/**
+ * enum name { A, B = 5 }, enumerations are ints
+ */
+static void parse_enum_specifier(struct parser *parser, struct datatype *datatype, struct node_list *definitions)
+{
+    struct token *keyword = parser_next(parser);
+    const char *tag = NULL;
+    struct token *token = parser_peek(parser, 0);
+    if (token && token->type == TOKEN_TYPE_IDENTIFIER)
+    {
+        tag = token->sval;
+        parser->index++;
+    }
+
+    datatype->type = DATA_TYPE_INT;
+    if (!parser_accept_op(parser, SYM_LBRACE))
+    {
+        return;
+    }
+
+    struct node_list enumerators = {};
+    while (!parser_accept_op(parser, SYM_RBRACE))
+    {
+        struct token *name = parser_expect_identifier(parser);
+        uint32_t value = NODE_NONE;
+        if (parser_accept_op(parser, OP_ASSIGN))
+        {
+            value = parse_expression_bp(parser, BP_ASSIGNMENT);
+        }
+
+        uint32_t index = parser_node(parser, NODE_TYPE_ENUMERATOR, name);
+        struct node *node = parser_node_at(parser, index);
+        node->sval = name->sval;
+        node->var.initializer = value;
+        node_list_append(parser->pool, &enumerators, index);
+        if (!parser_accept_op(parser, OP_COMMA))
+        {
+            parser_expect_op(parser, SYM_RBRACE);
+            break;
+        }
+    }
+
+    uint32_t index = parser_node(parser, NODE_TYPE_ENUM, keyword);
+    struct node *node = parser_node_at(parser, index);
+    node->sval = tag;
+    node->list.first = enumerators.head;
+    node_list_append(parser->pool, definitions, index);
+    parser->defines_enum |= !parser->in_function;
+}
+
+/**
+ * Reads storage classes, qualifiers and the base type such as "static const unsigned long"
+ */
+static void parse_datatype_specifiers(struct parser *parser, struct datatype *datatype, struct node_list *definitions)
+{
+    memset(datatype, 0, sizeof(struct datatype));
+    int type = -1;
+    int longs = 0;
+    bool is_short = false;
+    while (true)
+    {
+        struct token *token = parser_peek(parser, 0);
+        if (!token)
+        {
+            break;
+        }
+
+        if (token->type == TOKEN_TYPE_IDENTIFIER)
+        {
+            // a typedef name is only the type when no other type was given yet
+            struct datatype *defined = parser_get_typedef(parser, token->sval);
+            if (!defined || type != -1 || longs || is_short || (datatype->flags & (DATATYPE_FLAG_IS_SIGNED | DATATYPE_FLAG_IS_UNSIGNED)))
+            {
+                break;
+            }
+
+            int flags = datatype->flags;
+            *datatype = *defined;
+            datatype->flags |= flags;
+            type = datatype->type;
+            parser->index++;
+            continue;
+        }
+
+        if (token->type != TOKEN_TYPE_KEYWORD)
+        {
+            break;
+        }
+
+        const char *str = token->sval;
+        if (S_EQ(str, "struct") || S_EQ(str, "union"))
+        {
+            parse_struct_specifier(parser, datatype, definitions, S_EQ(str, "union"));
+            type = datatype->type;
+            continue;
+        }
+
+        if (S_EQ(str, "enum"))
+        {
+            parse_enum_specifier(parser, datatype, definitions);
+            type = datatype->type;
+            continue;
+        }
+
+        if (S_EQ(str, "void"))
+        {
+            type = DATA_TYPE_VOID;
+        }
+        else if (S_EQ(str, "char"))
+        {
+            type = DATA_TYPE_CHAR;
+        }
+        else if (S_EQ(str, "int"))
+        {
+            type = DATA_TYPE_INT;
+        }
+        else if (S_EQ(str, "float"))
+        {
+            type = DATA_TYPE_FLOAT;
+        }
+        else if (S_EQ(str, "double"))
+        {
+            type = DATA_TYPE_DOUBLE;
+        }
+        else if (S_EQ(str, "short"))
+        {
+            is_short = true;
+        }
+        else if (S_EQ(str, "long"))
+        {
+            longs++;
+        }
+        else if (S_EQ(str, "signed"))
+        {
+            datatype->flags |= DATATYPE_FLAG_IS_SIGNED;
+        }
+        else if (S_EQ(str, "unsigned"))
+        {
+            datatype->flags |= DATATYPE_FLAG_IS_UNSIGNED;
+        }
+        else if (S_EQ(str, "const"))
+        {
+            datatype->flags |= DATATYPE_FLAG_IS_CONST;
+        }
+        else if (S_EQ(str, "static"))
+        {
+            datatype->flags |= DATATYPE_FLAG_IS_STATIC;
+        }
+        else if (S_EQ(str, "extern"))
+        {
+            datatype->flags |= DATATYPE_FLAG_IS_EXTERN;
+        }
+        else if (S_EQ(str, "typedef"))
+        {
+            datatype->flags |= DATATYPE_FLAG_IS_TYPEDEF;
+        }
+        else if (S_EQ(str, "inline"))
+        {
+            datatype->flags |= DATATYPE_FLAG_IS_INLINE;
+        }
+        else if (!S_EQ(str, "volatile") && !S_EQ(str, "register") && !S_EQ(str, "auto") && !S_EQ(str, "restrict"))
+        {
+            break;
+        }
+        parser->index++;
+    }
+
+    if (is_short)
+    {
+        type = DATA_TYPE_SHORT;
+    }
+    else if (longs && type != DATA_TYPE_DOUBLE)
+    {
+        // long and long long are both 64 bits
+        type = DATA_TYPE_LONG;
+    }
+    else if (type == -1)
+    {
+        if (!(datatype->flags & (DATATYPE_FLAG_IS_SIGNED | DATATYPE_FLAG_IS_UNSIGNED)))
+        {
+            compiler_error(parser_error_position(parser), "Expecting a type\n");
+        }
+        type = DATA_TYPE_INT;
+    }
+    datatype->type = type;
+}
+
+/**
+ * Parses the pointers, declared name and array dimensions that follow the specifiers,
+ * returns the name token or NULL for an abstract declarator
+ */
+static struct token *parse_declarator(struct parser *parser, struct datatype *datatype)
+{
+    bool is_array = datatype->array_sizes != NODE_NONE;
+    while (parser_accept_op(parser, OP_STAR))
+    {
+        if (is_array)
+        {
+            compiler_error(parser_error_position(parser), "Pointers to arrays are not supported\n");
+        }
+
+        datatype->pointer_depth++;
+        while (parser_next_is_keyword(parser, "const") || parser_next_is_keyword(parser, "volatile") || parser_next_is_keyword(parser, "restrict"))
+        {
+            parser->index++;
+        }
+    }
+
+    struct token *name = NULL;
+    struct token *token = parser_peek(parser, 0);
+    if (token && token->type == TOKEN_TYPE_IDENTIFIER)
+    {
+        name = parser_next(parser);
+    }
+    else if (token_is_op(token, OP_LPAREN) && token_is_op(parser_peek(parser, 1), OP_STAR))
+    {
+        compiler_error(parser_error_position(parser), "Function pointers are not supported\n");
+    }
+
+    if (!parser_next_is_op(parser, OP_LBRACKET))
+    {
+        return name;
+    }
+
+    if (is_array)
+    {
+        compiler_error(parser_error_position(parser), "Arrays of array typedefs are not supported\n");
+    }
+
+    struct node_list sizes = {};
+    while (parser_next_is_op(parser, OP_LBRACKET))
+    {
+        struct token *bracket = parser_next(parser);
+        uint32_t size = NODE_NONE;
+        if (parser_next_is_op(parser, SYM_RBRACKET))
+        {
+            size = parser_node(parser, NODE_TYPE_NUMBER, bracket);
+            parser_node_at(parser, size)->flags |= NODE_FLAG_UNSIZED;
+        }
+        else
+        {
+            size = parse_expression(parser);
+        }
+        parser_expect_op(parser, SYM_RBRACKET);
+        node_list_append(parser->pool, &sizes, size);
+    }
+    datatype->array_sizes = sizes.head;
+    return name;
+}
+
+/**
+ * A type without a name as written in casts and sizeof, returns the datatype index
+ */
+static uint32_t parse_type_name(struct parser *parser)
+{
+    struct datatype datatype;
+    struct node_list definitions = {};
+    parse_datatype_specifiers(parser, &datatype, &definitions);
+    if (parse_declarator(parser, &datatype))
+    {
+        compiler_error(parser_error_position(parser), "Unexpected name in type\n");
+    }
+    return node_datatype_create(parser->pool, &datatype);
+}
+
+/**
+ * (int a, char *b, ...) returns the first parameter, parameters are variable nodes
+ */
+static uint32_t parse_function_params(struct parser *parser, int *flags)
+{
+    parser_expect_op(parser, OP_LPAREN);
+    if (parser_accept_op(parser, SYM_RPAREN))
+    {
+        return NODE_NONE;
+    }
+
+    if (parser_next_is_keyword(parser, "void") && token_is_op(parser_peek(parser, 1), SYM_RPAREN))
+    {
+        parser->index += 2;
+        return NODE_NONE;
+    }
+
+    struct node_list params = {};
+    struct node_list definitions = {};
+    while (true)
+    {
+        if (parser_accept_op(parser, OP_ELLIPSIS))
+        {
+            *flags |= NODE_FLAG_VARIADIC;
+            parser_expect_op(parser, SYM_RPAREN);
+            break;
+        }
+
+        struct token *start = parser_peek(parser, 0);
+        struct datatype datatype;
+        parse_datatype_specifiers(parser, &datatype, &definitions);
+        struct token *name = parse_declarator(parser, &datatype);
+
+        uint32_t index = parser_node(parser, NODE_TYPE_VARIABLE, name ? name : start);
+        uint32_t datatype_index = node_datatype_create(parser->pool, &datatype);
+        struct node *node = parser_node_at(parser, index);
+        node->sval = name ? name->sval : NULL;
+        node->datatype = datatype_index;
+        node_list_append(parser->pool, &params, index);
+
+        if (!parser_accept_op(parser, OP_COMMA))
+        {
+            parser_expect_op(parser, SYM_RPAREN);
+            break;
+        }
+    }
+    return params.head;
+}
+
+static uint32_t parse_initializer(struct parser *parser)
+{
+    struct token *brace = parser_peek(parser, 0);
+    if (!parser_accept_op(parser, SYM_LBRACE))
+    {
+        return parse_expression_bp(parser, BP_ASSIGNMENT);
+    }
+
+    struct node_list values = {};
+    parser_enter(parser);
+    while (!parser_accept_op(parser, SYM_RBRACE))
+    {
+        node_list_append(parser->pool, &values, parse_initializer(parser));
+        if (!parser_accept_op(parser, OP_COMMA))
+        {
+            parser_expect_op(parser, SYM_RBRACE);
+            break;
+        }
+    }
+    parser_leave(parser);
+
+    uint32_t index = parser_node(parser, NODE_TYPE_INITIALIZER_LIST, brace);
+    parser_node_at(parser, index)->list.first = values.head;
+    return index;
+}
+
+/**
+ * The names declared in the innermost block
+ */
+static struct hashmap *parser_scope(struct parser *parser)
+{
+    struct hashmap **scope = vector_back(parser->scopes);
+    if (!*scope)
+    {
+        *scope = hashmap_create();
+    }
+    return *scope;
+}
+
+/**
+ * Typedefs inside a function only last until the end of their block
+ */
+static void parse_typedef(struct parser *parser, struct token *name, struct datatype *datatype)
+{
+    struct hashmap *typedefs = parser->in_function ? parser_scope(parser) : parser->typedefs;
+
+    // a typedef may be repeated with the same type, the first one is kept
+    if (hashmap_get(typedefs, name->sval))
+    {
+        return;
+    }
+
+    struct parser_typedef *defined = malloc(sizeof(struct parser_typedef));
+    defined->datatype = *datatype;
+    defined->datatype.flags &= ~DATATYPE_FLAG_IS_TYPEDEF;
+    defined->declared_at = parser->token_base + (name - parser->tokens);
+    hashmap_set(typedefs, name->sval, defined);
+}
+
+static void parser_free_typedefs(struct hashmap *typedefs)
+{
+    for (size_t i = 0; i < typedefs->capacity; i++)
+    {
+        free(typedefs->entries[i].value);
+    }
+    hashmap_free(typedefs);
+}
+
+/**
+ * A variable or parameter named like a typedef hides it until the end of its block
+ */
+static void parser_hide_typedef(struct parser *parser, const char *name)
+{
+    if (parser->in_function && name && parser_get_typedef(parser, name))
+    {
+        hashmap_set(parser_scope(parser), name, NULL);
+    }
+}
+
+static void parser_push_scope(struct parser *parser)
+{
+    struct hashmap *scope = NULL;
+    vector_push(parser->scopes, &scope);
+}
+
+static void parser_pop_scope(struct parser *parser)
+{
+    struct hashmap *scope = *(struct hashmap **)vector_back(parser->scopes);
+    if (scope)
+    {
+        parser_free_typedefs(scope);
+    }
+    vector_pop(parser->scopes);
+}
+
+/**
+ * Parses the body of the function whose parameters start at params in the pool
+ */
+static uint32_t parse_function_body(struct parser *parser, struct node_pool *pool, uint32_t params)
+{
+    parser->in_function = true;
+    parser_push_scope(parser);
+    for (uint32_t param = params; param != NODE_NONE; param = node_at(pool, param)->next)
+    {
+        parser_hide_typedef(parser, node_at(pool, param)->sval);
+    }
+
+    uint32_t body = parse_body(parser);
+    parser_pop_scope(parser);
+    parser->in_function = false;
+    return body;
+}
+
+/**
+ * Records the body starting at the current token for a worker thread and skips past it
+ */
+static void parse_defer_function_body(struct parser *parser, uint32_t function)
+{
+    int start = parser->index;
+    int end = compile_process_matching_bracket(parser->compiler, start);
+    struct parser_body body = {
+        .function = function,
+        .start = start,
+        .end = end,
+        .body = NODE_NONE};
+    vector_push(parser->bodies, &body);
+    parser->index = end + 1;
+}
+
+/**
+ * Everything parsed from here on is the body or initializer of the file scope declaration
+ */
+static void parser_mark_release(struct parser *parser, uint32_t declaration)
+{
+    parser->release_declaration = declaration;
+    parser->release_node = parser->pool->base + parser->pool->count;
+    parser->release_datatype = parser->pool->base + parser->pool->datatype_count;
+}
+
+/**
+ * Parses a whole declaration including the ';' or the function body, the functions,
+ * variables and struct definitions it declares are appended to the list
+ */
+static void parse_declaration(struct parser *parser, struct node_list *list, bool allow_function_body)
+{
+    struct datatype base;
+    parse_datatype_specifiers(parser, &base, list);
+    if (parser_accept_op(parser, SYM_SEMICOLON))
+    {
+        // struct or enum definition on its own
+        return;
+    }
+
+    while (true)
+    {
+        // only what follows the last file scope declarator can be released
+        if (allow_function_body)
+        {
+            parser->release_declaration = NODE_NONE;
+        }
+
+        struct datatype datatype = base;
+        struct token *name = parse_declarator(parser, &datatype);
+        if (!name)
+        {
+            compiler_error(parser_error_position(parser), "Expecting a name in declaration\n");
+        }
+
+        if (datatype.flags & DATATYPE_FLAG_IS_TYPEDEF)
+        {
+            parse_typedef(parser, name, &datatype);
+        }
+        else if (parser_next_is_op(parser, OP_LPAREN))
+        {
+            int flags = 0;
+            uint32_t params = parse_function_params(parser, &flags);
+            bool has_body = parser_next_is_op(parser, SYM_LBRACE);
+            if (has_body && !allow_function_body)
+            {
+                compiler_error(parser_error_position(parser), "Functions can only be defined at file scope\n");
+            }
+
+            // the function comes before its body so the body can be released on its own
+            uint32_t index = parser_node(parser, NODE_TYPE_FUNCTION, name);
+            uint32_t datatype_index = node_datatype_create(parser->pool, &datatype);
+            struct node *node = parser_node_at(parser, index);
+            node->flags = flags;
+            node->sval = name->sval;
+            node->datatype = datatype_index;
+            node->func.params = params;
+            node->func.body = NODE_NONE;
+            node_list_append(parser->pool, list, index);
+            if (has_body)
+            {
+                if (parser->bodies)
+                {
+                    parse_defer_function_body(parser, index);
+                    return;
+                }
+
+                parser_mark_release(parser, index);
+                uint32_t body = parse_function_body(parser, parser->pool, params);
+                parser_node_at(parser, index)->func.body = body;
+                return;
+            }
+        }
+        else
+        {
+            parser_hide_typedef(parser, name->sval);
+            uint32_t index = parser_node(parser, NODE_TYPE_VARIABLE, name);
+            uint32_t datatype_index = node_datatype_create(parser->pool, &datatype);
+            struct node *node = parser_node_at(parser, index);
+            node->sval = name->sval;
+            node->datatype = datatype_index;
+            node->var.initializer = NODE_NONE;
+            node_list_append(parser->pool, list, index);
+            if (parser_accept_op(parser, OP_ASSIGN))
+            {
+                if (allow_function_body)
+                {
+                    parser_mark_release(parser, index);
+                }
+                uint32_t initializer = parse_initializer(parser);
+                parser_node_at(parser, index)->var.initializer = initializer;
+            }
+        }
+
+        if (!parser_accept_op(parser, OP_COMMA))
+        {
+            parser_expect_op(parser, SYM_SEMICOLON);
+            break;
+        }
+    }
+}
+
+/**
+ * "a" "b" is the one literal "ab", the tokens following the first are read here
+ */
+static void parse_string(struct parser *parser, struct node *node, struct token *token)
+{
+    node->sval = token->sval;
+    node->string.length = token->length;
+    if (!parser_peek(parser, 0) || parser_peek(parser, 0)->type != TOKEN_TYPE_STRING)
+    {
+        return;
+    }
+
+    size_t length = token->length;
+    int end = parser->index;
+    for (; end < parser->end && parser->tokens[end].type == TOKEN_TYPE_STRING; end++)
+    {
+        length += parser->tokens[end].length;
+    }
+
+    char *text = malloc(length + 1);
+    memcpy(text, token->sval, token->length);
+    length = token->length;
+    for (; parser->index < end; parser->index++)
+    {
+        memcpy(text + length, parser->tokens[parser->index].sval, parser->tokens[parser->index].length);
+        length += parser->tokens[parser->index].length;
+    }
+    text[length] = 0;
+    node->sval = text;
+    node->string.length = length;
+}
+
+static uint32_t parse_primary(struct parser *parser)
+{
+    struct token *token = parser_next(parser);
+    if (!token)
+    {
+        compiler_error(parser_error_position(parser), "Unexpected end of file in expression\n");
+    }
+
+    uint32_t index = NODE_NONE;
+    switch (token->type)
+    {
+    case TOKEN_TYPE_NUMBER:
+        index = parser_node(parser, NODE_TYPE_NUMBER, token);
+        parser_node_at(parser, index)->llnum = token->llnum;
+        return index;
+
+    case TOKEN_TYPE_STRING:
+        index = parser_node(parser, NODE_TYPE_STRING, token);
+        parse_string(parser, parser_node_at(parser, index), token);
+        return index;
+
+    case TOKEN_TYPE_IDENTIFIER:
+        index = parser_node(parser, NODE_TYPE_IDENTIFIER, token);
+        parser_node_at(parser, index)->sval = token->sval;
+        return index;
+
+    case TOKEN_TYPE_OPERATOR:
+        if (token->op == OP_LPAREN)
+        {
+            index = parse_expression(parser);
+            parser_expect_op(parser, SYM_RPAREN);
+            return index;
+        }
+        break;
+    }
+
+    parser->index--;
+    compiler_error(parser_error_position(parser), "Unexpected token in expression\n");
+    return NODE_NONE;
+}
+
+/**
+ * Calls, subscripts, member access and x++ x-- bind tighter than anything else
+ */
+static uint32_t parse_postfix(struct parser *parser, uint32_t left)
+{
+    while (true)
+    {
+        struct token *token = parser_peek(parser, 0);
+        if (!token || token->type != TOKEN_TYPE_OPERATOR)
+        {
+            return left;
+        }
+
+        uint32_t index = NODE_NONE;
+        switch (token->op)
+        {
+        case OP_LPAREN:
+        {
+            parser->index++;
+            struct node_list arguments = {};
+            while (!parser_accept_op(parser, SYM_RPAREN))
+            {
+                node_list_append(parser->pool, &arguments, parse_expression_bp(parser, BP_ASSIGNMENT));
+                if (!parser_accept_op(parser, OP_COMMA))
+                {
+                    parser_expect_op(parser, SYM_RPAREN);
+                    break;
+                }
+            }
+
+            index = parser_node(parser, NODE_TYPE_CALL, token);
+            struct node *node = parser_node_at(parser, index);
+            node->call.function = left;
+            node->call.arguments = arguments.head;
+        }
+        break;
+
+        case OP_LBRACKET:
+        {
+            parser->index++;
+            uint32_t subscript = parse_expression(parser);
+            parser_expect_op(parser, SYM_RBRACKET);
+            index = parser_node(parser, NODE_TYPE_SUBSCRIPT, token);
+            struct node *node = parser_node_at(parser, index);
+            node->exp.left = left;
+            node->exp.right = subscript;
+        }
+        break;
+
+        case OP_DOT:
+        case OP_ARROW:
+        {
+            parser->index++;
+            struct token *name = parser_expect_identifier(parser);
+            index = parser_node(parser, NODE_TYPE_MEMBER, token);
+            struct node *node = parser_node_at(parser, index);
+            node->op = token->op;
+            node->sval = name->sval;
+            node->unary.operand = left;
+        }
+        break;
+
+        case OP_INCREMENT:
+        case OP_DECREMENT:
+        {
+            parser->index++;
+            index = parser_node(parser, NODE_TYPE_POSTFIX, token);
+            struct node *node = parser_node_at(parser, index);
+            node->op = token->op;
+            node->unary.operand = left;
+        }
+        break;
+
+        default:
+            return left;
+        }
+        left = index;
+    }
+}
+
+static uint32_t parse_sizeof(struct parser *parser)
+{
+    struct token *token = parser_next(parser);
+    if (parser_next_is_op(parser, OP_LPAREN) && parser_is_datatype_start(parser, parser_peek(parser, 1)))
+    {
+        parser->index++;
+        uint32_t datatype = parse_type_name(parser);
+        parser_expect_op(parser, SYM_RPAREN);
+        uint32_t index = parser_node(parser, NODE_TYPE_SIZEOF, token);
+        struct node *node = parser_node_at(parser, index);
+        node->flags |= NODE_FLAG_SIZEOF_DATATYPE;
+        node->datatype = datatype;
+        return index;
+    }
+
+    uint32_t operand = parse_unary(parser);
+    uint32_t index = parser_node(parser, NODE_TYPE_SIZEOF, token);
+    parser_node_at(parser, index)->unary.operand = operand;
+    return index;
+}
+
+static uint32_t parse_prefix(struct parser *parser)
+{
+    struct token *token = parser_peek(parser, 0);
+    if (tocken_if_keyword(token, "sizeof"))
+    {
+        return parse_sizeof(parser);
+    }
+
+    if (token && token->type == TOKEN_TYPE_OPERATOR)
+    {
+        switch (token->op)
+        {
+        case OP_MINUS:
+        case OP_PLUS:
+        case OP_NOT:
+        case OP_TILDE:
+        case OP_STAR:
+        case OP_AMPERSAND:
+        case OP_INCREMENT:
+        case OP_DECREMENT:
+        {
+            parser->index++;
+            uint32_t operand = parse_unary(parser);
+            uint32_t index = parser_node(parser, NODE_TYPE_UNARY, token);
+            struct node *node = parser_node_at(parser, index);
+            node->op = token->op;
+            node->unary.operand = operand;
+            return index;
+        }
+
+        case OP_LPAREN:
+            if (parser_is_datatype_start(parser, parser_peek(parser, 1)))
+            {
+                parser->index++;
+                uint32_t datatype = parse_type_name(parser);
+                parser_expect_op(parser, SYM_RPAREN);
+                uint32_t operand = parse_unary(parser);
+                uint32_t index = parser_node(parser, NODE_TYPE_CAST, token);
+                struct node *node = parser_node_at(parser, index);
+                node->datatype = datatype;
+                node->unary.operand = operand;
+                return index;
+            }
+            break;
+        }
+    }
+
+    return parse_postfix(parser, parse_primary(parser));
+}
+
+/**
+ * Every operand goes through here, brackets and prefix operators nest by recursing
+ */
+static uint32_t parse_unary(struct parser *parser)
+{
+    parser_enter(parser);
+    uint32_t index = parse_prefix(parser);
+    parser_leave(parser);
+    return index;
+}
+
+/**
+ * Pratt parser for binary operators, the ternary operator and assignments.
+ * Only operators binding at least as tight as min_bp are consumed
+ */
+static uint32_t parse_expression_bp(struct parser *parser, int min_bp)
+{
+    uint32_t left = parse_unary(parser);
+    while (true)
+    {
+        struct token *token = parser_peek(parser, 0);
+        if (!token || token->type != TOKEN_TYPE_OPERATOR)
+        {
+            break;
+        }
+
+        int bp = binding_powers[token->op];
+        if (bp == BP_NONE || bp < min_bp)
+        {
+            break;
+        }
+        parser->index++;
+
+        // the branches of a conditional and the right of an assignment nest by
+        // recursing, the other operators are chained by the loop
+        if (token->op == OP_QUESTION)
+        {
+            parser_enter(parser);
+            uint32_t true_exp = parse_expression(parser);
+            parser_expect_op(parser, SYM_COLON);
+            uint32_t false_exp = parse_expression_bp(parser, BP_TERNARY);
+            parser_leave(parser);
+            uint32_t index = parser_node(parser, NODE_TYPE_TERNARY, token);
+            struct node *node = parser_node_at(parser, index);
+            node->ternary.condition = left;
+            node->ternary.true_exp = true_exp;
+            node->ternary.false_exp = false_exp;
+            left = index;
+            continue;
+        }
+
+        // assignments group right to left, everything else left to right
+        uint32_t right;
+        if (bp == BP_ASSIGNMENT)
+        {
+            parser_enter(parser);
+            right = parse_expression_bp(parser, bp);
+            parser_leave(parser);
+        }
+        else
+        {
+            right = parse_expression_bp(parser, bp + 1);
+        }
+        uint32_t index = parser_node(parser, NODE_TYPE_EXPRESSION, token);
+        struct node *node = parser_node_at(parser, index);
+        node->op = token->op;
+        node->exp.left = left;
+        node->exp.right = right;
+        left = index;
+    }
+    return left;
+}
+
+static uint32_t parse_expression(struct parser *parser)
+{
+    return parse_expression_bp(parser, BP_COMMA);
+}
+
+static uint32_t parse_parenthesized_expression(struct parser *parser)
+{
+    parser_expect_op(parser, OP_LPAREN);
+    uint32_t index = parse_expression(parser);
+    parser_expect_op(parser, SYM_RPAREN);
+    return index;
+}
+
+static uint32_t parse_body(struct parser *parser)
+{
+    struct token *brace = parser_expect_op(parser, SYM_LBRACE);
+    struct node_list statements = {};
+    parser_push_scope(parser);
+    while (!parser_accept_op(parser, SYM_RBRACE))
+    {
+        if (!parser_peek(parser, 0))
+        {
+            compiler_error(parser_error_position(parser), "Unexpected end of file in body\n");
+        }
+        node_list_append(parser->pool, &statements, parse_statement(parser));
+    }
+    parser_pop_scope(parser);
+
+    uint32_t index = parser_node(parser, NODE_TYPE_BODY, brace);
+    parser_node_at(parser, index)->list.first = statements.head;
+    return index;
+}
+
+/**
+ * An else if chain is as long as the source makes it, every if of it is parsed by
+ * the loop and becomes the else of the one before instead of nesting by recursing
+ */
+static uint32_t parse_if(struct parser *parser, struct token *keyword)
+{
+    uint32_t first = NODE_NONE;
+    uint32_t previous = NODE_NONE;
+    while (true)
+    {
+        uint32_t condition = parse_parenthesized_expression(parser);
+        uint32_t body = parse_statement(parser);
+        uint32_t index = parser_node(parser, NODE_TYPE_STATEMENT_IF, keyword);
+        struct node *node = parser_node_at(parser, index);
+        node->stmt_if.condition = condition;
+        node->stmt_if.body = body;
+        if (previous == NODE_NONE)
+        {
+            first = index;
+        }
+        else
+        {
+            parser_node_at(parser, previous)->stmt_if.else_body = index;
+        }
+        previous = index;
+
+        if (!parser_next_is_keyword(parser, "else"))
+        {
+            break;
+        }
+        parser->index++;
+        if (!parser_next_is_keyword(parser, "if"))
+        {
+            uint32_t else_body = parse_statement(parser);
+            parser_node_at(parser, index)->stmt_if.else_body = else_body;
+            break;
+        }
+        keyword = parser_peek(parser, 0);
+        parser->index++;
+    }
+    return first;
+}
+
+/**
+ * What the first clause declares is in a block of its own around the loop
+ */
+static uint32_t parse_for(struct parser *parser, struct token *keyword)
+{
+    parser_expect_op(parser, OP_LPAREN);
+    parser_push_scope(parser);
+    uint32_t init = NODE_NONE;
+    if (parser_is_datatype_start(parser, parser_peek(parser, 0)))
+    {
+        // the declaration consumes the ';'
+        struct node_list declarations = {};
+        parse_declaration(parser, &declarations, false);
+        init = declarations.head;
+    }
+    else
+    {
+        if (!parser_next_is_op(parser, SYM_SEMICOLON))
+        {
+            init = parse_expression(parser);
+        }
+        parser_expect_op(parser, SYM_SEMICOLON);
+    }
+
+    uint32_t condition = NODE_NONE;
+    if (!parser_next_is_op(parser, SYM_SEMICOLON))
+    {
+        condition = parse_expression(parser);
+    }
+    parser_expect_op(parser, SYM_SEMICOLON);
+
+    uint32_t step = NODE_NONE;
+    if (!parser_next_is_op(parser, SYM_RPAREN))
+    {
+        step = parse_expression(parser);
+    }
+    parser_expect_op(parser, SYM_RPAREN);
+
+    uint32_t body = parse_statement(parser);
+    parser_pop_scope(parser);
+    uint32_t index = parser_node(parser, NODE_TYPE_STATEMENT_FOR, keyword);
+    struct node *node = parser_node_at(parser, index);
+    node->stmt_for.init = init;
+    node->stmt_for.condition = condition;
+    node->stmt_for.step = step;
+    node->stmt_for.body = body;
+    return index;
+}
+
+/**
+ * Statements that start with a keyword, returns NODE_NONE if the keyword doesn't start one
+ */
+static uint32_t parse_keyword_statement(struct parser *parser)
+{
+    struct token *keyword = parser_peek(parser, 0);
+    const char *str = keyword->sval;
+    uint32_t index = NODE_NONE;
+    uint32_t exp = NODE_NONE;
+    uint32_t body = NODE_NONE;
+    if (S_EQ(str, "if"))
+    {
+        parser->index++;
+        return parse_if(parser, keyword);
+    }
+
+    if (S_EQ(str, "for"))
+    {
+        parser->index++;
+        return parse_for(parser, keyword);
+    }
+
+    if (S_EQ(str, "while") || S_EQ(str, "switch"))
+    {
+        parser->index++;
+        exp = parse_parenthesized_expression(parser);
+        body = parse_statement(parser);
+        index = parser_node(parser, S_EQ(str, "while") ? NODE_TYPE_STATEMENT_WHILE : NODE_TYPE_STATEMENT_SWITCH, keyword);
+    }
+    else if (S_EQ(str, "do"))
+    {
+        parser->index++;
+        body = parse_statement(parser);
+        if (!parser_next_is_keyword(parser, "while"))
+        {
+            compiler_error(parser_error_position(parser), "Expecting while after do body\n");
+        }
+        parser->index++;
+        exp = parse_parenthesized_expression(parser);
+        parser_expect_op(parser, SYM_SEMICOLON);
+        index = parser_node(parser, NODE_TYPE_STATEMENT_DO_WHILE, keyword);
+    }
+    else if (S_EQ(str, "return"))
+    {
+        parser->index++;
+        if (!parser_next_is_op(parser, SYM_SEMICOLON))
+        {
+            exp = parse_expression(parser);
+        }
+        parser_expect_op(parser, SYM_SEMICOLON);
+        index = parser_node(parser, NODE_TYPE_STATEMENT_RETURN, keyword);
+    }
+    else if (S_EQ(str, "break") || S_EQ(str, "continue"))
+    {
+        parser->index++;
+        parser_expect_op(parser, SYM_SEMICOLON);
+        index = parser_node(parser, S_EQ(str, "break") ? NODE_TYPE_STATEMENT_BREAK : NODE_TYPE_STATEMENT_CONTINUE, keyword);
+    }
+    else if (S_EQ(str, "case"))
+    {
+        parser->index++;
+        exp = parse_expression_bp(parser, BP_TERNARY);
+        parser_expect_op(parser, SYM_COLON);
+        index = parser_node(parser, NODE_TYPE_STATEMENT_CASE, keyword);
+    }
+    else if (S_EQ(str, "default"))
+    {
+        parser->index++;
+        parser_expect_op(parser, SYM_COLON);
+        index = parser_node(parser, NODE_TYPE_STATEMENT_DEFAULT, keyword);
+    }
+    else if (S_EQ(str, "goto"))
+    {
+        parser->index++;
+        struct token *label = parser_expect_identifier(parser);
+        parser_expect_op(parser, SYM_SEMICOLON);
+        index = parser_node(parser, NODE_TYPE_STATEMENT_GOTO, keyword);
+        parser_node_at(parser, index)->sval = label->sval;
+    }
+    else
+    {
+        return NODE_NONE;
+    }
+
+    struct node *node = parser_node_at(parser, index);
+    node->stmt.exp = exp;
+    node->stmt.body = body;
+    return index;
+}
+
+/**
+ * Returns the statement, a declaration can return a list of variables
+ */
+static uint32_t parse_single_statement(struct parser *parser)
+{
+    struct token *token = parser_peek(parser, 0);
+    if (!token)
+    {
+        compiler_error(parser_error_position(parser), "Expecting a statement\n");
+    }
+
+    if (token_is_op(token, SYM_LBRACE))
+    {
+        return parse_body(parser);
+    }
+
+    if (token_is_op(token, SYM_SEMICOLON))
+    {
+        // empty statement
+        parser->index++;
+        return parser_node(parser, NODE_TYPE_BODY, token);
+    }
+
+    if (token->type == TOKEN_TYPE_KEYWORD)
+    {
+        uint32_t index = parse_keyword_statement(parser);
+        if (index != NODE_NONE)
+        {
+            return index;
+        }
+    }
+
+    if (token->type == TOKEN_TYPE_IDENTIFIER && token_is_op(parser_peek(parser, 1), SYM_COLON))
+    {
+        parser->index += 2;
+        uint32_t index = parser_node(parser, NODE_TYPE_LABEL, token);
+        parser_node_at(parser, index)->sval = token->sval;
+        return index;
+    }
+
+    if (parser_is_datatype_start(parser, token))
+    {
+        struct node_list declarations = {};
+        parse_declaration(parser, &declarations, false);
+        if (declarations.head == NODE_NONE)
+        {
+            // only a struct or typedef was declared
+            return parser_node(parser, NODE_TYPE_BODY, token);
+        }
+        return declarations.head;
+    }
+
+    uint32_t index = parse_expression(parser);
+    parser_expect_op(parser, SYM_SEMICOLON);
+    return index;
+}
+
+/**
+ * Blocks, the bodies of loops and the branches of an if nest by recursing
+ */
+static uint32_t parse_statement(struct parser *parser)
+{
+    parser_enter(parser);
+    uint32_t index = parse_single_statement(parser);
+    parser_leave(parser);
+    return index;
+}
+
+static void *parser_worker_parse(void *data)
+{
+    struct parser_worker *worker = data;
+    for (int i = 0; i < worker->total; i++)
+    {
+        struct parser_body *body = &worker->bodies[i];
+        worker->parser.index = body->start;
+        worker->parser.end = body->end + 1;
+        body->body = parse_function_body(&worker->parser, worker->main_pool, node_at(worker->main_pool, body->function)->func.params);
+    }
+    return NULL;
+}
+
+static void *parser_worker_move(void *data)
+{
+    struct parser_worker *worker = data;
+    node_pool_move(worker->main_pool, worker->first, worker->first_datatype, worker->parser.pool);
+    return NULL;
+}
+
+static void parser_run_workers(struct parser *parser, struct parser_worker *workers, int total, void *(*function)(void *))
+{
+    for (int i = 0; i < total; i++)
+    {
+        if (pthread_create(&workers[i].thread, NULL, function, &workers[i]) != 0)
+        {
+            compiler_error(parser->compiler, "Failed to start a parser thread\n");
+        }
+    }
+
+    for (int i = 0; i < total; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+    }
+}
+
+/**
+ * Parses the recorded function bodies on worker threads. Every worker gets a run of
+ * consecutive bodies with about the same amount of tokens and its own pool. The pools
+ * are then moved into the main pool in worker order, which keeps the nodes in source
+ * order, with every worker relocating its own pool
+ */
+static void parse_bodies_in_parallel(struct parser *parser)
+{
+    int total = vector_count(parser->bodies);
+    if (total == 0)
+    {
+        return;
+    }
+
+    struct parser_body *bodies = vector_data_ptr(parser->bodies);
+    long total_tokens = 0;
+    for (int i = 0; i < total; i++)
+    {
+        total_tokens += bodies[i].end - bodies[i].start + 1;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int total_workers = cpus < 1 ? 1 : (cpus < total ? cpus : total);
+    struct parser_worker *workers = calloc(total_workers, sizeof(struct parser_worker));
+    int next = 0;
+    long tokens = 0;
+    for (int i = 0; i < total_workers; i++)
+    {
+        struct parser_worker *worker = &workers[i];
+        worker->parser = *parser;
+        worker->parser.pool = node_pool_create_local();
+        worker->parser.bodies = NULL;
+        worker->parser.scopes = vector_create(sizeof(struct hashmap *));
+        worker->main_pool = parser->pool;
+        worker->bodies = &bodies[next];
+
+        // leave at least one body for each of the remaining workers
+        long share = total_tokens * (i + 1) / total_workers;
+        while (next < total - (total_workers - i - 1) && (tokens < share || worker->total == 0))
+        {
+            tokens += bodies[next].end - bodies[next].start + 1;
+            worker->total++;
+            next++;
+        }
+    }
+    parser_run_workers(parser, workers, total_workers, parser_worker_parse);
+
+    for (int i = 0; i < total_workers; i++)
+    {
+        struct parser_worker *worker = &workers[i];
+        struct node_pool *local = worker->parser.pool;
+        worker->first = node_pool_extend(parser->pool, local->count, local->datatype_count, &worker->first_datatype);
+    }
+    parser_run_workers(parser, workers, total_workers, parser_worker_move);
+
+    for (int i = 0; i < total_workers; i++)
+    {
+        struct parser_worker *worker = &workers[i];
+        struct node_pool *local = worker->parser.pool;
+        for (int j = 0; j < worker->total; j++)
+        {
+            struct parser_body *body = &worker->bodies[j];
+            node_at(parser->pool, body->function)->func.body = body->body - local->base + worker->first;
+        }
+        node_pool_free(local);
+        vector_free(worker->parser.scopes);
+    }
+    free(workers);
+}
+
+/**
+ * A parser that keeps its typedefs between calls to parser_parse, the nodes go into
+ * the process's pool
+ */
+struct parser *parser_create(struct compile_process *process)
+{
+    struct parser *parser = calloc(1, sizeof(struct parser));
+    parser->compiler = process;
+    parser->pool = node_pool_create();
+    parser->typedefs = hashmap_create();
+    parser->scopes = vector_create(sizeof(struct hashmap *));
+    process->node_pool = parser->pool;
+    return parser;
+}
+
+/**
+ * Parses the tokens in the process's token_vec, which follow those of the last call,
+ * returns the first of the top level declarations they hold
+ */
+uint32_t parser_parse(struct parser *parser)
+{
+    struct compile_process *process = parser->compiler;
+    parser->token_base += parser->end;
+    parser->tokens = vector_data_ptr(process->token_vec);
+    parser->index = 0;
+    parser->end = vector_count(process->token_vec);
+    parser->release_declaration = NODE_NONE;
+    parser->defines_enum = false;
+
+    struct node_list tree = {};
+    while (parser->index < parser->end)
+    {
+        if (parser_accept_op(parser, SYM_SEMICOLON))
+        {
+            continue;
+        }
+        parse_declaration(parser, &tree, true);
+    }
+    return tree.head;
+}
+
+/**
+ * Once the last declaration parsed is compiled the nodes of its body or initializer
+ * can go, the function or variable stays declared. Returns the first node index that
+ * is handed out again or NODE_NONE when nothing was released
+ */
+uint32_t parser_release(struct parser *parser)
+{
+    if (parser->release_declaration == NODE_NONE || parser->defines_enum)
+    {
+        return NODE_NONE;
+    }
+
+    struct node *node = parser_node_at(parser, parser->release_declaration);
+    node->flags |= NODE_FLAG_RELEASED;
+    if (node->type == NODE_TYPE_FUNCTION)
+    {
+        node->func.body = NODE_NONE;
+    }
+    else
+    {
+        node->var.initializer = NODE_NONE;
+    }
+
+    node_pool_truncate(parser->pool, parser->release_node, parser->release_datatype);
+    parser->release_declaration = NODE_NONE;
+    return parser->release_node;
+}
+
+/**
+ * Frees the parser, the nodes stay in the process's pool
+ */
+void parser_free(struct parser *parser)
+{
+    parser_free_typedefs(parser->typedefs);
+    vector_free(parser->scopes);
+    free(parser);
+}
+
+int parse(struct compile_process *process)
+{
+    struct parser *parser = parser_create(process);
+    if (process->flags & COMPILE_PROCESS_FLAG_PARALLEL_PARSE)
+    {
+        // the declarations are parsed here first, the bodies are independent of
+        // each other and only need the typedefs of the declarations
+        parser->bodies = vector_create(sizeof(struct parser_body));
+    }
+
+    process->node_tree = parser_parse(parser);
+    if (parser->bodies)
+    {
+        parse_bodies_in_parallel(parser);
+        vector_free(parser->bodies);
+    }
+    parser_free(parser);
+    return PARSE_ALL_OK;
+}
@@ -0,0 +1,799 @@
+#include "compiler.h"
+#include <stdlib.h>
+
+/**
+ * Peephole rewrites of the assembly of one function before it goes to the
+ * output file. Every rule looks at a few instructions starting at one position,
+ * after a rule fires the window slides back so the rules see what it left.
+ *
+ * The rules lean on two things the code generator guarantees: flags are only
+ * live between a compare and the branch right after it, and rax, r10 and r11
+ * never carry a value from one block to another
+ */
+
+// the most instructions a rule looks at
+#define PEEPHOLE_WINDOW 4
+
+struct peephole_rule
+{
+    const char *name;
+    bool (*rewrite)(struct peephole *peephole, uint32_t at);
+};
+
+static const char *peephole_names64[] = {"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"};
+static const char *peephole_names32[] = {"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi", "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"};
+static const char *peephole_names16[] = {"ax", "cx", "dx", "bx", "sp", "bp", "si", "di", "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w"};
+static const char *peephole_names8[] = {"al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil", "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"};
+
+// condition codes and the ones that test the opposite
+static const char *peephole_conditions[][2] = {
+    {"e", "ne"}, {"ne", "e"}, {"l", "ge"}, {"ge", "l"}, {"le", "g"}, {"g", "le"}, {"b", "ae"}, {"ae", "b"}, {"be", "a"}, {"a", "be"}};
+
+struct peephole *peephole_create()
+{
+    struct peephole *peephole = calloc(1, sizeof(struct peephole));
+    peephole->capacity = 256;
+    peephole->instructions = calloc(peephole->capacity, sizeof(struct peephole_instruction));
+    peephole->count = 1;
+    return peephole;
+}
+
+void peephole_clear(struct peephole *peephole)
+{
+    for (uint32_t i = 1; i < peephole->count; i++)
+    {
+        free(peephole->instructions[i].operands[0]);
+        free(peephole->instructions[i].operands[1]);
+    }
+    peephole->count = 1;
+    peephole->first = IR_NONE;
+    peephole->last = IR_NONE;
+}
+
+void peephole_free(struct peephole *peephole)
+{
+    peephole_clear(peephole);
+    free(peephole->instructions);
+    free(peephole->fired);
+    free(peephole);
+}
+
+static char *peephole_copy(const char *text, size_t length)
+{
+    char *copy = malloc(length + 1);
+    memcpy(copy, text, length);
+    copy[length] = 0;
+    return copy;
+}
+
+static struct peephole_instruction *peephole_append(struct peephole *peephole)
+{
+    if (peephole->count == peephole->capacity)
+    {
+        peephole->capacity *= 2;
+        peephole->instructions = realloc(peephole->instructions, sizeof(struct peephole_instruction) * peephole->capacity);
+    }
+
+    uint32_t index = peephole->count++;
+    struct peephole_instruction *instruction = &peephole->instructions[index];
+    memset(instruction, 0, sizeof(struct peephole_instruction));
+    instruction->prev = peephole->last;
+    if (peephole->last != IR_NONE)
+    {
+        peephole->instructions[peephole->last].next = index;
+    }
+    else
+    {
+        peephole->first = index;
+    }
+    peephole->last = index;
+    return instruction;
+}
+
+/**
+ * Adds an instruction in AT&T syntax, operands are split at the commas outside parentheses
+ */
+void peephole_add(struct peephole *peephole, const char *line)
+{
+    struct peephole_instruction *instruction = peephole_append(peephole);
+    size_t length = strcspn(line, " ");
+    if (length >= sizeof(instruction->mnemonic))
+    {
+        length = sizeof(instruction->mnemonic) - 1;
+    }
+    memcpy(instruction->mnemonic, line, length);
+    const char *cursor = line + length;
+    while (*cursor == ' ')
+    {
+        cursor++;
+    }
+
+    while (*cursor && instruction->operand_count < 2)
+    {
+        int depth = 0;
+        const char *end = cursor;
+        while (*end && (depth || *end != ','))
+        {
+            depth += *end == '(' ? 1 : *end == ')' ? -1 : 0;
+            end++;
+        }
+
+        // a third operand stays in the second one, no rule looks at it
+        if (instruction->operand_count == 1)
+        {
+            end = cursor + strlen(cursor);
+        }
+        instruction->operands[instruction->operand_count++] = peephole_copy(cursor, end - cursor);
+        cursor = *end ? end + 1 : end;
+        while (*cursor == ' ')
+        {
+            cursor++;
+        }
+    }
+}
+
+void peephole_label(struct peephole *peephole, const char *name)
+{
+    struct peephole_instruction *instruction = peephole_append(peephole);
+    instruction->is_label = true;
+    instruction->operands[0] = peephole_copy(name, strlen(name));
+    instruction->operand_count = 1;
+}
+
+static struct peephole_instruction *peephole_at(struct peephole *peephole, uint32_t index)
+{
+    return index == IR_NONE ? NULL : &peephole->instructions[index];
+}
+
+static uint32_t peephole_next(struct peephole *peephole, uint32_t index)
+{
+    return index == IR_NONE ? IR_NONE : peephole->instructions[index].next;
+}
+
+static void peephole_remove(struct peephole *peephole, uint32_t index)
+{
+    struct peephole_instruction *instruction = &peephole->instructions[index];
+    if (instruction->prev != IR_NONE)
+    {
+        peephole->instructions[instruction->prev].next = instruction->next;
+    }
+    else
+    {
+        peephole->first = instruction->next;
+    }
+
+    if (instruction->next != IR_NONE)
+    {
+        peephole->instructions[instruction->next].prev = instruction->prev;
+    }
+    else
+    {
+        peephole->last = instruction->prev;
+    }
+}
+
+static void peephole_set(struct peephole_instruction *instruction, const char *mnemonic, const char *first, const char *second)
+{
+    if (mnemonic != instruction->mnemonic)
+    {
+        snprintf(instruction->mnemonic, sizeof(instruction->mnemonic), "%s", mnemonic);
+    }
+    const char *operands[2] = {first, second};
+    char *copies[2] = {NULL, NULL};
+    instruction->operand_count = 0;
+    for (int i = 0; i < 2 && operands[i]; i++)
+    {
+        copies[i] = peephole_copy(operands[i], strlen(operands[i]));
+        instruction->operand_count++;
+    }
+
+    // the new operands may be the old ones
+    free(instruction->operands[0]);
+    free(instruction->operands[1]);
+    instruction->operands[0] = copies[0];
+    instruction->operands[1] = copies[1];
+}
+
+static bool peephole_is(struct peephole_instruction *instruction, const char *mnemonic)
+{
+    return instruction && !instruction->is_label && S_EQ(instruction->mnemonic, mnemonic);
+}
+
+/**
+ * Whether the mnemonic is the stem with an optional size suffix
+ */
+static bool peephole_is_stem(struct peephole_instruction *instruction, const char *stem)
+{
+    size_t length = strlen(stem);
+    if (!instruction || instruction->is_label || strncmp(instruction->mnemonic, stem, length) != 0)
+    {
+        return false;
+    }
+    char suffix = instruction->mnemonic[length];
+    return !suffix || ((suffix == 'b' || suffix == 'w' || suffix == 'l' || suffix == 'q') && !instruction->mnemonic[length + 1]);
+}
+
+/**
+ * Register an operand names and its size in bytes, -1 for anything else
+ */
+static int peephole_register(const char *operand, int *size)
+{
+    if (!operand || operand[0] != '%')
+    {
+        return -1;
+    }
+
+    const char **tables[] = {peephole_names64, peephole_names32, peephole_names16, peephole_names8};
+    const int sizes[] = {8, 4, 2, 1};
+    for (int t = 0; t < 4; t++)
+    {
+        for (int reg = 0; reg < X86_REGISTER_COUNT; reg++)
+        {
+            if (S_EQ(operand + 1, tables[t][reg]))
+            {
+                *size = sizes[t];
+                return reg;
+            }
+        }
+    }
+    return -1;
+}
+
+static const char *peephole_register_name(int reg, int size)
+{
+    switch (size)
+    {
+    case 1:
+        return peephole_names8[reg];
+    case 2:
+        return peephole_names16[reg];
+    case 4:
+        return peephole_names32[reg];
+    }
+    return peephole_names64[reg];
+}
+
+/**
+ * Whether the operand refers to the register at any size, as itself or inside an address
+ */
+static bool peephole_mentions(const char *operand, int reg)
+{
+    if (!operand)
+    {
+        return false;
+    }
+
+    const char *names[] = {peephole_names64[reg], peephole_names32[reg], peephole_names16[reg], peephole_names8[reg]};
+    for (const char *at = strchr(operand, '%'); at; at = strchr(at + 1, '%'))
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            size_t length = strlen(names[i]);
+            char after = at[1 + length];
+            if (strncmp(at + 1, names[i], length) == 0 && !(after >= '0' && after <= '9') && after != 'd' && after != 'w' && after != 'b')
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static bool peephole_reads_flags(struct peephole_instruction *instruction)
+{
+    const char *mnemonic = instruction->mnemonic;
+    if (mnemonic[0] == 'j')
+    {
+        return !S_EQ(mnemonic, "jmp");
+    }
+    return strncmp(mnemonic, "set", 3) == 0 || strncmp(mnemonic, "cmov", 4) == 0 || peephole_is_stem(instruction, "adc") || peephole_is_stem(instruction, "sbb");
+}
+
+static bool peephole_writes_flags(struct peephole_instruction *instruction)
+{
+    static const char *stems[] = {"add", "sub", "and", "or", "xor", "cmp", "test", "shl", "shr", "sar", "imul", "neg", "inc", "dec", "div", "idiv"};
+    for (size_t i = 0; i < sizeof(stems) / sizeof(stems[0]); i++)
+    {
+        if (peephole_is_stem(instruction, stems[i]))
+        {
+            return true;
+        }
+    }
+    return S_EQ(instruction->mnemonic, "call") || S_EQ(instruction->mnemonic, "ret") || S_EQ(instruction->mnemonic, "jmp");
+}
+
+/**
+ * Whether the flags are written again before anything reads them
+ */
+static bool peephole_flags_dead(struct peephole *peephole, uint32_t from)
+{
+    for (uint32_t index = from; index != IR_NONE; index = peephole_next(peephole, index))
+    {
+        struct peephole_instruction *instruction = peephole_at(peephole, index);
+        if (instruction->is_label)
+        {
+            return true;
+        }
+
+        if (peephole_reads_flags(instruction))
+        {
+            return false;
+        }
+
+        if (peephole_writes_flags(instruction))
+        {
+            return true;
+        }
+    }
+    return true;
+}
+
+/**
+ * Whether a scratch register is written again before anything reads it
+ */
+static bool peephole_scratch_dead(struct peephole *peephole, uint32_t from, int reg)
+{
+    for (uint32_t index = from; index != IR_NONE; index = peephole_next(peephole, index))
+    {
+        struct peephole_instruction *instruction = peephole_at(peephole, index);
+        const char *mnemonic = instruction->mnemonic;
+        if (instruction->is_label || mnemonic[0] == 'j' || S_EQ(mnemonic, "call"))
+        {
+            return true;
+        }
+
+        // instructions that use rax and rdx without naming them
+        if (S_EQ(mnemonic, "ret") || S_EQ(mnemonic, "rep") || S_EQ(mnemonic, "cltd") || S_EQ(mnemonic, "cqto") || peephole_is_stem(instruction, "div") || peephole_is_stem(instruction, "idiv"))
+        {
+            return false;
+        }
+
+        if (instruction->operand_count == 0)
+        {
+            continue;
+        }
+
+        const char *destination = instruction->operands[instruction->operand_count - 1];
+        if (instruction->operand_count == 2 && peephole_mentions(instruction->operands[0], reg))
+        {
+            return false;
+        }
+
+        if (!peephole_mentions(destination, reg))
+        {
+            continue;
+        }
+
+        // only a full write of the register ends its value
+        int size;
+        bool is_move = strncmp(mnemonic, "mov", 3) == 0 || peephole_is_stem(instruction, "lea");
+        return instruction->operand_count == 2 && is_move && peephole_register(destination, &size) == reg && size >= 4;
+    }
+    return true;
+}
+
+static bool peephole_is_immediate(const char *operand, const char *value)
+{
+    return operand && operand[0] == '$' && S_EQ(operand + 1, value);
+}
+
+/**
+ * movq %r, %r
+ */
+static bool peephole_self_move(struct peephole *peephole, uint32_t at)
+{
+    struct peephole_instruction *instruction = peephole_at(peephole, at);
+    int size;
+    if (!peephole_is(instruction, "movq") || !S_EQ(instruction->operands[0], instruction->operands[1]) || peephole_register(instruction->operands[0], &size) < 0)
+    {
+        return false;
+    }
+    peephole_remove(peephole, at);
+    return true;
+}
+
+/**
+ * movq a, b followed by movq b, a, the second one has nothing left to do
+ */
+static bool peephole_move_back(struct peephole *peephole, uint32_t at)
+{
+    struct peephole_instruction *first = peephole_at(peephole, at);
+    uint32_t next = peephole_next(peephole, at);
+    struct peephole_instruction *second = peephole_at(peephole, next);
+    if (!peephole_is(first, "movq") || !peephole_is(second, "movq") || !S_EQ(first->operands[0], second->operands[1]) || !S_EQ(first->operands[1], second->operands[0]))
+    {
+        return false;
+    }
+
+    // movq (%rax), %rax changes the address the second move would use
+    int size;
+    int reg = peephole_register(first->operands[1], &size);
+    if (reg >= 0 && peephole_mentions(first->operands[0], reg))
+    {
+        return false;
+    }
+    peephole_remove(peephole, next);
+    return true;
+}
+
+/**
+ * mov $0, %r is longer than xorl %r, %r, which also writes the flags
+ */
+static bool peephole_zero_register(struct peephole *peephole, uint32_t at)
+{
+    struct peephole_instruction *instruction = peephole_at(peephole, at);
+    int size;
+    if ((!peephole_is(instruction, "movq") && !peephole_is(instruction, "movl")) || !peephole_is_immediate(instruction->operands[0], "0"))
+    {
+        return false;
+    }
+
+    int reg = peephole_register(instruction->operands[1], &size);
+    if (reg < 0 || !peephole_flags_dead(peephole, instruction->next))
+    {
+        return false;
+    }
+
+    char name[8];
+    snprintf(name, sizeof(name), "%%%s", peephole_names32[reg]);
+    peephole_set(instruction, "xorl", name, name);
+    return true;
+}
+
+/**
+ * Adding, or-ing or shifting a 64 bit value by zero, 32 bit forms clear the upper half so they stay
+ */
+static bool peephole_identity(struct peephole *peephole, uint32_t at)
+{
+    static const char *mnemonics[] = {"addq", "subq", "orq", "xorq", "shlq", "shrq", "sarq"};
+    struct peephole_instruction *instruction = peephole_at(peephole, at);
+    if (!instruction || instruction->is_label || !peephole_is_immediate(instruction->operands[0], "0"))
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < sizeof(mnemonics) / sizeof(mnemonics[0]); i++)
+    {
+        if (S_EQ(instruction->mnemonic, mnemonics[i]) && peephole_flags_dead(peephole, instruction->next))
+        {
+            peephole_remove(peephole, at);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * cmp $0, %r sets the same flags as the shorter test %r, %r
+ */
+static bool peephole_compare_zero(struct peephole *peephole, uint32_t at)
+{
+    struct peephole_instruction *instruction = peephole_at(peephole, at);
+    int size;
+    if (!peephole_is_stem(instruction, "cmp") || !peephole_is_immediate(instruction->operands[0], "0") || peephole_register(instruction->operands[1], &size) < 0)
+    {
+        return false;
+    }
+
+    char mnemonic[8];
+    snprintf(mnemonic, sizeof(mnemonic), "test%s", instruction->mnemonic + 3);
+    peephole_set(instruction, mnemonic, instruction->operands[1], instruction->operands[1]);
+    return true;
+}
+
+/**
+ * Whether one of the labels right after the instruction is the name
+ */
+static bool peephole_falls_into(struct peephole *peephole, uint32_t at, const char *name)
+{
+    for (uint32_t index = peephole_next(peephole, at); index != IR_NONE && peephole->instructions[index].is_label; index = peephole_next(peephole, index))
+    {
+        if (S_EQ(peephole->instructions[index].operands[0], name))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * A jump to the label that follows it
+ */
+static bool peephole_jump_to_next(struct peephole *peephole, uint32_t at)
+{
+    struct peephole_instruction *instruction = peephole_at(peephole, at);
+    if (!peephole_is(instruction, "jmp") || !peephole_falls_into(peephole, at, instruction->operands[0]))
+    {
+        return false;
+    }
+    peephole_remove(peephole, at);
+    return true;
+}
+
+static const char *peephole_inverse(const char *condition)
+{
+    for (size_t i = 0; i < sizeof(peephole_conditions) / sizeof(peephole_conditions[0]); i++)
+    {
+        if (S_EQ(condition, peephole_conditions[i][0]))
+        {
+            return peephole_conditions[i][1];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * jcc a; jmp b; a: turns into the opposite jump to b
+ */
+static bool peephole_branch_over_jump(struct peephole *peephole, uint32_t at)
+{
+    struct peephole_instruction *branch = peephole_at(peephole, at);
+    uint32_t next = peephole_next(peephole, at);
+    struct peephole_instruction *jump = peephole_at(peephole, next);
+    if (!branch || branch->is_label || branch->mnemonic[0] != 'j' || !peephole_is(jump, "jmp") || !peephole_falls_into(peephole, next, branch->operands[0]))
+    {
+        return false;
+    }
+
+    const char *inverse = peephole_inverse(branch->mnemonic + 1);
+    if (!inverse)
+    {
+        return false;
+    }
+
+    char mnemonic[8];
+    snprintf(mnemonic, sizeof(mnemonic), "j%s", inverse);
+    peephole_set(branch, mnemonic, jump->operands[0], NULL);
+    peephole_remove(peephole, next);
+    return true;
+}
+
+/**
+ * pushq a; popq b is a move, or nothing at all when a and b are the same
+ */
+static bool peephole_push_pop(struct peephole *peephole, uint32_t at)
+{
+    struct peephole_instruction *push = peephole_at(peephole, at);
+    uint32_t next = peephole_next(peephole, at);
+    struct peephole_instruction *pop = peephole_at(peephole, next);
+    if (!peephole_is(push, "pushq") || !peephole_is(pop, "popq"))
+    {
+        return false;
+    }
+
+    int size;
+    if (S_EQ(push->operands[0], pop->operands[0]))
+    {
+        peephole_remove(peephole, next);
+        peephole_remove(peephole, at);
+        return true;
+    }
+
+    if (peephole_register(push->operands[0], &size) < 0 && peephole_register(pop->operands[0], &size) < 0)
+    {
+        return false;
+    }
+    peephole_set(push, "movq", push->operands[0], pop->operands[0]);
+    peephole_remove(peephole, next);
+    return true;
+}
+
+/**
+ * movq %a, %b followed by an extension of b into itself extends a directly
+ */
+static bool peephole_move_extend(struct peephole *peephole, uint32_t at)
+{
+    static const char *extensions[] = {"movslq", "movsbl", "movswl", "movzbl", "movzwl", "movsbq", "movswq", "movzbq", "movzwq", "movl"};
+    struct peephole_instruction *move = peephole_at(peephole, at);
+    uint32_t next = peephole_next(peephole, at);
+    struct peephole_instruction *extend = peephole_at(peephole, next);
+    if (!peephole_is(move, "movq") || !extend || extend->is_label || extend->operand_count != 2)
+    {
+        return false;
+    }
+
+    bool is_extension = false;
+    for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++)
+    {
+        is_extension |= S_EQ(extend->mnemonic, extensions[i]);
+    }
+
+    int size;
+    int source_size;
+    int destination_size;
+    int from = peephole_register(move->operands[0], &size);
+    int to = peephole_register(move->operands[1], &size);
+    if (!is_extension || from < 0 || to < 0 || from == to)
+    {
+        return false;
+    }
+
+    // the extension has to write at least the low half of b, which clears the rest
+    if (peephole_register(extend->operands[0], &source_size) != to || peephole_register(extend->operands[1], &destination_size) != to || destination_size < 4)
+    {
+        return false;
+    }
+
+    char name[8];
+    snprintf(name, sizeof(name), "%%%s", peephole_register_name(from, source_size));
+    peephole_set(extend, extend->mnemonic, name, extend->operands[1]);
+    peephole_remove(peephole, at);
+    return true;
+}
+
+/**
+ * movq %rbp, %rsp; popq %rbp
+ */
+static bool peephole_leave(struct peephole *peephole, uint32_t at)
+{
+    struct peephole_instruction *move = peephole_at(peephole, at);
+    uint32_t next = peephole_next(peephole, at);
+    struct peephole_instruction *pop = peephole_at(peephole, next);
+    if (!peephole_is(move, "movq") || !S_EQ(move->operands[0], "%rbp") || !S_EQ(move->operands[1], "%rsp") || !peephole_is(pop, "popq") || !S_EQ(pop->operands[0], "%rbp"))
+    {
+        return false;
+    }
+    peephole_set(move, "leave", NULL, NULL);
+    peephole_remove(peephole, next);
+    return true;
+}
+
+/**
+ * A comparison result widened in rax and then copied out is widened straight
+ * into its register, rax is scratch and dies with the copy
+ */
+static bool peephole_widen_copy(struct peephole *peephole, uint32_t at)
+{
+    struct peephole_instruction *widen = peephole_at(peephole, at);
+    uint32_t next = peephole_next(peephole, at);
+    struct peephole_instruction *copy = peephole_at(peephole, next);
+    int size;
+    if (!peephole_is(widen, "movzbl") || !S_EQ(widen->operands[0], "%al") || !S_EQ(widen->operands[1], "%eax") || !peephole_is(copy, "movq") || !S_EQ(copy->operands[0], "%rax"))
+    {
+        return false;
+    }
+
+    int reg = peephole_register(copy->operands[1], &size);
+    if (reg < 0 || !peephole_scratch_dead(peephole, copy->next, X86_RAX))
+    {
+        return false;
+    }
+
+    char name[8];
+    snprintf(name, sizeof(name), "%%%s", peephole_names32[reg]);
+    peephole_set(widen, "movzbl", "%al", name);
+    peephole_remove(peephole, next);
+    return true;
+}
+
+/**
+ * setcc %al; movzbl %al, %eax; testl %eax, %eax; jne/je branches on the condition itself
+ */
+static bool peephole_set_branch(struct peephole *peephole, uint32_t at)
+{
+    struct peephole_instruction *set = peephole_at(peephole, at);
+    uint32_t widen = peephole_next(peephole, at);
+    uint32_t test = peephole_next(peephole, widen);
+    uint32_t branch = peephole_next(peephole, test);
+    struct peephole_instruction *instructions[] = {peephole_at(peephole, widen), peephole_at(peephole, test), peephole_at(peephole, branch)};
+    if (!set || set->is_label || strncmp(set->mnemonic, "set", 3) != 0 || !S_EQ(set->operands[0], "%al") || !peephole_is(instructions[0], "movzbl") || !S_EQ(instructions[0]->operands[1], "%eax") || !peephole_is(instructions[1], "testl") || !S_EQ(instructions[1]->operands[0], "%eax") || !S_EQ(instructions[1]->operands[1], "%eax"))
+    {
+        return false;
+    }
+
+    struct peephole_instruction *jump = instructions[2];
+    const char *condition = set->mnemonic + 3;
+    if (peephole_is(jump, "je"))
+    {
+        condition = peephole_inverse(condition);
+    }
+    else if (!peephole_is(jump, "jne"))
+    {
+        return false;
+    }
+
+    if (!condition || !peephole_scratch_dead(peephole, jump->next, X86_RAX))
+    {
+        return false;
+    }
+
+    char mnemonic[8];
+    snprintf(mnemonic, sizeof(mnemonic), "j%s", condition);
+    peephole_set(set, mnemonic, jump->operands[0], NULL);
+    peephole_remove(peephole, branch);
+    peephole_remove(peephole, test);
+    peephole_remove(peephole, widen);
+    return true;
+}
+
+static const struct peephole_rule peephole_rules[] = {
+    {"self move", peephole_self_move},
+    {"move back", peephole_move_back},
+    {"push pop", peephole_push_pop},
+    {"move extend", peephole_move_extend},
+    {"set branch", peephole_set_branch},
+    {"widen copy", peephole_widen_copy},
+    {"identity", peephole_identity},
+    {"zero register", peephole_zero_register},
+    {"compare zero", peephole_compare_zero},
+    {"jump to next", peephole_jump_to_next},
+    {"branch over jump", peephole_branch_over_jump},
+    {"leave", peephole_leave}};
+
+#define PEEPHOLE_RULE_COUNT (sizeof(peephole_rules) / sizeof(peephole_rules[0]))
+
+/**
+ * Slides the window over the list until no rule fires anywhere
+ */
+void peephole_run(struct peephole *peephole)
+{
+    if (!peephole->fired)
+    {
+        peephole->fired = calloc(PEEPHOLE_RULE_COUNT, sizeof(int));
+    }
+
+    uint32_t at = peephole->first;
+    while (at != IR_NONE)
+    {
+        uint32_t prev = peephole->instructions[at].prev;
+        bool fired = false;
+        for (size_t r = 0; r < PEEPHOLE_RULE_COUNT && !fired; r++)
+        {
+            if (peephole_rules[r].rewrite(peephole, at))
+            {
+                peephole->fired[r]++;
+                fired = true;
+            }
+        }
+
+        if (!fired)
+        {
+            at = peephole->instructions[at].next;
+            continue;
+        }
+
+        // the rule may have removed the instruction at the start of the window,
+        // start again from far enough back to see everything it touched
+        at = prev;
+        for (int i = 1; i < PEEPHOLE_WINDOW - 1 && at != IR_NONE && peephole->instructions[at].prev != IR_NONE; i++)
+        {
+            at = peephole->instructions[at].prev;
+        }
+        if (at == IR_NONE)
+        {
+            at = peephole->first;
+        }
+    }
+}
+
+/**
+ * Writes the instructions to the file and empties the list for the next function
+ */
+void peephole_write(struct peephole *peephole, FILE *out)
+{
+    for (uint32_t index = peephole->first; index != IR_NONE; index = peephole->instructions[index].next)
+    {
+        struct peephole_instruction *instruction = &peephole->instructions[index];
+        if (instruction->is_label)
+        {
+            fprintf(out, "%s:\n", instruction->operands[0]);
+            continue;
+        }
+
+        fprintf(out, "\t%s", instruction->mnemonic);
+        for (int i = 0; i < instruction->operand_count; i++)
+        {
+            fprintf(out, i == 0 ? " %s" : ", %s", instruction->operands[i]);
+        }
+        fprintf(out, "\n");
+    }
+    peephole_clear(peephole);
+}
+
+void peephole_report(struct peephole *peephole, FILE *out)
+{
+    for (size_t r = 0; r < PEEPHOLE_RULE_COUNT; r++)
+    {
+        fprintf(out, "%-18s %i\n", peephole_rules[r].name, peephole->fired ? peephole->fired[r] : 0);
+    }
+}
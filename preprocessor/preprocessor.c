@@ -0,0 +1,1864 @@
+#include "compiler.h"
+#include "helpers/vector.h"
+#include "helpers/buffer.h"
+#include "helpers/hashmap.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+// guards against headers that include themselves without a guard
+#define PREPROCESSOR_MAX_INCLUDE_DEPTH 200
+// brackets and unary operators inside one another in a #if expression
+#define PREPROCESSOR_MAX_EXPRESSION_DEPTH 1024
+// macro calls in the arguments of macro calls, every level holds a copy of the
+// arguments around it while it expands its own so the levels are few
+#define PREPROCESSOR_MAX_ARGUMENT_DEPTH 128
+
+enum
+{
+    PREPROCESSOR_DEFINITION_STANDARD,
+    PREPROCESSOR_DEFINITION_MACRO_FUNCTION
+};
+
+struct preprocessor_definition
+{
+    int type;
+    const char *name;
+    // tokens that make up the body of this definition
+    struct vector *value;
+    // const char* argument names for function like macros
+    struct vector *arguments;
+    bool variadic;
+};
+
+struct preprocessor_included_file
+{
+    const char *filename;
+    bool pragma_once;
+    // macro that guards the whole file, NULL if the file is not guarded
+    const char *guard;
+};
+
+enum
+{
+    // nothing but comments and newlines seen so far
+    PREPROCESSOR_GUARD_START,
+    // inside the #ifndef that might be the include guard
+    PREPROCESSOR_GUARD_INSIDE,
+    // the guard's #endif has been seen
+    PREPROCESSOR_GUARD_CLOSED,
+    // the file is not guarded
+    PREPROCESSOR_GUARD_NONE
+};
+
+struct preprocessor_source
+{
+    struct compile_process *compiler;
+    struct lex_process *lex_process;
+    // the lexer thread reading the file ahead of us, instead of lex_process
+    struct lex_pipeline *pipeline;
+    // struct token of the whole file when it is read from the cache instead of the lexer
+    struct vector *tokens;
+    int token_index;
+    // lexes a skipped branch of a cached file once a compile takes that branch
+    struct lex_process *skipped;
+    // struct token read from lex_process for the cache, the skipped branches as
+    // TOKEN_TYPE_SKIPPED, NULL when the file isn't cached
+    struct vector *record;
+    struct preprocessor_included_file *file;
+
+    // true when the next token is the first one on its line
+    bool line_start;
+
+    // conditional depth on entry, every file must close the conditionals it opens
+    int if_depth;
+
+    int guard_state;
+    const char *guard;
+    // index into preprocessor->ifs of the guard's #ifndef
+    int guard_if_index;
+};
+
+struct preprocessor_if
+{
+    // are the tokens of the current branch kept
+    bool active;
+    // has any branch of this conditional been taken (or can never be taken)
+    bool taken;
+    bool seen_else;
+};
+
+struct preprocessor
+{
+    struct compile_process *compiler;
+
+    // name -> struct preprocessor_definition*, NULL once undefined
+    struct hashmap *definitions;
+    // absolute path -> struct preprocessor_included_file*
+    struct hashmap *included_files;
+    // include lookup key -> absolute path, NULL when the file does not exist
+    struct hashmap *include_paths;
+    // "name next" pointers -> struct preprocessor_hideset*, equal hidesets are one
+    struct hashmap *hidesets;
+
+    // const char* directories searched for includes
+    struct vector *include_dirs;
+    // struct preprocessor_source* stack, the back is the file being read
+    struct vector *sources;
+    // struct preprocessor_if stack
+    struct vector *ifs;
+    // int indexes into compiler->token_vec of the brackets still open
+    struct vector *open_brackets;
+    // macro arguments being expanded inside one another
+    int argument_depth;
+
+    // the expansion of the translation unit, kept between calls to preprocessor_next_declaration
+    struct preprocessor_expansion *expansion;
+    // the main file is lexed on a thread of its own, which lets go of what it read itself
+    bool pipelined;
+    // stop the expansion at the end of every top level declaration
+    bool split;
+    // the declaration being read has a '=' outside of brackets, its '{' opens a function body
+    bool declaration_initialized;
+    bool declaration_function;
+};
+
+/**
+ * Names of the macros a token must not be expanded by again, lists share their tails
+ */
+struct preprocessor_hideset
+{
+    const char *name;
+    struct preprocessor_hideset *next;
+};
+
+struct preprocessor_token
+{
+    struct token token;
+    struct preprocessor_hideset *hideset;
+};
+
+/**
+ * Expanded macro bodies waiting to be rescanned. Each expansion becomes a chunk in
+ * front of the chain so splicing it in costs nothing no matter how long the rest of
+ * the input is.
+ */
+struct preprocessor_token_chunk
+{
+    // struct preprocessor_token
+    struct vector *tokens;
+    int index;
+    struct preprocessor_token_chunk *next;
+};
+
+struct preprocessor_expansion
+{
+    // read before anything else
+    struct preprocessor_token_chunk *chunks;
+    // once the chunks are exhausted read on from the files, false when
+    // expanding a macro argument or a directive line in isolation
+    bool read_source;
+    // struct token, where fully expanded tokens end up
+    struct vector *output;
+    // a whole declaration was output when the preprocessor splits the translation unit
+    bool stop;
+};
+
+struct preprocessor_expression
+{
+    struct preprocessor *preprocessor;
+    struct preprocessor_source *source;
+    struct vector *tokens;
+    int index;
+    int depth;
+};
+
+static long long preprocessor_evaluate(struct preprocessor_expression *expression, int min_priority);
+static long long preprocessor_evaluate_unary(struct preprocessor_expression *expression);
+static struct vector *preprocessor_expand_line(struct preprocessor *preprocessor, struct vector *line, int start);
+
+struct preprocessor *preprocessor_create(struct compile_process *compiler)
+{
+    struct preprocessor *preprocessor = calloc(1, sizeof(struct preprocessor));
+    preprocessor->compiler = compiler;
+    preprocessor->definitions = hashmap_create();
+    preprocessor->included_files = hashmap_create();
+    preprocessor->include_paths = hashmap_create();
+    preprocessor->hidesets = hashmap_create();
+    preprocessor->include_dirs = vector_create(sizeof(const char *));
+    preprocessor->sources = vector_create(sizeof(struct preprocessor_source *));
+    preprocessor->ifs = vector_create(sizeof(struct preprocessor_if));
+    preprocessor->open_brackets = vector_create(sizeof(int));
+
+    const char *default_dirs[] = {"/usr/local/include", "/usr/include"};
+    for (int i = 0; i < sizeof(default_dirs) / sizeof(default_dirs[0]); i++)
+    {
+        vector_push(preprocessor->include_dirs, &default_dirs[i]);
+    }
+    return preprocessor;
+}
+
+static struct preprocessor_definition *preprocessor_get_definition(struct preprocessor *preprocessor, const char *name)
+{
+    return hashmap_get(preprocessor->definitions, name);
+}
+
+static bool preprocessor_is_active(struct preprocessor *preprocessor)
+{
+    struct preprocessor_if *current_if = vector_back_or_null(preprocessor->ifs);
+    return !current_if || current_if->active;
+}
+
+static const char *preprocessor_token_name(struct token *token)
+{
+    if (token && (token->type == TOKEN_TYPE_IDENTIFIER || token->type == TOKEN_TYPE_KEYWORD))
+    {
+        return token->sval;
+    }
+    return NULL;
+}
+
+static struct preprocessor_source *preprocessor_push_source(struct preprocessor *preprocessor, struct compile_process *compiler, struct lex_process *lex_process, struct vector *tokens,
+                                     struct preprocessor_included_file *file)
+{
+    struct preprocessor_source *source = calloc(1, sizeof(struct preprocessor_source));
+    source->compiler = compiler;
+    source->lex_process = lex_process;
+    source->tokens = tokens;
+    source->file = file;
+    source->line_start = true;
+    source->if_depth = vector_count(preprocessor->ifs);
+    source->guard_state = PREPROCESSOR_GUARD_START;
+    vector_push(preprocessor->sources, &source);
+    return source;
+}
+
+static void preprocessor_pop_source(struct preprocessor *preprocessor)
+{
+    struct preprocessor_source *source = vector_back_ptr(preprocessor->sources);
+    if (vector_count(preprocessor->ifs) != source->if_depth)
+    {
+        compiler_error(source->compiler, "Unterminated conditional directive\n");
+    }
+
+    if (source->guard_state == PREPROCESSOR_GUARD_CLOSED)
+    {
+        // the whole file sits inside #ifndef guard ... #endif, including it again
+        // while the guard is defined produces nothing so we never have to reopen it
+        source->file->guard = source->guard;
+    }
+
+    if (source->record)
+    {
+        compiler_cache_set_header(source->file->filename, source->record);
+        vector_free(source->record);
+    }
+
+    vector_pop(preprocessor->sources);
+    if (source->compiler != preprocessor->compiler && source->lex_process)
+    {
+        buffer_free(source->compiler->cfile.buffer);
+        lex_process_free(source->lex_process);
+    }
+    free(source);
+}
+
+/**
+ * Starts lexing the text of a branch the compile that cached the file skipped,
+ * from where the branch is in the file
+ */
+static void preprocessor_source_lex_skipped(struct preprocessor_source *source, struct token *token)
+{
+    struct buffer *buffer = buffer_create();
+    buffer_write_bytes(buffer, token->sval, token->length);
+    source->compiler->cfile.buffer = buffer;
+    source->compiler->pos = token->pos;
+    source->skipped = lex_process_create(source->compiler, &compiler_lex_functions, NULL);
+    source->skipped->pos = token->pos;
+}
+
+static void preprocessor_source_end_skipped(struct preprocessor_source *source)
+{
+    lex_process_free(source->skipped);
+    buffer_free(source->compiler->cfile.buffer);
+    source->compiler->cfile.buffer = NULL;
+    source->skipped = NULL;
+}
+
+/**
+ * Jumps straight to the #elif, #else or #endif that ends the inactive branch the
+ * source is at. A file that is cached keeps the text it jumped over, a file read
+ * from the cache drops the text the compile that cached it jumped over. Tokens that
+ * are left are dropped one at a time by the caller
+ */
+static void preprocessor_source_skip(struct preprocessor_source *source)
+{
+    struct lex_process *lex_process = source->skipped ? source->skipped : (source->tokens ? NULL : source->lex_process);
+    if (lex_process)
+    {
+        struct buffer *buffer = lex_process->function->source ? lex_process->function->source(lex_process) : NULL;
+        size_t start = buffer ? buffer->rindex : 0;
+        struct pos pos = lex_process->pos;
+        if (lex_skip_inactive_region(lex_process) && source->record && buffer->rindex > start)
+        {
+            size_t length = buffer->rindex - start;
+            char *text = malloc(length);
+            memcpy(text, buffer->data + start, length);
+            struct token skipped = {.type = TOKEN_TYPE_SKIPPED, .sval = text, .length = length, .pos = pos};
+            vector_push(source->record, &skipped);
+        }
+    }
+    else if (source->tokens)
+    {
+        struct token *next = vector_peek_at(source->tokens, source->token_index);
+        if (next && next->type == TOKEN_TYPE_SKIPPED)
+        {
+            source->token_index++;
+        }
+    }
+}
+
+/**
+ * Next token of the file, NULL at its end. Files read from the cache or lexed on
+ * another thread move the position along so errors still point at the right line
+ */
+static struct token *preprocessor_source_next(struct preprocessor_source *source)
+{
+    struct token *token = NULL;
+    if (source->pipeline)
+    {
+        token = lex_pipeline_next(source->pipeline);
+    }
+    else if (!source->tokens)
+    {
+        token = lex_next_token(source->lex_process);
+        if (token && source->record)
+        {
+            vector_push(source->record, token);
+        }
+        return token;
+    }
+    else
+    {
+        while (source->skipped)
+        {
+            token = lex_next_token(source->skipped);
+            if (token)
+            {
+                return token;
+            }
+            preprocessor_source_end_skipped(source);
+        }
+
+        token = vector_peek_at(source->tokens, source->token_index);
+        source->token_index++;
+        if (token && token->type == TOKEN_TYPE_SKIPPED)
+        {
+            // branches that are skipped again never get here, this one is taken now
+            preprocessor_source_lex_skipped(source, token);
+            return preprocessor_source_next(source);
+        }
+    }
+
+    if (token)
+    {
+        source->compiler->pos = token->pos;
+    }
+    return token;
+}
+
+/**
+ * Any token or directive after the guard's #endif, or before its #ifndef,
+ * means the file is not fully guarded
+ */
+static void preprocessor_guard_invalidate(struct preprocessor_source *source)
+{
+    if (source->guard_state != PREPROCESSOR_GUARD_INSIDE)
+    {
+        source->guard_state = PREPROCESSOR_GUARD_NONE;
+    }
+}
+
+/**
+ * Reads the rest of the directive line into a vector of tokens, comments are dropped
+ * and escaped newlines join the next line
+ */
+static struct vector *preprocessor_read_line(struct preprocessor_source *source)
+{
+    struct vector *line = vector_create(sizeof(struct token));
+    struct token *token = preprocessor_source_next(source);
+    while (token && token->type != TOKEN_TYPE_NEWLINE)
+    {
+        if (token->type == TOKEN_TYPE_COMMENT)
+        {
+            token = preprocessor_source_next(source);
+            continue;
+        }
+
+        if (token_is_symbol(token, '\\'))
+        {
+            token = preprocessor_source_next(source);
+            if (token && token->type == TOKEN_TYPE_NEWLINE)
+            {
+                token = preprocessor_source_next(source);
+                continue;
+            }
+            compiler_error(source->compiler, "Expecting a new line after '\\'\n");
+        }
+
+        vector_push(line, token);
+        token = preprocessor_source_next(source);
+    }
+
+    source->line_start = true;
+    return line;
+}
+
+static struct token *preprocessor_line_token(struct vector *line, int index)
+{
+    return vector_peek_at(line, index);
+}
+
+static const char *preprocessor_line_expect_name(struct preprocessor_source *source, struct vector *line, int index)
+{
+    const char *name = preprocessor_token_name(preprocessor_line_token(line, index));
+    if (!name)
+    {
+        compiler_error(source->compiler, "Expecting a macro name\n");
+    }
+    return name;
+}
+
+static void preprocessor_handle_definition(struct preprocessor *preprocessor, struct preprocessor_source *source, struct vector *line)
+{
+    struct preprocessor_definition *definition = calloc(1, sizeof(struct preprocessor_definition));
+    definition->type = PREPROCESSOR_DEFINITION_STANDARD;
+    definition->name = preprocessor_line_expect_name(source, line, 1);
+    definition->value = vector_create(sizeof(struct token));
+
+    int index = 2;
+    struct token *name_token = preprocessor_line_token(line, 1);
+    struct token *token = preprocessor_line_token(line, index);
+    // #define ABC(a, b) is a macro function, #define ABC (a, b) is not
+    if (token_is_operator(token, "(") && !name_token->whitespace)
+    {
+        definition->type = PREPROCESSOR_DEFINITION_MACRO_FUNCTION;
+        definition->arguments = vector_create(sizeof(const char *));
+        index++;
+        token = preprocessor_line_token(line, index);
+        while (token && !token_is_symbol(token, ')'))
+        {
+            if (token_is_op(token, OP_ELLIPSIS))
+            {
+                definition->variadic = true;
+                index++;
+            }
+            else
+            {
+                const char *argument = preprocessor_line_expect_name(source, line, index);
+                vector_push(definition->arguments, &argument);
+                index++;
+            }
+
+            token = preprocessor_line_token(line, index);
+            if (token_is_operator(token, ","))
+            {
+                index++;
+                token = preprocessor_line_token(line, index);
+            }
+        }
+
+        if (!token)
+        {
+            compiler_error(source->compiler, "Unterminated macro argument list for %s\n", definition->name);
+        }
+        index++;
+    }
+
+    for (token = preprocessor_line_token(line, index); token; token = preprocessor_line_token(line, ++index))
+    {
+        vector_push(definition->value, token);
+    }
+
+    hashmap_set(preprocessor->definitions, definition->name, definition);
+}
+
+static const char *preprocessor_directory_of(const char *filename, char *out, size_t size)
+{
+    const char *slash = filename ? strrchr(filename, '/') : NULL;
+    if (!slash)
+    {
+        snprintf(out, size, ".");
+        return out;
+    }
+
+    snprintf(out, size, "%.*s", (int)(slash - filename), filename);
+    return out;
+}
+
+/**
+ * Absolute path of the file if it exists, a copy of the path tried is added to
+ * candidates unless they are NULL
+ */
+static const char *preprocessor_try_path(const char *directory, const char *name, struct vector *candidates)
+{
+    char candidate[PATH_MAX];
+    if (directory)
+    {
+        snprintf(candidate, sizeof(candidate), "%s/%s", directory, name);
+    }
+    else
+    {
+        snprintf(candidate, sizeof(candidate), "%s", name);
+    }
+
+    if (candidates)
+    {
+        const char *tried = strdup(candidate);
+        vector_push(candidates, &tried);
+    }
+    return realpath(candidate, NULL);
+}
+
+/**
+ * Resolves an include to an absolute path, results are cached for the whole
+ * translation unit so a header included hundreds of times is only looked up once.
+ * With the compiler cache on, lookups are also kept across translation units
+ * as long as none of the paths tried appeared or disappeared
+ */
+static const char *preprocessor_resolve_include(struct preprocessor *preprocessor, struct preprocessor_source *source, const char *name, bool system)
+{
+    char directory[PATH_MAX];
+    char key[PATH_MAX * 2];
+    if (system)
+    {
+        snprintf(key, sizeof(key), "<%s>", name);
+    }
+    else
+    {
+        snprintf(key, sizeof(key), "%s\"%s\"", preprocessor_directory_of(source->file->filename, directory, sizeof(directory)), name);
+    }
+
+    void *cached = NULL;
+    if (hashmap_find(preprocessor->include_paths, key, &cached))
+    {
+        return cached;
+    }
+
+    // a directory relative to the working directory means something else in the next compile
+    const char *path = NULL;
+    bool shared = key[0] == '<' || key[0] == '/';
+    if (shared && compiler_cache_include(key, &path))
+    {
+        hashmap_set(preprocessor->include_paths, key, (void *)path);
+        return path;
+    }
+
+    struct vector *candidates = shared && compiler_cache ? vector_create(sizeof(const char *)) : NULL;
+    if (name[0] == '/')
+    {
+        path = preprocessor_try_path(NULL, name, candidates);
+    }
+    else
+    {
+        if (!system)
+        {
+            path = preprocessor_try_path(directory, name, candidates);
+        }
+
+        vector_set_peek_pointer(preprocessor->include_dirs, 0);
+        const char **dir = vector_peek(preprocessor->include_dirs);
+        while (!path && dir)
+        {
+            path = preprocessor_try_path(*dir, name, candidates);
+            dir = vector_peek(preprocessor->include_dirs);
+        }
+    }
+
+    if (candidates)
+    {
+        compiler_cache_set_include(key, path, candidates);
+        vector_free(candidates);
+    }
+
+    hashmap_set(preprocessor->include_paths, key, (void *)path);
+    return path;
+}
+
+static void preprocessor_handle_include(struct preprocessor *preprocessor, struct preprocessor_source *source, struct vector *line)
+{
+    struct token *file_token = preprocessor_line_token(line, 1);
+    struct vector *expanded = NULL;
+    if (file_token && file_token->type != TOKEN_TYPE_STRING)
+    {
+        // #include MACRO
+        expanded = preprocessor_expand_line(preprocessor, line, 1);
+        file_token = preprocessor_line_token(expanded, 0);
+    }
+
+    if (!file_token || file_token->type != TOKEN_TYPE_STRING)
+    {
+        compiler_error(source->compiler, "Expecting a file name after #include\n");
+    }
+
+    bool system = file_token->flags & TOKEN_FLAG_SYSTEM_INCLUDE;
+    const char *path = preprocessor_resolve_include(preprocessor, source, file_token->sval, system);
+    if (!path)
+    {
+        compiler_error(source->compiler, "Cannot find include file %s\n", file_token->sval);
+    }
+
+    struct preprocessor_included_file *file = hashmap_get(preprocessor->included_files, path);
+    if (file)
+    {
+        if (file->pragma_once || (file->guard && preprocessor_get_definition(preprocessor, file->guard)))
+        {
+            return;
+        }
+    }
+    else
+    {
+        file = calloc(1, sizeof(struct preprocessor_included_file));
+        file->filename = path;
+        hashmap_set(preprocessor->included_files, path, file);
+        vector_push(preprocessor->compiler->dependencies, &path);
+    }
+
+    if (vector_count(preprocessor->sources) >= PREPROCESSOR_MAX_INCLUDE_DEPTH)
+    {
+        compiler_error(source->compiler, "#include nested too deeply in %s\n", path);
+    }
+
+    struct lex_process *lex_process = NULL;
+    struct vector *tokens = compiler_cache_header(path);
+    struct compile_process *compiler = NULL;
+    if (tokens)
+    {
+        compiler = compile_process_create_for_tokens(path, preprocessor->compiler);
+    }
+    else
+    {
+        compiler = compile_process_create_for_include(path, preprocessor->compiler);
+        if (!compiler)
+        {
+            compiler_error(source->compiler, "Failed to open include file %s\n", path);
+        }
+
+        lex_process = lex_process_create(compiler, &compiler_lex_functions, NULL);
+    }
+    struct preprocessor_source *included = preprocessor_push_source(preprocessor, compiler, lex_process, tokens, file);
+    if (compiler_cache && !tokens)
+    {
+        // the file is read like any other, the branches this compile skips are
+        // kept as text for compiles that take them
+        included->record = vector_create(sizeof(struct token));
+    }
+    if (expanded)
+    {
+        vector_free(expanded);
+    }
+}
+
+static struct token *preprocessor_expression_peek(struct preprocessor_expression *expression)
+{
+    return preprocessor_line_token(expression->tokens, expression->index);
+}
+
+static struct token *preprocessor_expression_next(struct preprocessor_expression *expression)
+{
+    struct token *token = preprocessor_expression_peek(expression);
+    if (!token)
+    {
+        compiler_error(expression->source->compiler, "Unexpected end of #if expression\n");
+    }
+    expression->index++;
+    return token;
+}
+
+static void preprocessor_expression_expect_symbol(struct preprocessor_expression *expression, char c)
+{
+    if (!token_is_symbol(preprocessor_expression_next(expression), c))
+    {
+        compiler_error(expression->source->compiler, "Expecting '%c' in #if expression\n", c);
+    }
+}
+
+static long long preprocessor_evaluate_operand(struct preprocessor_expression *expression)
+{
+    struct token *token = preprocessor_expression_next(expression);
+    if (token->type == TOKEN_TYPE_NUMBER)
+    {
+        return token->llnum;
+    }
+
+    if (preprocessor_token_name(token))
+    {
+        // whatever identifiers survive macro expansion evaluate to zero
+        return 0;
+    }
+
+    if (token->type == TOKEN_TYPE_OPERATOR)
+    {
+        if (S_EQ(token->sval, "("))
+        {
+            long long value = preprocessor_evaluate(expression, 0);
+            preprocessor_expression_expect_symbol(expression, ')');
+            return value;
+        }
+        if (S_EQ(token->sval, "!"))
+        {
+            return !preprocessor_evaluate_unary(expression);
+        }
+        if (S_EQ(token->sval, "~"))
+        {
+            return ~preprocessor_evaluate_unary(expression);
+        }
+        if (S_EQ(token->sval, "-"))
+        {
+            return -preprocessor_evaluate_unary(expression);
+        }
+        if (S_EQ(token->sval, "+"))
+        {
+            return preprocessor_evaluate_unary(expression);
+        }
+    }
+
+    compiler_error(expression->source->compiler, "Unexpected token in #if expression\n");
+    return 0;
+}
+
+/**
+ * Brackets and unary operators nest by recursing, so they nest only so far
+ */
+static long long preprocessor_evaluate_unary(struct preprocessor_expression *expression)
+{
+    if (expression->depth == PREPROCESSOR_MAX_EXPRESSION_DEPTH)
+    {
+        compiler_error(expression->source->compiler, "#if expression nested too deeply\n");
+    }
+    expression->depth++;
+    long long value = preprocessor_evaluate_operand(expression);
+    expression->depth--;
+    return value;
+}
+
+// binary operator priorities in #if expressions, 0 for anything that is not one
+static const int preprocessor_priorities[OP_TOTAL] = {
+    [OP_QUESTION] = 1,
+    [OP_LOGICAL_OR] = 2,
+    [OP_LOGICAL_AND] = 3,
+    [OP_PIPE] = 4,
+    [OP_CARET] = 5,
+    [OP_AMPERSAND] = 6,
+    [OP_EQUAL] = 7,
+    [OP_NOT_EQUAL] = 7,
+    [OP_LESS] = 8,
+    [OP_GREATER] = 8,
+    [OP_LESS_EQUAL] = 8,
+    [OP_GREATER_EQUAL] = 8,
+    [OP_SHIFT_LEFT] = 9,
+    [OP_SHIFT_RIGHT] = 9,
+    [OP_PLUS] = 10,
+    [OP_MINUS] = 10,
+    [OP_STAR] = 11,
+    [OP_SLASH] = 11,
+    [OP_PERCENT] = 11};
+
+static int preprocessor_binary_priority(struct token *token)
+{
+    if (!token || token->type != TOKEN_TYPE_OPERATOR)
+    {
+        return 0;
+    }
+    return preprocessor_priorities[token->op];
+}
+
+static long long preprocessor_evaluate_binary(struct preprocessor_expression *expression, int op, long long left, long long right)
+{
+    if ((op == OP_SLASH || op == OP_PERCENT) && right == 0)
+    {
+        compiler_error(expression->source->compiler, "Division by zero in #if expression\n");
+    }
+
+    switch (op)
+    {
+    case OP_LOGICAL_OR:
+        return left || right;
+    case OP_LOGICAL_AND:
+        return left && right;
+    case OP_PIPE:
+        return left | right;
+    case OP_CARET:
+        return left ^ right;
+    case OP_AMPERSAND:
+        return left & right;
+    case OP_EQUAL:
+        return left == right;
+    case OP_NOT_EQUAL:
+        return left != right;
+    case OP_LESS:
+        return left < right;
+    case OP_GREATER:
+        return left > right;
+    case OP_LESS_EQUAL:
+        return left <= right;
+    case OP_GREATER_EQUAL:
+        return left >= right;
+    case OP_SHIFT_LEFT:
+        return left << right;
+    case OP_SHIFT_RIGHT:
+        return left >> right;
+    case OP_PLUS:
+        return left + right;
+    case OP_MINUS:
+        return left - right;
+    case OP_STAR:
+        return left * right;
+    case OP_SLASH:
+        return left / right;
+    case OP_PERCENT:
+        return left % right;
+    }
+    return 0;
+}
+
+/**
+ * Precedence climbing over the tokens of a #if line
+ */
+static long long preprocessor_evaluate(struct preprocessor_expression *expression, int min_priority)
+{
+    long long left = preprocessor_evaluate_unary(expression);
+    struct token *op = preprocessor_expression_peek(expression);
+    int priority = preprocessor_binary_priority(op);
+    while (priority >= min_priority && priority > 0)
+    {
+        expression->index++;
+        if (op->op == OP_QUESTION)
+        {
+            long long true_value = preprocessor_evaluate(expression, 0);
+            preprocessor_expression_expect_symbol(expression, ':');
+            long long false_value = preprocessor_evaluate(expression, priority);
+            left = left ? true_value : false_value;
+        }
+        else
+        {
+            long long right = preprocessor_evaluate(expression, priority + 1);
+            left = preprocessor_evaluate_binary(expression, op->op, left, right);
+        }
+
+        op = preprocessor_expression_peek(expression);
+        priority = preprocessor_binary_priority(op);
+    }
+    return left;
+}
+
+/**
+ * Replaces defined X and defined(X) on a #if line with 0 or 1, this has to happen
+ * before macro expansion so the operand is not expanded
+ */
+static struct vector *preprocessor_replace_defined(struct preprocessor *preprocessor, struct preprocessor_source *source, struct vector *line)
+{
+    struct vector *result = vector_create(sizeof(struct token));
+    for (int i = 1; i < vector_count(line); i++)
+    {
+        struct token *token = vector_at(line, i);
+        if (!token_is_identifier(token, "defined"))
+        {
+            vector_push(result, token);
+            continue;
+        }
+
+        bool parentheses = token_is_operator(preprocessor_line_token(line, i + 1), "(");
+        int name_index = parentheses ? i + 2 : i + 1;
+        const char *name = preprocessor_token_name(preprocessor_line_token(line, name_index));
+        if (!name || (parentheses && !token_is_symbol(preprocessor_line_token(line, name_index + 1), ')')))
+        {
+            compiler_error(source->compiler, "Expecting a macro name after defined\n");
+        }
+
+        struct token value = *token;
+        value.type = TOKEN_TYPE_NUMBER;
+        value.llnum = preprocessor_get_definition(preprocessor, name) != NULL;
+        vector_push(result, &value);
+        i = parentheses ? name_index + 1 : name_index;
+    }
+    return result;
+}
+
+static bool preprocessor_evaluate_condition(struct preprocessor *preprocessor, struct preprocessor_source *source, struct vector *line)
+{
+    struct vector *defined_line = preprocessor_replace_defined(preprocessor, source, line);
+    struct vector *expanded_line = preprocessor_expand_line(preprocessor, defined_line, 0);
+    struct preprocessor_expression expression = {
+        .preprocessor = preprocessor,
+        .source = source,
+        .tokens = expanded_line,
+        .index = 0};
+    long long value = preprocessor_evaluate(&expression, 0);
+    if (preprocessor_expression_peek(&expression))
+    {
+        compiler_error(source->compiler, "Unexpected token after #if expression\n");
+    }
+    vector_free(defined_line);
+    vector_free(expanded_line);
+    return value != 0;
+}
+
+static void preprocessor_push_if(struct preprocessor *preprocessor, bool condition)
+{
+    bool parent_active = preprocessor_is_active(preprocessor);
+    struct preprocessor_if new_if = {
+        .active = parent_active && condition,
+        // no branch of a conditional nested in an inactive region can ever be taken
+        .taken = !parent_active || condition,
+        .seen_else = false};
+    vector_push(preprocessor->ifs, &new_if);
+}
+
+static struct preprocessor_if *preprocessor_current_if(struct preprocessor *preprocessor, struct preprocessor_source *source, const char *directive)
+{
+    if (vector_count(preprocessor->ifs) <= source->if_depth)
+    {
+        compiler_error(source->compiler, "#%s without #if\n", directive);
+    }
+    return vector_back(preprocessor->ifs);
+}
+
+static bool preprocessor_is_guard_if(struct preprocessor *preprocessor, struct preprocessor_source *source)
+{
+    return source->guard_state == PREPROCESSOR_GUARD_INSIDE && vector_count(preprocessor->ifs) - 1 == source->guard_if_index;
+}
+
+static void preprocessor_handle_conditional(struct preprocessor *preprocessor, struct preprocessor_source *source, const char *directive, struct vector *line)
+{
+    if (S_EQ(directive, "ifdef") || S_EQ(directive, "ifndef"))
+    {
+        const char *name = preprocessor_line_expect_name(source, line, 1);
+        bool defined = preprocessor_get_definition(preprocessor, name) != NULL;
+        if (source->guard_state == PREPROCESSOR_GUARD_START && S_EQ(directive, "ifndef"))
+        {
+            source->guard_state = PREPROCESSOR_GUARD_INSIDE;
+            source->guard = name;
+            source->guard_if_index = vector_count(preprocessor->ifs);
+        }
+        preprocessor_push_if(preprocessor, S_EQ(directive, "ifdef") ? defined : !defined);
+        return;
+    }
+
+    if (S_EQ(directive, "if"))
+    {
+        bool condition = preprocessor_is_active(preprocessor) && preprocessor_evaluate_condition(preprocessor, source, line);
+        preprocessor_push_if(preprocessor, condition);
+        return;
+    }
+
+    struct preprocessor_if *current_if = preprocessor_current_if(preprocessor, source, directive);
+    if (S_EQ(directive, "endif"))
+    {
+        if (preprocessor_is_guard_if(preprocessor, source))
+        {
+            source->guard_state = PREPROCESSOR_GUARD_CLOSED;
+        }
+        vector_pop(preprocessor->ifs);
+        return;
+    }
+
+    if (current_if->seen_else)
+    {
+        compiler_error(source->compiler, "#%s after #else\n", directive);
+    }
+
+    if (preprocessor_is_guard_if(preprocessor, source))
+    {
+        // an include guard has no other branches
+        source->guard_state = PREPROCESSOR_GUARD_NONE;
+    }
+
+    if (S_EQ(directive, "elif"))
+    {
+        current_if->active = !current_if->taken && preprocessor_evaluate_condition(preprocessor, source, line);
+        current_if->taken |= current_if->active;
+        return;
+    }
+
+    // #else
+    current_if->active = !current_if->taken;
+    current_if->taken = true;
+    current_if->seen_else = true;
+}
+
+static bool preprocessor_is_conditional(const char *directive)
+{
+    return S_EQ(directive, "if") || S_EQ(directive, "ifdef") || S_EQ(directive, "ifndef") ||
+           S_EQ(directive, "elif") || S_EQ(directive, "else") || S_EQ(directive, "endif");
+}
+
+static void preprocessor_handle_message(struct preprocessor_source *source, const char *directive, struct vector *line)
+{
+    struct buffer *buffer = buffer_create();
+    for (int i = 1; i < vector_count(line); i++)
+    {
+        struct token *token = vector_at(line, i);
+        token_write_spelling(buffer, token);
+        if (token->whitespace)
+        {
+            buffer_write(buffer, ' ');
+        }
+    }
+    buffer_write(buffer, 0x00);
+
+    if (S_EQ(directive, "error"))
+    {
+        compiler_error(source->compiler, "#error %s\n", (char *)buffer_ptr(buffer));
+    }
+    compile_warning(source->compiler, "#warning %s\n", (char *)buffer_ptr(buffer));
+    buffer_free(buffer);
+}
+
+static void preprocessor_handle_directive(struct preprocessor *preprocessor, struct preprocessor_source *source)
+{
+    struct vector *line = preprocessor_read_line(source);
+    const char *directive = preprocessor_token_name(preprocessor_line_token(line, 0));
+    if (vector_empty(line))
+    {
+        // the null directive
+        vector_free(line);
+        return;
+    }
+
+    if (!directive)
+    {
+        if (preprocessor_is_active(preprocessor))
+        {
+            compiler_error(source->compiler, "Invalid preprocessing directive\n");
+        }
+        vector_free(line);
+        return;
+    }
+
+    if (preprocessor_is_conditional(directive))
+    {
+        if (source->guard_state != PREPROCESSOR_GUARD_START || !S_EQ(directive, "ifndef"))
+        {
+            preprocessor_guard_invalidate(source);
+        }
+        preprocessor_handle_conditional(preprocessor, source, directive, line);
+        vector_free(line);
+        if (source->pipeline && !S_EQ(directive, "endif"))
+        {
+            // the lexer thread waits to hear if it skips the branch, it has the input
+            lex_pipeline_branch(source->pipeline, !preprocessor_is_active(preprocessor));
+            return;
+        }
+        if (!preprocessor_is_active(preprocessor))
+        {
+            // jump straight to the #elif, #else or #endif that ends this branch,
+            // if the input can't be scanned the tokens are lexed and dropped instead
+            preprocessor_source_skip(source);
+        }
+        return;
+    }
+
+    preprocessor_guard_invalidate(source);
+    if (!preprocessor_is_active(preprocessor))
+    {
+        vector_free(line);
+        return;
+    }
+
+    if (S_EQ(directive, "define"))
+    {
+        preprocessor_handle_definition(preprocessor, source, line);
+    }
+    else if (S_EQ(directive, "undef"))
+    {
+        hashmap_set(preprocessor->definitions, preprocessor_line_expect_name(source, line, 1), NULL);
+    }
+    else if (S_EQ(directive, "include"))
+    {
+        preprocessor_handle_include(preprocessor, source, line);
+    }
+    else if (S_EQ(directive, "pragma"))
+    {
+        if (token_is_identifier(preprocessor_line_token(line, 1), "once"))
+        {
+            source->file->pragma_once = true;
+        }
+    }
+    else if (S_EQ(directive, "error") || S_EQ(directive, "warning"))
+    {
+        preprocessor_handle_message(source, directive, line);
+    }
+    else if (!S_EQ(directive, "line"))
+    {
+        compiler_error(source->compiler, "Invalid preprocessing directive #%s\n", directive);
+    }
+
+    vector_free(line);
+}
+
+/**
+ * Returns true if the token is part of the output, directives, comments, newlines
+ * and tokens of inactive branches are consumed here
+ */
+static bool preprocessor_handle_token(struct preprocessor *preprocessor, struct preprocessor_source *source, struct token *token)
+{
+    if (token->type == TOKEN_TYPE_NEWLINE)
+    {
+        source->line_start = true;
+        return false;
+    }
+
+    if (token->type == TOKEN_TYPE_COMMENT)
+    {
+        return false;
+    }
+
+    if (source->line_start && token_is_symbol(token, '#'))
+    {
+        preprocessor_handle_directive(preprocessor, source);
+        return false;
+    }
+
+    source->line_start = false;
+    preprocessor_guard_invalidate(source);
+    return preprocessor_is_active(preprocessor);
+}
+
+/**
+ * Reads the next token of the translation unit from the files being lexed
+ */
+static bool preprocessor_next_source_token(struct preprocessor *preprocessor, struct token *token_out)
+{
+    while (!vector_empty(preprocessor->sources))
+    {
+        struct preprocessor_source *source = vector_back_ptr(preprocessor->sources);
+        struct token *token = preprocessor_source_next(source);
+        if (!token)
+        {
+            preprocessor_pop_source(preprocessor);
+            continue;
+        }
+
+        if (preprocessor_handle_token(preprocessor, source, token))
+        {
+            *token_out = *token;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool preprocessor_hideset_contains(struct preprocessor_hideset *hideset, const char *name)
+{
+    for (; hideset; hideset = hideset->next)
+    {
+        if (S_EQ(hideset->name, name))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static struct preprocessor_hideset *preprocessor_hideset_add(struct preprocessor *preprocessor, struct preprocessor_hideset *hideset, const char *name)
+{
+    if (preprocessor_hideset_contains(hideset, name))
+    {
+        return hideset;
+    }
+
+    // every expanded token has a hideset, allocating one per token adds up over a long file
+    char key[64];
+    snprintf(key, sizeof(key), "%p %p", (void *)name, (void *)hideset);
+    struct preprocessor_hideset *added = hashmap_get(preprocessor->hidesets, key);
+    if (!added)
+    {
+        added = malloc(sizeof(struct preprocessor_hideset));
+        added->name = name;
+        added->next = hideset;
+        hashmap_set(preprocessor->hidesets, key, added);
+    }
+    return added;
+}
+
+static struct preprocessor_hideset *preprocessor_hideset_union(struct preprocessor *preprocessor, struct preprocessor_hideset *hideset, struct preprocessor_hideset *other)
+{
+    for (; other; other = other->next)
+    {
+        hideset = preprocessor_hideset_add(preprocessor, hideset, other->name);
+    }
+    return hideset;
+}
+
+static struct preprocessor_hideset *preprocessor_hideset_intersection(struct preprocessor *preprocessor, struct preprocessor_hideset *hideset, struct preprocessor_hideset *other)
+{
+    struct preprocessor_hideset *result = NULL;
+    for (; hideset; hideset = hideset->next)
+    {
+        if (preprocessor_hideset_contains(other, hideset->name))
+        {
+            result = preprocessor_hideset_add(preprocessor, result, hideset->name);
+        }
+    }
+    return result;
+}
+
+static void preprocessor_push_chunk(struct preprocessor_expansion *expansion, struct vector *tokens)
+{
+    if (vector_empty(tokens))
+    {
+        vector_free(tokens);
+        return;
+    }
+
+    struct preprocessor_token_chunk *chunk = calloc(1, sizeof(struct preprocessor_token_chunk));
+    chunk->tokens = tokens;
+    chunk->next = expansion->chunks;
+    expansion->chunks = chunk;
+}
+
+static void preprocessor_push_back(struct preprocessor_expansion *expansion, struct preprocessor_token *token)
+{
+    struct vector *tokens = vector_create(sizeof(struct preprocessor_token));
+    vector_push(tokens, token);
+    preprocessor_push_chunk(expansion, tokens);
+}
+
+static bool preprocessor_expansion_next(struct preprocessor *preprocessor, struct preprocessor_expansion *expansion, struct preprocessor_token *token_out)
+{
+    while (expansion->chunks)
+    {
+        struct preprocessor_token_chunk *chunk = expansion->chunks;
+        if (chunk->index < vector_count(chunk->tokens))
+        {
+            *token_out = *(struct preprocessor_token *)vector_at(chunk->tokens, chunk->index);
+            chunk->index++;
+            return true;
+        }
+
+        expansion->chunks = chunk->next;
+        vector_free(chunk->tokens);
+        free(chunk);
+    }
+
+    if (!expansion->read_source)
+    {
+        return false;
+    }
+
+    token_out->hideset = NULL;
+    return preprocessor_next_source_token(preprocessor, &token_out->token);
+}
+
+static void preprocessor_expand(struct preprocessor *preprocessor, struct preprocessor_expansion *expansion);
+
+static void preprocessor_bracket_error(struct preprocessor *preprocessor, struct token *token, const char *msg, struct token *other)
+{
+    preprocessor->compiler->pos = token->pos;
+    compiler_error(preprocessor->compiler, msg, other->pos.line, other->pos.col, other->pos.filename);
+}
+
+/**
+ * Records the bracket matches of the token that was just added to the translation unit
+ */
+static void preprocessor_track_bracket(struct preprocessor *preprocessor, struct token *token)
+{
+    struct compile_process *compiler = preprocessor->compiler;
+    int index = vector_count(compiler->token_vec) - 1;
+    int no_match = -1;
+    vector_push(compiler->token_bracket_matches, &no_match);
+    if (token_closing_bracket(token))
+    {
+        vector_push(preprocessor->open_brackets, &index);
+        return;
+    }
+
+    if (!token_is_closing_bracket(token))
+    {
+        return;
+    }
+
+    int *open_index = vector_back_or_null(preprocessor->open_brackets);
+    if (!open_index)
+    {
+        compiler_error(compiler, "Unexpected '%c' with no opening bracket on line %i, col %i in file %s\n", token->cval, token->pos.line, token->pos.col, token->pos.filename);
+    }
+
+    struct token *open_token = vector_at(compiler->token_vec, *open_index);
+    if (token_closing_bracket(open_token) != token->cval)
+    {
+        preprocessor_bracket_error(preprocessor, token, "Mismatched bracket, this closes the bracket opened on line %i, col %i in file %s\n", open_token);
+    }
+
+    *(int *)vector_at(compiler->token_bracket_matches, *open_index) = index;
+    vector_pop(preprocessor->open_brackets);
+}
+
+/**
+ * Whether the token just added to the translation unit ends a top level declaration,
+ * which is a ';' outside of any brackets or the '}' closing a function body
+ */
+static bool preprocessor_ends_declaration(struct preprocessor *preprocessor, struct token *token)
+{
+    struct vector *tokens = preprocessor->compiler->token_vec;
+    size_t depth = vector_count(preprocessor->open_brackets);
+    if (depth == 0 && token_is_op(token, OP_ASSIGN))
+    {
+        preprocessor->declaration_initialized = true;
+    }
+    else if (depth == 1 && token_is_op(token, SYM_LBRACE))
+    {
+        // int f(void) { starts a body, struct s { and int a[] = { don't
+        struct token *previous = vector_count(tokens) > 1 ? vector_at(tokens, vector_count(tokens) - 2) : NULL;
+        preprocessor->declaration_function = !preprocessor->declaration_initialized && token_is_op(previous, SYM_RPAREN);
+    }
+
+    bool ends = depth == 0 && (token_is_op(token, SYM_SEMICOLON) || (token_is_op(token, SYM_RBRACE) && preprocessor->declaration_function));
+    if (ends)
+    {
+        preprocessor->declaration_initialized = false;
+        preprocessor->declaration_function = false;
+    }
+    return ends;
+}
+
+static void preprocessor_output(struct preprocessor *preprocessor, struct preprocessor_expansion *expansion, struct preprocessor_token *token)
+{
+    if (expansion->read_source)
+    {
+        // the translation unit's tokens don't need hidesets anymore
+        vector_push(expansion->output, &token->token);
+        preprocessor_track_bracket(preprocessor, &token->token);
+        expansion->stop = preprocessor->split && preprocessor_ends_declaration(preprocessor, &token->token);
+        return;
+    }
+    vector_push(expansion->output, token);
+}
+
+/**
+ * Fully expands the given tokens on their own, returns a vector of struct preprocessor_token
+ */
+static struct vector *preprocessor_expand_tokens(struct preprocessor *preprocessor, struct vector *tokens)
+{
+    // an argument holding a macro call expands that call's arguments in here again
+    if (preprocessor->argument_depth == PREPROCESSOR_MAX_ARGUMENT_DEPTH)
+    {
+        compiler_error(preprocessor->compiler, "Macro calls nested too deeply in macro arguments\n");
+    }
+
+    struct vector *output = vector_create(sizeof(struct preprocessor_token));
+    struct preprocessor_expansion expansion = {
+        .chunks = NULL,
+        .read_source = false,
+        .output = output};
+    preprocessor->argument_depth++;
+    preprocessor_push_chunk(&expansion, vector_clone(tokens));
+    preprocessor_expand(preprocessor, &expansion);
+    preprocessor->argument_depth--;
+    return output;
+}
+
+static struct vector *preprocessor_expand_line(struct preprocessor *preprocessor, struct vector *line, int start)
+{
+    struct vector *tokens = vector_create(sizeof(struct preprocessor_token));
+    for (int i = start; i < vector_count(line); i++)
+    {
+        struct preprocessor_token token = {.token = *(struct token *)vector_at(line, i), .hideset = NULL};
+        vector_push(tokens, &token);
+    }
+
+    struct vector *expanded = preprocessor_expand_tokens(preprocessor, tokens);
+    vector_free(tokens);
+
+    struct vector *result = vector_create(sizeof(struct token));
+    for (int i = 0; i < vector_count(expanded); i++)
+    {
+        struct preprocessor_token *token = vector_at(expanded, i);
+        vector_push(result, &token->token);
+    }
+    vector_free(expanded);
+    return result;
+}
+
+static int preprocessor_argument_index(struct preprocessor_definition *definition, struct token *token)
+{
+    if (definition->type != PREPROCESSOR_DEFINITION_MACRO_FUNCTION || !preprocessor_token_name(token))
+    {
+        return -1;
+    }
+
+    int total = vector_count(definition->arguments);
+    for (int i = 0; i < total; i++)
+    {
+        if (S_EQ(*(const char **)vector_at(definition->arguments, i), token->sval))
+        {
+            return i;
+        }
+    }
+
+    if (definition->variadic && S_EQ(token->sval, "__VA_ARGS__"))
+    {
+        return total;
+    }
+    return -1;
+}
+
+/**
+ * Reads the arguments of a macro function call, the opening parenthesis has been read.
+ * Returns a vector of struct vector* each holding struct preprocessor_token
+ */
+static struct vector *preprocessor_read_arguments(struct preprocessor *preprocessor, struct preprocessor_expansion *expansion, struct preprocessor_definition *definition, struct preprocessor_token *macro_token, struct preprocessor_token *rparen)
+{
+    struct vector *arguments = vector_create(sizeof(struct vector *));
+    struct vector *argument = vector_create(sizeof(struct preprocessor_token));
+    vector_push(arguments, &argument);
+
+    int named_total = vector_count(definition->arguments);
+    int depth = 0;
+    struct preprocessor_token token;
+    while (true)
+    {
+        if (!preprocessor_expansion_next(preprocessor, expansion, &token))
+        {
+            compiler_error(preprocessor->compiler, "Unterminated call to macro %s on line %i\n", definition->name, macro_token->token.pos.line);
+        }
+
+        if (token_is_symbol(&token.token, ')') && depth == 0)
+        {
+            *rparen = token;
+            break;
+        }
+
+        if (token_is_operator(&token.token, "("))
+        {
+            depth++;
+        }
+        else if (token_is_symbol(&token.token, ')'))
+        {
+            depth--;
+        }
+        // the variadic argument swallows the remaining commas
+        else if (token_is_operator(&token.token, ",") && depth == 0 &&
+                 !(definition->variadic && vector_count(arguments) > named_total))
+        {
+            argument = vector_create(sizeof(struct preprocessor_token));
+            vector_push(arguments, &argument);
+            continue;
+        }
+
+        vector_push(argument, &token);
+    }
+
+    int total = vector_count(arguments);
+    bool single_empty = total == 1 && vector_empty(argument);
+    if (definition->variadic && total == named_total)
+    {
+        // F(a) for F(a, ...) leaves __VA_ARGS__ empty
+        argument = vector_create(sizeof(struct preprocessor_token));
+        vector_push(arguments, &argument);
+        total++;
+    }
+
+    int expected = named_total + (definition->variadic ? 1 : 0);
+    if (total != expected && !(expected == 0 && single_empty))
+    {
+        compiler_error(preprocessor->compiler, "Macro %s expects %i arguments but %i were given on line %i\n", definition->name, expected, total, macro_token->token.pos.line);
+    }
+    return arguments;
+}
+
+static struct vector *preprocessor_argument(struct vector *arguments, int index)
+{
+    return *(struct vector **)vector_at(arguments, index);
+}
+
+static struct preprocessor_token preprocessor_stringify(struct vector *argument, struct preprocessor_token *hash)
+{
+    struct buffer *buffer = buffer_create();
+    int total = vector_count(argument);
+    for (int i = 0; i < total; i++)
+    {
+        struct preprocessor_token *token = vector_at(argument, i);
+        token_write_spelling(buffer, &token->token);
+        if (token->token.whitespace && i != total - 1)
+        {
+            buffer_write(buffer, ' ');
+        }
+    }
+    buffer_write(buffer, 0x00);
+
+    struct preprocessor_token result = *hash;
+    result.token.type = TOKEN_TYPE_STRING;
+    result.token.flags = 0;
+    result.token.sval = buffer_ptr(buffer);
+    result.token.length = buffer->len - 1;
+    return result;
+}
+
+/**
+ * Implements ##, the last token written so far is joined with the first token
+ * of the right operand and the result lexed again
+ */
+static void preprocessor_paste(struct preprocessor *preprocessor, struct vector *result, struct vector *right)
+{
+    struct preprocessor_token *left = vector_back(result);
+    struct preprocessor_token *first = vector_at(right, 0);
+    struct buffer *buffer = buffer_create();
+    token_write_spelling(buffer, &left->token);
+    token_write_spelling(buffer, &first->token);
+    buffer_write(buffer, 0x00);
+
+    struct vector *tokens = tokens_build_for_string(preprocessor->compiler, buffer_ptr(buffer));
+    struct token *pasted = NULL;
+    for (int i = 0; i < vector_count(tokens); i++)
+    {
+        struct token *token = vector_at(tokens, i);
+        if (token_is_nl_or_comment(token))
+        {
+            continue;
+        }
+
+        if (pasted)
+        {
+            compiler_error(preprocessor->compiler, "Pasting \"%s\" does not give a valid token\n", (char *)buffer_ptr(buffer));
+        }
+        pasted = token;
+    }
+
+    if (pasted)
+    {
+        pasted->pos = left->token.pos;
+        pasted->whitespace = first->token.whitespace;
+        left->token = *pasted;
+    }
+    else
+    {
+        vector_pop(result);
+    }
+
+    for (int i = 1; i < vector_count(right); i++)
+    {
+        vector_push(result, vector_at(right, i));
+    }
+    vector_free(tokens);
+}
+
+/**
+ * Appends the tokens of an argument, the last of them is followed by whitespace when
+ * the parameter it replaces was
+ */
+static void preprocessor_push_argument(struct vector *out, struct vector *argument, bool whitespace)
+{
+    for (int i = 0; i < vector_count(argument); i++)
+    {
+        vector_push(out, vector_at(argument, i));
+    }
+
+    if (!vector_empty(argument))
+    {
+        struct preprocessor_token *last = vector_back(out);
+        last->token.whitespace = whitespace;
+    }
+}
+
+static bool preprocessor_is_paste(struct vector *value, int index)
+{
+    return token_is_op(preprocessor_line_token(value, index), OP_HASH_HASH);
+}
+
+/**
+ * Substitutes the arguments into the body of the definition and handles # and ##,
+ * every resulting token has the given hideset added. The last one is followed by
+ * whitespace when the invocation was
+ */
+static struct vector *preprocessor_substitute(struct preprocessor *preprocessor, struct preprocessor_definition *definition, struct vector *arguments, struct preprocessor_hideset *hideset, struct preprocessor_token *macro_token, bool whitespace)
+{
+    struct vector *result = vector_create(sizeof(struct preprocessor_token));
+    int total_arguments = arguments ? vector_count(arguments) : 0;
+    struct vector **expanded = calloc(total_arguments + 1, sizeof(struct vector *));
+
+    // where the left operand of a ## would start, nothing to paste if the operand is empty
+    int operand_start = 0;
+    int total = vector_count(definition->value);
+    for (int i = 0; i < total; i++)
+    {
+        struct token *token = vector_at(definition->value, i);
+        struct preprocessor_token body_token = {.token = *token, .hideset = NULL};
+        body_token.token.pos = macro_token->token.pos;
+
+        if (preprocessor_is_paste(definition->value, i))
+        {
+            if (i + 1 >= total)
+            {
+                compiler_error(preprocessor->compiler, "'##' cannot appear at the end of macro %s\n", definition->name);
+            }
+
+            struct token *right_token = vector_at(definition->value, i + 1);
+            int argument_index = preprocessor_argument_index(definition, right_token);
+            struct vector *right = vector_create(sizeof(struct preprocessor_token));
+            if (argument_index >= 0)
+            {
+                preprocessor_push_argument(right, preprocessor_argument(arguments, argument_index), right_token->whitespace);
+            }
+            else
+            {
+                struct preprocessor_token right_body_token = {.token = *right_token, .hideset = NULL};
+                right_body_token.token.pos = macro_token->token.pos;
+                vector_push(right, &right_body_token);
+            }
+
+            bool left_empty = vector_count(result) == operand_start;
+            struct preprocessor_token *left = vector_back_or_null(result);
+            bool comma_variadic = !left_empty && token_is_operator(&left->token, ",") && argument_index == vector_count(definition->arguments) && definition->variadic;
+            if (comma_variadic && vector_empty(right))
+            {
+                // , ## __VA_ARGS__ drops the comma when there are no variadic arguments
+                vector_pop(result);
+            }
+            else if (left_empty || vector_empty(right) || comma_variadic)
+            {
+                for (int j = 0; j < vector_count(right); j++)
+                {
+                    vector_push(result, vector_at(right, j));
+                }
+            }
+            else
+            {
+                preprocessor_paste(preprocessor, result, right);
+            }
+
+            vector_free(right);
+            // the last token is the left operand of a following ##, as in x ## y ## z
+            if (vector_count(result) > operand_start)
+            {
+                operand_start = vector_count(result) - 1;
+            }
+            i++;
+            continue;
+        }
+
+        operand_start = vector_count(result);
+        int argument_index = preprocessor_argument_index(definition, preprocessor_line_token(definition->value, i + 1));
+        if (definition->type == PREPROCESSOR_DEFINITION_MACRO_FUNCTION && token_is_symbol(token, '#') && argument_index >= 0)
+        {
+            struct preprocessor_token string = preprocessor_stringify(preprocessor_argument(arguments, argument_index), &body_token);
+            string.token.whitespace = preprocessor_line_token(definition->value, i + 1)->whitespace;
+            vector_push(result, &string);
+            i++;
+            continue;
+        }
+
+        argument_index = preprocessor_argument_index(definition, token);
+        if (argument_index < 0)
+        {
+            vector_push(result, &body_token);
+            continue;
+        }
+
+        struct vector *argument = preprocessor_argument(arguments, argument_index);
+        if (!preprocessor_is_paste(definition->value, i + 1))
+        {
+            // arguments are fully expanded before substitution unless they are pasted,
+            // an argument used several times is only expanded once
+            if (!expanded[argument_index])
+            {
+                expanded[argument_index] = preprocessor_expand_tokens(preprocessor, argument);
+            }
+            argument = expanded[argument_index];
+        }
+        preprocessor_push_argument(result, argument, token->whitespace);
+    }
+
+    for (int i = 0; i < vector_count(result); i++)
+    {
+        struct preprocessor_token *token = vector_at(result, i);
+        token->hideset = preprocessor_hideset_union(preprocessor, token->hideset, hideset);
+    }
+
+    struct preprocessor_token *last = vector_back_or_null(result);
+    if (last)
+    {
+        last->token.whitespace = whitespace;
+    }
+
+    for (int i = 0; i < total_arguments; i++)
+    {
+        if (expanded[i])
+        {
+            vector_free(expanded[i]);
+        }
+    }
+    free(expanded);
+    return result;
+}
+
+static bool preprocessor_expand_builtin(struct preprocessor *preprocessor, struct preprocessor_expansion *expansion, struct preprocessor_token *token)
+{
+    struct preprocessor_token result = *token;
+    if (S_EQ(token->token.sval, "__LINE__"))
+    {
+        result.token.type = TOKEN_TYPE_NUMBER;
+        result.token.llnum = token->token.pos.line;
+    }
+    else if (S_EQ(token->token.sval, "__FILE__"))
+    {
+        result.token.type = TOKEN_TYPE_STRING;
+        result.token.sval = token->token.pos.filename ? token->token.pos.filename : "";
+        result.token.length = strlen(result.token.sval);
+    }
+    else
+    {
+        return false;
+    }
+
+    preprocessor_output(preprocessor, expansion, &result);
+    return true;
+}
+
+/**
+ * Returns true if the token was a macro whose expansion has been placed in front of
+ * the input for rescanning
+ */
+static bool preprocessor_expand_macro(struct preprocessor *preprocessor, struct preprocessor_expansion *expansion, struct preprocessor_token *token)
+{
+    const char *name = preprocessor_token_name(&token->token);
+    if (!name || preprocessor_hideset_contains(token->hideset, name))
+    {
+        return false;
+    }
+
+    struct preprocessor_definition *definition = preprocessor_get_definition(preprocessor, name);
+    if (!definition)
+    {
+        return false;
+    }
+
+    if (definition->type == PREPROCESSOR_DEFINITION_STANDARD)
+    {
+        struct preprocessor_hideset *hideset = preprocessor_hideset_add(preprocessor, token->hideset, name);
+        preprocessor_push_chunk(expansion, preprocessor_substitute(preprocessor, definition, NULL, hideset, token, token->token.whitespace));
+        return true;
+    }
+
+    // a macro function name without a call is an ordinary identifier
+    struct preprocessor_token next;
+    if (!preprocessor_expansion_next(preprocessor, expansion, &next))
+    {
+        return false;
+    }
+
+    if (!token_is_operator(&next.token, "("))
+    {
+        preprocessor_push_back(expansion, &next);
+        return false;
+    }
+
+    struct preprocessor_token rparen;
+    struct vector *arguments = preprocessor_read_arguments(preprocessor, expansion, definition, token, &rparen);
+    struct preprocessor_hideset *hideset = preprocessor_hideset_add(preprocessor, preprocessor_hideset_intersection(preprocessor, token->hideset, rparen.hideset), name);
+    preprocessor_push_chunk(expansion, preprocessor_substitute(preprocessor, definition, arguments, hideset, token, rparen.token.whitespace));
+
+    for (int i = 0; i < vector_count(arguments); i++)
+    {
+        vector_free(preprocessor_argument(arguments, i));
+    }
+    vector_free(arguments);
+    return true;
+}
+
+static void preprocessor_expand(struct preprocessor *preprocessor, struct preprocessor_expansion *expansion)
+{
+    struct preprocessor_token token;
+    while (!expansion->stop && preprocessor_expansion_next(preprocessor, expansion, &token))
+    {
+        if (preprocessor_expand_macro(preprocessor, expansion, &token))
+        {
+            continue;
+        }
+
+        if (token.token.type == TOKEN_TYPE_IDENTIFIER && preprocessor_expand_builtin(preprocessor, expansion, &token))
+        {
+            continue;
+        }
+
+        preprocessor_output(preprocessor, expansion, &token);
+    }
+}
+
+/**
+ * Starts on the main file, its tokens are read with preprocessor_next_declaration
+ */
+void preprocessor_start(struct compile_process *compiler, struct lex_process *lex_process, struct lex_pipeline *pipeline)
+{
+    struct preprocessor *preprocessor = compiler->preprocessor;
+    compiler->token_vec = vector_create(sizeof(struct token));
+    compiler->token_bracket_matches = vector_create(sizeof(int));
+
+    struct preprocessor_included_file *file = calloc(1, sizeof(struct preprocessor_included_file));
+    file->filename = compiler->cfile.abs_path;
+    hashmap_set(preprocessor->included_files, file->filename, file);
+    struct preprocessor_source *source = preprocessor_push_source(preprocessor, compiler, lex_process, NULL, file);
+    source->pipeline = pipeline;
+    preprocessor->pipelined = pipeline != NULL;
+
+    preprocessor->expansion = calloc(1, sizeof(struct preprocessor_expansion));
+    preprocessor->expansion->read_source = true;
+    preprocessor->expansion->output = compiler->token_vec;
+}
+
+static void preprocessor_check_brackets(struct preprocessor *preprocessor)
+{
+    int *open_index = vector_back_or_null(preprocessor->open_brackets);
+    if (open_index)
+    {
+        struct token *open_token = vector_at(preprocessor->compiler->token_vec, *open_index);
+        preprocessor_bracket_error(preprocessor, open_token, "Bracket opened on line %i, col %i in file %s is never closed\n", open_token);
+    }
+}
+
+/**
+ * Replaces the tokens in the compiler's token_vec with those of the next top level
+ * declaration, false once the translation unit is done. The tokens of the last
+ * declaration and what the lexers kept of them are let go
+ */
+bool preprocessor_next_declaration(struct compile_process *compiler)
+{
+    struct preprocessor *preprocessor = compiler->preprocessor;
+    preprocessor->split = true;
+    vector_clear(compiler->token_vec);
+    vector_clear(compiler->token_bracket_matches);
+
+    // a lexer only looks back at the token it made last
+    struct preprocessor_source **sources = vector_data_ptr(preprocessor->sources);
+    for (size_t i = 0; i < vector_count(preprocessor->sources); i++)
+    {
+        struct lex_process *lex_process = sources[i]->lex_process;
+        if (lex_process && !sources[i]->tokens && vector_count(lex_process->token_vec) > 1)
+        {
+            struct token last = *(struct token *)vector_back(lex_process->token_vec);
+            vector_clear(lex_process->token_vec);
+            vector_push(lex_process->token_vec, &last);
+        }
+    }
+    if (!preprocessor->pipelined)
+    {
+        buffer_release_read(compiler->cfile.buffer);
+    }
+
+    preprocessor->expansion->stop = false;
+    preprocessor_expand(preprocessor, preprocessor->expansion);
+    if (!preprocessor->expansion->stop)
+    {
+        preprocessor_check_brackets(preprocessor);
+    }
+    return !vector_empty(compiler->token_vec);
+}
+
+int preprocessor_run(struct compile_process *compiler, struct lex_process *lex_process, struct lex_pipeline *pipeline)
+{
+    preprocessor_start(compiler, lex_process, pipeline);
+    preprocessor_expand(compiler->preprocessor, compiler->preprocessor->expansion);
+    preprocessor_check_brackets(compiler->preprocessor);
+    return PREPROCESS_ALL_OK;
+}
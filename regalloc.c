@@ -0,0 +1,1003 @@
+#include "compiler.h"
+#include "helpers/vector.h"
+#include <stdlib.h>
+
+/**
+ * Linear scan register allocation over the live intervals of SSA values, with
+ * interval splitting (Wimmer and Mössenböck). Liveness comes straight from the
+ * use-lists by walking backwards from each use to the definition, so no live
+ * sets are ever built
+ */
+
+#define REGALLOC_NEVER UINT32_MAX
+
+// registers values can get, caller saved ones first so short lived values leave the callee saved ones alone
+static const int regalloc_registers[] = {X86_RSI, X86_RDI, X86_R8, X86_R9, X86_RDX, X86_RCX, X86_RBX, X86_R12, X86_R13, X86_R14, X86_R15};
+static const int regalloc_caller_saved[] = {X86_RSI, X86_RDI, X86_R8, X86_R9, X86_RDX, X86_RCX};
+static const int regalloc_arguments[] = {X86_RDI, X86_RSI, X86_RDX, X86_RCX, X86_R8, X86_R9};
+
+#define REGALLOC_REGISTER_COUNT (int)(sizeof(regalloc_registers) / sizeof(regalloc_registers[0]))
+#define REGALLOC_CALLER_SAVED_COUNT (int)(sizeof(regalloc_caller_saved) / sizeof(regalloc_caller_saved[0]))
+
+struct regalloc_list
+{
+    struct live_interval **items;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+struct regalloc_state
+{
+    struct regalloc *regalloc;
+    struct ir_function *function;
+    // positions at which each register is overwritten by a call, division or shift, in order
+    struct vector *clobbers[X86_REGISTER_COUNT];
+    // heap of intervals waiting for a location, by start
+    struct regalloc_list unhandled;
+    struct regalloc_list active;
+    struct regalloc_list inactive;
+    // ranges of the value whose interval is being built
+    struct vector *ranges;
+    struct vector *uses;
+    uint32_t *visited;
+};
+
+static void regalloc_list_push(struct regalloc_list *list, struct live_interval *interval)
+{
+    if (list->count == list->capacity)
+    {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        list->items = realloc(list->items, sizeof(struct live_interval *) * list->capacity);
+    }
+    list->items[list->count++] = interval;
+}
+
+static void regalloc_list_remove(struct regalloc_list *list, uint32_t index)
+{
+    list->items[index] = list->items[--list->count];
+}
+
+static uint32_t regalloc_start(struct live_interval *interval)
+{
+    return interval->ranges[0].from;
+}
+
+static uint32_t regalloc_end(struct live_interval *interval)
+{
+    return interval->ranges[interval->range_count - 1].to;
+}
+
+static void regalloc_heap_push(struct regalloc_list *heap, struct live_interval *interval)
+{
+    regalloc_list_push(heap, interval);
+    uint32_t index = heap->count - 1;
+    while (index)
+    {
+        uint32_t parent = (index - 1) / 2;
+        if (regalloc_start(heap->items[parent]) <= regalloc_start(heap->items[index]))
+        {
+            break;
+        }
+        struct live_interval *swap = heap->items[parent];
+        heap->items[parent] = heap->items[index];
+        heap->items[index] = swap;
+        index = parent;
+    }
+}
+
+static struct live_interval *regalloc_heap_pop(struct regalloc_list *heap)
+{
+    struct live_interval *top = heap->items[0];
+    heap->items[0] = heap->items[--heap->count];
+    uint32_t index = 0;
+    while (true)
+    {
+        uint32_t smallest = index;
+        for (uint32_t child = index * 2 + 1; child <= index * 2 + 2 && child < heap->count; child++)
+        {
+            if (regalloc_start(heap->items[child]) < regalloc_start(heap->items[smallest]))
+            {
+                smallest = child;
+            }
+        }
+
+        if (smallest == index)
+        {
+            break;
+        }
+        struct live_interval *swap = heap->items[smallest];
+        heap->items[smallest] = heap->items[index];
+        heap->items[index] = swap;
+        index = smallest;
+    }
+    return top;
+}
+
+bool regalloc_is_rematerialized(struct ir_function *function, uint32_t value)
+{
+    int op = function->instructions[value].op;
+    return op == IR_CONST || op == IR_ALLOCA || op == IR_GLOBAL;
+}
+
+/**
+ * Reverse postorder, every block comes after its dominators. The second
+ * successor is explored first so the first one, the loop body or the then
+ * branch, follows its block and loops stay together
+ */
+static void regalloc_order_blocks(struct regalloc *regalloc)
+{
+    struct ir_function *function = regalloc->function;
+    uint32_t count = function->block_count;
+    bool *visited = calloc(count, sizeof(bool));
+    uint32_t *postorder = malloc(sizeof(uint32_t) * count);
+    uint32_t *stack = malloc(sizeof(uint32_t) * count * 2);
+    uint32_t done = 0;
+    uint32_t top = 0;
+    stack[top++] = 1;
+    stack[top++] = 0;
+    visited[1] = true;
+    while (top)
+    {
+        uint32_t block = stack[top - 2];
+        uint32_t s = stack[top - 1];
+        if (s == 2)
+        {
+            postorder[done++] = block;
+            top -= 2;
+            continue;
+        }
+
+        stack[top - 1]++;
+        uint32_t successor = function->blocks[block].successors[1 - s];
+        if (successor != IR_NONE && !visited[successor])
+        {
+            visited[successor] = true;
+            stack[top++] = successor;
+            stack[top++] = 0;
+        }
+    }
+
+    regalloc->order = malloc(sizeof(uint32_t) * done);
+    regalloc->order_count = done;
+    for (uint32_t i = 0; i < done; i++)
+    {
+        regalloc->order[i] = postorder[done - 1 - i];
+    }
+    free(visited);
+    free(postorder);
+    free(stack);
+}
+
+static void regalloc_clobber(struct regalloc_state *state, int reg, uint32_t position)
+{
+    vector_push(state->clobbers[reg], &position);
+}
+
+static void regalloc_number(struct regalloc_state *state)
+{
+    struct regalloc *regalloc = state->regalloc;
+    struct ir_function *function = regalloc->function;
+    uint32_t position = 4;
+    for (uint32_t i = 0; i < regalloc->order_count; i++)
+    {
+        uint32_t block = regalloc->order[i];
+        regalloc->block_start[block] = position;
+        position += 4;
+        for (uint32_t index = function->blocks[block].first; index != IR_NONE; index = function->instructions[index].next)
+        {
+            struct ir_instruction *instruction = &function->instructions[index];
+            if (instruction->op == IR_PHI || instruction->op == IR_PARAM)
+            {
+                regalloc->positions[index] = regalloc->block_start[block];
+                continue;
+            }
+
+            regalloc->positions[index] = position;
+            switch (instruction->op)
+            {
+            case IR_CALL:
+                for (int r = 0; r < REGALLOC_CALLER_SAVED_COUNT; r++)
+                {
+                    regalloc_clobber(state, regalloc_caller_saved[r], position + 1);
+                }
+                break;
+
+            case IR_SDIV:
+            case IR_UDIV:
+            case IR_SREM:
+            case IR_UREM:
+                regalloc_clobber(state, X86_RDX, position + 1);
+                break;
+
+            case IR_SHL:
+            case IR_SHR:
+            case IR_SAR:
+                if (function->instructions[ir_operand(function, index, 1)].op != IR_CONST)
+                {
+                    regalloc_clobber(state, X86_RCX, position + 1);
+                }
+                break;
+            }
+            position += 4;
+        }
+        regalloc->block_end[block] = position - 1;
+    }
+}
+
+static uint32_t regalloc_weight(struct regalloc *regalloc, uint32_t block)
+{
+    uint32_t depth = regalloc->loop_depth[block];
+    return 1u << (3 * (depth < 5 ? depth : 5));
+}
+
+static uint32_t regalloc_definition(struct regalloc *regalloc, uint32_t value)
+{
+    struct ir_instruction *instruction = &regalloc->function->instructions[value];
+    if (instruction->op == IR_PHI || instruction->op == IR_PARAM)
+    {
+        return regalloc->block_start[instruction->block];
+    }
+    return regalloc->positions[value] + 2;
+}
+
+static void regalloc_add_range(struct regalloc_state *state, uint32_t from, uint32_t to)
+{
+    struct live_range range = {.from = from, .to = to};
+    vector_push(state->ranges, &range);
+}
+
+static void regalloc_add_use(struct regalloc_state *state, uint32_t position, uint32_t weight)
+{
+    struct live_use use = {.position = position, .weight = weight};
+    vector_push(state->uses, &use);
+}
+
+/**
+ * The value is live at the end of the block, walks back to its definition
+ */
+static void regalloc_live_out(struct regalloc_state *state, uint32_t value, uint32_t block, uint32_t *stack)
+{
+    struct regalloc *regalloc = state->regalloc;
+    struct ir_function *function = regalloc->function;
+    uint32_t defined_in = function->instructions[value].block;
+    uint32_t top = 0;
+    stack[top++] = block;
+    while (top)
+    {
+        block = stack[--top];
+        if (state->visited[block] == value)
+        {
+            continue;
+        }
+
+        state->visited[block] = value;
+        if (block == defined_in)
+        {
+            regalloc_add_range(state, regalloc_definition(regalloc, value), regalloc->block_end[block]);
+            continue;
+        }
+
+        regalloc_add_range(state, regalloc->block_start[block], regalloc->block_end[block]);
+        struct ir_block *target = &function->blocks[block];
+        for (uint32_t p = 0; p < target->pred_count; p++)
+        {
+            uint32_t pred = function->preds[target->preds + p];
+            if (state->visited[pred] != value)
+            {
+                stack[top++] = pred;
+            }
+        }
+    }
+}
+
+static int regalloc_compare_ranges(const void *a, const void *b)
+{
+    const struct live_range *left = a;
+    const struct live_range *right = b;
+    return left->from < right->from ? -1 : left->from > right->from;
+}
+
+static int regalloc_compare_uses(const void *a, const void *b)
+{
+    const struct live_use *left = a;
+    const struct live_use *right = b;
+    return left->position < right->position ? -1 : left->position > right->position;
+}
+
+static struct live_interval *regalloc_interval_create(uint32_t value)
+{
+    struct live_interval *interval = calloc(1, sizeof(struct live_interval));
+    interval->value = value;
+    interval->reg = X86_NO_REGISTER;
+    interval->hint_reg = X86_NO_REGISTER;
+    return interval;
+}
+
+static void regalloc_hint(struct regalloc *regalloc, uint32_t value, int reg, uint32_t other)
+{
+    struct live_interval *interval = regalloc->intervals[value];
+    if (!interval)
+    {
+        return;
+    }
+
+    if (reg != X86_NO_REGISTER && interval->hint_reg == X86_NO_REGISTER)
+    {
+        interval->hint_reg = reg;
+    }
+    if (other != IR_NONE && interval->hint_value == IR_NONE && !regalloc_is_rematerialized(regalloc->function, other))
+    {
+        interval->hint_value = other;
+    }
+}
+
+static void regalloc_build_interval(struct regalloc_state *state, uint32_t value, uint32_t *stack)
+{
+    struct regalloc *regalloc = state->regalloc;
+    struct ir_function *function = regalloc->function;
+    struct ir_instruction *instruction = &function->instructions[value];
+    uint32_t definition = regalloc_definition(regalloc, value);
+    vector_clear(state->ranges);
+    vector_clear(state->uses);
+    regalloc_add_use(state, definition, regalloc_weight(regalloc, instruction->block));
+    for (uint32_t use = instruction->first_use; use != IR_NONE; use = function->uses[use].next)
+    {
+        uint32_t user = function->uses[use].user;
+        struct ir_instruction *using = &function->instructions[user];
+        if (using->op == IR_PHI)
+        {
+            // phi operands are read at the end of the matching predecessor
+            struct ir_block *block = &function->blocks[using->block];
+            uint32_t pred = function->preds[block->preds + (use - using->operands)];
+            regalloc_add_use(state, regalloc->block_end[pred], regalloc_weight(regalloc, pred));
+            regalloc_live_out(state, value, pred, stack);
+            continue;
+        }
+
+        uint32_t position = regalloc->positions[user];
+        regalloc_add_use(state, position, regalloc_weight(regalloc, using->block));
+        if (using->block == instruction->block)
+        {
+            regalloc_add_range(state, definition, position);
+            continue;
+        }
+
+        regalloc_add_range(state, regalloc->block_start[using->block], position);
+        struct ir_block *block = &function->blocks[using->block];
+        for (uint32_t p = 0; p < block->pred_count; p++)
+        {
+            regalloc_live_out(state, value, function->preds[block->preds + p], stack);
+        }
+    }
+
+    // ranges of neighbouring blocks and of several uses overlap, merge them
+    uint32_t range_count = vector_count(state->ranges);
+    struct live_range *ranges = vector_data_ptr(state->ranges);
+    qsort(ranges, range_count, sizeof(struct live_range), regalloc_compare_ranges);
+    struct live_interval *interval = regalloc_interval_create(value);
+    interval->ranges = malloc(sizeof(struct live_range) * range_count);
+    interval->range_capacity = range_count;
+    for (uint32_t i = 0; i < range_count; i++)
+    {
+        struct live_range *last = interval->range_count ? &interval->ranges[interval->range_count - 1] : NULL;
+        if (last && ranges[i].from <= last->to + 1)
+        {
+            last->to = ranges[i].to > last->to ? ranges[i].to : last->to;
+            continue;
+        }
+        interval->ranges[interval->range_count++] = ranges[i];
+    }
+
+    uint32_t use_count = vector_count(state->uses);
+    interval->uses = malloc(sizeof(struct live_use) * use_count);
+    interval->use_count = use_count;
+    interval->use_capacity = use_count;
+    memcpy(interval->uses, vector_data_ptr(state->uses), sizeof(struct live_use) * use_count);
+    qsort(interval->uses, use_count, sizeof(struct live_use), regalloc_compare_uses);
+    regalloc->intervals[value] = interval;
+}
+
+static void regalloc_build_intervals(struct regalloc_state *state)
+{
+    struct regalloc *regalloc = state->regalloc;
+    struct ir_function *function = regalloc->function;
+    uint32_t *stack = malloc(sizeof(uint32_t) * (function->pred_capacity + function->block_count));
+    for (uint32_t value = 1; value < function->instruction_count; value++)
+    {
+        struct ir_instruction *instruction = &function->instructions[value];
+        if (instruction->op == IR_NOP || instruction->type == IR_TYPE_VOID || instruction->first_use == IR_NONE ||
+            regalloc_is_rematerialized(function, value))
+        {
+            continue;
+        }
+        regalloc_build_interval(state, value, stack);
+    }
+    free(stack);
+
+    // values that should share a register to save moves
+    for (uint32_t value = 1; value < function->instruction_count; value++)
+    {
+        struct ir_instruction *instruction = &function->instructions[value];
+        switch (instruction->op)
+        {
+        case IR_PARAM:
+            if (instruction->constant < 6)
+            {
+                regalloc_hint(regalloc, value, regalloc_arguments[instruction->constant], IR_NONE);
+            }
+            break;
+
+        case IR_CALL:
+            for (uint32_t i = 1; i < instruction->operand_count && i <= 6; i++)
+            {
+                regalloc_hint(regalloc, ir_operand(function, value, i), regalloc_arguments[i - 1], IR_NONE);
+            }
+            break;
+
+        case IR_PHI:
+            for (uint32_t i = 0; i < instruction->operand_count; i++)
+            {
+                uint32_t operand = ir_operand(function, value, i);
+                if (operand != IR_NONE)
+                {
+                    regalloc_hint(regalloc, value, X86_NO_REGISTER, operand);
+                    regalloc_hint(regalloc, operand, X86_NO_REGISTER, value);
+                }
+            }
+            break;
+
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+        case IR_AND:
+        case IR_OR:
+        case IR_XOR:
+        case IR_SHL:
+        case IR_SHR:
+        case IR_SAR:
+        case IR_NEG:
+        case IR_NOT:
+        case IR_SEXT:
+        case IR_ZEXT:
+        case IR_TRUNC:
+            // x86 overwrites the left operand
+            regalloc_hint(regalloc, value, X86_NO_REGISTER, ir_operand(function, value, 0));
+            break;
+        }
+    }
+}
+
+/**
+ * Moves the range cursor up to the position, which only ever grows
+ */
+static bool regalloc_covers(struct live_interval *interval, uint32_t position)
+{
+    while (interval->cursor < interval->range_count && interval->ranges[interval->cursor].to < position)
+    {
+        interval->cursor++;
+    }
+    return interval->cursor < interval->range_count && interval->ranges[interval->cursor].from <= position;
+}
+
+static uint32_t regalloc_next_intersection(struct live_interval *interval, struct live_interval *other)
+{
+    uint32_t i = interval->cursor;
+    uint32_t j = 0;
+    while (i < interval->range_count && j < other->range_count)
+    {
+        struct live_range *a = &interval->ranges[i];
+        struct live_range *b = &other->ranges[j];
+        if (a->to < b->from)
+        {
+            i++;
+        }
+        else if (b->to < a->from)
+        {
+            j++;
+        }
+        else
+        {
+            return a->from > b->from ? a->from : b->from;
+        }
+    }
+    return REGALLOC_NEVER;
+}
+
+/**
+ * First position inside the interval at which the register gets overwritten
+ */
+static uint32_t regalloc_next_clobber(struct regalloc_state *state, int reg, struct live_interval *interval)
+{
+    struct vector *clobbers = state->clobbers[reg];
+    uint32_t count = vector_count(clobbers);
+    uint32_t *points = vector_data_ptr(clobbers);
+    if (!count)
+    {
+        return REGALLOC_NEVER;
+    }
+
+    for (uint32_t r = 0; r < interval->range_count; r++)
+    {
+        uint32_t low = 0;
+        uint32_t high = count;
+        while (low < high)
+        {
+            uint32_t middle = (low + high) / 2;
+            if (points[middle] < interval->ranges[r].from)
+            {
+                low = middle + 1;
+            }
+            else
+            {
+                high = middle;
+            }
+        }
+
+        if (low < count && points[low] <= interval->ranges[r].to)
+        {
+            return points[low];
+        }
+    }
+    return REGALLOC_NEVER;
+}
+
+/**
+ * Uses still ahead of the position, weighted by loop depth
+ */
+static uint64_t regalloc_spill_cost(struct live_interval *interval, uint32_t position)
+{
+    uint64_t cost = 0;
+    for (uint32_t i = 0; i < interval->use_count; i++)
+    {
+        if (interval->uses[i].position >= position)
+        {
+            cost += interval->uses[i].weight;
+        }
+    }
+    return cost;
+}
+
+/**
+ * Splits can only happen in front of an instruction or at the start of a block
+ */
+static uint32_t regalloc_align(uint32_t position)
+{
+    return position & ~3u;
+}
+
+static void regalloc_ensure_slot(struct regalloc *regalloc, uint32_t value)
+{
+    if (!regalloc->slots[value])
+    {
+        regalloc->slots[value] = ++regalloc->slot_count;
+    }
+}
+
+/**
+ * The part from position on becomes a new interval following this one
+ */
+static struct live_interval *regalloc_split(struct live_interval *interval, uint32_t position)
+{
+    struct live_interval *child = regalloc_interval_create(interval->value);
+    child->hint_reg = interval->hint_reg;
+    child->hint_value = interval->hint_value;
+
+    uint32_t r = 0;
+    while (interval->ranges[r].to < position)
+    {
+        r++;
+    }
+
+    bool inside = interval->ranges[r].from < position;
+    child->range_count = interval->range_count - r;
+    child->range_capacity = child->range_count;
+    child->ranges = malloc(sizeof(struct live_range) * child->range_count);
+    memcpy(child->ranges, &interval->ranges[r], sizeof(struct live_range) * child->range_count);
+    if (inside)
+    {
+        child->ranges[0].from = position;
+        interval->ranges[r].to = position - 1;
+        interval->range_count = r + 1;
+    }
+    else
+    {
+        interval->range_count = r;
+    }
+
+    uint32_t u = 0;
+    while (u < interval->use_count && interval->uses[u].position < position)
+    {
+        u++;
+    }
+    child->use_count = interval->use_count - u;
+    child->use_capacity = child->use_count;
+    child->uses = malloc(sizeof(struct live_use) * (child->use_count ? child->use_count : 1));
+    memcpy(child->uses, &interval->uses[u], sizeof(struct live_use) * child->use_count);
+    interval->use_count = u;
+
+    if (interval->cursor >= interval->range_count)
+    {
+        interval->cursor = interval->range_count ? interval->range_count - 1 : 0;
+    }
+    child->next = interval->next;
+    interval->next = child;
+    return child;
+}
+
+/**
+ * A spilled part goes back to the queue from its next use, maybe a register is free by then
+ */
+static void regalloc_spill(struct regalloc_state *state, struct live_interval *interval)
+{
+    interval->reg = X86_NO_REGISTER;
+    regalloc_ensure_slot(state->regalloc, interval->value);
+    uint32_t start = regalloc_start(interval);
+    for (uint32_t u = 0; u < interval->use_count; u++)
+    {
+        uint32_t position = regalloc_align(interval->uses[u].position);
+        if (position > start && position <= regalloc_end(interval))
+        {
+            regalloc_heap_push(&state->unhandled, regalloc_split(interval, position));
+            return;
+        }
+    }
+}
+
+/**
+ * Register the interval would like, from its hints
+ */
+static int regalloc_preferred(struct regalloc *regalloc, struct live_interval *interval)
+{
+    if (interval->hint_reg != X86_NO_REGISTER)
+    {
+        return interval->hint_reg;
+    }
+
+    if (interval->hint_value == IR_NONE)
+    {
+        return X86_NO_REGISTER;
+    }
+
+    int reg = X86_NO_REGISTER;
+    uint32_t start = regalloc_start(interval);
+    for (struct live_interval *part = regalloc->intervals[interval->hint_value]; part; part = part->next)
+    {
+        if (part->reg != X86_NO_REGISTER && (reg == X86_NO_REGISTER || regalloc_start(part) <= start))
+        {
+            reg = part->reg;
+        }
+    }
+    return reg;
+}
+
+static bool regalloc_try_free(struct regalloc_state *state, struct live_interval *current)
+{
+    uint32_t free_until[X86_REGISTER_COUNT];
+    for (int r = 0; r < X86_REGISTER_COUNT; r++)
+    {
+        free_until[r] = REGALLOC_NEVER;
+    }
+
+    for (uint32_t i = 0; i < state->active.count; i++)
+    {
+        free_until[state->active.items[i]->reg] = 0;
+    }
+
+    for (uint32_t i = 0; i < state->inactive.count; i++)
+    {
+        struct live_interval *interval = state->inactive.items[i];
+        if (free_until[interval->reg])
+        {
+            uint32_t intersection = regalloc_next_intersection(interval, current);
+            free_until[interval->reg] = intersection < free_until[interval->reg] ? intersection : free_until[interval->reg];
+        }
+    }
+
+    for (int i = 0; i < REGALLOC_REGISTER_COUNT; i++)
+    {
+        int reg = regalloc_registers[i];
+        if (free_until[reg])
+        {
+            uint32_t clobber = regalloc_next_clobber(state, reg, current);
+            free_until[reg] = clobber < free_until[reg] ? clobber : free_until[reg];
+        }
+    }
+
+    uint32_t start = regalloc_start(current);
+    uint32_t end = regalloc_end(current);
+    int preferred = regalloc_preferred(state->regalloc, current);
+    int best = X86_NO_REGISTER;
+    if (preferred != X86_NO_REGISTER && free_until[preferred] > end)
+    {
+        best = preferred;
+    }
+    else
+    {
+        for (int i = 0; i < REGALLOC_REGISTER_COUNT; i++)
+        {
+            int reg = regalloc_registers[i];
+            if (best == X86_NO_REGISTER || free_until[reg] > free_until[best])
+            {
+                best = reg;
+            }
+        }
+    }
+
+    if (free_until[best] <= end)
+    {
+        // free for the first part only
+        uint32_t position = regalloc_align(free_until[best]);
+        if (position <= start)
+        {
+            return false;
+        }
+        regalloc_heap_push(&state->unhandled, regalloc_split(current, position));
+    }
+    current->reg = best;
+    return true;
+}
+
+/**
+ * Takes a register from the intervals that hold it from position on
+ */
+static void regalloc_evict(struct regalloc_state *state, struct live_interval *interval, uint32_t position)
+{
+    position = regalloc_align(position);
+    if (position <= regalloc_start(interval))
+    {
+        regalloc_spill(state, interval);
+        return;
+    }
+
+    if (position > regalloc_end(interval))
+    {
+        return;
+    }
+    regalloc_spill(state, regalloc_split(interval, position));
+}
+
+/**
+ * No register is free, either current or the intervals of the register that
+ * are cheapest to spill lose out
+ */
+static void regalloc_allocate_blocked(struct regalloc_state *state, struct live_interval *current)
+{
+    uint32_t start = regalloc_start(current);
+    uint64_t cost[X86_REGISTER_COUNT] = {0};
+    for (uint32_t i = 0; i < state->active.count; i++)
+    {
+        struct live_interval *interval = state->active.items[i];
+        cost[interval->reg] += regalloc_spill_cost(interval, start);
+    }
+
+    for (uint32_t i = 0; i < state->inactive.count; i++)
+    {
+        struct live_interval *interval = state->inactive.items[i];
+        if (regalloc_next_intersection(interval, current) != REGALLOC_NEVER)
+        {
+            cost[interval->reg] += regalloc_spill_cost(interval, start);
+        }
+    }
+
+    int best = X86_NO_REGISTER;
+    uint32_t usable_until = REGALLOC_NEVER;
+    for (int i = 0; i < REGALLOC_REGISTER_COUNT; i++)
+    {
+        int reg = regalloc_registers[i];
+        uint32_t clobber = regalloc_next_clobber(state, reg, current);
+        if (clobber != REGALLOC_NEVER && regalloc_align(clobber) <= start)
+        {
+            continue;
+        }
+
+        if (best == X86_NO_REGISTER || cost[reg] < cost[best])
+        {
+            best = reg;
+            usable_until = clobber;
+        }
+    }
+
+    if (best == X86_NO_REGISTER || cost[best] >= regalloc_spill_cost(current, start))
+    {
+        regalloc_spill(state, current);
+        return;
+    }
+
+    current->reg = best;
+    if (usable_until != REGALLOC_NEVER)
+    {
+        regalloc_heap_push(&state->unhandled, regalloc_split(current, regalloc_align(usable_until)));
+    }
+
+    for (uint32_t i = 0; i < state->active.count;)
+    {
+        struct live_interval *interval = state->active.items[i];
+        if (interval->reg != best)
+        {
+            i++;
+            continue;
+        }
+        regalloc_list_remove(&state->active, i);
+        regalloc_evict(state, interval, start);
+    }
+
+    for (uint32_t i = 0; i < state->inactive.count;)
+    {
+        struct live_interval *interval = state->inactive.items[i];
+        uint32_t intersection = interval->reg == best ? regalloc_next_intersection(interval, current) : REGALLOC_NEVER;
+        if (intersection == REGALLOC_NEVER)
+        {
+            i++;
+            continue;
+        }
+
+        // the part before the lifetime hole keeps the register
+        uint32_t resume = REGALLOC_NEVER;
+        for (uint32_t r = interval->cursor; r < interval->range_count; r++)
+        {
+            if (interval->ranges[r].from > start)
+            {
+                resume = interval->ranges[r].from;
+                break;
+            }
+        }
+        if (resume == REGALLOC_NEVER || regalloc_align(resume) <= regalloc_start(interval))
+        {
+            i++;
+            continue;
+        }
+        regalloc_list_remove(&state->inactive, i);
+        regalloc_spill(state, regalloc_split(interval, regalloc_align(resume)));
+    }
+}
+
+static void regalloc_scan(struct regalloc_state *state)
+{
+    struct regalloc *regalloc = state->regalloc;
+    while (state->unhandled.count)
+    {
+        struct live_interval *current = regalloc_heap_pop(&state->unhandled);
+        uint32_t position = regalloc_start(current);
+        for (uint32_t i = 0; i < state->active.count;)
+        {
+            struct live_interval *interval = state->active.items[i];
+            if (regalloc_end(interval) < position)
+            {
+                regalloc_list_remove(&state->active, i);
+            }
+            else if (!regalloc_covers(interval, position))
+            {
+                regalloc_list_remove(&state->active, i);
+                regalloc_list_push(&state->inactive, interval);
+            }
+            else
+            {
+                i++;
+            }
+        }
+
+        for (uint32_t i = 0; i < state->inactive.count;)
+        {
+            struct live_interval *interval = state->inactive.items[i];
+            if (regalloc_end(interval) < position)
+            {
+                regalloc_list_remove(&state->inactive, i);
+            }
+            else if (regalloc_covers(interval, position))
+            {
+                regalloc_list_remove(&state->inactive, i);
+                regalloc_list_push(&state->active, interval);
+            }
+            else
+            {
+                i++;
+            }
+        }
+
+        if (!regalloc_try_free(state, current))
+        {
+            regalloc_allocate_blocked(state, current);
+        }
+
+        if (current->reg != X86_NO_REGISTER)
+        {
+            regalloc->used_registers |= 1u << current->reg;
+            regalloc_list_push(&state->active, current);
+        }
+    }
+}
+
+struct regalloc *regalloc_run(struct ir_function *function, bool spill_all)
+{
+    struct regalloc *regalloc = calloc(1, sizeof(struct regalloc));
+    regalloc->function = function;
+    regalloc->block_start = calloc(function->block_count, sizeof(uint32_t));
+    regalloc->block_end = calloc(function->block_count, sizeof(uint32_t));
+    regalloc->loop_depth = calloc(function->block_count, sizeof(uint32_t));
+    regalloc->positions = calloc(function->instruction_count, sizeof(uint32_t));
+    regalloc->intervals = calloc(function->instruction_count, sizeof(struct live_interval *));
+    regalloc->slots = calloc(function->instruction_count, sizeof(uint32_t));
+
+    struct regalloc_state state = {.regalloc = regalloc, .function = function};
+    for (int r = 0; r < X86_REGISTER_COUNT; r++)
+    {
+        state.clobbers[r] = vector_create(sizeof(uint32_t));
+    }
+    state.ranges = vector_create(sizeof(struct live_range));
+    state.uses = vector_create(sizeof(struct live_use));
+    state.visited = calloc(function->block_count, sizeof(uint32_t));
+
+    regalloc_order_blocks(regalloc);
+    ssa_loop_depths(function, regalloc->loop_depth);
+    regalloc_number(&state);
+    regalloc_build_intervals(&state);
+    for (uint32_t value = 1; value < function->instruction_count; value++)
+    {
+        struct live_interval *interval = regalloc->intervals[value];
+        if (!interval)
+        {
+            continue;
+        }
+
+        if (spill_all)
+        {
+            regalloc_ensure_slot(regalloc, value);
+            continue;
+        }
+        regalloc_heap_push(&state.unhandled, interval);
+    }
+    regalloc_scan(&state);
+
+    for (int r = 0; r < X86_REGISTER_COUNT; r++)
+    {
+        vector_free(state.clobbers[r]);
+    }
+    vector_free(state.ranges);
+    vector_free(state.uses);
+    free(state.visited);
+    free(state.unhandled.items);
+    free(state.active.items);
+    free(state.inactive.items);
+    return regalloc;
+}
+
+void regalloc_free(struct regalloc *regalloc)
+{
+    for (uint32_t value = 1; value < regalloc->function->instruction_count; value++)
+    {
+        struct live_interval *interval = regalloc->intervals[value];
+        while (interval)
+        {
+            struct live_interval *next = interval->next;
+            free(interval->ranges);
+            free(interval->uses);
+            free(interval);
+            interval = next;
+        }
+    }
+    free(regalloc->order);
+    free(regalloc->block_start);
+    free(regalloc->block_end);
+    free(regalloc->loop_depth);
+    free(regalloc->positions);
+    free(regalloc->intervals);
+    free(regalloc->slots);
+    free(regalloc);
+}
+
+/**
+ * Part of the value that holds it at the position
+ */
+struct live_interval *regalloc_interval_at(struct regalloc *regalloc, uint32_t value, uint32_t position)
+{
+    struct live_interval *found = regalloc->intervals[value];
+    for (struct live_interval *part = found; part; part = part->next)
+    {
+        if (regalloc_start(part) > position)
+        {
+            break;
+        }
+        found = part;
+    }
+    return found;
+}
@@ -0,0 +1,1396 @@
+#include "compiler.h"
+#include <stdlib.h>
+#include <limits.h>
+#include "helpers/vector.h"
+
+/**
+ * Binds every identifier to the node that declares it and every struct type
+ * to the node that defines its members, then gives each declaration and
+ * expression its canonical type
+ */
+struct resolver
+{
+    struct compile_process *compiler;
+    struct node_pool *pool;
+    // variables, functions and enumerators
+    struct symbol_table *symbols;
+    // struct, union and enum tags live in a namespace of their own
+    struct symbol_table *tags;
+
+    struct type_table *types;
+    // indexed by node, grows with the pool as enumerators get value nodes
+    struct type **node_types;
+    uint32_t node_types_capacity;
+    // one past the highest node given a type
+    uint32_t node_types_end;
+    // operators of the a + b + c chains being walked, each walk pops back to where it started
+    struct vector *chain;
+};
+
+static void resolve_node(struct resolver *resolver, uint32_t index);
+static struct type *resolver_datatype_type(struct resolver *resolver, uint32_t index);
+
+static struct compile_process *resolver_error_position(struct resolver *resolver, uint32_t index)
+{
+    resolver->compiler->pos = node_at(resolver->pool, index)->pos;
+    return resolver->compiler;
+}
+
+static void resolver_enter_scope(struct resolver *resolver)
+{
+    symbol_table_enter_scope(resolver->symbols);
+    symbol_table_enter_scope(resolver->tags);
+}
+
+static void resolver_leave_scope(struct resolver *resolver)
+{
+    symbol_table_leave_scope(resolver->symbols);
+    symbol_table_leave_scope(resolver->tags);
+}
+
+static void resolver_set_type(struct resolver *resolver, uint32_t index, struct type *type)
+{
+    if (index >= resolver->node_types_capacity)
+    {
+        uint32_t capacity = resolver->node_types_capacity;
+        while (capacity <= index)
+        {
+            capacity *= 2;
+        }
+        resolver->node_types = realloc(resolver->node_types, sizeof(struct type *) * capacity);
+        memset(resolver->node_types + resolver->node_types_capacity, 0, sizeof(struct type *) * (capacity - resolver->node_types_capacity));
+        resolver->node_types_capacity = capacity;
+    }
+    resolver->node_types[index] = type;
+    resolver->node_types_end = index >= resolver->node_types_end ? index + 1 : resolver->node_types_end;
+}
+
+static struct type *resolver_type_of(struct resolver *resolver, uint32_t index)
+{
+    return index < resolver->node_types_capacity ? resolver->node_types[index] : NULL;
+}
+
+/**
+ * The type of an expression used as a value, arrays and functions decay to pointers
+ */
+static struct type *resolver_value_type(struct resolver *resolver, uint32_t index)
+{
+    return type_decay(resolver->types, resolver_type_of(resolver, index));
+}
+
+static struct type *resolver_int(struct resolver *resolver)
+{
+    return type_get_basic(resolver->types, TYPE_INT, 0);
+}
+
+static struct type *resolver_number_type(struct resolver *resolver, unsigned long long value)
+{
+    if (value <= INT_MAX)
+    {
+        return resolver_int(resolver);
+    }
+
+    if (value <= LONG_MAX)
+    {
+        return type_get_basic(resolver->types, TYPE_LONG, 0);
+    }
+    return type_get_basic(resolver->types, TYPE_LONG, TYPE_FLAG_UNSIGNED);
+}
+
+static bool resolver_is_struct(struct type *type)
+{
+    return type->kind == TYPE_STRUCT || type->kind == TYPE_UNION;
+}
+
+/**
+ * A struct that was only declared when the type was written may have been defined since
+ */
+static struct type *resolver_complete_type(struct resolver *resolver, struct type *type)
+{
+    if (resolver_is_struct(type) && !(type->flags & TYPE_FLAG_COMPLETE) && type->struct_node == NODE_NONE)
+    {
+        uint32_t definition = symbol_table_lookup(resolver->tags, type->tag);
+        if (definition != NODE_NONE)
+        {
+            return resolver_type_of(resolver, definition);
+        }
+    }
+    return type;
+}
+
+static bool resolver_is_incomplete(struct type *type)
+{
+    return type->kind == TYPE_VOID || (type->kind == TYPE_ARRAY && type->length < 0) ||
+           (resolver_is_struct(type) && !(type->flags & TYPE_FLAG_COMPLETE));
+}
+
+/**
+ * Wraps a value the way storing it in the integer type would
+ */
+static long long resolver_truncate(struct type *type, long long value)
+{
+    if (!type_is_integer(type) || type->size >= (long)sizeof(long long))
+    {
+        return value;
+    }
+
+    int shift = (sizeof(long long) - type->size) * 8;
+    if (type->flags & TYPE_FLAG_UNSIGNED)
+    {
+        return (long long)(((unsigned long long)value << shift) >> shift);
+    }
+    return (long long)((unsigned long long)value << shift) >> shift;
+}
+
+static bool resolver_constant(struct resolver *resolver, uint32_t index, long long *value);
+
+/**
+ * Applies the binary operator at index to the values of its operands
+ */
+static bool resolver_constant_binary(struct resolver *resolver, uint32_t index, long long left, long long right, long long *value)
+{
+    struct node *node = node_at(resolver->pool, index);
+    struct type *operands = type_common(resolver->types, resolver_type_of(resolver, node->exp.left), resolver_type_of(resolver, node->exp.right));
+    bool is_unsigned = type_is_unsigned(operands);
+    unsigned long long uleft = left;
+    unsigned long long uright = right;
+    switch (node->op)
+    {
+    case OP_PLUS:
+        *value = uleft + uright;
+        break;
+    case OP_MINUS:
+        *value = uleft - uright;
+        break;
+    case OP_STAR:
+        *value = uleft * uright;
+        break;
+    case OP_SLASH:
+    case OP_PERCENT:
+        if (right == 0)
+        {
+            compiler_error(resolver_error_position(resolver, index), "Division by zero in constant expression\n");
+        }
+
+        if (is_unsigned)
+        {
+            *value = node->op == OP_SLASH ? uleft / uright : uleft % uright;
+        }
+        else
+        {
+            *value = node->op == OP_SLASH ? left / right : left % right;
+        }
+        break;
+    case OP_AMPERSAND:
+        *value = left & right;
+        break;
+    case OP_PIPE:
+        *value = left | right;
+        break;
+    case OP_CARET:
+        *value = left ^ right;
+        break;
+    case OP_SHIFT_LEFT:
+        *value = uleft << (right & 63);
+        break;
+    case OP_SHIFT_RIGHT:
+        *value = is_unsigned ? (long long)(uleft >> (right & 63)) : left >> (right & 63);
+        break;
+    case OP_LESS:
+        *value = is_unsigned ? uleft < uright : left < right;
+        break;
+    case OP_GREATER:
+        *value = is_unsigned ? uleft > uright : left > right;
+        break;
+    case OP_LESS_EQUAL:
+        *value = is_unsigned ? uleft <= uright : left <= right;
+        break;
+    case OP_GREATER_EQUAL:
+        *value = is_unsigned ? uleft >= uright : left >= right;
+        break;
+    case OP_EQUAL:
+        *value = left == right;
+        break;
+    case OP_NOT_EQUAL:
+        *value = left != right;
+        break;
+    case OP_LOGICAL_AND:
+        *value = left && right;
+        break;
+    case OP_LOGICAL_OR:
+        *value = left || right;
+        break;
+    default:
+        // assignments and the comma operator
+        return false;
+    }
+    *value = resolver_truncate(resolver_type_of(resolver, index), *value);
+    return true;
+}
+
+/**
+ * a + b + c holds a + b as its left operand and such chains are as long as the
+ * source makes them, their operators are applied from the innermost out by a loop
+ */
+static bool resolver_constant_chain(struct resolver *resolver, uint32_t index, long long *value)
+{
+    size_t base = vector_count(resolver->chain);
+    while (node_at(resolver->pool, index)->type == NODE_TYPE_EXPRESSION)
+    {
+        vector_push(resolver->chain, &index);
+        index = node_at(resolver->pool, index)->exp.left;
+    }
+
+    bool constant = resolver_constant(resolver, index, value);
+    while (vector_count(resolver->chain) > base)
+    {
+        uint32_t operator = *(uint32_t *)vector_back(resolver->chain);
+        vector_pop(resolver->chain);
+        long long right;
+        constant = constant && resolver_constant(resolver, node_at(resolver->pool, operator)->exp.right, &right) &&
+                   resolver_constant_binary(resolver, operator, *value, right, value);
+    }
+    return constant;
+}
+
+/**
+ * Evaluates a resolved integer constant expression, false when it is not constant
+ */
+static bool resolver_constant(struct resolver *resolver, uint32_t index, long long *value)
+{
+    struct node *node = node_at(resolver->pool, index);
+    long long operand;
+    switch (node->type)
+    {
+    case NODE_TYPE_NUMBER:
+        *value = (long long)node->llnum;
+        return true;
+
+    case NODE_TYPE_CAST:
+        if (!resolver_constant(resolver, node->unary.operand, value))
+        {
+            return false;
+        }
+        *value = resolver_truncate(resolver_type_of(resolver, index), *value);
+        return true;
+
+    case NODE_TYPE_UNARY:
+        if (!resolver_constant(resolver, node->unary.operand, &operand))
+        {
+            return false;
+        }
+
+        switch (node->op)
+        {
+        case OP_PLUS:
+            *value = operand;
+            break;
+        case OP_MINUS:
+            *value = -(unsigned long long)operand;
+            break;
+        case OP_TILDE:
+            *value = ~operand;
+            break;
+        case OP_NOT:
+            *value = !operand;
+            break;
+        default:
+            return false;
+        }
+        *value = resolver_truncate(resolver_type_of(resolver, index), *value);
+        return true;
+
+    case NODE_TYPE_TERNARY:
+        if (!resolver_constant(resolver, node->ternary.condition, &operand))
+        {
+            return false;
+        }
+        return resolver_constant(resolver, operand ? node->ternary.true_exp : node->ternary.false_exp, value);
+
+    case NODE_TYPE_EXPRESSION:
+        return resolver_constant_chain(resolver, index, value);
+    }
+    return false;
+}
+
+/**
+ * Turns the expression into a number node holding its value, the expression
+ * keeps its type and its place in any list
+ */
+static void resolver_replace_with_number(struct resolver *resolver, uint32_t index, long long value)
+{
+    struct node *node = node_at(resolver->pool, index);
+    node->type = NODE_TYPE_NUMBER;
+    node->flags = 0;
+    node->op = OP_NONE;
+    node->datatype = NODE_NONE;
+    memset(node->children, 0, sizeof(node->children));
+    node->llnum = value;
+}
+
+static long long resolver_fold_constant(struct resolver *resolver, uint32_t index, const char *message)
+{
+    long long value;
+    if (!resolver_constant(resolver, index, &value))
+    {
+        compiler_error(resolver_error_position(resolver, index), message);
+    }
+    resolver_replace_with_number(resolver, index, value);
+    return value;
+}
+
+/**
+ * Static storage is initialized before the program runs, folding what can be
+ * folded leaves code generation with numbers and addresses
+ */
+static void resolver_fold_initializer(struct resolver *resolver, uint32_t index)
+{
+    struct node *node = node_at(resolver->pool, index);
+    if (node->type == NODE_TYPE_INITIALIZER_LIST)
+    {
+        for (uint32_t value = node->list.first; value != NODE_NONE; value = node_at(resolver->pool, value)->next)
+        {
+            resolver_fold_initializer(resolver, value);
+        }
+        return;
+    }
+
+    long long value;
+    if (node->type != NODE_TYPE_NUMBER && resolver_constant(resolver, index, &value))
+    {
+        resolver_replace_with_number(resolver, index, value);
+    }
+}
+
+static void resolve_list(struct resolver *resolver, uint32_t index)
+{
+    while (index != NODE_NONE)
+    {
+        resolve_node(resolver, index);
+        index = node_at(resolver->pool, index)->next;
+    }
+}
+
+static void resolve_datatype(struct resolver *resolver, uint32_t index)
+{
+    if (index == NODE_NONE)
+    {
+        return;
+    }
+
+    struct datatype *datatype = node_datatype_at(resolver->pool, index);
+    if ((datatype->type == DATA_TYPE_STRUCT || datatype->type == DATA_TYPE_UNION) && datatype->struct_node == NODE_NONE)
+    {
+        // stays NODE_NONE for structs that are only declared, pointers to them are fine
+        datatype->struct_node = symbol_table_lookup(resolver->tags, datatype->type_str);
+    }
+    resolve_list(resolver, datatype->array_sizes);
+}
+
+/**
+ * Array dimensions are listed outermost first so the innermost one is applied first
+ */
+static struct type *resolver_array_type(struct resolver *resolver, struct type *element, uint32_t size)
+{
+    if (size == NODE_NONE)
+    {
+        return element;
+    }
+
+    long length = -1;
+    if (!(node_at(resolver->pool, size)->flags & NODE_FLAG_UNSIZED))
+    {
+        length = resolver_fold_constant(resolver, size, "Array size must be a constant\n");
+        if (length < 0)
+        {
+            compiler_error(resolver_error_position(resolver, size), "Array size is negative\n");
+        }
+    }
+
+    element = resolver_array_type(resolver, element, node_at(resolver->pool, size)->next);
+    if (resolver_is_incomplete(resolver_complete_type(resolver, element)))
+    {
+        compiler_error(resolver_error_position(resolver, size), "Array has incomplete element type\n");
+    }
+    return type_get_array(resolver->types, element, length);
+}
+
+static const int resolver_basic_kinds[] = {
+    [DATA_TYPE_VOID] = TYPE_VOID,
+    [DATA_TYPE_CHAR] = TYPE_CHAR,
+    [DATA_TYPE_SHORT] = TYPE_SHORT,
+    [DATA_TYPE_INT] = TYPE_INT,
+    [DATA_TYPE_LONG] = TYPE_LONG,
+    [DATA_TYPE_FLOAT] = TYPE_FLOAT,
+    [DATA_TYPE_DOUBLE] = TYPE_DOUBLE};
+
+static struct type *resolver_datatype_type(struct resolver *resolver, uint32_t index)
+{
+    resolve_datatype(resolver, index);
+    struct datatype *datatype = node_datatype_at(resolver->pool, index);
+    struct type *type;
+    if (datatype->type == DATA_TYPE_STRUCT || datatype->type == DATA_TYPE_UNION)
+    {
+        int kind = datatype->type == DATA_TYPE_UNION ? TYPE_UNION : TYPE_STRUCT;
+        type = type_get_struct(resolver->types, kind, datatype->struct_node, datatype->type_str);
+    }
+    else
+    {
+        int flags = datatype->flags & DATATYPE_FLAG_IS_UNSIGNED ? TYPE_FLAG_UNSIGNED : 0;
+        type = type_get_basic(resolver->types, resolver_basic_kinds[datatype->type], flags);
+    }
+
+    for (int i = 0; i < datatype->pointer_depth; i++)
+    {
+        type = type_get_pointer(resolver->types, type);
+    }
+    return resolver_array_type(resolver, type, datatype->array_sizes);
+}
+
+static bool resolver_is_extern(struct resolver *resolver, struct node *node)
+{
+    return node->datatype != NODE_NONE && (node_datatype_at(resolver->pool, node->datatype)->flags & DATATYPE_FLAG_IS_EXTERN);
+}
+
+/**
+ * A function declared with () says nothing about its parameters
+ */
+static bool resolver_compatible_functions(struct type *type, struct type *other)
+{
+    if (type == other)
+    {
+        return true;
+    }
+
+    bool unspecified = (type->param_count == 0 && !(type->flags & TYPE_FLAG_VARIADIC)) ||
+                       (other->param_count == 0 && !(other->flags & TYPE_FLAG_VARIADIC));
+    return type->base == other->base && unspecified;
+}
+
+static bool resolver_compatible_variables(struct type *type, struct type *other)
+{
+    if (type == other)
+    {
+        return true;
+    }
+
+    // int a[]; may be completed by int a[10];
+    return type->kind == TYPE_ARRAY && other->kind == TYPE_ARRAY && type->base == other->base &&
+           (type->length < 0 || other->length < 0);
+}
+
+/**
+ * The body or initializer, a streamed declaration keeps counting as defined once it is released
+ */
+static bool resolver_is_defined(struct node *node, uint32_t definition)
+{
+    return definition != NODE_NONE || (node->flags & NODE_FLAG_RELEASED);
+}
+
+/**
+ * Functions may be declared any number of times and defined once, file scope
+ * variables may be declared extern before or after their definition
+ */
+static void resolver_declare(struct resolver *resolver, uint32_t index)
+{
+    struct node *node = node_at(resolver->pool, index);
+    uint32_t previous_index = symbol_table_declare(resolver->symbols, node->sval, index);
+    if (previous_index == NODE_NONE)
+    {
+        return;
+    }
+
+    struct node *previous = node_at(resolver->pool, previous_index);
+    struct type *type = resolver_type_of(resolver, index);
+    struct type *previous_type = resolver_type_of(resolver, previous_index);
+    if (node->type == NODE_TYPE_FUNCTION && previous->type == NODE_TYPE_FUNCTION)
+    {
+        if (node->func.body != NODE_NONE && resolver_is_defined(previous, previous->func.body))
+        {
+            compiler_error(resolver_error_position(resolver, index), "Redefinition of function %s\n", node->sval);
+        }
+
+        if (!resolver_compatible_functions(type, previous_type))
+        {
+            compiler_error(resolver_error_position(resolver, index), "Conflicting types for %s\n", node->sval);
+        }
+
+        if (node->func.body == NODE_NONE)
+        {
+            // keep pointing at the definition
+            symbol_table_declare(resolver->symbols, node->sval, previous_index);
+        }
+        return;
+    }
+
+    bool file_scope = symbol_table_depth(resolver->symbols) == 0;
+    if (file_scope && node->type == NODE_TYPE_VARIABLE && previous->type == NODE_TYPE_VARIABLE)
+    {
+        if (!resolver_compatible_variables(type, previous_type))
+        {
+            compiler_error(resolver_error_position(resolver, index), "Conflicting types for %s\n", node->sval);
+        }
+
+        if (resolver_is_extern(resolver, node))
+        {
+            symbol_table_declare(resolver->symbols, node->sval, previous_index);
+            return;
+        }
+
+        bool previous_defined = resolver_is_defined(previous, previous->var.initializer);
+        if (resolver_is_extern(resolver, previous) || !previous_defined || node->var.initializer == NODE_NONE)
+        {
+            if (node->var.initializer == NODE_NONE && previous_defined)
+            {
+                symbol_table_declare(resolver->symbols, node->sval, previous_index);
+            }
+            return;
+        }
+    }
+
+    compiler_error(resolver_error_position(resolver, index), "Redefinition of %s\n", node->sval);
+}
+
+static bool resolver_is_lvalue(struct resolver *resolver, uint32_t index)
+{
+    struct node *node = node_at(resolver->pool, index);
+    switch (node->type)
+    {
+    case NODE_TYPE_IDENTIFIER:
+        return node->declaration != NODE_NONE && node_at(resolver->pool, node->declaration)->type == NODE_TYPE_VARIABLE;
+
+    case NODE_TYPE_UNARY:
+        return node->op == OP_STAR;
+
+    case NODE_TYPE_MEMBER:
+        return node->op == OP_ARROW || resolver_is_lvalue(resolver, node->unary.operand);
+
+    case NODE_TYPE_SUBSCRIPT:
+    case NODE_TYPE_STRING:
+        return true;
+    }
+    return false;
+}
+
+static void resolver_expect_assignable(struct resolver *resolver, uint32_t index)
+{
+    struct type *type = resolver_type_of(resolver, index);
+    if (!resolver_is_lvalue(resolver, index) || type->kind == TYPE_ARRAY || type->kind == TYPE_FUNCTION)
+    {
+        compiler_error(resolver_error_position(resolver, index), "Expression is not assignable\n");
+    }
+}
+
+static void resolver_expect_scalar(struct resolver *resolver, uint32_t index, struct type *type)
+{
+    if (!type_is_scalar(type))
+    {
+        compiler_error(resolver_error_position(resolver, index), "Expecting a scalar value\n");
+    }
+}
+
+static void resolve_identifier(struct resolver *resolver, uint32_t index)
+{
+    struct node *node = node_at(resolver->pool, index);
+    uint32_t declaration = symbol_table_lookup(resolver->symbols, node->sval);
+    if (declaration == NODE_NONE)
+    {
+        compiler_error(resolver_error_position(resolver, index), "Undeclared identifier %s\n", node->sval);
+    }
+    node->declaration = declaration;
+
+    struct node *declared = node_at(resolver->pool, declaration);
+    if (declared->type == NODE_TYPE_ENUMERATOR)
+    {
+        // enumerators are constants, later phases only see their value
+        node->type = NODE_TYPE_NUMBER;
+        node->llnum = node_at(resolver->pool, declared->var.initializer)->llnum;
+    }
+    resolver_set_type(resolver, index, resolver_type_of(resolver, declaration));
+}
+
+static void resolve_call(struct resolver *resolver, uint32_t index)
+{
+    struct node *node = node_at(resolver->pool, index);
+    uint32_t callee = node->call.function;
+    struct node *function = node_at(resolver->pool, callee);
+    if (function->type == NODE_TYPE_IDENTIFIER && symbol_table_lookup(resolver->symbols, function->sval) == NODE_NONE)
+    {
+        // C89 style implicit declaration, the function is assumed to return int
+        compile_warning(resolver_error_position(resolver, index), "Implicit declaration of function %s\n", function->sval);
+        resolver_set_type(resolver, callee, type_get_function(resolver->types, resolver_int(resolver), NULL, 0, false));
+    }
+    else
+    {
+        resolve_node(resolver, callee);
+    }
+
+    int total = 0;
+    for (uint32_t argument = node_at(resolver->pool, index)->call.arguments; argument != NODE_NONE; argument = node_at(resolver->pool, argument)->next)
+    {
+        resolve_node(resolver, argument);
+        total++;
+    }
+
+    struct type *type = resolver_value_type(resolver, callee);
+    if (type->kind != TYPE_POINTER || type->base->kind != TYPE_FUNCTION)
+    {
+        compiler_error(resolver_error_position(resolver, index), "Called object is not a function\n");
+    }
+
+    type = type->base;
+    bool variadic = type->flags & TYPE_FLAG_VARIADIC;
+    bool specified = type->param_count || variadic;
+    if (specified && (total < type->param_count || (total > type->param_count && !variadic)))
+    {
+        compiler_error(resolver_error_position(resolver, index), "Expecting %i arguments but got %i\n", type->param_count, total);
+    }
+    resolver_set_type(resolver, index, type->base);
+}
+
+/**
+ * Type of the element at the given position of an aggregate initializer
+ */
+static struct type *resolver_initializer_element(struct resolver *resolver, uint32_t index, struct type *type, int position)
+{
+    type = resolver_complete_type(resolver, type);
+    if (type->kind == TYPE_ARRAY)
+    {
+        if (type->length >= 0 && position >= type->length)
+        {
+            compiler_error(resolver_error_position(resolver, index), "Excess elements in array initializer\n");
+        }
+        return type->base;
+    }
+
+    if (resolver_is_struct(type))
+    {
+        int total = type->kind == TYPE_UNION && type->member_count ? 1 : type->member_count;
+        if (position >= total)
+        {
+            compiler_error(resolver_error_position(resolver, index), "Excess elements in struct initializer\n");
+        }
+        return type->members[position].type;
+    }
+
+    if (position > 0)
+    {
+        compiler_error(resolver_error_position(resolver, index), "Excess elements in scalar initializer\n");
+    }
+    return type;
+}
+
+static void resolve_initializer(struct resolver *resolver, uint32_t index, struct type *type)
+{
+    if (node_at(resolver->pool, index)->type != NODE_TYPE_INITIALIZER_LIST)
+    {
+        resolve_node(resolver, index);
+        return;
+    }
+
+    resolver_set_type(resolver, index, type);
+    int position = 0;
+    for (uint32_t value = node_at(resolver->pool, index)->list.first; value != NODE_NONE; value = node_at(resolver->pool, value)->next)
+    {
+        resolve_initializer(resolver, value, resolver_initializer_element(resolver, value, type, position));
+        position++;
+    }
+}
+
+/**
+ * Length of an array declared with [] from its initializer
+ */
+static long resolver_initializer_length(struct resolver *resolver, uint32_t index)
+{
+    struct node *node = node_at(resolver->pool, index);
+    if (node->type == NODE_TYPE_STRING)
+    {
+        return node->string.length + 1;
+    }
+
+    long length = 0;
+    if (node->type == NODE_TYPE_INITIALIZER_LIST)
+    {
+        for (uint32_t value = node->list.first; value != NODE_NONE; value = node_at(resolver->pool, value)->next)
+        {
+            length++;
+        }
+    }
+    return length;
+}
+
+static void resolve_variable(struct resolver *resolver, uint32_t index)
+{
+    struct type *type = resolver_datatype_type(resolver, node_at(resolver->pool, index)->datatype);
+    resolver_set_type(resolver, index, type);
+    // the variable is in scope in its own initializer
+    resolver_declare(resolver, index);
+
+    struct node *node = node_at(resolver->pool, index);
+    uint32_t initializer = node->var.initializer;
+    if (initializer != NODE_NONE)
+    {
+        if (type->kind == TYPE_ARRAY && type->length < 0)
+        {
+            type = type_get_array(resolver->types, type->base, resolver_initializer_length(resolver, initializer));
+            resolver_set_type(resolver, index, type);
+        }
+        resolve_initializer(resolver, initializer, type);
+
+        struct datatype *datatype = node_datatype_at(resolver->pool, node_at(resolver->pool, index)->datatype);
+        if (symbol_table_depth(resolver->symbols) == 0 || (datatype->flags & DATATYPE_FLAG_IS_STATIC))
+        {
+            resolver_fold_initializer(resolver, initializer);
+        }
+    }
+
+    // file scope arrays declared with [] are completed by a later declaration
+    node = node_at(resolver->pool, index);
+    bool completed_later = symbol_table_depth(resolver->symbols) == 0 && type->kind == TYPE_ARRAY;
+    if (!resolver_is_extern(resolver, node) && !completed_later && resolver_is_incomplete(resolver_complete_type(resolver, type)))
+    {
+        compiler_error(resolver_error_position(resolver, index), "Variable %s has incomplete type\n", node->sval);
+    }
+}
+
+static struct type *resolver_function_type(struct resolver *resolver, uint32_t index)
+{
+    struct node *node = node_at(resolver->pool, index);
+    bool variadic = node->flags & NODE_FLAG_VARIADIC;
+    struct type *return_type = resolver_datatype_type(resolver, node->datatype);
+    if (return_type->kind == TYPE_ARRAY)
+    {
+        compiler_error(resolver_error_position(resolver, index), "Functions cannot return arrays\n");
+    }
+
+    struct vector *params = vector_create(sizeof(struct type *));
+    for (uint32_t param = node_at(resolver->pool, index)->func.params; param != NODE_NONE; param = node_at(resolver->pool, param)->next)
+    {
+        // array and function parameters are really pointers
+        struct type *type = type_decay(resolver->types, resolver_datatype_type(resolver, node_at(resolver->pool, param)->datatype));
+        resolver_set_type(resolver, param, type);
+        vector_push(params, &type);
+    }
+
+    struct type *type = type_get_function(resolver->types, return_type, vector_data_ptr(params), vector_count(params), variadic);
+    vector_free(params);
+    return type;
+}
+
+static void resolve_function(struct resolver *resolver, uint32_t index)
+{
+    resolver_set_type(resolver, index, resolver_function_type(resolver, index));
+    resolver_declare(resolver, index);
+
+    // parameters and the outermost block of the body share one scope
+    resolver_enter_scope(resolver);
+    uint32_t body = node_at(resolver->pool, index)->func.body;
+    if (body != NODE_NONE)
+    {
+        for (uint32_t param = node_at(resolver->pool, index)->func.params; param != NODE_NONE; param = node_at(resolver->pool, param)->next)
+        {
+            if (node_at(resolver->pool, param)->sval)
+            {
+                resolver_declare(resolver, param);
+            }
+        }
+        resolve_list(resolver, node_at(resolver->pool, body)->list.first);
+    }
+    resolver_leave_scope(resolver);
+}
+
+static void resolve_struct(struct resolver *resolver, uint32_t index)
+{
+    struct node *node = node_at(resolver->pool, index);
+    int kind = node->flags & NODE_FLAG_UNION ? TYPE_UNION : TYPE_STRUCT;
+    struct type *type = type_get_struct(resolver->types, kind, index, node->sval);
+    resolver_set_type(resolver, index, type);
+    if (node->sval)
+    {
+        // declared before the members so they can point to the struct itself
+        if (symbol_table_declare(resolver->tags, node->sval, index) != NODE_NONE)
+        {
+            compiler_error(resolver_error_position(resolver, index), "Redefinition of struct %s\n", node->sval);
+        }
+    }
+
+    // members are not variables, only their types are resolved
+    struct vector *members = vector_create(sizeof(struct type_member));
+    for (uint32_t member = node->list.first; member != NODE_NONE; member = node_at(resolver->pool, member)->next)
+    {
+        struct node *member_node = node_at(resolver->pool, member);
+        if (member_node->type != NODE_TYPE_VARIABLE)
+        {
+            resolve_node(resolver, member);
+            continue;
+        }
+
+        struct type *member_type = resolver_complete_type(resolver, resolver_datatype_type(resolver, member_node->datatype));
+        resolver_set_type(resolver, member, member_type);
+        member_node = node_at(resolver->pool, member);
+        // only the last member may be an array declared with []
+        bool flexible = member_type->kind == TYPE_ARRAY && member_type->length < 0 && member_node->next == NODE_NONE;
+        if (!flexible && resolver_is_incomplete(member_type))
+        {
+            compiler_error(resolver_error_position(resolver, member), "Member %s has incomplete type\n", member_node->sval);
+        }
+
+        struct type_member *declared = vector_data_ptr(members);
+        for (int i = 0; i < vector_count(members); i++)
+        {
+            if (declared[i].name == member_node->sval)
+            {
+                compiler_error(resolver_error_position(resolver, member), "Duplicate member %s\n", member_node->sval);
+            }
+        }
+
+        struct type_member entry = {.name = member_node->sval, .type = member_type};
+        vector_push(members, &entry);
+    }
+
+    type_complete_struct(type, vector_data_ptr(members), vector_count(members));
+    vector_free(members);
+}
+
+static void resolve_enum(struct resolver *resolver, uint32_t index)
+{
+    struct type *type = resolver_int(resolver);
+    long long value = 0;
+    for (uint32_t enumerator = node_at(resolver->pool, index)->list.first; enumerator != NODE_NONE; enumerator = node_at(resolver->pool, enumerator)->next)
+    {
+        uint32_t initializer = node_at(resolver->pool, enumerator)->var.initializer;
+        if (initializer != NODE_NONE)
+        {
+            resolve_node(resolver, initializer);
+            value = resolver_fold_constant(resolver, initializer, "Enumerator value must be a constant\n");
+        }
+        else
+        {
+            // every enumerator gets a number node so references can copy its value
+            struct pos pos = node_at(resolver->pool, enumerator)->pos;
+            initializer = node_create(resolver->pool, NODE_TYPE_NUMBER, &pos);
+            node_at(resolver->pool, initializer)->llnum = value;
+            node_at(resolver->pool, enumerator)->var.initializer = initializer;
+        }
+
+        resolver_set_type(resolver, initializer, type);
+        resolver_set_type(resolver, enumerator, type);
+        resolver_declare(resolver, enumerator);
+        value = resolver_truncate(type, value + 1);
+    }
+}
+
+static void resolve_cast(struct resolver *resolver, uint32_t index)
+{
+    struct type *type = resolver_datatype_type(resolver, node_at(resolver->pool, index)->datatype);
+    uint32_t operand = node_at(resolver->pool, index)->unary.operand;
+    resolve_node(resolver, operand);
+    if (type->kind != TYPE_VOID)
+    {
+        resolver_expect_scalar(resolver, index, type);
+        resolver_expect_scalar(resolver, operand, resolver_value_type(resolver, operand));
+    }
+    resolver_set_type(resolver, index, type);
+}
+
+/**
+ * sizeof is always a constant here, the node becomes the number
+ */
+static void resolve_sizeof(struct resolver *resolver, uint32_t index)
+{
+    struct node *node = node_at(resolver->pool, index);
+    struct type *type;
+    if (node->flags & NODE_FLAG_SIZEOF_DATATYPE)
+    {
+        type = resolver_datatype_type(resolver, node->datatype);
+    }
+    else
+    {
+        uint32_t operand = node->unary.operand;
+        resolve_node(resolver, operand);
+        type = resolver_type_of(resolver, operand);
+    }
+
+    type = resolver_complete_type(resolver, type);
+    if (type->kind == TYPE_FUNCTION || (type->kind != TYPE_VOID && resolver_is_incomplete(type)))
+    {
+        compiler_error(resolver_error_position(resolver, index), "Invalid application of sizeof to an incomplete type\n");
+    }
+
+    resolver_replace_with_number(resolver, index, type->size);
+    resolver_set_type(resolver, index, type_get_basic(resolver->types, TYPE_LONG, TYPE_FLAG_UNSIGNED));
+}
+
+static struct type *resolver_unary_type(struct resolver *resolver, uint32_t index)
+{
+    struct node *node = node_at(resolver->pool, index);
+    uint32_t operand = node->unary.operand;
+    struct type *type = resolver_value_type(resolver, operand);
+    switch (node->op)
+    {
+    case OP_PLUS:
+    case OP_MINUS:
+    case OP_TILDE:
+        if (!type_is_arithmetic(type) || (node->op == OP_TILDE && !type_is_integer(type)))
+        {
+            compiler_error(resolver_error_position(resolver, index), "Invalid operand to unary operator\n");
+        }
+        return type_promote(resolver->types, type);
+
+    case OP_NOT:
+        resolver_expect_scalar(resolver, operand, type);
+        return resolver_int(resolver);
+
+    case OP_STAR:
+        if (type->kind != TYPE_POINTER)
+        {
+            compiler_error(resolver_error_position(resolver, index), "Dereferencing a value that is not a pointer\n");
+        }
+        return resolver_complete_type(resolver, type->base);
+
+    case OP_AMPERSAND:
+    {
+        struct node *operand_node = node_at(resolver->pool, operand);
+        bool is_function = operand_node->type == NODE_TYPE_IDENTIFIER && operand_node->declaration != NODE_NONE &&
+                           node_at(resolver->pool, operand_node->declaration)->type == NODE_TYPE_FUNCTION;
+        if (!is_function && !resolver_is_lvalue(resolver, operand))
+        {
+            compiler_error(resolver_error_position(resolver, index), "Cannot take the address of an rvalue\n");
+        }
+        return type_get_pointer(resolver->types, resolver_type_of(resolver, operand));
+    }
+
+    case OP_INCREMENT:
+    case OP_DECREMENT:
+        resolver_expect_assignable(resolver, operand);
+        resolver_expect_scalar(resolver, operand, type);
+        return type;
+    }
+    return type;
+}
+
+static struct type *resolver_binary_type(struct resolver *resolver, uint32_t index)
+{
+    struct node *node = node_at(resolver->pool, index);
+    struct type *left = resolver_value_type(resolver, node->exp.left);
+    struct type *right = resolver_value_type(resolver, node->exp.right);
+    switch (node->op)
+    {
+    case OP_COMMA:
+        return right;
+
+    case OP_ASSIGN:
+        resolver_expect_assignable(resolver, node->exp.left);
+        if ((resolver_is_struct(left) || resolver_is_struct(right)) && left != right)
+        {
+            compiler_error(resolver_error_position(resolver, index), "Incompatible types in assignment\n");
+        }
+        return resolver_type_of(resolver, node->exp.left);
+
+    case OP_PLUS_ASSIGN:
+    case OP_MINUS_ASSIGN:
+    case OP_MUL_ASSIGN:
+    case OP_DIV_ASSIGN:
+    case OP_MOD_ASSIGN:
+    case OP_XOR_ASSIGN:
+    case OP_AND_ASSIGN:
+    case OP_OR_ASSIGN:
+    case OP_SHIFT_LEFT_ASSIGN:
+    case OP_SHIFT_RIGHT_ASSIGN:
+        resolver_expect_assignable(resolver, node->exp.left);
+        resolver_expect_scalar(resolver, node->exp.left, left);
+        resolver_expect_scalar(resolver, node->exp.right, right);
+        return resolver_type_of(resolver, node->exp.left);
+
+    case OP_LESS:
+    case OP_GREATER:
+    case OP_LESS_EQUAL:
+    case OP_GREATER_EQUAL:
+    case OP_EQUAL:
+    case OP_NOT_EQUAL:
+    case OP_LOGICAL_AND:
+    case OP_LOGICAL_OR:
+        resolver_expect_scalar(resolver, node->exp.left, left);
+        resolver_expect_scalar(resolver, node->exp.right, right);
+        return resolver_int(resolver);
+
+    case OP_PLUS:
+        if (left->kind == TYPE_POINTER && type_is_integer(right))
+        {
+            return left;
+        }
+
+        if (type_is_integer(left) && right->kind == TYPE_POINTER)
+        {
+            return right;
+        }
+        break;
+
+    case OP_MINUS:
+        if (left->kind == TYPE_POINTER && right->kind == TYPE_POINTER)
+        {
+            return type_get_basic(resolver->types, TYPE_LONG, 0);
+        }
+
+        if (left->kind == TYPE_POINTER && type_is_integer(right))
+        {
+            return left;
+        }
+        break;
+
+    case OP_PERCENT:
+    case OP_AMPERSAND:
+    case OP_PIPE:
+    case OP_CARET:
+    case OP_SHIFT_LEFT:
+    case OP_SHIFT_RIGHT:
+        if (!type_is_integer(left) || !type_is_integer(right))
+        {
+            compiler_error(resolver_error_position(resolver, index), "Invalid operands to binary operator\n");
+        }
+
+        if (node->op == OP_SHIFT_LEFT || node->op == OP_SHIFT_RIGHT)
+        {
+            return type_promote(resolver->types, left);
+        }
+        break;
+    }
+
+    if (!type_is_arithmetic(left) || !type_is_arithmetic(right))
+    {
+        compiler_error(resolver_error_position(resolver, index), "Invalid operands to binary operator\n");
+    }
+    return type_common(resolver->types, left, right);
+}
+
+static struct type *resolver_ternary_type(struct resolver *resolver, uint32_t index)
+{
+    struct node *node = node_at(resolver->pool, index);
+    resolver_expect_scalar(resolver, node->ternary.condition, resolver_value_type(resolver, node->ternary.condition));
+    struct type *true_type = resolver_value_type(resolver, node->ternary.true_exp);
+    struct type *false_type = resolver_value_type(resolver, node->ternary.false_exp);
+    if (type_is_arithmetic(true_type) && type_is_arithmetic(false_type))
+    {
+        return type_common(resolver->types, true_type, false_type);
+    }
+
+    if (true_type == false_type)
+    {
+        return true_type;
+    }
+
+    // a pointer on one side and usually a null pointer constant on the other
+    if (true_type->kind == TYPE_POINTER && type_is_integer(false_type))
+    {
+        return true_type;
+    }
+
+    if (type_is_integer(true_type) && false_type->kind == TYPE_POINTER)
+    {
+        return false_type;
+    }
+
+    if (true_type->kind == TYPE_POINTER && false_type->kind == TYPE_POINTER)
+    {
+        return true_type->base->kind == TYPE_VOID ? true_type : false_type;
+    }
+
+    compiler_error(resolver_error_position(resolver, index), "Mismatched types in conditional expression\n");
+    return NULL;
+}
+
+static struct type *resolver_subscript_type(struct resolver *resolver, uint32_t index)
+{
+    struct node *node = node_at(resolver->pool, index);
+    struct type *left = resolver_value_type(resolver, node->exp.left);
+    struct type *right = resolver_value_type(resolver, node->exp.right);
+    if (left->kind == TYPE_POINTER && type_is_integer(right))
+    {
+        return resolver_complete_type(resolver, left->base);
+    }
+
+    if (type_is_integer(left) && right->kind == TYPE_POINTER)
+    {
+        return resolver_complete_type(resolver, right->base);
+    }
+
+    compiler_error(resolver_error_position(resolver, index), "Subscripted value is not an array or pointer\n");
+    return NULL;
+}
+
+static struct type *resolver_member_type(struct resolver *resolver, uint32_t index)
+{
+    struct node *node = node_at(resolver->pool, index);
+    struct type *type = resolver_type_of(resolver, node->unary.operand);
+    if (node->op == OP_ARROW)
+    {
+        type = resolver_value_type(resolver, node->unary.operand);
+        if (type->kind != TYPE_POINTER)
+        {
+            compiler_error(resolver_error_position(resolver, index), "Member access through a value that is not a pointer\n");
+        }
+        type = type->base;
+    }
+
+    type = resolver_complete_type(resolver, type);
+    if (!resolver_is_struct(type))
+    {
+        compiler_error(resolver_error_position(resolver, index), "Member access on a value that is not a struct or union\n");
+    }
+
+    if (!(type->flags & TYPE_FLAG_COMPLETE))
+    {
+        compiler_error(resolver_error_position(resolver, index), "Member access on incomplete type %s\n", type->tag ? type->tag : "");
+    }
+
+    struct type_member *member = type_find_member(type, node->sval);
+    if (!member)
+    {
+        compiler_error(resolver_error_position(resolver, index), "No member named %s\n", node->sval);
+    }
+    // later passes find the complete struct through its definition
+    node->declaration = type->struct_node;
+    return member->type;
+}
+
+/**
+ * Types an expression whose operands are already typed
+ */
+static void resolver_type_expression(struct resolver *resolver, uint32_t index)
+{
+    struct type *type = NULL;
+    switch (node_at(resolver->pool, index)->type)
+    {
+    case NODE_TYPE_EXPRESSION:
+        type = resolver_binary_type(resolver, index);
+        break;
+
+    case NODE_TYPE_UNARY:
+    case NODE_TYPE_POSTFIX:
+        type = resolver_unary_type(resolver, index);
+        break;
+
+    case NODE_TYPE_TERNARY:
+        type = resolver_ternary_type(resolver, index);
+        break;
+
+    case NODE_TYPE_SUBSCRIPT:
+        type = resolver_subscript_type(resolver, index);
+        break;
+
+    case NODE_TYPE_MEMBER:
+        type = resolver_member_type(resolver, index);
+        break;
+
+    default:
+        // statements have no type
+        return;
+    }
+    resolver_set_type(resolver, index, type);
+}
+
+/**
+ * Resolves a chain of binary operators from its innermost left operand out, the
+ * parser builds a + b + c with a loop so the chain is followed with one here too
+ */
+static void resolve_expression(struct resolver *resolver, uint32_t index)
+{
+    size_t base = vector_count(resolver->chain);
+    while (node_at(resolver->pool, node_at(resolver->pool, index)->exp.left)->type == NODE_TYPE_EXPRESSION)
+    {
+        vector_push(resolver->chain, &index);
+        index = node_at(resolver->pool, index)->exp.left;
+    }
+
+    resolve_node(resolver, node_at(resolver->pool, index)->exp.left);
+    while (true)
+    {
+        resolve_node(resolver, node_at(resolver->pool, index)->exp.right);
+        resolver_type_expression(resolver, index);
+        if (vector_count(resolver->chain) == base)
+        {
+            break;
+        }
+        index = *(uint32_t *)vector_back(resolver->chain);
+        vector_pop(resolver->chain);
+    }
+}
+
+/**
+ * An else if chain is followed with a loop, like the parser builds it
+ */
+static void resolve_if(struct resolver *resolver, uint32_t index)
+{
+    while (index != NODE_NONE && node_at(resolver->pool, index)->type == NODE_TYPE_STATEMENT_IF)
+    {
+        resolve_node(resolver, node_at(resolver->pool, index)->stmt_if.condition);
+        resolve_node(resolver, node_at(resolver->pool, index)->stmt_if.body);
+        index = node_at(resolver->pool, index)->stmt_if.else_body;
+    }
+    resolve_node(resolver, index);
+}
+
+static void resolve_node(struct resolver *resolver, uint32_t index)
+{
+    if (index == NODE_NONE)
+    {
+        return;
+    }
+
+    struct node *node = node_at(resolver->pool, index);
+    switch (node->type)
+    {
+    case NODE_TYPE_IDENTIFIER:
+        resolve_identifier(resolver, index);
+        break;
+
+    case NODE_TYPE_CALL:
+        resolve_call(resolver, index);
+        break;
+
+    case NODE_TYPE_VARIABLE:
+        resolve_variable(resolver, index);
+        break;
+
+    case NODE_TYPE_FUNCTION:
+        resolve_function(resolver, index);
+        break;
+
+    case NODE_TYPE_STRUCT:
+        resolve_struct(resolver, index);
+        break;
+
+    case NODE_TYPE_ENUM:
+        resolve_enum(resolver, index);
+        break;
+
+    case NODE_TYPE_CAST:
+        resolve_cast(resolver, index);
+        break;
+
+    case NODE_TYPE_SIZEOF:
+        resolve_sizeof(resolver, index);
+        break;
+
+    case NODE_TYPE_NUMBER:
+        resolver_set_type(resolver, index, resolver_number_type(resolver, node->llnum));
+        break;
+
+    case NODE_TYPE_STRING:
+    {
+        struct type *element = type_get_basic(resolver->types, TYPE_CHAR, 0);
+        resolver_set_type(resolver, index, type_get_array(resolver->types, element, node->string.length + 1));
+    }
+    break;
+
+    case NODE_TYPE_INITIALIZER_LIST:
+        resolve_list(resolver, node->list.first);
+        break;
+
+    case NODE_TYPE_EXPRESSION:
+        resolve_expression(resolver, index);
+        break;
+
+    case NODE_TYPE_STATEMENT_IF:
+        resolve_if(resolver, index);
+        break;
+
+    case NODE_TYPE_BODY:
+        resolver_enter_scope(resolver);
+        resolve_list(resolver, node->list.first);
+        resolver_leave_scope(resolver);
+        break;
+
+    case NODE_TYPE_STATEMENT_FOR:
+        // variables declared in the first clause belong to the loop
+        resolver_enter_scope(resolver);
+        resolve_list(resolver, node->stmt_for.init);
+        for (int i = 1; i < NODE_MAX_CHILDREN; i++)
+        {
+            resolve_node(resolver, node_at(resolver->pool, index)->children[i]);
+        }
+        resolver_leave_scope(resolver);
+        break;
+
+    case NODE_TYPE_STATEMENT_CASE:
+        resolve_node(resolver, node->stmt.exp);
+        resolver_fold_constant(resolver, node_at(resolver->pool, index)->stmt.exp, "Case label must be a constant\n");
+        break;
+
+    case NODE_TYPE_STATEMENT_BREAK:
+    case NODE_TYPE_STATEMENT_CONTINUE:
+    case NODE_TYPE_STATEMENT_DEFAULT:
+    case NODE_TYPE_STATEMENT_GOTO:
+    case NODE_TYPE_LABEL:
+        break;
+
+    default:
+        // expressions and statements whose children are all expressions or statements,
+        // member access only resolves its operand as members are found through types
+        for (int i = 0; i < NODE_MAX_CHILDREN; i++)
+        {
+            resolve_node(resolver, node_at(resolver->pool, index)->children[i]);
+        }
+        resolver_type_expression(resolver, index);
+        break;
+    }
+}
+
+/**
+ * A resolver that keeps the file scope between calls to resolver_resolve
+ */
+struct resolver *resolver_create(struct compile_process *process)
+{
+    struct resolver *resolver = calloc(1, sizeof(struct resolver));
+    resolver->compiler = process;
+    resolver->pool = process->node_pool;
+    resolver->symbols = symbol_table_create();
+    resolver->tags = symbol_table_create();
+    resolver->types = type_table_create();
+    resolver->node_types_capacity = process->node_pool->count;
+    resolver->node_types = calloc(resolver->node_types_capacity, sizeof(struct type *));
+    resolver->chain = vector_create(sizeof(uint32_t));
+    process->types = resolver->types;
+    return resolver;
+}
+
+/**
+ * Resolves the top level declarations starting at tree, they may refer to those of earlier calls
+ */
+void resolver_resolve(struct resolver *resolver, uint32_t tree)
+{
+    resolve_list(resolver, tree);
+    resolver->compiler->node_types = resolver->node_types;
+}
+
+/**
+ * The nodes from first on were released, their indexes start out without a type again
+ */
+void resolver_release(struct resolver *resolver, uint32_t first)
+{
+    if (first < resolver->node_types_end)
+    {
+        memset(resolver->node_types + first, 0, sizeof(struct type *) * (resolver->node_types_end - first));
+        resolver->node_types_end = first;
+    }
+    type_table_release(resolver->types, first);
+}
+
+/**
+ * Frees the scopes, the types and node types stay with the process
+ */
+void resolver_free(struct resolver *resolver)
+{
+    symbol_table_free(resolver->symbols);
+    symbol_table_free(resolver->tags);
+    vector_free(resolver->chain);
+    free(resolver);
+}
+
+int resolve(struct compile_process *process)
+{
+    struct resolver *resolver = resolver_create(process);
+    resolver_resolve(resolver, process->node_tree);
+    resolver_free(resolver);
+    return RESOLVE_ALL_OK;
+}
@@ -0,0 +1,467 @@
+#define _GNU_SOURCE
+#include "compiler.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * Compile server. The server process listens on a Unix socket and keeps a pool
+ * of workers forked from it, every worker takes requests off the socket one after
+ * another and keeps its compiler caches warm in between. The workers are processes
+ * rather than threads because a compile error ends the compile with exit and
+ * nothing a compile allocates is freed: a worker that exits is replaced, and a
+ * worker retires after SERVER_WORKER_REQUESTS requests so its memory stays bounded.
+ *
+ * A request is the client's working directory and arguments, its standard input,
+ * output and error come along as file descriptors so the worker prints straight
+ * to them. The answer is the exit status, a connection closed without one means
+ * the compile exited.
+ *
+ * Only the user's own processes are talked to. The default socket is in a directory
+ * only the user can get into, and both ends check who the process at the other end
+ * of the connection runs as before sending anything.
+ */
+
+#define SERVER_PROTOCOL_VERSION 1
+#define SERVER_WORKER_REQUESTS 256
+#define SERVER_MAX_REQUEST (1 << 20)
+// the worker won't run the command line, the client has to run it itself
+#define SERVER_STATUS_DECLINED -2
+
+struct server_request
+{
+    uint32_t version;
+    uint32_t argc;
+    // bytes of the working directory and arguments that follow, each one ends with a zero
+    uint32_t size;
+};
+
+static volatile sig_atomic_t server_stopping = 0;
+
+/**
+ * True if the file at path is of the type and belongs to the user, a directory
+ * must not be open to anyone else either
+ */
+static bool server_owned(const char *path, mode_t type)
+{
+    struct stat info;
+    if (lstat(path, &info) != 0 || (info.st_mode & S_IFMT) != type || info.st_uid != getuid())
+    {
+        return false;
+    }
+    return type != S_IFDIR || !(info.st_mode & 0077);
+}
+
+/**
+ * $ZEZE_SERVER, else zeze.sock in $XDG_RUNTIME_DIR, else server.sock in a directory
+ * /tmp/zeze-<uid> that is made only the user can get into. NULL when that directory
+ * belongs to someone else or is open to them
+ */
+const char *server_default_socket()
+{
+    static char path[108];
+    const char *env = getenv("ZEZE_SERVER");
+    if (env && env[0])
+    {
+        return env;
+    }
+
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+    if (runtime && runtime[0])
+    {
+        snprintf(path, sizeof(path), "%s/zeze.sock", runtime);
+        return path;
+    }
+
+    char directory[64];
+    snprintf(directory, sizeof(directory), "/tmp/zeze-%d", (int)getuid());
+    mkdir(directory, 0700);
+    if (!server_owned(directory, S_IFDIR))
+    {
+        return NULL;
+    }
+
+    snprintf(path, sizeof(path), "%s/server.sock", directory);
+    return path;
+}
+
+/**
+ * True if the process at the other end of the connection runs as the user
+ */
+static bool server_peer_is_user(int connection)
+{
+    struct ucred credentials;
+    socklen_t size = sizeof(credentials);
+    return getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &credentials, &size) == 0 && credentials.uid == getuid();
+}
+
+static bool server_address(const char *socket_path, struct sockaddr_un *address)
+{
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+    if (!socket_path || strlen(socket_path) >= sizeof(address->sun_path))
+    {
+        return false;
+    }
+
+    strcpy(address->sun_path, socket_path);
+    return true;
+}
+
+static bool server_read_all(int fd, void *data, size_t size)
+{
+    char *ptr = data;
+    while (size)
+    {
+        ssize_t res = read(fd, ptr, size);
+        if (res < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (res <= 0)
+        {
+            return false;
+        }
+        ptr += res;
+        size -= res;
+    }
+    return true;
+}
+
+static bool server_write_all(int fd, const void *data, size_t size)
+{
+    const char *ptr = data;
+    while (size)
+    {
+        // a peer that went away is an error here, not SIGPIPE
+        ssize_t res = send(fd, ptr, size, MSG_NOSIGNAL);
+        if (res < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (res <= 0)
+        {
+            return false;
+        }
+        ptr += res;
+        size -= res;
+    }
+    return true;
+}
+
+/**
+ * Commands that have to run in the client's own process, the program --run and
+ * --interpret start would take the worker down with it
+ */
+static bool server_declines(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (S_EQ(argv[i], "--run") || S_EQ(argv[i], "--interpret") || S_EQ(argv[i], "--server"))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Reads one request, runs it with the client's descriptors as standard input,
+ * output and error and answers with the exit status
+ */
+static void server_serve(int connection, SERVER_COMMAND command, int null)
+{
+    struct server_request request;
+    int fds[3] = {-1, -1, -1};
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = {.iov_base = &request, .iov_len = sizeof(request)};
+    struct msghdr message = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control)};
+    ssize_t received = recvmsg(connection, &message, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    if (header && header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS && header->cmsg_len == CMSG_LEN(sizeof(fds)))
+    {
+        memcpy(fds, CMSG_DATA(header), sizeof(fds));
+    }
+
+    char *data = NULL;
+    char **argv = NULL;
+    int status = SERVER_STATUS_DECLINED;
+    if (received != sizeof(request) || request.version != SERVER_PROTOCOL_VERSION || fds[2] < 0 || request.size > SERVER_MAX_REQUEST ||
+        request.argc == 0 || request.argc > request.size || !server_peer_is_user(connection))
+    {
+        goto out;
+    }
+
+    data = malloc(request.size + 1);
+    if (!server_read_all(connection, data, request.size))
+    {
+        goto out;
+    }
+    data[request.size] = 0x00;
+
+    // the working directory comes first, then the arguments
+    argv = calloc(request.argc + 1, sizeof(char *));
+    char *ptr = data;
+    char *end = data + request.size;
+    const char *directory = ptr;
+    ptr += strlen(ptr) + 1;
+    for (uint32_t i = 0; i < request.argc; i++)
+    {
+        if (ptr >= end)
+        {
+            goto out;
+        }
+        argv[i] = ptr;
+        ptr += strlen(ptr) + 1;
+    }
+
+    if (server_declines(request.argc, argv) || chdir(directory) != 0)
+    {
+        goto out;
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        dup2(fds[i], i);
+    }
+    status = command(request.argc, argv);
+    fflush(stdout);
+    fflush(stderr);
+
+    // let go of the client's terminal or pipes, whoever reads them is waiting for the end
+    for (int i = 0; i < 3; i++)
+    {
+        dup2(null, i);
+    }
+
+out:
+    for (int i = 0; i < 3; i++)
+    {
+        if (fds[i] >= 0)
+        {
+            close(fds[i]);
+        }
+    }
+    int32_t answer = status;
+    server_write_all(connection, &answer, sizeof(answer));
+    free(argv);
+    free(data);
+}
+
+static void server_worker(int listener, SERVER_COMMAND command)
+{
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    int null = open("/dev/null", O_RDWR | O_CLOEXEC);
+    for (int i = 0; i < 3; i++)
+    {
+        dup2(null, i);
+    }
+
+    int served = 0;
+    while (served < SERVER_WORKER_REQUESTS)
+    {
+        int connection = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (connection < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            _exit(1);
+        }
+
+        server_serve(connection, command, null);
+        close(connection);
+        served++;
+    }
+    exit(0);
+}
+
+static pid_t server_spawn(int listener, SERVER_COMMAND command)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        server_worker(listener, command);
+    }
+    return pid;
+}
+
+static void server_stop(int number)
+{
+    server_stopping = 1;
+}
+
+/**
+ * Listens on the socket until SIGTERM or SIGINT, returns non zero if it can't
+ */
+int server_run(const char *socket_path, int workers, SERVER_COMMAND command)
+{
+    struct sockaddr_un address;
+    if (!socket_path)
+    {
+        fprintf(stderr, "/tmp/zeze-%d belongs to someone else or is open to them, give the socket instead\n", (int)getuid());
+        return 1;
+    }
+
+    if (!server_address(socket_path, &address))
+    {
+        fprintf(stderr, "Socket path %s is too long\n", socket_path);
+        return 1;
+    }
+
+    // a socket file nobody answers on is left over from a server that died
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (connect(listener, (struct sockaddr *)&address, sizeof(address)) == 0)
+    {
+        fprintf(stderr, "A server is already listening on %s\n", socket_path);
+        close(listener);
+        return 1;
+    }
+    close(listener);
+    unlink(socket_path);
+
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    mode_t mask = umask(0077);
+    bool bound = bind(listener, (struct sockaddr *)&address, sizeof(address)) == 0;
+    umask(mask);
+    if (!bound || listen(listener, 128) != 0)
+    {
+        fprintf(stderr, "Cannot listen on %s\n", socket_path);
+        close(listener);
+        return 1;
+    }
+
+    struct sigaction action = {.sa_handler = server_stop};
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+    // a client that goes away mid request must not kill the worker
+    signal(SIGPIPE, SIG_IGN);
+
+    workers = workers > 0 ? workers : 1;
+    pid_t *pids = calloc(workers, sizeof(pid_t));
+    for (int i = 0; i < workers; i++)
+    {
+        pids[i] = server_spawn(listener, command);
+    }
+
+    while (!server_stopping)
+    {
+        pid_t pid = wait(NULL);
+        if (pid < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+
+        for (int i = 0; i < workers; i++)
+        {
+            if (pids[i] == pid && !server_stopping)
+            {
+                pids[i] = server_spawn(listener, command);
+            }
+        }
+    }
+
+    for (int i = 0; i < workers; i++)
+    {
+        if (pids[i] > 0)
+        {
+            kill(pids[i], SIGTERM);
+        }
+    }
+    while (wait(NULL) > 0 || errno == EINTR)
+    {
+    }
+
+    close(listener);
+    unlink(socket_path);
+    free(pids);
+    return 0;
+}
+
+/**
+ * Runs the command line in the server as if this process ran it, returns its exit
+ * status or SERVER_NOT_SERVED when no server took it
+ */
+int server_forward(const char *socket_path, int argc, char **argv)
+{
+    struct sockaddr_un address;
+    char directory[PATH_MAX];
+    if (!server_address(socket_path, &address) || !getcwd(directory, sizeof(directory)))
+    {
+        return SERVER_NOT_SERVED;
+    }
+
+    // the working directory, the arguments and the descriptors only go to a server
+    // of the user's own
+    if (!server_owned(socket_path, S_IFSOCK))
+    {
+        return SERVER_NOT_SERVED;
+    }
+
+    int connection = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (connection < 0 || connect(connection, (struct sockaddr *)&address, sizeof(address)) != 0 || !server_peer_is_user(connection))
+    {
+        close(connection);
+        return SERVER_NOT_SERVED;
+    }
+
+    size_t size = strlen(directory) + 1;
+    for (int i = 0; i < argc; i++)
+    {
+        size += strlen(argv[i]) + 1;
+    }
+
+    char *data = malloc(size);
+    char *ptr = stpcpy(data, directory) + 1;
+    for (int i = 0; i < argc; i++)
+    {
+        ptr = stpcpy(ptr, argv[i]) + 1;
+    }
+
+    struct server_request request = {.version = SERVER_PROTOCOL_VERSION, .argc = argc, .size = size};
+    int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {.iov_base = &request, .iov_len = sizeof(request)};
+    struct msghdr message = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control)};
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(header), fds, sizeof(fds));
+
+    // our output has to be out before the worker starts writing to the same descriptors
+    fflush(stdout);
+    fflush(stderr);
+    int32_t status = SERVER_STATUS_DECLINED;
+    bool sent = sendmsg(connection, &message, MSG_NOSIGNAL) == sizeof(request) && server_write_all(connection, data, size);
+    free(data);
+    if (!sent)
+    {
+        close(connection);
+        return SERVER_NOT_SERVED;
+    }
+
+    // compiler_error exits with -1, the worker is gone before it can answer
+    if (!server_read_all(connection, &status, sizeof(status)))
+    {
+        status = 255;
+    }
+    close(connection);
+    return status == SERVER_STATUS_DECLINED ? SERVER_NOT_SERVED : status;
+}
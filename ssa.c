@@ -0,0 +1,792 @@
+#include "compiler.h"
+#include "helpers/vector.h"
+#include <stdlib.h>
+
+/**
+ * Puts a function built with stack slots into SSA form. Slots that are only
+ * loaded and stored as a whole become SSA values with phis placed on the
+ * iterated dominance frontiers of their stores (Cytron et al.) where the slot
+ * is live, dominators come from Lengauer-Tarjan
+ */
+struct ssa
+{
+    struct ir_function *function;
+    uint32_t block_count;
+
+    // depth first numbering, dfnum is 0 for blocks that were not reached
+    uint32_t *dfnum;
+    uint32_t *vertex;
+    uint32_t *parent;
+    uint32_t *semi;
+    uint32_t *ancestor;
+    uint32_t *best;
+    uint32_t *samedom;
+    uint32_t *bucket;
+    uint32_t *bucket_next;
+    uint32_t *path;
+    uint32_t count;
+
+    // children of each block in the dominator tree
+    uint32_t *first_child;
+    uint32_t *next_sibling;
+
+    // dominance frontiers as lists of struct ssa_frontier
+    uint32_t *frontier;
+    struct vector *frontiers;
+
+    // variable of each promotable stack slot, by instruction index
+    uint32_t *variables;
+    uint32_t instruction_count;
+    uint32_t *slots;
+    int *variable_types;
+    uint32_t variable_count;
+
+    // value each variable has at the point of renaming and the values it replaced
+    uint32_t *current;
+    struct vector *undo;
+    // zero constants of the entry block that stand in for undefined values, by type
+    uint32_t undefined[IR_TYPE_I64 + 1];
+};
+
+struct ssa_frontier
+{
+    uint32_t block;
+    uint32_t next;
+};
+
+struct ssa_undo
+{
+    uint32_t variable;
+    uint32_t value;
+};
+
+static void ssa_create_tree(struct ssa *ssa)
+{
+    uint32_t count = ssa->block_count;
+    ssa->dfnum = calloc(count, sizeof(uint32_t));
+    ssa->vertex = calloc(count + 1, sizeof(uint32_t));
+    ssa->parent = calloc(count, sizeof(uint32_t));
+    ssa->semi = calloc(count, sizeof(uint32_t));
+    ssa->ancestor = calloc(count, sizeof(uint32_t));
+    ssa->best = calloc(count, sizeof(uint32_t));
+    ssa->samedom = calloc(count, sizeof(uint32_t));
+    ssa->bucket = calloc(count, sizeof(uint32_t));
+    ssa->bucket_next = calloc(count, sizeof(uint32_t));
+    ssa->path = calloc(count, sizeof(uint32_t));
+    ssa->first_child = calloc(count, sizeof(uint32_t));
+    ssa->next_sibling = calloc(count, sizeof(uint32_t));
+}
+
+static void ssa_free_tree(struct ssa *ssa)
+{
+    free(ssa->dfnum);
+    free(ssa->vertex);
+    free(ssa->parent);
+    free(ssa->semi);
+    free(ssa->ancestor);
+    free(ssa->best);
+    free(ssa->samedom);
+    free(ssa->bucket);
+    free(ssa->bucket_next);
+    free(ssa->path);
+    free(ssa->first_child);
+    free(ssa->next_sibling);
+}
+
+static void ssa_number(struct ssa *ssa)
+{
+    struct ir_function *function = ssa->function;
+    // each entry is a block and the successor to look at next
+    uint32_t *stack = malloc(sizeof(uint32_t) * ssa->block_count * 2);
+    uint32_t top = 0;
+    ssa->dfnum[1] = ++ssa->count;
+    ssa->vertex[ssa->count] = 1;
+    stack[top++] = 1;
+    stack[top++] = 0;
+    while (top)
+    {
+        uint32_t block = stack[top - 2];
+        uint32_t s = stack[top - 1];
+        if (s == 2)
+        {
+            top -= 2;
+            continue;
+        }
+
+        stack[top - 1]++;
+        uint32_t successor = function->blocks[block].successors[s];
+        if (successor == IR_NONE || ssa->dfnum[successor])
+        {
+            continue;
+        }
+
+        ssa->dfnum[successor] = ++ssa->count;
+        ssa->vertex[ssa->count] = successor;
+        ssa->parent[successor] = block;
+        stack[top++] = successor;
+        stack[top++] = 0;
+    }
+    free(stack);
+}
+
+/**
+ * Ancestor of the block in the forest with the lowest semidominator, compresses the path on the way
+ */
+static uint32_t ssa_lowest_ancestor(struct ssa *ssa, uint32_t block)
+{
+    uint32_t length = 0;
+    uint32_t top = block;
+    while (ssa->ancestor[ssa->ancestor[top]] != IR_NONE)
+    {
+        ssa->path[length++] = top;
+        top = ssa->ancestor[top];
+    }
+
+    while (length)
+    {
+        uint32_t node = ssa->path[--length];
+        uint32_t ancestor = ssa->ancestor[node];
+        uint32_t lowest = ssa->best[ancestor];
+        ssa->ancestor[node] = ssa->ancestor[ancestor];
+        if (ssa->dfnum[ssa->semi[lowest]] < ssa->dfnum[ssa->semi[ssa->best[node]]])
+        {
+            ssa->best[node] = lowest;
+        }
+    }
+    return ssa->best[block];
+}
+
+static void ssa_dominators(struct ssa *ssa)
+{
+    struct ir_function *function = ssa->function;
+    ssa_number(ssa);
+    for (uint32_t i = ssa->count; i >= 2; i--)
+    {
+        uint32_t block = ssa->vertex[i];
+        uint32_t parent = ssa->parent[block];
+        uint32_t semi = parent;
+        struct ir_block *target = &function->blocks[block];
+        for (uint32_t p = 0; p < target->pred_count; p++)
+        {
+            uint32_t pred = function->preds[target->preds + p];
+            if (!ssa->dfnum[pred])
+            {
+                continue;
+            }
+
+            uint32_t candidate = ssa->dfnum[pred] <= ssa->dfnum[block] ? pred : ssa->semi[ssa_lowest_ancestor(ssa, pred)];
+            if (ssa->dfnum[candidate] < ssa->dfnum[semi])
+            {
+                semi = candidate;
+            }
+        }
+
+        ssa->semi[block] = semi;
+        ssa->bucket_next[block] = ssa->bucket[semi];
+        ssa->bucket[semi] = block;
+        ssa->ancestor[block] = parent;
+        ssa->best[block] = block;
+
+        for (uint32_t v = ssa->bucket[parent]; v != IR_NONE; v = ssa->bucket_next[v])
+        {
+            uint32_t lowest = ssa_lowest_ancestor(ssa, v);
+            if (ssa->semi[lowest] == ssa->semi[v])
+            {
+                function->blocks[v].idom = parent;
+            }
+            else
+            {
+                ssa->samedom[v] = lowest;
+            }
+        }
+        ssa->bucket[parent] = IR_NONE;
+    }
+
+    function->blocks[1].idom = IR_NONE;
+    for (uint32_t i = 2; i <= ssa->count; i++)
+    {
+        uint32_t block = ssa->vertex[i];
+        if (ssa->samedom[block] != IR_NONE)
+        {
+            function->blocks[block].idom = function->blocks[ssa->samedom[block]].idom;
+        }
+    }
+
+    // children are linked in reverse so the tree walk visits them in depth first order
+    for (uint32_t i = ssa->count; i >= 2; i--)
+    {
+        uint32_t block = ssa->vertex[i];
+        uint32_t idom = function->blocks[block].idom;
+        ssa->next_sibling[block] = ssa->first_child[idom];
+        ssa->first_child[idom] = block;
+    }
+}
+
+/**
+ * Sets blocks[].idom again after passes that changed the control flow graph,
+ * the predecessors must be up to date
+ */
+void ssa_compute_dominators(struct ir_function *function)
+{
+    struct ssa ssa = {.function = function, .block_count = function->block_count};
+    ssa_create_tree(&ssa);
+    ssa_dominators(&ssa);
+    ssa_free_tree(&ssa);
+}
+
+/**
+ * Adds the loop nesting depth of every block to depths, from the natural loops
+ * of the back edges. Needs current predecessors and dominators
+ */
+void ssa_loop_depths(struct ir_function *function, uint32_t *depths)
+{
+    uint32_t count = function->block_count;
+    // dominator tree numbering, a dominates b when b's interval nests in a's
+    uint32_t *first_child = calloc(count, sizeof(uint32_t));
+    uint32_t *next_sibling = calloc(count, sizeof(uint32_t));
+    uint32_t *enter = calloc(count, sizeof(uint32_t));
+    uint32_t *leave = calloc(count, sizeof(uint32_t));
+    for (uint32_t block = count; block-- > 2;)
+    {
+        if (function->blocks[block].flags & IR_BLOCK_FLAG_DEAD)
+        {
+            continue;
+        }
+        uint32_t idom = function->blocks[block].idom;
+        next_sibling[block] = first_child[idom];
+        first_child[idom] = block;
+    }
+
+    uint32_t *stack = malloc(sizeof(uint32_t) * count);
+    uint32_t top = 0;
+    uint32_t clock = 1;
+    stack[top++] = 1;
+    while (top)
+    {
+        uint32_t block = stack[top - 1];
+        if (!enter[block])
+        {
+            enter[block] = clock++;
+            for (uint32_t child = first_child[block]; child != IR_NONE; child = next_sibling[child])
+            {
+                stack[top++] = child;
+            }
+            continue;
+        }
+        if (!leave[block])
+        {
+            leave[block] = clock++;
+        }
+        top--;
+    }
+
+    uint32_t *mark = calloc(count, sizeof(uint32_t));
+    for (uint32_t header = 1; header < count; header++)
+    {
+        struct ir_block *block = &function->blocks[header];
+        if (block->flags & IR_BLOCK_FLAG_DEAD)
+        {
+            continue;
+        }
+        for (uint32_t p = 0; p < block->pred_count; p++)
+        {
+            uint32_t latch = function->preds[block->preds + p];
+            if (!enter[latch] || enter[latch] < enter[header] || leave[latch] > leave[header])
+            {
+                continue;
+            }
+
+            // the blocks that reach the latch without going through the header
+            top = 0;
+            if (mark[header] != header)
+            {
+                mark[header] = header;
+                depths[header]++;
+            }
+            if (mark[latch] != header)
+            {
+                mark[latch] = header;
+                depths[latch]++;
+                stack[top++] = latch;
+            }
+            while (top)
+            {
+                struct ir_block *body = &function->blocks[stack[--top]];
+                for (uint32_t q = 0; q < body->pred_count; q++)
+                {
+                    uint32_t pred = function->preds[body->preds + q];
+                    if (mark[pred] != header)
+                    {
+                        mark[pred] = header;
+                        depths[pred]++;
+                        stack[top++] = pred;
+                    }
+                }
+            }
+        }
+    }
+
+    free(first_child);
+    free(next_sibling);
+    free(enter);
+    free(leave);
+    free(stack);
+    free(mark);
+}
+
+static void ssa_frontiers(struct ssa *ssa)
+{
+    struct ir_function *function = ssa->function;
+    // the last block added to each frontier, joins are visited once so that is enough to avoid duplicates
+    uint32_t *last = calloc(ssa->block_count, sizeof(uint32_t));
+    for (uint32_t block = 1; block < ssa->block_count; block++)
+    {
+        struct ir_block *target = &function->blocks[block];
+        if (target->pred_count < 2 || !ssa->dfnum[block])
+        {
+            continue;
+        }
+
+        for (uint32_t p = 0; p < target->pred_count; p++)
+        {
+            uint32_t runner = function->preds[target->preds + p];
+            while (runner != IR_NONE && runner != target->idom && last[runner] != block)
+            {
+                struct ssa_frontier entry = {.block = block, .next = ssa->frontier[runner]};
+                last[runner] = block;
+                ssa->frontier[runner] = vector_count(ssa->frontiers);
+                vector_push(ssa->frontiers, &entry);
+                runner = function->blocks[runner].idom;
+            }
+        }
+    }
+    free(last);
+}
+
+/**
+ * A slot can be promoted if every use loads or stores the whole slot with one type
+ */
+static bool ssa_is_promotable(struct ssa *ssa, uint32_t slot, int *type)
+{
+    struct ir_function *function = ssa->function;
+    *type = IR_TYPE_VOID;
+    for (uint32_t use = function->instructions[slot].first_use; use != IR_NONE; use = function->uses[use].next)
+    {
+        uint32_t user = function->uses[use].user;
+        struct ir_instruction *instruction = &function->instructions[user];
+        uint32_t position = use - instruction->operands;
+        int value_type;
+        if (instruction->op == IR_LOAD)
+        {
+            value_type = instruction->type;
+        }
+        else if (instruction->op == IR_STORE && position == 0)
+        {
+            value_type = function->instructions[ir_operand(function, user, 1)].type;
+        }
+        else
+        {
+            return false;
+        }
+
+        if (*type != IR_TYPE_VOID && value_type != *type)
+        {
+            return false;
+        }
+        *type = value_type;
+    }
+    return *type != IR_TYPE_VOID && ir_type_size(*type) == function->instructions[slot].constant;
+}
+
+static void ssa_find_variables(struct ssa *ssa)
+{
+    struct ir_function *function = ssa->function;
+    struct vector *slots = vector_create(sizeof(uint32_t));
+    struct vector *types = vector_create(sizeof(int));
+    uint32_t none = IR_NONE;
+    int type = IR_TYPE_VOID;
+    vector_push(slots, &none);
+    vector_push(types, &type);
+    for (uint32_t index = function->blocks[1].first; index != IR_NONE; index = function->instructions[index].next)
+    {
+        if (function->instructions[index].op == IR_ALLOCA && ssa_is_promotable(ssa, index, &type))
+        {
+            ssa->variables[index] = vector_count(slots);
+            vector_push(slots, &index);
+            vector_push(types, &type);
+        }
+    }
+
+    ssa->variable_count = vector_count(slots);
+    ssa->slots = malloc(sizeof(uint32_t) * ssa->variable_count);
+    ssa->variable_types = malloc(sizeof(int) * ssa->variable_count);
+    memcpy(ssa->slots, vector_data_ptr(slots), sizeof(uint32_t) * ssa->variable_count);
+    memcpy(ssa->variable_types, vector_data_ptr(types), sizeof(int) * ssa->variable_count);
+    vector_free(slots);
+    vector_free(types);
+}
+
+/**
+ * Phis start with no operands filled in, aux holds their variable until renaming is done
+ */
+static void ssa_insert_phi(struct ssa *ssa, uint32_t block, uint32_t variable)
+{
+    struct ir_function *function = ssa->function;
+    struct ir_block *target = &function->blocks[block];
+    int type = ssa->variable_types[variable];
+    uint32_t phi = target->first != IR_NONE ? ir_insert_before(function, target->first, IR_PHI, type, target->pred_count)
+                                            : ir_append(function, block, IR_PHI, type, target->pred_count);
+    function->instructions[phi].aux = variable;
+}
+
+/**
+ * Variable whose slot the address refers to, 0 for any other address
+ */
+static uint32_t ssa_variable(struct ssa *ssa, uint32_t address)
+{
+    // phis and constants added since the slots were numbered are never slots
+    return address < ssa->instruction_count ? ssa->variables[address] : 0;
+}
+
+/**
+ * Marks the loads that read a slot before the block they are in stores to it, only
+ * those read a value that comes from another block
+ */
+static bool *ssa_exposed_loads(struct ssa *ssa)
+{
+    struct ir_function *function = ssa->function;
+    bool *exposed = calloc(ssa->instruction_count, sizeof(bool));
+    // the block that stored to each variable last
+    uint32_t *stored = calloc(ssa->variable_count, sizeof(uint32_t));
+    for (uint32_t block = 1; block < ssa->block_count; block++)
+    {
+        for (uint32_t index = function->blocks[block].first; index != IR_NONE; index = function->instructions[index].next)
+        {
+            struct ir_instruction *instruction = &function->instructions[index];
+            if (instruction->op != IR_LOAD && instruction->op != IR_STORE)
+            {
+                continue;
+            }
+
+            uint32_t variable = ssa_variable(ssa, ir_operand(function, index, 0));
+            if (!variable)
+            {
+                continue;
+            }
+            if (instruction->op == IR_STORE)
+            {
+                stored[variable] = block;
+            }
+            else if (stored[variable] != block)
+            {
+                exposed[index] = true;
+            }
+        }
+    }
+    free(stored);
+    return exposed;
+}
+
+/**
+ * Pruned SSA, a variable only gets phis on the iterated dominance frontier of its
+ * stores where it is live. Without the liveness check every temporary of a nested
+ * ?: would get a phi at each of the joins around it
+ */
+static void ssa_place_phis(struct ssa *ssa)
+{
+    struct ir_function *function = ssa->function;
+    bool *exposed = ssa_exposed_loads(ssa);
+    uint32_t *has_phi = calloc(ssa->block_count, sizeof(uint32_t));
+    uint32_t *queued = calloc(ssa->block_count, sizeof(uint32_t));
+    uint32_t *stores = calloc(ssa->block_count, sizeof(uint32_t));
+    uint32_t *live = calloc(ssa->block_count, sizeof(uint32_t));
+    uint32_t *worklist = malloc(sizeof(uint32_t) * ssa->block_count);
+    struct ssa_frontier *frontiers = vector_data_ptr(ssa->frontiers);
+    for (uint32_t variable = 1; variable < ssa->variable_count; variable++)
+    {
+        // the variable is live into the blocks that read it first and, going back
+        // from them, into every block that reaches them without storing to it
+        uint32_t count = 0;
+        for (uint32_t use = function->instructions[ssa->slots[variable]].first_use; use != IR_NONE; use = function->uses[use].next)
+        {
+            struct ir_instruction *user = &function->instructions[function->uses[use].user];
+            if (user->op == IR_STORE)
+            {
+                stores[user->block] = variable;
+            }
+        }
+        for (uint32_t use = function->instructions[ssa->slots[variable]].first_use; use != IR_NONE; use = function->uses[use].next)
+        {
+            uint32_t user = function->uses[use].user;
+            uint32_t block = function->instructions[user].block;
+            if (exposed[user] && live[block] != variable)
+            {
+                live[block] = variable;
+                worklist[count++] = block;
+            }
+        }
+        while (count)
+        {
+            struct ir_block *target = &function->blocks[worklist[--count]];
+            for (uint32_t p = 0; p < target->pred_count; p++)
+            {
+                uint32_t pred = function->preds[target->preds + p];
+                if (ssa->dfnum[pred] && stores[pred] != variable && live[pred] != variable)
+                {
+                    live[pred] = variable;
+                    worklist[count++] = pred;
+                }
+            }
+        }
+
+        for (uint32_t use = function->instructions[ssa->slots[variable]].first_use; use != IR_NONE; use = function->uses[use].next)
+        {
+            struct ir_instruction *user = &function->instructions[function->uses[use].user];
+            if (user->op == IR_STORE && queued[user->block] != variable)
+            {
+                queued[user->block] = variable;
+                worklist[count++] = user->block;
+            }
+        }
+
+        while (count)
+        {
+            uint32_t block = worklist[--count];
+            for (uint32_t entry = ssa->frontier[block]; entry != IR_NONE; entry = frontiers[entry].next)
+            {
+                uint32_t join = frontiers[entry].block;
+                if (has_phi[join] == variable || live[join] != variable)
+                {
+                    continue;
+                }
+
+                ssa_insert_phi(ssa, join, variable);
+                has_phi[join] = variable;
+                if (queued[join] != variable)
+                {
+                    queued[join] = variable;
+                    worklist[count++] = join;
+                }
+            }
+        }
+    }
+    free(exposed);
+    free(has_phi);
+    free(queued);
+    free(stores);
+    free(live);
+    free(worklist);
+}
+
+static uint32_t ssa_undefined(struct ssa *ssa, int type)
+{
+    if (ssa->undefined[type] == IR_NONE)
+    {
+        struct ir_function *function = ssa->function;
+        ssa->undefined[type] = ir_insert_before(function, function->blocks[1].first, IR_CONST, type, 0);
+    }
+    return ssa->undefined[type];
+}
+
+static uint32_t ssa_current(struct ssa *ssa, uint32_t variable)
+{
+    uint32_t value = ssa->current[variable];
+    return value != IR_NONE ? value : ssa_undefined(ssa, ssa->variable_types[variable]);
+}
+
+static void ssa_define(struct ssa *ssa, uint32_t variable, uint32_t value)
+{
+    struct ssa_undo undo = {.variable = variable, .value = ssa->current[variable]};
+    vector_push(ssa->undo, &undo);
+    ssa->current[variable] = value;
+}
+
+static void ssa_rename_block(struct ssa *ssa, uint32_t block)
+{
+    struct ir_function *function = ssa->function;
+    uint32_t index = function->blocks[block].first;
+    while (index != IR_NONE)
+    {
+        uint32_t next = function->instructions[index].next;
+        struct ir_instruction *instruction = &function->instructions[index];
+        if (instruction->op == IR_PHI && instruction->aux)
+        {
+            ssa_define(ssa, instruction->aux, index);
+        }
+        else if (instruction->op == IR_LOAD && ssa_variable(ssa, ir_operand(function, index, 0)))
+        {
+            uint32_t value = ssa_current(ssa, ssa_variable(ssa, ir_operand(function, index, 0)));
+            ir_replace_uses(function, index, value);
+            ir_remove(function, index);
+        }
+        else if (instruction->op == IR_STORE && ssa_variable(ssa, ir_operand(function, index, 0)))
+        {
+            ssa_define(ssa, ssa_variable(ssa, ir_operand(function, index, 0)), ir_operand(function, index, 1));
+            ir_remove(function, index);
+        }
+        index = next;
+    }
+
+    struct ir_block *target = &function->blocks[block];
+    for (int s = 0; s < 2; s++)
+    {
+        uint32_t successor = target->successors[s];
+        if (successor == IR_NONE || (s == 1 && successor == target->successors[0]))
+        {
+            continue;
+        }
+
+        struct ir_block *next = &function->blocks[successor];
+        for (uint32_t phi = next->first; phi != IR_NONE && function->instructions[phi].op == IR_PHI; phi = function->instructions[phi].next)
+        {
+            uint32_t variable = function->instructions[phi].aux;
+            if (!variable)
+            {
+                continue;
+            }
+
+            for (uint32_t p = 0; p < next->pred_count; p++)
+            {
+                if (function->preds[next->preds + p] == block)
+                {
+                    ir_set_operand(function, phi, p, ssa_current(ssa, variable));
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Walks the dominator tree, each block sees the values of the blocks that dominate it
+ */
+static void ssa_rename(struct ssa *ssa)
+{
+    // each entry is a block, the child visited last and the size of the undo log before the block
+    uint32_t *stack = malloc(sizeof(uint32_t) * ssa->block_count * 3);
+    uint32_t top = 0;
+    stack[top++] = 1;
+    stack[top++] = IR_NONE;
+    stack[top++] = 0;
+    ssa_rename_block(ssa, 1);
+    while (top)
+    {
+        uint32_t block = stack[top - 3];
+        uint32_t visited = stack[top - 2];
+        uint32_t child = visited == IR_NONE ? ssa->first_child[block] : ssa->next_sibling[visited];
+        if (child == IR_NONE)
+        {
+            // the values the block defined are not visible in its siblings
+            uint32_t size = stack[top - 1];
+            while (vector_count(ssa->undo) > size)
+            {
+                struct ssa_undo *undo = vector_back(ssa->undo);
+                ssa->current[undo->variable] = undo->value;
+                vector_pop(ssa->undo);
+            }
+            top -= 3;
+            continue;
+        }
+
+        stack[top - 2] = child;
+        stack[top++] = child;
+        stack[top++] = IR_NONE;
+        stack[top++] = vector_count(ssa->undo);
+        ssa_rename_block(ssa, child);
+    }
+    free(stack);
+}
+
+/**
+ * Phis of variables that are never read again are removed, which can leave other phis unused
+ */
+static void ssa_remove_dead_phis(struct ssa *ssa)
+{
+    struct ir_function *function = ssa->function;
+    struct vector *worklist = vector_create(sizeof(uint32_t));
+    for (uint32_t index = 1; index < function->instruction_count; index++)
+    {
+        struct ir_instruction *instruction = &function->instructions[index];
+        if (instruction->op == IR_PHI && instruction->first_use == IR_NONE)
+        {
+            vector_push(worklist, &index);
+        }
+    }
+
+    struct vector *operands = vector_create(sizeof(uint32_t));
+    while (vector_count(worklist))
+    {
+        uint32_t phi = *(uint32_t *)vector_back(worklist);
+        vector_pop(worklist);
+        if (function->instructions[phi].op != IR_PHI || function->instructions[phi].first_use != IR_NONE)
+        {
+            continue;
+        }
+
+        vector_clear(operands);
+        for (uint32_t i = 0; i < function->instructions[phi].operand_count; i++)
+        {
+            uint32_t value = ir_operand(function, phi, i);
+            vector_push(operands, &value);
+        }
+        ir_remove(function, phi);
+
+        uint32_t *values = vector_data_ptr(operands);
+        for (int i = 0; i < vector_count(operands); i++)
+        {
+            if (values[i] != IR_NONE && values[i] != phi && function->instructions[values[i]].op == IR_PHI && function->instructions[values[i]].first_use == IR_NONE)
+            {
+                vector_push(worklist, &values[i]);
+            }
+        }
+    }
+    vector_free(operands);
+    vector_free(worklist);
+
+    for (uint32_t index = 1; index < function->instruction_count; index++)
+    {
+        if (function->instructions[index].op == IR_PHI)
+        {
+            function->instructions[index].aux = 0;
+        }
+    }
+}
+
+void ssa_construct(struct ir_function *function)
+{
+    ir_remove_unreachable_blocks(function);
+    struct ssa ssa = {.function = function, .block_count = function->block_count};
+    uint32_t count = function->block_count;
+    ssa_create_tree(&ssa);
+    ssa.frontier = calloc(count, sizeof(uint32_t));
+    ssa.frontiers = vector_create(sizeof(struct ssa_frontier));
+    // entry 0 of the frontier lists stands for the end of a list
+    struct ssa_frontier end = {0};
+    vector_push(ssa.frontiers, &end);
+    ssa.instruction_count = function->instruction_count;
+    ssa.variables = calloc(ssa.instruction_count, sizeof(uint32_t));
+    ssa.undo = vector_create(sizeof(struct ssa_undo));
+
+    ssa_dominators(&ssa);
+    ssa_find_variables(&ssa);
+    if (ssa.variable_count > 1)
+    {
+        ssa_frontiers(&ssa);
+        ssa_place_phis(&ssa);
+        ssa.current = calloc(ssa.variable_count, sizeof(uint32_t));
+        ssa_rename(&ssa);
+        ssa_remove_dead_phis(&ssa);
+        for (uint32_t variable = 1; variable < ssa.variable_count; variable++)
+        {
+            ir_remove(function, ssa.slots[variable]);
+        }
+    }
+
+    ssa_free_tree(&ssa);
+    free(ssa.frontier);
+    vector_free(ssa.frontiers);
+    free(ssa.variables);
+    free(ssa.slots);
+    free(ssa.variable_types);
+    free(ssa.current);
+    vector_free(ssa.undo);
+}
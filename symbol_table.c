@@ -0,0 +1,151 @@
+#include "compiler.h"
+#include <stdlib.h>
+#include <assert.h>
+
+#define SYMBOL_TABLE_INITIAL_CAPACITY 256
+
+/**
+ * Names are interned so the slot of a name is found by hashing and comparing pointers
+ */
+static size_t symbol_table_hash(struct symbol_table *table, const char *name)
+{
+    // fibonacci hashing, the low bits of pointers are mostly alignment
+    uint64_t hash = (uint64_t)(uintptr_t)name * 0x9E3779B97F4A7C15ull;
+    return (size_t)(hash >> table->shift);
+}
+
+static struct symbol *symbol_table_slot(struct symbol_table *table, const char *name)
+{
+    size_t mask = table->capacity - 1;
+    size_t index = symbol_table_hash(table, name);
+    while (table->slots[index].name && table->slots[index].name != name)
+    {
+        index = (index + 1) & mask;
+    }
+    return &table->slots[index];
+}
+
+static void symbol_table_allocate(struct symbol_table *table, size_t capacity)
+{
+    table->capacity = capacity;
+    table->slots = calloc(capacity, sizeof(struct symbol));
+    table->shift = 64;
+    while (capacity > 1)
+    {
+        table->shift--;
+        capacity >>= 1;
+    }
+}
+
+struct symbol_table *symbol_table_create()
+{
+    struct symbol_table *table = calloc(1, sizeof(struct symbol_table));
+    symbol_table_allocate(table, SYMBOL_TABLE_INITIAL_CAPACITY);
+    return table;
+}
+
+void symbol_table_free(struct symbol_table *table)
+{
+    free(table->slots);
+    free(table->undo);
+    free(table->scopes);
+    free(table);
+}
+
+static void symbol_table_grow(struct symbol_table *table)
+{
+    struct symbol *old_slots = table->slots;
+    size_t old_capacity = table->capacity;
+    symbol_table_allocate(table, old_capacity * 2);
+    for (size_t i = 0; i < old_capacity; i++)
+    {
+        if (old_slots[i].name)
+        {
+            *symbol_table_slot(table, old_slots[i].name) = old_slots[i];
+        }
+    }
+    free(old_slots);
+}
+
+void symbol_table_enter_scope(struct symbol_table *table)
+{
+    if (table->depth == table->scopes_capacity)
+    {
+        table->scopes_capacity = table->scopes_capacity ? table->scopes_capacity * 2 : 64;
+        table->scopes = realloc(table->scopes, sizeof(size_t) * table->scopes_capacity);
+    }
+    table->scopes[table->depth++] = table->undo_count;
+}
+
+/**
+ * Puts back whatever the names declared in the scope hid, the cost is the amount
+ * of declarations made in the scope
+ */
+void symbol_table_leave_scope(struct symbol_table *table)
+{
+    assert(table->depth > 0);
+    size_t start = table->scopes[--table->depth];
+    while (table->undo_count > start)
+    {
+        struct symbol *undo = &table->undo[--table->undo_count];
+        *symbol_table_slot(table, undo->name) = *undo;
+    }
+}
+
+int symbol_table_depth(struct symbol_table *table)
+{
+    return table->depth;
+}
+
+/**
+ * Declares the name in the innermost scope, returns the node the name was already
+ * declared as in that same scope or NODE_NONE
+ */
+uint32_t symbol_table_declare(struct symbol_table *table, const char *name, uint32_t node)
+{
+    struct symbol *symbol = symbol_table_slot(table, name);
+    if (!symbol->name)
+    {
+        // names are never removed, a name that goes out of scope keeps its slot
+        // with NODE_NONE so the load factor only counts distinct names
+        if ((table->count + 1) * 4 > table->capacity * 3)
+        {
+            symbol_table_grow(table);
+            symbol = symbol_table_slot(table, name);
+        }
+        symbol->name = name;
+        symbol->node = NODE_NONE;
+        table->count++;
+    }
+
+    if (symbol->node != NODE_NONE && symbol->depth == table->depth)
+    {
+        uint32_t previous = symbol->node;
+        symbol->node = node;
+        return previous;
+    }
+
+    // the file scope is never left so it needs no undo entries
+    if (table->depth > 0)
+    {
+        if (table->undo_count == table->undo_capacity)
+        {
+            table->undo_capacity = table->undo_capacity ? table->undo_capacity * 2 : 256;
+            table->undo = realloc(table->undo, sizeof(struct symbol) * table->undo_capacity);
+        }
+        table->undo[table->undo_count++] = *symbol;
+    }
+
+    symbol->node = node;
+    symbol->depth = table->depth;
+    return NODE_NONE;
+}
+
+/**
+ * Returns the node the name refers to in the current scope, NODE_NONE if it's undeclared
+ */
+uint32_t symbol_table_lookup(struct symbol_table *table, const char *name)
+{
+    struct symbol *symbol = symbol_table_slot(table, name);
+    return symbol->name ? symbol->node : NODE_NONE;
+}
@@ -1,9 +1,26 @@
-50+20+10-50 ++ (100+20) [#]
-abs ccc aaa123 
-if while
-// comment
-/*
-asdf
-*/
-'a' 'c'
-0xABC1
\ No newline at end of file
+struct point
+{
+    int x;
+    int y;
+};
+
+int printf(const char *fmt, ...);
+
+int manhattan(struct point *a, struct point *b)
+{
+    int dx = a->x - b->x;
+    int dy = a->y - b->y;
+    return (dx < 0 ? -dx : dx) + (dy < 0 ? -dy : dy);
+}
+
+int main()
+{
+    struct point points[2] = {{1, 2}, {4, -2}};
+    int total = 0;
+    for (int i = 0; i < 10; i++)
+    {
+        total += manhattan(&points[0], &points[1]) * i;
+    }
+    printf("%d\n", total);
+    return 0;
+}
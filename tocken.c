@@ -1,5 +1,205 @@
 #include "compiler.h"
+#include "helpers/buffer.h"
+static const char *op_spellings[OP_TOTAL] = {
+    [OP_NONE] = "",
+    [OP_PLUS] = "+",
+    [OP_MINUS] = "-",
+    [OP_STAR] = "*",
+    [OP_SLASH] = "/",
+    [OP_PERCENT] = "%",
+    [OP_CARET] = "^",
+    [OP_AMPERSAND] = "&",
+    [OP_PIPE] = "|",
+    [OP_TILDE] = "~",
+    [OP_NOT] = "!",
+    [OP_LESS] = "<",
+    [OP_GREATER] = ">",
+    [OP_ASSIGN] = "=",
+    [OP_LPAREN] = "(",
+    [OP_LBRACKET] = "[",
+    [OP_COMMA] = ",",
+    [OP_DOT] = ".",
+    [OP_QUESTION] = "?",
+    [OP_PLUS_ASSIGN] = "+=",
+    [OP_MINUS_ASSIGN] = "-=",
+    [OP_MUL_ASSIGN] = "*=",
+    [OP_DIV_ASSIGN] = "/=",
+    [OP_MOD_ASSIGN] = "%=",
+    [OP_XOR_ASSIGN] = "^=",
+    [OP_AND_ASSIGN] = "&=",
+    [OP_OR_ASSIGN] = "|=",
+    [OP_SHIFT_LEFT] = "<<",
+    [OP_SHIFT_RIGHT] = ">>",
+    [OP_SHIFT_LEFT_ASSIGN] = "<<=",
+    [OP_SHIFT_RIGHT_ASSIGN] = ">>=",
+    [OP_LESS_EQUAL] = "<=",
+    [OP_GREATER_EQUAL] = ">=",
+    [OP_EQUAL] = "==",
+    [OP_NOT_EQUAL] = "!=",
+    [OP_LOGICAL_AND] = "&&",
+    [OP_LOGICAL_OR] = "||",
+    [OP_INCREMENT] = "++",
+    [OP_DECREMENT] = "--",
+    [OP_ARROW] = "->",
+    [OP_ELLIPSIS] = "...",
+    [OP_HASH_HASH] = "##",
+    [SYM_LBRACE] = "{",
+    [SYM_RBRACE] = "}",
+    [SYM_COLON] = ":",
+    [SYM_SEMICOLON] = ";",
+    [SYM_HASH] = "#",
+    [SYM_BACKSLASH] = "\\",
+    [SYM_RPAREN] = ")",
+    [SYM_RBRACKET] = "]"};
+
+const char *token_op_spelling(int op)
+{
+    return op_spellings[op];
+}
+
+int token_symbol_op(char c)
+{
+    switch (c)
+    {
+    case '{':
+        return SYM_LBRACE;
+    case '}':
+        return SYM_RBRACE;
+    case ':':
+        return SYM_COLON;
+    case ';':
+        return SYM_SEMICOLON;
+    case '#':
+        return SYM_HASH;
+    case '\\':
+        return SYM_BACKSLASH;
+    case ')':
+        return SYM_RPAREN;
+    case ']':
+        return SYM_RBRACKET;
+    }
+    return OP_NONE;
+}
+
 bool tocken_if_keyword(struct token *token, const char *value)
 {
-    return token->type == TOKEN_TYPE_KEYWORD && S_EQ(token->sval, value);
+    return token && token->type == TOKEN_TYPE_KEYWORD && S_EQ(token->sval, value);
+}
+
+bool token_is_identifier(struct token *token, const char *value)
+{
+    return token && token->type == TOKEN_TYPE_IDENTIFIER && S_EQ(token->sval, value);
+}
+
+bool token_is_symbol(struct token *token, char c)
+{
+    return token && token->type == TOKEN_TYPE_SYMBOL && token->cval == c;
+}
+
+bool token_is_operator(struct token *token, const char *value)
+{
+    return token && token->type == TOKEN_TYPE_OPERATOR && S_EQ(token->sval, value);
+}
+
+bool token_is_op(struct token *token, int op)
+{
+    return token && (token->type == TOKEN_TYPE_OPERATOR || token->type == TOKEN_TYPE_SYMBOL) && token->op == op;
+}
+
+bool token_is_nl_or_comment(struct token *token)
+{
+    return token && (token->type == TOKEN_TYPE_NEWLINE || token->type == TOKEN_TYPE_COMMENT);
+}
+
+/**
+ * Returns the bracket that closes this token, 0 if the token does not open a bracket
+ */
+char token_closing_bracket(struct token *token)
+{
+    if (token_is_op(token, OP_LPAREN))
+    {
+        return ')';
+    }
+    if (token_is_op(token, OP_LBRACKET))
+    {
+        return ']';
+    }
+    if (token_is_op(token, SYM_LBRACE))
+    {
+        return '}';
+    }
+    return 0;
+}
+
+bool token_is_closing_bracket(struct token *token)
+{
+    return token_is_op(token, SYM_RPAREN) || token_is_op(token, SYM_RBRACKET) || token_is_op(token, SYM_RBRACE);
+}
+
+/**
+ * Writes a character of a string literal the way it has to be spelled in one, the
+ * lexer decoded the escapes so they are written again
+ */
+static void token_write_string_char(struct buffer *buffer, char c, bool system)
+{
+    static const char escapes[] = {['\n'] = 'n', ['\t'] = 't', ['\r'] = 'r', ['\a'] = 'a', ['\b'] = 'b', ['\f'] = 'f', ['\v'] = 'v'};
+    if (system || (unsigned char)c >= 0x80 || (c >= ' ' && c != 0x7F && c != '"' && c != '\\'))
+    {
+        buffer_write(buffer, c);
+    }
+    else if (c == '"' || c == '\\')
+    {
+        buffer_write(buffer, '\\');
+        buffer_write(buffer, c);
+    }
+    else if (c >= 0 && c < (int)sizeof(escapes) && escapes[(int)c])
+    {
+        buffer_write(buffer, '\\');
+        buffer_write(buffer, escapes[(int)c]);
+    }
+    else
+    {
+        // three digits so a digit after it is not taken for part of it
+        buffer_write(buffer, '\\');
+        buffer_write(buffer, '0' + ((unsigned char)c >> 6));
+        buffer_write(buffer, '0' + ((unsigned char)c >> 3 & 7));
+        buffer_write(buffer, '0' + (c & 7));
+    }
+}
+
+/**
+ * Writes the token the way it would appear in the source code
+ */
+void token_write_spelling(struct buffer *buffer, struct token *token)
+{
+    switch (token->type)
+    {
+    case TOKEN_TYPE_NUMBER:
+        if (token->spelling)
+        {
+            buffer_write_bytes(buffer, token->spelling, strlen(token->spelling));
+            break;
+        }
+        buffer_printf(buffer, "%llu", token->llnum);
+        break;
+    case TOKEN_TYPE_SYMBOL:
+        buffer_write(buffer, token->cval);
+        break;
+    case TOKEN_TYPE_STRING:
+    {
+        bool system = token->flags & TOKEN_FLAG_SYSTEM_INCLUDE;
+        buffer_write(buffer, system ? '<' : '"');
+        for (size_t i = 0; i < token->length; i++)
+        {
+            token_write_string_char(buffer, token->sval[i], system);
+        }
+        buffer_write(buffer, system ? '>' : '"');
+    }
+    break;
+    case TOKEN_TYPE_IDENTIFIER:
+    case TOKEN_TYPE_KEYWORD:
+    case TOKEN_TYPE_OPERATOR:
+        buffer_printf(buffer, "%s", token->sval);
+        break;
+    }
 }
\ No newline at end of file
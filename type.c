@@ -0,0 +1,380 @@
+#include "compiler.h"
+#include <stdlib.h>
+#include <assert.h>
+
+#define TYPE_TABLE_INITIAL_CAPACITY 256
+
+/**
+ * The tag only tells structs apart when there is no defining node, laying a
+ * struct out later does not change which type it is
+ */
+static const char *type_key_tag(struct type *type)
+{
+    return type->struct_node == NODE_NONE ? type->tag : NULL;
+}
+
+/**
+ * Types are built from canonical parts, so hashing and comparing the parts by
+ * pointer is enough to find a structurally equal type
+ */
+static unsigned int type_hash(struct type *type)
+{
+    uint64_t hash = 1469598103934665603ull;
+    uint64_t parts[] = {type->kind, type->flags & ~TYPE_FLAG_COMPLETE, (uintptr_t)type->base, (uint64_t)type->length, type->struct_node, (uintptr_t)type_key_tag(type)};
+    for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); i++)
+    {
+        hash = (hash ^ parts[i]) * 1099511628211ull;
+    }
+
+    for (int i = 0; i < type->param_count; i++)
+    {
+        hash = (hash ^ (uintptr_t)type->params[i]) * 1099511628211ull;
+    }
+    return (unsigned int)(hash ^ (hash >> 32));
+}
+
+static bool type_equal_parts(struct type *type, struct type *other)
+{
+    if (type->kind != other->kind || ((type->flags ^ other->flags) & ~TYPE_FLAG_COMPLETE) || type->base != other->base ||
+        type->length != other->length || type->struct_node != other->struct_node || type_key_tag(type) != type_key_tag(other) ||
+        type->param_count != other->param_count)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < type->param_count; i++)
+    {
+        if (type->params[i] != other->params[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct type_table *type_table_create()
+{
+    struct type_table *table = calloc(1, sizeof(struct type_table));
+    table->capacity = TYPE_TABLE_INITIAL_CAPACITY;
+    table->entries = calloc(table->capacity, sizeof(struct type *));
+    return table;
+}
+
+void type_table_free(struct type_table *table)
+{
+    for (size_t i = 0; i < table->capacity; i++)
+    {
+        struct type *type = table->entries[i];
+        if (!type)
+        {
+            continue;
+        }
+        free(type->params);
+        free(type->members);
+        free(type);
+    }
+    free(table->entries);
+    free(table);
+}
+
+static struct type **type_table_slot(struct type_table *table, struct type *key, unsigned int hash)
+{
+    size_t mask = table->capacity - 1;
+    size_t index = hash & mask;
+    while (table->entries[index])
+    {
+        struct type *type = table->entries[index];
+        if (type->hash == hash && type_equal_parts(type, key))
+        {
+            return &table->entries[index];
+        }
+        index = (index + 1) & mask;
+    }
+    return &table->entries[index];
+}
+
+static void type_table_grow(struct type_table *table)
+{
+    struct type **old_entries = table->entries;
+    size_t old_capacity = table->capacity;
+    table->capacity *= 2;
+    table->entries = calloc(table->capacity, sizeof(struct type *));
+    for (size_t i = 0; i < old_capacity; i++)
+    {
+        struct type *type = old_entries[i];
+        if (type)
+        {
+            *type_table_slot(table, type, type->hash) = type;
+        }
+    }
+    free(old_entries);
+}
+
+static void type_compute_size(struct type *type)
+{
+    switch (type->kind)
+    {
+    case TYPE_VOID:
+    case TYPE_CHAR:
+    case TYPE_FUNCTION:
+        // GNU C lets void * and function pointers step a byte at a time
+        type->size = 1;
+        type->align = 1;
+        break;
+
+    case TYPE_SHORT:
+        type->size = 2;
+        type->align = 2;
+        break;
+
+    case TYPE_INT:
+    case TYPE_FLOAT:
+        type->size = 4;
+        type->align = 4;
+        break;
+
+    case TYPE_LONG:
+    case TYPE_DOUBLE:
+    case TYPE_POINTER:
+        type->size = 8;
+        type->align = 8;
+        break;
+
+    case TYPE_ARRAY:
+        type->size = type->length > 0 ? type->base->size * type->length : 0;
+        type->align = type->base->align;
+        break;
+
+    default:
+        // struct sizes are known once type_complete_struct lays them out
+        type->size = 0;
+        type->align = 1;
+        break;
+    }
+}
+
+/**
+ * Returns the canonical type equal to the key, the key is copied when it is new
+ * and the params array then belongs to the table
+ */
+static struct type *type_intern(struct type_table *table, struct type *key)
+{
+    key->hash = type_hash(key);
+    struct type **slot = type_table_slot(table, key, key->hash);
+    if (*slot)
+    {
+        return *slot;
+    }
+
+    if ((table->count + 1) * 4 > table->capacity * 3)
+    {
+        type_table_grow(table);
+        slot = type_table_slot(table, key, key->hash);
+    }
+
+    struct type *type = malloc(sizeof(struct type));
+    *type = *key;
+    if (key->param_count)
+    {
+        type->params = malloc(sizeof(struct type *) * key->param_count);
+        memcpy(type->params, key->params, sizeof(struct type *) * key->param_count);
+    }
+    type_compute_size(type);
+    *slot = type;
+    table->count++;
+    return type;
+}
+
+struct type *type_get_basic(struct type_table *table, int kind, int flags)
+{
+    struct type key = {.kind = kind, .flags = flags};
+    return type_intern(table, &key);
+}
+
+struct type *type_get_pointer(struct type_table *table, struct type *base)
+{
+    struct type key = {.kind = TYPE_POINTER, .base = base};
+    return type_intern(table, &key);
+}
+
+/**
+ * length is -1 for arrays declared with []
+ */
+struct type *type_get_array(struct type_table *table, struct type *base, long length)
+{
+    struct type key = {.kind = TYPE_ARRAY, .base = base, .length = length};
+    return type_intern(table, &key);
+}
+
+struct type *type_get_function(struct type_table *table, struct type *return_type, struct type **params, int total, bool variadic)
+{
+    struct type key = {
+        .kind = TYPE_FUNCTION,
+        .flags = variadic ? TYPE_FLAG_VARIADIC : 0,
+        .base = return_type,
+        .params = params,
+        .param_count = total};
+    return type_intern(table, &key);
+}
+
+/**
+ * Structs are the same type only when they come from the same definition,
+ * struct_node is NODE_NONE for structs that are only declared and then the tag names them
+ */
+struct type *type_get_struct(struct type_table *table, int kind, uint32_t struct_node, const char *tag)
+{
+    assert(kind == TYPE_STRUCT || kind == TYPE_UNION);
+    struct type key = {.kind = kind, .struct_node = struct_node, .tag = tag};
+    if (struct_node != NODE_NONE && struct_node > table->struct_node_max)
+    {
+        table->struct_node_max = struct_node;
+    }
+    return type_intern(table, &key);
+}
+
+// struct_node of a struct whose defining node was released, no node has this index
+#define TYPE_STRUCT_NODE_RELEASED UINT32_MAX
+
+/**
+ * The nodes from first on are about to be handed out again, structs they defined
+ * must not be found for the new nodes. Such a type stays in the table where it is
+ * but no key matches it anymore
+ */
+void type_table_release(struct type_table *table, uint32_t first)
+{
+    if (table->struct_node_max < first)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < table->capacity; i++)
+    {
+        struct type *type = table->entries[i];
+        if (type && (type->kind == TYPE_STRUCT || type->kind == TYPE_UNION) && type->struct_node != NODE_NONE && type->struct_node >= first)
+        {
+            type->struct_node = TYPE_STRUCT_NODE_RELEASED;
+        }
+    }
+    table->struct_node_max = first - 1;
+}
+
+/**
+ * Lays out the struct or union once, later calls for the same canonical type do nothing.
+ * The members array is copied
+ */
+void type_complete_struct(struct type *type, struct type_member *members, int total)
+{
+    if (type->flags & TYPE_FLAG_COMPLETE)
+    {
+        return;
+    }
+
+    type->members = malloc(sizeof(struct type_member) * (total ? total : 1));
+    memcpy(type->members, members, sizeof(struct type_member) * total);
+    type->member_count = total;
+
+    long offset = 0;
+    long size = 0;
+    int align = 1;
+    for (int i = 0; i < total; i++)
+    {
+        struct type_member *member = &type->members[i];
+        int member_align = member->type->align;
+        if (member_align > align)
+        {
+            align = member_align;
+        }
+
+        if (type->kind == TYPE_UNION)
+        {
+            member->offset = 0;
+            size = member->type->size > size ? member->type->size : size;
+            continue;
+        }
+
+        offset = (offset + member_align - 1) / member_align * member_align;
+        member->offset = offset;
+        offset += member->type->size;
+        size = offset;
+    }
+
+    type->size = (size + align - 1) / align * align;
+    type->align = align;
+    type->flags |= TYPE_FLAG_COMPLETE;
+}
+
+struct type_member *type_find_member(struct type *type, const char *name)
+{
+    for (int i = 0; i < type->member_count; i++)
+    {
+        if (type->members[i].name == name)
+        {
+            return &type->members[i];
+        }
+    }
+    return NULL;
+}
+
+bool type_is_integer(struct type *type)
+{
+    return type->kind >= TYPE_CHAR && type->kind <= TYPE_LONG;
+}
+
+bool type_is_arithmetic(struct type *type)
+{
+    return type->kind >= TYPE_CHAR && type->kind <= TYPE_DOUBLE;
+}
+
+bool type_is_scalar(struct type *type)
+{
+    return type_is_arithmetic(type) || type->kind == TYPE_POINTER;
+}
+
+bool type_is_unsigned(struct type *type)
+{
+    return type->kind == TYPE_POINTER || (type->flags & TYPE_FLAG_UNSIGNED);
+}
+
+/**
+ * Integers narrower than int are computed as int
+ */
+struct type *type_promote(struct type_table *table, struct type *type)
+{
+    if (type_is_integer(type) && type->kind < TYPE_INT)
+    {
+        return type_get_basic(table, TYPE_INT, 0);
+    }
+    return type;
+}
+
+/**
+ * The usual arithmetic conversions, the wider type wins and unsigned wins between equals
+ */
+struct type *type_common(struct type_table *table, struct type *type, struct type *other)
+{
+    type = type_promote(table, type);
+    other = type_promote(table, other);
+    if (type->kind != other->kind)
+    {
+        return type->kind > other->kind ? type : other;
+    }
+    return type->flags & TYPE_FLAG_UNSIGNED ? type : other;
+}
+
+/**
+ * Arrays become pointers to their first element and functions pointers to themselves
+ * when used as values
+ */
+struct type *type_decay(struct type_table *table, struct type *type)
+{
+    if (type->kind == TYPE_ARRAY)
+    {
+        return type_get_pointer(table, type->base);
+    }
+
+    if (type->kind == TYPE_FUNCTION)
+    {
+        return type_get_pointer(table, type);
+    }
+    return type;
+}
@@ -0,0 +1,977 @@
+#include "compiler.h"
+#include "helpers/hashmap.h"
+#include <elf.h>
+#include <stdlib.h>
+
+/**
+ * Machine code for the instructions the code generator emits. The peephole list
+ * of a function is encoded the way the GNU assembler encodes the same text.
+ * Jumps to local labels start out short and are widened until every one of them
+ * reaches, references to symbols become relocations of the object file
+ */
+
+// 16 bit names of the first eight registers, the others are spelled from these
+static const char x86_bases[8][2] = {"ax", "cx", "dx", "bx", "sp", "bp", "si", "di"};
+
+// base of rip relative memory operands
+#define X86_RIP X86_REGISTER_COUNT
+
+struct x86_opcode_name
+{
+    const char *name;
+    // condition code, or the opcode extension that goes in the reg field
+    int number;
+};
+
+static const struct x86_opcode_name x86_conditions[] = {
+    {"o", 0x0}, {"no", 0x1}, {"b", 0x2}, {"ae", 0x3}, {"e", 0x4}, {"ne", 0x5}, {"be", 0x6}, {"a", 0x7}, {"s", 0x8}, {"ns", 0x9}, {"p", 0xA}, {"np", 0xB}, {"l", 0xC}, {"ge", 0xD}, {"le", 0xE}, {"g", 0xF}};
+static const struct x86_opcode_name x86_arithmetic[] = {{"add", 0}, {"or", 1}, {"and", 4}, {"sub", 5}, {"xor", 6}, {"cmp", 7}};
+static const struct x86_opcode_name x86_shifts[] = {{"shl", 4}, {"shr", 5}, {"sar", 7}};
+static const struct x86_opcode_name x86_unary[] = {{"not", 2}, {"neg", 3}, {"div", 6}, {"idiv", 7}};
+
+// moves that widen a smaller source into the register
+static const struct x86_extension
+{
+    const char *name;
+    uint8_t opcode[2];
+    int opcode_length;
+    int size;
+    int source_size;
+} x86_extensions[] = {
+    {"movzbl", {0x0F, 0xB6}, 2, 4, 1},
+    {"movzwl", {0x0F, 0xB7}, 2, 4, 2},
+    {"movsbl", {0x0F, 0xBE}, 2, 4, 1},
+    {"movswl", {0x0F, 0xBF}, 2, 4, 2},
+    {"movzbq", {0x0F, 0xB6}, 2, 8, 1},
+    {"movzwq", {0x0F, 0xB7}, 2, 8, 2},
+    {"movsbq", {0x0F, 0xBE}, 2, 8, 1},
+    {"movswq", {0x0F, 0xBF}, 2, 8, 2},
+    {"movslq", {0x63}, 1, 8, 4}};
+
+#define X86_COUNT(table) ((int)(sizeof(table) / sizeof(table[0])))
+
+enum
+{
+    X86_OPERAND_REGISTER,
+    X86_OPERAND_IMMEDIATE,
+    // base register plus displacement, or rip relative to a symbol
+    X86_OPERAND_MEMORY,
+    // label or symbol a jump or call goes to
+    X86_OPERAND_TARGET,
+    // *%reg of an indirect jump or call
+    X86_OPERAND_INDIRECT
+};
+
+struct x86_operand
+{
+    int kind;
+    int reg;
+    // bytes of a register operand
+    int size;
+    // immediate, displacement or the offset from the symbol
+    long long value;
+    // name of the symbol, not terminated where it is followed by an offset or @
+    const char *symbol;
+    int symbol_length;
+    // R_X86_64_* the symbol is referred to with
+    int relocation;
+};
+
+// an instruction or label of the function
+struct x86_item
+{
+    uint8_t bytes[16];
+    int length;
+    bool is_label;
+    // jump to a local label, its bytes depend on the distance
+    bool is_branch;
+    // label the item defines or jumps to
+    int label;
+    // condition code of a branch, -1 for jmp
+    int condition;
+    bool is_long;
+    uint64_t offset;
+    // symbol the bytes refer to, the four bytes at relocation_at are filled by the linker
+    const char *symbol;
+    int symbol_length;
+    int relocation;
+    int relocation_at;
+    long long addend;
+};
+
+struct x86_assembler
+{
+    struct x86_item *items;
+    int item_count;
+    int item_capacity;
+    // local label name to id + 1
+    struct hashmap *labels;
+    int label_count;
+};
+
+static int x86_base_named(const char *name)
+{
+    for (int reg = 0; reg < 8; reg++)
+    {
+        if (x86_bases[reg][0] == name[0] && x86_bases[reg][1] == name[1])
+        {
+            return reg;
+        }
+    }
+    return X86_NO_REGISTER;
+}
+
+/**
+ * Register of a name without the %, every operand has one or two so this
+ * takes the name apart instead of comparing it against all 64 names
+ */
+static int x86_register_named(const char *name, size_t length, int *size)
+{
+    if (length >= 2 && name[0] == 'r' && name[1] >= '0' && name[1] <= '9')
+    {
+        // r8 to r15, d, w or b pick the lower parts
+        int reg = name[1] - '0';
+        size_t i = 2;
+        if (i < length && name[i] >= '0' && name[i] <= '9')
+        {
+            reg = reg * 10 + name[i++] - '0';
+        }
+
+        const char *suffix = i == length ? "" : i + 1 == length ? strchr("dwb", name[i]) : NULL;
+        if (reg < 8 || reg > 15 || !suffix || (i < length && !*suffix))
+        {
+            return X86_NO_REGISTER;
+        }
+        *size = !*suffix ? 8 : *suffix == 'd' ? 4 : *suffix == 'w' ? 2 : 1;
+        return reg;
+    }
+
+    int reg = X86_NO_REGISTER;
+    *size = 0;
+    switch (length)
+    {
+    case 2:
+        // ax or al
+        reg = x86_base_named(name);
+        *size = 2;
+        if (reg == X86_NO_REGISTER && name[1] == 'l')
+        {
+            char base[2] = {name[0], 'x'};
+            reg = x86_base_named(base);
+            *size = 1;
+        }
+        break;
+
+    case 3:
+        // rax, eax or spl
+        reg = x86_base_named(name + 1);
+        *size = name[0] == 'r' ? 8 : name[0] == 'e' ? 4 : 0;
+        if (name[2] == 'l' && reg == X86_NO_REGISTER)
+        {
+            reg = x86_base_named(name);
+            *size = reg >= 4 ? 1 : 0;
+        }
+        break;
+    }
+    return *size ? reg : X86_NO_REGISTER;
+}
+
+static int x86_lookup(const struct x86_opcode_name *table, int count, const char *name)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (S_EQ(table[i].name, name))
+        {
+            return table[i].number;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Reads an operand in the AT&T syntax the code generator writes
+ */
+static bool x86_parse_operand(const char *text, struct x86_operand *operand)
+{
+    memset(operand, 0, sizeof(struct x86_operand));
+    operand->reg = X86_NO_REGISTER;
+    char *end;
+    switch (text[0])
+    {
+    case '%':
+        operand->kind = X86_OPERAND_REGISTER;
+        operand->reg = x86_register_named(text + 1, strlen(text + 1), &operand->size);
+        return operand->reg != X86_NO_REGISTER;
+
+    case '$':
+        operand->kind = X86_OPERAND_IMMEDIATE;
+        operand->value = strtoll(text + 1, &end, 10);
+        return end != text + 1 && *end == 0;
+
+    case '*':
+        operand->kind = X86_OPERAND_INDIRECT;
+        if (text[1] == '%')
+        {
+            operand->reg = x86_register_named(text + 2, strlen(text + 2), &operand->size);
+        }
+        return operand->reg != X86_NO_REGISTER && operand->size == 8;
+    }
+
+    const char *open = strchr(text, '(');
+    if (!open)
+    {
+        operand->kind = X86_OPERAND_TARGET;
+        operand->symbol = text;
+        operand->symbol_length = strlen(text);
+        if (operand->symbol_length > 4 && S_EQ(text + operand->symbol_length - 4, "@PLT"))
+        {
+            operand->symbol_length -= 4;
+        }
+        operand->relocation = R_X86_64_PLT32;
+        return operand->symbol_length > 0;
+    }
+
+    size_t inside = strlen(open + 1);
+    if (inside < 2 || open[1] != '%' || open[inside] != ')')
+    {
+        return false;
+    }
+
+    operand->kind = X86_OPERAND_MEMORY;
+    if (inside == 5 && !strncmp(open + 2, "rip", 3))
+    {
+        operand->reg = X86_RIP;
+        operand->symbol = text;
+        const char *at = memchr(text, '@', open - text);
+        if (at)
+        {
+            operand->symbol_length = at - text;
+            operand->relocation = R_X86_64_REX_GOTPCRELX;
+            return open - at == 9 && !strncmp(at, "@GOTPCREL", 9);
+        }
+
+        const char *sign = text + 1;
+        while (sign < open && *sign != '+' && *sign != '-')
+        {
+            sign++;
+        }
+        operand->symbol_length = sign - text;
+        operand->relocation = R_X86_64_PC32;
+        if (sign < open)
+        {
+            operand->value = strtoll(sign, &end, 10);
+            return end == open;
+        }
+        return true;
+    }
+
+    int size;
+    operand->reg = x86_register_named(open + 2, inside - 2, &size);
+    if (operand->reg == X86_NO_REGISTER || size != 8)
+    {
+        return false;
+    }
+
+    if (open != text)
+    {
+        operand->value = strtoll(text, &end, 10);
+        return end == open;
+    }
+    return true;
+}
+
+static void x86_byte(struct x86_item *item, int byte)
+{
+    item->bytes[item->length++] = byte;
+}
+
+static void x86_immediate(struct x86_item *item, long long value, int size)
+{
+    for (int i = 0; i < size; i++)
+    {
+        x86_byte(item, (value >> (8 * i)) & 0xFF);
+    }
+}
+
+static bool x86_fits_int8(long long value)
+{
+    return value >= INT8_MIN && value <= INT8_MAX;
+}
+
+/**
+ * An immediate of an instruction on size bytes, the assembler takes values that
+ * fit the size either signed or unsigned and sees them as signed
+ */
+static bool x86_truncate_immediate(long long *value, int size)
+{
+    switch (size)
+    {
+    case 1:
+        if (*value < INT8_MIN || *value > UINT8_MAX)
+        {
+            return false;
+        }
+        *value = (int8_t)*value;
+        return true;
+
+    case 2:
+        if (*value < INT16_MIN || *value > UINT16_MAX)
+        {
+            return false;
+        }
+        *value = (int16_t)*value;
+        return true;
+
+    case 4:
+        if (*value < INT32_MIN || *value > UINT32_MAX)
+        {
+            return false;
+        }
+        *value = (int32_t)*value;
+        return true;
+    }
+    return *value >= INT32_MIN && *value <= INT32_MAX;
+}
+
+// bytes of the immediate of an instruction on size bytes, 64 bit ones sign extend 32
+static int x86_immediate_size(int size)
+{
+    return size == 8 ? 4 : size;
+}
+
+/**
+ * Prefixes, opcode, ModRM and the addressing bytes that follow for an instruction
+ * on size bytes. reg is a register or the opcode extension of the reg field and
+ * rm the register or memory operand
+ */
+static void x86_encode(struct x86_item *item, int size, const uint8_t *opcode, int opcode_length, int reg, bool reg_is_byte, struct x86_operand *rm)
+{
+    int rex = size == 8 ? 0x48 : 0;
+    rex |= reg >= 8 ? 0x44 : 0;
+    // spl, bpl, sil and dil only exist with a REX prefix
+    rex |= reg_is_byte && reg >= 4 ? 0x40 : 0;
+    if (rm->kind == X86_OPERAND_MEMORY)
+    {
+        rex |= rm->reg != X86_RIP && rm->reg >= 8 ? 0x41 : 0;
+    }
+    else
+    {
+        rex |= rm->reg >= 8 ? 0x41 : 0;
+        rex |= rm->size == 1 && rm->reg >= 4 ? 0x40 : 0;
+    }
+
+    if (size == 2)
+    {
+        x86_byte(item, 0x66);
+    }
+    if (rex)
+    {
+        x86_byte(item, rex);
+    }
+    for (int i = 0; i < opcode_length; i++)
+    {
+        x86_byte(item, opcode[i]);
+    }
+
+    if (rm->kind != X86_OPERAND_MEMORY)
+    {
+        x86_byte(item, 0xC0 | (reg & 7) << 3 | (rm->reg & 7));
+        return;
+    }
+
+    if (rm->reg == X86_RIP)
+    {
+        x86_byte(item, (reg & 7) << 3 | 5);
+        item->symbol = rm->symbol;
+        item->symbol_length = rm->symbol_length;
+        item->relocation = rm->relocation;
+        item->relocation_at = item->length;
+        item->addend = rm->value;
+        x86_immediate(item, 0, 4);
+        return;
+    }
+
+    // rbp and r13 need a displacement, rsp and r12 a SIB byte
+    int base = rm->reg & 7;
+    int mod = rm->value == 0 && base != 5 ? 0 : x86_fits_int8(rm->value) ? 1 : 2;
+    x86_byte(item, mod << 6 | (reg & 7) << 3 | base);
+    if (base == 4)
+    {
+        x86_byte(item, 0x24);
+    }
+    x86_immediate(item, rm->value, mod == 1 ? 1 : mod == 2 ? 4 : 0);
+}
+
+static void x86_encode1(struct x86_item *item, int size, int opcode, int reg, bool reg_is_byte, struct x86_operand *rm)
+{
+    uint8_t byte = opcode;
+    x86_encode(item, size, &byte, 1, reg, reg_is_byte, rm);
+}
+
+/**
+ * Opcodes with the register in their low three bits, push, pop and moves of immediates
+ */
+static void x86_encode_short(struct x86_item *item, int size, int opcode, int reg)
+{
+    int rex = (size == 8 ? 0x48 : 0) | (reg >= 8 ? 0x41 : 0) | (size == 1 && reg >= 4 ? 0x40 : 0);
+    if (size == 2)
+    {
+        x86_byte(item, 0x66);
+    }
+    if (rex)
+    {
+        x86_byte(item, rex);
+    }
+    x86_byte(item, opcode + (reg & 7));
+}
+
+static bool x86_is_rm(struct x86_operand *operand)
+{
+    return operand->kind == X86_OPERAND_REGISTER || operand->kind == X86_OPERAND_MEMORY;
+}
+
+static bool x86_branch(struct x86_assembler *assembler, struct x86_item *item, bool is_call, int condition, struct x86_operand *target)
+{
+    if (target->kind == X86_OPERAND_INDIRECT && condition < 0)
+    {
+        struct x86_operand reg = *target;
+        reg.kind = X86_OPERAND_REGISTER;
+        x86_encode1(item, 4, 0xFF, is_call ? 2 : 4, false, &reg);
+        return true;
+    }
+
+    if (target->kind != X86_OPERAND_TARGET)
+    {
+        return false;
+    }
+
+    void *label = target->symbol[target->symbol_length] ? NULL : hashmap_get(assembler->labels, target->symbol);
+    if (label && !is_call)
+    {
+        item->is_branch = true;
+        item->label = (int)(uintptr_t)label - 1;
+        item->condition = condition;
+        return true;
+    }
+
+    // calls and tail calls leave the function, anything else is a label we don't know
+    if (condition >= 0 || target->symbol[0] == '.')
+    {
+        return false;
+    }
+
+    x86_byte(item, is_call ? 0xE8 : 0xE9);
+    item->symbol = target->symbol;
+    item->symbol_length = target->symbol_length;
+    item->relocation = target->relocation;
+    item->relocation_at = item->length;
+    x86_immediate(item, 0, 4);
+    return true;
+}
+
+static bool x86_mov(struct x86_item *item, int size, struct x86_operand *from, struct x86_operand *to)
+{
+    long long value = from->value;
+    if (from->kind == X86_OPERAND_IMMEDIATE)
+    {
+        if (!x86_truncate_immediate(&value, size))
+        {
+            return false;
+        }
+
+        // gas only uses the short form where it is not longer
+        if (to->kind == X86_OPERAND_REGISTER && size != 8)
+        {
+            x86_encode_short(item, size, size == 1 ? 0xB0 : 0xB8, to->reg);
+            x86_immediate(item, value, size);
+            return true;
+        }
+        x86_encode1(item, size, size == 1 ? 0xC6 : 0xC7, 0, false, to);
+        x86_immediate(item, value, x86_immediate_size(size));
+        return true;
+    }
+
+    if (from->kind == X86_OPERAND_REGISTER)
+    {
+        x86_encode1(item, size, size == 1 ? 0x88 : 0x89, from->reg, size == 1, to);
+        return true;
+    }
+
+    if (to->kind != X86_OPERAND_REGISTER)
+    {
+        return false;
+    }
+    x86_encode1(item, size, size == 1 ? 0x8A : 0x8B, to->reg, size == 1, from);
+    return true;
+}
+
+static bool x86_arithmetic_op(struct x86_item *item, int digit, int size, struct x86_operand *from, struct x86_operand *to)
+{
+    long long value = from->value;
+    if (from->kind == X86_OPERAND_IMMEDIATE)
+    {
+        if (!x86_truncate_immediate(&value, size))
+        {
+            return false;
+        }
+
+        bool is_accumulator = to->kind == X86_OPERAND_REGISTER && to->reg == X86_RAX;
+        if (size != 1 && x86_fits_int8(value))
+        {
+            x86_encode1(item, size, 0x83, digit, false, to);
+            x86_immediate(item, value, 1);
+        }
+        else if (is_accumulator)
+        {
+            x86_encode_short(item, size, digit << 3 | (size == 1 ? 4 : 5), 0);
+            x86_immediate(item, value, x86_immediate_size(size));
+        }
+        else
+        {
+            x86_encode1(item, size, size == 1 ? 0x80 : 0x81, digit, false, to);
+            x86_immediate(item, value, x86_immediate_size(size));
+        }
+        return true;
+    }
+
+    if (from->kind == X86_OPERAND_REGISTER)
+    {
+        x86_encode1(item, size, digit << 3 | (size == 1 ? 0 : 1), from->reg, size == 1, to);
+        return true;
+    }
+
+    if (to->kind != X86_OPERAND_REGISTER)
+    {
+        return false;
+    }
+    x86_encode1(item, size, digit << 3 | (size == 1 ? 2 : 3), to->reg, size == 1, from);
+    return true;
+}
+
+/**
+ * Instructions whose mnemonic is a stem and a size suffix
+ */
+static bool x86_sized(struct x86_item *item, const char *stem, int size, struct x86_operand *operands, int count)
+{
+    struct x86_operand *from = &operands[0];
+    struct x86_operand *to = &operands[count - 1];
+    for (int i = 0; i < count; i++)
+    {
+        // the shift count is the only register of another size
+        bool is_count = i == 0 && count == 2 && x86_lookup(x86_shifts, X86_COUNT(x86_shifts), stem) >= 0;
+        if (operands[i].kind == X86_OPERAND_REGISTER && operands[i].size != size && !is_count)
+        {
+            return false;
+        }
+    }
+
+    int digit;
+    long long value = from->value;
+    if (count == 2 && !x86_is_rm(to))
+    {
+        return false;
+    }
+
+    if (count == 2 && S_EQ(stem, "mov"))
+    {
+        return x86_mov(item, size, from, to);
+    }
+
+    if (count == 2 && S_EQ(stem, "lea"))
+    {
+        if (from->kind != X86_OPERAND_MEMORY || to->kind != X86_OPERAND_REGISTER)
+        {
+            return false;
+        }
+        x86_encode1(item, size, 0x8D, to->reg, false, from);
+        return true;
+    }
+
+    if (count == 2 && (digit = x86_lookup(x86_arithmetic, X86_COUNT(x86_arithmetic), stem)) >= 0)
+    {
+        return x86_arithmetic_op(item, digit, size, from, to);
+    }
+
+    if (count == 2 && S_EQ(stem, "test"))
+    {
+        if (from->kind == X86_OPERAND_REGISTER)
+        {
+            x86_encode1(item, size, size == 1 ? 0x84 : 0x85, from->reg, size == 1, to);
+            return true;
+        }
+
+        if (from->kind != X86_OPERAND_IMMEDIATE || !x86_truncate_immediate(&value, size))
+        {
+            return false;
+        }
+
+        if (to->kind == X86_OPERAND_REGISTER && to->reg == X86_RAX)
+        {
+            x86_encode_short(item, size, size == 1 ? 0xA8 : 0xA9, 0);
+        }
+        else
+        {
+            x86_encode1(item, size, size == 1 ? 0xF6 : 0xF7, 0, false, to);
+        }
+        x86_immediate(item, value, x86_immediate_size(size));
+        return true;
+    }
+
+    if (count == 2 && S_EQ(stem, "imul") && size != 1)
+    {
+        if (to->kind != X86_OPERAND_REGISTER)
+        {
+            return false;
+        }
+
+        if (from->kind == X86_OPERAND_IMMEDIATE)
+        {
+            if (!x86_truncate_immediate(&value, size))
+            {
+                return false;
+            }
+            bool is_short = x86_fits_int8(value);
+            x86_encode1(item, size, is_short ? 0x6B : 0x69, to->reg, false, to);
+            x86_immediate(item, value, is_short ? 1 : x86_immediate_size(size));
+            return true;
+        }
+
+        static const uint8_t opcode[] = {0x0F, 0xAF};
+        x86_encode(item, size, opcode, 2, to->reg, false, from);
+        return true;
+    }
+
+    if (count == 2 && (digit = x86_lookup(x86_shifts, X86_COUNT(x86_shifts), stem)) >= 0)
+    {
+        if (from->kind == X86_OPERAND_REGISTER)
+        {
+            if (from->reg != X86_RCX || from->size != 1)
+            {
+                return false;
+            }
+            x86_encode1(item, size, size == 1 ? 0xD2 : 0xD3, digit, false, to);
+            return true;
+        }
+
+        if (from->kind != X86_OPERAND_IMMEDIATE || value < 0 || value > 255)
+        {
+            return false;
+        }
+
+        if (value == 1)
+        {
+            x86_encode1(item, size, size == 1 ? 0xD0 : 0xD1, digit, false, to);
+            return true;
+        }
+        x86_encode1(item, size, size == 1 ? 0xC0 : 0xC1, digit, false, to);
+        x86_immediate(item, value, 1);
+        return true;
+    }
+
+    if (count == 1 && (digit = x86_lookup(x86_unary, X86_COUNT(x86_unary), stem)) >= 0 && x86_is_rm(from))
+    {
+        x86_encode1(item, size, size == 1 ? 0xF6 : 0xF7, digit, false, from);
+        return true;
+    }
+
+    // push and pop are 64 bit without a REX prefix
+    if (count == 1 && size == 8 && S_EQ(stem, "push"))
+    {
+        switch (from->kind)
+        {
+        case X86_OPERAND_REGISTER:
+            x86_encode_short(item, 4, 0x50, from->reg);
+            return true;
+
+        case X86_OPERAND_IMMEDIATE:
+            if (!x86_truncate_immediate(&value, 8))
+            {
+                return false;
+            }
+            x86_byte(item, x86_fits_int8(value) ? 0x6A : 0x68);
+            x86_immediate(item, value, x86_fits_int8(value) ? 1 : 4);
+            return true;
+
+        case X86_OPERAND_MEMORY:
+            x86_encode1(item, 4, 0xFF, 6, false, from);
+            return true;
+        }
+        return false;
+    }
+
+    if (count == 1 && size == 8 && S_EQ(stem, "pop") && from->kind == X86_OPERAND_REGISTER)
+    {
+        x86_encode_short(item, 4, 0x58, from->reg);
+        return true;
+    }
+    return false;
+}
+
+static bool x86_instruction(struct x86_assembler *assembler, struct peephole_instruction *instruction, struct x86_item *item)
+{
+    const char *mnemonic = instruction->mnemonic;
+    int count = instruction->operand_count;
+    if (S_EQ(mnemonic, "rep") && count == 1)
+    {
+        bool is_movs = S_EQ(instruction->operands[0], "movsb");
+        if (!is_movs && !S_EQ(instruction->operands[0], "stosb"))
+        {
+            return false;
+        }
+        x86_byte(item, 0xF3);
+        x86_byte(item, is_movs ? 0xA4 : 0xAA);
+        return true;
+    }
+
+    struct x86_operand operands[2];
+    for (int i = 0; i < count; i++)
+    {
+        if (!x86_parse_operand(instruction->operands[i], &operands[i]))
+        {
+            return false;
+        }
+    }
+
+    if (count == 0)
+    {
+        static const struct x86_opcode_name plain[] = {{"ret", 0xC3}, {"leave", 0xC9}, {"cltd", 0x99}, {"cqto", 0x4899}};
+        int opcode = x86_lookup(plain, X86_COUNT(plain), mnemonic);
+        if (opcode < 0)
+        {
+            return false;
+        }
+
+        if (opcode > 0xFF)
+        {
+            x86_byte(item, opcode >> 8);
+        }
+        x86_byte(item, opcode & 0xFF);
+        return true;
+    }
+
+    if (count == 1 && (S_EQ(mnemonic, "jmp") || S_EQ(mnemonic, "call")))
+    {
+        return x86_branch(assembler, item, mnemonic[0] == 'c', -1, &operands[0]);
+    }
+
+    int condition;
+    if (count == 1 && mnemonic[0] == 'j')
+    {
+        condition = x86_lookup(x86_conditions, X86_COUNT(x86_conditions), mnemonic + 1);
+        return condition >= 0 && x86_branch(assembler, item, false, condition, &operands[0]);
+    }
+
+    if (count == 1 && !strncmp(mnemonic, "set", 3))
+    {
+        condition = x86_lookup(x86_conditions, X86_COUNT(x86_conditions), mnemonic + 3);
+        if (condition < 0 || operands[0].kind != X86_OPERAND_REGISTER || operands[0].size != 1)
+        {
+            return false;
+        }
+
+        uint8_t opcode[] = {0x0F, 0x90 + condition};
+        x86_encode(item, 1, opcode, 2, 0, false, &operands[0]);
+        return true;
+    }
+
+    if (count == 2 && S_EQ(mnemonic, "movabsq"))
+    {
+        if (operands[0].kind != X86_OPERAND_IMMEDIATE || operands[1].kind != X86_OPERAND_REGISTER || operands[1].size != 8)
+        {
+            return false;
+        }
+        x86_encode_short(item, 8, 0xB8, operands[1].reg);
+        x86_immediate(item, operands[0].value, 8);
+        return true;
+    }
+
+    for (int i = 0; i < X86_COUNT(x86_extensions); i++)
+    {
+        const struct x86_extension *extension = &x86_extensions[i];
+        if (!S_EQ(mnemonic, extension->name))
+        {
+            continue;
+        }
+
+        struct x86_operand *from = &operands[0];
+        struct x86_operand *to = &operands[1];
+        bool fits = count == 2 && to->kind == X86_OPERAND_REGISTER && to->size == extension->size &&
+                    (from->kind == X86_OPERAND_MEMORY || (from->kind == X86_OPERAND_REGISTER && from->size == extension->source_size));
+        if (!fits)
+        {
+            return false;
+        }
+        x86_encode(item, extension->size, extension->opcode, extension->opcode_length, to->reg, false, from);
+        return true;
+    }
+
+    size_t length = strlen(mnemonic);
+    char stem[sizeof(instruction->mnemonic)];
+    static const char suffixes[] = "bwlq";
+    const char *suffix = length > 1 ? strchr(suffixes, mnemonic[length - 1]) : NULL;
+    if (!suffix)
+    {
+        return false;
+    }
+    memcpy(stem, mnemonic, length - 1);
+    stem[length - 1] = 0;
+    return x86_sized(item, stem, 1 << (suffix - suffixes), operands, count);
+}
+
+static void x86_write_instruction(struct peephole_instruction *instruction, FILE *out)
+{
+    fprintf(out, "%s", instruction->mnemonic);
+    for (int i = 0; i < instruction->operand_count; i++)
+    {
+        fprintf(out, i == 0 ? " %s" : ", %s", instruction->operands[i]);
+    }
+}
+
+/**
+ * Gives every item its offset. Branches start short and the ones that don't
+ * reach are made long, which moves everything after them, until none changes
+ */
+static uint64_t x86_layout(struct x86_assembler *assembler)
+{
+    struct x86_item *items = assembler->items;
+    int count = assembler->item_count;
+    uint64_t *labels = calloc(assembler->label_count + 1, sizeof(uint64_t));
+    uint64_t offset;
+    bool changed = true;
+    while (changed)
+    {
+        offset = 0;
+        for (int i = 0; i < count; i++)
+        {
+            items[i].offset = offset;
+            if (items[i].is_label)
+            {
+                labels[items[i].label] = offset;
+            }
+            else if (items[i].is_branch)
+            {
+                offset += !items[i].is_long ? 2 : items[i].condition < 0 ? 5 : 6;
+            }
+            else
+            {
+                offset += items[i].length;
+            }
+        }
+
+        changed = false;
+        for (int i = 0; i < count; i++)
+        {
+            if (items[i].is_branch && !items[i].is_long &&
+                !x86_fits_int8((long long)labels[items[i].label] - (long long)(items[i].offset + 2)))
+            {
+                items[i].is_long = true;
+                changed = true;
+            }
+        }
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        struct x86_item *item = &items[i];
+        if (!item->is_branch)
+        {
+            continue;
+        }
+
+        if (!item->is_long)
+        {
+            x86_byte(item, item->condition < 0 ? 0xEB : 0x70 + item->condition);
+            x86_immediate(item, labels[item->label] - (item->offset + 2), 1);
+            continue;
+        }
+
+        if (item->condition >= 0)
+        {
+            x86_byte(item, 0x0F);
+            x86_byte(item, 0x80 + item->condition);
+        }
+        else
+        {
+            x86_byte(item, 0xE9);
+        }
+        x86_immediate(item, labels[item->label] - (item->offset + item->length + 4), 4);
+    }
+    free(labels);
+    return offset;
+}
+
+/**
+ * Appends the machine code of the instructions to .text and empties the list,
+ * false if one of them is not something this encoder knows
+ */
+bool x86_assemble(struct peephole *peephole, struct elf_object *object)
+{
+    struct x86_assembler assembler = {0};
+    assembler.labels = hashmap_create();
+
+    // labels first so forward jumps know them
+    for (uint32_t index = peephole->first; index != IR_NONE; index = peephole->instructions[index].next)
+    {
+        if (peephole->instructions[index].is_label)
+        {
+            hashmap_set(assembler.labels, peephole->instructions[index].operands[0], (void *)(uintptr_t)++assembler.label_count);
+        }
+    }
+
+    bool ok = true;
+    for (uint32_t index = peephole->first; index != IR_NONE && ok; index = peephole->instructions[index].next)
+    {
+        struct peephole_instruction *instruction = &peephole->instructions[index];
+        struct x86_item item = {.label = -1, .condition = -1};
+        if (instruction->is_label)
+        {
+            item.is_label = true;
+            item.label = (int)(uintptr_t)hashmap_get(assembler.labels, instruction->operands[0]) - 1;
+        }
+        else if (!x86_instruction(&assembler, instruction, &item))
+        {
+            fprintf(stderr, "Cannot encode \"");
+            x86_write_instruction(instruction, stderr);
+            fprintf(stderr, "\"\n");
+            ok = false;
+            break;
+        }
+
+        // rip relative addresses and calls count from the end of the instruction
+        if (item.symbol)
+        {
+            item.addend -= item.length - item.relocation_at;
+        }
+
+        if (assembler.item_count == assembler.item_capacity)
+        {
+            assembler.item_capacity = assembler.item_capacity ? assembler.item_capacity * 2 : 64;
+            assembler.items = realloc(assembler.items, sizeof(struct x86_item) * assembler.item_capacity);
+        }
+        assembler.items[assembler.item_count++] = item;
+    }
+
+    if (ok)
+    {
+        uint64_t base = object->sections[ELF_SECTION_TEXT].size;
+        uint64_t size = x86_layout(&assembler);
+        uint8_t *code = malloc(size ? size : 1);
+        struct x86_item *items = assembler.items;
+        for (int i = 0; i < assembler.item_count; i++)
+        {
+            memcpy(code + items[i].offset, items[i].bytes, items[i].length);
+            if (items[i].symbol)
+            {
+                uint32_t symbol = elf_symbol(object, items[i].symbol, items[i].symbol_length);
+                elf_relocate(object, ELF_SECTION_TEXT, base + items[i].offset + items[i].relocation_at, symbol, items[i].relocation, items[i].addend);
+            }
+        }
+        elf_append(object, ELF_SECTION_TEXT, code, size);
+        free(code);
+    }
+
+    free(assembler.items);
+    hashmap_free(assembler.labels);
+    peephole_clear(peephole);
+    return ok;
+}